@@ -0,0 +1,694 @@
+/*/
+/*  ** Capture.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the capture section, its writer and the pcapng reader.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Leslie Lamport, "Specifying Concurrent Program Modules", ACM TOPLAS 1983
+/*			* Single producer, single consumer ring where each side only ever writes its own index.
+/*		- IETF OPSAWG, "PCAP Now Generic (pcapng) Capture File Format", https://github.com/IETF-OPSAWG-WG/draft-ietf-opsawg-pcap
+/*			* Section header, interface description and enhanced packet blocks and their options.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "Capture.h"
+#include "Checksum.h"
+
+static_assert(sizeof(LB_CAPTURE_RECORD) == 64, "record header must fill one cache line");
+static_assert(sizeof(LB_CAPTURE_RING) == 128, "writer and reader side must each fill one cache line");
+
+// Sections are mapped into user mode a page at a time, nothing else may share their last page
+#define LB_CAPTURE_PAGE_SIZE 4096
+
+// Records start on 8 bytes, the padding record only needs its length and type
+#define LB_CAPTURE_ALIGN 8
+
+///////////////////////
+// WRITER STRUCTURES //
+///////////////////////
+
+// One per ring, only ever seen by the driver. The section is writable from user mode, so the writer
+// keeps its own copy of everything it reads back and only ever trusts tail as far as it is plausible.
+struct DECLSPEC_ALIGN(64) LB_CAPTURE_WRITER
+{
+	volatile LONG busy;			// Non-zero while a record is in progress
+	UINT32 head;				// Last head that was published
+};
+
+struct LB_CAPTURE
+{
+	UINT32 ringCount;
+	UINT32 ringSize;
+	UINT32 ringStride;
+	UINT8* rings;				// First ring in the section
+	LB_CAPTURE_WRITER* writers;	// Stored right after this struct
+};
+
+struct LB_CAPTURE_FILTER
+{
+	UINT32 ruleCount;
+	UINT32 processorCount;
+	LB_CAPTURE_RULE rules[LB_CAPTURE_MAX_RULES];	// Addresses already cut to their prefix
+	UINT32* countdowns;			// LB_CAPTURE_MAX_RULES per processor, covered packets left before the next one is captured
+};
+
+static_assert(LB_CAPTURE_MAX_RULES * sizeof(UINT32) % 64 == 0, "each processor's countdowns must fill whole cache lines");
+
+static inline LB_CAPTURE_RING* LbCaptureRing(UINT8* rings, UINT32 ringStride, UINT32 ring)
+{
+	return (LB_CAPTURE_RING*)(rings + (SIZE_T)ring * ringStride);
+}
+
+static inline UINT8* LbCaptureRecords(LB_CAPTURE_RING* ring)
+{
+	return (UINT8*)(ring + 1);
+}
+
+static inline UINT32 LbCapturePrefixMask(UINT8 prefixLength)
+{
+	return prefixLength == 0 ? 0 : ~(UINT32)0 << (32 - prefixLength);
+}
+
+//////////////////////////
+// CREATION AND CLEANUP //
+//////////////////////////
+
+SIZE_T LbCaptureSectionSize(UINT32 ringCount, UINT32 ringSize)
+{
+	SIZE_T headerSize = (sizeof(LB_CAPTURE_SECTION) + 63) & ~(SIZE_T)63;
+	SIZE_T size = headerSize + (SIZE_T)ringCount * (sizeof(LB_CAPTURE_RING) + ringSize);
+
+	return (size + LB_CAPTURE_PAGE_SIZE - 1) & ~(SIZE_T)(LB_CAPTURE_PAGE_SIZE - 1);
+}
+
+NTSTATUS LbCaptureCreate(void* section, SIZE_T size, UINT32 ringCount, UINT32 ringSize, LB_CAPTURE** capture)
+{
+	if (capture == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	*capture = NULL;
+
+	// Offsets in the section are 32-bit and a ring's head has to be able to wrap around many times over
+	if (section == NULL || ringCount == 0 || ringSize < LB_CAPTURE_PAGE_SIZE || ringSize > 0x10000000 || (ringSize & (ringSize - 1)) != 0)
+		return STATUS_INVALID_PARAMETER;
+	if (ringCount > (0xFFFFFFFF - LB_CAPTURE_PAGE_SIZE) / (sizeof(LB_CAPTURE_RING) + ringSize) || size < LbCaptureSectionSize(ringCount, ringSize))
+		return STATUS_INVALID_PARAMETER;
+
+	SIZE_T headerSize = (sizeof(LB_CAPTURE) + 63) & ~(SIZE_T)63;
+
+	LB_CAPTURE* result = (LB_CAPTURE*)LbAlloc(headerSize + sizeof(LB_CAPTURE_WRITER) * ringCount, 'LBC0');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	LB_CAPTURE_SECTION* header = (LB_CAPTURE_SECTION*)section;
+	header->magic = LB_CAPTURE_MAGIC;
+	header->version = LB_CAPTURE_VERSION;
+	header->ringCount = ringCount;
+	header->ringSize = ringSize;
+	header->ringOffset = (sizeof(LB_CAPTURE_SECTION) + 63) & ~63u;
+	header->ringStride = (UINT32)sizeof(LB_CAPTURE_RING) + ringSize;
+	header->frequency = LbTimestampFrequency();
+
+	result->ringCount = ringCount;
+	result->ringSize = ringSize;
+	result->ringStride = header->ringStride;
+	result->rings = (UINT8*)section + header->ringOffset;
+	result->writers = (LB_CAPTURE_WRITER*)((UINT8*)result + headerSize);
+
+	*capture = result;
+	return STATUS_SUCCESS;
+}
+
+void LbCaptureDestroy(LB_CAPTURE* capture)
+{
+	if (capture)
+		LbFree(capture, 'LBC0');
+}
+
+NTSTATUS LbCaptureFilterParse(const void* buffer, SIZE_T size, LB_CAPTURE_FILTER** filter)
+{
+	if (buffer == NULL || filter == NULL || size < sizeof(LB_CAPTURE_RULES_HEADER))
+		return STATUS_INVALID_PARAMETER;
+
+	*filter = NULL;
+
+	const LB_CAPTURE_RULES_HEADER* header = (const LB_CAPTURE_RULES_HEADER*)buffer;
+	const LB_CAPTURE_RULE* rules = (const LB_CAPTURE_RULE*)(header + 1);
+
+	if (header->version != LB_CAPTURE_RULES_VERSION || header->ruleCount > LB_CAPTURE_MAX_RULES)
+		return STATUS_INVALID_PARAMETER;
+	if (size != sizeof(LB_CAPTURE_RULES_HEADER) + sizeof(LB_CAPTURE_RULE) * header->ruleCount)
+		return STATUS_INVALID_PARAMETER;
+
+	for (UINT32 i = 0; i < header->ruleCount; i++)
+	{
+		const LB_CAPTURE_RULE* rule = &rules[i];
+
+		if (rule->prefixLength > 32 || rule->firstPort > rule->lastPort)
+			return STATUS_INVALID_PARAMETER;
+		if (rule->directions == 0 || (rule->directions & ~LB_RULE_DIRECTION_BOTH) != 0)
+			return STATUS_INVALID_PARAMETER;
+		if (rule->actions == 0 || (rule->actions & ~LB_CAPTURE_ACTION_ALL) != 0)
+			return STATUS_INVALID_PARAMETER;
+		if (rule->snapLength > LB_CAPTURE_MAX_SNAP || (rule->flags & ~LB_CAPTURE_RULE_REWRITTEN_ONLY) != 0)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	// Nothing to capture, callers take a NULL filter as capture being off
+	if (header->ruleCount == 0)
+		return STATUS_SUCCESS;
+
+	UINT32 processorCount = LbProcessorCount();
+	SIZE_T headerSize = (sizeof(LB_CAPTURE_FILTER) + 63) & ~(SIZE_T)63;
+
+	// LbAlloc zeroes the countdowns, the first packet each rule covers on a processor is captured
+	LB_CAPTURE_FILTER* result = (LB_CAPTURE_FILTER*)LbAlloc(headerSize + sizeof(UINT32) * LB_CAPTURE_MAX_RULES * processorCount, 'LBC1');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	result->ruleCount = header->ruleCount;
+	result->processorCount = processorCount;
+	result->countdowns = (UINT32*)((UINT8*)result + headerSize);
+
+	for (UINT32 i = 0; i < header->ruleCount; i++)
+	{
+		result->rules[i] = rules[i];
+		result->rules[i].address &= LbCapturePrefixMask(rules[i].prefixLength);
+	}
+
+	*filter = result;
+	return STATUS_SUCCESS;
+}
+
+void LbCaptureFilterFree(LB_CAPTURE_FILTER* filter)
+{
+	if (filter)
+		LbFree(filter, 'LBC1');
+}
+
+////////////
+// WRITER //
+////////////
+
+static inline BOOLEAN LbCaptureRuleCovers(const LB_CAPTURE_RULE* rule, const LB_CAPTURE_PACKET* packet)
+{
+	if (!(rule->directions & packet->direction) || !(rule->actions & (1 << packet->action)))
+		return FALSE;
+	if (rule->protocol != 0 && rule->protocol != packet->protocol)
+		return FALSE;
+	if (packet->remotePort < rule->firstPort || packet->remotePort > rule->lastPort)
+		return FALSE;
+	if ((rule->flags & LB_CAPTURE_RULE_REWRITTEN_ONLY) && !(packet->flags & LB_CAPTURE_FLAG_REWRITTEN))
+		return FALSE;
+
+	// Networks only ever cover IPv4 flows, like address rules
+	if (rule->prefixLength != 0)
+	{
+		if (packet->family != LB_FAMILY_IPV4)
+			return FALSE;
+		if ((LbReadBe32(packet->remoteAddress) & LbCapturePrefixMask(rule->prefixLength)) != rule->address)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOLEAN LbCaptureBegin(LB_CAPTURE* capture, const LB_CAPTURE_FILTER* filter, const LB_CAPTURE_PACKET* packet, LB_CAPTURE_SLOT* slot)
+{
+	UINT32 index = 0;
+
+	while (index < filter->ruleCount && !LbCaptureRuleCovers(&filter->rules[index], packet))
+		index++;
+	if (index == filter->ruleCount)
+		return FALSE;
+
+	// Every processor counts down on its own cache lines, so sampling takes no shared write
+	const LB_CAPTURE_RULE* rule = &filter->rules[index];
+	UINT32 processor = LbCurrentProcessor();
+	UINT32* countdown = &filter->countdowns[(SIZE_T)(processor % filter->processorCount) * LB_CAPTURE_MAX_RULES + index];
+
+	if (rule->sampleRate == 0)
+		return FALSE;
+	if (*countdown != 0)
+	{
+		(*countdown)--;
+		return FALSE;
+	}
+	*countdown = rule->sampleRate - 1;
+
+	UINT32 ringIndex = processor % capture->ringCount;
+	LB_CAPTURE_WRITER* writer = &capture->writers[ringIndex];
+	LB_CAPTURE_RING* ring = LbCaptureRing(capture->rings, capture->ringStride, ringIndex);
+
+	// Same as the event log: a ring is only ever owned already when the writer was preempted or moved
+	if (LbInterlockedCompareExchange(&writer->busy, 1, 0) != 0)
+	{
+		LbInterlockedIncrement(&ring->dropped);
+		return FALSE;
+	}
+
+	UINT32 captured = packet->length < rule->snapLength ? packet->length : rule->snapLength;
+	UINT32 length = (UINT32)(sizeof(LB_CAPTURE_RECORD) + captured + LB_CAPTURE_ALIGN - 1) & ~(UINT32)(LB_CAPTURE_ALIGN - 1);
+	UINT32 head = writer->head;
+	UINT32 offset = head & (capture->ringSize - 1);
+	UINT32 contiguous = capture->ringSize - offset;
+	UINT32 needed = length + (contiguous < length ? contiguous : 0);
+
+	// A tail that claims more was read than was written can only come from a broken reader, the ring counts as full
+	UINT32 used = head - (UINT32)LbReadAcquire(&ring->tail);
+	if (used > capture->ringSize || capture->ringSize - used < needed)
+	{
+		LbInterlockedIncrement(&ring->dropped);
+		LbWriteRelease(&writer->busy, 0);
+		return FALSE;
+	}
+
+	// Records never wrap, the end of the ring is skipped when the next one does not fit there
+	UINT8* records = LbCaptureRecords(ring);
+	if (contiguous < length)
+	{
+		LB_CAPTURE_RECORD* padding = (LB_CAPTURE_RECORD*)(records + offset);
+		padding->length = contiguous;
+		padding->type = LB_CAPTURE_RECORD_PADDING;
+		head += contiguous;
+		offset = 0;
+	}
+
+	LB_CAPTURE_RECORD* record = (LB_CAPTURE_RECORD*)(records + offset);
+	UINT32 addressBytes = packet->family == LB_FAMILY_IPV4 ? 4 : 16;
+
+	record->length = length;
+	record->type = LB_CAPTURE_RECORD_PACKET;
+	record->flags = packet->flags;
+	record->rule = (UINT8)index;
+	record->action = packet->action;
+	record->timestamp = LbTimestamp();
+	memset(record->localAddress, 0, sizeof(record->localAddress));
+	memset(record->remoteAddress, 0, sizeof(record->remoteAddress));
+	memcpy(record->localAddress, packet->localAddress, addressBytes);
+	memcpy(record->remoteAddress, packet->remoteAddress, addressBytes);
+	record->localPort = packet->localPort;
+	record->remotePort = packet->remotePort;
+	record->family = packet->family;
+	record->protocol = packet->protocol;
+	record->direction = packet->direction;
+	record->reserved = 0;
+	record->originalLength = packet->length;
+	record->capturedLength = 0;
+
+	slot->data = (UINT8*)(record + 1);
+	slot->capacity = captured;
+	slot->ring = ringIndex;
+	slot->head = head + length;
+	slot->record = record;
+	return TRUE;
+}
+
+void LbCaptureEnd(LB_CAPTURE* capture, LB_CAPTURE_SLOT* slot, UINT32 captured)
+{
+	LB_CAPTURE_WRITER* writer = &capture->writers[slot->ring];
+	LB_CAPTURE_RING* ring = LbCaptureRing(capture->rings, capture->ringStride, slot->ring);
+
+	slot->record->capturedLength = captured < slot->capacity ? captured : slot->capacity;
+
+	// Publishing head hands the record (and the padding before it) to the reader
+	writer->head = slot->head;
+	LbWriteRelease(&ring->head, (LONG)slot->head);
+	LbWriteRelease(&writer->busy, 0);
+}
+
+////////////
+// READER //
+////////////
+
+struct LB_CAPTURE_READER
+{
+	UINT32 ringCount;
+	UINT32 ringSize;
+	UINT32 ringStride;
+	UINT32 nextRing;			// First ring of the next drain
+	UINT8* rings;
+	UINT64 frequency;
+	LONG* droppedReported;		// Value of each ring's dropped at the previous drain, after this struct
+};
+
+NTSTATUS LbCaptureReaderOpen(void* section, SIZE_T size, LB_CAPTURE_READER** reader)
+{
+	if (reader == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	*reader = NULL;
+
+	const LB_CAPTURE_SECTION* header = (const LB_CAPTURE_SECTION*)section;
+	if (section == NULL || size < sizeof(LB_CAPTURE_SECTION))
+		return STATUS_INVALID_PARAMETER;
+	if (header->magic != LB_CAPTURE_MAGIC || header->version != LB_CAPTURE_VERSION || header->frequency == 0)
+		return STATUS_DATA_ERROR;
+	if (header->ringCount == 0 || header->ringSize < LB_CAPTURE_ALIGN || (header->ringSize & (header->ringSize - 1)) != 0)
+		return STATUS_DATA_ERROR;
+	if (header->ringOffset < sizeof(LB_CAPTURE_SECTION) || header->ringOffset % 64 != 0 || header->ringStride % 64 != 0)
+		return STATUS_DATA_ERROR;
+	if (header->ringStride < sizeof(LB_CAPTURE_RING) + (UINT64)header->ringSize)
+		return STATUS_DATA_ERROR;
+	if (header->ringOffset + (UINT64)header->ringStride * header->ringCount > size)
+		return STATUS_DATA_ERROR;
+
+	SIZE_T headerSize = (sizeof(LB_CAPTURE_READER) + 63) & ~(SIZE_T)63;
+
+	LB_CAPTURE_READER* result = (LB_CAPTURE_READER*)LbAlloc(headerSize + sizeof(LONG) * header->ringCount, 'LBC2');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	result->ringCount = header->ringCount;
+	result->ringSize = header->ringSize;
+	result->ringStride = header->ringStride;
+	result->rings = (UINT8*)section + header->ringOffset;
+	result->frequency = header->frequency;
+	result->droppedReported = (LONG*)((UINT8*)result + headerSize);
+
+	// Only drops from now on are reported
+	for (UINT32 i = 0; i < result->ringCount; i++)
+		result->droppedReported[i] = LbReadAcquire(&LbCaptureRing(result->rings, result->ringStride, i)->dropped);
+
+	*reader = result;
+	return STATUS_SUCCESS;
+}
+
+void LbCaptureReaderClose(LB_CAPTURE_READER* reader)
+{
+	if (reader)
+		LbFree(reader, 'LBC2');
+}
+
+////////////
+// PCAPNG //
+////////////
+
+#define LB_PCAPNG_SECTION_HEADER	0x0A0D0D0A
+#define LB_PCAPNG_INTERFACE			0x00000001
+#define LB_PCAPNG_ENHANCED_PACKET	0x00000006
+#define LB_PCAPNG_BYTE_ORDER		0x1A2B3C4D
+
+#define LB_PCAPNG_OPT_END			0
+#define LB_PCAPNG_OPT_COMMENT		1
+#define LB_PCAPNG_OPT_EPB_FLAGS		2
+#define LB_PCAPNG_OPT_IF_TSRESOL	9
+
+// Packets start with their IP header, IPv4 and IPv6 tell themselves apart by its version
+#define LB_PCAPNG_LINKTYPE_RAW		101
+
+// Fixed part of an enhanced packet block, without its data, options and trailing length
+#define LB_PCAPNG_PACKET_HEADER		28
+
+// Longest comment a packet gets, "rule 63, inspect, rewritten, queued, stream" fits
+#define LB_PCAPNG_COMMENT_MAX		64
+
+// IP header and transport header put back in front of the captured data
+#define LB_PCAPNG_HEADERS_MAX		(40 + 20)
+
+static_assert(LB_PCAPNG_PACKET_HEADER + LB_PCAPNG_HEADERS_MAX + LB_CAPTURE_MAX_SNAP + 3 + 12 + LB_PCAPNG_COMMENT_MAX + 8 <= LB_PCAPNG_BLOCK_MAX,
+	"every record must fit in LB_PCAPNG_BLOCK_MAX");
+
+// Blocks are written in the byte order of the machine writing them, readers find it from the byte order magic
+static inline UINT8* LbPcapngPut32(UINT8* p, UINT32 value)
+{
+	memcpy(p, &value, sizeof(value));
+	return p + sizeof(value);
+}
+
+static inline UINT8* LbPcapngPut16(UINT8* p, UINT16 value)
+{
+	memcpy(p, &value, sizeof(value));
+	return p + sizeof(value);
+}
+
+static inline UINT32 LbPcapngPad(UINT32 length)
+{
+	return (length + 3) & ~3u;
+}
+
+SIZE_T LbPcapngWriteHeader(UINT8* output, SIZE_T capacity)
+{
+	const UINT32 sectionLength = 28;
+	const UINT32 interfaceLength = 20 + 8 + 4;
+
+	if (output == NULL || capacity < sectionLength + interfaceLength)
+		return 0;
+
+	UINT8* p = output;
+
+	// Section header block without options, its length is left unknown
+	p = LbPcapngPut32(p, LB_PCAPNG_SECTION_HEADER);
+	p = LbPcapngPut32(p, sectionLength);
+	p = LbPcapngPut32(p, LB_PCAPNG_BYTE_ORDER);
+	p = LbPcapngPut16(p, 1);
+	p = LbPcapngPut16(p, 0);
+	p = LbPcapngPut32(p, 0xFFFFFFFF);
+	p = LbPcapngPut32(p, 0xFFFFFFFF);
+	p = LbPcapngPut32(p, sectionLength);
+
+	// The only interface, with timestamps in nanoseconds
+	p = LbPcapngPut32(p, LB_PCAPNG_INTERFACE);
+	p = LbPcapngPut32(p, interfaceLength);
+	p = LbPcapngPut16(p, LB_PCAPNG_LINKTYPE_RAW);
+	p = LbPcapngPut16(p, 0);
+	p = LbPcapngPut32(p, 0);
+	p = LbPcapngPut16(p, LB_PCAPNG_OPT_IF_TSRESOL);
+	p = LbPcapngPut16(p, 1);
+	p = LbPcapngPut32(p, 9);
+	p = LbPcapngPut16(p, LB_PCAPNG_OPT_END);
+	p = LbPcapngPut16(p, 0);
+	p = LbPcapngPut32(p, interfaceLength);
+
+	return (SIZE_T)(p - output);
+}
+
+static UINT32 LbPcapngAppend(char* comment, UINT32 length, const char* text)
+{
+	while (*text && length < LB_PCAPNG_COMMENT_MAX)
+		comment[length++] = *text++;
+	return length;
+}
+
+// What the classify path did with a packet, as the packet's comment
+static UINT32 LbPcapngComment(const LB_CAPTURE_RECORD* record, char* comment)
+{
+	static const char* const actions[] = { "permit", "block", "inspect" };
+	char number[3] = { 0 };
+	UINT32 digits = 0;
+	UINT32 length = 0;
+
+	// Rules never go past two digits
+	if (record->rule >= 10)
+		number[digits++] = (char)('0' + record->rule / 10 % 10);
+	number[digits++] = (char)('0' + record->rule % 10);
+
+	length = LbPcapngAppend(comment, length, "rule ");
+	length = LbPcapngAppend(comment, length, number);
+	length = LbPcapngAppend(comment, length, ", ");
+	length = LbPcapngAppend(comment, length, record->action < 3 ? actions[record->action] : "unknown");
+
+	if (record->flags & LB_CAPTURE_FLAG_REWRITTEN)
+		length = LbPcapngAppend(comment, length, ", rewritten");
+	if (record->flags & LB_CAPTURE_FLAG_QUEUED)
+		length = LbPcapngAppend(comment, length, ", queued");
+	if (record->flags & LB_CAPTURE_FLAG_STREAM)
+		length = LbPcapngAppend(comment, length, ", stream");
+
+	return length;
+}
+
+// Build the IP header and, when the record has none, the transport header that go in front of its data.
+// transportLength receives how much of the result is the transport header. Returns the total length.
+static UINT32 LbPcapngHeaders(const LB_CAPTURE_RECORD* record, UINT8* headers, UINT32* transportLength)
+{
+	BOOLEAN outbound = record->direction == LB_RULE_DIRECTION_OUTBOUND;
+	const UINT8* source = outbound ? record->localAddress : record->remoteAddress;
+	const UINT8* destination = outbound ? record->remoteAddress : record->localAddress;
+	UINT16 sourcePort = outbound ? record->localPort : record->remotePort;
+	UINT16 destinationPort = outbound ? record->remotePort : record->localPort;
+	UINT32 ipLength = record->family == LB_FAMILY_IPV4 ? 20 : 40;
+	UINT8* transport = headers + ipLength;
+
+	*transportLength = 0;
+	if (!(record->flags & LB_CAPTURE_FLAG_HEADER))
+	{
+		if (record->protocol == LB_IPPROTO_TCP)
+		{
+			// Sequence numbers are not recorded, the segment is only marked as carrying data
+			memset(transport, 0, 20);
+			LbWriteBe16(&transport[0], sourcePort);
+			LbWriteBe16(&transport[2], destinationPort);
+			transport[12] = 5 << 4;
+			transport[13] = 0x18;	// PSH, ACK
+			LbWriteBe16(&transport[14], 0xFFFF);
+			*transportLength = 20;
+		}
+		else if (record->protocol == LB_IPPROTO_UDP)
+		{
+			UINT32 udpLength = 8 + record->originalLength;
+
+			memset(transport, 0, 8);
+			LbWriteBe16(&transport[0], sourcePort);
+			LbWriteBe16(&transport[2], destinationPort);
+			LbWriteBe16(&transport[4], udpLength > 0xFFFF ? 0 : (UINT16)udpLength);
+			*transportLength = 8;
+		}
+	}
+
+	// Stream records can be longer than one packet, their length fields are capped
+	UINT32 payloadLength = *transportLength + record->originalLength;
+	if (record->family == LB_FAMILY_IPV4)
+	{
+		UINT32 totalLength = ipLength + payloadLength;
+
+		memset(headers, 0, 20);
+		headers[0] = 0x45;
+		LbWriteBe16(&headers[2], totalLength > 0xFFFF ? 0xFFFF : (UINT16)totalLength);
+		LbWriteBe16(&headers[6], 0x4000);	// Don't fragment
+		headers[8] = 64;
+		headers[9] = record->protocol;
+		memcpy(&headers[12], source, 4);
+		memcpy(&headers[16], destination, 4);
+		LbWriteBe16(&headers[10], LbChecksumFinish(LbChecksumAdd(0, headers, 20)));
+	}
+	else
+	{
+		memset(headers, 0, 8);
+		headers[0] = 0x60;
+		LbWriteBe16(&headers[4], payloadLength > 0xFFFF ? 0xFFFF : (UINT16)payloadLength);
+		headers[6] = record->protocol;
+		headers[7] = 64;
+		memcpy(&headers[8], source, 16);
+		memcpy(&headers[24], destination, 16);
+	}
+
+	return ipLength + *transportLength;
+}
+
+static inline UINT64 LbPcapngTime(const LB_CAPTURE_READER* reader, const LB_PCAPNG_CLOCK* clock, UINT64 timestamp)
+{
+	// Split into seconds first, ticks times 10^9 overflows after a few hours
+	BOOLEAN before = timestamp < clock->timestamp;
+	UINT64 ticks = before ? clock->timestamp - timestamp : timestamp - clock->timestamp;
+	UINT64 nanoseconds = ticks / reader->frequency * 1000000000ull + ticks % reader->frequency * 1000000000ull / reader->frequency;
+
+	return before ? clock->epochNanoseconds - nanoseconds : clock->epochNanoseconds + nanoseconds;
+}
+
+// Write one record as an enhanced packet block, returns its length or 0 when it does not fit in capacity
+static SIZE_T LbPcapngPacket(const LB_CAPTURE_READER* reader, const LB_PCAPNG_CLOCK* clock, const LB_CAPTURE_RECORD* record, UINT8* output, SIZE_T capacity)
+{
+	UINT8 headers[LB_PCAPNG_HEADERS_MAX];
+	char comment[LB_PCAPNG_COMMENT_MAX];
+	UINT32 transportLength;
+	UINT32 headerLength = LbPcapngHeaders(record, headers, &transportLength);
+	UINT32 commentLength = LbPcapngComment(record, comment);
+	UINT32 captured = headerLength + record->capturedLength;
+	UINT64 original = (UINT64)headerLength + record->originalLength;
+	UINT32 optionsLength = 8 + 4 + LbPcapngPad(commentLength) + 4;
+	UINT32 blockLength = LB_PCAPNG_PACKET_HEADER + LbPcapngPad(captured) + optionsLength + 4;
+
+	if (blockLength > capacity)
+		return 0;
+
+	UINT64 time = LbPcapngTime(reader, clock, record->timestamp);
+	UINT8* p = output;
+
+	p = LbPcapngPut32(p, LB_PCAPNG_ENHANCED_PACKET);
+	p = LbPcapngPut32(p, blockLength);
+	p = LbPcapngPut32(p, 0);
+	p = LbPcapngPut32(p, (UINT32)(time >> 32));
+	p = LbPcapngPut32(p, (UINT32)time);
+	p = LbPcapngPut32(p, captured);
+	p = LbPcapngPut32(p, original > 0xFFFFFFFF ? 0xFFFFFFFF : (UINT32)original);
+
+	memcpy(p, headers, headerLength);
+	memcpy(p + headerLength, record + 1, record->capturedLength);
+	memset(p + captured, 0, LbPcapngPad(captured) - captured);
+	p += LbPcapngPad(captured);
+
+	// Direction in the low bits of the flags, 1 inbound and 2 outbound
+	p = LbPcapngPut16(p, LB_PCAPNG_OPT_EPB_FLAGS);
+	p = LbPcapngPut16(p, 4);
+	p = LbPcapngPut32(p, record->direction == LB_RULE_DIRECTION_OUTBOUND ? 2 : 1);
+
+	p = LbPcapngPut16(p, LB_PCAPNG_OPT_COMMENT);
+	p = LbPcapngPut16(p, (UINT16)commentLength);
+	memcpy(p, comment, commentLength);
+	memset(p + commentLength, 0, LbPcapngPad(commentLength) - commentLength);
+	p += LbPcapngPad(commentLength);
+
+	p = LbPcapngPut16(p, LB_PCAPNG_OPT_END);
+	p = LbPcapngPut16(p, 0);
+	p = LbPcapngPut32(p, blockLength);
+
+	return (SIZE_T)(p - output);
+}
+
+SIZE_T LbCaptureDrainPcapng(LB_CAPTURE_READER* reader, const LB_PCAPNG_CLOCK* clock, UINT8* output, SIZE_T capacity, UINT64* dropped)
+{
+	SIZE_T written = 0;
+	UINT64 lost = 0;
+	BOOLEAN full = FALSE;
+
+	for (UINT32 n = 0; n < reader->ringCount && !full; n++)
+	{
+		UINT32 index = (reader->nextRing + n) % reader->ringCount;
+		LB_CAPTURE_RING* ring = LbCaptureRing(reader->rings, reader->ringStride, index);
+		const UINT8* records = LbCaptureRecords(ring);
+
+		// Everything up to head is complete once head has been read
+		UINT32 head = (UINT32)LbReadAcquire(&ring->head);
+		UINT32 tail = (UINT32)ring->tail;
+		LONG droppedNow = LbReadAcquire(&ring->dropped);
+
+		lost += (UINT32)droppedNow - (UINT32)reader->droppedReported[index];
+		reader->droppedReported[index] = droppedNow;
+
+		while (tail != head)
+		{
+			UINT32 offset = tail & (reader->ringSize - 1);
+			const LB_CAPTURE_RECORD* record = (const LB_CAPTURE_RECORD*)(records + offset);
+
+			// Head only ever moves by whole records, a tail off their alignment reads as no record at all
+			UINT32 length = offset % LB_CAPTURE_ALIGN == 0 ? record->length : 0;
+
+			// Only a ring that was written to by something other than the driver gets here, skip what is in it
+			if (length < LB_CAPTURE_ALIGN || length % LB_CAPTURE_ALIGN != 0 || length > head - tail || length > reader->ringSize - offset ||
+				(record->type == LB_CAPTURE_RECORD_PACKET && (length < sizeof(LB_CAPTURE_RECORD) ||
+					record->capturedLength > length - sizeof(LB_CAPTURE_RECORD) || record->family >= LB_FAMILY_COUNT)))
+			{
+				tail = head;
+				break;
+			}
+
+			if (record->type == LB_CAPTURE_RECORD_PACKET)
+			{
+				SIZE_T blockLength = LbPcapngPacket(reader, clock, record, output + written, capacity - written);
+				if (blockLength == 0)
+				{
+					full = TRUE;
+					break;
+				}
+				written += blockLength;
+			}
+
+			tail += length;
+		}
+
+		// Releasing tail hands the space back to the writer
+		LbWriteRelease(&ring->tail, (LONG)tail);
+	}
+
+	// Start on the next ring each time, so a small buffer cannot keep missing the last processors
+	reader->nextRing = (reader->nextRing + 1) % reader->ringCount;
+
+	if (dropped) *dropped = lost;
+	return written;
+}
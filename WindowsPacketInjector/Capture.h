@@ -0,0 +1,113 @@
+/*/
+/*  ** Capture.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for packet capture, sampled records of what the classify path saw and decided.
+/*	The driver writes records into a capture section (see LB_CAPTURE_SECTION in Ioctl.h), one ring per
+/*	processor, and user mode maps that same memory and reads them where they are. Nothing is copied
+/*	twice and reading costs no system call. Capture rules pick the packets: the first rule covering a packet
+/*	decides whether it is recorded, one in how many of them and how many of its bytes.
+/*
+/*	The reader turns records into pcapng, so a file written from a batch of them opens in Wireshark.
+/*	It only needs the section, which is why it builds as part of this portable file like the writer.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+#include "VerdictCache.h"
+
+// Record bytes each processor can hold until they are read
+#define LB_CAPTURE_RING_SIZE 0x40000
+
+// Longest block LbCaptureDrainPcapng writes for one record
+#define LB_PCAPNG_BLOCK_MAX (LB_CAPTURE_MAX_SNAP + 256)
+
+struct LB_CAPTURE;
+struct LB_CAPTURE_FILTER;
+struct LB_CAPTURE_READER;
+
+// What the classify path knows about a packet it offers to the capture
+struct LB_CAPTURE_PACKET
+{
+	const UINT8* localAddress;	// Network byte order, 4 or 16 bytes depending on family
+	const UINT8* remoteAddress;
+	UINT16 localPort;
+	UINT16 remotePort;
+	UINT8 family;				// LB_ADDRESS_FAMILY
+	UINT8 protocol;
+	UINT8 direction;			// LB_RULE_DIRECTION_OUTBOUND or LB_RULE_DIRECTION_INBOUND
+	UINT8 action;				// LB_RULE_ACTION
+	UINT8 flags;				// LB_CAPTURE_FLAG_*
+	UINT32 length;				// Bytes of data
+};
+
+// A record that was started and not published yet
+struct LB_CAPTURE_SLOT
+{
+	UINT8* data;				// Where the packet's data goes
+	UINT32 capacity;			// Bytes of it the record has room for
+	UINT32 ring;
+	UINT32 head;				// Head of the ring once the record is published
+	LB_CAPTURE_RECORD* record;
+};
+
+////////////////////////
+// SECTION AND WRITER //
+////////////////////////
+
+// Bytes a section of ringCount rings of ringSize bytes takes up, a multiple of the page size
+SIZE_T LbCaptureSectionSize(UINT32 ringCount, UINT32 ringSize);
+
+// Lay a section out in size bytes of zeroed memory and create the writer that fills it. ringSize must be a power
+// of two. The memory stays the caller's and has to outlive the writer.
+NTSTATUS LbCaptureCreate(void* section, SIZE_T size, UINT32 ringCount, UINT32 ringSize, LB_CAPTURE** capture);
+
+// Free a writer, no record may be in progress
+void LbCaptureDestroy(LB_CAPTURE* capture);
+
+// Build a filter from an IOCTL_LB_SET_CAPTURE buffer. A buffer without rules gives a NULL filter.
+NTSTATUS LbCaptureFilterParse(const void* buffer, SIZE_T size, LB_CAPTURE_FILTER** filter);
+
+// Free a filter returned by LbCaptureFilterParse
+void LbCaptureFilterFree(LB_CAPTURE_FILTER* filter);
+
+// Decide whether a packet is captured and start its record on the current processor's ring. Returns FALSE
+// when no rule covers it, its rule skips it or the ring is full. Otherwise the caller copies up to
+// slot->capacity bytes of its data to slot->data and calls LbCaptureEnd on the same processor.
+BOOLEAN LbCaptureBegin(LB_CAPTURE* capture, const LB_CAPTURE_FILTER* filter, const LB_CAPTURE_PACKET* packet, LB_CAPTURE_SLOT* slot);
+
+// Publish a record, captured is the number of bytes that were copied
+void LbCaptureEnd(LB_CAPTURE* capture, LB_CAPTURE_SLOT* slot, UINT32 captured);
+
+////////////
+// READER //
+////////////
+
+// Turns record timestamps into wall clock time: timestamp ticks is epochNanoseconds after 1970
+struct LB_PCAPNG_CLOCK
+{
+	UINT64 timestamp;
+	UINT64 epochNanoseconds;
+};
+
+// Start reading a mapped section of size bytes, its layout is checked first. Only one reader at a time.
+NTSTATUS LbCaptureReaderOpen(void* section, SIZE_T size, LB_CAPTURE_READER** reader);
+
+void LbCaptureReaderClose(LB_CAPTURE_READER* reader);
+
+// Write the section header and interface description blocks a pcapng file starts with.
+// Returns the number of bytes written, 0 when they do not fit in capacity.
+SIZE_T LbPcapngWriteHeader(UINT8* output, SIZE_T capacity);
+
+// Move as many records out of the rings as fit into output, each one as a pcapng enhanced packet block with
+// an IPv4 or IPv6 header (and the transport header, when the record has none) put back in front of its data.
+// Returns the number of bytes written. dropped receives the records the driver dropped since the previous drain.
+// An output of at least LB_PCAPNG_BLOCK_MAX bytes always has room for the next record.
+SIZE_T LbCaptureDrainPcapng(LB_CAPTURE_READER* reader, const LB_PCAPNG_CLOCK* clock, UINT8* output, SIZE_T capacity, UINT64* dropped);
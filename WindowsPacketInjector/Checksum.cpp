@@ -0,0 +1,210 @@
+/*/
+/*  ** Checksum.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the Internet checksum helpers.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- R. Braden, D. Borman, C. Partridge, RFC 1071 "Computing the Internet Checksum", https://www.rfc-editor.org/rfc/rfc1071
+/*		- A. Rijsinghani, RFC 1624 "Computation of the Internet Checksum via Incremental Update", https://www.rfc-editor.org/rfc/rfc1624
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "Checksum.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LB_CHECKSUM_SSE2 1
+#endif
+
+///////////////////
+// FULL CHECKSUM //
+///////////////////
+
+static inline UINT32 LbChecksumFold(UINT64 sum)
+{
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return (UINT32)sum;
+}
+
+static inline UINT32 LbChecksumSwap(UINT32 folded)
+{
+	return ((folded & 0xFF) << 8) | (folded >> 8);
+}
+
+// The one's complement sum comes out the same whichever byte order the words are added in, it only has to be
+// swapped back once at the end (RFC 1071 section 2). So the words are added as they load, 32 bits at a time
+// into 64-bit lanes that hold every carry until the fold. Only SSE2 is used, like the match engine's prefilter.
+UINT32 LbChecksumAdd(UINT32 sum, const UINT8* data, SIZE_T length)
+{
+	UINT64 wide = 0;
+	UINT32 folded;
+	SIZE_T i = 0;
+
+#if defined(LB_CHECKSUM_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i low = zero;
+	__m128i high = zero;
+
+	for (; i + 32 <= length; i += 32)
+	{
+		__m128i first = _mm_loadu_si128((const __m128i*)&data[i]);
+		__m128i second = _mm_loadu_si128((const __m128i*)&data[i + 16]);
+
+		low = _mm_add_epi64(low, _mm_unpacklo_epi32(first, zero));
+		high = _mm_add_epi64(high, _mm_unpackhi_epi32(first, zero));
+		low = _mm_add_epi64(low, _mm_unpacklo_epi32(second, zero));
+		high = _mm_add_epi64(high, _mm_unpackhi_epi32(second, zero));
+	}
+
+	UINT64 lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(low, high));
+	wide = lanes[0] + lanes[1];
+#endif
+
+	for (; i + 4 <= length; i += 4)
+	{
+		UINT32 word;
+		memcpy(&word, &data[i], sizeof(word));
+		wide += word;
+	}
+
+	folded = LbChecksumFold(wide);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	folded = LbChecksumSwap(folded);
+#endif
+
+	for (; i + 1 < length; i += 2)
+		folded += LbReadBe16(&data[i]);
+
+	// Odd trailing byte is padded with a zero
+	if (i < length)
+		folded += (UINT32)data[i] << 8;
+
+	// Folding the running sum first keeps it from overflowing, however many buffers are added to it
+	return (sum & 0xFFFF) + (sum >> 16) + folded;
+}
+
+UINT32 LbChecksumAddAt(UINT32 sum, SIZE_T offset, const UINT8* data, SIZE_T length)
+{
+	if ((offset & 1) == 0)
+		return LbChecksumAdd(sum, data, length);
+
+	// Summed as if it started a word, then every byte is moved to the other half of its word
+	return sum + LbChecksumSwap(LbChecksumFold(LbChecksumAdd(0, data, length)));
+}
+
+UINT16 LbChecksumFinish(UINT32 sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return (UINT16)~sum;
+}
+
+UINT32 LbPseudoHeaderSumV4(UINT32 sourceAddress, UINT32 destinationAddress, UINT8 protocol, SIZE_T length)
+{
+	UINT32 sum = 0;
+
+	sum += sourceAddress >> 16;
+	sum += sourceAddress & 0xFFFF;
+	sum += destinationAddress >> 16;
+	sum += destinationAddress & 0xFFFF;
+	sum += protocol;
+	sum += (UINT32)length;
+
+	return sum;
+}
+
+UINT16 LbTransportChecksumV4(UINT32 sourceAddress, UINT32 destinationAddress, UINT8 protocol, const UINT8* segment, SIZE_T length)
+{
+	UINT32 sum = LbPseudoHeaderSumV4(sourceAddress, destinationAddress, protocol, length);
+
+	return LbChecksumFinish(LbChecksumAdd(sum, segment, length));
+}
+
+////////////////////////
+// INCREMENTAL UPDATE //
+////////////////////////
+
+UINT16 LbChecksumUpdate32(UINT16 checksum, UINT32 oldValue, UINT32 newValue)
+{
+	// HC' = ~(~HC + ~m + m'), one 16-bit half at a time
+	UINT32 sum = (UINT16)~checksum;
+	sum += (UINT16)~(oldValue >> 16);
+	sum += (UINT16)~(oldValue & 0xFFFF);
+	sum += newValue >> 16;
+	sum += newValue & 0xFFFF;
+
+	return LbChecksumFinish(sum);
+}
+
+void LbChecksumEditsBegin(LB_CHECKSUM_EDITS* edits, SIZE_T limit)
+{
+	edits->sum = 0;
+	edits->count = 0;
+	edits->cost = 0;
+	edits->limit = limit;
+	edits->base = 0;
+}
+
+void LbChecksumEdit(LB_CHECKSUM_EDITS* edits, SIZE_T offset, const UINT8* before, const UINT8* after, SIZE_T length)
+{
+	edits->count++;
+	edits->cost += LB_CHECKSUM_EDIT_COST + LB_CHECKSUM_EDIT_BYTE_COST * length;
+
+	// Given up on already, only the count still matters
+	if (LbChecksumEditsExceeded(edits))
+		return;
+
+	// ~m + m' over the changed words, both sides aligned the same way within the segment (RFC 1624 eqn. 3)
+	SIZE_T position = edits->base + offset;
+	UINT32 removed = 0;
+	UINT32 added = 0;
+
+	// Most replacements are a few bytes long, a word at a time beats setting up the wide sum for them
+	if (length < 32)
+	{
+		SIZE_T i = 0;
+
+		if (position & 1)
+		{
+			removed += before[0];
+			added += after[0];
+			i = 1;
+		}
+
+		for (; i + 1 < length; i += 2)
+		{
+			removed += LbReadBe16(&before[i]);
+			added += LbReadBe16(&after[i]);
+		}
+
+		if (i < length)
+		{
+			removed += (UINT32)before[i] << 8;
+			added += (UINT32)after[i] << 8;
+		}
+	}
+	else
+	{
+		removed = LbChecksumAddAt(0, position, before, length);
+		added = LbChecksumAddAt(0, position, after, length);
+	}
+
+	edits->sum = LbChecksumFold((UINT64)edits->sum + (UINT16)~LbChecksumFold(removed) + LbChecksumFold(added));
+}
+
+UINT16 LbChecksumApplyEdits(UINT16 checksum, const LB_CHECKSUM_EDITS* edits)
+{
+	// HC' = ~(~HC + ~m + m')
+	return LbChecksumFinish((UINT32)(UINT16)~checksum + edits->sum);
+}
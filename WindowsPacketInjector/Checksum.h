@@ -0,0 +1,95 @@
+/*/
+/*  ** Checksum.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the Internet checksum helpers used when a rewritten packet is injected.
+/*	Values are handled in host byte order, checksum fields are read and written big endian by the caller.
+/*	Payloads rewritten in place keep a record of their edits, so their checksum can be patched for the
+/*	changed words alone instead of computed again over the whole segment.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+// Add the bytes of a buffer to a running one's complement sum, as big endian 16-bit words
+UINT32 LbChecksumAdd(UINT32 sum, const UINT8* data, SIZE_T length);
+
+// Same for a buffer that starts offset bytes into the data being summed, so it may begin with the low byte of a word
+UINT32 LbChecksumAddAt(UINT32 sum, SIZE_T offset, const UINT8* data, SIZE_T length);
+
+// Fold a running sum into the final 16-bit checksum
+UINT16 LbChecksumFinish(UINT32 sum);
+
+// Running sum of the IPv4 pseudo header of a TCP or UDP segment of length bytes
+UINT32 LbPseudoHeaderSumV4(UINT32 sourceAddress, UINT32 destinationAddress, UINT8 protocol, SIZE_T length);
+
+// Checksum of a TCP or UDP segment including the IPv4 pseudo header.
+// The checksum field inside the segment must be zero.
+UINT16 LbTransportChecksumV4(UINT32 sourceAddress, UINT32 destinationAddress, UINT8 protocol, const UINT8* segment, SIZE_T length);
+
+// Adjust an existing checksum after a 32-bit field changed from oldValue to newValue (RFC 1624)
+UINT16 LbChecksumUpdate32(UINT16 checksum, UINT32 oldValue, UINT32 newValue);
+
+// What patching the checksum for one edit costs, in bytes a full sum covers in the same time.
+// Each edit pays a fixed share for folding it in and a share for every byte it changes.
+#define LB_CHECKSUM_EDIT_COST		128
+#define LB_CHECKSUM_EDIT_BYTE_COST	8
+
+// Edits made in place to one segment. Each one is folded into the adjustment as it is made, while the old bytes
+// are still there. Once patching would cost more than summing limit bytes, the segment's length, the
+// adjustment is given up and the checksum has to be computed from scratch.
+struct LB_CHECKSUM_EDITS
+{
+	UINT32 sum;					// ~old + new of every changed word, at its place in the segment
+	UINT32 count;
+	SIZE_T cost;				// Of the edits so far, see LB_CHECKSUM_EDIT_COST
+	SIZE_T limit;
+	SIZE_T base;				// Offset of the buffer being edited from an even position of the segment
+};
+
+// Start the edits of a segment. A limit of 0 never gives up, for segments that cannot be summed again.
+void LbChecksumEditsBegin(LB_CHECKSUM_EDITS* edits, SIZE_T limit);
+
+// Record that length bytes at offset in the buffer being edited change from before to after.
+// Must be called before they are overwritten.
+void LbChecksumEdit(LB_CHECKSUM_EDITS* edits, SIZE_T offset, const UINT8* before, const UINT8* after, SIZE_T length);
+
+// TRUE once the edits cost too much to be patched
+inline BOOLEAN LbChecksumEditsExceeded(const LB_CHECKSUM_EDITS* edits)
+{
+	return edits->limit != 0 && edits->cost > edits->limit;
+}
+
+// Apply the edits to the checksum the segment had before them
+UINT16 LbChecksumApplyEdits(UINT16 checksum, const LB_CHECKSUM_EDITS* edits);
+
+// Big endian field access for packet headers
+inline UINT16 LbReadBe16(const UINT8* p)
+{
+	return (UINT16)((p[0] << 8) | p[1]);
+}
+
+inline UINT32 LbReadBe32(const UINT8* p)
+{
+	return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+}
+
+inline void LbWriteBe16(UINT8* p, UINT16 value)
+{
+	p[0] = (UINT8)(value >> 8);
+	p[1] = (UINT8)value;
+}
+
+inline void LbWriteBe32(UINT8* p, UINT32 value)
+{
+	p[0] = (UINT8)(value >> 24);
+	p[1] = (UINT8)(value >> 16);
+	p[2] = (UINT8)(value >> 8);
+	p[3] = (UINT8)value;
+}
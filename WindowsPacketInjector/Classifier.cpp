@@ -0,0 +1,612 @@
+/*/
+/*  ** Classifier.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for building and querying the flow classifier.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Pankaj Gupta, Steven Lin, Nick McKeown, "Routing Lookups in Hardware at Memory Access Speeds",
+/*		  IEEE INFOCOM 1998
+/*			* DIR-24-8, the table layout used here with a smaller first level (16-8-8) to keep it small.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "Classifier.h"
+
+//////////////////
+// TABLE LAYOUT //
+//////////////////
+
+// An address table entry either holds an LB_VERDICT or, with this bit set, the index of a 256 entry subtable
+#define LB_LPM_SUBTABLE 0x80000000
+
+#define LB_PORT_COUNT 0x10000
+
+/////////////
+// HELPERS //
+/////////////
+
+static inline BOOLEAN LbRuleIsValid(UINT8 action, UINT8 directions)
+{
+	return action <= LB_RULE_ACTION_INSPECT && directions != 0 && (directions & ~LB_RULE_DIRECTION_BOTH) == 0;
+}
+
+// Rule actions map onto verdicts one above them, leaving 0 for "no rule"
+static inline UINT8 LbRuleVerdict(UINT8 action)
+{
+	return (UINT8)(action + LB_VERDICT_PERMIT);
+}
+
+// First port at or after port that no rule has claimed yet, with path halving
+static inline UINT32 LbNextFreePort(UINT32* next, UINT32 port)
+{
+	while (next[port] != port)
+	{
+		next[port] = next[next[port]];
+		port = next[port];
+	}
+
+	return port;
+}
+
+// Returns the subtable an entry points to, turning the entry into a subtable first if it is a verdict.
+// The caller guarantees there is room for one more subtable.
+static UINT32* LbLpmDescend(LB_CLASSIFIER_TABLES* tables, UINT32* entry)
+{
+	if (!(*entry & LB_LPM_SUBTABLE))
+	{
+		UINT32 index = tables->subtableCount++;
+		UINT32* block = &tables->subtables[(SIZE_T)index * 256];
+
+		// Everything the shorter prefix covered is still covered, just one level further down
+		for (int i = 0; i < 256; i++)
+			block[i] = *entry;
+
+		*entry = LB_LPM_SUBTABLE | index;
+	}
+
+	return &tables->subtables[(SIZE_T)(*entry & ~LB_LPM_SUBTABLE) * 256];
+}
+
+static inline void LbLpmFill(UINT32* entries, UINT32 first, UINT32 span, UINT32 verdict)
+{
+	for (UINT32 i = 0; i < span; i++)
+		entries[first + i] = verdict;
+}
+
+// Write one prefix over everything it covers. Prefixes are inserted shortest first,
+// so whatever is already in the table is never more specific than the new prefix.
+static void LbLpmInsert(LB_CLASSIFIER_TABLES* tables, UINT32 address, UINT32 length, UINT32 verdict)
+{
+	if (length <= 16)
+	{
+		LbLpmFill(tables->addresses, address >> 16, 1u << (16 - length), verdict);
+		return;
+	}
+
+	UINT32* level = LbLpmDescend(tables, &tables->addresses[address >> 16]);
+	if (length <= 24)
+	{
+		LbLpmFill(level, (address >> 8) & 0xFF, 1u << (24 - length), verdict);
+		return;
+	}
+
+	level = LbLpmDescend(tables, &level[(address >> 8) & 0xFF]);
+	LbLpmFill(level, address & 0xFF, 1u << (32 - length), verdict);
+}
+
+// Make room for two more subtables, the most a single insert can add
+static NTSTATUS LbLpmReserve(LB_CLASSIFIER_TABLES* tables, UINT32* capacity)
+{
+	if (tables->subtableCount + 2 <= *capacity)
+		return STATUS_SUCCESS;
+
+	UINT32 newCapacity = *capacity ? *capacity * 2 : 16;
+	UINT32* subtables = (UINT32*)LbAlloc((SIZE_T)newCapacity * 256 * sizeof(UINT32), 'LBC1');
+	if (!subtables)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	if (tables->subtables)
+	{
+		memcpy(subtables, tables->subtables, (SIZE_T)tables->subtableCount * 256 * sizeof(UINT32));
+		LbFree(tables->subtables, 'LBC1');
+	}
+
+	tables->subtables = subtables;
+	*capacity = newCapacity;
+	return STATUS_SUCCESS;
+}
+
+//////////////////
+// PORT BUILDER //
+//////////////////
+
+static NTSTATUS LbClassifierBuildPorts(LB_CLASSIFIER_TABLES* tables, UINT8 direction, const LB_PORT_RULE* rules, UINT32 count)
+{
+	UINT32* next = NULL;
+	BOOLEAN used = FALSE;
+
+	for (UINT32 i = 0; i < count && !used; i++)
+		used = (rules[i].directions & direction) != 0;
+	if (!used)
+		return STATUS_SUCCESS;
+
+	tables->ports = (UINT8*)LbAlloc(LB_PORT_COUNT, 'LBC1');
+	next = (UINT32*)LbAlloc((LB_PORT_COUNT + 1) * sizeof(UINT32), 'LBC2');
+	if (!tables->ports || !next)
+	{
+		if (next) LbFree(next, 'LBC2');
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	for (UINT32 port = 0; port <= LB_PORT_COUNT; port++)
+		next[port] = port;
+
+	// The first rule covering a port wins, so every port is written once and then skipped,
+	// which keeps wide overlapping ranges from costing more than the table itself
+	for (UINT32 i = 0; i < count; i++)
+	{
+		const LB_PORT_RULE* rule = &rules[i];
+		if (!(rule->directions & direction))
+			continue;
+
+		for (UINT32 port = LbNextFreePort(next, rule->firstPort); port <= rule->lastPort; port = LbNextFreePort(next, port + 1))
+		{
+			tables->ports[port] = LbRuleVerdict(rule->action);
+			next[port] = port + 1;
+		}
+	}
+
+	LbFree(next, 'LBC2');
+	return STATUS_SUCCESS;
+}
+
+/////////////////////
+// ADDRESS BUILDER //
+/////////////////////
+
+static NTSTATUS LbClassifierBuildAddresses(LB_CLASSIFIER_TABLES* tables, UINT8 direction, const LB_ADDRESS_RULE* rules, UINT32 count)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	UINT32 lengthStart[34] = { 0 };
+	UINT32* order = NULL;
+	UINT32 used = 0;
+	UINT32 capacity = 0;
+
+	// Counting sort by prefix length, shortest first
+	for (UINT32 i = 0; i < count; i++)
+	{
+		if (rules[i].directions & direction)
+		{
+			lengthStart[rules[i].prefixLength + 1]++;
+			used++;
+		}
+	}
+	if (used == 0)
+		return STATUS_SUCCESS;
+
+	for (int length = 1; length < 34; length++)
+		lengthStart[length] += lengthStart[length - 1];
+
+	order = (UINT32*)LbAlloc(sizeof(UINT32) * used, 'LBC2');
+	tables->addresses = (UINT32*)LbAlloc(sizeof(UINT32) * 0x10000, 'LBC1');
+	if (!order || !tables->addresses)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	// Equal prefixes go in reverse so the rule listed first is written last and wins
+	for (UINT32 i = count; i > 0; i--)
+	{
+		const LB_ADDRESS_RULE* rule = &rules[i - 1];
+		if (rule->directions & direction)
+			order[lengthStart[rule->prefixLength]++] = i - 1;
+	}
+
+	for (UINT32 i = 0; i < used; i++)
+	{
+		const LB_ADDRESS_RULE* rule = &rules[order[i]];
+		UINT32 mask = rule->prefixLength ? 0xFFFFFFFF << (32 - rule->prefixLength) : 0;
+
+		status = LbLpmReserve(tables, &capacity);
+		if (!NT_SUCCESS(status)) goto Exit;
+
+		LbLpmInsert(tables, rule->address & mask, rule->prefixLength, LbRuleVerdict(rule->action));
+	}
+
+Exit:
+	if (order) LbFree(order, 'LBC2');
+
+	return status;
+}
+
+//////////////////////////
+// CREATION AND CLEANUP //
+//////////////////////////
+
+NTSTATUS LbClassifierCompile(const LB_ADDRESS_RULE* addressRules, UINT32 addressRuleCount, const LB_PORT_RULE* portRules, UINT32 portRuleCount, LB_CLASSIFIER** classifier)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_CLASSIFIER* result = NULL;
+
+	if (classifier == NULL || addressRuleCount > LB_RULES_MAX_COUNT || portRuleCount > LB_RULES_MAX_COUNT)
+		return STATUS_INVALID_PARAMETER;
+	if ((addressRuleCount > 0 && addressRules == NULL) || (portRuleCount > 0 && portRules == NULL))
+		return STATUS_INVALID_PARAMETER;
+
+	*classifier = NULL;
+
+	for (UINT32 i = 0; i < addressRuleCount; i++)
+	{
+		if (!LbRuleIsValid(addressRules[i].action, addressRules[i].directions) || addressRules[i].prefixLength > 32)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	for (UINT32 i = 0; i < portRuleCount; i++)
+	{
+		if (!LbRuleIsValid(portRules[i].action, portRules[i].directions) || portRules[i].firstPort > portRules[i].lastPort)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	result = (LB_CLASSIFIER*)LbAlloc(sizeof(LB_CLASSIFIER), 'LBC0');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	for (int direction = 0; direction < LB_DIRECTION_COUNT; direction++)
+	{
+		UINT8 mask = direction == LB_DIRECTION_OUTBOUND ? LB_RULE_DIRECTION_OUTBOUND : LB_RULE_DIRECTION_INBOUND;
+
+		status = LbClassifierBuildAddresses(&result->tables[direction], mask, addressRules, addressRuleCount);
+		if (!NT_SUCCESS(status)) goto Exit;
+
+		status = LbClassifierBuildPorts(&result->tables[direction], mask, portRules, portRuleCount);
+		if (!NT_SUCCESS(status)) goto Exit;
+	}
+
+Exit:
+	if (!NT_SUCCESS(status))
+	{
+		LbClassifierFree(result);
+		return status;
+	}
+
+	*classifier = result;
+	return status;
+}
+
+SIZE_T LbClassifierBytes(const LB_ADDRESS_RULE* addressRules, UINT32 addressRuleCount, const LB_PORT_RULE* portRules, UINT32 portRuleCount)
+{
+	SIZE_T bytes = sizeof(LB_CLASSIFIER);
+
+	for (int direction = 0; direction < LB_DIRECTION_COUNT; direction++)
+	{
+		UINT8 mask = direction == LB_DIRECTION_OUTBOUND ? LB_RULE_DIRECTION_OUTBOUND : LB_RULE_DIRECTION_INBOUND;
+		BOOLEAN ports = FALSE;
+		UINT32 used = 0;
+		SIZE_T subtables = 0;
+
+		for (UINT32 i = 0; i < portRuleCount && !ports; i++)
+			ports = (portRules[i].directions & mask) != 0;
+
+		// A prefix longer than 16 bits can take a subtable of its own, one longer than 24 bits a second one
+		for (UINT32 i = 0; i < addressRuleCount; i++)
+		{
+			if (!(addressRules[i].directions & mask))
+				continue;
+
+			used++;
+			subtables += (addressRules[i].prefixLength > 16) + (addressRules[i].prefixLength > 24);
+		}
+
+		if (ports)
+			bytes += LB_PORT_COUNT + (LB_PORT_COUNT + 1) * sizeof(UINT32);
+
+		// Subtables grow by doubling and the old ones are only freed once they were copied
+		if (used)
+		{
+			SIZE_T capacity = 16;
+			while (capacity < subtables + 2)
+				capacity *= 2;
+
+			bytes += (SIZE_T)used * sizeof(UINT32) + 0x10000 * sizeof(UINT32);
+			bytes += (capacity + (capacity > 16 ? capacity / 2 : 0)) * 256 * sizeof(UINT32);
+		}
+	}
+
+	return bytes;
+}
+
+void LbClassifierFree(LB_CLASSIFIER* classifier)
+{
+	if (!classifier)
+		return;
+
+	for (int direction = 0; direction < LB_DIRECTION_COUNT && !classifier->borrowed; direction++)
+	{
+		LB_CLASSIFIER_TABLES* tables = &classifier->tables[direction];
+		if (tables->ports) LbFree(tables->ports, 'LBC1');
+		if (tables->addresses) LbFree(tables->addresses, 'LBC1');
+		if (tables->subtables) LbFree(tables->subtables, 'LBC1');
+	}
+
+	LbFree(classifier, 'LBC0');
+}
+
+/////////////////
+// RULE IMAGES //
+/////////////////
+
+static inline SIZE_T LbAlignLine(SIZE_T value)
+{
+	return (value + 63) & ~(SIZE_T)63;
+}
+
+// Reserves room for one table and copies it there when there is an image to copy into
+static inline UINT32 LbImageTable(UINT8* image, SIZE_T* offset, const void* table, SIZE_T bytes)
+{
+	if (!table)
+		return 0;
+
+	SIZE_T start = LbAlignLine(*offset);
+	if (image)
+		memcpy(image + start, table, bytes);
+	*offset = start + bytes;
+
+	return (UINT32)start;
+}
+
+SIZE_T LbClassifierWriteImage(const LB_CLASSIFIER* classifier, UINT8* image, SIZE_T offset, LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT])
+{
+	for (int direction = 0; direction < LB_DIRECTION_COUNT; direction++)
+	{
+		const LB_CLASSIFIER_TABLES* source = &classifier->tables[direction];
+		LB_CLASSIFIER_IMAGE* target = &tables[direction];
+
+		target->portOffset = LbImageTable(image, &offset, source->ports, LB_PORT_COUNT);
+		target->addressOffset = LbImageTable(image, &offset, source->addresses, 0x10000 * sizeof(UINT32));
+		target->subtableOffset = source->subtableCount ?
+			LbImageTable(image, &offset, source->subtables, (SIZE_T)source->subtableCount * 256 * sizeof(UINT32)) : 0;
+		target->subtableCount = source->subtableCount;
+	}
+
+	return offset;
+}
+
+// A table must lie inside the image and start on a boundary its entries can be read from
+static inline BOOLEAN LbImageTableFits(SIZE_T size, UINT32 offset, SIZE_T bytes)
+{
+	return (offset & 63) == 0 && offset <= size && bytes <= size - offset;
+}
+
+// An address entry is a verdict or points to a subtable that exists
+static inline BOOLEAN LbLpmEntryIsValid(UINT32 entry, UINT32 subtableCount)
+{
+	if (entry & LB_LPM_SUBTABLE)
+		return (entry & ~LB_LPM_SUBTABLE) < subtableCount;
+
+	return entry <= LB_VERDICT_INSPECT;
+}
+
+NTSTATUS LbClassifierBindImage(const UINT8* image, SIZE_T size, const LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT], LB_CLASSIFIER** classifier)
+{
+	if (image == NULL || tables == NULL || classifier == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	*classifier = NULL;
+
+	// Lookups trust every entry they read, so each one is checked once here instead
+	for (int direction = 0; direction < LB_DIRECTION_COUNT; direction++)
+	{
+		const LB_CLASSIFIER_IMAGE* source = &tables[direction];
+
+		if (source->subtableCount > LB_LPM_SUBTABLE || (source->subtableCount != 0) != (source->subtableOffset != 0))
+			return STATUS_INVALID_PARAMETER;
+		if (source->subtableCount != 0 && source->addressOffset == 0)
+			return STATUS_INVALID_PARAMETER;
+
+		if (source->portOffset != 0)
+		{
+			if (!LbImageTableFits(size, source->portOffset, LB_PORT_COUNT))
+				return STATUS_INVALID_PARAMETER;
+
+			const UINT8* ports = image + source->portOffset;
+			for (UINT32 port = 0; port < LB_PORT_COUNT; port++)
+			{
+				if (ports[port] > LB_VERDICT_INSPECT)
+					return STATUS_INVALID_PARAMETER;
+			}
+		}
+
+		if (source->addressOffset != 0)
+		{
+			if (!LbImageTableFits(size, source->addressOffset, 0x10000 * sizeof(UINT32)))
+				return STATUS_INVALID_PARAMETER;
+
+			const UINT32* addresses = (const UINT32*)(image + source->addressOffset);
+			for (UINT32 i = 0; i < 0x10000; i++)
+			{
+				if (!LbLpmEntryIsValid(addresses[i], source->subtableCount))
+					return STATUS_INVALID_PARAMETER;
+			}
+		}
+
+		if (source->subtableCount != 0)
+		{
+			SIZE_T entries = (SIZE_T)source->subtableCount * 256;
+			if (entries > size / sizeof(UINT32) || !LbImageTableFits(size, source->subtableOffset, entries * sizeof(UINT32)))
+				return STATUS_INVALID_PARAMETER;
+
+			const UINT32* subtables = (const UINT32*)(image + source->subtableOffset);
+			for (SIZE_T i = 0; i < entries; i++)
+			{
+				if (!LbLpmEntryIsValid(subtables[i], source->subtableCount))
+					return STATUS_INVALID_PARAMETER;
+			}
+		}
+	}
+
+	LB_CLASSIFIER* result = (LB_CLASSIFIER*)LbAlloc(sizeof(LB_CLASSIFIER), 'LBC0');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	result->borrowed = TRUE;
+
+	for (int direction = 0; direction < LB_DIRECTION_COUNT; direction++)
+	{
+		const LB_CLASSIFIER_IMAGE* source = &tables[direction];
+		LB_CLASSIFIER_TABLES* target = &result->tables[direction];
+
+		target->ports = source->portOffset ? (UINT8*)(image + source->portOffset) : NULL;
+		target->addresses = source->addressOffset ? (UINT32*)(image + source->addressOffset) : NULL;
+		target->subtables = source->subtableOffset ? (UINT32*)(image + source->subtableOffset) : NULL;
+		target->subtableCount = source->subtableCount;
+	}
+
+	*classifier = result;
+	return STATUS_SUCCESS;
+}
+
+////////////
+// LOOKUP //
+////////////
+
+LB_VERDICT LbClassifierLookup(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, UINT32 remoteAddress, UINT16 remotePort)
+{
+	const LB_CLASSIFIER_TABLES* tables = &classifier->tables[direction];
+
+	// Address rules are more specific than port rules and take precedence
+	if (tables->addresses)
+	{
+		UINT32 entry = tables->addresses[remoteAddress >> 16];
+		if (entry & LB_LPM_SUBTABLE)
+		{
+			entry = tables->subtables[(SIZE_T)(entry & ~LB_LPM_SUBTABLE) * 256 + ((remoteAddress >> 8) & 0xFF)];
+			if (entry & LB_LPM_SUBTABLE)
+				entry = tables->subtables[(SIZE_T)(entry & ~LB_LPM_SUBTABLE) * 256 + (remoteAddress & 0xFF)];
+		}
+
+		if (entry != LB_VERDICT_NONE)
+			return (LB_VERDICT)entry;
+	}
+
+	if (tables->ports)
+		return (LB_VERDICT)tables->ports[remotePort];
+
+	return LB_VERDICT_NONE;
+}
+
+LB_VERDICT LbClassifierLookupPort(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, UINT16 remotePort)
+{
+	const LB_CLASSIFIER_TABLES* tables = &classifier->tables[direction];
+
+	if (tables->ports)
+		return (LB_VERDICT)tables->ports[remotePort];
+
+	return LB_VERDICT_NONE;
+}
+
+/////////////////
+// ENUMERATION //
+/////////////////
+
+// Merges neighbouring values with the same verdict before they reach the callback
+struct LB_RANGE_WALK
+{
+	LbClassifierRangeCallback* callbackFn;
+	void* userdata;
+	BOOLEAN open;
+	UINT32 first;
+	UINT32 last;
+	UINT32 verdict;
+};
+
+static inline NTSTATUS LbRangeWalkFlush(LB_RANGE_WALK* walk)
+{
+	if (!walk->open)
+		return STATUS_SUCCESS;
+
+	walk->open = FALSE;
+	return walk->callbackFn(walk->first, walk->last, (LB_VERDICT)walk->verdict, walk->userdata);
+}
+
+// Values are always visited in order, so a range only ever grows at its end
+static inline NTSTATUS LbRangeWalkAdd(LB_RANGE_WALK* walk, UINT32 first, UINT32 last, UINT32 verdict)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if (walk->open && walk->verdict == verdict)
+	{
+		walk->last = last;
+		return status;
+	}
+
+	status = LbRangeWalkFlush(walk);
+	walk->open = TRUE;
+	walk->first = first;
+	walk->last = last;
+	walk->verdict = verdict;
+	return status;
+}
+
+NTSTATUS LbClassifierEnumerateAddresses(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, LbClassifierRangeCallback* callbackFn, void* userdata)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	const LB_CLASSIFIER_TABLES* tables = &classifier->tables[direction];
+	LB_RANGE_WALK walk = { callbackFn, userdata, FALSE, 0, 0, LB_VERDICT_NONE };
+
+	if (!tables->addresses)
+		return callbackFn(0, 0xFFFFFFFF, LB_VERDICT_NONE, userdata);
+
+	for (UINT32 top = 0; top < 0x10000 && NT_SUCCESS(status); top++)
+	{
+		UINT32 entry = tables->addresses[top];
+		if (!(entry & LB_LPM_SUBTABLE))
+		{
+			status = LbRangeWalkAdd(&walk, top << 16, (top << 16) | 0xFFFF, entry);
+			continue;
+		}
+
+		const UINT32* middle = &tables->subtables[(SIZE_T)(entry & ~LB_LPM_SUBTABLE) * 256];
+		for (UINT32 mid = 0; mid < 256 && NT_SUCCESS(status); mid++)
+		{
+			UINT32 base = (top << 16) | (mid << 8);
+			if (!(middle[mid] & LB_LPM_SUBTABLE))
+			{
+				status = LbRangeWalkAdd(&walk, base, base | 0xFF, middle[mid]);
+				continue;
+			}
+
+			const UINT32* low = &tables->subtables[(SIZE_T)(middle[mid] & ~LB_LPM_SUBTABLE) * 256];
+			for (UINT32 i = 0; i < 256 && NT_SUCCESS(status); i++)
+				status = LbRangeWalkAdd(&walk, base | i, base | i, low[i]);
+		}
+	}
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	return LbRangeWalkFlush(&walk);
+}
+
+NTSTATUS LbClassifierEnumeratePorts(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, LbClassifierRangeCallback* callbackFn, void* userdata)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	const LB_CLASSIFIER_TABLES* tables = &classifier->tables[direction];
+	LB_RANGE_WALK walk = { callbackFn, userdata, FALSE, 0, 0, LB_VERDICT_NONE };
+
+	if (!tables->ports)
+		return callbackFn(0, LB_PORT_COUNT - 1, LB_VERDICT_NONE, userdata);
+
+	for (UINT32 port = 0; port < LB_PORT_COUNT && NT_SUCCESS(status); port++)
+		status = LbRangeWalkAdd(&walk, port, port, tables->ports[port]);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	return LbRangeWalkFlush(&walk);
+}
@@ -0,0 +1,95 @@
+/*/
+/*  ** Classifier.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the flow classifier built from the port and address rules of a rule set.
+/*	Port rules are flattened into one action per port and address rules into a three level
+/*	longest prefix match table (16, 8 and 8 bits), so deciding a flow takes at most four memory
+/*	reads no matter how many rules there are.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+#include "VerdictCache.h"
+
+enum LB_DIRECTION
+{
+	LB_DIRECTION_OUTBOUND = 0,
+	LB_DIRECTION_INBOUND,
+	LB_DIRECTION_COUNT
+};
+
+// Tables of one direction, every table is NULL when the direction has no rules of its kind
+struct LB_CLASSIFIER_TABLES
+{
+	UINT8* ports;			// LB_VERDICT[65536] indexed by remote port
+	UINT32* addresses;		// Entry[65536] indexed by the top 16 bits of the remote address
+	UINT32* subtables;		// Entry[256] blocks for prefixes longer than 16 bits
+	UINT32 subtableCount;
+};
+
+struct LB_CLASSIFIER
+{
+	LB_CLASSIFIER_TABLES tables[LB_DIRECTION_COUNT];
+	BOOLEAN borrowed;		// The tables belong to a rule image, LbClassifierFree leaves them alone
+};
+
+// Where the tables of one direction sit in a rule image, as offsets from its start. 0 marks a missing table.
+struct LB_CLASSIFIER_IMAGE
+{
+	UINT32 portOffset;
+	UINT32 addressOffset;
+	UINT32 subtableOffset;
+	UINT32 subtableCount;
+};
+
+// Build a classifier, rules are validated first
+NTSTATUS LbClassifierCompile(
+	const LB_ADDRESS_RULE* addressRules,
+	UINT32 addressRuleCount,
+	const LB_PORT_RULE* portRules,
+	UINT32 portRuleCount,
+	LB_CLASSIFIER** classifier
+);
+
+// Most bytes of pool LbClassifierCompile can take for these rules, the tables it builds them in included.
+// Only the rule counts and prefix lengths are looked at, the rules are not validated.
+SIZE_T LbClassifierBytes(
+	const LB_ADDRESS_RULE* addressRules,
+	UINT32 addressRuleCount,
+	const LB_PORT_RULE* portRules,
+	UINT32 portRuleCount
+);
+
+// Free a classifier returned by LbClassifierCompile
+void LbClassifierFree(LB_CLASSIFIER* classifier);
+
+// Copy the tables of a classifier into a rule image from offset on, each one aligned to a cache line, and record
+// where they went in tables. With image NULL nothing is written. Returns the offset after the last table.
+SIZE_T LbClassifierWriteImage(const LB_CLASSIFIER* classifier, UINT8* image, SIZE_T offset, LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT]);
+
+// Build a classifier that looks flows up in the tables of a rule image of size bytes, without copying them.
+// Every entry is validated first. The image must outlive the classifier.
+NTSTATUS LbClassifierBindImage(const UINT8* image, SIZE_T size, const LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT], LB_CLASSIFIER** classifier);
+
+// Returns the verdict of the rule covering a flow, or LB_VERDICT_NONE when no rule does
+LB_VERDICT LbClassifierLookup(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, UINT32 remoteAddress, UINT16 remotePort);
+
+// Same, but only port rules are consulted. Used for IPv6 flows, address rules only ever cover IPv4.
+LB_VERDICT LbClassifierLookupPort(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, UINT16 remotePort);
+
+// Called once per range of consecutive values sharing a verdict, in ascending order. Returning an error stops the walk.
+typedef NTSTATUS(LbClassifierRangeCallback)(UINT32 first, UINT32 last, LB_VERDICT verdict, void* value);
+
+// Walk the address rules of one direction as the verdicts they give every remote address
+NTSTATUS LbClassifierEnumerateAddresses(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, LbClassifierRangeCallback* callbackFn, void* userdata);
+
+// Walk the port rules of one direction as the verdicts they give every remote port
+NTSTATUS LbClassifierEnumeratePorts(const LB_CLASSIFIER* classifier, LB_DIRECTION direction, LbClassifierRangeCallback* callbackFn, void* userdata);
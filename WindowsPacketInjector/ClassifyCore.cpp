@@ -0,0 +1,350 @@
+/*/
+/*  ** ClassifyCore.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the platform independent part of the classify path.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- J. Postel, RFC 793 "Transmission Control Protocol", https://www.rfc-editor.org/rfc/rfc793
+/*			* Header layout, data offset and sequence number of a TCP segment.
+/*		- J. Postel, RFC 768 "User Datagram Protocol", https://www.rfc-editor.org/rfc/rfc768
+/*			* A computed UDP checksum of zero is sent as all ones.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "ClassifyCore.h"
+#include "Checksum.h"
+
+///////////////////
+// FIELD SCOPING //
+///////////////////
+
+void LbScanSegment(LB_SCAN_CONTEXT* scan, UINT32 sequence, SIZE_T length)
+{
+	scan->dissector = NULL;
+	scan->offset = 0;
+	LbMatcherSpansBegin(&scan->spans);
+
+	// A few edits are patched into the checksum, many are cheaper to sum again with the segment. Only IPv4
+	// segments can be summed again, the pseudo header of an IPv6 one is not in its flow key.
+	LbChecksumEditsBegin(&scan->edits, scan->key->family == LB_FAMILY_IPV4 ? length : 0);
+
+	if (scan->fields == 0)
+		return;
+
+	if (scan->key->protocol == LB_IPPROTO_TCP && scan->stream)
+	{
+		// A resent segment has no place in the stream any more, it is scanned whole
+		if (LbDissectorInSequence(scan->stream, sequence, length))
+			scan->dissector = scan->stream;
+		return;
+	}
+
+	// Every datagram is a message of its own, a segment outside of a flow has nothing to continue from
+	LbDissectorBegin(&scan->single, LbDissectorForFlow(scan->key));
+	scan->dissector = &scan->single;
+}
+
+///////////////////////
+// IN PLACE SCANNING //
+///////////////////////
+
+// offset is where data starts in the segment's payload
+static void LbScanRun(LB_SCAN_CONTEXT* scan, UINT8* data, SIZE_T length, SIZE_T offset)
+{
+	UINT64 start = scan->timed ? LbCycles() : 0;
+
+	// Single pass over the buffer, continuing where the previous buffer left off
+	scan->edits.base = offset;
+	if (scan->replace)
+		scan->replacements += scan->replace(&scan->state, data, length, &scan->spans, &scan->edits);
+	else
+		scan->replacements += LbMatcherReplace(scan->matcher, &scan->state, data, length, &scan->spans, &scan->edits);
+	scan->bytes += length;
+
+	// A match still in progress may have to reach back into this buffer
+	LbMatcherSpansAdd(&scan->spans, data, length, offset);
+
+	if (scan->timed) scan->matchCycles += LbCycles() - start;
+}
+
+static void LbScanField(SIZE_T offset, SIZE_T length, BOOLEAN first, void* value)
+{
+	LB_SCAN_CONTEXT* scan = (LB_SCAN_CONTEXT*)value;
+
+	// A match never spans two fields
+	if (first)
+		scan->state = LB_MATCHER_ROOT_STATE;
+
+	LbScanRun(scan, &scan->span[offset], length, scan->offset + offset);
+}
+
+void LbScanBuffer(LB_SCAN_CONTEXT* scan, UINT8* data, SIZE_T length)
+{
+	if (!scan->dissector)
+		LbScanRun(scan, data, length, scan->offset);
+	else
+	{
+		UINT64 scanned = scan->bytes;
+
+		scan->span = data;
+		LbDissectorFeed(scan->dissector, scan->fields, data, length, LbScanField, scan);
+		scan->skipped += length - (scan->bytes - scanned);
+	}
+
+	scan->offset += length;
+}
+
+LB_SCAN_CHECKSUM LbScanChecksum(const LB_SCAN_CONTEXT* scan, UINT16* checksum)
+{
+	// Zero is how a UDP datagram says it has no checksum, a computed zero is sent as all ones instead
+	if (scan->edits.count == 0 || (scan->key->protocol == LB_IPPROTO_UDP && *checksum == 0))
+		return LB_SCAN_CHECKSUM_UNCHANGED;
+
+	if (LbChecksumEditsExceeded(&scan->edits))
+		return LB_SCAN_CHECKSUM_RECOMPUTE;
+
+	*checksum = LbChecksumApplyEdits(*checksum, &scan->edits);
+	if (*checksum == 0 && scan->key->protocol == LB_IPPROTO_UDP)
+		*checksum = 0xFFFF;
+
+	return LB_SCAN_CHECKSUM_PATCHED;
+}
+
+/////////////////////////////
+// LENGTH CHANGING REWRITE //
+/////////////////////////////
+
+// Where the fields of a scoped rewrite go
+struct LB_REWRITE_RUNS
+{
+	LB_SCAN_CONTEXT* scan;
+	UINT32* state;
+	const UINT8* payload;
+	UINT8* output;
+	SIZE_T copied;				// Payload bytes already accounted for in output
+	SIZE_T written;
+	UINT32 replacements;
+};
+
+static void LbRewriteField(SIZE_T offset, SIZE_T length, BOOLEAN first, void* value)
+{
+	LB_REWRITE_RUNS* runs = (LB_REWRITE_RUNS*)value;
+	UINT64 start = runs->scan->timed ? LbCycles() : 0;
+	SIZE_T written = 0;
+
+	// Bytes between fields are copied as they are
+	memcpy(&runs->output[runs->written], &runs->payload[runs->copied], offset - runs->copied);
+	runs->written += offset - runs->copied;
+
+	if (first)
+		*runs->state = LB_MATCHER_ROOT_STATE;
+
+	runs->replacements += LbMatcherRewrite(runs->scan->matcher, runs->state, &runs->payload[offset], length, &runs->output[runs->written], &written);
+	runs->written += written;
+	runs->copied = offset + length;
+	runs->scan->bytes += length;
+
+	if (runs->scan->timed) runs->scan->matchCycles += LbCycles() - start;
+}
+
+// Rewrites a whole payload, or only its fields when the segment has a dissector.
+// The output bound of the whole payload covers its fields, they are never longer together.
+static UINT32 LbRewritePayload(LB_SCAN_CONTEXT* scan, UINT32* state, const UINT8* payload, SIZE_T length, UINT8* output, SIZE_T* written)
+{
+	if (!scan->dissector)
+	{
+		UINT64 start = scan->timed ? LbCycles() : 0;
+		UINT32 replacements = LbMatcherRewrite(scan->matcher, state, payload, length, output, written);
+
+		scan->bytes += length;
+		if (scan->timed) scan->matchCycles += LbCycles() - start;
+		return replacements;
+	}
+
+	LB_REWRITE_RUNS runs = { scan, state, payload, output, 0, 0, 0 };
+	UINT64 scanned = scan->bytes;
+
+	LbDissectorFeed(scan->dissector, scan->fields, payload, length, LbRewriteField, &runs);
+
+	memcpy(&output[runs.written], &payload[runs.copied], length - runs.copied);
+	*written = runs.written + (length - runs.copied);
+	scan->skipped += length - (scan->bytes - scanned);
+
+	return runs.replacements;
+}
+
+BOOLEAN LbRewriteTransport(
+	const LB_FLOW_KEY* key,
+	LB_SEQ_TRACKER* seq,
+	LB_SCAN_CONTEXT* scan,
+	const UINT8* segment,
+	ULONG length,
+	UINT8* output,
+	ULONG capacity,
+	ULONG* outputLength)
+{
+	ULONG headerLength = key->protocol == LB_IPPROTO_TCP ? 20 : 8;
+	ULONG checksumOffset = key->protocol == LB_IPPROTO_TCP ? 16 : 6;
+	ULONG payloadLength = 0;
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	UINT16 checksum = 0;
+	SIZE_T written = 0;
+	UINT32 replacements = 0;
+
+	if (length < headerLength || length > capacity)
+		return FALSE;
+
+	if (key->protocol == LB_IPPROTO_TCP)
+	{
+		headerLength = (segment[12] >> 4) * 4;
+		if (headerLength < 20 || headerLength > length)
+			return FALSE;
+	}
+
+	// Every segment is rewritten from the root. A match that began in an earlier segment could not be rewritten
+	// here anyway, and starting from it would only move where the automaton resets: a resent segment, which has
+	// to come out exactly like the first time, would then depend on what was sent before it.
+	payloadLength = length - headerLength;
+
+	LbScanSegment(scan, key->protocol == LB_IPPROTO_TCP ? LbReadBe32(&segment[4]) : 0, payloadLength);
+
+	memcpy(output, segment, headerLength);
+	if (headerLength + LbMatcherRewriteBound(scan->matcher, payloadLength) <= capacity)
+		replacements = LbRewritePayload(scan, &state, &segment[headerLength], payloadLength, &output[headerLength], &written);
+	else
+	{
+		// Growing this payload could overflow an IP packet, send it unchanged
+		memcpy(&output[headerLength], &segment[headerLength], payloadLength);
+		written = payloadLength;
+
+		// The dissector still has to follow the stream past it
+		if (scan->dissector)
+			LbDissectorFeed(scan->dissector, scan->fields, &segment[headerLength], payloadLength, NULL, NULL);
+	}
+	*outputLength = headerLength + (ULONG)written;
+	scan->replacements += replacements;
+
+	if (key->protocol == LB_IPPROTO_TCP)
+	{
+		UINT32 sequence = LbReadBe32(&segment[4]);
+		UINT32 mapped = LbSeqTrackerMapSeq(seq, sequence);
+
+		LbSeqTrackerRecord(seq, sequence, payloadLength, (UINT32)written);
+
+		if (replacements == 0 && mapped == sequence)
+			return FALSE;
+
+		LbWriteBe32(&output[4], mapped);
+	}
+	else
+	{
+		if (replacements == 0)
+			return FALSE;
+
+		LbWriteBe16(&output[4], (UINT16)*outputLength);
+	}
+
+	// Checksum offload only applies to the original, the new segment carries a complete checksum
+	LbWriteBe16(&output[checksumOffset], 0);
+	checksum = LbTransportChecksumV4(key->localAddress, key->remoteAddress, key->protocol, output, *outputLength);
+	if (checksum == 0 && key->protocol == LB_IPPROTO_UDP)
+		checksum = 0xFFFF;
+	LbWriteBe16(&output[checksumOffset], checksum);
+
+	return TRUE;
+}
+
+/////////////////////
+// STREAM CHUNKING //
+/////////////////////
+
+UINT32 LbStreamWait(const LB_STREAM_POLICY* policy, SIZE_T available, UINT32 flags)
+{
+	// Data that has to leave now is scanned however little of it there is
+	if (flags & (LB_STREAM_FLUSH | LB_STREAM_END))
+		return 0;
+
+	return available < policy->chunk ? policy->chunk : 0;
+}
+
+UINT32 LbRewriteStream(
+	const LB_STREAM_POLICY* policy,
+	LB_SCAN_CONTEXT* scan,
+	const UINT8* data,
+	SIZE_T length,
+	UINT32 flags,
+	UINT8* output,
+	SIZE_T capacity,
+	SIZE_T* consumed,
+	SIZE_T* written)
+{
+	SIZE_T window = length < capacity ? length : capacity;
+	SIZE_T hold = 0;
+	UINT32 state = scan->state;
+	UINT64 bytes = scan->bytes;
+	UINT64 skipped = scan->skipped;
+	LB_DISSECTOR dissector = { 0 };
+	UINT32 replacements = 0;
+
+	*consumed = 0;
+	*written = 0;
+
+	// Only as much as can grow into output is scanned now
+	while (window > 0 && LbMatcherRewriteBound(scan->matcher, window) > capacity)
+		window /= 2;
+	if (window == 0)
+		return 0;
+
+	// Stream data comes in order and is never resent, the flow's dissector follows it without sequence numbers
+	scan->dissector = NULL;
+	if (scan->fields != 0)
+	{
+		scan->dissector = scan->stream;
+		if (!scan->dissector)
+		{
+			// Without a flow context every write is dissected as if it started the stream
+			LbDissectorBegin(&scan->single, LbDissectorForFlow(scan->key));
+			scan->dissector = &scan->single;
+		}
+		dissector = *scan->dissector;
+	}
+
+	replacements = LbRewritePayload(scan, &scan->state, data, window, output, written);
+	*consumed = window;
+
+	// A match can only continue past the window when more follows: the rest of this write, or a later write
+	// unless the sender is flushing. One longer than everything that fits is never found whole anyway.
+	if (window < length || !(flags & (LB_STREAM_FLUSH | LB_STREAM_END)))
+	{
+		hold = LbMatcherPendingLength(scan->matcher, scan->state);
+		if (hold > policy->lookahead) hold = policy->lookahead;
+		if (hold > window) hold = window;
+		if (hold == window && window < length)
+			hold = 0;
+	}
+
+	if (hold > 0)
+	{
+		// The window ends inside a possible match. Where it began is left for the next call, which sees it
+		// together with what follows, and everything before is scanned again from where this call started.
+		scan->state = state;
+		scan->bytes = bytes;
+		scan->skipped = skipped;
+		if (scan->dissector)
+			*scan->dissector = dissector;
+
+		*consumed = window - hold;
+		*written = 0;
+		replacements = 0;
+		if (*consumed > 0)
+			replacements = LbRewritePayload(scan, &scan->state, data, *consumed, output, written);
+	}
+
+	scan->replacements += replacements;
+	return replacements;
+}
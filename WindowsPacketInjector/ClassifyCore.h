@@ -0,0 +1,169 @@
+/*/
+/*  ** ClassifyCore.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the part of the classify path that does not depend on WFP or NDIS:
+/*	deciding a flow's verdict and running the match engine over contiguous transport segments,
+/*	or over the in-order data of a TCP stream together with the policy that batches it.
+/*	The callout only extracts the flow key and the packet buffers and hands them to these functions,
+/*	so the same code can be driven from a user mode program with packets read from a capture file.
+/*
+/*	Everything that differs between the transport layers the callout runs at is described by an
+/*	LB_LAYER_TRAITS. Its members are compile time constants, so each layer gets its own copy of the
+/*	classify path with the decisions for other layers compiled out rather than tested per packet.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "RuleSet.h"
+#include "SeqTracker.h"
+#include "Stats.h"
+#include "Dissector.h"
+#include "Checksum.h"
+
+// Carries the automaton position from one buffer to the next
+struct LB_SCAN_CONTEXT
+{
+	const LB_MATCHER* matcher;
+	LbMatcherReplaceCallback* replace;	// LB_RULESET::replace, NULL runs LbMatcherReplace
+	UINT32 state;
+	UINT32 replacements;
+	UINT64 bytes;
+	BOOLEAN timed;				// Add the time spent in the match engine to matchCycles
+	UINT64 matchCycles;
+
+	// Only used when the rule set targets fields
+	UINT32 fields;				// LB_FIELD_*, 0 scans every byte
+	const LB_FLOW_KEY* key;
+	LB_DISSECTOR* stream;		// The flow's dissector, NULL without a flow context
+	LB_DISSECTOR* dissector;	// Dissector of the current segment, NULL scans every byte of it
+	LB_DISSECTOR single;		// Dissector of a datagram, or of a segment outside of a flow
+	UINT64 skipped;				// Payload bytes kept from the match engine
+	UINT8* span;				// Buffer being scanned in place, the dissector reports offsets into it
+
+	// Only used when scanning in place
+	SIZE_T offset;				// Payload bytes of the current segment before span
+	LB_CHECKSUM_EDITS edits;	// What was rewritten in the current segment, for its checksum
+	LB_MATCHER_SPANS spans;		// Buffers of the current segment already scanned, a match that began in them is rewritten there
+};
+
+// What the classify path needs to know about one transport layer
+template <LB_DIRECTION Direction, LB_ADDRESS_FAMILY Family>
+struct LB_LAYER_TRAITS
+{
+	static const LB_DIRECTION direction = Direction;
+	static const LB_ADDRESS_FAMILY family = Family;
+	static const UINT32 addressBytes = Family == LB_FAMILY_IPV6 ? 16 : 4;
+
+	// Outbound layers hand out a segment from its transport header on, inbound layers from its payload on
+	static const BOOLEAN headerInData = Direction == LB_DIRECTION_OUTBOUND;
+
+	// Only the outgoing stream carries its match state in the flow context, an incoming segment is matched on its own
+	static const BOOLEAN flowState = Direction == LB_DIRECTION_OUTBOUND;
+
+	// Size changes (and the workers, which send what they inspected) need segments injected through the IPv4
+	// send path. Incoming IPv4 acknowledgements are translated to match the resized stream.
+	static const BOOLEAN resizes = Direction == LB_DIRECTION_OUTBOUND && Family == LB_FAMILY_IPV4;
+	static const BOOLEAN translatesAcks = Direction == LB_DIRECTION_INBOUND && Family == LB_FAMILY_IPV4;
+};
+
+typedef LB_LAYER_TRAITS<LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4> LB_LAYER_OUTBOUND_V4;
+typedef LB_LAYER_TRAITS<LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV6> LB_LAYER_OUTBOUND_V6;
+typedef LB_LAYER_TRAITS<LB_DIRECTION_INBOUND, LB_FAMILY_IPV4> LB_LAYER_INBOUND_V4;
+typedef LB_LAYER_TRAITS<LB_DIRECTION_INBOUND, LB_FAMILY_IPV6> LB_LAYER_INBOUND_V6;
+
+// Fill in the parts of a flow key that come from the layer rather than the packet
+template <class Layer>
+inline void LbClassifyKeyLayer(LB_FLOW_KEY* key)
+{
+	key->direction = (UINT8)Layer::direction;
+	key->family = (UINT8)Layer::family;
+}
+
+// Verdict of a flow seen at Layer. Repeat packets take the cached verdict, only new flows evaluate the rules.
+template <class Layer>
+inline LB_VERDICT LbClassifyLookup(const LB_RULESET* rules, const LB_FLOW_KEY* key, LB_STATS_PROCESSOR* stats)
+{
+	LB_VERDICT verdict = LbVerdictCacheLookup(key);
+	if (verdict != LB_VERDICT_NONE)
+		return verdict;
+
+	// Address rules only cover IPv4, the other evaluation is never compiled in
+	verdict = Layer::family == LB_FAMILY_IPV4 ?
+		LbRuleSetEvaluate(rules, key, Layer::direction) :
+		LbRuleSetEvaluatePorts(rules, key, Layer::direction);
+	LbVerdictCacheInsert(key, verdict);
+	LbStatsCount(stats, LB_COUNTER_RULE_LOOKUPS);
+
+	return verdict;
+}
+
+// Choose the dissector for the payload of the next segment, length bytes starting at TCP sequence number
+// sequence. LbRewriteTransport does this itself, scans in place call it before the payload's first buffer.
+void LbScanSegment(LB_SCAN_CONTEXT* scan, UINT32 sequence, SIZE_T length);
+
+// Replace matches of equal length pairs in place, continuing where the previous buffer left off.
+// The buffers of a segment's payload are passed in order, each rewrite is recorded in scan->edits.
+void LbScanBuffer(LB_SCAN_CONTEXT* scan, UINT8* data, SIZE_T length);
+
+// Where the checksum of a segment rewritten in place stands, see LbScanChecksum
+enum LB_SCAN_CHECKSUM
+{
+	LB_SCAN_CHECKSUM_UNCHANGED = 0,	// Nothing was rewritten, or the segment carries no checksum
+	LB_SCAN_CHECKSUM_PATCHED,		// checksum holds the patched value
+	LB_SCAN_CHECKSUM_RECOMPUTE		// Too much changed, the segment has to be summed again
+};
+
+// Patch the checksum of the segment scanned since LbScanSegment for the edits made to it, checksum
+// being the value the segment was sent with. A UDP datagram sent without a checksum keeps it that way.
+LB_SCAN_CHECKSUM LbScanChecksum(const LB_SCAN_CONTEXT* scan, UINT16* checksum);
+
+// Write a rewritten copy of one TCP or UDP segment (transport header and payload) to output,
+// with sequence number and checksum fixed up. seq is the flow's offset tracker and may only be
+// NULL for UDP. Returns FALSE when the original should be permitted as it is, because nothing
+// changed or because the segment cannot be rewritten within capacity bytes.
+BOOLEAN LbRewriteTransport(
+	const LB_FLOW_KEY* key,
+	LB_SEQ_TRACKER* seq,
+	LB_SCAN_CONTEXT* scan,
+	const UINT8* segment,
+	ULONG length,
+	UINT8* output,
+	ULONG capacity,
+	ULONG* outputLength);
+
+// Conditions of a stream write the chunking policy reacts to
+#define LB_STREAM_FLUSH		0x00000001	// The sender wants the data out without delay
+#define LB_STREAM_END		0x00000002	// Nothing follows in this direction
+
+// How stream data is batched before it is scanned, see LB_RULES_HEADER::streamChunk and streamLookahead
+struct LB_STREAM_POLICY
+{
+	UINT32 chunk;
+	UINT32 lookahead;
+};
+
+// Bytes of stream data to collect before the available bytes are scanned, 0 to scan them now
+UINT32 LbStreamWait(const LB_STREAM_POLICY* policy, SIZE_T available, UINT32 flags);
+
+// Write a rewritten copy of the front of length bytes of in-order stream data to output, which holds
+// capacity bytes, continuing where the previous call left off. consumed receives the input bytes that were
+// scanned and written what they became. The bytes after them did not fit or may start a match the next data
+// completes; they are not part of the result and have to come first in the next call.
+// Returns the number of replacements made.
+UINT32 LbRewriteStream(
+	const LB_STREAM_POLICY* policy,
+	LB_SCAN_CONTEXT* scan,
+	const UINT8* data,
+	SIZE_T length,
+	UINT32 flags,
+	UINT8* output,
+	SIZE_T capacity,
+	SIZE_T* consumed,
+	SIZE_T* written);
@@ -0,0 +1,594 @@
+/*/
+/*  ** Dissector.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the streaming HTTP and DNS dissectors.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- R. Fielding, M. Nottingham, J. Reschke, RFC 9112 "HTTP/1.1", https://www.rfc-editor.org/rfc/rfc9112
+/*			* Message framing: start line, header lines, Content-Length and chunked bodies.
+/*			* Responses to which no body can follow, and bodies that end with the connection.
+/*		- P. Mockapetris, RFC 1035 "Domain Names - Implementation and Specification", https://www.rfc-editor.org/rfc/rfc1035
+/*			* Message header, question and resource record layout, label and pointer encoding of names.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "Dissector.h"
+#include "Checksum.h"
+
+////////////
+// PHASES //
+////////////
+
+enum LB_HTTP_PHASE : UINT8
+{
+	LB_HTTP_START_LINE = 0,		// Blank lines before the start line are skipped
+	LB_HTTP_HEADERS,
+	LB_HTTP_BODY,				// remaining bytes of body left
+	LB_HTTP_BODY_TO_CLOSE,		// Response without a length, its body ends with the connection
+	LB_HTTP_CHUNK_SIZE,			// Size line of the next chunk
+	LB_HTTP_CHUNK_DATA,			// remaining bytes of chunk data left
+	LB_HTTP_CHUNK_END,			// Line ending after the chunk data
+	LB_HTTP_TRAILERS,			// Header lines after the last chunk
+};
+
+#define LB_HTTP_FLAG_RESPONSE	0x01
+#define LB_HTTP_FLAG_LENGTH		0x02
+#define LB_HTTP_FLAG_CHUNKED	0x04
+
+enum LB_DNS_PHASE : UINT8
+{
+	LB_DNS_HEADER = 0,
+	LB_DNS_NAME,				// Next byte is a label length or the first byte of a pointer
+	LB_DNS_LABEL,				// remaining bytes of a label left
+	LB_DNS_POINTER,				// Second byte of a compression pointer
+	LB_DNS_QUESTION,			// Type and class of a question
+	LB_DNS_RECORD,				// Type, class, TTL and data length of a record
+	LB_DNS_DATA,				// remaining bytes of record data left
+	LB_DNS_END,					// Past the last record
+};
+
+#define LB_DNS_FLAG_RECORD		0x01	// The name being read is the owner of a record, not a question
+
+/////////////
+// HELPERS //
+/////////////
+
+// Where runs of one LbDissectorFeed call go
+struct LB_DISSECTOR_FEED
+{
+	UINT32 fields;
+	LbDissectorCallback* callbackFn;
+	void* value;
+};
+
+static inline SIZE_T LbMinSize(UINT64 a, SIZE_T b)
+{
+	return a < b ? (SIZE_T)a : b;
+}
+
+static inline void LbDissectorEmit(LB_DISSECTOR* dissector, const LB_DISSECTOR_FEED* feed, UINT32 field, SIZE_T offset, SIZE_T length)
+{
+	BOOLEAN first = field != dissector->lastField;
+
+	dissector->lastField = field;
+	if (length != 0 && (field & feed->fields) && feed->callbackFn)
+		feed->callbackFn(offset, length, first, feed->value);
+}
+
+// The stream no longer makes sense, everything after this is LB_FIELD_OTHER
+static inline void LbDissectorLost(LB_DISSECTOR* dissector)
+{
+	dissector->protocol = LB_DISSECTOR_NONE;
+}
+
+// Consumes bytes up to and including the end of the current line, keeping its start in line.
+// *ended is set when the line feed was among them.
+static SIZE_T LbDissectorLine(LB_DISSECTOR* dissector, const UINT8* data, SIZE_T length, BOOLEAN* ended)
+{
+	const UINT8* feed = (const UINT8*)memchr(data, '\n', length);
+	SIZE_T used = feed ? (SIZE_T)(feed - data) + 1 : length;
+	SIZE_T content = feed ? used - 1 : used;
+
+	if (dissector->lineLength < LB_DISSECTOR_LINE)
+	{
+		SIZE_T keep = LbMinSize(LB_DISSECTOR_LINE - dissector->lineLength, content);
+		memcpy(&dissector->line[dissector->lineLength], data, keep);
+	}
+
+	dissector->lineLength = content > 0xFFFFFFFF - dissector->lineLength ? 0xFFFFFFFF : dissector->lineLength + (UINT32)content;
+	*ended = feed != NULL;
+	return used;
+}
+
+// Bytes of the current line that were kept
+static inline UINT32 LbDissectorLineKept(const LB_DISSECTOR* dissector)
+{
+	return dissector->lineLength < LB_DISSECTOR_LINE ? dissector->lineLength : LB_DISSECTOR_LINE;
+}
+
+// The line that just ended held nothing but its line ending
+static inline BOOLEAN LbDissectorLineEmpty(const LB_DISSECTOR* dissector)
+{
+	return dissector->lineLength == 0 || (dissector->lineLength == 1 && dissector->line[0] == '\r');
+}
+
+// Consumes bytes of a part of fixed size into line, the part is complete once lineLength reaches size
+static SIZE_T LbDissectorFixed(LB_DISSECTOR* dissector, const UINT8* data, SIZE_T length, UINT32 size)
+{
+	SIZE_T used = LbMinSize(size - dissector->lineLength, length);
+
+	memcpy(&dissector->line[dissector->lineLength], data, used);
+	dissector->lineLength += (UINT32)used;
+	return used;
+}
+
+// The current line starts with prefix, compared without regard to case
+static BOOLEAN LbDissectorLineStartsWith(const LB_DISSECTOR* dissector, const char* prefix)
+{
+	UINT32 kept = LbDissectorLineKept(dissector);
+	UINT32 i = 0;
+
+	for (; prefix[i] != '\0'; i++)
+	{
+		if (i >= kept)
+			return FALSE;
+
+		UINT8 c = dissector->line[i];
+		if ((c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c) != (UINT8)prefix[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+// The current line contains word anywhere after start, compared without regard to case
+static BOOLEAN LbDissectorLineContains(const LB_DISSECTOR* dissector, UINT32 start, const char* word)
+{
+	UINT32 kept = LbDissectorLineKept(dissector);
+	UINT32 length = (UINT32)strlen(word);
+
+	for (UINT32 i = start; i + length <= kept; i++)
+	{
+		UINT32 j = 0;
+		for (; j < length; j++)
+		{
+			UINT8 c = dissector->line[i + j];
+			if ((c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c) != (UINT8)word[j])
+				break;
+		}
+
+		if (j == length)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+//////////
+// HTTP //
+//////////
+
+static void LbHttpMessageBegin(LB_DISSECTOR* dissector)
+{
+	dissector->phase = LB_HTTP_START_LINE;
+	dissector->flags = 0;
+	dissector->count = 0;
+	dissector->remaining = 0;
+}
+
+// A request line is a method of upper case letters and a space, a status line starts with HTTP/1.x and its code
+static void LbHttpStartLineEnd(LB_DISSECTOR* dissector)
+{
+	UINT32 kept = LbDissectorLineKept(dissector);
+	const UINT8* line = dissector->line;
+	UINT32 i = 0;
+
+	if (LbDissectorLineEmpty(dissector))
+		return;
+
+	if (kept >= 12 && memcmp(line, "HTTP/", 5) == 0)
+	{
+		if (line[8] != ' ' || line[9] < '0' || line[9] > '9' || line[10] < '0' || line[10] > '9' || line[11] < '0' || line[11] > '9')
+		{
+			LbDissectorLost(dissector);
+			return;
+		}
+
+		dissector->flags |= LB_HTTP_FLAG_RESPONSE;
+		dissector->count = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+		dissector->phase = LB_HTTP_HEADERS;
+		return;
+	}
+
+	while (i < kept && line[i] >= 'A' && line[i] <= 'Z')
+		i++;
+
+	if (i == 0 || i == kept || line[i] != ' ')
+	{
+		LbDissectorLost(dissector);
+		return;
+	}
+
+	dissector->phase = LB_HTTP_HEADERS;
+}
+
+// Decides what follows the headers once the blank line ending them went by
+static void LbHttpBodyBegin(LB_DISSECTOR* dissector)
+{
+	BOOLEAN response = (dissector->flags & LB_HTTP_FLAG_RESPONSE) != 0;
+	UINT32 status = dissector->count;
+
+	// 1xx, 204 and 304 responses never have a body, whatever their headers say
+	if (response && (status < 200 || status == 204 || status == 304))
+		LbHttpMessageBegin(dissector);
+	else if (dissector->flags & LB_HTTP_FLAG_CHUNKED)
+		dissector->phase = LB_HTTP_CHUNK_SIZE;
+	else if (dissector->flags & LB_HTTP_FLAG_LENGTH)
+	{
+		if (dissector->remaining != 0)
+			dissector->phase = LB_HTTP_BODY;
+		else
+			LbHttpMessageBegin(dissector);
+	}
+	else if (response)
+		dissector->phase = LB_HTTP_BODY_TO_CLOSE;
+	else
+		LbHttpMessageBegin(dissector);
+}
+
+static void LbHttpHeaderEnd(LB_DISSECTOR* dissector)
+{
+	if (LbDissectorLineEmpty(dissector))
+	{
+		LbHttpBodyBegin(dissector);
+		return;
+	}
+
+	if (LbDissectorLineStartsWith(dissector, "content-length:"))
+	{
+		UINT32 kept = LbDissectorLineKept(dissector);
+		UINT32 i = 15;
+		UINT64 length = 0;
+
+		while (i < kept && (dissector->line[i] == ' ' || dissector->line[i] == '\t'))
+			i++;
+
+		// A length that does not fit or is not a number leaves no way to find the next message
+		if (i == kept || dissector->line[i] < '0' || dissector->line[i] > '9')
+		{
+			LbDissectorLost(dissector);
+			return;
+		}
+
+		for (; i < kept && dissector->line[i] >= '0' && dissector->line[i] <= '9'; i++)
+		{
+			if (length > 0xFFFFFFFFFFFull)
+			{
+				LbDissectorLost(dissector);
+				return;
+			}
+			length = length * 10 + (dissector->line[i] - '0');
+		}
+
+		dissector->flags |= LB_HTTP_FLAG_LENGTH;
+		dissector->remaining = length;
+	}
+	else if (LbDissectorLineStartsWith(dissector, "transfer-encoding:") && LbDissectorLineContains(dissector, 18, "chunked"))
+	{
+		// Chunked takes precedence over a length sent along with it
+		dissector->flags |= LB_HTTP_FLAG_CHUNKED;
+	}
+}
+
+static void LbHttpChunkSizeEnd(LB_DISSECTOR* dissector)
+{
+	UINT32 kept = LbDissectorLineKept(dissector);
+	UINT64 size = 0;
+	UINT32 i = 0;
+
+	for (; i < kept; i++)
+	{
+		UINT8 c = dissector->line[i];
+		int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+		if (digit < 0)
+			break;
+
+		if (size >> 40)
+		{
+			LbDissectorLost(dissector);
+			return;
+		}
+		size = size * 16 + digit;
+	}
+
+	if (i == 0)
+	{
+		LbDissectorLost(dissector);
+		return;
+	}
+
+	dissector->remaining = size;
+	dissector->phase = size != 0 ? LB_HTTP_CHUNK_DATA : LB_HTTP_TRAILERS;
+}
+
+// Consumes the next part of an HTTP stream, returns the bytes used
+static SIZE_T LbHttpStep(LB_DISSECTOR* dissector, const LB_DISSECTOR_FEED* feed, const UINT8* data, SIZE_T offset, SIZE_T length)
+{
+	BOOLEAN ended = FALSE;
+	SIZE_T used = 0;
+
+	switch (dissector->phase)
+	{
+	case LB_HTTP_START_LINE:
+		// Anything but a method, HTTP/ or a blank line means this is not HTTP after all
+		if (dissector->lineLength == 0 && (data[0] < 'A' || data[0] > 'Z') && data[0] != '\r' && data[0] != '\n')
+		{
+			LbDissectorLost(dissector);
+			return 0;
+		}
+
+		used = LbDissectorLine(dissector, data, length, &ended);
+		LbDissectorEmit(dissector, feed, LB_FIELD_HTTP_START_LINE, offset, used);
+		if (ended) LbHttpStartLineEnd(dissector);
+		break;
+
+	case LB_HTTP_HEADERS:
+		used = LbDissectorLine(dissector, data, length, &ended);
+		LbDissectorEmit(dissector, feed, LB_FIELD_HTTP_HEADERS, offset, used);
+		if (ended) LbHttpHeaderEnd(dissector);
+		break;
+
+	case LB_HTTP_BODY:
+		used = LbMinSize(dissector->remaining, length);
+		LbDissectorEmit(dissector, feed, LB_FIELD_HTTP_BODY, offset, used);
+		dissector->remaining -= used;
+		if (dissector->remaining == 0)
+			LbHttpMessageBegin(dissector);
+		return used;
+
+	case LB_HTTP_BODY_TO_CLOSE:
+		LbDissectorEmit(dissector, feed, LB_FIELD_HTTP_BODY, offset, length);
+		return length;
+
+	// Chunk framing belongs to no field, the body continues across it as a single field
+	case LB_HTTP_CHUNK_SIZE:
+		used = LbDissectorLine(dissector, data, length, &ended);
+		if (ended) LbHttpChunkSizeEnd(dissector);
+		break;
+
+	case LB_HTTP_CHUNK_DATA:
+		used = LbMinSize(dissector->remaining, length);
+		LbDissectorEmit(dissector, feed, LB_FIELD_HTTP_BODY, offset, used);
+		dissector->remaining -= used;
+		if (dissector->remaining == 0)
+			dissector->phase = LB_HTTP_CHUNK_END;
+		return used;
+
+	case LB_HTTP_CHUNK_END:
+		used = LbDissectorLine(dissector, data, length, &ended);
+		if (ended) dissector->phase = LB_HTTP_CHUNK_SIZE;
+		break;
+
+	case LB_HTTP_TRAILERS:
+		used = LbDissectorLine(dissector, data, length, &ended);
+		if (ended && LbDissectorLineEmpty(dissector))
+			LbHttpMessageBegin(dissector);
+		break;
+	}
+
+	if (ended)
+		dissector->lineLength = 0;
+
+	return used;
+}
+
+/////////
+// DNS //
+/////////
+
+// Moves on to the next question or record, or past the end of the message
+static void LbDnsNext(LB_DISSECTOR* dissector)
+{
+	dissector->lineLength = 0;
+
+	if (dissector->questions > 0)
+	{
+		dissector->phase = LB_DNS_NAME;
+		dissector->flags &= ~LB_DNS_FLAG_RECORD;
+	}
+	else if (dissector->count > 0)
+	{
+		dissector->phase = LB_DNS_NAME;
+		dissector->flags |= LB_DNS_FLAG_RECORD;
+	}
+	else
+		dissector->phase = LB_DNS_END;
+}
+
+// Consumes as much of a name as there is, returns the bytes used. lineLength counts the bytes of the name.
+static SIZE_T LbDnsName(LB_DISSECTOR* dissector, const LB_DISSECTOR_FEED* feed, const UINT8* data, SIZE_T offset, SIZE_T length)
+{
+	BOOLEAN ended = FALSE;
+	SIZE_T used = 0;
+
+	while (used < length && !ended && dissector->protocol == LB_DISSECTOR_DNS)
+	{
+		if (dissector->phase == LB_DNS_LABEL)
+		{
+			SIZE_T take = LbMinSize(dissector->remaining, length - used);
+			used += take;
+			dissector->remaining -= take;
+			if (dissector->remaining == 0)
+				dissector->phase = LB_DNS_NAME;
+			continue;
+		}
+
+		if (dissector->phase == LB_DNS_POINTER)
+		{
+			used++;
+			ended = TRUE;
+			continue;
+		}
+
+		UINT8 label = data[used++];
+		if (label == 0)
+			ended = TRUE;
+		else if ((label & 0xC0) == 0xC0)
+			dissector->phase = LB_DNS_POINTER;
+		else if ((label & 0xC0) != 0 || dissector->lineLength + 1 + label > 255)
+			LbDissectorLost(dissector);
+		else
+		{
+			dissector->phase = LB_DNS_LABEL;
+			dissector->remaining = label;
+			dissector->lineLength += 1 + label;
+		}
+	}
+
+	LbDissectorEmit(dissector, feed, LB_FIELD_DNS_NAMES, offset, used);
+
+	if (ended)
+	{
+		dissector->lineLength = 0;
+		dissector->phase = (dissector->flags & LB_DNS_FLAG_RECORD) ? LB_DNS_RECORD : LB_DNS_QUESTION;
+	}
+
+	return used;
+}
+
+// Consumes the next part of a DNS message, returns the bytes used
+static SIZE_T LbDnsStep(LB_DISSECTOR* dissector, const LB_DISSECTOR_FEED* feed, const UINT8* data, SIZE_T offset, SIZE_T length)
+{
+	SIZE_T used = 0;
+
+	switch (dissector->phase)
+	{
+	case LB_DNS_HEADER:
+		used = LbDissectorFixed(dissector, data, length, 12);
+		LbDissectorEmit(dissector, feed, 0, offset, used);
+		if (dissector->lineLength == 12)
+		{
+			dissector->questions = LbReadBe16(&dissector->line[4]);
+			dissector->count = (UINT32)LbReadBe16(&dissector->line[6]) + LbReadBe16(&dissector->line[8]) + LbReadBe16(&dissector->line[10]);
+			LbDnsNext(dissector);
+		}
+		return used;
+
+	case LB_DNS_NAME:
+	case LB_DNS_LABEL:
+	case LB_DNS_POINTER:
+		return LbDnsName(dissector, feed, data, offset, length);
+
+	case LB_DNS_QUESTION:
+		used = LbDissectorFixed(dissector, data, length, 4);
+		LbDissectorEmit(dissector, feed, 0, offset, used);
+		if (dissector->lineLength == 4)
+		{
+			dissector->questions--;
+			LbDnsNext(dissector);
+		}
+		return used;
+
+	case LB_DNS_RECORD:
+		used = LbDissectorFixed(dissector, data, length, 10);
+		LbDissectorEmit(dissector, feed, 0, offset, used);
+		if (dissector->lineLength == 10)
+		{
+			dissector->remaining = LbReadBe16(&dissector->line[8]);
+			dissector->phase = LB_DNS_DATA;
+			if (dissector->remaining == 0)
+			{
+				dissector->count--;
+				LbDnsNext(dissector);
+			}
+		}
+		return used;
+
+	case LB_DNS_DATA:
+		used = LbMinSize(dissector->remaining, length);
+		LbDissectorEmit(dissector, feed, LB_FIELD_DNS_DATA, offset, used);
+		dissector->remaining -= used;
+		if (dissector->remaining == 0)
+		{
+			dissector->count--;
+			LbDnsNext(dissector);
+		}
+		return used;
+	}
+
+	// Whatever follows the last record is not part of the message
+	LbDissectorEmit(dissector, feed, 0, offset, length);
+	return length;
+}
+
+////////////////
+// OPERATIONS //
+////////////////
+
+UINT8 LbDissectorForFlow(const LB_FLOW_KEY* key)
+{
+	if (key->protocol == LB_IPPROTO_TCP && (key->remotePort == LB_HTTP_PORT || key->localPort == LB_HTTP_PORT))
+		return LB_DISSECTOR_HTTP;
+
+	if (key->protocol == LB_IPPROTO_UDP && (key->remotePort == LB_DNS_PORT || key->localPort == LB_DNS_PORT))
+		return LB_DISSECTOR_DNS;
+
+	return LB_DISSECTOR_NONE;
+}
+
+void LbDissectorBegin(LB_DISSECTOR* dissector, UINT8 protocol)
+{
+	memset(dissector, 0, sizeof(LB_DISSECTOR));
+	dissector->protocol = protocol;
+}
+
+BOOLEAN LbDissectorInSequence(LB_DISSECTOR* dissector, UINT32 sequence, SIZE_T length)
+{
+	// Nothing depends on the position in a stream without a protocol, and empty segments carry nothing to place
+	if (dissector->protocol == LB_DISSECTOR_NONE || length == 0)
+		return TRUE;
+
+	if (!dissector->sequenced || sequence == dissector->nextSequence)
+	{
+		dissector->sequenced = TRUE;
+		dissector->nextSequence = sequence + (UINT32)length;
+		return TRUE;
+	}
+
+	// Sequence numbers wrap, only their difference tells which comes first
+	if ((INT32)(sequence - dissector->nextSequence) < 0)
+		return FALSE;
+
+	// Bytes went by unseen, there is no telling where in a message the stream is now
+	LbDissectorLost(dissector);
+	return TRUE;
+}
+
+void LbDissectorFeed(LB_DISSECTOR* dissector, UINT32 fields, const UINT8* data, SIZE_T length, LbDissectorCallback* callbackFn, void* value)
+{
+	LB_DISSECTOR_FEED feed = { fields, callbackFn, value };
+	SIZE_T offset = 0;
+
+	// Every step uses at least one byte, or gives up on the protocol and leaves the rest to the next case
+	while (offset < length)
+	{
+		switch (dissector->protocol)
+		{
+		case LB_DISSECTOR_HTTP:
+			offset += LbHttpStep(dissector, &feed, &data[offset], offset, length - offset);
+			break;
+		case LB_DISSECTOR_DNS:
+			offset += LbDnsStep(dissector, &feed, &data[offset], offset, length - offset);
+			break;
+		default:
+			LbDissectorEmit(dissector, &feed, LB_FIELD_OTHER, offset, length - offset);
+			offset = length;
+			break;
+		}
+	}
+}
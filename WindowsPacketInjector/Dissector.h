@@ -0,0 +1,79 @@
+/*/
+/*  ** Dissector.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the HTTP and DNS dissectors that limit a scan to the fields a rule set targets.
+/*	A dissector is fed a flow's payload in order, in pieces of any size, and reports which runs of it
+/*	belong to which LB_FIELD_*. It never looks at a byte twice and never reads past what it was given.
+/*	Bodies with a known length and DNS record data are skipped by counting, so a header only rule set
+/*	costs the same on a large upload as on a tiny request.
+/*
+/*	HTTP/1.x is followed through any number of messages on a connection, including chunked bodies.
+/*	DNS is only dissected over UDP, where every datagram is one complete message.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+#include "VerdictCache.h"
+
+// Well known ports a flow is dissected on, either end of the connection may use them
+#define LB_HTTP_PORT 80
+#define LB_DNS_PORT 53
+
+// Bytes kept of every line, enough for the headers the dissector reads
+#define LB_DISSECTOR_LINE 64
+
+enum LB_DISSECTOR_PROTOCOL : UINT8
+{
+	LB_DISSECTOR_NONE = 0,		// Everything is LB_FIELD_OTHER
+	LB_DISSECTOR_HTTP,
+	LB_DISSECTOR_DNS,
+};
+
+struct LB_DISSECTOR
+{
+	UINT8 protocol;				// LB_DISSECTOR_PROTOCOL, LB_DISSECTOR_NONE as well once the stream stops making sense
+	UINT8 phase;				// Protocol specific
+	UINT8 flags;				// Protocol specific
+	UINT8 sequenced;			// nextSequence is valid
+	UINT32 lastField;			// Field of the previous run, a run of another field starts a new match
+	UINT32 nextSequence;		// TCP sequence number of the next byte expected
+	UINT32 lineLength;			// Bytes of the current line so far, only the first LB_DISSECTOR_LINE are kept
+	UINT32 count;				// HTTP status code, DNS records left
+	UINT32 questions;			// DNS questions left
+	UINT64 remaining;			// Bytes left in the current body, chunk, label or record
+	UINT8 line[LB_DISSECTOR_LINE];
+};
+
+// Receives a run of length bytes starting offset bytes into the data given to LbDissectorFeed.
+// first is set when the run starts a new field rather than continuing the one of the previous run.
+typedef void(LbDissectorCallback)(SIZE_T offset, SIZE_T length, BOOLEAN first, void* value);
+
+// Dissector a flow gets from its protocol and ports
+UINT8 LbDissectorForFlow(const LB_FLOW_KEY* key);
+
+// Start a new stream, or a new datagram
+void LbDissectorBegin(LB_DISSECTOR* dissector, UINT8 protocol);
+
+// Place a TCP segment of length bytes at sequence in the stream before feeding it. Returns FALSE for a
+// segment resending bytes the dissector already saw, it must not be fed. After a gap the stream is lost
+// and everything from then on is LB_FIELD_OTHER.
+BOOLEAN LbDissectorInSequence(LB_DISSECTOR* dissector, UINT32 sequence, SIZE_T length);
+
+// Feed the next bytes of the stream. callbackFn is called for every run belonging to one of fields,
+// in order; it may be NULL to only keep the dissector in step with the stream.
+void LbDissectorFeed(
+	LB_DISSECTOR* dissector,
+	UINT32 fields,
+	const UINT8* data,
+	SIZE_T length,
+	LbDissectorCallback* callbackFn,
+	void* value
+);
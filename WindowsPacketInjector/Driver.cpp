@@ -24,6 +24,14 @@
 
 #include "Driver.h"
 #include "InjectionCallout.h"
+#include "FlowContext.h"
+#include "VerdictCache.h"
+#include "PacketInjector.h"
+#include "FilterCompiler.h"
+#include "EventLog.h"
+#include "Stats.h"
+#include "Ioctl.h"
+#include "RuleImage.h"
 
 #pragma warning(disable: 4390)
 
@@ -40,23 +48,63 @@
 HANDLE lbFilterEngineHandle = NULL;
 
 // Filter and Callout ID's
-UINT64 lbInjectionFilterId = 0;
-UINT32 lbInjectionCalloutId;
+UINT64* lbRuleFilterIds = NULL;		// One per filter generated from the active rule set
+UINT32 lbRuleFilterCount = 0;
+UINT32 lbInjectionCalloutIds[LB_CALLOUT_COUNT] = { 0 };
+UINT64 lbAckFilterId = 0;
 
 // Callout and Filter names
 
-// Data and constants for the example Callout
+// Data and constants for the injection Callouts, one per transport layer
 #define INJECTION_CALLOUT_NAME		L"InjectionCallout"
+#define INJECTION_CALLOUT_V6_NAME	L"InjectionCalloutV6"
+#define INBOUND_CALLOUT_NAME		L"InboundCallout"
+#define INBOUND_CALLOUT_V6_NAME		L"InboundCalloutV6"
+#define STREAM_CALLOUT_NAME			L"StreamCallout"
+#define STREAM_CALLOUT_V6_NAME		L"StreamCalloutV6"
 // Data and constants for the example Sublayer
 #define INJECTION_SUBLAYER_NAME		L"InjectionSublayer"
 // Data and constants for the example Filter
 #define INJECTION_FILTER_NAME		L"InjectionFilter"
+// Data and constants for the block and permit Filters generated from the rules
+#define RULE_FILTER_NAME			L"RuleFilter"
+// Data and constants for the Filter that sends every inbound TCP segment to the inbound callout
+#define ACK_FILTER_NAME				L"AckFilter"
 
 // GUID's (generated with uuidgen.exe in command prompt)
 DEFINE_GUID(INJECTION_CALLOUT_GUID,		// cbcf44f8-369a-466d-acec-8a46b29c90d3
 	0xcbcf44f8, 0x369a, 0x466d, 0xac, 0xec, 0x8a, 0x46, 0xb2, 0x9c, 0x90, 0xd3);
 DEFINE_GUID(INJECTION_SUBLAYER_GUID,	// 1497aadc-9239-49a1-8569-55603592b3d9
 	0x1497aadc, 0x9239, 0x49a1, 0x85, 0x69, 0x55, 0x60, 0x35, 0x92, 0xb3, 0xd9);
+DEFINE_GUID(INJECTION_CALLOUT_V6_GUID,	// 0af13441-244b-49a3-a98a-0396dca556fd
+	0x0af13441, 0x244b, 0x49a3, 0xa9, 0x8a, 0x03, 0x96, 0xdc, 0xa5, 0x56, 0xfd);
+DEFINE_GUID(INBOUND_CALLOUT_GUID,		// 6f0d2a4e-81c3-4b7a-9e25-d4c1a7b3f860
+	0x6f0d2a4e, 0x81c3, 0x4b7a, 0x9e, 0x25, 0xd4, 0xc1, 0xa7, 0xb3, 0xf8, 0x60);
+DEFINE_GUID(INBOUND_CALLOUT_V6_GUID,	// 825f2d75-c48e-4357-95b1-2772f32a74d9
+	0x825f2d75, 0xc48e, 0x4357, 0x95, 0xb1, 0x27, 0x72, 0xf3, 0x2a, 0x74, 0xd9);
+DEFINE_GUID(STREAM_CALLOUT_GUID,		// e2b4d5ff-f527-445f-ad33-a1fbb89cd1f6
+	0xe2b4d5ff, 0xf527, 0x445f, 0xad, 0x33, 0xa1, 0xfb, 0xb8, 0x9c, 0xd1, 0xf6);
+DEFINE_GUID(STREAM_CALLOUT_V6_GUID,		// 164a0f3e-84d9-4a34-ae55-d62776e845b7
+	0x164a0f3e, 0x84d9, 0x4a34, 0xae, 0x55, 0xd6, 0x27, 0x76, 0xe8, 0x45, 0xb7);
+
+// Everything that differs between the injection callouts, indexed by LB_CALLOUT_LAYER
+struct LB_CALLOUT_SPEC
+{
+	const GUID* calloutKey;
+	const GUID* layerKey;
+	const wchar_t* name;
+	FWPS_CALLOUT_CLASSIFY_FN classifyFn;
+};
+
+static const LB_CALLOUT_SPEC lbCalloutSpecs[LB_CALLOUT_COUNT] =
+{
+	{ &INJECTION_CALLOUT_GUID, &FWPM_LAYER_OUTBOUND_TRANSPORT_V4, INJECTION_CALLOUT_NAME, LbClassifyOutboundV4 },
+	{ &INJECTION_CALLOUT_V6_GUID, &FWPM_LAYER_OUTBOUND_TRANSPORT_V6, INJECTION_CALLOUT_V6_NAME, LbClassifyOutboundV6 },
+	{ &INBOUND_CALLOUT_GUID, &FWPM_LAYER_INBOUND_TRANSPORT_V4, INBOUND_CALLOUT_NAME, LbClassifyInboundV4 },
+	{ &INBOUND_CALLOUT_V6_GUID, &FWPM_LAYER_INBOUND_TRANSPORT_V6, INBOUND_CALLOUT_V6_NAME, LbClassifyInboundV6 },
+	{ &STREAM_CALLOUT_GUID, &FWPM_LAYER_STREAM_V4, STREAM_CALLOUT_NAME, LbClassifyStreamV4 },
+	{ &STREAM_CALLOUT_V6_GUID, &FWPM_LAYER_STREAM_V6, STREAM_CALLOUT_V6_NAME, LbClassifyStreamV6 },
+};
 
 ////////////////////////
 // DRIVER ENTRY POINT //
@@ -71,12 +119,32 @@ NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING Regi
 	DEVICE_OBJECT* wdmDevObj = NULL;
 	FWPM_SESSION filterSession = { 0 };
 	BOOLEAN bInTransaction = FALSE;
-	BOOLEAN bCalloutRegistered = FALSE;
+
+	// The control device can be opened as soon as it exists, handles to it rely on the capture lock
+	LbInjectionInitializeCapture();
 
 	// Initialize WDF driver object
 	status = LbInitializeDriver(DriverObject, RegistryPath, &driver, &device);
 	if (!NT_SUCCESS(status)) goto Exit;
 
+	// The event log comes first so everything after it can record events
+	status = LbEventLogCreate(LB_EVENT_RING_CAPACITY, &lbEventLog);
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = LbStatsInitialize();
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	// Compile match rules before any packet can reach the callout
+	status = LbInjectionInitialize();
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = LbFlowContextInitialize();
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = LbVerdictCacheInitialize();
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = LbInjectorInitialize();
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = LbInjectionStartWorkers();
+	if (!NT_SUCCESS(status)) goto Exit;
+
 	// Begin transaction
 	filterSession.flags = FWPM_SESSION_FLAG_DYNAMIC;	// Automatically destroys all filters and callouts after this wdf_session ends
 	status = FwpmEngineOpen(NULL, RPC_C_AUTHN_WINNT, NULL, &filterSession, &lbFilterEngineHandle);
@@ -85,18 +153,19 @@ NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING Regi
 	if (!NT_SUCCESS(status)) goto Exit;
 	bInTransaction = TRUE;
 
-	// Register callout
+	// Register callouts
 	wdmDevObj = WdfDeviceWdmGetDeviceObject(device);
 	status = RegisterInjectionCallout(wdmDevObj);
 	if (!NT_SUCCESS(status)) goto Exit;
-	bCalloutRegistered = TRUE;
 
 	// Register sublayer
 	status = InitSublayer();
 	if (!NT_SUCCESS(status)) goto Exit;
 
-	// Register filter
-	status = InitFilter();
+	// Register filters
+	status = LbInjectionInstallFilters();
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = InitAckFilter();
 	if (!NT_SUCCESS(status)) goto Exit;
 
 	// Finalize transaction
@@ -117,8 +186,23 @@ Exit:
 			DWORD result = FwpmTransactionAbort(lbFilterEngineHandle);
 			if (result == 0) _Analysis_assume_lock_not_held_(lbFilterEngineHandle);
 		}
-		if (bCalloutRegistered == TRUE)
-			FwpsCalloutUnregisterById(lbInjectionCalloutId);
+		// Aborting the transaction already took the filters back out
+		if (lbRuleFilterIds)
+		{
+			LbFree(lbRuleFilterIds, 'LBD0');
+			lbRuleFilterIds = NULL;
+			lbRuleFilterCount = 0;
+		}
+		UnregisterInjectionCallout();
+		LbInjectionStopWorkers();
+		LbInjectionCleanup();
+		LbInjectionCleanupCapture();
+		LbInjectorCleanup();
+		LbFlowContextCleanup();
+		LbVerdictCacheCleanup();
+		LbStatsCleanup();
+		LbEventLogDestroy(lbEventLog);
+		lbEventLog = NULL;
 		
 		status = STATUS_FAILED_DRIVER_ENTRY;
 	}
@@ -138,11 +222,25 @@ void DriverUnload(_In_ struct _DRIVER_OBJECT* DriverObject)
     UNICODE_STRING symlink = { 0 };
 
 	// Cleanup filters
-	status = FwpmFilterDeleteById(lbFilterEngineHandle, lbInjectionFilterId);
+	RemoveFilters();
+	status = FwpmFilterDeleteById(lbFilterEngineHandle, lbAckFilterId);
 	if (!NT_SUCCESS(status)) LBPRINTLN("Failed to unregister filters, STATUS CODE: %d", status);
-	status = FwpsCalloutUnregisterById(lbInjectionCalloutId);
-	if (!NT_SUCCESS(status)) LBPRINTLN("Failed to unregister callout, STATUS CODE: %d", status);
+	// Flows holding a context keep the callout busy, detach them first
+	LbFlowContextRemoveAll();
+	UnregisterInjectionCallout();
 	
+	// Cleanup match rules, the callout is gone so no classify can still be using them.
+	// Queued segments are inspected with them first.
+	LbInjectionStopWorkers();
+	LbInjectionCleanup();
+	LbInjectionCleanupCapture();
+	LbInjectorCleanup();
+	LbFlowContextCleanup();
+	LbVerdictCacheCleanup();
+	LbStatsCleanup();
+	LbEventLogDestroy(lbEventLog);
+	lbEventLog = NULL;
+
 	// Close handle to the WFP Filter Engine
 	if (lbFilterEngineHandle) 
 	{
@@ -176,6 +274,10 @@ NTSTATUS LbInitializeDriver(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRI
 	UNICODE_STRING device_name = { 0 };
 	UNICODE_STRING device_symlink = { 0 };
 	PWDFDEVICE_INIT device_init = NULL;
+	WDF_IO_QUEUE_CONFIG queue_config = { 0 };
+	WDF_OBJECT_ATTRIBUTES queue_attributes = { 0 };
+	WDF_FILEOBJECT_CONFIG file_config = { 0 };
+	WDFQUEUE queue = NULL;
 
 	RtlInitUnicodeString(&device_name, DEVICE_NAME);
 	RtlInitUnicodeString(&device_symlink, DOS_DEVICE_NAME);
@@ -201,18 +303,325 @@ NTSTATUS LbInitializeDriver(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRI
 	WdfPdoInitAssignRawDevice(device_init, &GUID_DEVCLASS_NET);
 	WdfDeviceInitSetDeviceClass(device_init, &GUID_DEVCLASS_NET);
 
+	// The capture section is mapped in the context of the process asking for it, before the request is queued.
+	// The mapping belongs to the handle it was asked for on and is taken back when that handle is cleaned up.
+	WdfDeviceInitSetIoInCallerContextCallback(device_init, LbEvtIoInCallerContext);
+	WDF_FILEOBJECT_CONFIG_INIT(&file_config, WDF_NO_EVENT_CALLBACK, WDF_NO_EVENT_CALLBACK, LbEvtFileCleanup);
+	WdfDeviceInitSetFileObjectConfig(device_init, &file_config, WDF_NO_OBJECT_ATTRIBUTES);
+
 	status = WdfDeviceCreate(&device_init, WDF_NO_OBJECT_ATTRIBUTES, WdfDevice);
 	if (!NT_SUCCESS(status)) {
 		WdfDeviceInitFree(device_init);
 		goto Exit;
 	}
 
+	// Expose the device to user mode as \\.\LbDriver
+	status = WdfDeviceCreateSymbolicLink(*WdfDevice, &device_symlink);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	// Control requests are handled one at a time at PASSIVE_LEVEL, rule replacement relies on both
+	WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queue_config, WdfIoQueueDispatchSequential);
+	queue_config.EvtIoDeviceControl = LbEvtIoDeviceControl;
+	WDF_OBJECT_ATTRIBUTES_INIT(&queue_attributes);
+	queue_attributes.ExecutionLevel = WdfExecutionLevelPassive;
+	status = WdfIoQueueCreate(*WdfDevice, &queue_config, &queue_attributes, &queue);
+	if (!NT_SUCCESS(status)) goto Exit;
+
 	WdfControlFinishInitializing(*WdfDevice);
 
 Exit:
 	return status;
 }
 
+//////////////////////////////
+// CONTROL DEVICE CALLBACKS //
+//////////////////////////////
+
+void LbEvtIoDeviceControl(_In_ WDFQUEUE Queue, _In_ WDFREQUEST Request, _In_ size_t OutputBufferLength, _In_ size_t InputBufferLength, _In_ ULONG IoControlCode)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	PVOID input = NULL;
+	size_t inputSize = 0;
+	PVOID output = NULL;
+	size_t outputSize = 0;
+	size_t information = 0;
+
+	UNREFERENCED_PARAMETER(Queue);
+	UNREFERENCED_PARAMETER(OutputBufferLength);
+	UNREFERENCED_PARAMETER(InputBufferLength);
+
+	switch (IoControlCode)
+	{
+	case IOCTL_LB_SET_RULES:
+		status = WdfRequestRetrieveInputBuffer(Request, sizeof(LB_RULES_HEADER), &input, &inputSize);
+		if (!NT_SUCCESS(status)) break;
+		status = LbInjectionReplaceRules(input, inputSize);
+		break;
+
+	case IOCTL_LB_SET_RULE_IMAGE:
+		// Direct I/O, the image is the caller's own pages mapped through the request's MDL
+		status = WdfRequestRetrieveOutputBuffer(Request, sizeof(LB_RULE_IMAGE_HEADER), &input, &inputSize);
+		if (!NT_SUCCESS(status)) break;
+		status = LbInjectionReplaceRuleImage(input, inputSize);
+		break;
+
+	case IOCTL_LB_SET_CAPTURE:
+		status = WdfRequestRetrieveInputBuffer(Request, sizeof(LB_CAPTURE_RULES_HEADER), &input, &inputSize);
+		if (!NT_SUCCESS(status)) break;
+		status = LbInjectionReplaceCapture(input, inputSize);
+		break;
+
+	case IOCTL_LB_READ_EVENTS:
+	{
+		status = WdfRequestRetrieveOutputBuffer(Request, sizeof(LB_EVENTS_HEADER), &output, &outputSize);
+		if (!NT_SUCCESS(status)) break;
+
+		// Copies straight into the request buffer, as many whole events as fit
+		LB_EVENTS_HEADER* header = (LB_EVENTS_HEADER*)output;
+		UINT32 maxEvents = (UINT32)min((outputSize - sizeof(LB_EVENTS_HEADER)) / sizeof(LB_EVENT), MAXUINT32);
+		RtlZeroMemory(header, sizeof(LB_EVENTS_HEADER));
+		header->count = LbEventLogDrain(lbEventLog, (LB_EVENT*)(header + 1), maxEvents, &header->lost);
+		header->frequency = LbTimestampFrequency();
+		information = sizeof(LB_EVENTS_HEADER) + sizeof(LB_EVENT) * header->count;
+		break;
+	}
+
+	case IOCTL_LB_READ_STATS:
+		status = WdfRequestRetrieveOutputBuffer(Request, sizeof(LB_STATS_SNAPSHOT), &output, &outputSize);
+		if (!NT_SUCCESS(status)) break;
+		LbStatsSnapshot((LB_STATS_SNAPSHOT*)output);
+		information = sizeof(LB_STATS_SNAPSHOT);
+		break;
+
+	default:
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		break;
+	}
+
+	WdfRequestCompleteWithInformation(Request, status, information);
+}
+
+void LbEvtIoInCallerContext(_In_ WDFDEVICE Device, _In_ WDFREQUEST Request)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	WDF_REQUEST_PARAMETERS parameters;
+	PVOID output = NULL;
+	size_t outputSize = 0;
+
+	WDF_REQUEST_PARAMETERS_INIT(&parameters);
+	WdfRequestGetParameters(Request, &parameters);
+
+	// Everything else goes through the sequential queue as before
+	if (parameters.Type != WdfRequestTypeDeviceControl || parameters.Parameters.DeviceIoControl.IoControlCode != IOCTL_LB_MAP_CAPTURE)
+	{
+		status = WdfDeviceEnqueueRequest(Device, Request);
+		if (!NT_SUCCESS(status))
+			WdfRequestComplete(Request, status);
+		return;
+	}
+
+	status = WdfRequestRetrieveOutputBuffer(Request, sizeof(LB_CAPTURE_MAPPING), &output, &outputSize);
+	if (NT_SUCCESS(status))
+		status = LbInjectionMapCapture(WdfRequestGetFileObject(Request), (LB_CAPTURE_MAPPING*)output);
+
+	WdfRequestCompleteWithInformation(Request, status, NT_SUCCESS(status) ? sizeof(LB_CAPTURE_MAPPING) : 0);
+}
+
+void LbEvtFileCleanup(_In_ WDFFILEOBJECT FileObject)
+{
+	LbInjectionUnmapCapture(FileObject);
+}
+
+//////////////////
+// RULE FILTERS //
+//////////////////
+
+// Turns one generated filter into an Fwpm filter, context is the filter engine handle
+static NTSTATUS LbFwpmAddFilter(void* context, const LB_FILTER_SPEC* spec, UINT64* filterId)
+{
+	FWPM_FILTER filter = { 0 };
+	FWPM_FILTER_CONDITION conditions[3] = { 0 };
+	FWP_RANGE0 ranges[2];			// Only the entries a condition points to are filled in
+	UINT32 count = 0;
+	BOOLEAN outbound = spec->direction == LB_DIRECTION_OUTBOUND;
+	const LB_CALLOUT_SPEC* callout = &lbCalloutSpecs[spec->layer == LB_FILTER_LAYER_STREAM ?
+		(spec->family == LB_FAMILY_IPV4 ? LB_CALLOUT_STREAM_V4 : LB_CALLOUT_STREAM_V6) : outbound ?
+		(spec->family == LB_FAMILY_IPV4 ? LB_CALLOUT_OUTBOUND_V4 : LB_CALLOUT_OUTBOUND_V6) :
+		(spec->family == LB_FAMILY_IPV4 ? LB_CALLOUT_INBOUND_V4 : LB_CALLOUT_INBOUND_V6)];
+
+	if (spec->matchAddress)
+	{
+		conditions[count].fieldKey = FWPM_CONDITION_IP_REMOTE_ADDRESS;
+		if (spec->firstAddress == spec->lastAddress)
+		{
+			conditions[count].matchType = FWP_MATCH_EQUAL;
+			conditions[count].conditionValue.type = FWP_UINT32;
+			conditions[count].conditionValue.uint32 = spec->firstAddress;
+		}
+		else
+		{
+			ranges[count].valueLow.type = FWP_UINT32;
+			ranges[count].valueLow.uint32 = spec->firstAddress;
+			ranges[count].valueHigh.type = FWP_UINT32;
+			ranges[count].valueHigh.uint32 = spec->lastAddress;
+			conditions[count].matchType = FWP_MATCH_RANGE;
+			conditions[count].conditionValue.type = FWP_RANGE_TYPE;
+			conditions[count].conditionValue.rangeValue = &ranges[count];
+		}
+		count++;
+	}
+
+	if (spec->matchPort)
+	{
+		conditions[count].fieldKey = FWPM_CONDITION_IP_REMOTE_PORT;
+		if (spec->firstPort == spec->lastPort)
+		{
+			conditions[count].matchType = FWP_MATCH_EQUAL;
+			conditions[count].conditionValue.type = FWP_UINT16;
+			conditions[count].conditionValue.uint16 = spec->firstPort;
+		}
+		else
+		{
+			ranges[count].valueLow.type = FWP_UINT16;
+			ranges[count].valueLow.uint16 = spec->firstPort;
+			ranges[count].valueHigh.type = FWP_UINT16;
+			ranges[count].valueHigh.uint16 = spec->lastPort;
+			conditions[count].matchType = FWP_MATCH_RANGE;
+			conditions[count].conditionValue.type = FWP_RANGE_TYPE;
+			conditions[count].conditionValue.rangeValue = &ranges[count];
+		}
+		count++;
+	}
+
+	if (spec->protocol != LB_FILTER_PROTOCOL_ANY)
+	{
+		conditions[count].fieldKey = FWPM_CONDITION_IP_PROTOCOL;
+		conditions[count].matchType = spec->protocol == LB_FILTER_PROTOCOL_TCP ? FWP_MATCH_EQUAL : FWP_MATCH_NOT_EQUAL;
+		conditions[count].conditionValue.type = FWP_UINT8;
+		conditions[count].conditionValue.uint8 = IPPROTO_TCP;
+		count++;
+	}
+	else if (spec->layer == LB_FILTER_LAYER_STREAM)
+	{
+		// The stream layer carries both directions of a connection, only the outgoing data is rewritten
+		conditions[count].fieldKey = FWPM_CONDITION_DIRECTION;
+		conditions[count].matchType = FWP_MATCH_EQUAL;
+		conditions[count].conditionValue.type = FWP_UINT32;
+		conditions[count].conditionValue.uint32 = FWP_DIRECTION_OUTBOUND;
+		count++;
+	}
+
+	filter.displayData.name = (wchar_t*)(spec->tier == LB_FILTER_TIER_ACK ? ACK_FILTER_NAME : spec->verdict == LB_VERDICT_INSPECT ? INJECTION_FILTER_NAME : RULE_FILTER_NAME);
+	filter.subLayerKey = INJECTION_SUBLAYER_GUID;
+	filter.weight.type = FWP_UINT8;
+	filter.weight.uint8 = LbFilterWeight(spec);
+	filter.numFilterConditions = count;
+	filter.filterCondition = count > 0 ? conditions : NULL;
+	filter.layerKey = *callout->layerKey;
+
+	switch (LbFilterAction(spec))
+	{
+	case LB_FILTER_ACTION_BLOCK:
+		filter.action.type = FWP_ACTION_BLOCK;
+		break;
+	case LB_FILTER_ACTION_CALLOUT:
+		filter.action.type = FWP_ACTION_CALLOUT_TERMINATING;
+		filter.action.calloutKey = *callout->calloutKey;
+		break;
+	default:
+		filter.action.type = FWP_ACTION_PERMIT;
+		break;
+	}
+
+	return FwpmFilterAdd((HANDLE)context, &filter, NULL, filterId);
+}
+
+static NTSTATUS LbFwpmDeleteFilter(void* context, UINT64 filterId)
+{
+	return FwpmFilterDeleteById((HANDLE)context, filterId);
+}
+
+// Add the filters generated for a rule set, on success the caller owns the returned ID array
+static NTSTATUS LbAddRuleFilters(const LB_CLASSIFIER* classifier, BOOLEAN stream, UINT64** filterIds, UINT32* filterCount)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_FILTER_ENGINE engine = { lbFilterEngineHandle, LbFwpmAddFilter, LbFwpmDeleteFilter };
+	LB_FILTER_PLAN plan = { 0 };
+	UINT64* ids = NULL;
+
+	status = LbFilterPlanCompile(classifier, stream, &plan);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	if (plan.count > 0)
+	{
+		ids = (UINT64*)LbAlloc(sizeof(UINT64) * plan.count, 'LBD0');
+		if (!ids)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto Exit;
+		}
+	}
+
+	status = LbFilterPlanInstall(&plan, &engine, ids);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	*filterIds = ids;
+	*filterCount = plan.count;
+	ids = NULL;
+
+Exit:
+	if (ids) LbFree(ids, 'LBD0');
+	LbFilterPlanFree(&plan);
+
+	return status;
+}
+
+NTSTATUS UpdateFilters(const LB_CLASSIFIER* classifier, BOOLEAN stream)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_FILTER_ENGINE engine = { lbFilterEngineHandle, LbFwpmAddFilter, LbFwpmDeleteFilter };
+	UINT64* filterIds = NULL;
+	UINT32 filterCount = 0;
+
+	// Old and new filters are swapped in one transaction, no packet ever sees a mix of both
+	status = FwpmTransactionBegin(lbFilterEngineHandle, 0);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	LbFilterPlanRemove(&engine, lbRuleFilterIds, lbRuleFilterCount);
+	status = LbAddRuleFilters(classifier, stream, &filterIds, &filterCount);
+	if (!NT_SUCCESS(status))
+	{
+		FwpmTransactionAbort(lbFilterEngineHandle);
+		goto Exit;
+	}
+
+	status = FwpmTransactionCommit(lbFilterEngineHandle);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	if (lbRuleFilterIds) LbFree(lbRuleFilterIds, 'LBD0');
+	lbRuleFilterIds = filterIds;
+	lbRuleFilterCount = filterCount;
+	filterIds = NULL;
+
+	LBPRINTLN("%u rule filters registered", lbRuleFilterCount);
+
+Exit:
+	if (!NT_SUCCESS(status)) LBPRINTLN("Failed to update rule filters, status 0x%08x", status);
+	if (filterIds) LbFree(filterIds, 'LBD0');
+
+	return status;
+}
+
+void RemoveFilters()
+{
+	LB_FILTER_ENGINE engine = { lbFilterEngineHandle, LbFwpmAddFilter, LbFwpmDeleteFilter };
+
+	LbFilterPlanRemove(&engine, lbRuleFilterIds, lbRuleFilterCount);
+	if (lbRuleFilterIds) LbFree(lbRuleFilterIds, 'LBD0');
+	lbRuleFilterIds = NULL;
+	lbRuleFilterCount = 0;
+}
+
 /////////////////////////////////////
 // HELPER INITIALIZATION FUNCTIONS //
 /////////////////////////////////////
@@ -220,35 +629,42 @@ Exit:
 NTSTATUS RegisterInjectionCallout(DEVICE_OBJECT* wdm_device)
 {
 	NTSTATUS status = STATUS_SUCCESS;
-	// Run-time Callout Filtering Layer Identifiers Struct
-	FWPS_CALLOUT callout = { 0 };
-	// Management Filtering Layer Identifiers Struct
-	FWPM_CALLOUT calloutManager = { 0 };
-	// Display data struct for FWPM
-	FWPM_DISPLAY_DATA displayData = { 0 };
 
 	// Check for NULL handle
 	if (lbFilterEngineHandle == NULL)
 		return STATUS_INVALID_HANDLE;
 
-	// Set callout name
-	displayData.name = (wchar_t*)INJECTION_CALLOUT_NAME;
-
-	// Register new Callout with Filtering Engine
-	callout.calloutKey = INJECTION_CALLOUT_GUID;
-	callout.classifyFn = LbClassifyInject;	// INJECTION FUNCTION
-	callout.notifyFn = LbNotify;	// Placeholder function
-	callout.flowDeleteFn = LbFlowDelete;	// Placeholder function
-	status = FwpsCalloutRegister((void*)wdm_device, &callout, &lbInjectionCalloutId);
-	if (!NT_SUCCESS(status)) goto Exit;
-
-	// Add Callout to the system
-	calloutManager.calloutKey = INJECTION_CALLOUT_GUID;
-	calloutManager.displayData = displayData;
-	calloutManager.applicableLayer = FWPM_LAYER_OUTBOUND_TRANSPORT_V4;
-	calloutManager.flags = 0;
-	status = FwpmCalloutAdd(lbFilterEngineHandle, &calloutManager, NULL, NULL);
-	if (!NT_SUCCESS(status)) goto Exit;
+	// One callout per transport layer, each runs the classify function built for its layer
+	for (int layer = 0; layer < LB_CALLOUT_COUNT; layer++)
+	{
+		const LB_CALLOUT_SPEC* spec = &lbCalloutSpecs[layer];
+		// Run-time Callout Filtering Layer Identifiers Struct
+		FWPS_CALLOUT callout = { 0 };
+		// Management Filtering Layer Identifiers Struct
+		FWPM_CALLOUT calloutManager = { 0 };
+		// Display data struct for FWPM
+		FWPM_DISPLAY_DATA displayData = { 0 };
+
+		// Set callout name
+		displayData.name = (wchar_t*)spec->name;
+
+		// Register new Callout with Filtering Engine. Every callout shares the flow contexts,
+		// so they share the flow delete function too.
+		callout.calloutKey = *spec->calloutKey;
+		callout.classifyFn = spec->classifyFn;	// INJECTION FUNCTION
+		callout.notifyFn = LbNotify;	// Placeholder function
+		callout.flowDeleteFn = LbFlowDelete;
+		status = FwpsCalloutRegister((void*)wdm_device, &callout, &lbInjectionCalloutIds[layer]);
+		if (!NT_SUCCESS(status)) goto Exit;
+
+		// Add Callout to the system
+		calloutManager.calloutKey = *spec->calloutKey;
+		calloutManager.displayData = displayData;
+		calloutManager.applicableLayer = *spec->layerKey;
+		calloutManager.flags = 0;
+		status = FwpmCalloutAdd(lbFilterEngineHandle, &calloutManager, NULL, NULL);
+		if (!NT_SUCCESS(status)) goto Exit;
+	}
 
 	LBPRINTLN("REGISTER CALLOUT SUCCESSFUL");
 
@@ -258,6 +674,19 @@ Exit:
 	return status;
 }
 
+void UnregisterInjectionCallout()
+{
+	for (int layer = 0; layer < LB_CALLOUT_COUNT; layer++)
+	{
+		if (lbInjectionCalloutIds[layer] == 0)
+			continue;
+
+		NTSTATUS status = FwpsCalloutUnregisterById(lbInjectionCalloutIds[layer]);
+		if (!NT_SUCCESS(status)) LBPRINTLN("Failed to unregister callout, STATUS CODE: %d", status);
+		lbInjectionCalloutIds[layer] = 0;
+	}
+}
+
 NTSTATUS InitSublayer()
 {
 	NTSTATUS status = STATUS_SUCCESS;
@@ -277,26 +706,32 @@ NTSTATUS InitSublayer()
 	return status;
 }
 
-NTSTATUS InitFilter()
+NTSTATUS InitFilter(const LB_CLASSIFIER* classifier, BOOLEAN stream)
 {
-	NTSTATUS status = STATUS_SUCCESS;
-	FWPM_FILTER filter = { 0 };
+	NTSTATUS status = LbAddRuleFilters(classifier, stream, &lbRuleFilterIds, &lbRuleFilterCount);
+	if (status != STATUS_SUCCESS) {
+		LBPRINTLN("Failed to register rule filters, status 0x%08x", status);
+	}
+	else {
+		LBPRINTLN("%u rule filters registered", lbRuleFilterCount);
+	}
 
+	return status;
+}
 
-	filter.displayData.name = (wchar_t*)INJECTION_FILTER_NAME;
-	filter.action.type = FWP_ACTION_CALLOUT_TERMINATING;	// Says this filter's callout MUST make a block/permit decission
-	filter.subLayerKey = INJECTION_SUBLAYER_GUID;
-	filter.weight.type = FWP_UINT8;
-	filter.weight.uint8 = 0xf;		// The weight of this filter within its sublayer
-	filter.numFilterConditions = 0;	// If you specify 0, this filter invokes its callout for all traffic in its layer
-	filter.layerKey = FWPM_LAYER_OUTBOUND_TRANSPORT_V4;	// This layer must match the layer that ExampleCallout is registered to
-	filter.action.calloutKey = INJECTION_CALLOUT_GUID;
-	status = FwpmFilterAdd(lbFilterEngineHandle, &filter, NULL, &(lbInjectionFilterId));
+NTSTATUS InitAckFilter()
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_FILTER_SPEC spec;
+
+	// Below every rule filter, so inbound rules still apply to TCP
+	LbFilterAckSpec(&spec);
+	status = LbFwpmAddFilter(lbFilterEngineHandle, &spec, &lbAckFilterId);
 	if (status != STATUS_SUCCESS) {
-		LBPRINTLN("Failed to register example filter, status 0x%08x", status);
+		LBPRINTLN("Failed to register ACK filter, status 0x%08x", status);
 	}
 	else {
-		LBPRINTLN("Example filter registered");
+		LBPRINTLN("ACK filter registered");
 	}
 
 	return status;
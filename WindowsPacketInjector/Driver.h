@@ -45,6 +45,8 @@ enum _WDF_REQUEST_TYPE : int; // Seems to be required for wdf.h compilation in C
 //  - $(DDK_LIB_PATH)wdmsec.lib
 //  - $(DDK_LIB_PATH)fwpkclnt.lib
 
+// Synchronous debug output, for the control path only.
+// The classify path records LBEVENTs (EventLog.h) instead.
 #ifndef LBPRINTF
 #define LBPRINTF(...) \
     {\
@@ -67,14 +69,38 @@ enum _WDF_REQUEST_TYPE : int; // Seems to be required for wdf.h compilation in C
     DbgPrintEx(0, 0, __VA_ARGS__)
 #endif
 
+/////////////
+// GLOBALS //
+/////////////
+
+// Layers the injection callout is registered at, one callout each
+enum LB_CALLOUT_LAYER
+{
+	LB_CALLOUT_OUTBOUND_V4 = 0,
+	LB_CALLOUT_OUTBOUND_V6,
+	LB_CALLOUT_INBOUND_V4,		// Also translates the acknowledgements of resized outgoing streams
+	LB_CALLOUT_INBOUND_V6,
+	LB_CALLOUT_STREAM_V4,		// Outgoing TCP data of rule sets with LB_RULES_FLAG_STREAM
+	LB_CALLOUT_STREAM_V6,
+	LB_CALLOUT_COUNT
+};
+
+// Runtime IDs of the injection callouts, needed to associate flow contexts. 0 until registered.
+extern UINT32 lbInjectionCalloutIds[LB_CALLOUT_COUNT];
+
 //////////////////////////
 // FORWARD DECLERATIONS //
 //////////////////////////
 
+struct LB_CLASSIFIER;
+
 EXTERN_C
 DRIVER_INITIALIZE DriverEntry;
 DRIVER_UNLOAD DriverUnload;
 EVT_WDF_DRIVER_UNLOAD WDFUnload;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL LbEvtIoDeviceControl;
+EVT_WDF_IO_IN_CALLER_CONTEXT LbEvtIoInCallerContext;
+EVT_WDF_FILE_CLEANUP LbEvtFileCleanup;
 
 NTSTATUS LbInitializeDriver(
     _In_ PDRIVER_OBJECT DriverObject,
@@ -85,5 +111,13 @@ NTSTATUS LbInitializeDriver(
 
 // Demonstrates how to register/unregister a callout, sublayer, and filter to the Base Filtering Engine
 NTSTATUS RegisterInjectionCallout(DEVICE_OBJECT* wdm_device);
+void UnregisterInjectionCallout();
 NTSTATUS InitSublayer();
-NTSTATUS InitFilter();
+NTSTATUS InitAckFilter();
+
+// Filters generated from a rule set, so only flows that need their payload rewritten reach the callout.
+// InitFilter must run inside the DriverEntry transaction, UpdateFilters opens its own and swaps
+// the filters of the previous rule set for the new ones atomically. stream is LB_RULES_FLAG_STREAM.
+NTSTATUS InitFilter(const LB_CLASSIFIER* classifier, BOOLEAN stream);
+NTSTATUS UpdateFilters(const LB_CLASSIFIER* classifier, BOOLEAN stream);
+void RemoveFilters();
@@ -0,0 +1,169 @@
+/*/
+/*  ** EventLog.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the per-processor binary event log.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Leslie Lamport, "Specifying Concurrent Program Modules", ACM TOPLAS 1983
+/*			* Single producer, single consumer ring where each side only ever writes its own index.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "EventLog.h"
+
+static_assert(sizeof(LB_EVENT) == 64, "event must fill one cache line");
+
+/////////////////////
+// RING STRUCTURES //
+/////////////////////
+
+// One per processor. The writer and the reader each get a cache line of their own,
+// so draining one ring never slows down the processor filling it.
+struct DECLSPEC_ALIGN(64) LB_EVENT_RING
+{
+	// Written by the processor that owns the ring
+	volatile LONG busy;			// Non-zero while a writer owns the ring
+	volatile LONG head;			// Events ever written
+	volatile LONG lost;			// Events ever dropped
+	UINT8 writerPad[52];
+
+	// Written by the reader
+	volatile LONG tail;			// Events ever read
+	LONG lostReported;			// Value of lost at the previous drain
+	UINT8 readerPad[56];
+};
+
+static_assert(sizeof(LB_EVENT_RING) == 128, "writer and reader side must each fill one cache line");
+
+struct LB_EVENT_LOG
+{
+	UINT32 capacity;
+	UINT32 processorCount;
+	UINT32 nextProcessor;		// First ring of the next drain
+	LB_EVENT_RING* rings;		// Stored right after this struct, one per processor
+	LB_EVENT* events;			// capacity events per processor, after the rings
+};
+
+LB_EVENT_LOG* lbEventLog = NULL;
+
+//////////////////////////
+// CREATION AND CLEANUP //
+//////////////////////////
+
+NTSTATUS LbEventLogCreate(UINT32 capacity, LB_EVENT_LOG** log)
+{
+	if (log == NULL || capacity == 0 || (capacity & (capacity - 1)) != 0)
+		return STATUS_INVALID_PARAMETER;
+
+	*log = NULL;
+
+	UINT32 processorCount = LbProcessorCount();
+	SIZE_T headerSize = (sizeof(LB_EVENT_LOG) + 63) & ~(SIZE_T)63;
+	SIZE_T ringSize = sizeof(LB_EVENT_RING) * processorCount;
+
+	LB_EVENT_LOG* result = (LB_EVENT_LOG*)LbAlloc(headerSize + ringSize + sizeof(LB_EVENT) * capacity * processorCount, 'LBE0');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	result->capacity = capacity;
+	result->processorCount = processorCount;
+	result->rings = (LB_EVENT_RING*)((UINT8*)result + headerSize);
+	result->events = (LB_EVENT*)((UINT8*)result->rings + ringSize);
+
+	*log = result;
+	return STATUS_SUCCESS;
+}
+
+void LbEventLogDestroy(LB_EVENT_LOG* log)
+{
+	if (!log)
+		return;
+
+	LbFree(log, 'LBE0');
+}
+
+////////////
+// WRITER //
+////////////
+
+void LbEventLogWrite(LB_EVENT_LOG* log, UINT8 level, UINT16 id, const UINT64* args, UINT32 argCount)
+{
+	UINT32 processor = LbCurrentProcessor();
+	LB_EVENT_RING* ring = &log->rings[processor];
+
+	// Claim the ring without waiting. It is only ever owned already when a writer was preempted
+	// at PASSIVE_LEVEL or moved to another processor, that rare event is counted as lost.
+	if (LbInterlockedCompareExchange(&ring->busy, 1, 0) != 0)
+	{
+		LbInterlockedIncrement(&ring->lost);
+		return;
+	}
+
+	UINT32 head = (UINT32)ring->head;
+	if (head - (UINT32)LbReadAcquire(&ring->tail) >= log->capacity)
+	{
+		LbInterlockedIncrement(&ring->lost);
+		LbWriteRelease(&ring->busy, 0);
+		return;
+	}
+
+	LB_EVENT* event = &log->events[(SIZE_T)processor * log->capacity + (head & (log->capacity - 1))];
+	event->timestamp = LbTimestamp();
+	event->sequence = head;
+	event->id = id;
+	event->level = level;
+	event->reserved = 0;
+	event->processor = processor;
+	event->argCount = argCount;
+	for (UINT32 i = 0; i < LB_EVENT_ARGS; i++)
+		event->args[i] = i < argCount ? args[i] : 0;
+
+	// Publishing head hands the slot to the reader
+	LbWriteRelease(&ring->head, (LONG)(head + 1));
+	LbWriteRelease(&ring->busy, 0);
+}
+
+////////////
+// READER //
+////////////
+
+UINT32 LbEventLogDrain(LB_EVENT_LOG* log, LB_EVENT* events, UINT32 maxEvents, UINT64* lost)
+{
+	UINT32 count = 0;
+	UINT64 dropped = 0;
+
+	for (UINT32 n = 0; n < log->processorCount; n++)
+	{
+		UINT32 processor = (log->nextProcessor + n) % log->processorCount;
+		LB_EVENT_RING* ring = &log->rings[processor];
+		const LB_EVENT* slots = &log->events[(SIZE_T)processor * log->capacity];
+
+		// Everything up to head is complete once head has been read
+		UINT32 head = (UINT32)LbReadAcquire(&ring->head);
+		UINT32 tail = (UINT32)ring->tail;
+		LONG lostNow = LbReadAcquire(&ring->lost);
+
+		dropped += (UINT32)lostNow - (UINT32)ring->lostReported;
+		ring->lostReported = lostNow;
+
+		while (tail != head && count < maxEvents)
+		{
+			events[count++] = slots[tail & (log->capacity - 1)];
+			tail++;
+		}
+
+		// Releasing tail hands the slots back to the writer
+		LbWriteRelease(&ring->tail, (LONG)tail);
+	}
+
+	// Start on the next ring each time, so a small buffer cannot keep missing the last processors
+	log->nextProcessor = (log->nextProcessor + 1) % log->processorCount;
+
+	if (lost) *lost = dropped;
+	return count;
+}
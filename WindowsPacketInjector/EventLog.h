@@ -0,0 +1,67 @@
+/*/
+/*  ** EventLog.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the binary event log that replaces debug printing on the classify path.
+/*	Every processor writes fixed size LB_EVENT records into a ring of its own without taking a lock,
+/*	and a single reader (the control device) drains all rings in batches. When a ring is full the
+/*	event is counted as lost instead of making the writer wait.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+
+// Events each processor can hold until they are read, must be a power of two
+#define LB_EVENT_RING_CAPACITY 1024
+
+// Highest level that is compiled in, LBEVENT calls above it cost nothing
+#ifndef LB_EVENT_LEVEL_MAX
+#if DBG
+#define LB_EVENT_LEVEL_MAX LB_LEVEL_TRACE
+#else
+#define LB_EVENT_LEVEL_MAX LB_LEVEL_INFO
+#endif
+#endif
+
+struct LB_EVENT_LOG;
+
+// The driver's log, NULL until DriverEntry creates it (events written before then are dropped)
+extern LB_EVENT_LOG* lbEventLog;
+
+// Create a log with one ring of capacity events per processor
+NTSTATUS LbEventLogCreate(UINT32 capacity, LB_EVENT_LOG** log);
+
+// Free a log, no writer or reader may still be using it
+void LbEventLogDestroy(LB_EVENT_LOG* log);
+
+// Record an event on the current processor's ring, safe at any IRQL up to DISPATCH_LEVEL
+void LbEventLogWrite(LB_EVENT_LOG* log, UINT8 level, UINT16 id, const UINT64* args, UINT32 argCount);
+
+// Move up to maxEvents events out of the rings, returns how many were copied.
+// lost receives the number of events dropped since the previous drain. Only one reader at a time.
+UINT32 LbEventLogDrain(LB_EVENT_LOG* log, LB_EVENT* events, UINT32 maxEvents, UINT64* lost);
+
+// Packs any number of integer or pointer arguments (up to LB_EVENT_ARGS) into an event
+template <typename... T>
+inline void LbEventEmit(UINT8 level, UINT16 id, T... args)
+{
+	static_assert(sizeof...(T) <= LB_EVENT_ARGS, "too many event arguments");
+	const UINT64 values[] = { 0, (UINT64)args... };
+
+	if (lbEventLog)
+		LbEventLogWrite(lbEventLog, level, id, values + 1, sizeof...(T));
+}
+
+#ifndef LBEVENT
+#define LBEVENT(level, id, ...) \
+    {\
+    if ((level) <= LB_EVENT_LEVEL_MAX) LbEventEmit((level), (id), ##__VA_ARGS__);\
+    }
+#endif
@@ -0,0 +1,230 @@
+/*/
+/*  ** FilterCompiler.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for turning a compiled rule set into Base Filtering Engine filters.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Microsoft, "Filter Arbitration", https://learn.microsoft.com/en-us/windows/win32/fwp/filter-arbitration
+/*			* Within a sublayer the matching filter with the highest weight decides.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "FilterCompiler.h"
+
+/////////////
+// HELPERS //
+/////////////
+
+// State shared with the classifier range callbacks
+struct LB_PLAN_BUILDER
+{
+	LB_FILTER_PLAN* plan;
+	UINT8 direction;
+	UINT8 family;
+	UINT8 tier;
+	BOOLEAN keepPermit;		// Permitted ranges are only needed to override a lower tier
+	BOOLEAN stream;			// Outgoing TCP of inspected ranges goes to the stream layer
+	BOOLEAN streamPorts;	// Some port range went to the stream layer, address ranges override it there as well
+};
+
+static NTSTATUS LbFilterPlanAppend(LB_FILTER_PLAN* plan, const LB_FILTER_SPEC* filter)
+{
+	if (plan->count == plan->capacity)
+	{
+		UINT32 capacity = plan->capacity ? plan->capacity * 2 : 16;
+		LB_FILTER_SPEC* filters = (LB_FILTER_SPEC*)LbAlloc(sizeof(LB_FILTER_SPEC) * capacity, 'LBP0');
+		if (!filters)
+			return STATUS_INSUFFICIENT_RESOURCES;
+
+		if (plan->filters)
+		{
+			memcpy(filters, plan->filters, sizeof(LB_FILTER_SPEC) * plan->count);
+			LbFree(plan->filters, 'LBP0');
+		}
+
+		plan->filters = filters;
+		plan->capacity = capacity;
+	}
+
+	plan->filters[plan->count++] = *filter;
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS LbFilterPlanRange(UINT32 first, UINT32 last, LB_VERDICT verdict, void* value)
+{
+	LB_PLAN_BUILDER* builder = (LB_PLAN_BUILDER*)value;
+	LB_FILTER_SPEC filter = { 0 };
+
+	// Anything no rule covers is permitted by the engine already
+	if (verdict == LB_VERDICT_NONE || (verdict == LB_VERDICT_PERMIT && !builder->keepPermit))
+		return STATUS_SUCCESS;
+
+	filter.direction = builder->direction;
+	filter.family = builder->family;
+	filter.tier = builder->tier;
+	filter.verdict = verdict;
+
+	if (builder->tier == LB_FILTER_TIER_ADDRESS)
+	{
+		filter.matchAddress = first != 0 || last != 0xFFFFFFFF;
+		filter.firstAddress = first;
+		filter.lastAddress = last;
+	}
+	else
+	{
+		filter.matchPort = first != 0 || last != 0xFFFF;
+		filter.firstPort = (UINT16)first;
+		filter.lastPort = (UINT16)last;
+	}
+
+	if (!builder->stream || (verdict != LB_VERDICT_INSPECT && builder->tier != LB_FILTER_TIER_ADDRESS))
+		return LbFilterPlanAppend(builder->plan, &filter);
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if (verdict == LB_VERDICT_INSPECT)
+	{
+		// Other protocols are still inspected segment by segment, TCP passes the transport layer untouched
+		filter.protocol = LB_FILTER_PROTOCOL_NOT_TCP;
+		status = LbFilterPlanAppend(builder->plan, &filter);
+		if (!NT_SUCCESS(status))
+			return status;
+
+		filter.protocol = LB_FILTER_PROTOCOL_TCP;
+		filter.verdict = LB_VERDICT_PERMIT;
+	}
+
+	status = LbFilterPlanAppend(builder->plan, &filter);
+	if (!NT_SUCCESS(status) || (verdict != LB_VERDICT_INSPECT && !builder->streamPorts))
+		return status;
+
+	// The stream layer gets the same tiers, an address range overriding an inspected port range there as well.
+	// Blocking is left to the transport layer, with no inspected port under it a blocked range needs no copy.
+	filter.layer = LB_FILTER_LAYER_STREAM;
+	filter.protocol = LB_FILTER_PROTOCOL_ANY;
+	filter.verdict = verdict == LB_VERDICT_INSPECT ? LB_VERDICT_INSPECT : LB_VERDICT_PERMIT;
+
+	return LbFilterPlanAppend(builder->plan, &filter);
+}
+
+/////////////////
+// COMPILATION //
+/////////////////
+
+NTSTATUS LbFilterPlanCompile(const LB_CLASSIFIER* classifier, BOOLEAN stream, LB_FILTER_PLAN* plan)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if (classifier == NULL || plan == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	memset(plan, 0, sizeof(LB_FILTER_PLAN));
+
+	for (int direction = 0; direction < LB_DIRECTION_COUNT; direction++)
+	{
+		for (int family = 0; family < LB_FAMILY_COUNT; family++)
+		{
+			LB_PLAN_BUILDER builder = { plan, (UINT8)direction, (UINT8)family, LB_FILTER_TIER_PORT, FALSE, stream && direction == LB_DIRECTION_OUTBOUND, FALSE };
+			UINT32 portFilters = plan->count;
+
+			// Port rules take the lowest tier, their ranges come out of the flattened table already disjoint
+			status = LbClassifierEnumeratePorts(classifier, (LB_DIRECTION)direction, LbFilterPlanRange, &builder);
+			if (!NT_SUCCESS(status)) goto Exit;
+
+			if (family != LB_FAMILY_IPV4)
+				continue;
+
+			// Address rules take precedence over port rules. A permitted address range only has to be
+			// a filter of its own when some port filter would otherwise block or divert it.
+			builder.tier = LB_FILTER_TIER_ADDRESS;
+			builder.keepPermit = plan->count != portFilters;
+			for (UINT32 i = portFilters; i < plan->count; i++)
+				builder.streamPorts = builder.streamPorts || plan->filters[i].layer == LB_FILTER_LAYER_STREAM;
+			status = LbClassifierEnumerateAddresses(classifier, (LB_DIRECTION)direction, LbFilterPlanRange, &builder);
+			if (!NT_SUCCESS(status)) goto Exit;
+		}
+	}
+
+Exit:
+	if (!NT_SUCCESS(status))
+		LbFilterPlanFree(plan);
+
+	return status;
+}
+
+void LbFilterPlanFree(LB_FILTER_PLAN* plan)
+{
+	if (!plan)
+		return;
+
+	if (plan->filters) LbFree(plan->filters, 'LBP0');
+	memset(plan, 0, sizeof(LB_FILTER_PLAN));
+}
+
+//////////////////
+// INSTALLATION //
+//////////////////
+
+NTSTATUS LbFilterPlanInstall(const LB_FILTER_PLAN* plan, const LB_FILTER_ENGINE* engine, UINT64* filterIds)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	for (UINT32 i = 0; i < plan->count; i++)
+	{
+		status = engine->addFilter(engine->context, &plan->filters[i], &filterIds[i]);
+		if (!NT_SUCCESS(status))
+		{
+			LbFilterPlanRemove(engine, filterIds, i);
+			return status;
+		}
+	}
+
+	return status;
+}
+
+void LbFilterPlanRemove(const LB_FILTER_ENGINE* engine, const UINT64* filterIds, UINT32 count)
+{
+	for (UINT32 i = 0; i < count; i++)
+		engine->deleteFilter(engine->context, filterIds[i]);
+}
+
+////////////////////
+// FILTER ACTIONS //
+////////////////////
+
+UINT8 LbFilterWeight(const LB_FILTER_SPEC* filter)
+{
+	return filter->tier == LB_FILTER_TIER_ADDRESS ? LB_FILTER_WEIGHT_ADDRESS : filter->tier == LB_FILTER_TIER_PORT ? LB_FILTER_WEIGHT_PORT : LB_FILTER_WEIGHT_ACK;
+}
+
+LB_FILTER_ACTION LbFilterAction(const LB_FILTER_SPEC* filter)
+{
+	if (filter->verdict == LB_VERDICT_BLOCK)
+		return LB_FILTER_ACTION_BLOCK;
+	if (filter->verdict == LB_VERDICT_INSPECT)
+		return LB_FILTER_ACTION_CALLOUT;
+
+	// Inbound IPv4 traffic that is let through may still carry acknowledgements to translate
+	if (filter->direction == LB_DIRECTION_INBOUND && filter->family == LB_FAMILY_IPV4 && filter->layer == LB_FILTER_LAYER_TRANSPORT)
+		return LB_FILTER_ACTION_CALLOUT;
+
+	return LB_FILTER_ACTION_PERMIT;
+}
+
+void LbFilterAckSpec(LB_FILTER_SPEC* filter)
+{
+	memset(filter, 0, sizeof(LB_FILTER_SPEC));
+
+	// Only TCP has acknowledgements to translate
+	filter->direction = LB_DIRECTION_INBOUND;
+	filter->family = LB_FAMILY_IPV4;
+	filter->tier = LB_FILTER_TIER_ACK;
+	filter->verdict = LB_VERDICT_PERMIT;
+	filter->layer = LB_FILTER_LAYER_TRANSPORT;
+	filter->protocol = LB_FILTER_PROTOCOL_TCP;
+}
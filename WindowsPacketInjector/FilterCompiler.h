@@ -0,0 +1,115 @@
+/*/
+/*  ** FilterCompiler.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for turning a compiled rule set into Base Filtering Engine filters.
+/*	Blocked traffic is dropped by plain block filters and permitted traffic never leaves the engine,
+/*	only flows that need their payload rewritten still reach the injection callout.
+/*	When TCP is inspected at the stream layer its inspected ranges are split: TCP is permitted at the
+/*	transport layer and sent to the stream callout instead, every other protocol keeps its transport filter.
+/*	Nothing here calls Fwpm directly, the driver hands in an LB_FILTER_ENGINE that does.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Classifier.h"
+
+// Filters of a higher tier override every filter of a lower tier they overlap.
+// Filters of the same tier never overlap, so the order within a tier does not matter.
+// Address filters only exist for IPv4, the IPv6 layers get the port filters alone.
+enum LB_FILTER_TIER : UINT8
+{
+	LB_FILTER_TIER_ACK = 0,		// Only the filter of LbFilterAckSpec, below every rule
+	LB_FILTER_TIER_PORT,
+	LB_FILTER_TIER_ADDRESS,
+};
+
+// Weight of each tier within the injection sublayer
+#define LB_FILTER_WEIGHT_ACK		0x1
+#define LB_FILTER_WEIGHT_PORT		0x8
+#define LB_FILTER_WEIGHT_ADDRESS	0xc
+
+enum LB_FILTER_LAYER : UINT8
+{
+	LB_FILTER_LAYER_TRANSPORT = 0,
+	LB_FILTER_LAYER_STREAM,		// Outgoing TCP data only, never blocks
+};
+
+enum LB_FILTER_PROTOCOL : UINT8
+{
+	LB_FILTER_PROTOCOL_ANY = 0,
+	LB_FILTER_PROTOCOL_TCP,
+	LB_FILTER_PROTOCOL_NOT_TCP,
+};
+
+// One filter. A condition that would match every value is left out.
+struct LB_FILTER_SPEC
+{
+	UINT8 direction;			// LB_DIRECTION, LB_ADDRESS_FAMILY and LB_FILTER_LAYER pick the layer
+	UINT8 family;
+	UINT8 tier;					// LB_FILTER_TIER, picks the weight
+	UINT8 verdict;				// LB_VERDICT_PERMIT, LB_VERDICT_BLOCK or LB_VERDICT_INSPECT
+	BOOLEAN matchAddress;
+	BOOLEAN matchPort;
+	UINT8 layer;				// LB_FILTER_LAYER
+	UINT8 protocol;				// LB_FILTER_PROTOCOL, transport filters only
+	UINT32 firstAddress;		// Host byte order, inclusive
+	UINT32 lastAddress;
+	UINT16 firstPort;			// Inclusive
+	UINT16 lastPort;
+};
+
+struct LB_FILTER_PLAN
+{
+	UINT32 count;
+	UINT32 capacity;
+	LB_FILTER_SPEC* filters;
+};
+
+// What the filter engine does with the packets a filter matches
+enum LB_FILTER_ACTION : UINT8
+{
+	LB_FILTER_ACTION_PERMIT = 0,
+	LB_FILTER_ACTION_BLOCK,
+	LB_FILTER_ACTION_CALLOUT,	// Terminating callout of the filter's layer
+};
+
+// Filter engine a plan is installed into
+struct LB_FILTER_ENGINE
+{
+	void* context;
+	NTSTATUS(*addFilter)(void* context, const LB_FILTER_SPEC* filter, UINT64* filterId);
+	NTSTATUS(*deleteFilter)(void* context, UINT64 filterId);
+};
+
+// Build the smallest set of filters that gives every flow the verdict LbClassifierLookup would.
+// stream sends the outgoing TCP data of inspected flows to the stream layer, see LB_RULES_FLAG_STREAM.
+NTSTATUS LbFilterPlanCompile(const LB_CLASSIFIER* classifier, BOOLEAN stream, LB_FILTER_PLAN* plan);
+
+// Free the filters of a plan built by LbFilterPlanCompile
+void LbFilterPlanFree(LB_FILTER_PLAN* plan);
+
+// Add every filter of a plan, filterIds receives plan->count IDs.
+// If one cannot be added the ones already added are deleted again.
+NTSTATUS LbFilterPlanInstall(const LB_FILTER_PLAN* plan, const LB_FILTER_ENGINE* engine, UINT64* filterIds);
+
+// Delete filters added by LbFilterPlanInstall
+void LbFilterPlanRemove(const LB_FILTER_ENGINE* engine, const UINT64* filterIds, UINT32 count);
+
+// Weight of a filter, from its tier
+UINT8 LbFilterWeight(const LB_FILTER_SPEC* filter);
+
+// Action of a filter. Blocked ranges are dropped by the engine itself and only inspected ones reach the
+// injection callouts for their payload, except that inbound IPv4 traffic that is let through still goes to
+// the inbound callout for its acknowledgements to be translated.
+LB_FILTER_ACTION LbFilterAction(const LB_FILTER_SPEC* filter);
+
+// The filter under every rule filter that sends the rest of inbound IPv4 TCP to the inbound callout,
+// for the acknowledgements of rewritten flows. It is added once and outlives every rule set.
+void LbFilterAckSpec(LB_FILTER_SPEC* filter);
@@ -0,0 +1,199 @@
+/*/
+/*  ** FlowContext.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for creating, associating and freeing per-flow contexts.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Microsoft, Windows-Driver-Samples, https://github.com/microsoft/Windows-driver-samples/
+/*			* The WFP stream edit and inspect samples show how flow contexts are associated and removed.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "FlowContext.h"
+#include "MatchEngine.h"
+#include "Slab.h"
+
+/////////////
+// GLOBALS //
+/////////////
+
+// Every context currently associated with a flow, needed to remove them all on unload
+static LIST_ENTRY lbFlowList;
+static KSPIN_LOCK lbFlowListLock;
+
+// Contexts are created on the classify path, each processor keeps a few free ones at hand
+static LB_SLAB* lbFlowContextSlab = NULL;
+
+////////////////////
+// INITIALIZATION //
+////////////////////
+
+NTSTATUS LbFlowContextInitialize()
+{
+	InitializeListHead(&lbFlowList);
+	KeInitializeSpinLock(&lbFlowListLock);
+
+	return LbSlabCreate(sizeof(LB_FLOW_CONTEXT), 32, 'LBF0', &lbFlowContextSlab);
+}
+
+void LbFlowContextCleanup()
+{
+	LbSlabDestroy(lbFlowContextSlab);
+	lbFlowContextSlab = NULL;
+}
+
+////////////////////////
+// CONTEXT MANAGEMENT //
+////////////////////////
+
+LB_FLOW_CONTEXT* LbFlowContextGet(const FWPS_INCOMING_METADATA_VALUES* inMetaValues, UINT16 layerId, UINT32 calloutId, UINT64 flowContext, const LB_FLOW_KEY* key)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_FLOW_CONTEXT* context = NULL;
+	KIRQL irql;
+
+	// Already associated on an earlier packet of this flow
+	if (flowContext != 0)
+		return (LB_FLOW_CONTEXT*)flowContext;
+
+	// Without a flow handle there is nothing to associate with
+	if (!FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_FLOW_HANDLE))
+		return NULL;
+
+	context = (LB_FLOW_CONTEXT*)LbSlabAlloc(lbFlowContextSlab);
+	if (!context)
+		return NULL;
+
+	RtlZeroMemory(context, sizeof(LB_FLOW_CONTEXT));
+
+	KeInitializeSpinLock(&context->lock);
+	context->references = 1;
+	context->flowHandle = inMetaValues->flowHandle;
+	context->layerId = layerId;
+	context->calloutId = calloutId;
+	context->key = *key;
+	context->matchState = LB_MATCHER_ROOT_STATE;
+	LbSeqTrackerInitialize(&context->seq);
+	LbDissectorBegin(&context->dissector, LbDissectorForFlow(key));
+
+	// Acknowledgements only need translating for TCP, and only segments resized at the outbound IPv4 transport
+	// layer shift them. A rewrite at the stream layer is resegmented by TCP itself.
+	if (key->protocol == IPPROTO_TCP && layerId == FWPS_LAYER_OUTBOUND_TRANSPORT_V4 && lbInjectionCalloutIds[LB_CALLOUT_INBOUND_V4] != 0)
+	{
+		context->ackAssociated = TRUE;
+		context->references++;
+	}
+
+	// Track the context before associating it, flowDeleteFn may run as soon as the association exists
+	KeAcquireSpinLock(&lbFlowListLock, &irql);
+	InsertTailList(&lbFlowList, &context->link);
+	KeReleaseSpinLock(&lbFlowListLock, irql);
+
+	status = FwpsFlowAssociateContext(context->flowHandle, layerId, calloutId, (UINT64)context);
+	if (!NT_SUCCESS(status) || status == STATUS_OBJECT_NAME_EXISTS)
+	{
+		// Another processor associated a context first (or the flow is gone), this packet is matched on its own
+		KeAcquireSpinLock(&lbFlowListLock, &irql);
+		RemoveEntryList(&context->link);
+		KeReleaseSpinLock(&lbFlowListLock, irql);
+
+		LbSlabFree(lbFlowContextSlab, context);
+		return NULL;
+	}
+
+	if (context->ackAssociated)
+	{
+		status = FwpsFlowAssociateContext(context->flowHandle, FWPS_LAYER_INBOUND_TRANSPORT_V4, lbInjectionCalloutIds[LB_CALLOUT_INBOUND_V4], (UINT64)context);
+		if (!NT_SUCCESS(status) || status == STATUS_OBJECT_NAME_EXISTS)
+		{
+			// The outbound association still holds its reference, so this never frees the context
+			KeAcquireSpinLock(&lbFlowListLock, &irql);
+			context->ackAssociated = FALSE;
+			KeReleaseSpinLock(&lbFlowListLock, irql);
+			InterlockedDecrement(&context->references);
+		}
+	}
+
+	return context;
+}
+
+void LbFlowContextDelete(UINT64 flowContext)
+{
+	LbFlowContextRelease((LB_FLOW_CONTEXT*)flowContext);
+}
+
+void LbFlowContextReference(LB_FLOW_CONTEXT* context)
+{
+	InterlockedIncrement(&context->references);
+}
+
+void LbFlowContextRelease(LB_FLOW_CONTEXT* context)
+{
+	KIRQL irql;
+
+	if (!context)
+		return;
+
+	// Still associated at the other layer, or a segment of the flow is still queued
+	if (InterlockedDecrement(&context->references) > 0)
+		return;
+
+	KeAcquireSpinLock(&lbFlowListLock, &irql);
+	RemoveEntryList(&context->link);
+	KeReleaseSpinLock(&lbFlowListLock, irql);
+
+	// A later flow reusing the same 5-tuple starts with a fresh evaluation
+	LbVerdictCacheRemove(&context->key);
+
+	LbSlabFree(lbFlowContextSlab, context);
+}
+
+void LbFlowContextRemoveAll()
+{
+	KIRQL irql;
+
+	for (;;)
+	{
+		LB_FLOW_CONTEXT* context = NULL;
+		UINT64 flowHandle = 0;
+		UINT16 layerId = 0;
+		UINT32 calloutId = 0;
+		BOOLEAN ackAssociated = FALSE;
+
+		// Pick a context that has not been asked to go away yet
+		KeAcquireSpinLock(&lbFlowListLock, &irql);
+		for (LIST_ENTRY* entry = lbFlowList.Flink; entry != &lbFlowList; entry = entry->Flink)
+		{
+			LB_FLOW_CONTEXT* candidate = CONTAINING_RECORD(entry, LB_FLOW_CONTEXT, link);
+			if (!candidate->removing)
+			{
+				candidate->removing = TRUE;
+				context = candidate;
+				flowHandle = candidate->flowHandle;
+				layerId = candidate->layerId;
+				calloutId = candidate->calloutId;
+				ackAssociated = candidate->ackAssociated;
+				break;
+			}
+		}
+		KeReleaseSpinLock(&lbFlowListLock, irql);
+
+		if (!context)
+			break;
+
+		// Causes LbFlowDelete to be called once per association, the last one frees the context
+		NTSTATUS status = FwpsFlowRemoveContext(flowHandle, layerId, calloutId);
+		if (!NT_SUCCESS(status)) LBPRINTLN("Failed to remove flow context, STATUS CODE: 0x%08x", status);
+
+		if (ackAssociated)
+		{
+			status = FwpsFlowRemoveContext(flowHandle, FWPS_LAYER_INBOUND_TRANSPORT_V4, lbInjectionCalloutIds[LB_CALLOUT_INBOUND_V4]);
+			if (!NT_SUCCESS(status)) LBPRINTLN("Failed to remove flow context, STATUS CODE: 0x%08x", status);
+		}
+	}
+}
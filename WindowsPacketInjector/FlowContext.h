@@ -0,0 +1,75 @@
+/*/
+/*  ** FlowContext.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the per-flow context associated with a data flow through flowContext.
+/*	The context holds the match engine position so a flow is scanned as one continuous stream
+/*	instead of every packet being matched as if it stood alone. TCP flows also associate it at the
+/*	inbound transport layer, where acknowledgements are translated once a rewrite changed sizes.
+/*	Flows inspected at the stream layer get a context of their own there, with no offsets to track.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Microsoft, Windows-Driver-Samples, https://github.com/microsoft/Windows-driver-samples/
+/*			* The WFP stream edit and inspect samples show how flow contexts are associated and removed.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Driver.h"
+#include "VerdictCache.h"
+#include "SeqTracker.h"
+#include "Dissector.h"
+
+struct LB_FLOW_CONTEXT
+{
+	LIST_ENTRY link;		// Entry in the global list of live contexts
+	KSPIN_LOCK lock;		// Serializes classifies of the same flow on different processors
+	volatile LONG references;	// One per layer the context is associated at, and one per segment waiting for a worker
+	UINT64 flowHandle;
+	UINT16 layerId;
+	UINT32 calloutId;
+	BOOLEAN ackAssociated;	// Also associated at the inbound IPv4 transport layer, where acknowledgements are translated
+	LB_FLOW_KEY key;		// 5-tuple of the flow, its cached verdict is dropped when the flow is deleted
+	BOOLEAN removing;		// Set once FwpsFlowRemoveContext has been requested during unload
+	UINT32 matchState;		// Automaton position at the end of the last scanned buffer
+	UINT32 matchGeneration;	// Rule set generation matchState belongs to
+	LB_SEQ_TRACKER seq;		// Size changes made to the outgoing stream so far
+	LB_DISSECTOR dissector;	// Position in the outgoing stream's HTTP messages, for rule sets that target fields
+	UINT32 deferred;		// Segments absorbed and not yet inspected by a worker, every later one has to queue behind them
+};
+
+// Sets up the list of live contexts and their allocator, call before the callout is registered
+NTSTATUS LbFlowContextInitialize();
+
+// Frees the context allocator, call once the callouts are unregistered and no context is left
+void LbFlowContextCleanup();
+
+// Returns the context associated with this flow, creating and associating one if needed.
+// TCP contexts of the outbound IPv4 transport layer are associated with the inbound IPv4 callout as well
+// so returning acknowledgements can be fixed.
+// Returns NULL when the layer does not provide a flow handle, in which case the packet is matched on its own.
+LB_FLOW_CONTEXT* LbFlowContextGet(
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	UINT16 layerId,
+	UINT32 calloutId,
+	UINT64 flowContext,
+	const LB_FLOW_KEY* key
+);
+
+// Drops one association of a context, the last one frees it and forgets the flow's cached verdict.
+// Called from the flowDeleteFn of every callout.
+void LbFlowContextDelete(UINT64 flowContext);
+
+// Keep a context alive past the classify that returned it, for a segment that is inspected later
+void LbFlowContextReference(LB_FLOW_CONTEXT* context);
+
+// Drop a reference taken by LbFlowContextReference, callable at any IRQL up to DISPATCH_LEVEL
+void LbFlowContextRelease(LB_FLOW_CONTEXT* context);
+
+// Removes every context still associated with a flow, must be called before the callout is unregistered
+void LbFlowContextRemoveAll();
@@ -0,0 +1,683 @@
+/*/
+/*  ** HashedEngine.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for compiling and running the hashed literal engine.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Sun Wu and Udi Manber, "A Fast Algorithm for Multi-Pattern Searching",
+/*		  Technical Report TR-94-17, University of Arizona, 1994
+/*			* Shift table over hashed blocks of the shortest pattern's length, verification on zero shifts.
+/*		- Adam Kirsch and Michael Mitzenmacher, "Less Hashing, Same Performance: Building a Better Bloom Filter",
+/*		  Random Structures & Algorithms 33(2), 2008
+/*			* Every probe of the filter derived from the two halves of one 64-bit hash.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "HashedEngine.h"
+
+////////////////
+// STRUCTURES //
+////////////////
+
+// Bits of the Bloom filter set for every window
+#define LB_HASHED_BLOOM_PROBES 3
+
+// Where the scan of one buffer stands
+struct LB_HASHED_SCAN
+{
+	SIZE_T position;			// No match can start before this
+	SIZE_T pending;				// First byte that could still begin a match once the buffer is used up
+	SIZE_T after;				// No match can end at or before this, see LbHashedReplace
+};
+
+/////////////////////
+// TABLE ACCESSORS //
+/////////////////////
+
+static inline const LB_MATCHER_PATTERN* LbHashedPairs(const LB_MATCHER* matcher)
+{
+	return (const LB_MATCHER_PATTERN*)((const UINT8*)matcher + matcher->patternOffset);
+}
+
+static inline UINT8* LbHashedShifts(const LB_MATCHER* matcher)
+{
+	return (UINT8*)matcher + matcher->hashShiftOffset;
+}
+
+static inline UINT64* LbHashedBloom(const LB_MATCHER* matcher)
+{
+	return (UINT64*)((UINT8*)matcher + matcher->hashBloomOffset);
+}
+
+static inline UINT32* LbHashedBuckets(const LB_MATCHER* matcher)
+{
+	return (UINT32*)((UINT8*)matcher + matcher->hashBucketOffset);
+}
+
+static inline UINT32* LbHashedEntries(const LB_MATCHER* matcher)
+{
+	return (UINT32*)((UINT8*)matcher + matcher->hashEntryOffset);
+}
+
+static inline SIZE_T LbAlignUp(SIZE_T value)
+{
+	return (value + 7) & ~(SIZE_T)7;
+}
+
+// Smallest bits with 1 << bits at least value
+static inline UINT32 LbHashedLog2(SIZE_T value)
+{
+	UINT32 bits = 0;
+
+	while (bits < 63 && ((SIZE_T)1 << bits) < value)
+		bits++;
+
+	return bits;
+}
+
+/////////////
+// HASHING //
+/////////////
+
+#define LB_HASHED_MULTIPLIER 0x9E3779B97F4A7C15ull
+
+// Shift table entry for the gram starting at gram. A gram of two bytes is its own index.
+template <UINT32 Gram>
+static inline UINT32 LbHashedGram(const UINT8* gram, UINT32 shiftBits)
+{
+	if (Gram == 2)
+		return (UINT32)gram[0] | ((UINT32)gram[1] << 8);
+
+	UINT32 value = (UINT32)gram[0] | ((UINT32)gram[1] << 8) | ((UINT32)gram[2] << 16);
+	if (Gram == 4)
+		value |= (UINT32)gram[3] << 24;
+
+	return (value * 0x9E3779B1u) >> (32 - shiftBits);
+}
+
+static inline UINT32 LbHashedGramAny(const UINT8* gram, UINT32 gramLength, UINT32 shiftBits)
+{
+	switch (gramLength)
+	{
+	case 2: return LbHashedGram<2>(gram, shiftBits);
+	case 3: return LbHashedGram<3>(gram, shiftBits);
+	default: return LbHashedGram<4>(gram, shiftBits);
+	}
+}
+
+// Hash of a whole window, the Bloom filter and the buckets both come from it
+static inline UINT64 LbHashedWindow(const UINT8* window, UINT32 length)
+{
+	UINT64 hash = length * LB_HASHED_MULTIPLIER;
+	UINT32 i = 0;
+
+	for (; i + 8 <= length; i += 8)
+	{
+		UINT64 word;
+		memcpy(&word, &window[i], 8);
+		hash = (hash ^ word) * LB_HASHED_MULTIPLIER;
+		hash ^= hash >> 29;
+	}
+
+	if (i < length)
+	{
+		UINT64 word = 0;
+		memcpy(&word, &window[i], length - i);
+		hash = (hash ^ word) * LB_HASHED_MULTIPLIER;
+		hash ^= hash >> 29;
+	}
+
+	hash *= 0xD6E8FEB86659FD93ull;
+	return hash ^ (hash >> 32);
+}
+
+static inline BOOLEAN LbHashedBloomHas(const UINT64* bloom, UINT32 bloomBits, UINT64 hash)
+{
+	UINT32 mask = (UINT32)(((UINT64)1 << bloomBits) - 1);
+	UINT32 bit = (UINT32)hash;
+	UINT32 step = (UINT32)(hash >> 32) | 1;
+
+	for (int probe = 0; probe < LB_HASHED_BLOOM_PROBES; probe++, bit += step)
+	{
+		if (!((bloom[(bit & mask) >> 6] >> (bit & 63)) & 1))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static inline void LbHashedBloomAdd(UINT64* bloom, UINT32 bloomBits, UINT64 hash)
+{
+	UINT32 mask = (UINT32)(((UINT64)1 << bloomBits) - 1);
+	UINT32 bit = (UINT32)hash;
+	UINT32 step = (UINT32)(hash >> 32) | 1;
+
+	for (int probe = 0; probe < LB_HASHED_BLOOM_PROBES; probe++, bit += step)
+		bloom[(bit & mask) >> 6] |= (UINT64)1 << (bit & 63);
+}
+
+static inline UINT32 LbHashedBucket(UINT32 bucketBits, UINT64 hash)
+{
+	return (UINT32)(hash >> (64 - bucketBits));
+}
+
+//////////////
+// COMPILER //
+//////////////
+
+BOOLEAN LbHashedPreferred(UINT32 patternCount, SIZE_T maxStates, SIZE_T shortest)
+{
+	if (patternCount == 0 || shortest < LB_HASHED_MIN_WINDOW)
+		return FALSE;
+
+	// The automaton also finds matches split between buffers, small dictionaries keep it
+	return maxStates > (shortest >= LB_HASHED_FAST_WINDOW ? LB_HASHED_MIN_STATES : LB_HASHED_MIN_STATES_SHORT);
+}
+
+NTSTATUS LbHashedCompile(const LB_USERDATA* ud, LB_MATCHER** matcher)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	UINT32 patternCount = 0;
+	SIZE_T stringBytes = 0;
+	SIZE_T minMatchLength = 0;
+	SIZE_T maxMatchLength = 0;
+	SIZE_T maxReplaceLength = 0;
+	BOOLEAN equalLength = TRUE;
+	UINT32* lengthStarts = NULL;	// UINT32[maxMatchLength + 2], first slot of each length in order
+	UINT32* order = NULL;			// UINT32[patternCount], patterns by length, shortest first
+	LB_MATCHER* result = NULL;
+
+	if (ud == NULL || matcher == NULL || ud->regex || ud->count <= 0 || ud->strArray == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	*matcher = NULL;
+
+	for (int i = 0; i < ud->count; i++)
+	{
+		const char* match = ud->strArray[i].match;
+		const char* replace = ud->strArray[i].replace;
+
+		if (match == NULL || replace == NULL || match[0] == '\0' || replace[0] == '\0')
+			return STATUS_INVALID_PARAMETER;
+
+		SIZE_T matchLength = strlen(match);
+		SIZE_T replaceLength = strlen(replace);
+
+		if (matchLength != replaceLength)
+			equalLength = FALSE;
+
+		// Same bounds as the automaton, with reversal a replacement is a pattern too
+		SIZE_T shortest = matchLength;
+		SIZE_T longest = replaceLength;
+		if (ud->enableReversal && replaceLength < matchLength)
+			shortest = replaceLength;
+		if (ud->enableReversal && matchLength > replaceLength)
+			longest = matchLength;
+		if (minMatchLength == 0 || shortest < minMatchLength)
+			minMatchLength = shortest;
+		if (longest > maxReplaceLength)
+			maxReplaceLength = longest;
+		if (matchLength > maxMatchLength)
+			maxMatchLength = matchLength;
+		if (ud->enableReversal && replaceLength > maxMatchLength)
+			maxMatchLength = replaceLength;
+
+		patternCount += ud->enableReversal ? 2 : 1;
+		stringBytes += matchLength + replaceLength;
+	}
+
+	// Too short a window would leave no room for a gram and a shift past it
+	if (minMatchLength < LB_HASHED_MIN_WINDOW || maxMatchLength > 0xFFFFFFF0)
+		return STATUS_INVALID_PARAMETER;
+
+	UINT32 windowLength = minMatchLength < LB_HASHED_MAX_WINDOW ? (UINT32)minMatchLength : LB_HASHED_MAX_WINDOW;
+	UINT32 gramLength = 2;
+	UINT32 shiftBits = 16;
+	UINT8 alphabet[32] = { 0 };
+	SIZE_T alphabetSize = 0;
+
+	// Bytes the windows are made of, grams of any other byte all keep the longest shift
+	for (int i = 0; i < ud->count; i++)
+	{
+		for (int direction = 0; direction < (ud->enableReversal ? 2 : 1); direction++)
+		{
+			const UINT8* window = (const UINT8*)(direction == 0 ? ud->strArray[i].match : ud->strArray[i].replace);
+
+			for (UINT32 k = 0; k < windowLength; k++)
+				alphabet[window[k] >> 3] |= (UINT8)(1 << (window[k] & 7));
+		}
+	}
+	for (int c = 0; c < 256; c++)
+		alphabetSize += (alphabet[c >> 3] >> (c & 7)) & 1;
+
+	// Longer grams once the windows would fill more than a quarter of the grams their bytes can make or of
+	// the shift table, the shifts left in it would be too short to skip anything
+	for (;;)
+	{
+		SIZE_T needed = (SIZE_T)patternCount * (windowLength - gramLength + 1) * 4;
+		SIZE_T grams = 1;
+
+		for (UINT32 k = 0; k < gramLength; k++)
+			grams *= alphabetSize;
+
+		if (gramLength > 2)
+		{
+			shiftBits = LbHashedLog2(needed);
+			if (shiftBits < 16) shiftBits = 16;
+			if (shiftBits > LB_HASHED_MAX_SHIFT_BITS) shiftBits = LB_HASHED_MAX_SHIFT_BITS;
+		}
+
+		if ((needed <= grams && needed <= ((SIZE_T)1 << shiftBits)) || gramLength == 4 || gramLength + 1 >= windowLength)
+			break;
+
+		gramLength++;
+	}
+
+	UINT32 bloomBits = LbHashedLog2((SIZE_T)patternCount * LB_HASHED_BLOOM_BITS_PER_PATTERN);
+	if (bloomBits < 6) bloomBits = 6;
+	if (bloomBits > 31) bloomBits = 31;
+
+	UINT32 bucketBits = LbHashedLog2(patternCount);
+	if (bucketBits < 1) bucketBits = 1;
+	if (bucketBits > LB_HASHED_MAX_BUCKET_BITS) bucketBits = LB_HASHED_MAX_BUCKET_BITS;
+
+	// Lay out the final flat block
+	{
+		SIZE_T patternOffset = LbAlignUp(sizeof(LB_MATCHER));
+		SIZE_T stringOffset = LbAlignUp(patternOffset + (SIZE_T)patternCount * sizeof(LB_MATCHER_PATTERN));
+		SIZE_T shiftOffset = LbAlignUp(stringOffset + stringBytes);
+		SIZE_T bloomOffset = LbAlignUp(shiftOffset + ((SIZE_T)1 << shiftBits));
+		SIZE_T bucketOffset = LbAlignUp(bloomOffset + ((SIZE_T)1 << bloomBits) / 8);
+		SIZE_T entryOffset = LbAlignUp(bucketOffset + (((SIZE_T)1 << bucketBits) + 1) * sizeof(UINT32));
+		SIZE_T size = entryOffset + (SIZE_T)patternCount * sizeof(UINT32);
+
+		if (size > 0xFFFFFFFF)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto Exit;
+		}
+
+		// Nothing is allocated before the layout is known, a dictionary over the budget never takes any pool
+		if (ud->budget != 0 && size + (maxMatchLength + 2 + patternCount) * sizeof(UINT32) > ud->budget)
+		{
+			status = STATUS_QUOTA_EXCEEDED;
+			goto Exit;
+		}
+
+		lengthStarts = (UINT32*)LbAlloc((maxMatchLength + 2) * sizeof(UINT32), 'LBP2');
+		order = (UINT32*)LbAlloc((SIZE_T)patternCount * sizeof(UINT32), 'LBP2');
+		result = (LB_MATCHER*)LbAlloc(size, 'LBP3');
+		if (!lengthStarts || !order || !result)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto Exit;
+		}
+
+		result->size = (UINT32)size;
+		result->engine = LB_MATCHER_ENGINE_HASHED;
+		result->patternCount = patternCount;
+		result->equalLength = equalLength;
+		result->minMatchLength = (UINT32)minMatchLength;
+		result->maxReplaceLength = (UINT32)maxReplaceLength;
+		result->patternOffset = (UINT32)patternOffset;
+		result->stringOffset = (UINT32)stringOffset;
+		result->hashWindowLength = windowLength;
+		result->hashGramLength = gramLength;
+		result->hashShiftBits = shiftBits;
+		result->hashShiftOffset = (UINT32)shiftOffset;
+		result->hashBloomBits = bloomBits;
+		result->hashBloomOffset = (UINT32)bloomOffset;
+		result->hashBucketBits = bucketBits;
+		result->hashBucketOffset = (UINT32)bucketOffset;
+		result->hashEntryOffset = (UINT32)entryOffset;
+
+		// Copy the strings, each pair is stored once and shared by both directions
+		LB_MATCHER_PATTERN* patterns = (LB_MATCHER_PATTERN*)((UINT8*)result + patternOffset);
+		UINT32 cursor = (UINT32)stringOffset;
+
+		for (int i = 0; i < ud->count; i++)
+		{
+			UINT32 matchLength = (UINT32)strlen(ud->strArray[i].match);
+			UINT32 replaceLength = (UINT32)strlen(ud->strArray[i].replace);
+			UINT32 matchOffset = cursor;
+			UINT32 replaceOffset = cursor + matchLength;
+
+			memcpy((UINT8*)result + matchOffset, ud->strArray[i].match, matchLength);
+			memcpy((UINT8*)result + replaceOffset, ud->strArray[i].replace, replaceLength);
+			cursor += matchLength + replaceLength;
+
+			if (ud->enableReversal)
+			{
+				patterns[i * 2] = { matchOffset, matchLength, replaceOffset, replaceLength };
+				patterns[i * 2 + 1] = { replaceOffset, replaceLength, matchOffset, matchLength };
+			}
+			else
+			{
+				patterns[i] = { matchOffset, matchLength, replaceOffset, replaceLength };
+			}
+		}
+
+		// A gram the windows never hold lets the window move past it entirely. One they do hold lets it move
+		// until the gram sits at the end of the window, the way it does in the window furthest to the right.
+		UINT8* shifts = LbHashedShifts(result);
+		UINT64* bloom = LbHashedBloom(result);
+		UINT32* buckets = LbHashedBuckets(result);
+		UINT32* entries = LbHashedEntries(result);
+
+		memset(shifts, windowLength - gramLength + 1, (SIZE_T)1 << shiftBits);
+
+		for (UINT32 p = 0; p < patternCount; p++)
+		{
+			const UINT8* window = (const UINT8*)result + patterns[p].matchOffset;
+
+			for (UINT32 q = 0; q + gramLength <= windowLength; q++)
+			{
+				UINT8* shift = &shifts[LbHashedGramAny(&window[q], gramLength, shiftBits)];
+				if (*shift > windowLength - gramLength - q)
+					*shift = (UINT8)(windowLength - gramLength - q);
+			}
+
+			LbHashedBloomAdd(bloom, bloomBits, LbHashedWindow(window, windowLength));
+		}
+
+		// Within a bucket patterns go shortest first, then in pair order, so the first one that fits is the
+		// match the automaton would report: it ends first, and the first pair to claim a string wins.
+		for (UINT32 p = 0; p < patternCount; p++)
+			lengthStarts[patterns[p].matchLength + 1]++;
+		for (SIZE_T length = 1; length <= maxMatchLength + 1; length++)
+			lengthStarts[length] += lengthStarts[length - 1];
+		for (UINT32 p = 0; p < patternCount; p++)
+			order[lengthStarts[patterns[p].matchLength]++] = p;
+
+		// Buckets are ranges of the entry table, each one starting where the one before ends. Slots are
+		// handed out from the end of each range, walking the order backwards keeps it within a bucket.
+		for (UINT32 p = 0; p < patternCount; p++)
+		{
+			const UINT8* window = (const UINT8*)result + patterns[p].matchOffset;
+			buckets[LbHashedBucket(bucketBits, LbHashedWindow(window, windowLength))]++;
+		}
+		for (UINT32 b = 1; b <= (1u << bucketBits); b++)
+			buckets[b] += buckets[b - 1];
+
+		for (UINT32 i = patternCount; i-- > 0;)
+		{
+			const UINT8* window = (const UINT8*)result + patterns[order[i]].matchOffset;
+			entries[--buckets[LbHashedBucket(bucketBits, LbHashedWindow(window, windowLength))]] = order[i];
+		}
+
+		// Every pattern also starts with one of these, for LbMatcherNextCandidate
+		for (UINT32 p = 0; p < patternCount; p++)
+		{
+			UINT8 c = *((const UINT8*)result + patterns[p].matchOffset);
+			result->firstByteMap[c >> 3] |= (UINT8)(1 << (c & 7));
+		}
+		for (int c = 0; c < 256; c++)
+		{
+			if (!(result->firstByteMap[c >> 3] & (1 << (c & 7))))
+				continue;
+
+			if (result->firstByteCount < LB_PREFILTER_MAX_BYTES)
+				result->firstBytes[result->firstByteCount] = (UINT8)c;
+			result->firstByteCount++;
+		}
+	}
+
+	*matcher = result;
+
+Exit:
+	if (!NT_SUCCESS(status) && result) LbFree(result, 'LBP3');
+	if (lengthStarts) LbFree(lengthStarts, 'LBP2');
+	if (order) LbFree(order, 'LBP2');
+
+	return status;
+}
+
+/////////////////
+// RULE IMAGES //
+/////////////////
+
+// count elements of elementSize bytes at offset lie inside the block, after its header
+static inline BOOLEAN LbHashedTableFits(const LB_MATCHER* matcher, UINT32 offset, SIZE_T count, SIZE_T elementSize)
+{
+	return (offset & 7) == 0 && offset >= sizeof(LB_MATCHER) && offset <= matcher->size && count <= (matcher->size - offset) / elementSize;
+}
+
+NTSTATUS LbHashedBindImage(LB_MATCHER* matcher)
+{
+	// Every window is read whole out of every pattern, and a gram out of every window
+	if (matcher->patternCount == 0 || matcher->hashWindowLength > matcher->minMatchLength || matcher->hashWindowLength > LB_HASHED_MAX_WINDOW)
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->hashGramLength < 2 || matcher->hashGramLength > 4 || matcher->hashGramLength >= matcher->hashWindowLength)
+		return STATUS_INVALID_PARAMETER;
+
+	// A gram of two bytes indexes the shift table directly, it needs every one of its entries
+	if (matcher->hashShiftBits < 16 || matcher->hashShiftBits > LB_HASHED_MAX_SHIFT_BITS ||
+		(matcher->hashGramLength == 2 && matcher->hashShiftBits != 16))
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->hashBloomBits < 6 || matcher->hashBloomBits > 31)
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->hashBucketBits < 1 || matcher->hashBucketBits > LB_HASHED_MAX_BUCKET_BITS)
+		return STATUS_INVALID_PARAMETER;
+
+	if (!LbHashedTableFits(matcher, matcher->hashShiftOffset, (SIZE_T)1 << matcher->hashShiftBits, sizeof(UINT8)) ||
+		!LbHashedTableFits(matcher, matcher->hashBloomOffset, (SIZE_T)1 << (matcher->hashBloomBits - 6), sizeof(UINT64)) ||
+		!LbHashedTableFits(matcher, matcher->hashBucketOffset, ((SIZE_T)1 << matcher->hashBucketBits) + 1, sizeof(UINT32)) ||
+		!LbHashedTableFits(matcher, matcher->hashEntryOffset, matcher->patternCount, sizeof(UINT32)))
+		return STATUS_INVALID_PARAMETER;
+
+	// Buckets must be ranges of the entry table one after another, and every entry a pattern
+	const UINT32* buckets = LbHashedBuckets(matcher);
+	const UINT32* entries = LbHashedEntries(matcher);
+
+	if (buckets[0] != 0 || buckets[(SIZE_T)1 << matcher->hashBucketBits] != matcher->patternCount)
+		return STATUS_INVALID_PARAMETER;
+	for (SIZE_T b = 0; b < ((SIZE_T)1 << matcher->hashBucketBits); b++)
+	{
+		if (buckets[b] > buckets[b + 1])
+			return STATUS_INVALID_PARAMETER;
+	}
+	for (UINT32 i = 0; i < matcher->patternCount; i++)
+	{
+		if (entries[i] >= matcher->patternCount)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+//////////////
+// SCANNING //
+//////////////
+
+// There is nothing to carry over, a scan always starts with a fresh buffer
+static inline void LbHashedScanBegin(LB_HASHED_SCAN* scan)
+{
+	scan->position = 0;
+	scan->pending = 0;
+	scan->after = 0;
+}
+
+SIZE_T LbHashedPendingLength(const LB_MATCHER* matcher, UINT32 state)
+{
+	UNREFERENCED_PARAMETER(matcher);
+
+	// The state is the number of bytes at the end of the last buffer that could still begin a match
+	return state;
+}
+
+static inline UINT32 LbHashedScanEnd(const LB_HASHED_SCAN* scan, SIZE_T length)
+{
+	return (UINT32)(length - scan->pending);
+}
+
+// Finds the next match in the buffer: the one that ends first, and of those the longest.
+// That is the match the automaton would report for the same pairs. Returns FALSE once the buffer is used up.
+template <UINT32 Gram>
+static BOOLEAN LbHashedNextMatch(const LB_MATCHER* matcher, LB_HASHED_SCAN* scan, const UINT8* data, SIZE_T length, UINT32* pattern, SIZE_T* start, SIZE_T* end)
+{
+	const LB_MATCHER_PATTERN* pairs = LbHashedPairs(matcher);
+	const UINT8* shifts = LbHashedShifts(matcher);
+	const UINT64* bloom = LbHashedBloom(matcher);
+	const UINT32* buckets = LbHashedBuckets(matcher);
+	const UINT32* entries = LbHashedEntries(matcher);
+	const UINT32 window = matcher->hashWindowLength;
+	const UINT32 shiftBits = matcher->hashShiftBits;
+	const UINT32 bloomBits = matcher->hashBloomBits;
+	const UINT32 bucketBits = matcher->hashBucketBits;
+	SIZE_T best = (SIZE_T)-1;		// End of the best match so far
+	SIZE_T partial = length;		// Leftmost start of a pattern the buffer ends inside of
+	SIZE_T s = scan->position;
+
+	// A start only beats the best match so far when even its shortest pattern would end before it
+	while (s + window <= length && s + window < best)
+	{
+		// Nearly every window lets the scan move on without ever looking at a pattern
+		UINT32 shift = shifts[LbHashedGram<Gram>(&data[s + window - Gram], shiftBits)];
+		if (shift != 0)
+		{
+			s += shift;
+			continue;
+		}
+
+		UINT64 hash = LbHashedWindow(&data[s], window);
+		if (LbHashedBloomHas(bloom, bloomBits, hash))
+		{
+			UINT32 bucket = LbHashedBucket(bucketBits, hash);
+
+			for (UINT32 e = buckets[bucket]; e < buckets[bucket + 1]; e++)
+			{
+				const LB_MATCHER_PATTERN* pair = &pairs[entries[e]];
+				const UINT8* match = (const UINT8*)matcher + pair->matchOffset;
+
+				if (s + pair->matchLength >= best)
+					break;
+
+				// Shortest first: the first whole match is the one ending first, once a pattern runs past the
+				// buffer every one after it does too
+				if (s + pair->matchLength <= length)
+				{
+					if (s + pair->matchLength <= scan->after)
+						continue;
+					if (memcmp(&data[s], match, pair->matchLength) == 0)
+					{
+						best = s + pair->matchLength;
+						*pattern = entries[e];
+						break;
+					}
+				}
+				else if (partial == length)
+				{
+					if (memcmp(&data[s], match, length - s) == 0)
+					{
+						partial = s;
+						break;
+					}
+				}
+			}
+		}
+
+		s++;
+	}
+
+	if (best != (SIZE_T)-1)
+	{
+		// Matches never overlap, continue after this one
+		*end = best;
+		*start = best - pairs[*pattern].matchLength;
+		scan->position = best;
+		return TRUE;
+	}
+
+	// Every start before s was looked at, from s on the window did not fit any more
+	scan->pending = partial < s ? partial : s;
+	scan->position = length;
+	return FALSE;
+}
+
+static inline BOOLEAN LbHashedNext(const LB_MATCHER* matcher, LB_HASHED_SCAN* scan, const UINT8* data, SIZE_T length, UINT32* pattern, SIZE_T* start, SIZE_T* end)
+{
+	switch (matcher->hashGramLength)
+	{
+	case 2: return LbHashedNextMatch<2>(matcher, scan, data, length, pattern, start, end);
+	case 3: return LbHashedNextMatch<3>(matcher, scan, data, length, pattern, start, end);
+	default: return LbHashedNextMatch<4>(matcher, scan, data, length, pattern, start, end);
+	}
+}
+
+/////////////////////
+// MATCH & REPLACE //
+/////////////////////
+
+UINT32 LbHashedReplace(const LB_MATCHER* matcher, UINT32* state, UINT8* data, SIZE_T length, LB_CHECKSUM_EDITS* edits)
+{
+	const LB_MATCHER_PATTERN* pairs = LbHashedPairs(matcher);
+	LB_HASHED_SCAN scan;
+	UINT32 replacements = 0;
+	UINT32 pattern;
+	SIZE_T start;
+	SIZE_T end;
+
+	LbHashedScanBegin(&scan);
+
+	for (SIZE_T position = 0; LbHashedNext(matcher, &scan, data, length, &pattern, &start, &end); position = scan.position)
+	{
+		// Nothing can move in place, other matches are left for the copying rewrite. The automaton goes on
+		// from inside of such a match as if it had not been there, so a shorter one overlapping it that ends
+		// later is still found.
+		const LB_MATCHER_PATTERN* pair = &pairs[pattern];
+		if (pair->matchLength != pair->replaceLength)
+		{
+			scan.position = position;
+			scan.after = end;
+			continue;
+		}
+
+		if (edits)
+			LbChecksumEdit(edits, start, &data[start], (const UINT8*)matcher + pair->replaceOffset, pair->replaceLength);
+		memcpy(&data[start], (const UINT8*)matcher + pair->replaceOffset, pair->replaceLength);
+		replacements++;
+	}
+
+	*state = LbHashedScanEnd(&scan, length);
+	return replacements;
+}
+
+UINT32 LbHashedRewrite(const LB_MATCHER* matcher, UINT32* state, const UINT8* data, SIZE_T length, UINT8* output, SIZE_T* outputLength)
+{
+	const LB_MATCHER_PATTERN* pairs = LbHashedPairs(matcher);
+	LB_HASHED_SCAN scan;
+	UINT32 replacements = 0;
+	UINT32 pattern;
+	SIZE_T start;
+	SIZE_T end;
+	SIZE_T copied = 0;		// Input bytes already written to output
+	SIZE_T written = 0;
+
+	LbHashedScanBegin(&scan);
+
+	// Every match starts at or after the end of the previous one
+	while (LbHashedNext(matcher, &scan, data, length, &pattern, &start, &end))
+	{
+		const LB_MATCHER_PATTERN* pair = &pairs[pattern];
+
+		memcpy(&output[written], &data[copied], start - copied);
+		written += start - copied;
+		memcpy(&output[written], (const UINT8*)matcher + pair->replaceOffset, pair->replaceLength);
+		written += pair->replaceLength;
+		copied = end;
+		replacements++;
+	}
+
+	// Rest of the buffer is unchanged
+	memcpy(&output[written], &data[copied], length - copied);
+	written += length - copied;
+
+	*state = LbHashedScanEnd(&scan, length);
+	*outputLength = written;
+	return replacements;
+}
@@ -0,0 +1,85 @@
+/*/
+/*  ** HashedEngine.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the hashed literal engine behind LB_MATCHER_ENGINE_HASHED, the one large
+/*	dictionaries of literal pairs are compiled into. An automaton takes a kilobyte per state, so tens of
+/*	thousands of strings would not even fit in memory, let alone in cache. This engine only keeps a few bytes
+/*	per pattern plus two fixed size tables.
+/*
+/*	Every pattern is looked at through its first windowLength bytes, as long as the shortest pattern. A window
+/*	slides over the data and the last gramLength bytes under it are hashed into a table of shifts: how far the
+/*	window can move before any pattern could line up with it. Where nothing lets it move, the whole window is
+/*	hashed and tested against a Bloom filter of every pattern's window, and only when that passes are the
+/*	patterns in the window's bucket compared. A match is the one that ends first and the longest of those, the
+/*	same one the automaton reports; the scan continues after it.
+/*
+/*	There is no automaton state to carry into the next buffer. A scan reports how many of its last bytes could
+/*	still begin a match instead, which lets the stream layer hold them back, see LbMatcherPendingLength.
+/*	Matches split between two buffers of one packet are not found.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Sun Wu and Udi Manber, "A Fast Algorithm for Multi-Pattern Searching",
+/*		  Technical Report TR-94-17, University of Arizona, 1994
+/*			* Shift table over hashed blocks of the shortest pattern's length, verification on zero shifts.
+/*		- Burton H. Bloom, "Space/Time Trade-offs in Hash Coding with Allowable Errors",
+/*		  Communications of the ACM 13(7), 1970
+/*			* The filter that keeps most zero shifts away from the buckets.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "MatchEngine.h"
+
+// Shortest window the engine takes. Shorter ones leave it too little room to shift.
+#define LB_HASHED_MIN_WINDOW 4
+
+// LbMatcherCompile turns literal pairs over to this engine once an automaton could need more states than
+// LB_HASHED_MIN_STATES, about a megabyte of transitions. While the shortest pattern is below
+// LB_HASHED_FAST_WINDOW bytes the shifts stay so short that the automaton is faster on binary data, there it
+// only takes over once the automaton could need LB_HASHED_MIN_STATES_SHORT states.
+#define LB_HASHED_FAST_WINDOW 6
+#define LB_HASHED_MIN_STATES 0x400
+#define LB_HASHED_MIN_STATES_SHORT 0x8000
+
+// Longest window, patterns are only hashed up to here
+#define LB_HASHED_MAX_WINDOW 32
+
+// Largest shift and bucket tables, log2 of their entries
+#define LB_HASHED_MAX_SHIFT_BITS 20
+#define LB_HASHED_MAX_BUCKET_BITS 24
+
+// Bits of the Bloom filter per pattern, about 1% of windows that no pattern starts with get past it
+#define LB_HASHED_BLOOM_BITS_PER_PATTERN 12
+
+// Whether LbMatcherCompile builds this engine for patternCount patterns that would need up to maxStates
+// automaton states and the shortest of which is shortest bytes long
+BOOLEAN LbHashedPreferred(UINT32 patternCount, SIZE_T maxStates, SIZE_T shortest);
+
+// Build a hashed matcher from literal pairs, enableReversal works like it does for the automaton
+NTSTATUS LbHashedCompile(const LB_USERDATA* ud, LB_MATCHER** matcher);
+
+// LbMatcherBindImage for hashed matchers. The pairs and their strings were already checked.
+NTSTATUS LbHashedBindImage(LB_MATCHER* matcher);
+
+// LbMatcherReplace for hashed matchers. Matches are only rewritten when the replacement has the same length.
+UINT32 LbHashedReplace(const LB_MATCHER* matcher, UINT32* state, UINT8* data, SIZE_T length, LB_CHECKSUM_EDITS* edits);
+
+// LbMatcherPendingLength for hashed matchers
+SIZE_T LbHashedPendingLength(const LB_MATCHER* matcher, UINT32 state);
+
+// LbMatcherRewrite for hashed matchers
+UINT32 LbHashedRewrite(
+	const LB_MATCHER* matcher,
+	UINT32* state,
+	const UINT8* data,
+	SIZE_T length,
+	UINT8* output,
+	SIZE_T* outputLength
+);
@@ -20,6 +20,21 @@
 /*/
 
 #include "InjectionCallout.h"
+#include "MatchEngine.h"
+#include "StaticMatcher.h"
+#include "FlowContext.h"
+#include "VerdictCache.h"
+#include "RuleSet.h"
+#include "Rcu.h"
+#include "PacketInjector.h"
+#include "Checksum.h"
+#include "EventLog.h"
+#include "Stats.h"
+#include "ClassifyCore.h"
+#include "SpanIterator.h"
+#include "WorkQueue.h"
+#include "Slab.h"
+#include "Capture.h"
 #include <ntstrsafe.h>
 
 /////////////////////////////
@@ -34,200 +49,1478 @@
 
 void PrintPayload(NET_BUFFER_LIST* netBufferList)
 {
-	// initial vars
-	NET_BUFFER_LIST* currentNBL = netBufferList;
-	NET_BUFFER* currentNB = netBufferList->FirstNetBuffer;
-	PMDL currentMDL = currentNB->CurrentMdl;
-	char* buffer;
+	// loop through all NBL's
+	for (NET_BUFFER_LIST* currentNBL = netBufferList; currentNBL != NULL; currentNBL = NET_BUFFER_LIST_NEXT_NBL(currentNBL))
+	{
+		// loop through all NB's per NBL
+		for (NET_BUFFER* currentNB = NET_BUFFER_LIST_FIRST_NB(currentNBL); currentNB != NULL; currentNB = NET_BUFFER_NEXT_NB(currentNB))
+		{
+			LB_SPAN_ITERATOR<MDL> it;
+			LB_SPAN span;
+
+			LBPRINTLN("LENGTH: %u | OFFSET: %u", NET_BUFFER_DATA_LENGTH(currentNB), NET_BUFFER_CURRENT_MDL_OFFSET(currentNB));
+
+			// One line per span, only the bytes the NB actually describes
+			LbSpanBegin(&it, NET_BUFFER_CURRENT_MDL(currentNB), NET_BUFFER_CURRENT_MDL_OFFSET(currentNB), NET_BUFFER_DATA_LENGTH(currentNB));
+			while (LbSpanNext(&it, &span))
+			{
+				// print bytes as hex
+				for (SIZE_T i = 0; i < span.length; i++)
+					LBPRINT_NO_INFO("0x%02X ", span.data[i]);
+
+				LBPRINT_NO_INFO("\n");
+			}
+
+			if (it.remaining != 0)
+				LBPRINT_NO_INFO("UNMAPPED BUFFER\n");
+		}
+	}
+}
+
+//////////////////////////
+// COMPILED MATCH RULES //
+//////////////////////////
+
+// Rule set every classify reads. It is only ever replaced as a whole: readers raise to DISPATCH_LEVEL
+// while they use it, and a writer frees the old set only after every processor has run at a lower IRQL.
+static LB_RCU lbRules;
+
+// Starts a read-side section, the returned rule set stays valid until LbRulesRelease
+static inline const LB_RULESET* LbRulesAcquire(KIRQL* oldIrql)
+{
+	KeRaiseIrql(DISPATCH_LEVEL, oldIrql);
+	return (const LB_RULESET*)LbRcuRead(&lbRules);
+}
+
+static inline void LbRulesRelease(KIRQL oldIrql)
+{
+	KeLowerIrql(oldIrql);
+}
+
+// Runs once on every processor. A DPC can only run on a processor that is not already at DISPATCH_LEVEL,
+// so once all of them are done no reader can still be holding the previous rule set.
+static void LbRulesBarrierDpc(PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+	UNREFERENCED_PARAMETER(Dpc);
+	UNREFERENCED_PARAMETER(DeferredContext);
+
+	KeSignalCallDpcSynchronize(SystemArgument2);
+	KeSignalCallDpcDone(SystemArgument1);
+}
+
+// The grace period of the rule set, returns once the DPC has run on every processor
+static void LbRulesBarrier(void* context)
+{
+	UNREFERENCED_PARAMETER(context);
+
+	KeGenericCallDpc(LbRulesBarrierDpc, NULL);
+}
+
+static void LbRulesRetire(void* value, void* context)
+{
+	UNREFERENCED_PARAMETER(context);
+
+	// Verdicts cached by readers of the old rules are dropped only after they are all done
+	LbVerdictCacheInvalidateAll();
+	LbRuleSetFree((LB_RULESET*)value);
+}
+
+// Publish a new rule set and free the old one once no reader can see it. Must be called at PASSIVE_LEVEL
+// and never concurrently with itself (the control device queue is sequential).
+static void LbRulesPublish(LB_RULESET* ruleSet)
+{
+	LbRcuPublish(&lbRules, ruleSet, LbRulesRetire, NULL);
+}
+
+// Match and replace pairs every build starts with. Their tables are built by the compiler, so publishing
+// them allocates nothing and the payload is scanned by code specialized for exactly these pairs.
+struct LB_BUILTIN_PAIRS
+{
+	static constexpr LB_STATIC_RULES<3> Get()
+	{
+		// Allow inversion of strings EX: {"Love", "Hate"} results in "Love"  -> "Hate" and "Hate" -> "Love"
+		return { true, {
+			{ "Love", "Hate" },
+			{ "Alice", "Trudy" },
+			{ "Rob", "Bob" },
+		} };
+	}
+};
+
+typedef LB_STATIC_MATCHER<LB_BUILTIN_PAIRS> LB_BUILTIN_MATCHER;
+
+NTSTATUS LbInjectionInitialize()
+{
+	LB_RULESET* ruleSet = NULL;
+
+	// port 80 is HTTP traffic (No Encryption)
+	// port 443 is HTTPS (Encrypted)
+	// port 53 is DNS
+	LB_PORT_RULE ports[] = {
+		{ 443, 443, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_OUTBOUND, 0 },		// Block HTTPS traffic
+		{ 27015, 27015, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_OUTBOUND, 0 },	// Rewrite traffic to the demo server
+	};
+
+	LbRcuInitialize(&lbRules, NULL, LbRulesBarrier, NULL);
+
+	NTSTATUS status = LbRuleSetCompileStatic(NULL, 0, ports, ARRAYSIZE(ports),
+		LB_BUILTIN_MATCHER::Matcher(), LB_BUILTIN_MATCHER::Replace, &ruleSet);
+	if (!NT_SUCCESS(status))
+	{
+		LBPRINTLN("Failed to compile match rules, STATUS CODE: 0x%08x", status);
+		return status;
+	}
+
+	LbRulesPublish(ruleSet);
+	return status;
+}
+
+NTSTATUS LbInjectionInstallFilters()
+{
+	// Called from DriverEntry before any IOCTL can replace the rules
+	const LB_RULESET* ruleSet = (const LB_RULESET*)lbRules.value;
+
+	return InitFilter(ruleSet->classifier, ruleSet->stream);
+}
+
+// Installs a rule set that was just built, it is freed when it cannot be
+static NTSTATUS LbInjectionInstallRules(LB_RULESET* ruleSet)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	// Building the set already checked against the budget what it could take, this is what it does take
+	if (ruleSet->bytes > ruleSet->memoryBudget)
+	{
+		LBPRINTLN("Rejected rule set of %llu bytes, over its budget of %llu", (UINT64)ruleSet->bytes, (UINT64)ruleSet->memoryBudget);
+		LBEVENT(LB_LEVEL_WARNING, LB_EVENT_RULES_OVER_BUDGET, ruleSet->bytes, ruleSet->memoryBudget);
+		LbRuleSetFree(ruleSet);
+		return STATUS_QUOTA_EXCEEDED;
+	}
+
+	// Filters go first: until the rules follow, the callout may see flows the old rules would not
+	// have sent it, and those simply get the verdict the old rules give them
+	status = UpdateFilters(ruleSet->classifier, ruleSet->stream);
+	if (!NT_SUCCESS(status))
+	{
+		LbRuleSetFree(ruleSet);
+		return status;
+	}
+
+	LbRulesPublish(ruleSet);
+	LBPRINTLN("Rule set %u published, %llu bytes", ruleSet->generation, (UINT64)ruleSet->bytes);
+	LBEVENT(LB_LEVEL_INFO, LB_EVENT_RULES_PUBLISHED, ruleSet->generation, ruleSet->bytes);
+
+	return status;
+}
+
+NTSTATUS LbInjectionReplaceRules(const void* buffer, SIZE_T size)
+{
+	LB_RULESET* ruleSet = NULL;
+
+	// All parsing and table building happens here, before readers can see the new set
+	NTSTATUS status = LbRuleSetParse(buffer, size, &ruleSet);
+	if (!NT_SUCCESS(status))
+	{
+		LBPRINTLN("Rejected new rule set, STATUS CODE: 0x%08x", status);
+		if (status == STATUS_QUOTA_EXCEEDED)
+			LBEVENT(LB_LEVEL_WARNING, LB_EVENT_RULES_OVER_BUDGET, 0, LB_RULES_MAX_BYTES);
+		return status;
+	}
+
+	return LbInjectionInstallRules(ruleSet);
+}
+
+NTSTATUS LbInjectionReplaceRuleImage(const void* buffer, SIZE_T size)
+{
+	LB_RULESET* ruleSet = NULL;
+
+	// Only validation happens here, the tables were built in user mode
+	NTSTATUS status = LbRuleSetLoadImage(buffer, size, &ruleSet);
+	if (!NT_SUCCESS(status))
+	{
+		LBPRINTLN("Rejected rule image, STATUS CODE: 0x%08x", status);
+		if (status == STATUS_QUOTA_EXCEEDED)
+			LBEVENT(LB_LEVEL_WARNING, LB_EVENT_RULES_OVER_BUDGET, 0, LB_RULES_MAX_BYTES);
+		return status;
+	}
+
+	return LbInjectionInstallRules(ruleSet);
+}
+
+void LbInjectionCleanup()
+{
+	// Only called once the callout is gone, no reader can be left
+	LbRuleSetFree((LB_RULESET*)LbInterlockedExchangePointer(&lbRules.value, NULL));
+}
+
+////////////////////
+// PACKET CAPTURE //
+////////////////////
+
+// Capture rules every classify reads, NULL while nothing is captured. Replaced and freed like the rule set.
+static LB_CAPTURE_FILTER* volatile lbCaptureFilter = NULL;
+
+// Writer of the capture section. Created the first time rules are set or the section is mapped, both only
+// ever at PASSIVE_LEVEL under lbCaptureLock, and kept until the driver unloads.
+static LB_CAPTURE* lbCapture = NULL;
+static PMDL lbCaptureMdl = NULL;
+static void* lbCaptureSection = NULL;
+static SIZE_T lbCaptureSize = 0;
+static FAST_MUTEX lbCaptureLock;
+
+// The one mapping into user mode. owner is the file object that asked for it, it is taken back when that is cleaned up.
+static void* lbCaptureOwner = NULL;
+static PEPROCESS lbCaptureProcess = NULL;
+static void* lbCaptureUserAddress = NULL;
+
+void LbInjectionInitializeCapture()
+{
+	ExInitializeFastMutex(&lbCaptureLock);
+}
+
+// Allocate the section on first use, called with lbCaptureLock held
+static NTSTATUS LbCaptureSectionCreate()
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	PHYSICAL_ADDRESS lowest = { 0 };
+	PHYSICAL_ADDRESS highest;
+	PHYSICAL_ADDRESS skip = { 0 };
+	UINT32 ringCount = LbProcessorCount();
+	SIZE_T size = LbCaptureSectionSize(ringCount, LB_CAPTURE_RING_SIZE);
+	PMDL mdl = NULL;
+	void* section = NULL;
+
+	if (lbCapture)
+		return STATUS_SUCCESS;
+
+	// Whole pages of their own, so nothing but the section ends up in what user mode maps. They come zeroed.
+	highest.QuadPart = -1;
+	mdl = MmAllocatePagesForMdlEx(lowest, highest, skip, size, MmCached, MM_ALLOCATE_FULLY_REQUIRED);
+	if (!mdl)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	section = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+	if (!section)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	status = LbCaptureCreate(section, size, ringCount, LB_CAPTURE_RING_SIZE, &lbCapture);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	lbCaptureMdl = mdl;
+	lbCaptureSection = section;
+	lbCaptureSize = size;
+
+Exit:
+	if (!NT_SUCCESS(status))
+	{
+		if (section) MmUnmapLockedPages(section, mdl);
+		MmFreePagesFromMdl(mdl);
+		ExFreePool(mdl);
+	}
+
+	return status;
+}
+
+NTSTATUS LbInjectionReplaceCapture(const void* buffer, SIZE_T size)
+{
+	LB_CAPTURE_FILTER* filter = NULL;
+	LB_CAPTURE_FILTER* previous = NULL;
+
+	NTSTATUS status = LbCaptureFilterParse(buffer, size, &filter);
+	if (!NT_SUCCESS(status))
+	{
+		LBPRINTLN("Rejected capture rules, STATUS CODE: 0x%08x", status);
+		return status;
+	}
+
+	// The section has to exist before a classify can see rules that write to it
+	ExAcquireFastMutex(&lbCaptureLock);
+	if (filter)
+		status = LbCaptureSectionCreate();
+	if (NT_SUCCESS(status))
+		previous = (LB_CAPTURE_FILTER*)InterlockedExchangePointer((PVOID volatile*)&lbCaptureFilter, filter);
+	ExReleaseFastMutex(&lbCaptureLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		LbCaptureFilterFree(filter);
+		return status;
+	}
+
+	// Classify calls only read the rules at DISPATCH_LEVEL, the same barrier as for rule sets covers them
+	if (previous)
+	{
+		KeGenericCallDpc(LbRulesBarrierDpc, NULL);
+		LbCaptureFilterFree(previous);
+	}
+
+	return status;
+}
+
+NTSTATUS LbInjectionMapCapture(void* owner, LB_CAPTURE_MAPPING* mapping)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	void* address = NULL;
+
+	ExAcquireFastMutex(&lbCaptureLock);
+
+	if (lbCaptureOwner)
+	{
+		status = STATUS_DEVICE_BUSY;
+		goto Exit;
+	}
+
+	status = LbCaptureSectionCreate();
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	// Maps into whatever process this runs in, the control device calls this in the context of the one asking
+	__try
+	{
+		address = MmMapLockedPagesSpecifyCache(lbCaptureMdl, UserMode, MmCached, NULL, FALSE, NormalPagePriority | MdlMappingNoExecute);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		address = NULL;
+	}
+
+	if (!address)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	lbCaptureOwner = owner;
+	lbCaptureProcess = PsGetCurrentProcess();
+	ObReferenceObject(lbCaptureProcess);
+	lbCaptureUserAddress = address;
+
+	mapping->address = (UINT64)(ULONG_PTR)address;
+	mapping->size = lbCaptureSize;
+
+Exit:
+	ExReleaseFastMutex(&lbCaptureLock);
+	return status;
+}
+
+void LbInjectionUnmapCapture(void* owner)
+{
+	KAPC_STATE apcState;
+
+	ExAcquireFastMutex(&lbCaptureLock);
+
+	if (owner && owner == lbCaptureOwner)
+	{
+		// A handle can be closed from another process than the one it was mapped for
+		BOOLEAN attach = PsGetCurrentProcess() != lbCaptureProcess;
+
+		if (attach) KeStackAttachProcess(lbCaptureProcess, &apcState);
+		MmUnmapLockedPages(lbCaptureUserAddress, lbCaptureMdl);
+		if (attach) KeUnstackDetachProcess(&apcState);
+
+		ObDereferenceObject(lbCaptureProcess);
+		lbCaptureProcess = NULL;
+		lbCaptureUserAddress = NULL;
+		lbCaptureOwner = NULL;
+	}
+
+	ExReleaseFastMutex(&lbCaptureLock);
+}
+
+void LbInjectionCleanupCapture()
+{
+	// Only called once the callout is gone and every handle is closed, nothing writes or maps the section any more
+	LbCaptureFilterFree((LB_CAPTURE_FILTER*)InterlockedExchangePointer((PVOID volatile*)&lbCaptureFilter, NULL));
+	LbCaptureDestroy(lbCapture);
+	lbCapture = NULL;
+
+	if (lbCaptureMdl)
+	{
+		MmUnmapLockedPages(lbCaptureSection, lbCaptureMdl);
+		MmFreePagesFromMdl(lbCaptureMdl);
+		ExFreePool(lbCaptureMdl);
+		lbCaptureMdl = NULL;
+		lbCaptureSection = NULL;
+		lbCaptureSize = 0;
+	}
+}
+
+// Capture rules of this classify, the caller is at DISPATCH_LEVEL until it is done with them
+static inline const LB_CAPTURE_FILTER* LbCaptureCurrent()
+{
+	return (const LB_CAPTURE_FILTER*)ReadPointerAcquire((PVOID const volatile*)&lbCaptureFilter);
+}
+
+// Offer a packet of a flow to the capture. IPv6 flows pass their addresses, IPv4 ones are taken from the key.
+// The data is length bytes at data or, when data is NULL, each NET_BUFFER of netBufferList as a packet of its own.
+static void LbCaptureOffer(
+	const LB_CAPTURE_FILTER* filter,
+	const LB_FLOW_KEY* key,
+	const UINT8* localAddress6,
+	const UINT8* remoteAddress6,
+	LB_VERDICT verdict,
+	UINT8 flags,
+	const UINT8* data,
+	SIZE_T length,
+	NET_BUFFER_LIST* netBufferList)
+{
+	UINT8 localAddress[4];
+	UINT8 remoteAddress[4];
+	LB_CAPTURE_PACKET packet;
+	LB_CAPTURE_SLOT slot;
+
+	LbWriteBe32(localAddress, key->localAddress);
+	LbWriteBe32(remoteAddress, key->remoteAddress);
+
+	packet.localAddress = key->family == LB_FAMILY_IPV6 ? localAddress6 : localAddress;
+	packet.remoteAddress = key->family == LB_FAMILY_IPV6 ? remoteAddress6 : remoteAddress;
+	packet.localPort = key->localPort;
+	packet.remotePort = key->remotePort;
+	packet.family = key->family;
+	packet.protocol = key->protocol;
+	packet.direction = key->direction == LB_DIRECTION_OUTBOUND ? LB_RULE_DIRECTION_OUTBOUND : LB_RULE_DIRECTION_INBOUND;
+	packet.action = (UINT8)(verdict - LB_VERDICT_PERMIT);
+	packet.flags = flags;
+
+	if (data)
+	{
+		packet.length = (UINT32)length;
+		if (LbCaptureBegin(lbCapture, filter, &packet, &slot))
+		{
+			RtlCopyMemory(slot.data, data, slot.capacity);
+			LbCaptureEnd(lbCapture, &slot, slot.capacity);
+		}
+		return;
+	}
+
+	for (NET_BUFFER_LIST* currentNBL = netBufferList; currentNBL != NULL; currentNBL = NET_BUFFER_LIST_NEXT_NBL(currentNBL))
+	{
+		for (NET_BUFFER* currentNB = NET_BUFFER_LIST_FIRST_NB(currentNBL); currentNB != NULL; currentNB = NET_BUFFER_NEXT_NB(currentNB))
+		{
+			LB_SPAN_ITERATOR<MDL> it;
+			LB_SPAN span;
+			UINT32 copied = 0;
+
+			packet.length = NET_BUFFER_DATA_LENGTH(currentNB);
+			if (!LbCaptureBegin(lbCapture, filter, &packet, &slot))
+				continue;
+
+			// Only the front of the data is kept, the walk stops once the record is full
+			LbSpanBegin(&it, NET_BUFFER_CURRENT_MDL(currentNB), NET_BUFFER_CURRENT_MDL_OFFSET(currentNB), slot.capacity);
+			while (LbSpanNext(&it, &span))
+			{
+				RtlCopyMemory(slot.data + copied, span.data, span.length);
+				copied += (UINT32)span.length;
+			}
+
+			LbCaptureEnd(lbCapture, &slot, copied);
+		}
+	}
+}
+
+////////////////////////
+// INJECTION CALLBACK //
+////////////////////////
+
+void LbReplaceCallback(UINT8* packetData, SIZE_T length, void* value)
+{
+	// Cast user value void* to LB_SCAN_CONTEXT struct
+	LbScanBuffer((LB_SCAN_CONTEXT*)value, packetData, length);
+}
+
+void LbSegmentCallback(UINT32 sequence, SIZE_T length, void* value)
+{
+	LbScanSegment((LB_SCAN_CONTEXT*)value, sequence, length);
+}
+
+// The two bytes of a checksum field offset bytes into a NET_BUFFER, wherever the MDLs split them
+static BOOLEAN LbChecksumField(NET_BUFFER* netBuffer, ULONG offset, UINT8* field[2])
+{
+	LB_SPAN_ITERATOR<MDL> it;
+	LB_SPAN span;
+	UINT32 found = 0;
+
+	LbSpanBegin(&it, NET_BUFFER_CURRENT_MDL(netBuffer), (SIZE_T)NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer) + offset, 2);
+	while (LbSpanNext(&it, &span))
+	{
+		for (SIZE_T i = 0; i < span.length; i++)
+			field[found++] = &span.data[i];
+	}
+
+	return found == 2;
+}
+
+// Sum an IPv4 segment again once too much of it changed to patch its checksum. checksum is the value the
+// segment still carries, it is part of the sum and taken back out of it.
+static BOOLEAN LbChecksumRecompute(NET_BUFFER* netBuffer, const LB_FLOW_KEY* key, UINT16* checksum)
+{
+	LB_SPAN_ITERATOR<MDL> it;
+	LB_SPAN span;
+	ULONG length = NET_BUFFER_DATA_LENGTH(netBuffer);
+	SIZE_T offset = 0;
+	UINT32 sum = LbPseudoHeaderSumV4(key->localAddress, key->remoteAddress, key->protocol, length);
+
+	LbSpanBegin(&it, NET_BUFFER_CURRENT_MDL(netBuffer), NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer), length);
+	while (LbSpanNext(&it, &span))
+	{
+		sum = LbChecksumAddAt(sum, offset, span.data, span.length);
+		offset += span.length;
+	}
+
+	if (it.remaining != 0)
+		return FALSE;
+
+	*checksum = LbChecksumFinish(sum + (UINT16)~*checksum);
+	if (*checksum == 0 && key->protocol == IPPROTO_UDP)
+		*checksum = 0xFFFF;
+
+	return TRUE;
+}
+
+// Fix the checksum of a segment after its payload was rewritten in place
+void LbChecksumCallback(NET_BUFFER_LIST* netBufferList, NET_BUFFER* netBuffer, void* value)
+{
+	LB_SCAN_CONTEXT* scan = (LB_SCAN_CONTEXT*)value;
+	NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO offload;
+	ULONG offset = scan->key->protocol == IPPROTO_TCP ? 16 : 6;
+	UINT8* field[2];
+	UINT16 checksum;
+
+	if (scan->edits.count == 0)
+		return;
+
+	// The stack left the checksum to the adapter, which sums the segment as it goes out
+	offload.Value = NET_BUFFER_LIST_INFO(netBufferList, TcpIpChecksumNetBufferListInfo);
+	if (scan->key->protocol == IPPROTO_TCP ? offload.Transmit.TcpChecksum : offload.Transmit.UdpChecksum)
+		return;
+
+	if (!LbChecksumField(netBuffer, offset, field))
+		return;
+
+	checksum = (UINT16)((*field[0] << 8) | *field[1]);
+
+	LB_SCAN_CHECKSUM result = LbScanChecksum(scan, &checksum);
+	if (result == LB_SCAN_CHECKSUM_UNCHANGED)
+		return;
+	if (result == LB_SCAN_CHECKSUM_RECOMPUTE && !LbChecksumRecompute(netBuffer, scan->key, &checksum))
+		return;
+
+	*field[0] = (UINT8)(checksum >> 8);
+	*field[1] = (UINT8)checksum;
+}
+
+//////////////////////////////////
+// PACKET PARSING WITH CALLBACK //
+//////////////////////////////////
+
+typedef void(LbPacketParseCallback)(UINT8* packetData, SIZE_T length, void* value);
+typedef void(LbPacketSegmentCallback)(UINT32 sequence, SIZE_T length, void* value);
+typedef void(LbPacketFinishCallback)(NET_BUFFER_LIST* netBufferList, NET_BUFFER* netBuffer, void* value);
+
+// Length of the transport header at the start of a NET_BUFFER, 0 for protocols without one this driver knows,
+// and the TCP sequence number. Returns FALSE when the header is cut short or malformed.
+static BOOLEAN LbTransportHeader(NET_BUFFER* netBuffer, UINT8 protocol, ULONG* headerLength, UINT32* sequence)
+{
+	UINT8 storage[13];
+	UINT8* header;
+
+	*headerLength = 0;
+	*sequence = 0;
+
+	if (protocol == IPPROTO_UDP)
+		*headerLength = 8;
+	else if (protocol == IPPROTO_TCP)
+	{
+		// The data offset sits in byte 12, copied out only if the header spans MDLs
+		header = (UINT8*)NdisGetDataBuffer(netBuffer, sizeof(storage), storage, 1, 0);
+		if (!header)
+			return FALSE;
+
+		*headerLength = (header[12] >> 4) * 4;
+		if (*headerLength < 20)
+			return FALSE;
+
+		*sequence = LbReadBe32(&header[4]);
+	}
+
+	return *headerLength <= NET_BUFFER_DATA_LENGTH(netBuffer);
+}
+
+// Hands the payload of every NET_BUFFER in the batch to callbackFn, as exact spans of the mapped MDLs.
+// Each NB starts at its own CurrentMdl and CurrentMdlOffset and covers DataLength bytes minus the transport header.
+// segmentFn is told about every payload before its first span, finishFn about every segment after its last one.
+// Inbound layers hand out the payload alone, headerInData is FALSE for them and their sequence numbers read as 0.
+// Their segments have no header to finish, finishFn is only called when headerInData is TRUE.
+void ParsePacket(
+	NET_BUFFER_LIST* netBufferList,
+	UINT8 protocol,
+	BOOLEAN headerInData,
+	LbPacketSegmentCallback* segmentFn,
+	LbPacketParseCallback* callbackFn,
+	LbPacketFinishCallback* finishFn,
+	void* userdata)
+{
+	// loop through all NBL's
+	for (NET_BUFFER_LIST* currentNBL = netBufferList; currentNBL != NULL; currentNBL = NET_BUFFER_LIST_NEXT_NBL(currentNBL))
+	{
+		// loop through all NB's per NBL
+		for (NET_BUFFER* currentNB = NET_BUFFER_LIST_FIRST_NB(currentNBL); currentNB != NULL; currentNB = NET_BUFFER_NEXT_NB(currentNB))
+		{
+			LB_SPAN_ITERATOR<MDL> it;
+			LB_SPAN span;
+			ULONG headerLength;
+			UINT32 sequence;
+
+			if (!headerInData)
+			{
+				headerLength = 0;
+				sequence = 0;
+			}
+			else if (!LbTransportHeader(currentNB, protocol, &headerLength, &sequence))
+				continue;
+
+			segmentFn(sequence, NET_BUFFER_DATA_LENGTH(currentNB) - headerLength, userdata);
+
+			// loop through all spans per NB, a payload in a single MDL is one span
+			LbSpanBegin(&it, NET_BUFFER_CURRENT_MDL(currentNB), (SIZE_T)NET_BUFFER_CURRENT_MDL_OFFSET(currentNB) + headerLength,
+				NET_BUFFER_DATA_LENGTH(currentNB) - headerLength);
+			while (LbSpanNext(&it, &span))
+				callbackFn(span.data, span.length, userdata);
+
+			if (headerInData)
+				finishFn(currentNBL, currentNB, userdata);
+		}
+	}
+}
+
+/////////////////////////////
+// LENGTH CHANGING REWRITE //
+/////////////////////////////
+
+// Builds a rewritten copy of an outgoing TCP or UDP segment, ready to be injected in place of the original.
+// seq is the flow's offset tracker and may only be NULL for UDP. Returns NULL when the original should be
+// permitted as it is, because nothing changed or because the packet cannot be rewritten.
+static LB_INJECT_PACKET* LbRewriteSegment(NET_BUFFER_LIST* netBufferList, const LB_FLOW_KEY* key, LB_SEQ_TRACKER* seq, LB_SCAN_CONTEXT* scan)
+{
+	NET_BUFFER* netBuffer = NET_BUFFER_LIST_FIRST_NB(netBufferList);
+	LB_INJECT_PACKET* scratch = NULL;
+	LB_INJECT_PACKET* packet = NULL;
+	UINT8* segment = NULL;
+	ULONG length = NET_BUFFER_DATA_LENGTH(netBuffer);
+
+	// Every rewritten segment replaces exactly one original, batches are left alone
+	if (NET_BUFFER_LIST_NEXT_NBL(netBufferList) != NULL || NET_BUFFER_NEXT_NB(netBuffer) != NULL)
+		return NULL;
+	if (length > LB_INJECT_MAX_SEGMENT)
+		return NULL;
+
+	// Most segments sit in one MDL and are read where they are, the rest are gathered into a scratch buffer
+	segment = (UINT8*)NdisGetDataBuffer(netBuffer, length, NULL, 1, 0);
+	if (!segment)
+	{
+		scratch = LbInjectorAllocatePacket();
+		if (!scratch)
+			return NULL;
+		segment = (UINT8*)NdisGetDataBuffer(netBuffer, length, scratch->data, 1, 0);
+		if (!segment)
+			goto Exit;
+	}
+
+	packet = LbInjectorAllocatePacket();
+	if (!packet)
+		goto Exit;
+
+	if (!LbRewriteTransport(key, seq, scan, segment, length, packet->data, LB_INJECT_MAX_SEGMENT, &packet->length))
+		goto Exit;
+
+	if (scratch) LbInjectorFreePacket(scratch);
+	return packet;
+
+Exit:
+	if (scratch) LbInjectorFreePacket(scratch);
+	if (packet) LbInjectorFreePacket(packet);
+
+	return NULL;
+}
+
+////////////////////////
+// PAYLOAD INSPECTION //
+////////////////////////
+
+// Runs the match engine over a segment, called with the flow's lock held. Equal length pairs are
+// rewritten in place without copying, unless an earlier size change already shifted this flow, and the
+// checksum of an outgoing segment is fixed up for them unless the adapter computes it. Size changes
+// need a copy, which only canCopy allows, and return the rewritten segment to send instead of the original.
+// headerInData is the layer's LB_LAYER_TRAITS::headerInData, a copy is only ever made of a whole segment.
+static LB_INJECT_PACKET* LbInspectPayload(
+	const LB_RULESET* rules,
+	LB_FLOW_CONTEXT* flow,
+	const LB_FLOW_KEY* key,
+	NET_BUFFER_LIST* netBufferList,
+	BOOLEAN headerInData,
+	BOOLEAN canCopy,
+	LB_SCAN_CONTEXT* scan)
+{
+	LB_INJECT_PACKET* packet = NULL;
+
+	// A saved position is meaningless once the rule set it belongs to has been replaced
+	if (flow && flow->matchGeneration == rules->generation)
+		scan->state = flow->matchState;
+
+	// Rule sets that target fields only hand those to the match engine
+	scan->fields = rules->fields;
+	scan->key = key;
+	scan->stream = flow ? &flow->dissector : NULL;
+
+	BOOLEAN shifted = flow && LbSeqTrackerIsActive(&flow->seq);
+
+	if ((rules->matcher->equalLength && !shifted) || !canCopy)
+		ParsePacket(netBufferList, key->protocol, headerInData, LbSegmentCallback, LbReplaceCallback, LbChecksumCallback, scan);
+	else
+		packet = LbRewriteSegment(netBufferList, key, flow ? &flow->seq : NULL, scan);
+
+	if (flow)
+	{
+		flow->matchState = scan->state;
+		flow->matchGeneration = rules->generation;
+	}
+
+	return packet;
+}
+
+/////////////////////////////
+// ASYNCHRONOUS INSPECTION //
+/////////////////////////////
+
+// Segments one worker's lane holds before the callout stops handing it more
+#define LB_INSPECT_QUEUE_CAPACITY 1024
+
+// Most segments a worker inspects per batch, the rule set is acquired once for all of them
+#define LB_INSPECT_BATCH 32
+
+// An absorbed outbound segment waiting for its worker
+struct LB_DEFERRED_SEGMENT
+{
+	LB_WORK_ITEM work;				// Entry in the lane of the segment's flow
+	NET_BUFFER_LIST* original;		// Referenced until whatever replaces it is sent
+	LB_FLOW_CONTEXT* flow;			// Referenced as well, NULL when the flow has no context
+	LB_FLOW_KEY key;
+	LB_INJECT_TARGET target;
+	LB_INJECT_PACKET* packet;		// Rewritten copy sent instead of the original, NULL sends a clone of the original
+};
+
+// One worker per processor and pinned to it, it drains the lane of the same number
+struct LB_INSPECT_WORKER
+{
+	KEVENT wake;
+	HANDLE thread;
+	UINT32 lane;
+};
+
+static LB_WORK_QUEUE* lbInspectQueue = NULL;
+static LB_INSPECT_WORKER* lbInspectWorkers = NULL;
+static UINT32 lbInspectWorkerCount = 0;
+static LB_SLAB* lbDeferredSlab = NULL;
+
+// Set once the workers are asked to exit, the segments still being sent are awaited through lbInspectIdle
+static volatile LONG lbInspectStopping = 0;
+static volatile LONG lbDeferredOutstanding = 0;
+static KEVENT lbInspectIdle;
+
+// Anything that tells flows apart works, the lane mixes it well enough
+static inline UINT64 LbFlowId(const LB_FLOW_KEY* key)
+{
+	return (((UINT64)key->localAddress << 32) | key->remoteAddress) ^
+		(((UINT64)key->localPort << 16) | key->remotePort) ^ ((UINT64)key->protocol << 40);
+}
+
+static void LbDeferredFree(LB_DEFERRED_SEGMENT* deferred, BOOLEAN dispatchLevel)
+{
+	if (deferred->packet) LbInjectorFreePacket(deferred->packet);
+
+	FwpsDereferenceNetBufferList(deferred->original, dispatchLevel);
+	LbInjectorReleaseTarget(&deferred->target);
+	LbFlowContextRelease(deferred->flow);
+	LbSlabFree(lbDeferredSlab, deferred);
+
+	if (InterlockedDecrement(&lbDeferredOutstanding) == 0 && LbReadAcquire(&lbInspectStopping))
+		KeSetEvent(&lbInspectIdle, IO_NO_INCREMENT, FALSE);
+}
+
+static void LbDeferredSendComplete(void* context, NET_BUFFER_LIST* netBufferList, BOOLEAN dispatchLevel)
+{
+	LB_DEFERRED_SEGMENT* deferred = (LB_DEFERRED_SEGMENT*)context;
+
+	if (!NT_SUCCESS(netBufferList->Status)) LBEVENT(LB_LEVEL_WARNING, LB_EVENT_INJECT_COMPLETED, (UINT32)netBufferList->Status);
+
+	// A rewritten copy's list goes away with its packet, a clone of the original is freed here
+	if (!deferred->packet)
+		FwpsFreeCloneNetBufferList(netBufferList, 0);
+
+	LbDeferredFree(deferred, dispatchLevel);
+}
+
+// Queue a segment for the worker of its flow, called with the flow's lock held. The caller absorbs the
+// segment when this succeeds. Returns FALSE when it could not be queued.
+static BOOLEAN LbInspectDefer(
+	NET_BUFFER_LIST* netBufferList,
+	const LB_FLOW_KEY* key,
+	LB_FLOW_CONTEXT* flow,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	LB_STATS_PROCESSOR* stats)
+{
+	LB_DEFERRED_SEGMENT* deferred = NULL;
+	BOOLEAN wake = FALSE;
+	UINT32 lane = 0;
+
+	if (!lbInspectQueue)
+		return FALSE;
+
+	deferred = (LB_DEFERRED_SEGMENT*)LbSlabAlloc(lbDeferredSlab);
+	if (!deferred)
+		return FALSE;
+
+	// The endpoint and control data of the classify are only valid until it returns
+	if (!NT_SUCCESS(LbInjectorCaptureTarget(key->remoteAddress, inMetaValues, &deferred->target)))
+	{
+		LbInjectorReleaseTarget(&deferred->target);
+		LbSlabFree(lbDeferredSlab, deferred);
+		return FALSE;
+	}
+
+	deferred->original = netBufferList;
+	deferred->flow = flow;
+	deferred->key = *key;
+	deferred->packet = NULL;
+
+	// Everything the worker frees has to be held before it can see the segment
+	FwpsReferenceNetBufferList(netBufferList, TRUE);
+	if (flow) LbFlowContextReference(flow);
+	InterlockedIncrement(&lbDeferredOutstanding);
+
+	lane = LbWorkQueueLane(lbInspectQueue, LbFlowId(key));
+	if (!LbWorkQueuePush(lbInspectQueue, lane, &deferred->work, &wake))
+	{
+		LbStatsCount(stats, LB_COUNTER_QUEUE_FULL);
+		LbDeferredFree(deferred, TRUE);
+		return FALSE;
+	}
+
+	if (wake)
+		KeSetEvent(&lbInspectWorkers[lane].wake, IO_NO_INCREMENT, FALSE);
+
+	return TRUE;
+}
+
+// Inspect one absorbed segment and send it, or what replaces it, on its way
+static void LbInspectDeferred(const LB_RULESET* rules, LB_DEFERRED_SEGMENT* deferred, LB_STATS_PROCESSOR* stats)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_FLOW_CONTEXT* flow = deferred->flow;
+	LB_FLOW_KEY key = deferred->key;
+	LB_SCAN_CONTEXT scan = { rules->matcher, rules->replace, LB_MATCHER_ROOT_STATE, 0, 0, FALSE, 0 };
+	NET_BUFFER_LIST* send = NULL;
+	NET_BUFFER_LIST* clone = NULL;
+	ULONG length = 0;
+
+	// The original is absorbed already, so a copy can always take its place. TCP still needs the flow's offsets.
+	BOOLEAN canCopy = key.protocol == IPPROTO_UDP || (key.protocol == IPPROTO_TCP && flow);
+
+	if (flow)
+		KeAcquireSpinLockAtDpcLevel(&flow->lock);
+
+	deferred->packet = LbInspectPayload(rules, flow, &key, deferred->original, TRUE, canCopy, &scan);
+
+	if (flow)
+		KeReleaseSpinLockFromDpcLevel(&flow->lock);
+
+	// The flow is only needed until the segment is on its way, the worker lets go of it below
+	deferred->flow = NULL;
+
+	LBEVENT(LB_LEVEL_TRACE, LB_EVENT_PACKET_INSPECTED, key.remoteAddress, key.remotePort, key.protocol, scan.replacements);
+	LbStatsCount(stats, LB_COUNTER_BYTES_SCANNED, scan.bytes);
+	LbStatsCount(stats, LB_COUNTER_BYTES_SKIPPED, scan.skipped);
+	LbStatsCount(stats, LB_COUNTER_REPLACEMENTS, scan.replacements);
+
+	// Captured as it is sent, the copy when there is one and otherwise the original rewritten in place
+	const LB_CAPTURE_FILTER* captureFilter = LbCaptureCurrent();
+	if (captureFilter)
+	{
+		UINT8 captureFlags = LB_CAPTURE_FLAG_HEADER | LB_CAPTURE_FLAG_QUEUED | (scan.replacements > 0 ? LB_CAPTURE_FLAG_REWRITTEN : 0);
+
+		if (deferred->packet)
+			LbCaptureOffer(captureFilter, &key, NULL, NULL, LB_VERDICT_INSPECT, captureFlags, deferred->packet->data, deferred->packet->length, NULL);
+		else
+			LbCaptureOffer(captureFilter, &key, NULL, NULL, LB_VERDICT_INSPECT, captureFlags, NULL, 0, deferred->original);
+	}
+
+	if (deferred->packet)
+	{
+		length = deferred->packet->length;
+		status = LbInjectorWrapPacket(deferred->packet);
+		send = deferred->packet->netBufferList;
+	}
+	else
+	{
+		// Nothing changed size, the original goes out with whatever was replaced in place
+		status = FwpsAllocateCloneNetBufferList(deferred->original, NULL, NULL, 0, &clone);
+		send = clone;
+	}
+
+	// The completion routine may free the segment as soon as the send is started
+	if (NT_SUCCESS(status))
+		status = LbInjectorSendTargetV4(send, &deferred->target, LbDeferredSendComplete, deferred);
+
+	if (!NT_SUCCESS(status))
+	{
+		// The segment is lost, TCP resends it and the retransmission is rewritten the same way
+		if (clone) FwpsFreeCloneNetBufferList(clone, 0);
+		LbDeferredFree(deferred, TRUE);
+	}
+	else if (length > 0)
+	{
+		LbStatsCount(stats, LB_COUNTER_INJECTED);
+		LBEVENT(LB_LEVEL_TRACE, LB_EVENT_SEGMENT_INJECTED, key.remoteAddress, key.remotePort, length);
+	}
+
+	// Later segments of the flow may only stop queueing once this one is sent
+	if (flow)
+	{
+		KeAcquireSpinLockAtDpcLevel(&flow->lock);
+		flow->deferred--;
+		KeReleaseSpinLockFromDpcLevel(&flow->lock);
+
+		LbFlowContextRelease(flow);
+	}
+}
+
+// Inspect a batch of segments from one lane, oldest first
+static void LbInspectBatch(LB_WORK_ITEM** items, UINT32 count)
+{
+	// Workers only run while a rule set is published, raising once covers the whole batch
+	KIRQL rulesIrql;
+	const LB_RULESET* rules = LbRulesAcquire(&rulesIrql);
+	LB_STATS_PROCESSOR* stats = LbStatsCurrent();
+	UINT64 cyclesPerSecond = stats ? LbStatsCyclesPerSecond() : 0;
+	UINT64 now = LbTimestamp();
+
+	LbStatsCount(stats, LB_COUNTER_BATCHES);
+
+	for (UINT32 i = 0; i < count; i++)
+	{
+		LB_DEFERRED_SEGMENT* deferred = CONTAINING_RECORD(items[i], LB_DEFERRED_SEGMENT, work);
+
+		// The next segment's bookkeeping is pulled in while this one is matched
+		if (i + 1 < count)
+			LbPrefetch(CONTAINING_RECORD(items[i + 1], LB_DEFERRED_SEGMENT, work));
+
+		if (stats)
+			LbStatsRecord(stats, LB_STAGE_QUEUE, LbStatsTicksToCycles(now - deferred->work.queued, cyclesPerSecond));
+
+		LbInspectDeferred(rules, deferred, stats);
+	}
+
+	LbRulesRelease(rulesIrql);
+}
+
+static void LbInspectWorkerRoutine(PVOID context)
+{
+	LB_INSPECT_WORKER* worker = (LB_INSPECT_WORKER*)context;
+	LB_WORK_ITEM* items[LB_INSPECT_BATCH];
+	PROCESSOR_NUMBER number = { 0 };
+	GROUP_AFFINITY affinity = { 0 };
+	GROUP_AFFINITY previous = { 0 };
+
+	// Every worker stays on its own processor, a burst spread over many flows is inspected by all of them at once
+	if (NT_SUCCESS(KeGetProcessorNumberFromIndex(worker->lane, &number)))
+	{
+		affinity.Group = number.Group;
+		affinity.Mask = (KAFFINITY)1 << number.Number;
+		KeSetSystemGroupAffinityThread(&affinity, &previous);
+	}
+
+	for (;;)
+	{
+		UINT32 count = LbWorkQueuePop(lbInspectQueue, worker->lane, items, LB_INSPECT_BATCH);
+		if (count > 0)
+		{
+			LbInspectBatch(items, count);
+			continue;
+		}
+
+		// Only exits with its lane empty, nothing is pushed any more once stopping is set
+		if (LbReadAcquire(&lbInspectStopping))
+			break;
+
+		KeWaitForSingleObject(&worker->wake, Executive, KernelMode, FALSE, NULL);
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS LbInjectionStartWorkers()
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	OBJECT_ATTRIBUTES attributes;
+	UINT32 count = LbProcessorCount();
+
+	lbInspectStopping = 0;
+	lbDeferredOutstanding = 0;
+	KeInitializeEvent(&lbInspectIdle, NotificationEvent, FALSE);
+
+	status = LbWorkQueueCreate(count, LB_INSPECT_QUEUE_CAPACITY, 'LBQ0', &lbInspectQueue);
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = LbSlabCreate(sizeof(LB_DEFERRED_SEGMENT), 32, 'LBQ1', &lbDeferredSlab);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	lbInspectWorkers = (LB_INSPECT_WORKER*)LbAlloc(sizeof(LB_INSPECT_WORKER) * count, 'LBQ2');
+	if (!lbInspectWorkers)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+	for (UINT32 i = 0; i < count; i++)
+	{
+		LB_INSPECT_WORKER* worker = &lbInspectWorkers[i];
+
+		KeInitializeEvent(&worker->wake, SynchronizationEvent, FALSE);
+		worker->lane = i;
+
+		status = PsCreateSystemThread(&worker->thread, THREAD_ALL_ACCESS, &attributes, NULL, NULL, LbInspectWorkerRoutine, worker);
+		if (!NT_SUCCESS(status)) goto Exit;
 
-	// loop through all NBL's
-	while (currentNBL != NULL)
+		lbInspectWorkerCount++;
+	}
+
+Exit:
+	if (!NT_SUCCESS(status))
 	{
-		// loop through all NB's per NBL
-		while (currentNB != NULL)
-		{
-			// loop through all MDL's per NB
-			while (currentMDL != NULL)
-			{
-				// Allocate buffer to get data stored in current MDL
-				buffer = (PCHAR)MmGetSystemAddressForMdlSafe(currentMDL, NormalPagePriority | MdlMappingNoExecute);
+		LBPRINTLN("Failed to start inspection workers, STATUS CODE: 0x%08x", status);
+		LbInjectionStopWorkers();
+	}
 
-				LBPRINTLN("COUNT: %d | OFFSET: %d", currentMDL->ByteCount, currentMDL->ByteOffset);
+	return status;
+}
 
-				// if null buffer, skip
-				if (!buffer)
-				{
-					LBPRINT_NO_INFO("EMPTY BUFFER\n");
-				}
-				else
-				{
-					for (int i = 0; i < (int)currentMDL->ByteCount; i++)
-					{
-						char val = buffer[i];
-
-						// print bytes as hex
-						LBPRINT_NO_INFO("0x%X ", val);
-						// print bytes as char
-						//LBPRINT_NO_INFO("%c ", val);
-					}
-				}
+void LbInjectionStopWorkers()
+{
+	// The callout is gone, nothing is queued any more and every worker empties its lane before it exits
+	InterlockedExchange(&lbInspectStopping, 1);
 
-				// new line for new MDL
-				LBPRINT_NO_INFO("\n");
+	for (UINT32 i = 0; i < lbInspectWorkerCount; i++)
+		KeSetEvent(&lbInspectWorkers[i].wake, IO_NO_INCREMENT, FALSE);
 
-				// Next list element
-				currentMDL = currentMDL->Next;
-			}
+	for (UINT32 i = 0; i < lbInspectWorkerCount; i++)
+	{
+		ZwWaitForSingleObject(lbInspectWorkers[i].thread, FALSE, NULL);
+		ZwClose(lbInspectWorkers[i].thread);
+	}
+	lbInspectWorkerCount = 0;
 
-			// Next list element
-			currentNB = currentNB->Next;
-		}
+	// Segments the workers sent are only freed once their send completes
+	if (LbReadAcquire(&lbDeferredOutstanding) != 0)
+		KeWaitForSingleObject(&lbInspectIdle, Executive, KernelMode, FALSE, NULL);
 
-		// Next list element
-		currentNBL = NET_BUFFER_LIST_NEXT_NBL(currentNBL);
+	if (lbInspectWorkers)
+	{
+		LbFree(lbInspectWorkers, 'LBQ2');
+		lbInspectWorkers = NULL;
 	}
+
+	LbSlabDestroy(lbDeferredSlab);
+	lbDeferredSlab = NULL;
+	LbWorkQueueDestroy(lbInspectQueue);
+	lbInspectQueue = NULL;
 }
 
-/////////////////////////////
-// CUSTOM USERDATA STRUCTS //
-/////////////////////////////
+////////////////////////////
+// TRANSPORT LAYER TRAITS //
+////////////////////////////
 
-struct LB_MATCH_AND_REPLACE
+// The WFP side of a layer the callouts run at: its ID, its callout and where its fields sit in the incoming values
+template <UINT16 LayerId>
+struct LB_WFP_LAYER;
+
+template <>
+struct LB_WFP_LAYER<FWPS_LAYER_OUTBOUND_TRANSPORT_V4> : LB_LAYER_OUTBOUND_V4
 {
-	char* match;
-	char* replace;
+	static const UINT16 layerId = FWPS_LAYER_OUTBOUND_TRANSPORT_V4;
+	static const LB_CALLOUT_LAYER callout = LB_CALLOUT_OUTBOUND_V4;
+	static const UINT32 localAddress = FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_LOCAL_ADDRESS;
+	static const UINT32 remoteAddress = FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_REMOTE_ADDRESS;
+	static const UINT32 localPort = FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_LOCAL_PORT;
+	static const UINT32 remotePort = FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_REMOTE_PORT;
+	static const UINT32 protocol = FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_PROTOCOL;
 };
 
-struct LB_USERDATA
+template <>
+struct LB_WFP_LAYER<FWPS_LAYER_OUTBOUND_TRANSPORT_V6> : LB_LAYER_OUTBOUND_V6
 {
-	int count;
-	bool enableReversal = false;
-	LB_MATCH_AND_REPLACE* strArray;
+	static const UINT16 layerId = FWPS_LAYER_OUTBOUND_TRANSPORT_V6;
+	static const LB_CALLOUT_LAYER callout = LB_CALLOUT_OUTBOUND_V6;
+	static const UINT32 localAddress = FWPS_FIELD_OUTBOUND_TRANSPORT_V6_IP_LOCAL_ADDRESS;
+	static const UINT32 remoteAddress = FWPS_FIELD_OUTBOUND_TRANSPORT_V6_IP_REMOTE_ADDRESS;
+	static const UINT32 localPort = FWPS_FIELD_OUTBOUND_TRANSPORT_V6_IP_LOCAL_PORT;
+	static const UINT32 remotePort = FWPS_FIELD_OUTBOUND_TRANSPORT_V6_IP_REMOTE_PORT;
+	static const UINT32 protocol = FWPS_FIELD_OUTBOUND_TRANSPORT_V6_IP_PROTOCOL;
 };
 
-////////////////////////
-// INJECTION CALLBACK //
-////////////////////////
+template <>
+struct LB_WFP_LAYER<FWPS_LAYER_INBOUND_TRANSPORT_V4> : LB_LAYER_INBOUND_V4
+{
+	static const UINT16 layerId = FWPS_LAYER_INBOUND_TRANSPORT_V4;
+	static const LB_CALLOUT_LAYER callout = LB_CALLOUT_INBOUND_V4;
+	static const UINT32 localAddress = FWPS_FIELD_INBOUND_TRANSPORT_V4_IP_LOCAL_ADDRESS;
+	static const UINT32 remoteAddress = FWPS_FIELD_INBOUND_TRANSPORT_V4_IP_REMOTE_ADDRESS;
+	static const UINT32 localPort = FWPS_FIELD_INBOUND_TRANSPORT_V4_IP_LOCAL_PORT;
+	static const UINT32 remotePort = FWPS_FIELD_INBOUND_TRANSPORT_V4_IP_REMOTE_PORT;
+	static const UINT32 protocol = FWPS_FIELD_INBOUND_TRANSPORT_V4_IP_PROTOCOL;
+};
+
+template <>
+struct LB_WFP_LAYER<FWPS_LAYER_INBOUND_TRANSPORT_V6> : LB_LAYER_INBOUND_V6
+{
+	static const UINT16 layerId = FWPS_LAYER_INBOUND_TRANSPORT_V6;
+	static const LB_CALLOUT_LAYER callout = LB_CALLOUT_INBOUND_V6;
+	static const UINT32 localAddress = FWPS_FIELD_INBOUND_TRANSPORT_V6_IP_LOCAL_ADDRESS;
+	static const UINT32 remoteAddress = FWPS_FIELD_INBOUND_TRANSPORT_V6_IP_REMOTE_ADDRESS;
+	static const UINT32 localPort = FWPS_FIELD_INBOUND_TRANSPORT_V6_IP_LOCAL_PORT;
+	static const UINT32 remotePort = FWPS_FIELD_INBOUND_TRANSPORT_V6_IP_REMOTE_PORT;
+	static const UINT32 protocol = FWPS_FIELD_INBOUND_TRANSPORT_V6_IP_PROTOCOL;
+};
+
+// The stream layers only carry TCP and have no protocol field
+template <>
+struct LB_WFP_LAYER<FWPS_LAYER_STREAM_V4> : LB_LAYER_OUTBOUND_V4
+{
+	static const UINT16 layerId = FWPS_LAYER_STREAM_V4;
+	static const LB_CALLOUT_LAYER callout = LB_CALLOUT_STREAM_V4;
+	static const UINT32 localAddress = FWPS_FIELD_STREAM_V4_IP_LOCAL_ADDRESS;
+	static const UINT32 remoteAddress = FWPS_FIELD_STREAM_V4_IP_REMOTE_ADDRESS;
+	static const UINT32 localPort = FWPS_FIELD_STREAM_V4_IP_LOCAL_PORT;
+	static const UINT32 remotePort = FWPS_FIELD_STREAM_V4_IP_REMOTE_PORT;
+};
+
+template <>
+struct LB_WFP_LAYER<FWPS_LAYER_STREAM_V6> : LB_LAYER_OUTBOUND_V6
+{
+	static const UINT16 layerId = FWPS_LAYER_STREAM_V6;
+	static const LB_CALLOUT_LAYER callout = LB_CALLOUT_STREAM_V6;
+	static const UINT32 localAddress = FWPS_FIELD_STREAM_V6_IP_LOCAL_ADDRESS;
+	static const UINT32 remoteAddress = FWPS_FIELD_STREAM_V6_IP_REMOTE_ADDRESS;
+	static const UINT32 localPort = FWPS_FIELD_STREAM_V6_IP_LOCAL_PORT;
+	static const UINT32 remotePort = FWPS_FIELD_STREAM_V6_IP_REMOTE_PORT;
+};
 
-void LbReplaceCallback(char* packetStr, void* value)
+// An IPv4 address field holds the address in host byte order, an IPv6 one points to 16 bytes in network byte order
+template <LB_ADDRESS_FAMILY Family>
+static inline UINT32 LbLayerAddress(const FWP_VALUE0* value)
 {
-	// Cast user value void* to LB_USERDATA struct
-	LB_USERDATA* ud = (LB_USERDATA*)value;
+	return value->uint32;
+}
 
-	// Result memory pool
-	char* result = (char*)ExAllocatePool2(POOL_FLAG_NON_PAGED, 255, 'LBP1');
+template <>
+inline UINT32 LbLayerAddress<LB_FAMILY_IPV6>(const FWP_VALUE0* value)
+{
+	return LbFlowAddressFold(value->byteArray16->byteArray16);
+}
 
-	// "Zero Out" the new memory
-	for (int i = 0; i < 255; i++)
-		result[i] = '\0';
+// The 16 bytes of an IPv6 address field for the capture, IPv4 ones are rebuilt from the flow key instead
+template <LB_ADDRESS_FAMILY Family>
+static inline const UINT8* LbLayerAddressBytes(const FWP_VALUE0* value)
+{
+	UNREFERENCED_PARAMETER(value);
+	return NULL;
+}
 
-	// Save the original position of the result pointer
-	char* resOrigin = result;
+template <>
+inline const UINT8* LbLayerAddressBytes<LB_FAMILY_IPV6>(const FWP_VALUE0* value)
+{
+	return value->byteArray16->byteArray16;
+}
 
-	// Loop through all characters in packetStr
-	for (int i = 0, offset = 0; i < strnlen(packetStr, 255); i++, offset++)
-	{
-		// Place current char into result
-		result[offset] = packetStr[i];
+/////////////////////////////////
+// ACKNOWLEDGEMENT TRANSLATION //
+/////////////////////////////////
 
-		// Check result against 'match' and 'replace' strings to see if replacement must be done
-		for (int k = 0; k < ud->count; k++)
-		{
-			// Initialize match and replace vars with info from LB_USERDATA struct
-			char* match = ud->strArray[k].match;
-			char* replace = ud->strArray[k].replace;
+// Translates an incoming acknowledgement of a flow whose outgoing segments changed size. Returns TRUE when
+// a translated copy was injected, the caller then absorbs the original.
+static BOOLEAN LbTranslateAck(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	NET_BUFFER_LIST* buff,
+	UINT64 flowContext,
+	const FWPS_CLASSIFY_OUT* classifyOut)
+{
+	// Only TCP flows with a context from an outbound classify get one here
+	LB_FLOW_CONTEXT* flow = (LB_FLOW_CONTEXT*)flowContext;
+	NET_BUFFER_LIST* clone = NULL;
+	UINT8* headers = NULL;
+	BOOLEAN shifted = FALSE;
+	KIRQL irql;
 
-			// Check if current string contains 'match'
-			char* loc = strstr(result, match);
+	if (flow == NULL || buff == NULL || !(classifyOut->rights & FWPS_RIGHT_ACTION_WRITE))
+		return FALSE;
+	if (NET_BUFFER_LIST_NEXT_NBL(buff) != NULL || NET_BUFFER_NEXT_NB(NET_BUFFER_LIST_FIRST_NB(buff)) != NULL)
+		return FALSE;
 
-			if (loc)
-			{
-				// If successful, swap with the 'replace' str
-				strcpy(loc, replace);
-				// Increment result pointer by distance offset and reset the offset
-				result += offset;
-				offset = 0;
-				// Break out of inner loop on success
-				break;
-			}
-			else if (!loc)
-			{
-				// If no result containing 'match' was found, try the inverse 
-				loc = strstr(result, replace);
+	// Nothing to translate until an outgoing segment changed size
+	KeAcquireSpinLock(&flow->lock, &irql);
+	shifted = LbSeqTrackerIsActive(&flow->seq);
+	KeReleaseSpinLock(&flow->lock, irql);
+	if (!shifted)
+		return FALSE;
 
-				if (loc)
-				{
-					// If successful then replace with 'match' string
-					strcpy(loc, match);
-					// Increment result pointer by distance offset and reset the offset
-					result += offset;
-					offset = 0;
-					// Break out of inner loop on success
-					break;
-				}
-			}
-		}
+	if (!NT_SUCCESS(LbInjectorCloneInbound(buff, inMetaValues, &clone, &headers)))
+		return FALSE;
+
+	UINT8* tcp = headers + inMetaValues->ipHeaderSize;
+	if (inMetaValues->transportHeaderSize < 20 || !(tcp[13] & 0x10))	// ACK flag
+	{
+		FwpsFreeCloneNetBufferList(clone, 0);
+		return FALSE;
 	}
 
-	// DBG print packetStr before copy
-	LBPRINTLN("BEFORE COPY:\t%s", packetStr);
+	UINT32 ack = LbReadBe32(&tcp[8]);
+	KeAcquireSpinLock(&flow->lock, &irql);
+	UINT32 mapped = LbSeqTrackerMapAck(&flow->seq, ack);
+	KeReleaseSpinLock(&flow->lock, irql);
 
-	// Copy result to packetStr
-	strcpy(packetStr, resOrigin);
-	
-	// DBG print packetStr after copy
-	LBPRINTLN("AFTER COPY:\t%s", packetStr);
+	if (mapped == ack)
+	{
+		FwpsFreeCloneNetBufferList(clone, 0);
+		return FALSE;
+	}
 
-	// Free pooled memory in result
-	ExFreePool2(resOrigin, 'LBP1', NULL, NULL);
-}
+	// Only the acknowledgement number moves, so the checksum is patched instead of recomputed
+	LbWriteBe32(&tcp[8], mapped);
+	LbWriteBe16(&tcp[16], LbChecksumUpdate32(LbReadBe16(&tcp[16]), ack, mapped));
 
-//////////////////////////////////
-// PACKET PARSING WITH CALLBACK //
-//////////////////////////////////
+	// A failed injection only loses an ACK, the server sends another one
+	LbInjectorReceiveTransportV4(clone, inFixedValues, inMetaValues);
+	LBEVENT(LB_LEVEL_TRACE, LB_EVENT_ACK_TRANSLATED, ack, mapped);
+	LbStatsCount(LbStatsCurrent(), LB_COUNTER_ACKS_TRANSLATED);
 
-typedef void(LbPacketParseCallback)(char* packetStr, void* value);
+	return TRUE;
+}
+
+/////////////////////////////////
+// INJECTION CLASSIFY FUNCTION //
+/////////////////////////////////
 
-void ParsePacket(NET_BUFFER_LIST* netBufferList, LbPacketParseCallback* callbackFn, void* userdata)
+// Shared by the classify functions of every layer. Layer is an LB_WFP_LAYER, each one gets its own copy
+// of this function with every decision about the layer made at compile time.
+template <class Layer>
+static void LbClassifyLayer(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut)
 {
-	// initial vars
-	NET_BUFFER_LIST* currentNBL = netBufferList;
-	NET_BUFFER* currentNB = netBufferList->FirstNetBuffer;
-	PMDL currentMDL = currentNB->CurrentMdl;
-	char* buffer;
+	// No rule set can be freed while it is held here. Holding it also keeps this call on one processor,
+	// which is what lets the statistics below use plain increments.
+	KIRQL rulesIrql;
+	LB_VERDICT verdict = LB_VERDICT_NONE;
+	const LB_RULESET* rules = LbRulesAcquire(&rulesIrql);
+	LB_STATS_PROCESSOR* stats = LbStatsCurrent();
+	BOOLEAN timed = LbStatsSample(stats);
+	UINT64 start = timed ? LbCycles() : 0;
+	UINT64 mark = start;
+	UINT8 captureFlags = Layer::headerInData ? LB_CAPTURE_FLAG_HEADER : 0;
+	BOOLEAN captured = FALSE;
 
-	// loop through all NBL's
-	while (currentNBL != NULL)
+	// Initialize some basic packet location and destination information
+	LB_FLOW_KEY key;
+	key.localAddress = LbLayerAddress<Layer::family>(&inFixedValues->incomingValue[Layer::localAddress].value);
+	key.remoteAddress = LbLayerAddress<Layer::family>(&inFixedValues->incomingValue[Layer::remoteAddress].value);
+	key.localPort = inFixedValues->incomingValue[Layer::localPort].value.uint16;
+	key.remotePort = inFixedValues->incomingValue[Layer::remotePort].value.uint16;
+	key.protocol = inFixedValues->incomingValue[Layer::protocol].value.uint8;
+	LbClassifyKeyLayer<Layer>(&key);
+	if (timed) mark = LbStatsStage(stats, LB_STAGE_FIELDS, mark);
+
+	// Allow all other packets
+	classifyOut->actionType = FWP_ACTION_PERMIT;
+
+	// Segments this driver injected come back through the same layer, they are already rewritten
+	if (layerData != NULL && LbInjectorIsOwnPacket((NET_BUFFER_LIST*)layerData))
+		goto Exit;
+
+	if (!rules)
+		goto Acks;
+
+	// Repeat packets of a flow take the cached verdict, only new flows evaluate the rules
+	verdict = LbClassifyLookup<Layer>(rules, &key, stats);
+	if (timed) mark = LbStatsStage(stats, LB_STAGE_LOOKUP, mark);
+
+	// Fast path for the vast majority of flows
+	if (verdict == LB_VERDICT_PERMIT)
+		goto Acks;
+
+	if (verdict == LB_VERDICT_BLOCK)
 	{
-		// loop through all NB's per NBL
-		while (currentNB != NULL)
+		// Every processor can get here at once, only the one that wins the exchange logs the event.
+		// Reading the flag first keeps later blocked packets from writing the shared cache line.
+		static volatile LONG first = 0;
+
+		if (LbReadAcquire(&first) == 0 && LbInterlockedCompareExchange(&first, 1, 0) == 0)
+			LBEVENT(LB_LEVEL_INFO, LB_EVENT_FIRST_BLOCK, key.remoteAddress, key.remotePort);
+
+		classifyOut->actionType = FWP_ACTION_BLOCK;
+		goto Exit;
+	}
+
+	// Flow needs payload inspection
+	if (verdict == LB_VERDICT_INSPECT)
+	{
+		// This is the packet structure for windows
+		NET_BUFFER_LIST* buff = (NET_BUFFER_LIST*)layerData;
+		
+		// If packet data is not null
+		if (buff != nullptr)
 		{
-			// loop through all MDL's per NB
-			while (currentMDL != NULL)
+			// Resume from where the previous segment of this flow stopped. Incoming segments are matched on their own,
+			// the context a flow may have at an inbound layer belongs to its outgoing stream.
+			LB_FLOW_CONTEXT* flow = Layer::flowState ?
+				LbFlowContextGet(inMetaValues, Layer::layerId, lbInjectionCalloutIds[Layer::callout], flowContext, &key) : NULL;
+			LB_SCAN_CONTEXT scan = { rules->matcher, rules->replace, LB_MATCHER_ROOT_STATE, 0, 0, timed, 0 };
+			LB_INJECT_PACKET* packet = NULL;
+			BOOLEAN canAbsorb = Layer::resizes && (classifyOut->rights & FWPS_RIGHT_ACTION_WRITE) != 0;
+			BOOLEAN absorb = FALSE;
+
+			if (flow)
+				KeAcquireSpinLockAtDpcLevel(&flow->lock);
+
+			// Asynchronous rule sets hand the segment to a worker. Once a flow has segments queued every later one
+			// queues behind them, even after the rules changed, or it would overtake them. One that can do neither
+			// is dropped, TCP resends it.
+			BOOLEAN queued = flow && flow->deferred > 0;
+			if (canAbsorb && (rules->async || queued))
+			{
+				if (LbInspectDefer(buff, &key, flow, inMetaValues, stats))
+				{
+					if (flow) flow->deferred++;
+					LbStatsCount(stats, LB_COUNTER_QUEUED);
+					absorb = TRUE;
+				}
+				else if (queued)
+					absorb = TRUE;
+			}
+
+			// Size changes need a copy, permission to absorb the original, and for TCP a context
+			if (!absorb)
+			{
+				BOOLEAN canCopy = canAbsorb && (key.protocol == IPPROTO_UDP || (key.protocol == IPPROTO_TCP && flow));
+				packet = LbInspectPayload(rules, flow, &key, buff, Layer::headerInData, canCopy, &scan);
+			}
+
+			if (flow)
+				KeReleaseSpinLockFromDpcLevel(&flow->lock);
+
+			// Queued segments are captured by the worker once they are inspected
+			if (absorb)
 			{
-				buffer = (PCHAR)MmGetSystemAddressForMdlSafe(currentMDL, NormalPagePriority | MdlMappingNoExecute);
+				classifyOut->actionType = FWP_ACTION_BLOCK;
+				classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+				classifyOut->flags |= FWPS_CLASSIFY_OUT_FLAG_ABSORB;
+				captured = TRUE;
+				goto Exit;
+			}
 
-				// Call user callback here
-				callbackFn(buffer, userdata);
+			if (scan.replacements > 0)
+				captureFlags |= LB_CAPTURE_FLAG_REWRITTEN;
 
-				// Next list element
-				currentMDL = currentMDL->Next;
+			LBEVENT(LB_LEVEL_TRACE, LB_EVENT_PACKET_INSPECTED, key.remoteAddress, key.remotePort, key.protocol, scan.replacements);
+			LbStatsCount(stats, LB_COUNTER_BYTES_SCANNED, scan.bytes);
+			LbStatsCount(stats, LB_COUNTER_BYTES_SKIPPED, scan.skipped);
+			LbStatsCount(stats, LB_COUNTER_REPLACEMENTS, scan.replacements);
+
+			// Everything since the lookup was payload work, the match engine's share of it is split off
+			if (timed)
+			{
+				UINT64 now = LbCycles();
+				LbStatsRecord(stats, LB_STAGE_MATCH, scan.matchCycles);
+				LbStatsRecord(stats, LB_STAGE_WALK, now - mark - scan.matchCycles);
+				mark = now;
 			}
 
-			// Next list element
-			currentNB = currentNB->Next;
+			// Send the rewritten copy and swallow the original. If the send fails the segment is simply lost,
+			// TCP resends it and the retransmission is rewritten the same way.
+			if (packet)
+			{
+				// The copy is what goes out, it is captured before the send can complete and free it
+				const LB_CAPTURE_FILTER* captureFilter = LbCaptureCurrent();
+				if (captureFilter)
+					LbCaptureOffer(captureFilter, &key, NULL, NULL, verdict, captureFlags, packet->data, packet->length, NULL);
+				captured = TRUE;
+
+				LbInjectorSendTransportV4(packet, key.remoteAddress, inMetaValues);
+				LbStatsCount(stats, LB_COUNTER_INJECTED);
+				if (timed) mark = LbStatsStage(stats, LB_STAGE_INJECT, mark);
+
+				classifyOut->actionType = FWP_ACTION_BLOCK;
+				classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+				classifyOut->flags |= FWPS_CLASSIFY_OUT_FLAG_ABSORB;
+
+				LBEVENT(LB_LEVEL_TRACE, LB_EVENT_SEGMENT_INJECTED, key.remoteAddress, key.remotePort, packet->length);
+				goto Exit;
+			}
 		}
+	}
 
-		// Next list element
-		currentNBL = NET_BUFFER_LIST_NEXT_NBL(currentNBL);
+Acks:
+	// Segments let through at the inbound IPv4 layer may carry acknowledgements of a resized outgoing stream
+	if (Layer::translatesAcks && LbTranslateAck(inFixedValues, inMetaValues, (NET_BUFFER_LIST*)layerData, flowContext, classifyOut))
+	{
+		classifyOut->actionType = FWP_ACTION_BLOCK;
+		classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+		classifyOut->flags |= FWPS_CLASSIFY_OUT_FLAG_ABSORB;
+	}
+
+Exit:
+	// Packets that went through unchanged, or were blocked, are captured as the layer holds them
+	if (verdict != LB_VERDICT_NONE && !captured && layerData != NULL)
+	{
+		const LB_CAPTURE_FILTER* captureFilter = LbCaptureCurrent();
+		if (captureFilter)
+		{
+			LbCaptureOffer(captureFilter, &key,
+				LbLayerAddressBytes<Layer::family>(&inFixedValues->incomingValue[Layer::localAddress].value),
+				LbLayerAddressBytes<Layer::family>(&inFixedValues->incomingValue[Layer::remoteAddress].value),
+				verdict, captureFlags, NULL, 0, (NET_BUFFER_LIST*)layerData);
+		}
 	}
+
+	LbStatsCount(stats, LB_COUNTER_PACKETS);
+	if (verdict == LB_VERDICT_PERMIT) LbStatsCount(stats, LB_COUNTER_PERMITTED);
+	if (verdict == LB_VERDICT_BLOCK) LbStatsCount(stats, LB_COUNTER_BLOCKED);
+	if (verdict == LB_VERDICT_INSPECT) LbStatsCount(stats, LB_COUNTER_INSPECTED);
+	if (timed) LbStatsRecord(stats, LB_STAGE_CLASSIFY, LbCycles() - start);
+
+	LbRulesRelease(rulesIrql);
+	return;
 }
 
-/////////////////////////////////
-// INJECTION CLASSIFY FUNCTION //
-/////////////////////////////////
+void LbClassifyOutboundV4(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut)
+{
+	UNREFERENCED_PARAMETER(classifyContext);
+	UNREFERENCED_PARAMETER(filter);
+	LbClassifyLayer<LB_WFP_LAYER<FWPS_LAYER_OUTBOUND_TRANSPORT_V4>>(inFixedValues, inMetaValues, layerData, flowContext, classifyOut);
+}
 
-void LbClassifyInject(
+void LbClassifyOutboundV6(
 	const FWPS_INCOMING_VALUES* inFixedValues,
 	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
 	void* layerData,
@@ -236,78 +1529,259 @@ void LbClassifyInject(
 	UINT64 flowContext,
 	FWPS_CLASSIFY_OUT* classifyOut)
 {
-	// Initialize some basic packet location and destination information
-	UINT32 local_address = inFixedValues->incomingValue[FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_LOCAL_ADDRESS].value.uint32;
-	UINT32 remote_address = inFixedValues->incomingValue[FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_REMOTE_ADDRESS].value.uint32;
-	UINT16 local_port = inFixedValues->incomingValue[FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_LOCAL_PORT].value.uint16;
-	UINT16 remote_port = inFixedValues->incomingValue[FWPS_FIELD_OUTBOUND_TRANSPORT_V4_IP_REMOTE_PORT].value.uint16;
+	UNREFERENCED_PARAMETER(classifyContext);
+	UNREFERENCED_PARAMETER(filter);
+	LbClassifyLayer<LB_WFP_LAYER<FWPS_LAYER_OUTBOUND_TRANSPORT_V6>>(inFixedValues, inMetaValues, layerData, flowContext, classifyOut);
+}
+
+void LbClassifyInboundV4(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut)
+{
+	UNREFERENCED_PARAMETER(classifyContext);
+	UNREFERENCED_PARAMETER(filter);
+	LbClassifyLayer<LB_WFP_LAYER<FWPS_LAYER_INBOUND_TRANSPORT_V4>>(inFixedValues, inMetaValues, layerData, flowContext, classifyOut);
+}
 
-	UNREFERENCED_PARAMETER(inMetaValues);
-	UNREFERENCED_PARAMETER(layerData);
+void LbClassifyInboundV6(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut)
+{
 	UNREFERENCED_PARAMETER(classifyContext);
-	UNREFERENCED_PARAMETER(flowContext);
 	UNREFERENCED_PARAMETER(filter);
+	LbClassifyLayer<LB_WFP_LAYER<FWPS_LAYER_INBOUND_TRANSPORT_V6>>(inFixedValues, inMetaValues, layerData, flowContext, classifyOut);
+}
 
-	UNREFERENCED_PARAMETER(remote_address);
-	UNREFERENCED_PARAMETER(local_port);
-	UNREFERENCED_PARAMETER(local_address);
+//////////////////////////////
+// STREAM CLASSIFY FUNCTION //
+//////////////////////////////
 
-	// port 80 is HTTP traffic (No Encryption)
-	// port 443 is HTTPS (Encrypted)
-	// port 53 is DNS
+// Outgoing TCP data of rule sets with LB_RULES_FLAG_STREAM, after the stack put it in order and before it is
+// cut into segments. Small writes are collected with FWPS_STREAM_ACTION_NEED_MORE_DATA until a chunk is
+// worth scanning, and the tail that may start a match is handed back to be scanned with the data after it.
+// Rewritten data is injected into the stream, which takes care of sequence numbers and acknowledgements.
+template <class Layer>
+static void LbClassifyStreamLayer(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut)
+{
+	KIRQL rulesIrql;
+	LB_VERDICT verdict = LB_VERDICT_NONE;
+	const LB_RULESET* rules = LbRulesAcquire(&rulesIrql);
+	LB_STATS_PROCESSOR* stats = LbStatsCurrent();
+	BOOLEAN timed = LbStatsSample(stats);
+	UINT64 start = timed ? LbCycles() : 0;
+	FWPS_STREAM_CALLOUT_IO_PACKET* ioPacket = (FWPS_STREAM_CALLOUT_IO_PACKET*)layerData;
+	FWPS_STREAM_DATA* streamData = ioPacket ? ioPacket->streamData : NULL;
+	LB_FLOW_CONTEXT* flow = NULL;
+	LB_INJECT_PACKET* scratch = NULL;
+	LB_INJECT_PACKET* packet = NULL;
+	LB_SCAN_CONTEXT scan = { rules ? rules->matcher : NULL, rules ? rules->replace : NULL, LB_MATCHER_ROOT_STATE, 0, 0, timed, 0 };
+	SIZE_T consumed = 0;
+	SIZE_T written = 0;
+
+	LB_FLOW_KEY key;
+	key.localAddress = LbLayerAddress<Layer::family>(&inFixedValues->incomingValue[Layer::localAddress].value);
+	key.remoteAddress = LbLayerAddress<Layer::family>(&inFixedValues->incomingValue[Layer::remoteAddress].value);
+	key.localPort = inFixedValues->incomingValue[Layer::localPort].value.uint16;
+	key.remotePort = inFixedValues->incomingValue[Layer::remotePort].value.uint16;
+	key.protocol = IPPROTO_TCP;
+	LbClassifyKeyLayer<Layer>(&key);
+
+	LbStatsCount(stats, LB_COUNTER_STREAM_CALLS);
+
+	// Whatever is not rewritten passes as it is
+	classifyOut->actionType = FWP_ACTION_PERMIT;
+	if (!ioPacket)
+		goto Exit;
+	ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
+	ioPacket->countBytesEnforced = streamData ? streamData->dataLength : 0;
+
+	// The filter only asks for outgoing data, a connection's other flags carry nothing to rewrite
+	if (!streamData || !(streamData->flags & FWPS_STREAM_FLAG_SEND) || streamData->dataLength == 0)
+		goto Exit;
+	if (!rules || !(classifyOut->rights & FWPS_RIGHT_ACTION_WRITE))
+		goto Exit;
+
+	verdict = LbClassifyLookup<Layer>(rules, &key, stats);
+	if (verdict != LB_VERDICT_INSPECT)
+		goto Exit;
+
+	flow = LbFlowContextGet(inMetaValues, Layer::layerId, lbInjectionCalloutIds[Layer::callout], flowContext, &key);
+	if (!flow)
+		goto Exit;
 
-	// Block HTTPS traffic
-	if (remote_port == 443)
 	{
-		static bool first = false;
+		LB_STREAM_POLICY policy = { rules->streamChunk, rules->streamLookahead };
+		UINT32 flags = 0;
+		SIZE_T length = streamData->dataLength;
+		SIZE_T copied = 0;
+
+		if (streamData->flags & (FWPS_STREAM_FLAG_SEND_EXPEDITED | FWPS_STREAM_FLAG_SEND_NODELAY))
+			flags |= LB_STREAM_FLUSH;
+		if (streamData->flags & (FWPS_STREAM_FLAG_SEND_DISCONNECT | FWPS_STREAM_FLAG_SEND_ABORT))
+			flags |= LB_STREAM_END;
 
-		if (!first)
+		// Too little to be worth a scan, the stack indicates it again once enough has been written behind it
+		UINT32 wait = LbStreamWait(&policy, length, flags);
+		if (wait > 0)
 		{
-			LBPRINTLN("FIRST HTTPS PACKET DETECTED!");
-			LBPRINTLN("BLOCKING ALL HTTPS TRAFFIC...");
-			first = true;
+			ioPacket->streamAction = FWPS_STREAM_ACTION_NEED_MORE_DATA;
+			ioPacket->countBytesRequired = wait;
+			ioPacket->countBytesEnforced = 0;
+			classifyOut->actionType = FWP_ACTION_NONE;
+			LbStatsCount(stats, LB_COUNTER_STREAM_WAITS);
+			goto Exit;
 		}
 
-		classifyOut->actionType = FWP_ACTION_BLOCK;
-		return;
-	}
-
-	// Check if destination port is the correct port
-	if (remote_port == 27015)
-	{
-		// This is the packet structure for windows
-		NET_BUFFER_LIST* buff = (NET_BUFFER_LIST*)layerData;
-		
-		// If packet data is not null
-		if (buff != nullptr)
+		// One buffer at a time, the rest is indicated again after what this call enforces.
+		// Data past the copy follows right after it, so the copy is never the end of anything.
+		if (length > LB_INJECT_MAX_SEGMENT)
 		{
-			LBPRINTLN("PACKET DATA:\n");
+			length = LB_INJECT_MAX_SEGMENT;
+			flags = 0;
+		}
+
+		scratch = LbInjectorAllocatePacket();
+		packet = LbInjectorAllocatePacket();
+		if (!scratch || !packet)
+			goto Exit;
+
+		FwpsCopyStreamDataToBuffer(streamData, scratch->data, length, &copied);
+		if (copied != length)
+			goto Exit;
+
+		KeAcquireSpinLockAtDpcLevel(&flow->lock);
 
-			LB_USERDATA ud;
-			ud.count = 3; // Number of elements that will be in strArray
-			ud.enableReversal = true; // Allow inversion of strings EX: {"Love", "Hate"} results in "Love"  -> "Hate" and "Hate" -> "Love"
-			ud.strArray = (LB_MATCH_AND_REPLACE*)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(LB_MATCH_AND_REPLACE) * ud.count, 'LBP0'); // Create memory pool for string array to allocate space
-			
-			// Initialize match and replace mappings 
-			ud.strArray[0] = { (char*)"Love", (char*)"Hate" };
-			ud.strArray[1] = { (char*)"Alice", (char*)"Trudy" };
-			ud.strArray[2] = { (char*)"Rob", (char*)"Bob" };
+		if (flow->matchGeneration == rules->generation)
+			scan.state = flow->matchState;
+		scan.fields = rules->fields;
+		scan.key = &key;
+		scan.stream = &flow->dissector;
 
-			// Call parse packet and alter with callback function
-			ParsePacket(buff, LbReplaceCallback, &ud);
+		LbRewriteStream(&policy, &scan, scratch->data, length, flags, packet->data, LB_INJECT_MAX_SEGMENT, &consumed, &written);
 
-			// Free memory pool
-			ExFreePool2(ud.strArray, 'LBP0', NULL, NULL);
+		flow->matchState = scan.state;
+		flow->matchGeneration = rules->generation;
 
-			LBPRINT_NO_INFO("\n");
+		KeReleaseSpinLockFromDpcLevel(&flow->lock);
+
+		LbStatsCount(stats, LB_COUNTER_BYTES_SCANNED, scan.bytes);
+		LbStatsCount(stats, LB_COUNTER_BYTES_SKIPPED, scan.skipped);
+		LbStatsCount(stats, LB_COUNTER_REPLACEMENTS, scan.replacements);
+		LBEVENT(LB_LEVEL_TRACE, LB_EVENT_PACKET_INSPECTED, key.remoteAddress, key.remotePort, key.protocol, scan.replacements);
+
+		// Everything may be the start of a match, wait for one more byte than there is
+		if (consumed == 0)
+		{
+			if (flags & LB_STREAM_END)
+				goto Exit;
+
+			ioPacket->streamAction = FWPS_STREAM_ACTION_NEED_MORE_DATA;
+			ioPacket->countBytesRequired = (UINT32)(streamData->dataLength + 1);
+			ioPacket->countBytesEnforced = 0;
+			classifyOut->actionType = FWP_ACTION_NONE;
+			LbStatsCount(stats, LB_COUNTER_STREAM_WAITS);
+			LbStatsCount(stats, LB_COUNTER_STREAM_HELD, streamData->dataLength);
+			goto Exit;
+		}
+
+		// Enforcing less than was indicated hands the rest back with the next data
+		ioPacket->countBytesEnforced = consumed;
+		if (consumed < streamData->dataLength)
+			LbStatsCount(stats, LB_COUNTER_STREAM_HELD, streamData->dataLength - consumed);
+
+		// Stream data has no headers of its own, the reader makes one up around each chunk
+		const LB_CAPTURE_FILTER* captureFilter = LbCaptureCurrent();
+		if (captureFilter)
+		{
+			LbCaptureOffer(captureFilter, &key,
+				LbLayerAddressBytes<Layer::family>(&inFixedValues->incomingValue[Layer::localAddress].value),
+				LbLayerAddressBytes<Layer::family>(&inFixedValues->incomingValue[Layer::remoteAddress].value),
+				verdict, LB_CAPTURE_FLAG_STREAM | (scan.replacements > 0 ? LB_CAPTURE_FLAG_REWRITTEN : 0),
+				scan.replacements > 0 ? packet->data : scratch->data, scan.replacements > 0 ? written : consumed, NULL);
 		}
-		// Print some debug text
-		LBPRINTLN("PERMITTING PACKET...");
+
+		if (scan.replacements == 0)
+			goto Exit;
+
+		// The rewritten bytes take the place of the consumed ones. If the injection fails they go out unchanged.
+		packet->length = (ULONG)written;
+		NTSTATUS status = LbInjectorSendStream(packet, inMetaValues->flowHandle, lbInjectionCalloutIds[Layer::callout],
+			Layer::layerId, streamData->flags);
+		packet = NULL;
+		if (!NT_SUCCESS(status))
+			goto Exit;
+
+		classifyOut->actionType = FWP_ACTION_BLOCK;
+		classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+		LbStatsCount(stats, LB_COUNTER_INJECTED);
+		LBEVENT(LB_LEVEL_TRACE, LB_EVENT_SEGMENT_INJECTED, key.remoteAddress, key.remotePort, (ULONG)written);
 	}
 
-	// Allow all other packets
-	classifyOut->actionType = FWP_ACTION_PERMIT;
-	return;
+Exit:
+	if (scratch) LbInjectorFreePacket(scratch);
+	if (packet) LbInjectorFreePacket(packet);
+
+	if (verdict == LB_VERDICT_PERMIT) LbStatsCount(stats, LB_COUNTER_PERMITTED);
+	if (verdict == LB_VERDICT_INSPECT) LbStatsCount(stats, LB_COUNTER_INSPECTED);
+	if (timed) LbStatsRecord(stats, LB_STAGE_STREAM, LbCycles() - start);
+
+	LbRulesRelease(rulesIrql);
+}
+
+void LbClassifyStreamV4(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut)
+{
+	UNREFERENCED_PARAMETER(classifyContext);
+	UNREFERENCED_PARAMETER(filter);
+	LbClassifyStreamLayer<LB_WFP_LAYER<FWPS_LAYER_STREAM_V4>>(inFixedValues, inMetaValues, layerData, flowContext, classifyOut);
+}
+
+void LbClassifyStreamV6(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut)
+{
+	UNREFERENCED_PARAMETER(classifyContext);
+	UNREFERENCED_PARAMETER(filter);
+	LbClassifyStreamLayer<LB_WFP_LAYER<FWPS_LAYER_STREAM_V6>>(inFixedValues, inMetaValues, layerData, flowContext, classifyOut);
+}
+
+//////////////////////////
+// FLOW DELETE CALLBACK //
+//////////////////////////
+
+void LbFlowDelete(UINT16 layerId, UINT32 calloutId, UINT64 flowContext)
+{
+	// Called once a flow with an associated context ends, or when the context is removed on unload
+
+	UNREFERENCED_PARAMETER(layerId);
+	UNREFERENCED_PARAMETER(calloutId);
+	LbFlowContextDelete(flowContext);
 }
 
 //////////////////////
@@ -323,12 +1797,3 @@ NTSTATUS LbNotify(FWPS_CALLOUT_NOTIFY_TYPE notifyType, const GUID* filterKey,FWP
 	UNREFERENCED_PARAMETER(filter);
 	return STATUS_SUCCESS;
 }
-
-void LbFlowDelete(UINT16 layerId, UINT32 calloutId, UINT64 flowContext)
-{
-	// Required for WFP driver, function is unused
-
-	UNREFERENCED_PARAMETER(layerId);
-	UNREFERENCED_PARAMETER(calloutId);
-	UNREFERENCED_PARAMETER(flowContext);
-}
\ No newline at end of file
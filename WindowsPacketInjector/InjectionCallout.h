@@ -21,10 +21,107 @@
 #pragma once
 
 #include "Driver.h"
+#include "Ioctl.h"
 
-// Custom classifyFn callout
-// Controls packet flow and injection
-void LbClassifyInject(
+// Compiles the match and replace rules used by the classify functions
+// Must be called before the callout is registered
+NTSTATUS LbInjectionInitialize();
+
+// Frees everything allocated by LbInjectionInitialize
+void LbInjectionCleanup();
+
+// Starts one inspection worker per processor for rule sets with LB_RULES_FLAG_ASYNC.
+// Must be called after LbInjectionInitialize and LbInjectorInitialize, before the callout is registered.
+NTSTATUS LbInjectionStartWorkers();
+
+// Stops the workers once they inspected every queued segment and waits for those sends to complete.
+// Must be called after the callout is unregistered and before LbInjectionCleanup.
+void LbInjectionStopWorkers();
+
+// Registers the filters generated from the rules compiled by LbInjectionInitialize.
+// Must be called inside the filter engine transaction that registers the callouts.
+NTSTATUS LbInjectionInstallFilters();
+
+// Compiles an IOCTL_LB_SET_RULES buffer and atomically replaces the active rules and their filters with it.
+// Classify calls keep running on the old rules until the swap, nothing is ever blocked.
+// Must be called at PASSIVE_LEVEL.
+NTSTATUS LbInjectionReplaceRules(const void* buffer, SIZE_T size);
+
+// Same for an IOCTL_LB_SET_RULE_IMAGE buffer, the image is validated and used in place instead of compiled
+NTSTATUS LbInjectionReplaceRuleImage(const void* buffer, SIZE_T size);
+
+// Sets up the lock guarding the capture section, must be called before any of the capture functions below
+void LbInjectionInitializeCapture();
+
+// Replaces the capture rules with an IOCTL_LB_SET_CAPTURE buffer, creating the capture section the first time.
+// Must be called at PASSIVE_LEVEL.
+NTSTATUS LbInjectionReplaceCapture(const void* buffer, SIZE_T size);
+
+// Maps the capture section into the current process for IOCTL_LB_MAP_CAPTURE. One owner at a time holds it,
+// it must be called at PASSIVE_LEVEL in the context of the process asking for it.
+NTSTATUS LbInjectionMapCapture(void* owner, LB_CAPTURE_MAPPING* mapping);
+
+// Takes the mapping back if owner holds it, called when a handle to the control device is cleaned up
+void LbInjectionUnmapCapture(void* owner);
+
+// Frees the capture section and rules, must be called after the callout is unregistered
+void LbInjectionCleanupCapture();
+
+// Custom classifyFn callouts, one per transport layer
+// Control packet flow and injection. The inbound IPv4 one also translates the acknowledgements
+// of flows whose outgoing segments changed size.
+void LbClassifyOutboundV4(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut
+);
+
+void LbClassifyOutboundV6(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut
+);
+
+void LbClassifyInboundV4(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut
+);
+
+void LbClassifyInboundV6(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut
+);
+
+// Stream layer classifyFn callouts, outgoing TCP data of rule sets with LB_RULES_FLAG_STREAM
+void LbClassifyStreamV4(
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	void* layerData,
+	const void* classifyContext,
+	const FWPS_FILTER* filter,
+	UINT64 flowContext,
+	FWPS_CLASSIFY_OUT* classifyOut
+);
+
+void LbClassifyStreamV6(
 	const FWPS_INCOMING_VALUES* inFixedValues,
 	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
 	void* layerData,
@@ -43,7 +140,7 @@ NTSTATUS LbNotify(
 );
 
 // Custom flowDeleteFn callout
-// Does nothing in this implementation
+// Releases the per-flow context associated by the outbound classify functions, shared by every callout
 void LbFlowDelete(
 	UINT16 layerId,
 	UINT32 calloutId,
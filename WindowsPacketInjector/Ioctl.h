@@ -0,0 +1,388 @@
+/*/
+/*  ** Ioctl.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the control codes and buffer layouts understood by the \Device\LbDriver control device.
+/*	This header is shared with user mode, so it only depends on Platform.h.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+#ifndef CTL_CODE
+#define CTL_CODE(DeviceType, Function, Method, Access) (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+#define FILE_DEVICE_NETWORK	0x00000012
+#define METHOD_BUFFERED		0
+#define METHOD_IN_DIRECT	1
+#define FILE_ANY_ACCESS		0
+#define FILE_READ_DATA		0x0001
+#define FILE_WRITE_DATA		0x0002
+#endif
+
+// User mode opens the device through this name
+#define LB_USER_DEVICE_NAME "\\\\.\\LbDriver"
+
+///////////////////
+// CONTROL CODES //
+///////////////////
+
+// Replace the active rule set, input is an LB_RULES_HEADER followed by its rules
+#define IOCTL_LB_SET_RULES		CTL_CODE(FILE_DEVICE_NETWORK, 0x800, METHOD_BUFFERED, FILE_WRITE_DATA)
+
+// Drain the event log, output receives an LB_EVENTS_HEADER followed by as many LB_EVENTs as fit
+#define IOCTL_LB_READ_EVENTS	CTL_CODE(FILE_DEVICE_NETWORK, 0x801, METHOD_BUFFERED, FILE_READ_DATA)
+
+// Read the counters and latency histograms summed over all processors, output receives an LB_STATS_SNAPSHOT
+#define IOCTL_LB_READ_STATS		CTL_CODE(FILE_DEVICE_NETWORK, 0x802, METHOD_BUFFERED, FILE_READ_DATA)
+
+// Replace the active rule set with one compiled ahead of time. The rule image (see RuleImage.h) is passed as the
+// output buffer of DeviceIoControl: direct I/O locks and maps the caller's pages instead of copying them first,
+// so the copy LbRuleSetLoadImage makes is the only one.
+#define IOCTL_LB_SET_RULE_IMAGE	CTL_CODE(FILE_DEVICE_NETWORK, 0x803, METHOD_IN_DIRECT, FILE_WRITE_DATA)
+
+// Replace the capture rules, input is an LB_CAPTURE_RULES_HEADER followed by its rules. No rules stops capturing.
+#define IOCTL_LB_SET_CAPTURE	CTL_CODE(FILE_DEVICE_NETWORK, 0x804, METHOD_BUFFERED, FILE_WRITE_DATA)
+
+// Map the capture section into the calling process, output receives an LB_CAPTURE_MAPPING.
+// One handle at a time can hold the mapping, it is taken back when that handle is closed.
+#define IOCTL_LB_MAP_CAPTURE	CTL_CODE(FILE_DEVICE_NETWORK, 0x805, METHOD_BUFFERED, FILE_READ_DATA | FILE_WRITE_DATA)
+
+//////////////////
+// RULE BUFFERS //
+//////////////////
+
+#define LB_RULES_VERSION 5
+
+// Largest number of port or address rules, or of match/replace pairs, accepted in one buffer
+#define LB_RULES_MAX_COUNT 0x100000
+
+// Most bytes of nonpaged pool one rule set may take, see LB_RULES_HEADER::memoryBudget
+#define LB_RULES_MAX_BYTES (128 * 1024 * 1024)
+
+// Add every match/replace pair a second time in the reverse direction
+#define LB_RULES_FLAG_REVERSAL 0x00000001
+
+// Match strings are regular expressions, cannot be combined with LB_RULES_FLAG_REVERSAL.
+// Supported: literals, ., [...], [^...], \d \w \s (and \D \W \S), \xHH, \n \r \t, groups, |,
+// * + ? {n} {n,} {n,m} and a leading ^ for the start of a line. Like literal pairs, a match is taken
+// as soon as one ends; it then runs from its leftmost start for as long as the pattern keeps matching.
+#define LB_RULES_FLAG_REGEX 0x00000002
+
+// Inspect outbound segments on per-processor worker threads instead of inside the classify call.
+// The callout absorbs each segment and a worker matches, rewrites and injects it a little later;
+// all segments of a flow go to the same worker, so they still leave in the order they were sent.
+#define LB_RULES_FLAG_ASYNC 0x00000004
+
+// Inspect TCP flows at the stream layer, as the reassembled outgoing byte stream instead of segment by segment.
+// Matches that straddle segments are found, a rewrite that changes sizes needs no sequence number fix-ups, and
+// small writes can be collected into larger chunks before they are scanned, see LB_RULES_HEADER::streamChunk.
+// UDP is still inspected per datagram, and LB_RULES_FLAG_ASYNC then only applies to UDP.
+#define LB_RULES_FLAG_STREAM 0x00000008
+
+// Largest LB_RULES_HEADER::streamChunk and streamLookahead
+#define LB_STREAM_MAX_CHUNK 0x8000
+
+// Parts of a payload the match/replace pairs are run over, see LB_RULES_HEADER::fields.
+// HTTP is recognized on TCP port 80 and DNS on UDP port 53, at either end of the flow.
+#define LB_FIELD_HTTP_START_LINE	0x00000001	// Request or status line
+#define LB_FIELD_HTTP_HEADERS		0x00000002	// Header lines, up to and including the blank line that ends them
+#define LB_FIELD_HTTP_BODY			0x00000004	// Message body, only the chunk data of a chunked body
+#define LB_FIELD_DNS_NAMES			0x00000008	// Encoded names of questions and records, labels with their length bytes
+#define LB_FIELD_DNS_DATA			0x00000010	// Data of answer, authority and additional records
+#define LB_FIELD_OTHER				0x00000020	// Flows of any other protocol, and HTTP or DNS the driver lost track of
+#define LB_FIELD_ALL				0x0000003F
+
+enum LB_RULE_ACTION : UINT8
+{
+	LB_RULE_ACTION_PERMIT = 0,
+	LB_RULE_ACTION_BLOCK,
+	LB_RULE_ACTION_INSPECT,		// Permit, but rewrite the payload with the match/replace pairs
+};
+
+// Traffic a rule applies to, any combination
+#define LB_RULE_DIRECTION_OUTBOUND	0x01
+#define LB_RULE_DIRECTION_INBOUND	0x02
+#define LB_RULE_DIRECTION_BOTH		(LB_RULE_DIRECTION_OUTBOUND | LB_RULE_DIRECTION_INBOUND)
+
+// Action taken for traffic to or from a range of remote ports.
+// When ranges overlap the rule listed first wins.
+struct LB_PORT_RULE
+{
+	UINT16 firstPort;
+	UINT16 lastPort;			// Inclusive
+	UINT8 action;				// LB_RULE_ACTION
+	UINT8 directions;			// LB_RULE_DIRECTION_*
+	UINT16 reserved;
+};
+
+// Action taken for traffic to or from a remote IPv4 network.
+// The longest matching prefix wins, between equal prefixes the rule listed first wins.
+struct LB_ADDRESS_RULE
+{
+	UINT32 address;				// Host byte order, bits past prefixLength are ignored
+	UINT8 prefixLength;			// 0 to 32
+	UINT8 action;				// LB_RULE_ACTION
+	UINT8 directions;			// LB_RULE_DIRECTION_*
+	UINT8 reserved;
+};
+
+// Layout of an IOCTL_LB_SET_RULES input buffer:
+//  - LB_RULES_HEADER
+//  - LB_ADDRESS_RULE[addressRuleCount]
+//  - LB_PORT_RULE[portRuleCount]
+//  - pairCount match/replace pairs, each as two NUL terminated strings back to back
+// A flow is decided by its remote address when an address rule covers it, otherwise by its remote port.
+// Flows matched by neither are permitted.
+struct LB_RULES_HEADER
+{
+	UINT32 version;				// LB_RULES_VERSION
+	UINT32 flags;				// LB_RULES_FLAG_*
+	UINT32 addressRuleCount;
+	UINT32 portRuleCount;
+	UINT32 pairCount;
+	UINT32 fields;				// LB_FIELD_*, 0 runs the pairs over every payload byte
+
+	// Only used with LB_RULES_FLAG_STREAM. Data is never held back once the sender asks for it to go out
+	// without delay or closes its side, but a sender that waits for an answer before writing again stalls
+	// until then: only raise these for flows that keep writing, like uploads.
+	UINT32 streamChunk;			// Bytes collected before they are scanned, 0 scans every write as it comes
+	UINT32 streamLookahead;		// Most bytes held back when the data ends inside a possible match, at least
+								// the longest match minus one finds every match across writes; 0 holds none back
+
+	// Most bytes of nonpaged pool the compiled rule set may take, its tables and the match engine's included,
+	// as well as the tables they are built in. It can only lower LB_RULES_MAX_BYTES, 0 keeps that limit.
+	// A rule set that could go over it is rejected with STATUS_QUOTA_EXCEEDED before its tables are built.
+	UINT32 memoryBudget;
+};
+
+///////////////////
+// EVENT BUFFERS //
+///////////////////
+
+enum LB_EVENT_LEVEL : UINT8
+{
+	LB_LEVEL_ERROR = 1,
+	LB_LEVEL_WARNING,
+	LB_LEVEL_INFO,
+	LB_LEVEL_TRACE,				// Once per packet
+};
+
+// What an event means and what its arguments are
+enum LB_EVENT_ID : UINT16
+{
+	LB_EVENT_NONE = 0,
+	LB_EVENT_RULES_PUBLISHED,	// generation, bytes
+	LB_EVENT_FIRST_BLOCK,		// remote address, remote port
+	LB_EVENT_PACKET_INSPECTED,	// remote address, remote port, protocol, replacements
+	LB_EVENT_SEGMENT_INJECTED,	// remote address, remote port, new length
+	LB_EVENT_INJECT_FAILED,		// status
+	LB_EVENT_INJECT_COMPLETED,	// status, only logged when the send failed
+	LB_EVENT_ACK_TRANSLATED,	// acknowledgement number received, acknowledgement number passed on
+	LB_EVENT_RULES_OVER_BUDGET,	// bytes (0 when the rules were turned away before they were built), memory budget
+};
+
+#define LB_EVENT_ARGS 5
+
+// Fixed size binary record, exactly one cache line
+struct LB_EVENT
+{
+	UINT64 timestamp;			// Performance counter ticks, see LB_EVENTS_HEADER::frequency
+	UINT32 sequence;			// Per processor, counts the events that processor recorded
+	UINT16 id;					// LB_EVENT_ID
+	UINT8 level;				// LB_EVENT_LEVEL
+	UINT8 reserved;
+	UINT32 processor;
+	UINT32 argCount;
+	UINT64 args[LB_EVENT_ARGS];
+};
+
+// Layout of an IOCTL_LB_READ_EVENTS output buffer:
+//  - LB_EVENTS_HEADER
+//  - LB_EVENT[count]
+// Events come out grouped by processor, sort them by timestamp for a global order.
+struct LB_EVENTS_HEADER
+{
+	UINT32 count;
+	UINT32 reserved;
+	UINT64 lost;				// Events dropped because a ring was full since the previous read
+	UINT64 frequency;			// Timestamp ticks per second
+};
+
+/////////////////////
+// CAPTURE BUFFERS //
+/////////////////////
+
+#define LB_CAPTURE_RULES_VERSION 1
+
+// Largest number of capture rules accepted in one buffer
+#define LB_CAPTURE_MAX_RULES 64
+
+// Most packet bytes a record keeps
+#define LB_CAPTURE_MAX_SNAP 0x4000
+
+// Actions a capture rule applies to, any combination of 1 << LB_RULE_ACTION
+#define LB_CAPTURE_ACTION_PERMIT	0x01
+#define LB_CAPTURE_ACTION_BLOCK		0x02
+#define LB_CAPTURE_ACTION_INSPECT	0x04
+#define LB_CAPTURE_ACTION_ALL		0x07
+
+// Only packets the match/replace pairs changed are captured
+#define LB_CAPTURE_RULE_REWRITTEN_ONLY 0x0001
+
+// Which packets go into the capture section and how many of them. A packet is decided by the first rule
+// that covers it, packets no rule covers are not captured.
+struct LB_CAPTURE_RULE
+{
+	UINT32 address;				// Remote IPv4 network in host byte order, bits past prefixLength are ignored
+	UINT8 prefixLength;			// 0 to 32, IPv6 flows are only covered by rules with 0
+	UINT8 protocol;				// IPPROTO_TCP or IPPROTO_UDP, 0 for both
+	UINT8 directions;			// LB_RULE_DIRECTION_*
+	UINT8 actions;				// LB_CAPTURE_ACTION_*
+	UINT16 firstPort;			// Remote ports
+	UINT16 lastPort;			// Inclusive
+	UINT32 sampleRate;			// One in this many covered packets per processor is captured, 0 captures none of them
+	UINT16 snapLength;			// Most packet bytes kept, up to LB_CAPTURE_MAX_SNAP
+	UINT16 flags;				// LB_CAPTURE_RULE_*
+};
+
+// Layout of an IOCTL_LB_SET_CAPTURE input buffer:
+//  - LB_CAPTURE_RULES_HEADER
+//  - LB_CAPTURE_RULE[ruleCount]
+struct LB_CAPTURE_RULES_HEADER
+{
+	UINT32 version;				// LB_CAPTURE_RULES_VERSION
+	UINT32 ruleCount;
+};
+
+struct LB_CAPTURE_MAPPING
+{
+	UINT64 address;				// Where the section starts in the calling process
+	UINT64 size;
+};
+
+#define LB_CAPTURE_MAGIC 0x50434C42	// "LBCP"
+#define LB_CAPTURE_VERSION 1
+
+// Layout of the capture section:
+//  - LB_CAPTURE_SECTION
+//  - ringCount rings, the first one ringOffset bytes from the start and each one ringStride bytes after the
+//    one before. A ring is an LB_CAPTURE_RING followed by ringSize bytes of records.
+// Each processor writes to a ring of its own. The driver publishes a record by moving head past it, the
+// reader hands the bytes back by moving tail. Both only ever grow and wrap around at 2^32, a record starts
+// at (head % ringSize) bytes into the ring's records.
+struct LB_CAPTURE_SECTION
+{
+	UINT32 magic;				// LB_CAPTURE_MAGIC
+	UINT32 version;				// LB_CAPTURE_VERSION
+	UINT32 ringCount;
+	UINT32 ringSize;			// A power of two
+	UINT32 ringOffset;
+	UINT32 ringStride;
+	UINT64 frequency;			// Timestamp ticks per second
+};
+
+// Head and tail each have a cache line of their own
+struct LB_CAPTURE_RING
+{
+	volatile LONG head;			// Record bytes ever written, only the driver writes it
+	volatile LONG dropped;		// Records ever dropped because the ring was full
+	UINT8 writerPad[56];
+
+	volatile LONG tail;			// Record bytes ever read, only the reader writes it
+	UINT8 readerPad[60];
+};
+
+enum LB_CAPTURE_RECORD_TYPE : UINT8
+{
+	LB_CAPTURE_RECORD_PACKET = 1,
+	LB_CAPTURE_RECORD_PADDING,	// Fills the end of the ring, the next record starts at the beginning
+};
+
+// Data starts with the transport header, otherwise it is the payload alone
+#define LB_CAPTURE_FLAG_HEADER		0x01
+// The match/replace pairs changed the data, it is captured as it was sent on
+#define LB_CAPTURE_FLAG_REWRITTEN	0x02
+// The data was inspected on a worker thread after the classify call returned, see LB_RULES_FLAG_ASYNC
+#define LB_CAPTURE_FLAG_QUEUED		0x04
+// The data is a piece of a TCP stream as the stream layer saw it, not one segment
+#define LB_CAPTURE_FLAG_STREAM		0x08
+
+// One packet, followed by capturedLength bytes of its data and padding up to length
+struct LB_CAPTURE_RECORD
+{
+	UINT32 length;				// Bytes the record takes up in the ring, a multiple of 8
+	UINT8 type;					// LB_CAPTURE_RECORD_TYPE
+	UINT8 flags;				// LB_CAPTURE_FLAG_*
+	UINT8 rule;					// Capture rule that sampled the packet
+	UINT8 action;				// LB_RULE_ACTION the flow got
+	UINT64 timestamp;			// See LB_CAPTURE_SECTION::frequency
+	UINT8 localAddress[16];		// Network byte order, an IPv4 address takes the first 4 bytes
+	UINT8 remoteAddress[16];
+	UINT16 localPort;			// Host byte order
+	UINT16 remotePort;
+	UINT8 family;				// 0 for IPv4, 1 for IPv6
+	UINT8 protocol;
+	UINT8 direction;			// LB_RULE_DIRECTION_OUTBOUND or LB_RULE_DIRECTION_INBOUND
+	UINT8 reserved;
+	UINT32 originalLength;		// Bytes of data the packet had
+	UINT32 capturedLength;		// Bytes of data that follow
+};
+
+///////////////////
+// STATS BUFFERS //
+///////////////////
+
+enum LB_COUNTER
+{
+	LB_COUNTER_PACKETS = 0,		// Calls to the injection classify function
+	LB_COUNTER_PERMITTED,
+	LB_COUNTER_BLOCKED,
+	LB_COUNTER_INSPECTED,
+	LB_COUNTER_RULE_LOOKUPS,	// Verdicts that were not in the verdict cache
+	LB_COUNTER_BYTES_SCANNED,	// Payload bytes fed to the match engine
+	LB_COUNTER_REPLACEMENTS,
+	LB_COUNTER_INJECTED,		// Rewritten segments sent in place of the original
+	LB_COUNTER_ACKS_TRANSLATED,
+	LB_COUNTER_BYTES_SKIPPED,	// Payload bytes of inspected flows outside the fields the rule set targets
+	LB_COUNTER_QUEUED,			// Segments absorbed and handed to a worker, see LB_RULES_FLAG_ASYNC
+	LB_COUNTER_QUEUE_FULL,		// Segments dropped because their worker's queue was full
+	LB_COUNTER_BATCHES,			// Batches the workers ran, QUEUED / BATCHES is the average batch size
+	LB_COUNTER_STREAM_CALLS,	// Calls to the stream classify function, compare with PACKETS for the per-segment path
+	LB_COUNTER_STREAM_WAITS,	// Stream calls that asked for more data before scanning
+	LB_COUNTER_STREAM_HELD,		// Bytes held back for a match that might continue in the next write
+	LB_COUNTER_COUNT
+};
+
+// Parts of a classify call that are timed
+enum LB_STAGE
+{
+	LB_STAGE_CLASSIFY = 0,		// The whole call
+	LB_STAGE_FIELDS,			// Reading the flow key from the incoming values
+	LB_STAGE_LOOKUP,			// Verdict cache and rule evaluation
+	LB_STAGE_WALK,				// Walking and copying the payload, without the match engine
+	LB_STAGE_MATCH,				// Match engine, finding and rewriting matches
+	LB_STAGE_INJECT,			// Sending a rewritten segment
+	LB_STAGE_QUEUE,				// Time an absorbed segment waited for its worker
+	LB_STAGE_STREAM,			// A whole stream classify call, the stream layer's counterpart of CLASSIFY
+	LB_STAGE_COUNT
+};
+
+// Histogram buckets are log-linear, four per power of two. Bucket i below 4 holds the value i, every
+// other bucket holds values from (4 + i % 4) << (i / 4 - 1) up to the next bucket. The last bucket
+// also holds everything from 2^32 cycles up.
+#define LB_HISTOGRAM_BUCKETS 128
+
+struct LB_STATS_SNAPSHOT
+{
+	UINT64 cyclesPerSecond;		// Measured since the driver loaded, turns histogram values into time
+	UINT32 sampleInterval;		// One in this many classify calls per processor is timed
+	UINT32 reserved;
+	UINT64 counters[LB_COUNTER_COUNT];
+	UINT64 histograms[LB_STAGE_COUNT][LB_HISTOGRAM_BUCKETS];	// Cycles
+};
@@ -0,0 +1,741 @@
+/*/
+/*  ** MatchEngine.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for building and running the Aho-Corasick match and replace engine.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Alfred V. Aho and Margaret J. Corasick, "Efficient String Matching: An Aid to
+/*		  Bibliographic Search", Communications of the ACM 18(6), 1975
+/*			* Original description of the goto/failure/output automaton built here.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "MatchEngine.h"
+#include "RegexEngine.h"
+#include "HashedEngine.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LB_PREFILTER_SSE2 1
+#endif
+
+/////////////////////
+// TABLE ACCESSORS //
+/////////////////////
+
+static inline UINT8* LbMatcherClasses(const LB_MATCHER* matcher)
+{
+	return (UINT8*)matcher + matcher->classOffset;
+}
+
+template <typename STATE>
+static inline STATE* LbMatcherTransitions(const LB_MATCHER* matcher)
+{
+	return (STATE*)((UINT8*)matcher + matcher->transitionOffset);
+}
+
+static inline UINT32* LbMatcherOutputs(const LB_MATCHER* matcher)
+{
+	return (UINT32*)((UINT8*)matcher + matcher->outputOffset);
+}
+
+static inline UINT32* LbMatcherDepths(const LB_MATCHER* matcher)
+{
+	return (UINT32*)((UINT8*)matcher + matcher->depthOffset);
+}
+
+static inline LB_MATCHER_PATTERN* LbMatcherPatterns(const LB_MATCHER* matcher)
+{
+	return (LB_MATCHER_PATTERN*)((UINT8*)matcher + matcher->patternOffset);
+}
+
+static inline SIZE_T LbAlignUp(SIZE_T value)
+{
+	return (value + 7) & ~(SIZE_T)7;
+}
+
+///////////////////////
+// AUTOMATON BUILDER //
+///////////////////////
+
+// Lays out an automaton of stateCount states in layout and returns the size of its block
+static SIZE_T LbMatcherLayout(LB_MATCHER* layout, SIZE_T stateCount, UINT32 classCount, UINT32 patternCount, SIZE_T stringBytes)
+{
+	SIZE_T stateWidth = stateCount <= 0x10000 ? sizeof(UINT16) : sizeof(UINT32);
+	SIZE_T classOffset = LbAlignUp(sizeof(LB_MATCHER));
+	SIZE_T transitionOffset = LbAlignUp(classOffset + 256);
+	SIZE_T outputOffset = LbAlignUp(transitionOffset + stateCount * classCount * stateWidth);
+	SIZE_T depthOffset = LbAlignUp(outputOffset + stateCount * sizeof(UINT32));
+	SIZE_T patternOffset = LbAlignUp(depthOffset + stateCount * sizeof(UINT32));
+	SIZE_T stringOffset = LbAlignUp(patternOffset + (SIZE_T)patternCount * sizeof(LB_MATCHER_PATTERN));
+
+	layout->stateCount = (UINT32)stateCount;
+	layout->patternCount = patternCount;
+	layout->classCount = classCount;
+	layout->stateWidth = (UINT32)stateWidth;
+	layout->classOffset = (UINT32)classOffset;
+	layout->transitionOffset = (UINT32)transitionOffset;
+	layout->outputOffset = (UINT32)outputOffset;
+	layout->depthOffset = (UINT32)depthOffset;
+	layout->patternOffset = (UINT32)patternOffset;
+	layout->stringOffset = (UINT32)stringOffset;
+
+	return stringOffset + stringBytes;
+}
+
+// Fill in the transitions, outputs and depths of an automaton from its trie. States are numbered breadth first
+// as they are reached, so the failure state of every state already has its row when the state's row is written:
+// it starts as a copy of that row, and the state's own edges are written over it.
+// Shallow states come first and share cache lines, the root's row and the rows of the few states scans pass
+// through between candidates stay hot.
+template <typename STATE>
+static void LbMatcherBuildRows(LB_MATCHER* matcher, const UINT32* child, const UINT32* sibling, const UINT8* label, const UINT32* output, UINT32* queue, UINT32* fail)
+{
+	STATE* transitions = LbMatcherTransitions<STATE>(matcher);
+	UINT32* outputs = LbMatcherOutputs(matcher);
+	UINT32* depths = LbMatcherDepths(matcher);
+	const UINT8* classes = LbMatcherClasses(matcher);
+	SIZE_T classCount = matcher->classCount;
+	UINT32 tail = 1;
+
+	queue[LB_MATCHER_ROOT_STATE] = LB_MATCHER_ROOT_STATE;
+	fail[LB_MATCHER_ROOT_STATE] = LB_MATCHER_ROOT_STATE;
+
+	for (UINT32 state = 0; state < matcher->stateCount; state++)
+	{
+		STATE* row = &transitions[state * classCount];
+		UINT32 node = queue[state];
+
+		// A state's output becomes the output of its failure state when it has none of its own,
+		// which is always the longest pattern ending there since failure states are shallower
+		outputs[state] = output[node] != 0 ? output[node] : outputs[fail[state]];
+
+		// Every byte leads the root back to itself unless a pattern starts with it
+		if (state != LB_MATCHER_ROOT_STATE)
+			memcpy(row, &transitions[fail[state] * classCount], classCount * sizeof(STATE));
+
+		// The failure state of a child is where the failure state of its parent goes on the same byte
+		for (UINT32 edge = child[node]; edge != 0; edge = sibling[edge])
+		{
+			UINT32 next = tail++;
+
+			queue[next] = edge;
+			fail[next] = row[classes[label[edge]]];
+			depths[next] = depths[state] + 1;
+			row[classes[label[edge]]] = (STATE)next;
+		}
+	}
+}
+
+NTSTATUS LbMatcherCompile(const LB_USERDATA* ud, LB_MATCHER** matcher)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	UINT32 patternCount = 0;
+	SIZE_T stringBytes = 0;
+	SIZE_T maxStates = 1;
+	SIZE_T minMatchLength = 0;
+	SIZE_T maxReplaceLength = 0;
+	BOOLEAN equalLength = TRUE;
+	UINT32 stateCount = 1;
+	UINT32* child = NULL;		// UINT32[maxStates], first edge out of every trie node, edges are kept in byte order
+	UINT32* sibling = NULL;		// UINT32[maxStates], next edge out of the same node. 0 ends both lists, it is the root.
+	UINT8* label = NULL;		// UINT8[maxStates], byte of the edge into every node
+	UINT32* output = NULL;		// UINT32[maxStates], index + 1 of the pattern every node spells, 0 if none
+	UINT32* queue = NULL;		// UINT32[maxStates], trie node of every state
+	UINT32* fail = NULL;		// UINT32[maxStates], failure state of every state
+	UINT8 classes[256] = { 0 };
+	UINT32 classCount = 1;
+	LB_MATCHER layout = { 0 };
+	LB_MATCHER* result = NULL;
+
+	if (ud == NULL || matcher == NULL || ud->count < 0 || (ud->count > 0 && ud->strArray == NULL))
+		return STATUS_INVALID_PARAMETER;
+
+	// Regular expressions get an engine of their own, without any pairs both engines are the same
+	if (ud->regex && ud->count > 0)
+		return LbRegexCompile(ud, matcher);
+
+	*matcher = NULL;
+
+	// Validate pairs and size every table up front
+	for (int i = 0; i < ud->count; i++)
+	{
+		const char* match = ud->strArray[i].match;
+		const char* replace = ud->strArray[i].replace;
+
+		if (match == NULL || replace == NULL || match[0] == '\0' || replace[0] == '\0')
+			return STATUS_INVALID_PARAMETER;
+
+		SIZE_T matchLength = strlen(match);
+		SIZE_T replaceLength = strlen(replace);
+
+		// Pairs that change the payload size need the copying rewrite path
+		if (matchLength != replaceLength)
+			equalLength = FALSE;
+
+		// Track the extremes in both directions to bound the rewrite output
+		SIZE_T shortest = matchLength;
+		SIZE_T longest = replaceLength;
+		if (ud->enableReversal && replaceLength < matchLength)
+			shortest = replaceLength;
+		if (ud->enableReversal && matchLength > replaceLength)
+			longest = matchLength;
+		if (minMatchLength == 0 || shortest < minMatchLength)
+			minMatchLength = shortest;
+		if (longest > maxReplaceLength)
+			maxReplaceLength = longest;
+
+		for (SIZE_T k = 0; k < matchLength; k++)
+			classes[(UINT8)match[k]] = 1;
+		for (SIZE_T k = 0; ud->enableReversal && k < replaceLength; k++)
+			classes[(UINT8)replace[k]] = 1;
+
+		patternCount += ud->enableReversal ? 2 : 1;
+		maxStates += ud->enableReversal ? matchLength + replaceLength : matchLength;
+		stringBytes += matchLength + replaceLength;
+	}
+
+	// An automaton for a dictionary this large would not stay in any cache, if it fit in memory at all
+	if (!ud->automaton && LbHashedPreferred(patternCount, maxStates, minMatchLength))
+		return LbHashedCompile(ud, matcher);
+
+	// A byte no pattern contains takes every state where the root takes it, a byte some pattern contains leads
+	// one state on to a state no other byte leads to. So the bytes that appear in the patterns each get a column
+	// of their own, and every other byte shares the first. No pattern contains byte 0, there are at most 256.
+	for (int c = 0; c < 256; c++)
+	{
+		if (classes[c])
+			classes[c] = (UINT8)classCount++;
+	}
+
+	// The patterns alone bound every table, a dictionary over the budget is turned away before any of them is allocated
+	if (ud->budget != 0 && LbMatcherLayout(&layout, maxStates, classCount, patternCount, stringBytes) + maxStates * (5 * sizeof(UINT32) + sizeof(UINT8)) > ud->budget)
+		return STATUS_QUOTA_EXCEEDED;
+
+	// Temporary build tables, the trie only takes an edge per node
+	child = (UINT32*)LbAlloc(maxStates * sizeof(UINT32), 'LBP2');
+	sibling = (UINT32*)LbAlloc(maxStates * sizeof(UINT32), 'LBP2');
+	label = (UINT8*)LbAlloc(maxStates, 'LBP2');
+	output = (UINT32*)LbAlloc(maxStates * sizeof(UINT32), 'LBP2');
+	queue = (UINT32*)LbAlloc(maxStates * sizeof(UINT32), 'LBP2');
+	fail = (UINT32*)LbAlloc(maxStates * sizeof(UINT32), 'LBP2');
+	if (!child || !sibling || !label || !output || !queue || !fail)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	// Insert every pattern into the trie
+	for (UINT32 p = 0; p < patternCount; p++)
+	{
+		const LB_MATCH_AND_REPLACE* pair = &ud->strArray[ud->enableReversal ? p / 2 : p];
+		const UINT8* pattern = (const UINT8*)((ud->enableReversal && (p & 1)) ? pair->replace : pair->match);
+		UINT32 state = LB_MATCHER_ROOT_STATE;
+
+		for (SIZE_T i = 0; pattern[i] != '\0'; i++)
+		{
+			UINT32* edge = &child[state];
+			while (*edge != 0 && label[*edge] < pattern[i])
+				edge = &sibling[*edge];
+
+			if (*edge == 0 || label[*edge] != pattern[i])
+			{
+				label[stateCount] = pattern[i];
+				sibling[stateCount] = *edge;
+				*edge = stateCount++;
+			}
+			state = *edge;
+		}
+
+		// The first pair to claim a string wins, duplicates are ignored
+		if (output[state] == 0)
+			output[state] = p + 1;
+	}
+
+	// Lay out the final flat block
+	{
+		SIZE_T size = LbMatcherLayout(&layout, stateCount, classCount, patternCount, stringBytes);
+
+		if (size > 0xFFFFFFFF)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto Exit;
+		}
+
+		result = (LB_MATCHER*)LbAlloc(size, 'LBP3');
+		if (!result)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto Exit;
+		}
+
+		*result = layout;
+		result->size = (UINT32)size;
+		result->equalLength = equalLength;
+		result->minMatchLength = (UINT32)minMatchLength;
+		result->maxReplaceLength = (UINT32)maxReplaceLength;
+
+		// Every edge leaving the root is a byte some pattern starts with
+		for (UINT32 edge = child[LB_MATCHER_ROOT_STATE]; edge != 0; edge = sibling[edge])
+		{
+			UINT8 c = label[edge];
+
+			if (result->firstByteCount < LB_PREFILTER_MAX_BYTES)
+				result->firstBytes[result->firstByteCount] = c;
+			result->firstByteCount++;
+			result->firstByteMap[c >> 3] |= (UINT8)(1 << (c & 7));
+		}
+
+		// One column per class
+		memcpy(LbMatcherClasses(result), classes, sizeof(classes));
+
+		if (result->stateWidth == sizeof(UINT16))
+			LbMatcherBuildRows<UINT16>(result, child, sibling, label, output, queue, fail);
+		else
+			LbMatcherBuildRows<UINT32>(result, child, sibling, label, output, queue, fail);
+
+		// Copy the strings, each pair is stored once and shared by both directions
+		LB_MATCHER_PATTERN* patterns = LbMatcherPatterns(result);
+		UINT32 cursor = (UINT32)result->stringOffset;
+
+		for (int i = 0; i < ud->count; i++)
+		{
+			UINT32 matchLength = (UINT32)strlen(ud->strArray[i].match);
+			UINT32 replaceLength = (UINT32)strlen(ud->strArray[i].replace);
+			UINT32 matchOffset = cursor;
+			UINT32 replaceOffset = cursor + matchLength;
+
+			memcpy((UINT8*)result + matchOffset, ud->strArray[i].match, matchLength);
+			memcpy((UINT8*)result + replaceOffset, ud->strArray[i].replace, replaceLength);
+			cursor += matchLength + replaceLength;
+
+			if (ud->enableReversal)
+			{
+				patterns[i * 2] = { matchOffset, matchLength, replaceOffset, replaceLength };
+				patterns[i * 2 + 1] = { replaceOffset, replaceLength, matchOffset, matchLength };
+			}
+			else
+			{
+				patterns[i] = { matchOffset, matchLength, replaceOffset, replaceLength };
+			}
+		}
+	}
+
+	*matcher = result;
+
+Exit:
+	if (child) LbFree(child, 'LBP2');
+	if (sibling) LbFree(sibling, 'LBP2');
+	if (label) LbFree(label, 'LBP2');
+	if (output) LbFree(output, 'LBP2');
+	if (queue) LbFree(queue, 'LBP2');
+	if (fail) LbFree(fail, 'LBP2');
+
+	return status;
+}
+
+void LbMatcherFree(LB_MATCHER* matcher)
+{
+	if (!matcher)
+		return;
+
+	if (matcher->regexCache) LbRegexCacheFree(matcher->regexCache);
+	LbFree(matcher, 'LBP3');
+}
+
+SIZE_T LbMatcherPendingLength(const LB_MATCHER* matcher, UINT32 state)
+{
+	if (matcher->engine == LB_MATCHER_ENGINE_REGEX)
+		return LbRegexPendingLength(matcher, state);
+	if (matcher->engine == LB_MATCHER_ENGINE_HASHED)
+		return LbHashedPendingLength(matcher, state);
+
+	// A state is the longest suffix of the data that begins some pattern, a match can only start there
+	return state < matcher->stateCount ? LbMatcherDepths(matcher)[state] : 0;
+}
+
+/////////////////
+// RULE IMAGES //
+/////////////////
+
+SIZE_T LbMatcherWriteImage(const LB_MATCHER* matcher, UINT8* image, SIZE_T offset, UINT32* matcherOffset)
+{
+	SIZE_T start = (offset + 63) & ~(SIZE_T)63;
+
+	// The state cache is the one pointer in the block, an image never carries it
+	if (image)
+	{
+		memcpy(image + start, matcher, matcher->size);
+		((LB_MATCHER*)(image + start))->regexCache = NULL;
+	}
+
+	*matcherOffset = (UINT32)start;
+	return start + matcher->size;
+}
+
+// count elements of elementSize bytes at offset lie inside a block of size bytes, after its header
+static inline BOOLEAN LbMatcherTableFits(SIZE_T size, UINT32 offset, SIZE_T count, SIZE_T elementSize)
+{
+	return (offset & 3) == 0 && offset >= sizeof(LB_MATCHER) && offset <= size && count <= (size - offset) / elementSize;
+}
+
+NTSTATUS LbMatcherBindImage(LB_MATCHER* matcher, SIZE_T size)
+{
+	if (matcher == NULL || size < sizeof(LB_MATCHER) || matcher->size < sizeof(LB_MATCHER) || matcher->size > size)
+		return STATUS_INVALID_PARAMETER;
+
+	size = matcher->size;
+
+	if (matcher->regexCache != NULL || matcher->firstByteCount > 256)
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->engine != LB_MATCHER_ENGINE_AUTOMATON && matcher->engine != LB_MATCHER_ENGINE_REGEX &&
+		matcher->engine != LB_MATCHER_ENGINE_HASHED)
+		return STATUS_INVALID_PARAMETER;
+
+	// Every engine shares the pairs. The copying rewrite sizes its output from the shortest match and the
+	// longest replacement, so a pair outside of those bounds could write past the end of it.
+	if (!LbMatcherTableFits(size, matcher->patternOffset, matcher->patternCount, sizeof(LB_MATCHER_PATTERN)))
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->patternCount > 0 && matcher->minMatchLength == 0)
+		return STATUS_INVALID_PARAMETER;
+
+	const LB_MATCHER_PATTERN* patterns = LbMatcherPatterns(matcher);
+	for (UINT32 p = 0; p < matcher->patternCount; p++)
+	{
+		const LB_MATCHER_PATTERN* pattern = &patterns[p];
+
+		if (pattern->matchOffset < matcher->stringOffset || pattern->matchOffset > size || pattern->matchLength > size - pattern->matchOffset)
+			return STATUS_INVALID_PARAMETER;
+		if (pattern->replaceOffset < matcher->stringOffset || pattern->replaceOffset > size || pattern->replaceLength > size - pattern->replaceOffset)
+			return STATUS_INVALID_PARAMETER;
+		if (pattern->replaceLength == 0 || pattern->replaceLength > matcher->maxReplaceLength)
+			return STATUS_INVALID_PARAMETER;
+		if (matcher->engine != LB_MATCHER_ENGINE_REGEX && pattern->matchLength < matcher->minMatchLength)
+			return STATUS_INVALID_PARAMETER;
+		if (matcher->equalLength && pattern->matchLength != pattern->replaceLength)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	if (matcher->engine == LB_MATCHER_ENGINE_REGEX)
+		return LbRegexBindImage(matcher);
+	if (matcher->engine == LB_MATCHER_ENGINE_HASHED)
+		return LbHashedBindImage(matcher);
+
+	// Every byte has to land in a column, every transition on a state, every output on a pattern
+	if (matcher->classCount == 0 || matcher->classCount > 256)
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->stateWidth != sizeof(UINT16) && matcher->stateWidth != sizeof(UINT32))
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->stateCount == 0 || matcher->stateCount > size / matcher->classCount / matcher->stateWidth ||
+		(matcher->stateWidth == sizeof(UINT16) && matcher->stateCount > 0x10000))
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->classOffset < sizeof(LB_MATCHER) || matcher->classOffset > size || size - matcher->classOffset < 256 ||
+		!LbMatcherTableFits(size, matcher->transitionOffset, (SIZE_T)matcher->stateCount * matcher->classCount, matcher->stateWidth) ||
+		!LbMatcherTableFits(size, matcher->outputOffset, matcher->stateCount, sizeof(UINT32)) ||
+		!LbMatcherTableFits(size, matcher->depthOffset, matcher->stateCount, sizeof(UINT32)))
+		return STATUS_INVALID_PARAMETER;
+
+	const UINT8* classes = LbMatcherClasses(matcher);
+	for (int c = 0; c < 256; c++)
+	{
+		if (classes[c] >= matcher->classCount)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	for (SIZE_T i = 0; i < (SIZE_T)matcher->stateCount * matcher->classCount; i++)
+	{
+		UINT32 next = matcher->stateWidth == sizeof(UINT16) ? LbMatcherTransitions<UINT16>(matcher)[i] : LbMatcherTransitions<UINT32>(matcher)[i];
+		if (next >= matcher->stateCount)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	const UINT32* outputs = LbMatcherOutputs(matcher);
+	for (UINT32 state = 0; state < matcher->stateCount; state++)
+	{
+		if (outputs[state] > matcher->patternCount)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+void LbMatcherUnbindImage(LB_MATCHER* matcher)
+{
+	if (matcher && matcher->regexCache)
+	{
+		LbRegexCacheFree(matcher->regexCache);
+		matcher->regexCache = NULL;
+	}
+}
+
+///////////////
+// PREFILTER //
+///////////////
+
+// While the automaton sits at the root every other byte loops back to the root, so skipping them is exact.
+// Only SSE2 is used: it is always available on x64 and is safe in kernel mode without
+// saving extended processor state, which wider AVX2 registers would require.
+SIZE_T LbMatcherNextCandidate(const LB_MATCHER* matcher, const UINT8* data, SIZE_T start, SIZE_T length)
+{
+	SIZE_T i = start;
+
+	if (matcher->firstByteCount == 0)
+		return length;
+
+#if defined(LB_PREFILTER_SSE2)
+	if (matcher->firstByteCount <= LB_PREFILTER_MAX_BYTES)
+	{
+		__m128i needles[LB_PREFILTER_MAX_BYTES];
+		UINT32 count = matcher->firstByteCount;
+
+		for (UINT32 n = 0; n < count; n++)
+			needles[n] = _mm_set1_epi8((char)matcher->firstBytes[n]);
+
+		// Test 16 bytes at a time against every possible first byte
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i chunk = _mm_loadu_si128((const __m128i*)&data[i]);
+			__m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+
+			for (UINT32 n = 1; n < count; n++)
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[n]));
+
+			UINT32 mask = (UINT32)_mm_movemask_epi8(hits);
+			if (mask != 0)
+			{
+#if defined(_MSC_VER)
+				unsigned long bit;
+				_BitScanForward(&bit, mask);
+				return i + bit;
+#else
+				return i + (SIZE_T)__builtin_ctz(mask);
+#endif
+			}
+		}
+	}
+#endif
+
+	// Scalar fallback and tail, one bitmap test per byte
+	for (; i < length; i++)
+	{
+		if (matcher->firstByteMap[data[i] >> 3] & (1 << (data[i] & 7)))
+			return i;
+	}
+
+	return length;
+}
+
+/////////////////////
+// MATCH & REPLACE //
+/////////////////////
+
+void LbMatcherSpansAdd(LB_MATCHER_SPANS* spans, UINT8* data, SIZE_T length, SIZE_T offset)
+{
+	if (length == 0)
+		return;
+
+	if (spans->count == LB_MATCHER_MAX_SPANS)
+	{
+		memmove(&spans->data[0], &spans->data[1], (LB_MATCHER_MAX_SPANS - 1) * sizeof(spans->data[0]));
+		memmove(&spans->length[0], &spans->length[1], (LB_MATCHER_MAX_SPANS - 1) * sizeof(spans->length[0]));
+		memmove(&spans->offset[0], &spans->offset[1], (LB_MATCHER_MAX_SPANS - 1) * sizeof(spans->offset[0]));
+		spans->count--;
+	}
+
+	spans->data[spans->count] = data;
+	spans->length[spans->count] = length;
+	spans->offset[spans->count] = offset;
+	spans->count++;
+}
+
+BOOLEAN LbMatcherWriteReplacement(const LB_MATCHER_SPANS* spans, UINT8* data, SIZE_T end, const UINT8* replacement, SIZE_T matchLength, LB_CHECKSUM_EDITS* edits)
+{
+	SIZE_T before = matchLength > end ? matchLength - end : 0;	// Bytes of the match in earlier buffers
+	SIZE_T available = 0;
+	UINT32 first = spans ? spans->count : 0;
+
+	// Find the earliest buffer the match reaches back into, all of it has to be there before anything is written
+	while (available < before && first > 0)
+		available += spans->length[--first];
+	if (available < before)
+		return FALSE;
+
+	if (before > 0)
+	{
+		SIZE_T base = edits ? edits->base : 0;
+		SIZE_T at = available - before;
+		SIZE_T written = 0;
+
+		for (UINT32 n = first; n < spans->count; n++)
+		{
+			SIZE_T part = spans->length[n] - at;
+
+			if (edits)
+			{
+				edits->base = spans->offset[n];
+				LbChecksumEdit(edits, at, &spans->data[n][at], replacement + written, part);
+			}
+			memcpy(&spans->data[n][at], replacement + written, part);
+			written += part;
+			at = 0;
+		}
+
+		if (edits) edits->base = base;
+	}
+
+	SIZE_T start = end - (matchLength - before);
+	if (edits)
+		LbChecksumEdit(edits, start, &data[start], replacement + before, matchLength - before);
+	memcpy(&data[start], replacement + before, matchLength - before);
+
+	return TRUE;
+}
+
+// LbMatcherReplace over the automaton, for either width of its states
+template <typename STATE>
+static UINT32 LbMatcherReplaceStates(const LB_MATCHER* matcher, UINT32* state, UINT8* data, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits)
+{
+	const STATE* transitions = LbMatcherTransitions<STATE>(matcher);
+	const UINT8* classes = LbMatcherClasses(matcher);
+	const UINT32 classCount = matcher->classCount;
+	const UINT32* outputs = LbMatcherOutputs(matcher);
+	const LB_MATCHER_PATTERN* patterns = LbMatcherPatterns(matcher);
+	UINT32 current = *state;
+	UINT32 replacements = 0;
+
+	for (SIZE_T i = 0; i < length; i++)
+	{
+		// Nearly all traffic never leaves the root, jump straight to the next byte that could start a match
+		if (current == LB_MATCHER_ROOT_STATE)
+		{
+			i = LbMatcherNextCandidate(matcher, data, i, length);
+			if (i == length)
+				break;
+		}
+
+		current = transitions[(SIZE_T)current * classCount + classes[data[i]]];
+
+		UINT32 out = outputs[current];
+		if (out == 0)
+			continue;
+
+		// Rewrite the match in place, reaching back into the earlier buffers of the segment when it began there
+		const LB_MATCHER_PATTERN* pattern = &patterns[out - 1];
+		if (pattern->matchLength != pattern->replaceLength)
+			continue;
+
+		if (LbMatcherWriteReplacement(spans, data, i + 1, (const UINT8*)matcher + pattern->replaceOffset, pattern->matchLength, edits))
+			replacements++;
+
+		// Matches never overlap, continue from the root after one, even one whose start was already gone
+		current = LB_MATCHER_ROOT_STATE;
+	}
+
+	*state = current;
+	return replacements;
+}
+
+UINT32 LbMatcherReplace(const LB_MATCHER* matcher, UINT32* state, UINT8* data, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits)
+{
+	// Neither of these reports a match that began before data, they have no use for the earlier buffers
+	if (matcher->engine == LB_MATCHER_ENGINE_REGEX)
+		return LbRegexReplace(matcher, state, data, length, edits);
+	if (matcher->engine == LB_MATCHER_ENGINE_HASHED)
+		return LbHashedReplace(matcher, state, data, length, edits);
+
+	if (matcher->stateWidth == sizeof(UINT16))
+		return LbMatcherReplaceStates<UINT16>(matcher, state, data, length, spans, edits);
+
+	return LbMatcherReplaceStates<UINT32>(matcher, state, data, length, spans, edits);
+}
+
+//////////////////////////
+// LENGTH CHANGING COPY //
+//////////////////////////
+
+SIZE_T LbMatcherRewriteBound(const LB_MATCHER* matcher, SIZE_T length)
+{
+	if (matcher->patternCount == 0 || matcher->maxReplaceLength <= matcher->minMatchLength)
+		return length;
+
+	// Worst case every match is as short as possible and grows as much as possible
+	return length + (length / matcher->minMatchLength) * (matcher->maxReplaceLength - matcher->minMatchLength);
+}
+
+// LbMatcherRewrite over the automaton, for either width of its states
+template <typename STATE>
+static UINT32 LbMatcherRewriteStates(const LB_MATCHER* matcher, UINT32* state, const UINT8* data, SIZE_T length, UINT8* output, SIZE_T* outputLength)
+{
+	const STATE* transitions = LbMatcherTransitions<STATE>(matcher);
+	const UINT8* classes = LbMatcherClasses(matcher);
+	const UINT32 classCount = matcher->classCount;
+	const UINT32* outputs = LbMatcherOutputs(matcher);
+	const LB_MATCHER_PATTERN* patterns = LbMatcherPatterns(matcher);
+	UINT32 current = *state;
+	UINT32 replacements = 0;
+	SIZE_T copied = 0;		// Input bytes already written to output
+	SIZE_T written = 0;
+
+	for (SIZE_T i = 0; i < length; i++)
+	{
+		if (current == LB_MATCHER_ROOT_STATE)
+		{
+			i = LbMatcherNextCandidate(matcher, data, i, length);
+			if (i == length)
+				break;
+		}
+
+		current = transitions[(SIZE_T)current * classCount + classes[data[i]]];
+
+		UINT32 out = outputs[current];
+		if (out == 0)
+			continue;
+
+		const LB_MATCHER_PATTERN* pattern = &patterns[out - 1];
+		SIZE_T end = i + 1;
+
+		// The start of this match is already gone, leave it as it is
+		if (pattern->matchLength > end - copied)
+		{
+			current = LB_MATCHER_ROOT_STATE;
+			continue;
+		}
+
+		// Copy everything up to the match, then the replacement instead of the match
+		SIZE_T start = end - pattern->matchLength;
+		memcpy(&output[written], &data[copied], start - copied);
+		written += start - copied;
+		memcpy(&output[written], (const UINT8*)matcher + pattern->replaceOffset, pattern->replaceLength);
+		written += pattern->replaceLength;
+		copied = end;
+		replacements++;
+
+		current = LB_MATCHER_ROOT_STATE;
+	}
+
+	// Rest of the buffer is unchanged
+	memcpy(&output[written], &data[copied], length - copied);
+	written += length - copied;
+
+	*state = current;
+	*outputLength = written;
+	return replacements;
+}
+
+UINT32 LbMatcherRewrite(const LB_MATCHER* matcher, UINT32* state, const UINT8* data, SIZE_T length, UINT8* output, SIZE_T* outputLength)
+{
+	if (matcher->engine == LB_MATCHER_ENGINE_REGEX)
+		return LbRegexRewrite(matcher, state, data, length, output, outputLength);
+	if (matcher->engine == LB_MATCHER_ENGINE_HASHED)
+		return LbHashedRewrite(matcher, state, data, length, output, outputLength);
+
+	if (matcher->stateWidth == sizeof(UINT16))
+		return LbMatcherRewriteStates<UINT16>(matcher, state, data, length, output, outputLength);
+
+	return LbMatcherRewriteStates<UINT32>(matcher, state, data, length, output, outputLength);
+}
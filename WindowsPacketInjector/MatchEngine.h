@@ -0,0 +1,223 @@
+/*/
+/*  ** MatchEngine.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the multi-pattern match and replace engine used by the injection callout.
+/*	All match/replace pairs are compiled once into a single Aho-Corasick automaton so that a payload
+/*	can be rewritten in one linear pass, no matter how many pairs are configured.
+/*	The automaton lives in nonpaged pool and is read for every inspected byte, so it is kept small: bytes every
+/*	state moves on alike share one column of the transition table, states are 16 bits wide whenever they fit
+/*	and numbered breadth first, which keeps the shallow states nearly all traffic stays in on a few cache lines.
+/*	When the pairs are regular expressions the same functions run the lazy DFA of RegexEngine.cpp instead,
+/*	and dictionaries too large for an automaton run the hashed engine of HashedEngine.cpp.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Alfred V. Aho and Margaret J. Corasick, "Efficient String Matching: An Aid to
+/*		  Bibliographic Search", Communications of the ACM 18(6), 1975
+/*			* Original description of the goto/failure/output automaton built here.
+/*		- RE2, https://github.com/google/re2
+/*			* Byte map of the DFA: bytes no state tells apart share one column of the transition table.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Checksum.h"
+
+/////////////////////////////
+// CUSTOM USERDATA STRUCTS //
+/////////////////////////////
+
+struct LB_MATCH_AND_REPLACE
+{
+	char* match;
+	char* replace;
+};
+
+struct LB_USERDATA
+{
+	int count;
+	bool enableReversal = false;
+	bool regex = false;			// Every match string is a regular expression, see LB_RULES_FLAG_REGEX
+	LB_MATCH_AND_REPLACE* strArray;
+	bool automaton = false;		// Build the automaton however large the dictionary, to compare it with the hashed engine
+	SIZE_T budget = 0;			// Most bytes of pool the compile may take, temporary tables included. 0 sets no limit.
+};
+
+////////////////////////
+// COMPILED AUTOMATON //
+////////////////////////
+
+// One pattern of the automaton, offsets are relative to the start of the LB_MATCHER block
+struct LB_MATCHER_PATTERN
+{
+	UINT32 matchOffset;
+	UINT32 matchLength;
+	UINT32 replaceOffset;
+	UINT32 replaceLength;
+};
+
+// Largest first byte set the vectorized prefilter compares against directly,
+// bigger sets fall back to a bitmap lookup per byte
+#define LB_PREFILTER_MAX_BYTES 8
+
+enum LB_MATCHER_ENGINE : UINT32
+{
+	LB_MATCHER_ENGINE_AUTOMATON = 0,	// Literal pairs, Aho-Corasick
+	LB_MATCHER_ENGINE_REGEX,			// Regular expressions, lazily built DFA
+	LB_MATCHER_ENGINE_HASHED,			// Large literal dictionaries, hashed shift table and Bloom filter
+};
+
+struct LB_REGEX_CACHE;
+
+// The automaton is a single flat allocation with no pointers inside of it.
+// Every table is found through an offset from the start of the block.
+// The only exception is the regex engine's state cache, which keeps growing after compilation.
+struct LB_MATCHER
+{
+	UINT32 size;				// Total size of the block in bytes
+	UINT32 engine;				// LB_MATCHER_ENGINE
+	UINT32 stateCount;
+	UINT32 patternCount;
+	UINT32 equalLength;			// Non-zero when every replacement is as long as its match
+	UINT32 minMatchLength;
+	UINT32 maxReplaceLength;
+	UINT32 firstByteCount;		// Number of distinct bytes any pattern can start with
+	UINT8 firstBytes[LB_PREFILTER_MAX_BYTES];	// Only filled when firstByteCount <= LB_PREFILTER_MAX_BYTES
+	UINT8 firstByteMap[32];		// Bitmap of every byte any pattern can start with
+	UINT32 classCount;			// Columns of the transition table, 256 when every byte has its own
+	UINT32 stateWidth;			// Bytes of one transition, 2 for UINT16 states and 4 for UINT32 ones
+	UINT32 classOffset;			// UINT8[256], the column of every byte
+	UINT32 transitionOffset;	// [stateCount][classCount] states of stateWidth bytes, full DFA (failure links already resolved)
+	UINT32 outputOffset;		// UINT32[stateCount], index + 1 of the longest pattern ending in a state, 0 if none
+	UINT32 depthOffset;			// UINT32[stateCount], length of the pattern prefix a state stands for
+	UINT32 patternOffset;		// LB_MATCHER_PATTERN[patternCount]
+	UINT32 stringOffset;		// Raw bytes of all match and replace strings
+
+	// Regex engine only
+	UINT32 regexNodeCount;
+	UINT32 regexNodeOffset;		// LB_REGEX_NODE[regexNodeCount]
+	UINT32 regexClassOffset;	// UINT8[][32], byte sets of the NFA
+	UINT32 regexPatternOffset;	// LB_REGEX_PATTERN[patternCount]
+
+	// Hashed engine only
+	UINT32 hashWindowLength;	// Bytes of every pattern hashed, up to the shortest pattern
+	UINT32 hashGramLength;		// Bytes the shift table is indexed by
+	UINT32 hashShiftBits;
+	UINT32 hashShiftOffset;		// UINT8[1 << hashShiftBits], how far the window can move by the gram at its end
+	UINT32 hashBloomBits;
+	UINT32 hashBloomOffset;		// UINT64[1 << (hashBloomBits - 6)], Bloom filter of every window
+	UINT32 hashBucketBits;
+	UINT32 hashBucketOffset;	// UINT32[(1 << hashBucketBits) + 1], range of hashEntryOffset each window hash owns
+	UINT32 hashEntryOffset;		// UINT32[patternCount], patterns by bucket, shortest first
+
+	LB_REGEX_CACHE* regexCache;
+};
+
+// State every scan starts from
+#define LB_MATCHER_ROOT_STATE 0
+
+// Most earlier buffers of one segment an in place scan can reach back into
+#define LB_MATCHER_MAX_SPANS 8
+
+// Buffers of the current segment a scan went through before the one it is in, oldest first. A match that began
+// in one of them is only rewritten once it completes, and then whole. One that began before them, in a segment
+// that may already be on its way, is left as it is like LbMatcherRewrite leaves it.
+struct LB_MATCHER_SPANS
+{
+	UINT32 count;
+	UINT8* data[LB_MATCHER_MAX_SPANS];
+	SIZE_T length[LB_MATCHER_MAX_SPANS];
+	SIZE_T offset[LB_MATCHER_MAX_SPANS];	// Of each buffer in the segment, the base of its checksum edits
+};
+
+// Forget the buffers of the previous segment
+inline void LbMatcherSpansBegin(LB_MATCHER_SPANS* spans)
+{
+	spans->count = 0;
+}
+
+// Add a buffer that was just scanned, offset bytes into its segment. The oldest one goes once there is no room.
+void LbMatcherSpansAdd(LB_MATCHER_SPANS* spans, UINT8* data, SIZE_T length, SIZE_T offset);
+
+// Write replacement over the last matchLength bytes scanned, the ones before data[end] and as many as needed
+// from the end of spans. Writes nothing and returns FALSE unless every one of them is still there.
+// Each part is recorded in edits first, unless it is NULL.
+BOOLEAN LbMatcherWriteReplacement(
+	const LB_MATCHER_SPANS* spans,
+	UINT8* data,
+	SIZE_T end,
+	const UINT8* replacement,
+	SIZE_T matchLength,
+	LB_CHECKSUM_EDITS* edits
+);
+
+// Build an automaton from a match/replace list.
+// When ud->enableReversal is set every pair is added a second time in the reverse direction.
+// When ud->regex is set the match strings are compiled as regular expressions.
+// Literal pairs an automaton would need too many states for are built into the hashed engine, see LbHashedPreferred,
+// unless ud->automaton is set.
+// Returns STATUS_QUOTA_EXCEEDED, before allocating anything, when the patterns could take more than ud->budget.
+NTSTATUS LbMatcherCompile(const LB_USERDATA* ud, LB_MATCHER** matcher);
+
+// Free an automaton returned by LbMatcherCompile
+void LbMatcherFree(LB_MATCHER* matcher);
+
+// Copy an automaton into a rule image from offset on, aligned to a cache line, and store where it went in
+// matcherOffset. With image NULL nothing is written. Returns the offset after it.
+SIZE_T LbMatcherWriteImage(const LB_MATCHER* matcher, UINT8* image, SIZE_T offset, UINT32* matcherOffset);
+
+// Make an automaton copied out of a rule image ready to scan where it is. Nothing in it is trusted: every offset,
+// state and pattern must stay inside the size bytes it may take up, and the bounds the copying rewrite sizes
+// its output by must hold. A regex automaton gets its state cache.
+NTSTATUS LbMatcherBindImage(LB_MATCHER* matcher, SIZE_T size);
+
+// Release what LbMatcherBindImage added, the automaton itself belongs to the image
+void LbMatcherUnbindImage(LB_MATCHER* matcher);
+
+// Scan a buffer and rewrite every match in place, the zero-copy path for equal length pairs.
+// state carries the automaton position in and out so a scan can be continued in the next buffer, spans holds
+// the buffers of the same segment before this one (NULL when there are none). A match is only ever rewritten
+// whole, see LB_MATCHER_SPANS. Matches whose replacement has a different length are left untouched, use
+// LbMatcherRewrite for those. Every rewrite is recorded in edits first, unless it is NULL.
+// Returns the number of replacements made.
+UINT32 LbMatcherReplace(
+	const LB_MATCHER* matcher,
+	UINT32* state,
+	UINT8* data,
+	SIZE_T length,
+	const LB_MATCHER_SPANS* spans,
+	LB_CHECKSUM_EDITS* edits
+);
+
+// LbMatcherReplace specialized for one matcher built at compile time, see StaticMatcher.h
+typedef UINT32(LbMatcherReplaceCallback)(UINT32* state, UINT8* data, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits);
+
+// Bytes of a match still in progress that a scan stopping in state has already seen, 0 when none is.
+// A regex state does not record where its match began, while one is in progress this returns (SIZE_T)-1.
+// A hashed state is the number of bytes at the end of the last buffer that could still begin a match.
+SIZE_T LbMatcherPendingLength(const LB_MATCHER* matcher, UINT32 state);
+
+// Offset of the first byte at or after start that can begin a match, or length if there is none
+SIZE_T LbMatcherNextCandidate(const LB_MATCHER* matcher, const UINT8* data, SIZE_T start, SIZE_T length);
+
+// Largest output LbMatcherRewrite can produce for an input of the given length
+SIZE_T LbMatcherRewriteBound(const LB_MATCHER* matcher, SIZE_T length);
+
+// Copy a buffer into output while rewriting every match, replacements may change the length.
+// A match that started in an earlier buffer is left alone since those bytes were already sent.
+// output must hold at least LbMatcherRewriteBound(matcher, length) bytes.
+// Returns the number of replacements made, the size of the result is stored in outputLength.
+UINT32 LbMatcherRewrite(
+	const LB_MATCHER* matcher,
+	UINT32* state,
+	const UINT8* data,
+	SIZE_T length,
+	UINT8* output,
+	SIZE_T* outputLength
+);
@@ -0,0 +1,397 @@
+/*/
+/*  ** PacketInjector.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for building and injecting rewritten packets.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Microsoft, Windows-Driver-Samples, https://github.com/microsoft/Windows-driver-samples/
+/*			* The WFP inspect and ddproxy samples show how packets are cloned, injected and completed.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "PacketInjector.h"
+#include "Slab.h"
+#include "EventLog.h"
+
+/////////////
+// GLOBALS //
+/////////////
+
+static HANDLE lbInjectionHandle = NULL;
+static HANDLE lbStreamInjectionHandle = NULL;
+static NDIS_HANDLE lbNdisGenericObject = NULL;
+static NDIS_HANDLE lbNetBufferListPool = NULL;
+
+// Segment buffers are large, recycle them instead of going to the pool for every packet.
+// Each processor only keeps a few since every one is close to 64KB.
+static LB_SLAB* lbPacketSlab = NULL;
+
+////////////////////
+// INITIALIZATION //
+////////////////////
+
+NTSTATUS LbInjectorInitialize()
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	NET_BUFFER_LIST_POOL_PARAMETERS poolParameters = { 0 };
+
+	status = FwpsInjectionHandleCreate(AF_INET, FWPS_INJECTION_TYPE_TRANSPORT, &lbInjectionHandle);
+	if (!NT_SUCCESS(status)) goto Exit;
+	status = FwpsInjectionHandleCreate(AF_UNSPEC, FWPS_INJECTION_TYPE_STREAM, &lbStreamInjectionHandle);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	lbNdisGenericObject = NdisAllocateGenericObject(NULL, 'LBI1', 0);
+	if (!lbNdisGenericObject)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	poolParameters.Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+	poolParameters.Header.Revision = NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1;
+	poolParameters.Header.Size = NDIS_SIZEOF_NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1;
+	poolParameters.fAllocateNetBuffer = TRUE;
+	poolParameters.DataSize = 0;
+	poolParameters.PoolTag = 'LBI2';
+	lbNetBufferListPool = NdisAllocateNetBufferListPool(lbNdisGenericObject, &poolParameters);
+	if (!lbNetBufferListPool)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	status = LbSlabCreate(sizeof(LB_INJECT_PACKET), 4, 'LBI0', &lbPacketSlab);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+Exit:
+	if (!NT_SUCCESS(status))
+	{
+		LBPRINTLN("Failed to initialize packet injection, STATUS CODE: 0x%08x", status);
+		LbInjectorCleanup();
+	}
+
+	return status;
+}
+
+void LbInjectorCleanup()
+{
+	// Pending injections complete before the handle is destroyed, so the pools are idle afterwards
+	if (lbInjectionHandle)
+	{
+		FwpsInjectionHandleDestroy(lbInjectionHandle);
+		lbInjectionHandle = NULL;
+	}
+
+	if (lbStreamInjectionHandle)
+	{
+		FwpsInjectionHandleDestroy(lbStreamInjectionHandle);
+		lbStreamInjectionHandle = NULL;
+	}
+
+	if (lbPacketSlab)
+	{
+		LbSlabDestroy(lbPacketSlab);
+		lbPacketSlab = NULL;
+	}
+
+	if (lbNetBufferListPool)
+	{
+		NdisFreeNetBufferListPool(lbNetBufferListPool);
+		lbNetBufferListPool = NULL;
+	}
+
+	if (lbNdisGenericObject)
+	{
+		NdisFreeGenericObject((PNDIS_GENERIC_OBJECT)lbNdisGenericObject);
+		lbNdisGenericObject = NULL;
+	}
+}
+
+/////////////
+// BUFFERS //
+/////////////
+
+BOOLEAN LbInjectorIsOwnPacket(const NET_BUFFER_LIST* netBufferList)
+{
+	FWPS_PACKET_INJECTION_STATE state = FwpsQueryPacketInjectionState(lbInjectionHandle, netBufferList, NULL);
+
+	return state == FWPS_PACKET_INJECTED_BY_SELF || state == FWPS_PACKET_PREVIOUSLY_INJECTED_BY_SELF;
+}
+
+LB_INJECT_PACKET* LbInjectorAllocatePacket()
+{
+	LB_INJECT_PACKET* packet = (LB_INJECT_PACKET*)LbSlabAlloc(lbPacketSlab);
+	if (!packet)
+		return NULL;
+
+	packet->mdl = NULL;
+	packet->netBufferList = NULL;
+	packet->length = 0;
+	return packet;
+}
+
+void LbInjectorFreePacket(LB_INJECT_PACKET* packet)
+{
+	if (packet->netBufferList) FwpsFreeNetBufferList(packet->netBufferList);
+	if (packet->mdl) IoFreeMdl(packet->mdl);
+
+	LbSlabFree(lbPacketSlab, packet);
+}
+
+//////////////////////////
+// COMPLETION CALLBACKS //
+//////////////////////////
+
+static void LbSendComplete(void* context, NET_BUFFER_LIST* netBufferList, BOOLEAN dispatchLevel)
+{
+	LB_INJECT_PACKET* packet = (LB_INJECT_PACKET*)context;
+
+	UNREFERENCED_PARAMETER(dispatchLevel);
+
+	if (!NT_SUCCESS(netBufferList->Status)) LBEVENT(LB_LEVEL_WARNING, LB_EVENT_INJECT_COMPLETED, (UINT32)netBufferList->Status);
+
+	LbInjectorFreePacket(packet);
+}
+
+static void LbReceiveComplete(void* context, NET_BUFFER_LIST* netBufferList, BOOLEAN dispatchLevel)
+{
+	UNREFERENCED_PARAMETER(context);
+	UNREFERENCED_PARAMETER(dispatchLevel);
+
+	FwpsFreeCloneNetBufferList(netBufferList, 0);
+}
+
+///////////////
+// INJECTION //
+///////////////
+
+NTSTATUS LbInjectorWrapPacket(LB_INJECT_PACKET* packet)
+{
+	packet->mdl = IoAllocateMdl(packet->data, packet->length, FALSE, FALSE, NULL);
+	if (!packet->mdl)
+		return STATUS_INSUFFICIENT_RESOURCES;
+	MmBuildMdlForNonPagedPool(packet->mdl);
+
+	return FwpsAllocateNetBufferAndNetBufferList(lbNetBufferListPool, 0, 0, packet->mdl, 0, packet->length, &packet->netBufferList);
+}
+
+NTSTATUS LbInjectorSendTransportV4(LB_INJECT_PACKET* packet, UINT32 remoteAddress, const FWPS_INCOMING_METADATA_VALUES* inMetaValues)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	FWPS_TRANSPORT_SEND_PARAMS sendParams = { 0 };
+	COMPARTMENT_ID compartmentId = UNSPECIFIED_COMPARTMENT_ID;
+
+	// The stack needs the endpoint to send on behalf of
+	if (!FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_TRANSPORT_ENDPOINT_HANDLE))
+	{
+		status = STATUS_NOT_SUPPORTED;
+		goto Exit;
+	}
+
+	if (FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_COMPARTMENT_ID))
+		compartmentId = (COMPARTMENT_ID)inMetaValues->compartmentId;
+
+	status = LbInjectorWrapPacket(packet);
+	if (!NT_SUCCESS(status)) goto Exit;
+
+	packet->remoteAddress = RtlUlongByteSwap(remoteAddress);
+	sendParams.remoteAddress = (UCHAR*)&packet->remoteAddress;
+	if (FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_TRANSPORT_CONTROL_DATA))
+	{
+		sendParams.controlData = (WSACMSGHDR*)inMetaValues->controlData;
+		sendParams.controlDataLength = inMetaValues->controlDataLength;
+	}
+
+	status = FwpsInjectTransportSendAsync(
+		lbInjectionHandle,
+		NULL,
+		inMetaValues->transportEndpointHandle,
+		0,
+		&sendParams,
+		AF_INET,
+		compartmentId,
+		packet->netBufferList,
+		LbSendComplete,
+		packet);
+
+Exit:
+	// On success the completion routine frees the packet
+	if (!NT_SUCCESS(status))
+	{
+		LBEVENT(LB_LEVEL_WARNING, LB_EVENT_INJECT_FAILED, (UINT32)status);
+		LbInjectorFreePacket(packet);
+	}
+
+	return status;
+}
+
+NTSTATUS LbInjectorSendStream(LB_INJECT_PACKET* packet, UINT64 flowId, UINT32 calloutId, UINT16 layerId, UINT32 streamFlags)
+{
+	NTSTATUS status = LbInjectorWrapPacket(packet);
+
+	// Injected stream data only passes the sublayers below this driver's, it never comes back to the callout
+	if (NT_SUCCESS(status))
+		status = FwpsStreamInjectAsync(
+			lbStreamInjectionHandle,
+			NULL,
+			0,
+			flowId,
+			calloutId,
+			layerId,
+			streamFlags,
+			packet->netBufferList,
+			packet->length,
+			LbSendComplete,
+			packet);
+
+	// On success the completion routine frees the packet
+	if (!NT_SUCCESS(status))
+	{
+		LBEVENT(LB_LEVEL_WARNING, LB_EVENT_INJECT_FAILED, (UINT32)status);
+		LbInjectorFreePacket(packet);
+	}
+
+	return status;
+}
+
+NTSTATUS LbInjectorCloneInbound(NET_BUFFER_LIST* netBufferList, const FWPS_INCOMING_METADATA_VALUES* inMetaValues, NET_BUFFER_LIST** clone, UINT8** headerData)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG headerSize = 0;
+	NET_BUFFER* netBuffer = NET_BUFFER_LIST_FIRST_NB(netBufferList);
+
+	*clone = NULL;
+	*headerData = NULL;
+
+	if (!FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_IP_HEADER_SIZE) ||
+		!FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_TRANSPORT_HEADER_SIZE))
+		return STATUS_NOT_SUPPORTED;
+
+	// At the inbound transport layer the data starts after the transport header, step back over both headers
+	headerSize = inMetaValues->ipHeaderSize + inMetaValues->transportHeaderSize;
+	status = NdisRetreatNetBufferDataStart(netBuffer, headerSize, 0, NULL);
+	if (status != NDIS_STATUS_SUCCESS)
+		return STATUS_UNSUCCESSFUL;
+
+	status = FwpsAllocateCloneNetBufferList(netBufferList, NULL, NULL, 0, clone);
+
+	// The original must be handed back exactly as it came in
+	NdisAdvanceNetBufferDataStart(netBuffer, headerSize, FALSE, NULL);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	// Headers are only edited when they sit in one piece
+	*headerData = (UINT8*)NdisGetDataBuffer(NET_BUFFER_LIST_FIRST_NB(*clone), headerSize, NULL, 1, 0);
+	if (!*headerData)
+	{
+		FwpsFreeCloneNetBufferList(*clone, 0);
+		*clone = NULL;
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS LbInjectorReceiveTransportV4(NET_BUFFER_LIST* clone, const FWPS_INCOMING_VALUES* inFixedValues, const FWPS_INCOMING_METADATA_VALUES* inMetaValues)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	COMPARTMENT_ID compartmentId = UNSPECIFIED_COMPARTMENT_ID;
+
+	if (FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_COMPARTMENT_ID))
+		compartmentId = (COMPARTMENT_ID)inMetaValues->compartmentId;
+
+	status = FwpsInjectTransportReceiveAsync(
+		lbInjectionHandle,
+		NULL,
+		NULL,
+		0,
+		AF_INET,
+		compartmentId,
+		inFixedValues->incomingValue[FWPS_FIELD_INBOUND_TRANSPORT_V4_INTERFACE_INDEX].value.uint32,
+		inFixedValues->incomingValue[FWPS_FIELD_INBOUND_TRANSPORT_V4_SUB_INTERFACE_INDEX].value.uint32,
+		clone,
+		LbReceiveComplete,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		LBEVENT(LB_LEVEL_WARNING, LB_EVENT_INJECT_FAILED, (UINT32)status);
+		FwpsFreeCloneNetBufferList(clone, 0);
+	}
+
+	return status;
+}
+
+//////////////////////
+// DEFERRED SENDING //
+//////////////////////
+
+NTSTATUS LbInjectorCaptureTarget(UINT32 remoteAddress, const FWPS_INCOMING_METADATA_VALUES* inMetaValues, LB_INJECT_TARGET* target)
+{
+	RtlZeroMemory(target, sizeof(LB_INJECT_TARGET));
+
+	if (!FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_TRANSPORT_ENDPOINT_HANDLE))
+		return STATUS_NOT_SUPPORTED;
+
+	target->endpointHandle = inMetaValues->transportEndpointHandle;
+	target->compartmentId = UNSPECIFIED_COMPARTMENT_ID;
+	target->remoteAddress = RtlUlongByteSwap(remoteAddress);
+
+	if (FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_COMPARTMENT_ID))
+		target->compartmentId = (COMPARTMENT_ID)inMetaValues->compartmentId;
+
+	// The metadata's control data is gone once the classify returns
+	if (FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, FWPS_METADATA_FIELD_TRANSPORT_CONTROL_DATA) &&
+		inMetaValues->controlData != NULL && inMetaValues->controlDataLength > 0)
+	{
+		target->controlData = (WSACMSGHDR*)LbAlloc(inMetaValues->controlDataLength, 'LBI3');
+		if (!target->controlData)
+			return STATUS_INSUFFICIENT_RESOURCES;
+
+		RtlCopyMemory(target->controlData, inMetaValues->controlData, inMetaValues->controlDataLength);
+		target->controlDataLength = inMetaValues->controlDataLength;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+void LbInjectorReleaseTarget(LB_INJECT_TARGET* target)
+{
+	if (target->controlData)
+	{
+		LbFree(target->controlData, 'LBI3');
+		target->controlData = NULL;
+		target->controlDataLength = 0;
+	}
+}
+
+NTSTATUS LbInjectorSendTargetV4(NET_BUFFER_LIST* netBufferList, LB_INJECT_TARGET* target, FWPS_INJECT_COMPLETE* completionFn, void* context)
+{
+	FWPS_TRANSPORT_SEND_PARAMS sendParams = { 0 };
+
+	sendParams.remoteAddress = (UCHAR*)&target->remoteAddress;
+	sendParams.controlData = target->controlData;
+	sendParams.controlDataLength = target->controlDataLength;
+
+	NTSTATUS status = FwpsInjectTransportSendAsync(
+		lbInjectionHandle,
+		NULL,
+		target->endpointHandle,
+		0,
+		&sendParams,
+		AF_INET,
+		target->compartmentId,
+		netBufferList,
+		completionFn,
+		context);
+
+	if (!NT_SUCCESS(status)) LBEVENT(LB_LEVEL_WARNING, LB_EVENT_INJECT_FAILED, (UINT32)status);
+
+	return status;
+}
@@ -0,0 +1,121 @@
+/*/
+/*  ** PacketInjector.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for building and injecting rewritten packets.
+/*	A rewrite that changes the size of a payload cannot happen inside the original net buffer,
+/*	so the new segment is built in a pooled buffer, wrapped in a fresh net buffer list and injected
+/*	while the original packet is absorbed.
+/*	Segments inspected by a worker thread are sent the same way, after their classify returned, to a target
+/*	captured while it ran. Either way the injection handle marks them so the callout lets them pass.
+/*	Rewritten stream data is injected into its flow at the stream layer instead, TCP cuts it into segments itself.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Microsoft, Windows-Driver-Samples, https://github.com/microsoft/Windows-driver-samples/
+/*			* The WFP inspect and ddproxy samples show how packets are cloned, injected and completed.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Driver.h"
+
+// Largest transport segment that still fits an IPv4 packet with the largest possible IP header
+#define LB_INJECT_MAX_SEGMENT (0xFFFF - 60)
+
+// One pooled buffer, everything an injected segment needs until its send completes
+struct LB_INJECT_PACKET
+{
+	PMDL mdl;
+	NET_BUFFER_LIST* netBufferList;
+	UINT32 remoteAddress;		// Network byte order, the send reads it asynchronously
+	ULONG length;				// Bytes of data in use
+	UINT8 data[LB_INJECT_MAX_SEGMENT];
+};
+
+// Where an absorbed outbound segment was headed, everything a send needs once the classify metadata is gone
+struct LB_INJECT_TARGET
+{
+	UINT64 endpointHandle;
+	COMPARTMENT_ID compartmentId;
+	UINT32 remoteAddress;		// Network byte order, the send reads it asynchronously
+	ULONG controlDataLength;
+	WSACMSGHDR* controlData;	// Copy owned by the target, NULL without control data
+};
+
+// Create the injection handle and buffer pools, call before the callouts are registered
+NTSTATUS LbInjectorInitialize();
+
+// Destroy the injection handle and pools, call after the callouts are unregistered
+void LbInjectorCleanup();
+
+// True for packets this driver injected, they must be permitted untouched or they would be rewritten twice
+BOOLEAN LbInjectorIsOwnPacket(const NET_BUFFER_LIST* netBufferList);
+
+// Take a buffer from the pool, returns NULL when none can be allocated
+LB_INJECT_PACKET* LbInjectorAllocatePacket();
+
+// Return a buffer that was never handed to LbInjectorSendTransportV4
+void LbInjectorFreePacket(LB_INJECT_PACKET* packet);
+
+// Send packet->data as the next transport segment of the outbound flow being classified.
+// remoteAddress is in host byte order. The packet belongs to the injector afterwards, even on failure.
+NTSTATUS LbInjectorSendTransportV4(
+	LB_INJECT_PACKET* packet,
+	UINT32 remoteAddress,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues
+);
+
+// Send packet->data as the next packet->length bytes of the outgoing stream being classified at layerId, in place
+// of the stream data the classify blocks. streamFlags are those of the data it replaces. The packet belongs to
+// the injector afterwards, even on failure.
+NTSTATUS LbInjectorSendStream(
+	LB_INJECT_PACKET* packet,
+	UINT64 flowId,
+	UINT32 calloutId,
+	UINT16 layerId,
+	UINT32 streamFlags
+);
+
+// Fill in a target from the metadata of the classify that absorbs a segment. remoteAddress is in host byte order.
+NTSTATUS LbInjectorCaptureTarget(
+	UINT32 remoteAddress,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	LB_INJECT_TARGET* target
+);
+
+// Free what LbInjectorCaptureTarget copied
+void LbInjectorReleaseTarget(LB_INJECT_TARGET* target);
+
+// Describe packet->length bytes of packet->data with packet->netBufferList, freed along with the packet
+NTSTATUS LbInjectorWrapPacket(LB_INJECT_PACKET* packet);
+
+// Send a net buffer list as the next transport segment towards target, outside of any classify.
+// completionFn gets context and the list once the send is done, target must stay valid until then.
+// On failure completionFn is never called and everything still belongs to the caller.
+NTSTATUS LbInjectorSendTargetV4(
+	NET_BUFFER_LIST* netBufferList,
+	LB_INJECT_TARGET* target,
+	FWPS_INJECT_COMPLETE* completionFn,
+	void* context
+);
+
+// Clone an inbound transport packet with its IP and transport headers in front of the data,
+// headerData receives a pointer to the start of the IP header inside the clone
+NTSTATUS LbInjectorCloneInbound(
+	NET_BUFFER_LIST* netBufferList,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+	NET_BUFFER_LIST** clone,
+	UINT8** headerData
+);
+
+// Receive inject a clone made by LbInjectorCloneInbound. The clone belongs to the injector afterwards, even on failure.
+NTSTATUS LbInjectorReceiveTransportV4(
+	NET_BUFFER_LIST* clone,
+	const FWPS_INCOMING_VALUES* inFixedValues,
+	const FWPS_INCOMING_METADATA_VALUES* inMetaValues
+);
@@ -0,0 +1,328 @@
+/*/
+/*  ** Platform.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the small set of types and helpers shared by the portable packet processing code.
+/*	Files that include this header instead of Driver.h build both inside the driver and as
+/*	ordinary user mode code (Windows or Linux), which lets them be exercised outside of a VM.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#if defined(_KERNEL_MODE)
+
+#include <ntddk.h>
+
+#elif defined(_WIN32)
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+#include <winternl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef int32_t LONG;
+typedef int64_t LONG64;
+typedef uint32_t ULONG;
+typedef size_t SIZE_T;
+typedef unsigned char BOOLEAN;
+typedef LONG NTSTATUS;
+
+#define TRUE 1
+#define FALSE 0
+
+#define STATUS_SUCCESS					((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL				((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER		((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES	((NTSTATUS)0xC000009AL)
+#define STATUS_DATA_ERROR				((NTSTATUS)0xC000003EL)
+#define STATUS_QUOTA_EXCEEDED			((NTSTATUS)0xC0000044L)
+
+#define UNREFERENCED_PARAMETER(P) (void)(P)
+#define DECLSPEC_ALIGN(x) __attribute__((aligned(x)))
+#define FIELD_OFFSET(type, field) offsetof(type, field)
+
+#endif
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#endif
+
+// SAL annotations only exist in the Microsoft toolchain
+#ifndef _In_
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#endif
+
+////////////////
+// ALLOCATION //
+////////////////
+
+// All portable code allocates through these so the pool tag is kept in the driver build.
+// Memory returned by LbAlloc is always zeroed (ExAllocatePool2 zeroes by default) and,
+// outside of the Win32 user mode build, starts on a cache line.
+
+inline void* LbAlloc(SIZE_T size, UINT32 tag)
+{
+#if defined(_KERNEL_MODE)
+	return ExAllocatePool2(POOL_FLAG_NON_PAGED | POOL_FLAG_CACHE_ALIGNED, size, tag);
+#elif defined(_WIN32)
+	UNREFERENCED_PARAMETER(tag);
+	return calloc(1, size);
+#else
+	// Cache line aligned like the driver's allocations, so aligned structures stay aligned
+	UNREFERENCED_PARAMETER(tag);
+	void* ptr = aligned_alloc(64, (size + 63) & ~(SIZE_T)63);
+	if (ptr) memset(ptr, 0, size);
+	return ptr;
+#endif
+}
+
+inline void LbFree(void* ptr, UINT32 tag)
+{
+#if defined(_KERNEL_MODE)
+	ExFreePool2(ptr, tag, NULL, NULL);
+#else
+	UNREFERENCED_PARAMETER(tag);
+	free(ptr);
+#endif
+}
+
+/////////////
+// ATOMICS //
+/////////////
+
+// Thin wrappers so portable code can use the Interlocked family on every platform
+
+inline LONG LbInterlockedCompareExchange(volatile LONG* target, LONG exchange, LONG comparand)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return InterlockedCompareExchange(target, exchange, comparand);
+#else
+	__atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+#endif
+}
+
+inline LONG LbInterlockedIncrement(volatile LONG* target)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return InterlockedIncrement(target);
+#else
+	return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline LONG LbInterlockedAdd(volatile LONG* target, LONG value)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return InterlockedAdd(target, value);
+#else
+	return __atomic_add_fetch(target, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline void* LbInterlockedExchangePointer(void* volatile* target, void* value)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return InterlockedExchangePointer(target, value);
+#else
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline void* LbInterlockedCompareExchangePointer(void* volatile* target, void* exchange, void* comparand)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return InterlockedCompareExchangePointer(target, exchange, comparand);
+#else
+	__atomic_compare_exchange_n(target, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+#endif
+}
+
+inline LONG LbReadAcquire(const volatile LONG* source)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return ReadAcquire(source);
+#else
+	return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline void* LbReadPointerAcquire(void* const volatile* source)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return ReadPointerAcquire((PVOID const volatile*)source);
+#else
+	return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline void LbWriteRelease(volatile LONG* target, LONG value)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	WriteRelease(target, value);
+#else
+	__atomic_store_n(target, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// Tells the processor the caller is spinning on a lock
+inline void LbSpinPause()
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#endif
+}
+
+// Gives up the rest of the caller's time slice, for waits that can outlast it. PASSIVE_LEVEL only.
+inline void LbYield()
+{
+#if defined(_KERNEL_MODE)
+	LARGE_INTEGER interval;
+	interval.QuadPart = 0;
+	KeDelayExecutionThread(KernelMode, FALSE, &interval);
+#elif defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+// Orders the plain reads before it against the acquire read after it (seqlock readers)
+inline void LbReadBarrier()
+{
+#if defined(_KERNEL_MODE)
+	KeMemoryBarrier();
+#elif defined(_WIN32)
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+//////////////
+// PREFETCH //
+//////////////
+
+// Hint that the cache line holding address will be read soon, never faults
+inline void LbPrefetch(const void* address)
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, address);
+#else
+	__builtin_prefetch(address);
+#endif
+}
+
+////////////////
+// PROCESSORS //
+////////////////
+
+// Number of processors per-processor data has to be sized for
+inline UINT32 LbProcessorCount()
+{
+#if defined(_KERNEL_MODE)
+	return KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#elif defined(_WIN32)
+	return GetMaximumProcessorCount(ALL_PROCESSOR_GROUPS);
+#else
+	long count = sysconf(_SC_NPROCESSORS_CONF);
+	return count > 0 ? (UINT32)count : 1;
+#endif
+}
+
+// Index of the processor the caller is running on, always below LbProcessorCount().
+// Outside of DISPATCH_LEVEL the caller may move to another processor right after this returns.
+inline UINT32 LbCurrentProcessor()
+{
+#if defined(_KERNEL_MODE)
+	return KeGetCurrentProcessorNumberEx(NULL);
+#elif defined(_WIN32)
+	PROCESSOR_NUMBER number;
+	GetCurrentProcessorNumberEx(&number);
+	return ((UINT32)number.Group * 64 + number.Number) % LbProcessorCount();
+#else
+	int cpu = sched_getcpu();
+	return cpu > 0 ? (UINT32)cpu % LbProcessorCount() : 0;
+#endif
+}
+
+//////////
+// TIME //
+//////////
+
+// Monotonic timestamp in ticks of LbTimestampFrequency(), callable at any IRQL
+inline UINT64 LbTimestamp()
+{
+#if defined(_KERNEL_MODE)
+	return (UINT64)KeQueryPerformanceCounter(NULL).QuadPart;
+#elif defined(_WIN32)
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (UINT64)counter.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (UINT64)now.tv_sec * 1000000000ull + (UINT64)now.tv_nsec;
+#endif
+}
+
+inline UINT64 LbTimestampFrequency()
+{
+#if defined(_KERNEL_MODE)
+	LARGE_INTEGER frequency;
+	KeQueryPerformanceCounter(&frequency);
+	return (UINT64)frequency.QuadPart;
+#elif defined(_WIN32)
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return (UINT64)frequency.QuadPart;
+#else
+	return 1000000000ull;
+#endif
+}
+
+// Processor cycle counter. Much cheaper and finer than LbTimestamp, but only meaningful as a difference
+// taken on one processor. Targets without one fall back to LbTimestamp.
+inline UINT64 LbCycles()
+{
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	return ReadTimeStampCounter();
+#elif defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return LbTimestamp();
+#endif
+}
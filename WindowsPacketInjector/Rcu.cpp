@@ -0,0 +1,57 @@
+/*/
+/*  ** Rcu.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains definitions for publishing a pointer that readers follow without locks and retiring what it
+/*	pointed to after a grace period.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "Rcu.h"
+
+////////////////
+// PUBLISHING //
+////////////////
+
+void LbRcuInitialize(LB_RCU* rcu, void* value, LbRcuBarrierCallback* barrier, void* barrierContext)
+{
+	rcu->value = value;
+	rcu->barrier = barrier;
+	rcu->barrierContext = barrierContext;
+	rcu->gracePeriods = 0;
+}
+
+void LbRcuPublish(LB_RCU* rcu, void* value, LbRcuRetireCallback* retire, void* retireContext)
+{
+	// A full barrier: readers that start after this see value, the barrier below waits out the rest
+	void* previous = LbInterlockedExchangePointer(&rcu->value, value);
+
+	if (previous == NULL)
+		return;
+
+	rcu->barrier(rcu->barrierContext);
+	rcu->gracePeriods++;
+	retire(previous, retireContext);
+}
+
+//////////////////////
+// THREADED READERS //
+//////////////////////
+
+void LbRcuWaitReaders(void* context)
+{
+	LB_RCU_READERS* readers = (LB_RCU_READERS*)context;
+
+	// The exchange before this ordered the new value against every count read here. A reader seen outside
+	// of a section, or in a later one, started after the exchange and cannot hold the previous value.
+	for (UINT32 r = 0; r < readers->count; r++)
+	{
+		LONG seen = LbReadAcquire(&readers->readers[r].section);
+		while ((seen & 1) && LbReadAcquire(&readers->readers[r].section) == seen)
+			LbYield();
+	}
+}
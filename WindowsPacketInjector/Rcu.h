@@ -0,0 +1,79 @@
+/*/
+/*  ** Rcu.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for publishing a pointer that readers follow without locks, read-copy-update style.
+/*	A new value replaces the old one as a whole, and the old one is retired only after a grace period: once
+/*	every reader that could have seen it has left its read section. Readers never take a lock.
+/*	What a read section is, and so how a grace period is waited out, is up to the barrier the pointer is
+/*	given. In the driver a reader is a classify at DISPATCH_LEVEL and the barrier a DPC on every processor.
+/*	Threads that can be preempted mark their sections in an LB_RCU_READER and LbRcuWaitReaders waits on them.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+// Returns once every reader that was inside a read section when it was called has left it
+typedef void(LbRcuBarrierCallback)(void* context);
+
+// Frees a value no reader can reach any more
+typedef void(LbRcuRetireCallback)(void* value, void* context);
+
+struct LB_RCU
+{
+	void* volatile value;
+	LbRcuBarrierCallback* barrier;
+	void* barrierContext;
+	UINT64 gracePeriods;		// Barriers waited out, one per value retired
+};
+
+// Start with value, which may be NULL
+void LbRcuInitialize(LB_RCU* rcu, void* value, LbRcuBarrierCallback* barrier, void* barrierContext);
+
+// The current value, only valid until the caller's read section ends
+inline void* LbRcuRead(LB_RCU* rcu)
+{
+	return LbReadPointerAcquire(&rcu->value);
+}
+
+// Publish value and hand the previous one, if there was one, to retire once no reader can still hold it.
+// Waits for the grace period, so never call it from a read section. Writers must not publish concurrently.
+void LbRcuPublish(LB_RCU* rcu, void* value, LbRcuRetireCallback* retire, void* retireContext);
+
+//////////////////////
+// THREADED READERS //
+//////////////////////
+
+// Read sections of one thread, the count is odd while it is inside one. One cache line each.
+struct DECLSPEC_ALIGN(64) LB_RCU_READER
+{
+	volatile LONG section;
+};
+
+// Every reader LbRcuWaitReaders waits on
+struct LB_RCU_READERS
+{
+	LB_RCU_READER* readers;
+	UINT32 count;
+};
+
+// Both are full barriers, the value cannot be read before the section starts or used after it ends
+inline void LbRcuReadBegin(LB_RCU_READER* reader)
+{
+	LbInterlockedIncrement(&reader->section);
+}
+
+inline void LbRcuReadEnd(LB_RCU_READER* reader)
+{
+	LbInterlockedIncrement(&reader->section);
+}
+
+// LbRcuBarrierCallback over an LB_RCU_READERS. A reader inside a section is waited for until it leaves
+// that one, not until it is outside of every section, so readers that keep reading never hold it up.
+void LbRcuWaitReaders(void* context);
@@ -0,0 +1,1478 @@
+/*/
+/*  ** RegexEngine.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for compiling and running the lazily built regex DFA.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Ken Thompson, "Regular Expression Search Algorithm", Communications of the ACM 11(6), 1968
+/*			* Construction of the NFA from the parsed pattern.
+/*		- Russ Cox, "Regular Expression Matching in the Wild", https://swtch.com/~rsc/regexp/regexp3.html
+/*			* DFA states built on demand from NFA state sets, kept in a bounded cache.
+/*			* Finding the start of a match by running the reversed pattern backwards from its end.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "RegexEngine.h"
+
+////////////////
+// STRUCTURES //
+////////////////
+
+// Cached state ids that are not states
+#define LB_REGEX_DEAD		0xFFFFFFFE		// No thread left, anchored and reversed scans stop here
+#define LB_REGEX_UNCACHED	0xFFFFFFFD		// The cache was full, the position only exists as a set
+
+#define LB_REGEX_REPEAT_INFINITE 0xFFFF
+#define LB_REGEX_NONE 0xFFFFFFFF
+
+// Shared by every processor. States are only ever added, so a state id stays valid as long as the rule set
+// and a reader never has to lock: everything about a state is written before its id is published.
+struct LB_REGEX_CACHE
+{
+	volatile LONG lock;			// Held while a state is added
+	volatile LONG stateCount;
+	UINT32 capacity;
+	UINT32 words;				// UINT64 words of one NFA state set
+	UINT32 bucketMask;
+	UINT32 midlineState;		// Unanchored start after a byte that did not end a line, LB_MATCHER_ROOT_STATE after one that did
+	volatile LONG* transitions;	// [capacity][256], next state + 1, 0 until the transition is first taken
+	UINT64* sets;				// [capacity][words], NFA states behind a state. Bit 0 marks unanchored scans.
+	UINT32* accept;				// [capacity], index + 1 of the first pattern a state completes, 0 if none
+	volatile LONG* buckets;		// [bucketMask + 1], state + 1 of a hash table over sets, 0 if empty
+};
+
+// A scan position: a cached state, or a set of NFA states when the cache had no room for it
+struct LB_REGEX_CURSOR
+{
+	UINT32 state;
+	UINT64 set[LB_REGEX_SET_WORDS];
+};
+
+// Where the scan of one buffer stands
+struct LB_REGEX_SCAN
+{
+	LB_REGEX_CURSOR cursor;
+	SIZE_T position;			// Next byte to read
+	SIZE_T low;					// No match can start before this
+	BOOLEAN lowKnown;			// FALSE while a match could still have started in an earlier buffer
+	BOOLEAN lowLineStart;		// The byte before the buffer ended a line
+};
+
+/////////////////////
+// TABLE ACCESSORS //
+/////////////////////
+
+static inline const LB_REGEX_NODE* LbRegexNodes(const LB_MATCHER* matcher)
+{
+	return (const LB_REGEX_NODE*)((const UINT8*)matcher + matcher->regexNodeOffset);
+}
+
+static inline const UINT8* LbRegexClasses(const LB_MATCHER* matcher)
+{
+	return (const UINT8*)matcher + matcher->regexClassOffset;
+}
+
+static inline LB_REGEX_PATTERN* LbRegexPatterns(const LB_MATCHER* matcher)
+{
+	return (LB_REGEX_PATTERN*)((UINT8*)matcher + matcher->regexPatternOffset);
+}
+
+static inline const LB_MATCHER_PATTERN* LbRegexPairs(const LB_MATCHER* matcher)
+{
+	return (const LB_MATCHER_PATTERN*)((const UINT8*)matcher + matcher->patternOffset);
+}
+
+static inline SIZE_T LbAlignUp(SIZE_T value)
+{
+	return (value + 7) & ~(SIZE_T)7;
+}
+
+static inline void LbByteSetAdd(UINT8* set, UINT32 first, UINT32 last)
+{
+	for (UINT32 c = first; c <= last; c++)
+		set[c >> 3] |= (UINT8)(1 << (c & 7));
+}
+
+static inline BOOLEAN LbByteSetHas(const UINT8* set, UINT8 c)
+{
+	return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static inline BOOLEAN LbNodeSetHas(const UINT64* set, UINT32 node)
+{
+	return (set[node >> 6] >> (node & 63)) & 1;
+}
+
+static inline void LbNodeSetAdd(UINT64* set, UINT32 node)
+{
+	set[node >> 6] |= 1ull << (node & 63);
+}
+
+static inline UINT32 LbLowestBit(UINT64 bits)
+{
+#if defined(_MSC_VER)
+	unsigned long bit;
+	_BitScanForward64(&bit, bits);
+	return bit;
+#else
+	return (UINT32)__builtin_ctzll(bits);
+#endif
+}
+
+////////////
+// PARSER //
+////////////
+
+enum LB_REGEX_AST_TYPE : UINT8
+{
+	LB_REGEX_AST_CLASS = 0,
+	LB_REGEX_AST_CONCAT,		// Children one after the other, no children is the empty string
+	LB_REGEX_AST_ALTERNATE,		// Any one of the children
+	LB_REGEX_AST_REPEAT,		// first repeated min to max times
+};
+
+// Parse tree node. Children of a concatenation or alternation are a list from first to last,
+// so a long string of literals does not turn into deep recursion later on.
+struct LB_REGEX_AST
+{
+	UINT8 type;					// LB_REGEX_AST_TYPE
+	UINT16 min;
+	UINT16 max;
+	UINT32 first;
+	UINT32 last;
+	UINT32 next;
+	UINT32 prev;
+	UINT8 bytes[32];			// Byte set of a class
+};
+
+struct LB_REGEX_PARSER
+{
+	const UINT8* cursor;
+	LB_REGEX_AST* nodes;
+	UINT32 count;
+	UINT32 capacity;
+	BOOLEAN failed;
+};
+
+static UINT32 LbRegexParseAlternation(LB_REGEX_PARSER* parser, UINT32 depth);
+
+static UINT32 LbRegexNewAst(LB_REGEX_PARSER* parser, UINT8 type)
+{
+	if (parser->count == parser->capacity)
+	{
+		parser->failed = TRUE;
+		return LB_REGEX_NONE;
+	}
+
+	LB_REGEX_AST* ast = &parser->nodes[parser->count];
+	memset(ast, 0, sizeof(LB_REGEX_AST));
+	ast->type = type;
+	ast->first = ast->last = ast->next = ast->prev = LB_REGEX_NONE;
+
+	return parser->count++;
+}
+
+static void LbRegexAppend(LB_REGEX_PARSER* parser, UINT32 list, UINT32 child)
+{
+	LB_REGEX_AST* parent = &parser->nodes[list];
+
+	parser->nodes[child].prev = parent->last;
+	if (parent->last != LB_REGEX_NONE)
+		parser->nodes[parent->last].next = child;
+	else
+		parent->first = child;
+	parent->last = child;
+}
+
+static int LbRegexHexDigit(UINT8 c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Parses the escape after a backslash and adds what it stands for to set.
+// Returns the byte of an escape that stands for one byte, -1 for a class like \d and -2 when it is invalid.
+static int LbRegexParseEscape(LB_REGEX_PARSER* parser, UINT8* set)
+{
+	UINT8 c = *parser->cursor;
+	UINT8 shorthand[32] = { 0 };
+	int value = c;
+
+	if (c == '\0')
+		return -2;
+	parser->cursor++;
+
+	switch (c)
+	{
+	case 'd':
+	case 'D':
+		LbByteSetAdd(shorthand, '0', '9');
+		break;
+	case 'w':
+	case 'W':
+		LbByteSetAdd(shorthand, '0', '9');
+		LbByteSetAdd(shorthand, 'a', 'z');
+		LbByteSetAdd(shorthand, 'A', 'Z');
+		LbByteSetAdd(shorthand, '_', '_');
+		break;
+	case 's':
+	case 'S':
+		LbByteSetAdd(shorthand, ' ', ' ');
+		LbByteSetAdd(shorthand, '\t', '\r');
+		break;
+	case 'n': value = '\n'; break;
+	case 'r': value = '\r'; break;
+	case 't': value = '\t'; break;
+	case 'f': value = '\f'; break;
+	case 'v': value = '\v'; break;
+	case 'x':
+	{
+		int high = LbRegexHexDigit(parser->cursor[0]);
+		int low = high < 0 ? -1 : LbRegexHexDigit(parser->cursor[1]);
+		if (low < 0)
+			return -2;
+		parser->cursor += 2;
+		value = high * 16 + low;
+		break;
+	}
+	default:
+		// Escaping punctuation makes it literal, other letters and digits are reserved
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+			return -2;
+		break;
+	}
+
+	if (c == 'd' || c == 'w' || c == 's' || c == 'D' || c == 'W' || c == 'S')
+	{
+		BOOLEAN negate = c == 'D' || c == 'W' || c == 'S';
+		for (int i = 0; i < 32; i++)
+			set[i] |= negate ? (UINT8)~shorthand[i] : shorthand[i];
+		return -1;
+	}
+
+	LbByteSetAdd(set, (UINT32)value, (UINT32)value);
+	return value;
+}
+
+// [abc], [a-z], [^\r\n], the cursor is right after the opening bracket
+static UINT32 LbRegexParseClass(LB_REGEX_PARSER* parser)
+{
+	UINT32 index = LbRegexNewAst(parser, LB_REGEX_AST_CLASS);
+	UINT8 set[32] = { 0 };
+	BOOLEAN negate = FALSE;
+	BOOLEAN first = TRUE;
+
+	if (index == LB_REGEX_NONE)
+		return index;
+
+	if (*parser->cursor == '^')
+	{
+		negate = TRUE;
+		parser->cursor++;
+	}
+
+	// A ] right after the opening bracket is a literal
+	while (first || *parser->cursor != ']')
+	{
+		int low;
+		first = FALSE;
+
+		if (*parser->cursor == '\0')
+		{
+			parser->failed = TRUE;
+			return LB_REGEX_NONE;
+		}
+
+		if (*parser->cursor == '\\')
+		{
+			parser->cursor++;
+			low = LbRegexParseEscape(parser, set);
+		}
+		else
+		{
+			low = *parser->cursor++;
+			LbByteSetAdd(set, (UINT32)low, (UINT32)low);
+		}
+
+		if (low == -2)
+		{
+			parser->failed = TRUE;
+			return LB_REGEX_NONE;
+		}
+
+		// A range needs a single byte on both ends, a - before the closing bracket is a literal
+		if (low >= 0 && parser->cursor[0] == '-' && parser->cursor[1] != ']' && parser->cursor[1] != '\0')
+		{
+			UINT8 scratch[32] = { 0 };
+			int high;
+
+			parser->cursor++;
+			if (*parser->cursor == '\\')
+			{
+				parser->cursor++;
+				high = LbRegexParseEscape(parser, scratch);
+			}
+			else
+			{
+				high = *parser->cursor++;
+			}
+
+			if (high < low)
+			{
+				parser->failed = TRUE;
+				return LB_REGEX_NONE;
+			}
+
+			LbByteSetAdd(set, (UINT32)low, (UINT32)high);
+		}
+	}
+	parser->cursor++;
+
+	for (int i = 0; i < 32; i++)
+		parser->nodes[index].bytes[i] = negate ? (UINT8)~set[i] : set[i];
+
+	return index;
+}
+
+static UINT32 LbRegexParseAtom(LB_REGEX_PARSER* parser, UINT32 depth)
+{
+	UINT8 c = *parser->cursor;
+	UINT32 index = LB_REGEX_NONE;
+
+	switch (c)
+	{
+	case '(':
+		if (depth >= LB_REGEX_MAX_DEPTH)
+			break;
+
+		// Every group is non-capturing, (?:x) is accepted as well
+		parser->cursor++;
+		if (parser->cursor[0] == '?' && parser->cursor[1] == ':')
+			parser->cursor += 2;
+
+		index = LbRegexParseAlternation(parser, depth + 1);
+		if (parser->failed || *parser->cursor != ')')
+			break;
+
+		parser->cursor++;
+		return index;
+
+	case '[':
+		parser->cursor++;
+		return LbRegexParseClass(parser);
+
+	case '.':
+		// Any byte but the end of a line, so .* never runs past the line it started on
+		index = LbRegexNewAst(parser, LB_REGEX_AST_CLASS);
+		if (index == LB_REGEX_NONE)
+			return index;
+
+		LbByteSetAdd(parser->nodes[index].bytes, 0, '\n' - 1);
+		LbByteSetAdd(parser->nodes[index].bytes, '\n' + 1, 255);
+		parser->cursor++;
+		return index;
+
+	case '\\':
+		parser->cursor++;
+		index = LbRegexNewAst(parser, LB_REGEX_AST_CLASS);
+		if (index == LB_REGEX_NONE)
+			return index;
+
+		if (LbRegexParseEscape(parser, parser->nodes[index].bytes) == -2)
+			break;
+		return index;
+
+	// ^ is only valid at the start of a pattern and $ not at all, quantifiers need something to repeat
+	case '^':
+	case '$':
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		break;
+
+	default:
+		index = LbRegexNewAst(parser, LB_REGEX_AST_CLASS);
+		if (index == LB_REGEX_NONE)
+			return index;
+
+		LbByteSetAdd(parser->nodes[index].bytes, c, c);
+		parser->cursor++;
+		return index;
+	}
+
+	parser->failed = TRUE;
+	return LB_REGEX_NONE;
+}
+
+static BOOLEAN LbRegexParseCount(LB_REGEX_PARSER* parser, UINT32* value)
+{
+	UINT32 result = 0;
+
+	if (*parser->cursor < '0' || *parser->cursor > '9')
+		return FALSE;
+
+	while (*parser->cursor >= '0' && *parser->cursor <= '9')
+	{
+		result = result * 10 + (*parser->cursor++ - '0');
+		if (result > LB_REGEX_MAX_REPEAT)
+			return FALSE;
+	}
+
+	*value = result;
+	return TRUE;
+}
+
+static UINT32 LbRegexParseRepeat(LB_REGEX_PARSER* parser, UINT32 depth)
+{
+	UINT32 atom = LbRegexParseAtom(parser, depth);
+	UINT32 min = 0;
+	UINT32 max = 0;
+
+	if (parser->failed)
+		return LB_REGEX_NONE;
+
+	switch (*parser->cursor)
+	{
+	case '*': min = 0; max = LB_REGEX_REPEAT_INFINITE; parser->cursor++; break;
+	case '+': min = 1; max = LB_REGEX_REPEAT_INFINITE; parser->cursor++; break;
+	case '?': min = 0; max = 1; parser->cursor++; break;
+	case '{':
+		parser->cursor++;
+		if (!LbRegexParseCount(parser, &min))
+			goto Invalid;
+
+		max = min;
+		if (*parser->cursor == ',')
+		{
+			parser->cursor++;
+			max = LB_REGEX_REPEAT_INFINITE;
+			if (*parser->cursor != '}' && (!LbRegexParseCount(parser, &max) || max < min))
+				goto Invalid;
+		}
+
+		if (*parser->cursor != '}')
+			goto Invalid;
+		parser->cursor++;
+		break;
+	default:
+		return atom;
+	}
+
+	// One quantifier per atom, x** would only nest repetitions for nothing
+	switch (*parser->cursor)
+	{
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		goto Invalid;
+	}
+
+	{
+		UINT32 index = LbRegexNewAst(parser, LB_REGEX_AST_REPEAT);
+		if (index == LB_REGEX_NONE)
+			return index;
+
+		parser->nodes[index].first = parser->nodes[index].last = atom;
+		parser->nodes[index].min = (UINT16)min;
+		parser->nodes[index].max = (UINT16)max;
+		return index;
+	}
+
+Invalid:
+	parser->failed = TRUE;
+	return LB_REGEX_NONE;
+}
+
+static UINT32 LbRegexParseConcat(LB_REGEX_PARSER* parser, UINT32 depth)
+{
+	UINT32 index = LbRegexNewAst(parser, LB_REGEX_AST_CONCAT);
+
+	while (!parser->failed && *parser->cursor != '\0' && *parser->cursor != '|' && *parser->cursor != ')')
+	{
+		UINT32 child = LbRegexParseRepeat(parser, depth);
+		if (!parser->failed)
+			LbRegexAppend(parser, index, child);
+	}
+
+	return index;
+}
+
+static UINT32 LbRegexParseAlternation(LB_REGEX_PARSER* parser, UINT32 depth)
+{
+	UINT32 first = LbRegexParseConcat(parser, depth);
+	UINT32 index;
+
+	if (parser->failed || *parser->cursor != '|')
+		return first;
+
+	index = LbRegexNewAst(parser, LB_REGEX_AST_ALTERNATE);
+	if (index == LB_REGEX_NONE)
+		return index;
+
+	LbRegexAppend(parser, index, first);
+	while (!parser->failed && *parser->cursor == '|')
+	{
+		parser->cursor++;
+
+		UINT32 child = LbRegexParseConcat(parser, depth);
+		if (!parser->failed)
+			LbRegexAppend(parser, index, child);
+	}
+
+	return index;
+}
+
+// Parses a whole pattern, a leading ^ anchors it to the start of a line
+static UINT32 LbRegexParse(LB_REGEX_PARSER* parser, const char* pattern, BOOLEAN* lineStart)
+{
+	UINT32 root;
+
+	parser->cursor = (const UINT8*)pattern;
+	parser->count = 0;
+	parser->failed = FALSE;
+
+	*lineStart = *parser->cursor == '^';
+	if (*lineStart)
+		parser->cursor++;
+
+	root = LbRegexParseAlternation(parser, 0);
+
+	// Anything left over is a ) without a (
+	if (*parser->cursor != '\0')
+		parser->failed = TRUE;
+
+	return root;
+}
+
+// Length of the shortest string a parse tree matches
+static UINT32 LbRegexMinLength(const LB_REGEX_AST* nodes, UINT32 index)
+{
+	const LB_REGEX_AST* ast = &nodes[index];
+	UINT64 total = 0;
+
+	switch (ast->type)
+	{
+	case LB_REGEX_AST_CLASS:
+		return 1;
+	case LB_REGEX_AST_CONCAT:
+		for (UINT32 child = ast->first; child != LB_REGEX_NONE; child = nodes[child].next)
+			total += LbRegexMinLength(nodes, child);
+		break;
+	case LB_REGEX_AST_ALTERNATE:
+		total = 0xFFFFFFFF;
+		for (UINT32 child = ast->first; child != LB_REGEX_NONE; child = nodes[child].next)
+		{
+			UINT32 length = LbRegexMinLength(nodes, child);
+			if (length < total)
+				total = length;
+		}
+		break;
+	case LB_REGEX_AST_REPEAT:
+		total = (UINT64)ast->min * LbRegexMinLength(nodes, ast->first);
+		break;
+	}
+
+	return total > 0xFFFFFFFF ? 0xFFFFFFFF : (UINT32)total;
+}
+
+/////////////////
+// NFA BUILDER //
+/////////////////
+
+struct LB_REGEX_BUILDER
+{
+	LB_REGEX_NODE* nodes;		// LB_REGEX_MAX_NODES, node 0 is never used
+	UINT32 nodeCount;
+	UINT8* classes;				// [LB_REGEX_MAX_NODES][32]
+	UINT32 classCount;
+	BOOLEAN failed;				// Ran out of nodes
+};
+
+static UINT16 LbRegexNewNode(LB_REGEX_BUILDER* builder, UINT8 op, UINT16 arg, UINT16 out, UINT16 out2)
+{
+	if (builder->nodeCount == LB_REGEX_MAX_NODES)
+	{
+		builder->failed = TRUE;
+		return 0;
+	}
+
+	LB_REGEX_NODE* node = &builder->nodes[builder->nodeCount];
+	node->op = op;
+	node->arg = arg;
+	node->out = out;
+	node->out2 = out2;
+
+	return (UINT16)builder->nodeCount++;
+}
+
+// Index of a byte set in the class table, equal sets are stored once
+static UINT16 LbRegexClassIndex(LB_REGEX_BUILDER* builder, const UINT8* bytes)
+{
+	for (UINT32 i = 0; i < builder->classCount; i++)
+	{
+		if (memcmp(&builder->classes[i * 32], bytes, 32) == 0)
+			return (UINT16)i;
+	}
+
+	memcpy(&builder->classes[builder->classCount * 32], bytes, 32);
+	return (UINT16)builder->classCount++;
+}
+
+// Emits the NFA of a parse tree that continues at out once it matched, returns the node it starts at.
+// Built back to front, reverse emits the pattern reading right to left.
+static UINT16 LbRegexEmit(LB_REGEX_BUILDER* builder, const LB_REGEX_AST* nodes, UINT32 index, UINT16 out, BOOLEAN reverse)
+{
+	const LB_REGEX_AST* ast = &nodes[index];
+	UINT16 entry = out;
+
+	if (builder->failed)
+		return 0;
+
+	switch (ast->type)
+	{
+	case LB_REGEX_AST_CLASS:
+		// Every class belongs to a node, the class table cannot fill up before the node table does
+		if (builder->nodeCount == LB_REGEX_MAX_NODES)
+		{
+			builder->failed = TRUE;
+			return 0;
+		}
+		return LbRegexNewNode(builder, LB_REGEX_OP_CLASS, LbRegexClassIndex(builder, ast->bytes), out, 0);
+
+	case LB_REGEX_AST_CONCAT:
+		if (reverse)
+		{
+			for (UINT32 child = ast->first; child != LB_REGEX_NONE; child = nodes[child].next)
+				entry = LbRegexEmit(builder, nodes, child, entry, reverse);
+		}
+		else
+		{
+			for (UINT32 child = ast->last; child != LB_REGEX_NONE; child = nodes[child].prev)
+				entry = LbRegexEmit(builder, nodes, child, entry, reverse);
+		}
+		return entry;
+
+	case LB_REGEX_AST_ALTERNATE:
+		entry = LbRegexEmit(builder, nodes, ast->first, out, reverse);
+		for (UINT32 child = nodes[ast->first].next; child != LB_REGEX_NONE; child = nodes[child].next)
+			entry = LbRegexNewNode(builder, LB_REGEX_OP_SPLIT, 0, LbRegexEmit(builder, nodes, child, out, reverse), entry);
+		return entry;
+
+	case LB_REGEX_AST_REPEAT:
+		if (ast->max == LB_REGEX_REPEAT_INFINITE)
+		{
+			// Loop: either one more round of the child or on to out
+			UINT16 loop = LbRegexNewNode(builder, LB_REGEX_OP_SPLIT, 0, 0, out);
+			UINT16 body = LbRegexEmit(builder, nodes, ast->first, loop, reverse);
+			if (builder->failed)
+				return 0;
+
+			builder->nodes[loop].out = body;
+			entry = loop;
+		}
+		else
+		{
+			// Optional rounds nest, each one may skip straight to out
+			for (UINT32 i = ast->min; i < ast->max; i++)
+				entry = LbRegexNewNode(builder, LB_REGEX_OP_SPLIT, 0, LbRegexEmit(builder, nodes, ast->first, entry, reverse), out);
+		}
+
+		for (UINT32 i = 0; i < ast->min; i++)
+			entry = LbRegexEmit(builder, nodes, ast->first, entry, reverse);
+		return entry;
+	}
+
+	return entry;
+}
+
+/////////////////
+// STATE CACHE //
+/////////////////
+
+// Adds a node and everything it reaches without consuming a byte
+static void LbRegexClosure(const LB_REGEX_NODE* nodes, UINT64* set, UINT16 start)
+{
+	UINT16 stack[LB_REGEX_MAX_NODES];
+	UINT32 depth = 0;
+
+	if (start == 0 || LbNodeSetHas(set, start))
+		return;
+
+	// Nodes are marked when pushed, so each one is pushed at most once
+	LbNodeSetAdd(set, start);
+	stack[depth++] = start;
+
+	while (depth > 0)
+	{
+		const LB_REGEX_NODE* node = &nodes[stack[--depth]];
+		if (node->op != LB_REGEX_OP_SPLIT)
+			continue;
+
+		if (node->out != 0 && !LbNodeSetHas(set, node->out))
+		{
+			LbNodeSetAdd(set, node->out);
+			stack[depth++] = node->out;
+		}
+		if (node->out2 != 0 && !LbNodeSetHas(set, node->out2))
+		{
+			LbNodeSetAdd(set, node->out2);
+			stack[depth++] = node->out2;
+		}
+	}
+}
+
+// Index + 1 of the first pattern a set of NFA states completes, 0 if none
+static UINT32 LbRegexAccept(const LB_MATCHER* matcher, const UINT64* set, UINT32 words)
+{
+	const LB_REGEX_NODE* nodes = LbRegexNodes(matcher);
+	UINT32 accept = 0;
+
+	for (UINT32 w = 0; w < words; w++)
+	{
+		for (UINT64 bits = set[w]; bits != 0; bits &= bits - 1)
+		{
+			const LB_REGEX_NODE* node = &nodes[w * 64 + LbLowestBit(bits)];
+			if (node->op == LB_REGEX_OP_MATCH && (accept == 0 || node->arg + 1u < accept))
+				accept = node->arg + 1u;
+		}
+	}
+
+	return accept;
+}
+
+// NFA states after reading c from the states in from
+static void LbRegexStep(const LB_MATCHER* matcher, const LB_REGEX_CACHE* cache, const UINT64* from, UINT8 c, UINT64* to)
+{
+	const LB_REGEX_NODE* nodes = LbRegexNodes(matcher);
+	const UINT8* classes = LbRegexClasses(matcher);
+	UINT32 words = cache->words;
+
+	memset(to, 0, words * sizeof(UINT64));
+
+	for (UINT32 w = 0; w < words; w++)
+	{
+		for (UINT64 bits = from[w]; bits != 0; bits &= bits - 1)
+		{
+			UINT32 index = w * 64 + LbLowestBit(bits);
+			const LB_REGEX_NODE* node = &nodes[index];
+
+			if (index != 0 && node->op == LB_REGEX_OP_CLASS && LbByteSetHas(&classes[node->arg * 32], c))
+				LbRegexClosure(nodes, to, node->out);
+		}
+	}
+
+	// Unanchored scans can start a match after every byte, patterns beginning with ^ only after a line ends
+	if (from[0] & 1)
+	{
+		const UINT64* start = &cache->sets[(SIZE_T)(c == '\n' ? LB_MATCHER_ROOT_STATE : cache->midlineState) * words];
+		for (UINT32 w = 0; w < words; w++)
+			to[w] |= start[w];
+	}
+}
+
+static inline UINT32 LbRegexHash(const UINT64* set, UINT32 words)
+{
+	UINT64 hash = 0;
+
+	for (UINT32 w = 0; w < words; w++)
+		hash = (hash ^ set[w]) * 0x9E3779B97F4A7C15ull;
+
+	return (UINT32)(hash >> 32);
+}
+
+// Cached state holding exactly the given set, LB_REGEX_UNCACHED if there is none. Needs no lock.
+static UINT32 LbRegexLookup(const LB_REGEX_CACHE* cache, const UINT64* set, UINT32 hash)
+{
+	for (UINT32 slot = hash & cache->bucketMask; ; slot = (slot + 1) & cache->bucketMask)
+	{
+		UINT32 entry = (UINT32)LbReadAcquire(&cache->buckets[slot]);
+		if (entry == 0)
+			return LB_REGEX_UNCACHED;
+
+		if (memcmp(&cache->sets[(SIZE_T)(entry - 1) * cache->words], set, cache->words * sizeof(UINT64)) == 0)
+			return entry - 1;
+	}
+}
+
+// State for a set of NFA states, added to the cache when it is new.
+// Returns LB_REGEX_DEAD for the empty set and LB_REGEX_UNCACHED when the cache is full.
+static UINT32 LbRegexIntern(const LB_MATCHER* matcher, LB_REGEX_CACHE* cache, const UINT64* set)
+{
+	UINT32 words = cache->words;
+	UINT64 any = 0;
+	UINT32 hash;
+	UINT32 state;
+
+	for (UINT32 w = 0; w < words; w++)
+		any |= set[w];
+	if (any == 0)
+		return LB_REGEX_DEAD;
+
+	hash = LbRegexHash(set, words);
+	state = LbRegexLookup(cache, set, hash);
+	if (state != LB_REGEX_UNCACHED)
+		return state;
+
+	// New states are rare once a rule set has seen some traffic, a plain spin lock is enough
+	while (LbInterlockedCompareExchange(&cache->lock, 1, 0) != 0)
+		LbSpinPause();
+
+	state = LbRegexLookup(cache, set, hash);
+	if (state == LB_REGEX_UNCACHED && (UINT32)cache->stateCount < cache->capacity)
+	{
+		UINT32 slot = hash & cache->bucketMask;
+
+		state = (UINT32)cache->stateCount;
+		memcpy(&cache->sets[(SIZE_T)state * words], set, words * sizeof(UINT64));
+		cache->accept[state] = LbRegexAccept(matcher, set, words);
+
+		// Publishing the bucket makes the state visible to lookups without the lock
+		while (cache->buckets[slot] != 0)
+			slot = (slot + 1) & cache->bucketMask;
+		LbWriteRelease(&cache->buckets[slot], (LONG)(state + 1));
+		LbWriteRelease(&cache->stateCount, (LONG)(state + 1));
+	}
+
+	LbWriteRelease(&cache->lock, 0);
+	return state;
+}
+
+static UINT32 LbRegexAdvanceSlow(const LB_MATCHER* matcher, LB_REGEX_CACHE* cache, LB_REGEX_CURSOR* cursor, UINT8 c)
+{
+	UINT64 next[LB_REGEX_SET_WORDS];
+	const UINT64* from = cursor->state == LB_REGEX_UNCACHED ? cursor->set : &cache->sets[(SIZE_T)cursor->state * cache->words];
+	UINT32 state;
+
+	LbRegexStep(matcher, cache, from, c, next);
+	state = LbRegexIntern(matcher, cache, next);
+
+	if (state == LB_REGEX_UNCACHED)
+	{
+		// The cache is full, keep going on the NFA until a position comes up that is cached
+		memcpy(cursor->set, next, cache->words * sizeof(UINT64));
+		cursor->state = LB_REGEX_UNCACHED;
+		return LbRegexAccept(matcher, next, cache->words);
+	}
+
+	if (cursor->state != LB_REGEX_UNCACHED)
+		LbWriteRelease(&cache->transitions[(SIZE_T)cursor->state * 256 + c], (LONG)(state + 1));
+
+	cursor->state = state;
+	return state == LB_REGEX_DEAD ? 0 : cache->accept[state];
+}
+
+// Read one byte, returns the index + 1 of the first pattern completed by it or 0.
+// Must not be called once the cursor is LB_REGEX_DEAD.
+static inline UINT32 LbRegexAdvance(const LB_MATCHER* matcher, LB_REGEX_CACHE* cache, LB_REGEX_CURSOR* cursor, UINT8 c)
+{
+	if (cursor->state != LB_REGEX_UNCACHED)
+	{
+		UINT32 next = (UINT32)LbReadAcquire(&cache->transitions[(SIZE_T)cursor->state * 256 + c]);
+		if (next != 0)
+		{
+			cursor->state = next - 1;
+			return cursor->state == LB_REGEX_DEAD ? 0 : cache->accept[cursor->state];
+		}
+	}
+
+	return LbRegexAdvanceSlow(matcher, cache, cursor, c);
+}
+
+// Creates the cache of a compiled matcher with its fixed states: the two unanchored roots,
+// and the anchored and reversed start of every pattern
+static NTSTATUS LbRegexCacheCreate(LB_MATCHER* matcher)
+{
+	const LB_REGEX_NODE* nodes = LbRegexNodes(matcher);
+	const UINT8* classes = LbRegexClasses(matcher);
+	LB_REGEX_PATTERN* patterns = LbRegexPatterns(matcher);
+	LB_REGEX_CACHE* cache = NULL;
+	UINT64 root[LB_REGEX_SET_WORDS] = { 0 };
+	UINT64 midline[LB_REGEX_SET_WORDS] = { 0 };
+	UINT32 words = (matcher->regexNodeCount + 63) / 64;
+
+	// Room for the hash table is included, it has between two and four buckets per state
+	SIZE_T header = (sizeof(LB_REGEX_CACHE) + 63) & ~(SIZE_T)63;
+	SIZE_T perState = 256 * sizeof(LONG) + words * sizeof(UINT64) + sizeof(UINT32) + 4 * sizeof(LONG);
+	UINT32 capacity = (UINT32)((LB_REGEX_CACHE_BYTES - header) / perState);
+	UINT32 buckets = 1;
+
+	while (buckets < capacity * 2)
+		buckets <<= 1;
+
+	cache = (LB_REGEX_CACHE*)LbAlloc(header + (SIZE_T)capacity * (256 * sizeof(LONG) + words * sizeof(UINT64) + sizeof(UINT32)) + buckets * sizeof(LONG), 'LBP4');
+	if (!cache)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	cache->capacity = capacity;
+	cache->words = words;
+	cache->bucketMask = buckets - 1;
+	cache->transitions = (volatile LONG*)((UINT8*)cache + header);
+	cache->sets = (UINT64*)(cache->transitions + (SIZE_T)capacity * 256);
+	cache->accept = (UINT32*)(cache->sets + (SIZE_T)capacity * words);
+	cache->buckets = (volatile LONG*)(cache->accept + capacity);
+	matcher->regexCache = cache;
+
+	// The root comes first so LB_MATCHER_ROOT_STATE starts every flow
+	LbNodeSetAdd(root, 0);
+	LbNodeSetAdd(midline, 0);
+	for (UINT32 p = 0; p < matcher->patternCount; p++)
+	{
+		LbRegexClosure(nodes, root, patterns[p].forwardStart);
+		if (!patterns[p].lineStart)
+			LbRegexClosure(nodes, midline, patterns[p].forwardStart);
+	}
+
+	if (LbRegexIntern(matcher, cache, root) != LB_MATCHER_ROOT_STATE)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	cache->midlineState = LbRegexIntern(matcher, cache, midline);
+	if (cache->midlineState == LB_REGEX_UNCACHED)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	for (UINT32 p = 0; p < matcher->patternCount; p++)
+	{
+		UINT64 set[LB_REGEX_SET_WORDS] = { 0 };
+
+		LbRegexClosure(nodes, set, patterns[p].forwardStart);
+		patterns[p].anchoredState = LbRegexIntern(matcher, cache, set);
+
+		memset(set, 0, sizeof(set));
+		LbRegexClosure(nodes, set, patterns[p].reverseStart);
+		patterns[p].reverseState = LbRegexIntern(matcher, cache, set);
+
+		if (patterns[p].anchoredState == LB_REGEX_UNCACHED || patterns[p].reverseState == LB_REGEX_UNCACHED)
+			return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	// Every byte some pattern can start with feeds the same prefilter the literal engine uses.
+	// A matcher from a rule image arrives with it filled in already, it is rebuilt from the NFA all the same.
+	matcher->firstByteCount = 0;
+	memset(matcher->firstBytes, 0, sizeof(matcher->firstBytes));
+	memset(matcher->firstByteMap, 0, sizeof(matcher->firstByteMap));
+
+	for (UINT32 w = 0; w < words; w++)
+	{
+		for (UINT64 bits = root[w]; bits != 0; bits &= bits - 1)
+		{
+			UINT32 index = w * 64 + LbLowestBit(bits);
+			if (index != 0 && nodes[index].op == LB_REGEX_OP_CLASS)
+			{
+				for (int i = 0; i < 32; i++)
+					matcher->firstByteMap[i] |= classes[nodes[index].arg * 32 + i];
+			}
+		}
+	}
+
+	for (int c = 0; c < 256; c++)
+	{
+		if (!LbByteSetHas(matcher->firstByteMap, (UINT8)c))
+			continue;
+
+		if (matcher->firstByteCount < LB_PREFILTER_MAX_BYTES)
+			matcher->firstBytes[matcher->firstByteCount] = (UINT8)c;
+		matcher->firstByteCount++;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+void LbRegexCacheFree(LB_REGEX_CACHE* cache)
+{
+	if (cache)
+		LbFree(cache, 'LBP4');
+}
+
+//////////////
+// COMPILER //
+//////////////
+
+NTSTATUS LbRegexCompile(const LB_USERDATA* ud, LB_MATCHER** matcher)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_REGEX_PARSER parser = { 0 };
+	LB_REGEX_BUILDER builder = { 0 };
+	LB_REGEX_PATTERN* patterns = NULL;
+	LB_MATCHER* result = NULL;
+	SIZE_T stringBytes = 0;
+	SIZE_T longestPattern = 0;
+	SIZE_T minMatchLength = 0;
+	SIZE_T maxReplaceLength = 0;
+
+	// A replacement cannot be turned back into the expression it replaced, reversal only works on literals.
+	// Every pattern takes at least four nodes: a class and a match node, forwards and reversed.
+	if (ud == NULL || matcher == NULL || !ud->regex || ud->enableReversal || ud->count <= 0 || ud->strArray == NULL)
+		return STATUS_INVALID_PARAMETER;
+	if (ud->count > LB_REGEX_MAX_NODES / 4)
+		return STATUS_INVALID_PARAMETER;
+
+	*matcher = NULL;
+
+	for (int i = 0; i < ud->count; i++)
+	{
+		const char* match = ud->strArray[i].match;
+		const char* replace = ud->strArray[i].replace;
+
+		if (match == NULL || replace == NULL || match[0] == '\0' || replace[0] == '\0')
+			return STATUS_INVALID_PARAMETER;
+
+		SIZE_T matchLength = strlen(match);
+		SIZE_T replaceLength = strlen(replace);
+
+		if (matchLength > longestPattern)
+			longestPattern = matchLength;
+		if (replaceLength > maxReplaceLength)
+			maxReplaceLength = replaceLength;
+		stringBytes += matchLength + replaceLength;
+	}
+
+	// Each byte of a pattern adds at most two parse tree nodes
+	parser.capacity = (UINT32)longestPattern * 2 + 2;
+
+	// The NFA never grows past LB_REGEX_MAX_NODES nodes and byte sets, so the most the block can take is known
+	// before anything is parsed. Together with the builder's tables and the state cache it has to fit the budget.
+	if (ud->budget != 0)
+	{
+		SIZE_T nfa = LB_REGEX_MAX_NODES * (sizeof(LB_REGEX_NODE) + 32) + (SIZE_T)ud->count * sizeof(LB_REGEX_PATTERN);
+		SIZE_T block = LbAlignUp(sizeof(LB_MATCHER)) + (SIZE_T)ud->count * sizeof(LB_MATCHER_PATTERN) + stringBytes + nfa + 4 * 8;
+		SIZE_T builder = sizeof(LB_REGEX_AST) * parser.capacity + nfa;
+
+		if (block + builder + LB_REGEX_CACHE_BYTES > ud->budget)
+			return STATUS_QUOTA_EXCEEDED;
+	}
+	parser.nodes = (LB_REGEX_AST*)LbAlloc(sizeof(LB_REGEX_AST) * parser.capacity, 'LBP2');
+	builder.nodes = (LB_REGEX_NODE*)LbAlloc(sizeof(LB_REGEX_NODE) * LB_REGEX_MAX_NODES, 'LBP2');
+	builder.classes = (UINT8*)LbAlloc(32 * LB_REGEX_MAX_NODES, 'LBP2');
+	patterns = (LB_REGEX_PATTERN*)LbAlloc(sizeof(LB_REGEX_PATTERN) * ud->count, 'LBP2');
+	if (!parser.nodes || !builder.nodes || !builder.classes || !patterns)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	// Node 0 marks unanchored scans in state sets, it is never part of the NFA
+	builder.nodeCount = 1;
+
+	for (int p = 0; p < ud->count; p++)
+	{
+		BOOLEAN lineStart;
+		UINT32 root = LbRegexParse(&parser, ud->strArray[p].match, &lineStart);
+		if (parser.failed)
+		{
+			status = STATUS_INVALID_PARAMETER;
+			goto Exit;
+		}
+
+		// A pattern that matches the empty string would match between every two bytes
+		UINT32 shortest = LbRegexMinLength(parser.nodes, root);
+		if (shortest == 0)
+		{
+			status = STATUS_INVALID_PARAMETER;
+			goto Exit;
+		}
+		if (minMatchLength == 0 || shortest < minMatchLength)
+			minMatchLength = shortest;
+
+		UINT16 forwardMatch = LbRegexNewNode(&builder, LB_REGEX_OP_MATCH, (UINT16)p, 0, 0);
+		patterns[p].forwardStart = LbRegexEmit(&builder, parser.nodes, root, forwardMatch, FALSE);
+		UINT16 reverseMatch = LbRegexNewNode(&builder, LB_REGEX_OP_MATCH, (UINT16)p, 0, 0);
+		patterns[p].reverseStart = LbRegexEmit(&builder, parser.nodes, root, reverseMatch, TRUE);
+		patterns[p].lineStart = lineStart;
+
+		if (builder.failed)
+		{
+			status = STATUS_INVALID_PARAMETER;
+			goto Exit;
+		}
+	}
+
+	// Lay out the final flat block
+	{
+		SIZE_T patternOffset = LbAlignUp(sizeof(LB_MATCHER));
+		SIZE_T stringOffset = LbAlignUp(patternOffset + (SIZE_T)ud->count * sizeof(LB_MATCHER_PATTERN));
+		SIZE_T nodeOffset = LbAlignUp(stringOffset + stringBytes);
+		SIZE_T classOffset = LbAlignUp(nodeOffset + (SIZE_T)builder.nodeCount * sizeof(LB_REGEX_NODE));
+		SIZE_T regexPatternOffset = LbAlignUp(classOffset + (SIZE_T)builder.classCount * 32);
+		SIZE_T size = regexPatternOffset + (SIZE_T)ud->count * sizeof(LB_REGEX_PATTERN);
+
+		if (size > 0xFFFFFFFF)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto Exit;
+		}
+
+		result = (LB_MATCHER*)LbAlloc(size, 'LBP3');
+		if (!result)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto Exit;
+		}
+
+		result->size = (UINT32)size;
+		result->engine = LB_MATCHER_ENGINE_REGEX;
+		result->patternCount = (UINT32)ud->count;
+		result->equalLength = FALSE;
+		result->minMatchLength = (UINT32)minMatchLength;
+		result->maxReplaceLength = (UINT32)maxReplaceLength;
+		result->patternOffset = (UINT32)patternOffset;
+		result->stringOffset = (UINT32)stringOffset;
+		result->regexNodeCount = builder.nodeCount;
+		result->regexNodeOffset = (UINT32)nodeOffset;
+		result->regexClassOffset = (UINT32)classOffset;
+		result->regexPatternOffset = (UINT32)regexPatternOffset;
+
+		LB_MATCHER_PATTERN* pairs = (LB_MATCHER_PATTERN*)((UINT8*)result + patternOffset);
+		UINT32 cursor = (UINT32)stringOffset;
+
+		for (int i = 0; i < ud->count; i++)
+		{
+			UINT32 matchLength = (UINT32)strlen(ud->strArray[i].match);
+			UINT32 replaceLength = (UINT32)strlen(ud->strArray[i].replace);
+
+			memcpy((UINT8*)result + cursor, ud->strArray[i].match, matchLength);
+			memcpy((UINT8*)result + cursor + matchLength, ud->strArray[i].replace, replaceLength);
+			pairs[i] = { cursor, matchLength, cursor + matchLength, replaceLength };
+			cursor += matchLength + replaceLength;
+		}
+
+		memcpy((UINT8*)result + nodeOffset, builder.nodes, (SIZE_T)builder.nodeCount * sizeof(LB_REGEX_NODE));
+		memcpy((UINT8*)result + classOffset, builder.classes, (SIZE_T)builder.classCount * 32);
+		memcpy((UINT8*)result + regexPatternOffset, patterns, (SIZE_T)ud->count * sizeof(LB_REGEX_PATTERN));
+	}
+
+	status = LbRegexCacheCreate(result);
+	if (!NT_SUCCESS(status))
+		goto Exit;
+
+	*matcher = result;
+
+Exit:
+	if (!NT_SUCCESS(status) && result) LbMatcherFree(result);
+	if (parser.nodes) LbFree(parser.nodes, 'LBP2');
+	if (builder.nodes) LbFree(builder.nodes, 'LBP2');
+	if (builder.classes) LbFree(builder.classes, 'LBP2');
+	if (patterns) LbFree(patterns, 'LBP2');
+
+	return status;
+}
+
+/////////////////
+// RULE IMAGES //
+/////////////////
+
+// Fewest bytes the NFA can read from start before it reaches a match node, 0xFFFF if it never does.
+// Splits read nothing and classes one byte, a few passes over the nodes settle every distance.
+static UINT32 LbRegexShortestMatch(const LB_REGEX_NODE* nodes, UINT32 nodeCount, UINT16 start)
+{
+	UINT16 distance[LB_REGEX_MAX_NODES];
+	UINT32 shortest = 0xFFFF;
+	BOOLEAN changed = TRUE;
+
+	for (UINT32 i = 0; i < nodeCount; i++)
+		distance[i] = 0xFFFF;
+	distance[start] = 0;
+
+	for (UINT32 pass = 0; pass < nodeCount && changed; pass++)
+	{
+		changed = FALSE;
+
+		for (UINT32 i = 1; i < nodeCount; i++)
+		{
+			const LB_REGEX_NODE* node = &nodes[i];
+			if (distance[i] == 0xFFFF || node->op == LB_REGEX_OP_MATCH)
+				continue;
+
+			UINT16 next = (UINT16)(distance[i] + (node->op == LB_REGEX_OP_CLASS ? 1 : 0));
+
+			if (node->out != 0 && next < distance[node->out])
+			{
+				distance[node->out] = next;
+				changed = TRUE;
+			}
+			if (node->op == LB_REGEX_OP_SPLIT && node->out2 != 0 && next < distance[node->out2])
+			{
+				distance[node->out2] = next;
+				changed = TRUE;
+			}
+		}
+	}
+
+	for (UINT32 i = 1; i < nodeCount; i++)
+	{
+		if (nodes[i].op == LB_REGEX_OP_MATCH && distance[i] < shortest)
+			shortest = distance[i];
+	}
+
+	return shortest;
+}
+
+NTSTATUS LbRegexBindImage(LB_MATCHER* matcher)
+{
+	SIZE_T size = matcher->size;
+
+	// State sets are bitmaps of a fixed size on the stack, no node may fall outside of them
+	if (matcher->patternCount == 0 || matcher->patternCount > LB_REGEX_MAX_NODES / 4 || matcher->equalLength)
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->regexNodeCount < 2 || matcher->regexNodeCount > LB_REGEX_MAX_NODES)
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->regexNodeOffset < sizeof(LB_MATCHER) || (matcher->regexNodeOffset & 1) != 0 || matcher->regexNodeOffset > size ||
+		(SIZE_T)matcher->regexNodeCount * sizeof(LB_REGEX_NODE) > size - matcher->regexNodeOffset)
+		return STATUS_INVALID_PARAMETER;
+	if (matcher->regexPatternOffset < sizeof(LB_MATCHER) || (matcher->regexPatternOffset & 3) != 0 || matcher->regexPatternOffset > size ||
+		(SIZE_T)matcher->patternCount * sizeof(LB_REGEX_PATTERN) > size - matcher->regexPatternOffset)
+		return STATUS_INVALID_PARAMETER;
+
+	// Byte sets run from their offset up to the pattern table
+	if (matcher->regexClassOffset < sizeof(LB_MATCHER) || matcher->regexClassOffset > matcher->regexPatternOffset)
+		return STATUS_INVALID_PARAMETER;
+
+	const LB_REGEX_NODE* nodes = LbRegexNodes(matcher);
+	const LB_REGEX_PATTERN* patterns = LbRegexPatterns(matcher);
+	UINT32 classCount = (matcher->regexPatternOffset - matcher->regexClassOffset) / 32;
+
+	// Node 0 only ever stands for bit 0 of a state set, which every accept check still reads
+	if (nodes[0].op == LB_REGEX_OP_MATCH)
+		return STATUS_INVALID_PARAMETER;
+
+	for (UINT32 i = 1; i < matcher->regexNodeCount; i++)
+	{
+		const LB_REGEX_NODE* node = &nodes[i];
+
+		if (node->out >= matcher->regexNodeCount || node->out2 >= matcher->regexNodeCount)
+			return STATUS_INVALID_PARAMETER;
+		if (node->op == LB_REGEX_OP_CLASS && node->arg >= classCount)
+			return STATUS_INVALID_PARAMETER;
+		if (node->op == LB_REGEX_OP_MATCH && node->arg >= matcher->patternCount)
+			return STATUS_INVALID_PARAMETER;
+		if (node->op > LB_REGEX_OP_MATCH)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	// Every replacement takes the place of at least minMatchLength bytes, or the copying rewrite would outgrow
+	// its bound. The reversed patterns decide where a match starts, so they are the ones that have to hold to it.
+	for (UINT32 p = 0; p < matcher->patternCount; p++)
+	{
+		if (patterns[p].forwardStart == 0 || patterns[p].forwardStart >= matcher->regexNodeCount)
+			return STATUS_INVALID_PARAMETER;
+		if (patterns[p].reverseStart == 0 || patterns[p].reverseStart >= matcher->regexNodeCount)
+			return STATUS_INVALID_PARAMETER;
+		if (LbRegexShortestMatch(nodes, matcher->regexNodeCount, patterns[p].reverseStart) < matcher->minMatchLength)
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	return LbRegexCacheCreate(matcher);
+}
+
+//////////////
+// SCANNING //
+//////////////
+
+static void LbRegexScanBegin(const LB_MATCHER* matcher, LB_REGEX_SCAN* scan, UINT32 state)
+{
+	const LB_REGEX_CACHE* cache = matcher->regexCache;
+
+	if (state >= (UINT32)LbReadAcquire(&cache->stateCount))
+		state = LB_MATCHER_ROOT_STATE;
+
+	// Sitting at one of the roots means no match is in progress from an earlier buffer
+	scan->cursor.state = state;
+	scan->position = 0;
+	scan->low = 0;
+	scan->lowKnown = state == LB_MATCHER_ROOT_STATE || state == cache->midlineState;
+	scan->lowLineStart = state == LB_MATCHER_ROOT_STATE;
+}
+
+SIZE_T LbRegexPendingLength(const LB_MATCHER* matcher, UINT32 state)
+{
+	const LB_REGEX_CACHE* cache = matcher->regexCache;
+
+	if (state == LB_MATCHER_ROOT_STATE || state == cache->midlineState || state >= (UINT32)LbReadAcquire(&cache->stateCount))
+		return 0;
+
+	// Only the position of the scan is known, not where the match it may be in began
+	return (SIZE_T)-1;
+}
+
+// Position to carry into the next buffer. One the cache had no room for is lost, the next buffer starts over.
+static inline UINT32 LbRegexScanEnd(const LB_REGEX_SCAN* scan)
+{
+	return scan->cursor.state == LB_REGEX_UNCACHED ? LB_MATCHER_ROOT_STATE : scan->cursor.state;
+}
+
+static inline BOOLEAN LbRegexLineStart(const LB_REGEX_SCAN* scan, const UINT8* data, SIZE_T position)
+{
+	return position == 0 ? scan->lowLineStart : data[position - 1] == '\n';
+}
+
+// Leftmost start of a match of pattern ending at end, found by reading the reversed pattern backwards.
+// Returns FALSE when the match may have started in an earlier buffer.
+static BOOLEAN LbRegexFindStart(const LB_MATCHER* matcher, const LB_REGEX_SCAN* scan, const LB_REGEX_PATTERN* pattern, const UINT8* data, SIZE_T end, SIZE_T* start)
+{
+	LB_REGEX_CURSOR cursor;
+	SIZE_T position = end;
+	BOOLEAN found = FALSE;
+
+	cursor.state = pattern->reverseState;
+
+	while (position > scan->low)
+	{
+		UINT32 accept = LbRegexAdvance(matcher, matcher->regexCache, &cursor, data[--position]);
+		if (cursor.state == LB_REGEX_DEAD)
+			return found;
+
+		if (accept != 0 && (!pattern->lineStart || LbRegexLineStart(scan, data, position)))
+		{
+			found = TRUE;
+			*start = position;
+		}
+	}
+
+	// Still alive at the lower bound, it only ends the match when nothing before it can belong to one
+	return found && scan->lowKnown;
+}
+
+// End of the longest match of pattern that begins at start, at least end
+static SIZE_T LbRegexFindEnd(const LB_MATCHER* matcher, const LB_REGEX_PATTERN* pattern, const UINT8* data, SIZE_T start, SIZE_T end, SIZE_T length)
+{
+	LB_REGEX_CURSOR cursor;
+
+	cursor.state = pattern->anchoredState;
+
+	// A match still growing at the end of the buffer ends there, the rest was not seen yet
+	for (SIZE_T position = start; position < length; position++)
+	{
+		UINT32 accept = LbRegexAdvance(matcher, matcher->regexCache, &cursor, data[position]);
+		if (cursor.state == LB_REGEX_DEAD)
+			break;
+
+		if (accept != 0 && position + 1 > end)
+			end = position + 1;
+	}
+
+	return end;
+}
+
+// Finds the next match in the buffer, leftmost first and then as long as possible.
+// Returns FALSE once the buffer is used up.
+static BOOLEAN LbRegexNextMatch(const LB_MATCHER* matcher, LB_REGEX_SCAN* scan, const UINT8* data, SIZE_T length, UINT32* pattern, SIZE_T* start, SIZE_T* end)
+{
+	LB_REGEX_CACHE* cache = matcher->regexCache;
+	const LB_REGEX_PATTERN* patterns = LbRegexPatterns(matcher);
+	SIZE_T i = scan->position;
+
+	while (i < length)
+	{
+		// Nearly all traffic never leaves the roots, jump straight to the next byte that could start a match
+		if (scan->cursor.state == LB_MATCHER_ROOT_STATE || scan->cursor.state == cache->midlineState)
+		{
+			SIZE_T next = LbMatcherNextCandidate(matcher, data, i, length);
+			if (next != i)
+				scan->cursor.state = data[next - 1] == '\n' ? LB_MATCHER_ROOT_STATE : cache->midlineState;
+
+			i = next;
+			if (i == length)
+				break;
+		}
+
+		UINT32 accept = LbRegexAdvance(matcher, cache, &scan->cursor, data[i++]);
+		if (accept == 0)
+			continue;
+
+		// The DFA only knows where the earliest match ends, find where it starts and how far it goes
+		const LB_REGEX_PATTERN* found = &patterns[accept - 1];
+		BOOLEAN known = LbRegexFindStart(matcher, scan, found, data, i, start);
+		*end = known ? LbRegexFindEnd(matcher, found, data, *start, i, length) : i;
+
+		// Matches never overlap, continue from a root after this one
+		scan->position = *end;
+		scan->low = *end;
+		scan->lowKnown = TRUE;
+		scan->cursor.state = data[*end - 1] == '\n' ? LB_MATCHER_ROOT_STATE : cache->midlineState;
+
+		if (known)
+		{
+			*pattern = accept - 1;
+			return TRUE;
+		}
+
+		i = *end;
+	}
+
+	scan->position = length;
+	return FALSE;
+}
+
+/////////////////////
+// MATCH & REPLACE //
+/////////////////////
+
+UINT32 LbRegexReplace(const LB_MATCHER* matcher, UINT32* state, UINT8* data, SIZE_T length, LB_CHECKSUM_EDITS* edits)
+{
+	const LB_MATCHER_PATTERN* pairs = LbRegexPairs(matcher);
+	LB_REGEX_SCAN scan;
+	UINT32 replacements = 0;
+	UINT32 pattern;
+	SIZE_T start;
+	SIZE_T end;
+
+	LbRegexScanBegin(matcher, &scan, *state);
+
+	while (LbRegexNextMatch(matcher, &scan, data, length, &pattern, &start, &end))
+	{
+		// Nothing can move in place, other matches are left for the copying rewrite
+		const LB_MATCHER_PATTERN* pair = &pairs[pattern];
+		if (end - start != pair->replaceLength)
+			continue;
+
+		if (edits)
+			LbChecksumEdit(edits, start, &data[start], (const UINT8*)matcher + pair->replaceOffset, pair->replaceLength);
+		memcpy(&data[start], (const UINT8*)matcher + pair->replaceOffset, pair->replaceLength);
+		replacements++;
+	}
+
+	*state = LbRegexScanEnd(&scan);
+	return replacements;
+}
+
+UINT32 LbRegexRewrite(const LB_MATCHER* matcher, UINT32* state, const UINT8* data, SIZE_T length, UINT8* output, SIZE_T* outputLength)
+{
+	const LB_MATCHER_PATTERN* pairs = LbRegexPairs(matcher);
+	LB_REGEX_SCAN scan;
+	UINT32 replacements = 0;
+	UINT32 pattern;
+	SIZE_T start;
+	SIZE_T end;
+	SIZE_T copied = 0;		// Input bytes already written to output
+	SIZE_T written = 0;
+
+	LbRegexScanBegin(matcher, &scan, *state);
+
+	// Every match starts at or after the end of the previous one
+	while (LbRegexNextMatch(matcher, &scan, data, length, &pattern, &start, &end))
+	{
+		const LB_MATCHER_PATTERN* pair = &pairs[pattern];
+
+		memcpy(&output[written], &data[copied], start - copied);
+		written += start - copied;
+		memcpy(&output[written], (const UINT8*)matcher + pair->replaceOffset, pair->replaceLength);
+		written += pair->replaceLength;
+		copied = end;
+		replacements++;
+	}
+
+	// Rest of the buffer is unchanged
+	memcpy(&output[written], &data[copied], length - copied);
+	written += length - copied;
+
+	*state = LbRegexScanEnd(&scan);
+	*outputLength = written;
+	return replacements;
+}
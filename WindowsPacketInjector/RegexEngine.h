@@ -0,0 +1,89 @@
+/*/
+/*  ** RegexEngine.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the regular expression engine behind LB_MATCHER_ENGINE_REGEX.
+/*	Every pattern is compiled into one Thompson NFA. Scanning runs it as a DFA whose states are only
+/*	built the first time a scan reaches them, so no input can make a scan backtrack and each byte costs
+/*	one table lookup once the states it needs exist. The states live in a cache of fixed size shared by
+/*	all processors. Nothing is ever evicted from it, which lets a flow keep its position between packets;
+/*	once it is full, positions it does not hold are simulated on the NFA directly instead.
+/*
+/*	A match is found in three steps: the DFA reports where the earliest match ends, a DFA of the reversed
+/*	pattern walks back to where it starts, and an anchored DFA extends it as far as it can go.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "MatchEngine.h"
+
+// Largest NFA of all patterns together (forward and reversed), sets of its states are bitmaps on the stack
+#define LB_REGEX_MAX_NODES 512
+#define LB_REGEX_SET_WORDS (LB_REGEX_MAX_NODES / 64)
+
+// Largest count of a bounded repetition, x{n,m}
+#define LB_REGEX_MAX_REPEAT 255
+
+// Deepest nesting of groups
+#define LB_REGEX_MAX_DEPTH 16
+
+// Memory of the state cache of one rule set
+#define LB_REGEX_CACHE_BYTES (1024 * 1024)
+
+enum LB_REGEX_OP : UINT8
+{
+	LB_REGEX_OP_CLASS = 0,		// Consume one byte of the set arg, continue at out
+	LB_REGEX_OP_SPLIT,			// Continue at both out and out2
+	LB_REGEX_OP_MATCH,			// Pattern arg matched
+};
+
+struct LB_REGEX_NODE
+{
+	UINT8 op;					// LB_REGEX_OP
+	UINT8 reserved;
+	UINT16 arg;
+	UINT16 out;
+	UINT16 out2;
+};
+
+struct LB_REGEX_PATTERN
+{
+	UINT32 anchoredState;		// Cached state matching the pattern from the current position only
+	UINT32 reverseState;		// Cached state matching the reversed pattern backwards from a match end
+	UINT16 forwardStart;		// NFA node the pattern starts at
+	UINT16 reverseStart;		// NFA node the reversed pattern starts at
+	UINT8 lineStart;			// Pattern began with ^
+	UINT8 reserved[3];
+};
+
+// Build a regex matcher, ud->regex must be set and ud->enableReversal clear
+NTSTATUS LbRegexCompile(const LB_USERDATA* ud, LB_MATCHER** matcher);
+
+// Free the state cache of a regex matcher, LbMatcherFree calls this
+void LbRegexCacheFree(LB_REGEX_CACHE* cache);
+
+// LbMatcherBindImage for regex matchers, checks the NFA and creates the state cache.
+// The pairs and their strings were already checked.
+NTSTATUS LbRegexBindImage(LB_MATCHER* matcher);
+
+// LbMatcherReplace for regex matchers. Matches are only rewritten when the replacement has the same length.
+UINT32 LbRegexReplace(const LB_MATCHER* matcher, UINT32* state, UINT8* data, SIZE_T length, LB_CHECKSUM_EDITS* edits);
+
+// LbMatcherPendingLength for regex matchers
+SIZE_T LbRegexPendingLength(const LB_MATCHER* matcher, UINT32 state);
+
+// LbMatcherRewrite for regex matchers
+UINT32 LbRegexRewrite(
+	const LB_MATCHER* matcher,
+	UINT32* state,
+	const UINT8* data,
+	SIZE_T length,
+	UINT8* output,
+	SIZE_T* outputLength
+);
@@ -0,0 +1,159 @@
+/*/
+/*  ** RuleImage.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for building and checking rule images.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- G. Castagnoli, S. Braeuer, M. Herrmann, "Optimization of Cyclic Redundancy-Check Codes with 24
+/*		  and 32 Parity Bits", IEEE Transactions on Communications 41(6), 1993
+/*			* The CRC-32C polynomial, the one the SSE4.2 crc32 instruction computes.
+/*		- Ross N. Williams, "A Painless Guide to CRC Error Detection Algorithms", 1993
+/*			* The table driven, reflected form used where that instruction is not available.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "RuleImage.h"
+
+#if defined(_M_X64) || defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define LB_CRC_SSE42 1
+#endif
+
+//////////////
+// CHECKSUM //
+//////////////
+
+// Images run to hundreds of megabytes with enough address rules, the checksum must not cost more than
+// building the tables again would. The crc32 instruction only uses general purpose registers, so unlike
+// the vector units it needs no saved state in kernel mode, and every processor Windows 11 supports has it.
+UINT32 LbRuleImageChecksum(const void* data, SIZE_T length)
+{
+	const UINT8* bytes = (const UINT8*)data;
+	UINT32 crc = 0xFFFFFFFF;
+	SIZE_T i = 0;
+
+#if defined(LB_CRC_SSE42)
+	UINT64 wide = crc;
+
+	for (; i + 8 <= length; i += 8)
+	{
+		UINT64 word;
+		memcpy(&word, &bytes[i], sizeof(word));
+		wide = _mm_crc32_u64(wide, word);
+	}
+
+	crc = (UINT32)wide;
+	for (; i < length; i++)
+		crc = _mm_crc32_u8(crc, bytes[i]);
+#else
+	UINT32 table[256];
+
+	// Building the table costs less than a kilobyte of input, no shared copy has to be set up anywhere
+	for (UINT32 n = 0; n < 256; n++)
+	{
+		UINT32 value = n;
+		for (int bit = 0; bit < 8; bit++)
+			value = (value >> 1) ^ ((value & 1) ? 0x82F63B78 : 0);
+		table[n] = value;
+	}
+
+	for (; i < length; i++)
+		crc = (crc >> 8) ^ table[(crc ^ bytes[i]) & 0xFF];
+#endif
+
+	return ~crc;
+}
+
+// Everything after the checksum field is covered, the header's own fields included
+static inline UINT32 LbRuleImageSum(const UINT8* image, SIZE_T size)
+{
+	SIZE_T start = FIELD_OFFSET(LB_RULE_IMAGE_HEADER, checksum) + sizeof(UINT32);
+	return LbRuleImageChecksum(image + start, size - start);
+}
+
+/////////////
+// BUILDER //
+/////////////
+
+NTSTATUS LbRuleImageBuild(const LB_RULESET* ruleSet, void** image, UINT32* size)
+{
+	LB_RULE_IMAGE_HEADER header = { 0 };
+
+	if (ruleSet == NULL || image == NULL || size == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	*image = NULL;
+	*size = 0;
+
+	// A first pass without an image only adds up where everything goes
+	SIZE_T end = LbClassifierWriteImage(ruleSet->classifier, NULL, sizeof(LB_RULE_IMAGE_HEADER), header.tables);
+	end = LbMatcherWriteImage(ruleSet->matcher, NULL, end, &header.matcherOffset);
+	if (end > 0xFFFFFFFF)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	UINT8* result = (UINT8*)LbAlloc(end, 'LBR2');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	SIZE_T offset = LbClassifierWriteImage(ruleSet->classifier, result, sizeof(LB_RULE_IMAGE_HEADER), header.tables);
+	LbMatcherWriteImage(ruleSet->matcher, result, offset, &header.matcherOffset);
+
+	header.magic = LB_RULE_IMAGE_MAGIC;
+	header.version = LB_RULE_IMAGE_VERSION;
+	header.size = (UINT32)end;
+	header.matcherSize = ruleSet->matcher->size;
+	header.fields = ruleSet->fields;
+	header.streamChunk = ruleSet->streamChunk;
+	header.streamLookahead = ruleSet->streamLookahead;
+	header.memoryBudget = (UINT32)ruleSet->memoryBudget;
+	header.flags = (ruleSet->async ? LB_RULES_FLAG_ASYNC : 0) | (ruleSet->stream ? LB_RULES_FLAG_STREAM : 0) |
+		(ruleSet->matcher->engine == LB_MATCHER_ENGINE_REGEX ? LB_RULES_FLAG_REGEX : 0);
+
+	memcpy(result, &header, sizeof(header));
+	((LB_RULE_IMAGE_HEADER*)result)->checksum = LbRuleImageSum(result, end);
+
+	*image = result;
+	*size = (UINT32)end;
+	return STATUS_SUCCESS;
+}
+
+void LbRuleImageFree(void* image)
+{
+	if (image)
+		LbFree(image, 'LBR2');
+}
+
+//////////////
+// CHECKING //
+//////////////
+
+NTSTATUS LbRuleImageCheck(const void* image, SIZE_T size)
+{
+	const LB_RULE_IMAGE_HEADER* header = (const LB_RULE_IMAGE_HEADER*)image;
+
+	if (image == NULL || size < sizeof(LB_RULE_IMAGE_HEADER))
+		return STATUS_INVALID_PARAMETER;
+	if (header->magic != LB_RULE_IMAGE_MAGIC || header->version != LB_RULE_IMAGE_VERSION || header->size != size)
+		return STATUS_INVALID_PARAMETER;
+
+	// The same limits LbRuleSetParse puts on a rule buffer
+	if (header->fields & ~LB_FIELD_ALL)
+		return STATUS_INVALID_PARAMETER;
+	if (header->streamChunk > LB_STREAM_MAX_CHUNK || header->streamLookahead > LB_STREAM_MAX_CHUNK)
+		return STATUS_INVALID_PARAMETER;
+
+	// The automaton is bound where it lies, its header must be readable in place
+	if (header->matcherOffset < sizeof(LB_RULE_IMAGE_HEADER) || (header->matcherOffset & 63) != 0 || header->matcherOffset > size ||
+		header->matcherSize < sizeof(LB_MATCHER) || header->matcherSize > size - header->matcherOffset)
+		return STATUS_INVALID_PARAMETER;
+
+	if (LbRuleImageSum((const UINT8*)image, size) != header->checksum)
+		return STATUS_DATA_ERROR;
+
+	return STATUS_SUCCESS;
+}
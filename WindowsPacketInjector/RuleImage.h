@@ -0,0 +1,55 @@
+/*/
+/*  ** RuleImage.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for rule images, rule sets compiled ahead of time into one flat block.
+/*	An image holds the classifier tables and the match automaton exactly as the classify path reads them,
+/*	found through offsets from its start instead of pointers, so it works wherever it is copied to.
+/*	User mode builds one with LbRuleImageBuild, which only depends on Platform.h like the rest of the
+/*	compiler, and hands it to IOCTL_LB_SET_RULE_IMAGE. The driver copies it once, straight out of the
+/*	caller's pages the direct I/O request maps, checks every table in it and then runs out of that copy:
+/*	nothing is parsed and no table is built in the kernel.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+#include "RuleSet.h"
+
+#define LB_RULE_IMAGE_MAGIC 0x4952424C		// "LBRI"
+#define LB_RULE_IMAGE_VERSION 3
+
+// Start of every image. The tables follow it, each one on a cache line of its own.
+struct LB_RULE_IMAGE_HEADER
+{
+	UINT32 magic;				// LB_RULE_IMAGE_MAGIC
+	UINT32 version;				// LB_RULE_IMAGE_VERSION
+	UINT32 size;				// Whole image, this header included
+	UINT32 checksum;			// CRC-32C of every byte after this field
+	UINT32 flags;				// LB_RULES_HEADER::flags and the fields after it, as the image was built with
+	UINT32 fields;
+	UINT32 streamChunk;
+	UINT32 streamLookahead;
+	UINT32 memoryBudget;
+	LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT];
+	UINT32 matcherOffset;		// LB_MATCHER block
+	UINT32 matcherSize;
+};
+
+// Lay a compiled rule set out as an image. Free it with LbRuleImageFree.
+NTSTATUS LbRuleImageBuild(const LB_RULESET* ruleSet, void** image, UINT32* size);
+
+// Free an image returned by LbRuleImageBuild
+void LbRuleImageFree(void* image);
+
+// Check the header of an image of size bytes and its checksum. The tables are checked when they are bound.
+NTSTATUS LbRuleImageCheck(const void* image, SIZE_T size);
+
+// CRC-32C (Castagnoli) of a buffer, as stored in LB_RULE_IMAGE_HEADER::checksum
+UINT32 LbRuleImageChecksum(const void* data, SIZE_T length);
@@ -0,0 +1,362 @@
+/*/
+/*  ** RuleSet.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for building, parsing and evaluating compiled rule sets.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "RuleSet.h"
+#include "RuleImage.h"
+#include "RegexEngine.h"
+
+/////////////
+// GLOBALS //
+/////////////
+
+// Source of rule set generations, 0 is never handed out
+static volatile LONG lbRuleSetGeneration = 0;
+
+//////////////
+// COMPILER //
+//////////////
+
+static inline UINT32 LbRuleSetNextGeneration()
+{
+	UINT32 generation = (UINT32)LbInterlockedIncrement(&lbRuleSetGeneration);
+	if (generation == 0)
+		generation = (UINT32)LbInterlockedIncrement(&lbRuleSetGeneration);
+
+	return generation;
+}
+
+NTSTATUS LbRuleSetCompile(const LB_ADDRESS_RULE* addressRules, UINT32 addressRuleCount, const LB_PORT_RULE* portRules, UINT32 portRuleCount, const LB_USERDATA* ud, SIZE_T budget, LB_RULESET** ruleSet)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_RULESET* result = NULL;
+	LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT];
+
+	if (ruleSet == NULL || ud == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	*ruleSet = NULL;
+
+	// The rules alone bound what the classifier takes, a set over the budget never gets to allocate it
+	if (budget != 0 && sizeof(LB_RULESET) + LbClassifierBytes(addressRules, addressRuleCount, portRules, portRuleCount) > budget)
+		return STATUS_QUOTA_EXCEEDED;
+
+	result = (LB_RULESET*)LbAlloc(sizeof(LB_RULESET), 'LBR0');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	// Rules are validated by the classifier, however many there are they cost the same per packet
+	status = LbClassifierCompile(addressRules, addressRuleCount, portRules, portRuleCount, &result->classifier);
+	if (!NT_SUCCESS(status))
+	{
+		LbFree(result, 'LBR0');
+		return status;
+	}
+
+	// The match engine gets what the classifier left of the budget, and checks against it before it allocates
+	{
+		LB_USERDATA limited = *ud;
+		SIZE_T used = sizeof(LB_RULESET) + sizeof(LB_CLASSIFIER) + LbClassifierWriteImage(result->classifier, NULL, 0, tables);
+
+		limited.budget = budget != 0 ? budget - used : 0;
+		status = used < budget || budget == 0 ? LbMatcherCompile(&limited, &result->matcher) : STATUS_QUOTA_EXCEEDED;
+	}
+	if (!NT_SUCCESS(status))
+	{
+		LbClassifierFree(result->classifier);
+		LbFree(result, 'LBR0');
+		return status;
+	}
+
+	result->memoryBudget = budget;
+	result->generation = LbRuleSetNextGeneration();
+	result->bytes = LbRuleSetBytes(result);
+
+	*ruleSet = result;
+	return status;
+}
+
+NTSTATUS LbRuleSetCompileStatic(const LB_ADDRESS_RULE* addressRules, UINT32 addressRuleCount, const LB_PORT_RULE* portRules, UINT32 portRuleCount, const LB_MATCHER* matcher, LbMatcherReplaceCallback* replace, LB_RULESET** ruleSet)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_RULESET* result = NULL;
+
+	if (ruleSet == NULL || matcher == NULL || replace == NULL || matcher->engine != LB_MATCHER_ENGINE_AUTOMATON)
+		return STATUS_INVALID_PARAMETER;
+
+	*ruleSet = NULL;
+
+	result = (LB_RULESET*)LbAlloc(sizeof(LB_RULESET), 'LBR0');
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	status = LbClassifierCompile(addressRules, addressRuleCount, portRules, portRuleCount, &result->classifier);
+	if (!NT_SUCCESS(status))
+	{
+		LbFree(result, 'LBR0');
+		return status;
+	}
+
+	// Nothing writes to an automaton once it is built, so the constant tables are shared as they are
+	result->matcher = (LB_MATCHER*)matcher;
+	result->replace = replace;
+	result->memoryBudget = LbRuleSetBudget(0);
+	result->generation = LbRuleSetNextGeneration();
+	result->bytes = LbRuleSetBytes(result);
+
+	*ruleSet = result;
+	return status;
+}
+
+SIZE_T LbRuleSetBytes(const LB_RULESET* ruleSet)
+{
+	LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT];
+	SIZE_T bytes = sizeof(LB_RULESET) + sizeof(LB_CLASSIFIER);
+
+	// An image holds the classifier tables and the matcher in one allocation
+	if (ruleSet->image)
+		bytes += ((const LB_RULE_IMAGE_HEADER*)ruleSet->image)->size;
+	else
+	{
+		// Laying the tables out without an image only adds up their sizes
+		bytes += LbClassifierWriteImage(ruleSet->classifier, NULL, 0, tables);
+		if (!ruleSet->replace)
+			bytes += ruleSet->matcher->size;
+	}
+
+	if (ruleSet->matcher->regexCache)
+		bytes += LB_REGEX_CACHE_BYTES;
+
+	return bytes;
+}
+
+void LbRuleSetFree(LB_RULESET* ruleSet)
+{
+	if (!ruleSet)
+		return;
+
+	// Tables of an image are freed with it, only what binding them added goes on its own
+	if (ruleSet->image)
+	{
+		LbMatcherUnbindImage(ruleSet->matcher);
+		LbClassifierFree(ruleSet->classifier);
+		LbFree(ruleSet->image, 'LBR2');
+	}
+	else
+	{
+		if (!ruleSet->replace)
+			LbMatcherFree(ruleSet->matcher);
+		LbClassifierFree(ruleSet->classifier);
+	}
+
+	LbFree(ruleSet, 'LBR0');
+}
+
+////////////
+// PARSER //
+////////////
+
+// Returns the length of a NUL terminated string that must end before limit, or -1 if it does not
+static inline INT64 LbBoundedStringLength(const char* str, const char* limit)
+{
+	for (const char* c = str; c < limit; c++)
+	{
+		if (*c == '\0')
+			return c - str;
+	}
+
+	return -1;
+}
+
+NTSTATUS LbRuleSetParse(const void* buffer, SIZE_T size, LB_RULESET** ruleSet)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	const LB_RULES_HEADER* header = (const LB_RULES_HEADER*)buffer;
+	const char* cursor = NULL;
+	const char* limit = (const char*)buffer + size;
+	LB_USERDATA ud;
+
+	if (buffer == NULL || ruleSet == NULL || size < sizeof(LB_RULES_HEADER))
+		return STATUS_INVALID_PARAMETER;
+
+	if (header->version != LB_RULES_VERSION)
+		return STATUS_INVALID_PARAMETER;
+
+	// Rules must fit in the buffer, counts come from user mode so check before multiplying
+	if (header->addressRuleCount > LB_RULES_MAX_COUNT || header->portRuleCount > LB_RULES_MAX_COUNT || header->pairCount > LB_RULES_MAX_COUNT)
+		return STATUS_INVALID_PARAMETER;
+	if (header->fields & ~LB_FIELD_ALL)
+		return STATUS_INVALID_PARAMETER;
+	if (header->streamChunk > LB_STREAM_MAX_CHUNK || header->streamLookahead > LB_STREAM_MAX_CHUNK)
+		return STATUS_INVALID_PARAMETER;
+	if (size - sizeof(LB_RULES_HEADER) < (SIZE_T)header->addressRuleCount * sizeof(LB_ADDRESS_RULE) + (SIZE_T)header->portRuleCount * sizeof(LB_PORT_RULE))
+		return STATUS_INVALID_PARAMETER;
+
+	const LB_ADDRESS_RULE* addressRules = (const LB_ADDRESS_RULE*)(header + 1);
+	const LB_PORT_RULE* portRules = (const LB_PORT_RULE*)(addressRules + header->addressRuleCount);
+	cursor = (const char*)(portRules + header->portRuleCount);
+
+	ud.count = (int)header->pairCount;
+	ud.enableReversal = (header->flags & LB_RULES_FLAG_REVERSAL) != 0;
+	ud.regex = (header->flags & LB_RULES_FLAG_REGEX) != 0;
+	ud.strArray = NULL;
+
+	if (ud.count > 0)
+	{
+		ud.strArray = (LB_MATCH_AND_REPLACE*)LbAlloc(sizeof(LB_MATCH_AND_REPLACE) * ud.count, 'LBR1');
+		if (!ud.strArray)
+			return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	// Pairs point straight into the caller's buffer, LbMatcherCompile copies the bytes it keeps
+	for (int i = 0; i < ud.count; i++)
+	{
+		INT64 matchLength = LbBoundedStringLength(cursor, limit);
+		if (matchLength < 0)
+		{
+			status = STATUS_INVALID_PARAMETER;
+			goto Exit;
+		}
+		ud.strArray[i].match = (char*)cursor;
+		cursor += matchLength + 1;
+
+		INT64 replaceLength = LbBoundedStringLength(cursor, limit);
+		if (replaceLength < 0)
+		{
+			status = STATUS_INVALID_PARAMETER;
+			goto Exit;
+		}
+		ud.strArray[i].replace = (char*)cursor;
+		cursor += replaceLength + 1;
+	}
+
+	status = LbRuleSetCompile(addressRules, header->addressRuleCount, portRules, header->portRuleCount, &ud, LbRuleSetBudget(header->memoryBudget), ruleSet);
+	if (NT_SUCCESS(status))
+	{
+		(*ruleSet)->fields = header->fields;
+		(*ruleSet)->async = (header->flags & LB_RULES_FLAG_ASYNC) != 0;
+		(*ruleSet)->stream = (header->flags & LB_RULES_FLAG_STREAM) != 0;
+		(*ruleSet)->streamChunk = header->streamChunk;
+		(*ruleSet)->streamLookahead = header->streamLookahead;
+	}
+
+Exit:
+	if (ud.strArray) LbFree(ud.strArray, 'LBR1');
+
+	return status;
+}
+
+/////////////////
+// RULE IMAGES //
+/////////////////
+
+NTSTATUS LbRuleSetLoadImage(const void* buffer, SIZE_T size, LB_RULESET** ruleSet)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	LB_RULESET* result = NULL;
+	UINT8* image = NULL;
+
+	if (buffer == NULL || ruleSet == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	*ruleSet = NULL;
+
+	// An image is the tables themselves, one over the driver's limit is not even copied
+	if (size > LB_RULES_MAX_BYTES - sizeof(LB_RULESET) - sizeof(LB_CLASSIFIER))
+		return STATUS_QUOTA_EXCEEDED;
+
+	// The one copy. buffer is the caller's pages, which it can still write to, so only the copy is checked.
+	image = (UINT8*)LbAlloc(size, 'LBR2');
+	result = (LB_RULESET*)LbAlloc(sizeof(LB_RULESET), 'LBR0');
+	if (!image || !result)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto Exit;
+	}
+
+	memcpy(image, buffer, size);
+
+	status = LbRuleImageCheck(image, size);
+	if (!NT_SUCCESS(status))
+		goto Exit;
+
+	{
+		const LB_RULE_IMAGE_HEADER* header = (const LB_RULE_IMAGE_HEADER*)image;
+		const LB_MATCHER* matcher = (const LB_MATCHER*)(image + header->matcherOffset);
+		SIZE_T bytes = sizeof(LB_RULESET) + sizeof(LB_CLASSIFIER) + size;
+
+		// Binding only adds the regex state cache, so the image tells what the set will take before it is bound
+		if (matcher->engine == LB_MATCHER_ENGINE_REGEX)
+			bytes += LB_REGEX_CACHE_BYTES;
+		if (bytes > LbRuleSetBudget(header->memoryBudget))
+		{
+			status = STATUS_QUOTA_EXCEEDED;
+			goto Exit;
+		}
+
+		status = LbClassifierBindImage(image, size, header->tables, &result->classifier);
+		if (!NT_SUCCESS(status))
+			goto Exit;
+
+		result->matcher = (LB_MATCHER*)(image + header->matcherOffset);
+		status = LbMatcherBindImage(result->matcher, header->matcherSize);
+		if (!NT_SUCCESS(status))
+		{
+			result->matcher = NULL;
+			goto Exit;
+		}
+
+		result->image = image;
+		result->fields = header->fields;
+		result->async = (header->flags & LB_RULES_FLAG_ASYNC) != 0;
+		result->stream = (header->flags & LB_RULES_FLAG_STREAM) != 0;
+		result->streamChunk = header->streamChunk;
+		result->streamLookahead = header->streamLookahead;
+		result->memoryBudget = LbRuleSetBudget(header->memoryBudget);
+		result->generation = LbRuleSetNextGeneration();
+		result->bytes = LbRuleSetBytes(result);
+	}
+
+	*ruleSet = result;
+	return status;
+
+Exit:
+	if (result && result->classifier) LbClassifierFree(result->classifier);
+	if (result) LbFree(result, 'LBR0');
+	if (image) LbFree(image, 'LBR2');
+
+	return status;
+}
+
+////////////////
+// EVALUATION //
+////////////////
+
+LB_VERDICT LbRuleSetEvaluate(const LB_RULESET* ruleSet, const LB_FLOW_KEY* key, LB_DIRECTION direction)
+{
+	LB_VERDICT verdict = LbClassifierLookup(ruleSet->classifier, direction, key->remoteAddress, key->remotePort);
+
+	// Allow all other packets
+	if (verdict == LB_VERDICT_NONE)
+		return LB_VERDICT_PERMIT;
+
+	return verdict;
+}
+
+LB_VERDICT LbRuleSetEvaluatePorts(const LB_RULESET* ruleSet, const LB_FLOW_KEY* key, LB_DIRECTION direction)
+{
+	LB_VERDICT verdict = LbClassifierLookupPort(ruleSet->classifier, direction, key->remotePort);
+
+	if (verdict == LB_VERDICT_NONE)
+		return LB_VERDICT_PERMIT;
+
+	return verdict;
+}
@@ -0,0 +1,91 @@
+/*/
+/*  ** RuleSet.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the compiled rule set: the flow classifier plus the match engine for payload rewrites.
+/*	A rule set is built once, never modified afterwards, and shared by every classify call
+/*	until a newer one replaces it.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+#include "MatchEngine.h"
+#include "VerdictCache.h"
+#include "Classifier.h"
+
+struct LB_RULESET
+{
+	UINT32 generation;			// Unique per published rule set, lets flows notice their match state is stale
+	LB_CLASSIFIER* classifier;
+	LB_MATCHER* matcher;
+	UINT32 fields;				// LB_FIELD_* the match engine runs over, 0 for every payload byte
+	BOOLEAN async;				// LB_RULES_FLAG_ASYNC
+	BOOLEAN stream;				// LB_RULES_FLAG_STREAM
+	UINT32 streamChunk;			// LB_RULES_HEADER::streamChunk
+	UINT32 streamLookahead;		// LB_RULES_HEADER::streamLookahead
+	SIZE_T memoryBudget;		// Most pool it may take, see LbRuleSetBudget
+	SIZE_T bytes;				// Pool the rule set takes, see LbRuleSetBytes
+	void* image;				// Rule image the classifier tables and the matcher live in, NULL when they were compiled here
+	LbMatcherReplaceCallback* replace;	// Only set when the matcher was built at compile time, it is read-only and never freed
+};
+
+// Most pool a rule set may take: LB_RULES_MAX_BYTES, or less when the rules ask for less.
+// Nothing the caller sends can raise it or turn it off.
+inline SIZE_T LbRuleSetBudget(UINT32 requested)
+{
+	return requested != 0 && requested < LB_RULES_MAX_BYTES ? requested : LB_RULES_MAX_BYTES;
+}
+
+// Build a rule set from address rules, port rules and match/replace pairs. A set that could take more than
+// budget bytes of pool, the tables it is built in included, is rejected with STATUS_QUOTA_EXCEEDED before
+// they are allocated. 0 sets no limit, rules from user mode always get one.
+NTSTATUS LbRuleSetCompile(
+	const LB_ADDRESS_RULE* addressRules,
+	UINT32 addressRuleCount,
+	const LB_PORT_RULE* portRules,
+	UINT32 portRuleCount,
+	const LB_USERDATA* ud,
+	SIZE_T budget,
+	LB_RULESET** ruleSet
+);
+
+// Same with a matcher built at compile time (see StaticMatcher.h), replace is its specialized in place scan.
+// Only the classifier is built here.
+NTSTATUS LbRuleSetCompileStatic(
+	const LB_ADDRESS_RULE* addressRules,
+	UINT32 addressRuleCount,
+	const LB_PORT_RULE* portRules,
+	UINT32 portRuleCount,
+	const LB_MATCHER* matcher,
+	LbMatcherReplaceCallback* replace,
+	LB_RULESET** ruleSet
+);
+
+// Build a rule set from an IOCTL_LB_SET_RULES buffer, every length and count is validated.
+// The set has to fit LbRuleSetBudget of the buffer's memoryBudget.
+NTSTATUS LbRuleSetParse(const void* buffer, SIZE_T size, LB_RULESET** ruleSet);
+
+// Build a rule set from an IOCTL_LB_SET_RULE_IMAGE buffer. The image is copied once and used where it is,
+// every table in it is validated but none is rebuilt. The set has to fit LbRuleSetBudget of the image's memoryBudget.
+// buffer may be the caller's mapped pages and change during the call, it is read only by that one copy.
+NTSTATUS LbRuleSetLoadImage(const void* buffer, SIZE_T size, LB_RULESET** ruleSet);
+
+// Bytes of pool a rule set takes: itself, its classifier and match engine tables, and the regex state cache.
+// A matcher built at compile time is not counted, it is not in pool.
+SIZE_T LbRuleSetBytes(const LB_RULESET* ruleSet);
+
+// Free a rule set returned by LbRuleSetCompile, LbRuleSetCompileStatic, LbRuleSetParse or LbRuleSetLoadImage
+void LbRuleSetFree(LB_RULESET* ruleSet);
+
+// Decide what happens to every packet of an IPv4 flow travelling in the given direction
+LB_VERDICT LbRuleSetEvaluate(const LB_RULESET* ruleSet, const LB_FLOW_KEY* key, LB_DIRECTION direction);
+
+// Same for an IPv6 flow, only the port rules can match it
+LB_VERDICT LbRuleSetEvaluatePorts(const LB_RULESET* ruleSet, const LB_FLOW_KEY* key, LB_DIRECTION direction);
@@ -0,0 +1,111 @@
+/*/
+/*  ** SeqTracker.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the per-flow TCP sequence offset tracker.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- R. Elz, R. Bush, RFC 1982 "Serial Number Arithmetic", https://www.rfc-editor.org/rfc/rfc1982
+/*			* Sequence numbers wrap, so they are only ever compared through their signed difference.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "SeqTracker.h"
+
+/////////////
+// HELPERS //
+/////////////
+
+// a comes before b in sequence space
+static inline BOOLEAN LbSeqBefore(UINT32 a, UINT32 b)
+{
+	return (INT32)(a - b) < 0;
+}
+
+static inline INT32 LbSeqTrackerLastDelta(const LB_SEQ_TRACKER* tracker)
+{
+	return tracker->count > 0 ? tracker->edits[tracker->count - 1].delta : tracker->baseDelta;
+}
+
+////////////////
+// OPERATIONS //
+////////////////
+
+void LbSeqTrackerInitialize(LB_SEQ_TRACKER* tracker)
+{
+	memset(tracker, 0, sizeof(LB_SEQ_TRACKER));
+}
+
+BOOLEAN LbSeqTrackerIsActive(const LB_SEQ_TRACKER* tracker)
+{
+	return tracker->count > 0 || tracker->baseDelta != 0;
+}
+
+BOOLEAN LbSeqTrackerIsRetransmission(const LB_SEQ_TRACKER* tracker, UINT32 seq)
+{
+	return tracker->started && LbSeqBefore(seq, tracker->highestEnd);
+}
+
+void LbSeqTrackerRecord(LB_SEQ_TRACKER* tracker, UINT32 seq, UINT32 originalLength, UINT32 newLength)
+{
+	UINT32 end = seq + originalLength;
+
+	if (LbSeqTrackerIsRetransmission(tracker, seq))
+		return;
+
+	tracker->started = TRUE;
+	tracker->highestEnd = end;
+
+	if (newLength == originalLength)
+		return;
+
+	// Make room by folding the oldest edit into the base
+	if (tracker->count == LB_SEQ_TRACKER_EDITS)
+	{
+		tracker->baseDelta = tracker->edits[0].delta;
+		memmove(&tracker->edits[0], &tracker->edits[1], sizeof(LB_SEQ_EDIT) * (LB_SEQ_TRACKER_EDITS - 1));
+		tracker->count--;
+	}
+
+	LB_SEQ_EDIT* edit = &tracker->edits[tracker->count];
+	edit->originalStart = seq;
+	edit->originalEnd = end;
+	edit->delta = LbSeqTrackerLastDelta(tracker) + (INT32)(newLength - originalLength);
+	tracker->count++;
+}
+
+UINT32 LbSeqTrackerMapSeq(const LB_SEQ_TRACKER* tracker, UINT32 seq)
+{
+	// Newest edit that ends at or before seq decides how far seq moved
+	for (UINT32 i = tracker->count; i > 0; i--)
+	{
+		const LB_SEQ_EDIT* edit = &tracker->edits[i - 1];
+		if (!LbSeqBefore(seq, edit->originalEnd))
+			return seq + (UINT32)edit->delta;
+	}
+
+	return seq + (UINT32)tracker->baseDelta;
+}
+
+UINT32 LbSeqTrackerMapAck(const LB_SEQ_TRACKER* tracker, UINT32 ack)
+{
+	for (UINT32 i = tracker->count; i > 0; i--)
+	{
+		const LB_SEQ_EDIT* edit = &tracker->edits[i - 1];
+		INT32 previousDelta = i > 1 ? tracker->edits[i - 2].delta : tracker->baseDelta;
+
+		// Acknowledges all of the rewritten segment
+		if (!LbSeqBefore(ack, edit->originalEnd + (UINT32)edit->delta))
+			return ack - (UINT32)edit->delta;
+
+		// Acknowledges part of it, the client has to resend the whole segment anyway
+		if (LbSeqBefore(edit->originalStart + (UINT32)previousDelta, ack))
+			return edit->originalStart;
+	}
+
+	return ack - (UINT32)tracker->baseDelta;
+}
@@ -0,0 +1,58 @@
+/*/
+/*  ** SeqTracker.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the per-flow TCP sequence offset tracker.
+/*	Once a rewrite changes the size of a segment, every later sequence number the client sends
+/*	and every acknowledgement the server sends back are off by the total size change so far.
+/*	The tracker remembers where those changes happened so both directions can be translated.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+// Number of size changes remembered per flow. Older ones are folded into baseDelta,
+// by then the server has long acknowledged the bytes they cover.
+#define LB_SEQ_TRACKER_EDITS 16
+
+struct LB_SEQ_EDIT
+{
+	UINT32 originalStart;	// Original sequence number of the first byte of the rewritten segment
+	UINT32 originalEnd;		// Original sequence number right after the segment
+	INT32 delta;			// Total size change of everything up to originalEnd
+};
+
+struct LB_SEQ_TRACKER
+{
+	BOOLEAN started;		// highestEnd is only valid once the first segment was recorded
+	UINT32 highestEnd;		// Original sequence number right after the newest byte sent so far
+	UINT32 count;
+	INT32 baseDelta;		// Size change of every byte before the oldest remembered edit
+	LB_SEQ_EDIT edits[LB_SEQ_TRACKER_EDITS];	// Oldest first
+};
+
+// Reset a tracker to no size changes
+void LbSeqTrackerInitialize(LB_SEQ_TRACKER* tracker);
+
+// True once any segment of the flow changed size, every later segment then needs its sequence number moved
+BOOLEAN LbSeqTrackerIsActive(const LB_SEQ_TRACKER* tracker);
+
+// True when a segment starting at seq resends bytes that were already recorded
+BOOLEAN LbSeqTrackerIsRetransmission(const LB_SEQ_TRACKER* tracker, UINT32 seq);
+
+// Remember that the segment at seq shrank or grew from originalLength to newLength bytes.
+// Retransmissions are ignored, their size change was recorded the first time around.
+void LbSeqTrackerRecord(LB_SEQ_TRACKER* tracker, UINT32 seq, UINT32 originalLength, UINT32 newLength);
+
+// Translate the sequence number of an outgoing segment into the rewritten stream
+UINT32 LbSeqTrackerMapSeq(const LB_SEQ_TRACKER* tracker, UINT32 seq);
+
+// Translate an acknowledgement of the rewritten stream back into the original stream.
+// An acknowledgement that ends inside a rewritten segment maps to the start of that segment.
+UINT32 LbSeqTrackerMapAck(const LB_SEQ_TRACKER* tracker, UINT32 ack);
@@ -0,0 +1,149 @@
+/*/
+/*  ** Slab.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the per-processor object cache.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Jeff Bonwick, Jonathan Adams, "Magazines and Vmem: Extending the Slab Allocator
+/*		  to Many CPUs and Arbitrary Resources", USENIX 2001
+/*			* Per-processor stacks of free objects in front of a shared allocator.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "Slab.h"
+
+////////////////////
+// SLAB STRUCTURE //
+////////////////////
+
+// One per processor, aligned so two processors never write the same cache line
+struct DECLSPEC_ALIGN(64) LB_SLAB_CACHE
+{
+	volatile LONG busy;		// Non-zero while a caller owns the stack
+	UINT32 count;
+	void* objects[LB_SLAB_MAX_DEPTH];
+};
+
+struct LB_SLAB
+{
+	SIZE_T objectSize;
+	UINT32 depth;
+	UINT32 tag;
+	UINT32 processorCount;
+	LB_SLAB_CACHE* caches;	// Stored right after this struct, one per processor
+};
+
+/////////////
+// HELPERS //
+/////////////
+
+// Claim the current processor's stack. Never waits: if the stack is already owned
+// (a thread that moved processors, or a nested caller) the slab goes straight to the pool.
+static inline LB_SLAB_CACHE* LbSlabCacheAcquire(LB_SLAB* slab)
+{
+	LB_SLAB_CACHE* cache = &slab->caches[LbCurrentProcessor()];
+
+	if (LbInterlockedCompareExchange(&cache->busy, 1, 0) != 0)
+		return NULL;
+
+	return cache;
+}
+
+static inline void LbSlabCacheRelease(LB_SLAB_CACHE* cache)
+{
+	LbWriteRelease(&cache->busy, 0);
+}
+
+//////////////////////////
+// CREATION AND CLEANUP //
+//////////////////////////
+
+NTSTATUS LbSlabCreate(SIZE_T objectSize, UINT32 depth, UINT32 tag, LB_SLAB** slab)
+{
+	if (slab == NULL || objectSize == 0 || depth > LB_SLAB_MAX_DEPTH)
+		return STATUS_INVALID_PARAMETER;
+
+	*slab = NULL;
+
+	UINT32 processorCount = LbProcessorCount();
+	SIZE_T headerSize = (sizeof(LB_SLAB) + 63) & ~(SIZE_T)63;
+
+	// LbAlloc returns cache line aligned memory, so every cache stays on its own lines
+	LB_SLAB* result = (LB_SLAB*)LbAlloc(headerSize + sizeof(LB_SLAB_CACHE) * processorCount, tag);
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	result->objectSize = objectSize;
+	result->depth = depth;
+	result->tag = tag;
+	result->processorCount = processorCount;
+	result->caches = (LB_SLAB_CACHE*)((UINT8*)result + headerSize);
+
+	*slab = result;
+	return STATUS_SUCCESS;
+}
+
+void LbSlabDestroy(LB_SLAB* slab)
+{
+	if (!slab)
+		return;
+
+	for (UINT32 i = 0; i < slab->processorCount; i++)
+	{
+		LB_SLAB_CACHE* cache = &slab->caches[i];
+		while (cache->count > 0)
+			LbFree(cache->objects[--cache->count], slab->tag);
+	}
+
+	LbFree(slab, slab->tag);
+}
+
+////////////////
+// OPERATIONS //
+////////////////
+
+void* LbSlabAlloc(LB_SLAB* slab)
+{
+	void* object = NULL;
+	LB_SLAB_CACHE* cache = LbSlabCacheAcquire(slab);
+
+	if (cache)
+	{
+		if (cache->count > 0)
+			object = cache->objects[--cache->count];
+		LbSlabCacheRelease(cache);
+	}
+
+	// Stack empty or owned by someone else
+	if (!object)
+		object = LbAlloc(slab->objectSize, slab->tag);
+
+	return object;
+}
+
+void LbSlabFree(LB_SLAB* slab, void* object)
+{
+	if (!object)
+		return;
+
+	LB_SLAB_CACHE* cache = LbSlabCacheAcquire(slab);
+
+	if (cache)
+	{
+		if (cache->count < slab->depth)
+		{
+			cache->objects[cache->count++] = object;
+			object = NULL;
+		}
+		LbSlabCacheRelease(cache);
+	}
+
+	// Stack full or owned by someone else
+	if (object)
+		LbFree(object, slab->tag);
+}
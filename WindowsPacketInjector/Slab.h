@@ -0,0 +1,36 @@
+/*/
+/*  ** Slab.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the per-processor object cache used by the classify path.
+/*	Every slab hands out objects of one fixed size. Each processor keeps a small stack of free
+/*	objects it can reach without touching any other processor's memory, only when that stack
+/*	is empty (or full on free) does the slab fall back to the pool.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+// Upper bound for the depth of every per-processor stack
+#define LB_SLAB_MAX_DEPTH 64
+
+struct LB_SLAB;
+
+// Create a slab for objects of objectSize bytes. depth is the number of free objects each processor
+// may hold on to (at most LB_SLAB_MAX_DEPTH), keep it small for large objects.
+NTSTATUS LbSlabCreate(SIZE_T objectSize, UINT32 depth, UINT32 tag, LB_SLAB** slab);
+
+// Free every cached object and the slab itself, every object must have been returned first
+void LbSlabDestroy(LB_SLAB* slab);
+
+// Take an object, its contents are undefined. Returns NULL when the pool is exhausted.
+void* LbSlabAlloc(LB_SLAB* slab);
+
+// Return an object taken from the same slab
+void LbSlabFree(LB_SLAB* slab, void* object);
@@ -0,0 +1,114 @@
+/*/
+/*  ** SpanIterator.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains a zero copy view over the bytes of a chained buffer. A NET_BUFFER describes its data as
+/*	DataLength bytes starting CurrentMdlOffset bytes into CurrentMdl, continuing through the MDL chain.
+/*	The iterator hands those bytes out as exact (pointer, length) spans, one per buffer, so a matcher
+/*	can run over them in a single pass. Data that fits in one MDL comes out as exactly one span.
+/*
+/*	The walk is written against three small accessors (LbSpanNodeNext, LbSpanNodeSize and LbSpanNodeMap)
+/*	instead of MDL itself. The driver gets the MDL versions below, user mode code can walk chains of
+/*	its own by providing the same three functions for its node type.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+struct LB_SPAN
+{
+	UINT8* data;
+	SIZE_T length;
+};
+
+template <typename NODE>
+struct LB_SPAN_ITERATOR
+{
+	NODE* node;			// Next buffer to hand out
+	SIZE_T offset;		// Bytes to skip in node, only ever non-zero before the first span
+	SIZE_T remaining;	// Bytes of the data not handed out yet
+};
+
+///////////////////
+// MDL ACCESSORS //
+///////////////////
+
+#if defined(_KERNEL_MODE)
+
+inline MDL* LbSpanNodeNext(MDL* mdl)
+{
+	return mdl->Next;
+}
+
+inline SIZE_T LbSpanNodeSize(MDL* mdl)
+{
+	return MmGetMdlByteCount(mdl);
+}
+
+// NULL when the buffer cannot be mapped, the walk then stops
+inline UINT8* LbSpanNodeMap(MDL* mdl)
+{
+	return (UINT8*)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+}
+
+#endif
+
+//////////////
+// ITERATOR //
+//////////////
+
+// Start a walk over length bytes, beginning offset bytes into first
+template <typename NODE>
+inline void LbSpanBegin(LB_SPAN_ITERATOR<NODE>* it, NODE* first, SIZE_T offset, SIZE_T length)
+{
+	it->node = first;
+	it->offset = offset;
+	it->remaining = length;
+}
+
+// Fetch the next span. Returns FALSE once the data is exhausted, or early when a buffer could not be
+// mapped or the chain is shorter than the data; it->remaining is non-zero in those two cases.
+template <typename NODE>
+inline BOOLEAN LbSpanNext(LB_SPAN_ITERATOR<NODE>* it, LB_SPAN* span)
+{
+	while (it->remaining != 0 && it->node != NULL)
+	{
+		NODE* node = it->node;
+		SIZE_T size = LbSpanNodeSize(node);
+
+		it->node = LbSpanNodeNext(node);
+
+		// Skipped and empty buffers are never mapped
+		if (it->offset >= size)
+		{
+			it->offset -= size;
+			continue;
+		}
+
+		// The caller works on this span next, by then the following node is in the cache
+		if (it->node != NULL)
+			LbPrefetch(it->node);
+
+		UINT8* data = LbSpanNodeMap(node);
+		if (data == NULL)
+		{
+			it->node = NULL;
+			return FALSE;
+		}
+
+		span->data = data + it->offset;
+		span->length = size - it->offset < it->remaining ? size - it->offset : it->remaining;
+
+		it->offset = 0;
+		it->remaining -= span->length;
+		return TRUE;
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,659 @@
+/*/
+/*  ** StaticMatcher.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the match and replace engine for pair lists that are fixed when the driver is built.
+/*	The compiler runs the same Aho-Corasick construction LbMatcherCompile runs at startup, so the
+/*	transition table, the first byte sets and every pattern's offsets end up as read-only data in the
+/*	image. Nothing is built and nothing is allocated when the driver loads.
+/*
+/*	LB_STATIC_MATCHER<Rules> hands out two things built from one list:
+/*		- Matcher(), an LB_MATCHER block in the plainest layout every LbMatcher* function reads: a class of
+/*		  its own for every byte and 32-bit states, numbered in the order the trie was built in.
+/*		- Replace(), an in place scan specialized for the list. States are as narrow as the list allows,
+/*		  the first bytes are constants, and away from the end of a buffer every pattern is compared
+/*		  against one word of data in fully unrolled code instead of walking the automaton.
+/*	UserData() turns the same list into an LB_USERDATA, for when it should be compiled at runtime instead.
+/*
+/*	A rule list is a type with a constexpr Get() returning an LB_STATIC_RULES, for example:
+/*		struct MY_RULES { static constexpr LB_STATIC_RULES<1> Get() { return { false, { { "Love", "Hate" } } }; } };
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Alfred V. Aho and Margaret J. Corasick, "Efficient String Matching: An Aid to
+/*		  Bibliographic Search", Communications of the ACM 18(6), 1975
+/*			* Original description of the goto/failure/output automaton built here.
+/*
+/*	ADDITIONAL NOTES:
+/*	The tables are built by constant evaluation, which compilers cap. A list of a few dozen short pairs
+/*	stays well below the defaults, longer ones may need /constexpr:steps (MSVC) or -fconstexpr-ops-limit.
+/*
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "MatchEngine.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LB_STATIC_SSE2 1
+#endif
+
+// Longest pattern the specialized scan compares directly instead of walking the automaton, one word each
+#define LB_STATIC_UNROLL_MAX 8
+
+////////////////
+// RULE LISTS //
+////////////////
+
+struct LB_STATIC_PAIR
+{
+	const char* match;
+	const char* replace;
+};
+
+template <UINT32 Count>
+struct LB_STATIC_RULES
+{
+	bool reversal;					// Same as LB_USERDATA::enableReversal
+	LB_STATIC_PAIR pairs[Count];
+};
+
+template <UINT32 Count>
+constexpr UINT32 LbStaticPairCount(const LB_STATIC_RULES<Count>&)
+{
+	return Count;
+}
+
+template <UINT32 Count>
+constexpr UINT32 LbStaticPatternCount(const LB_STATIC_RULES<Count>& rules)
+{
+	return rules.reversal ? Count * 2 : Count;
+}
+
+// Pattern p of a list, numbered the way LbMatcherCompile numbers them
+template <UINT32 Count>
+constexpr const char* LbStaticPattern(const LB_STATIC_RULES<Count>& rules, UINT32 p)
+{
+	return !rules.reversal ? rules.pairs[p].match : (p & 1) ? rules.pairs[p / 2].replace : rules.pairs[p / 2].match;
+}
+
+constexpr UINT32 LbStaticLength(const char* string)
+{
+	UINT32 length = 0;
+	while (string[length] != '\0')
+		length++;
+	return length;
+}
+
+constexpr bool LbStaticContains(const char* haystack, const char* needle)
+{
+	UINT32 haystackLength = LbStaticLength(haystack);
+	UINT32 needleLength = LbStaticLength(needle);
+
+	for (UINT32 start = 0; start + needleLength <= haystackLength; start++)
+	{
+		UINT32 i = 0;
+		while (i < needleLength && haystack[start + i] == needle[i])
+			i++;
+		if (i == needleLength)
+			return true;
+	}
+
+	return false;
+}
+
+// LbMatcherCompile turns away the same lists
+template <UINT32 Count>
+constexpr bool LbStaticValid(const LB_STATIC_RULES<Count>& rules)
+{
+	for (UINT32 i = 0; i < Count; i++)
+	{
+		if (rules.pairs[i].match == NULL || rules.pairs[i].replace == NULL)
+			return false;
+		if (rules.pairs[i].match[0] == '\0' || rules.pairs[i].replace[0] == '\0')
+			return false;
+	}
+
+	return true;
+}
+
+// The trie never needs more than one state per pattern byte, plus the root
+template <UINT32 Count>
+constexpr UINT32 LbStaticMaxStates(const LB_STATIC_RULES<Count>& rules)
+{
+	UINT32 states = 1;
+	for (UINT32 p = 0; p < LbStaticPatternCount(rules); p++)
+		states += LbStaticLength(LbStaticPattern(rules, p));
+	return states;
+}
+
+// Every pair is stored once and shared by both directions
+template <UINT32 Count>
+constexpr UINT32 LbStaticStringBytes(const LB_STATIC_RULES<Count>& rules)
+{
+	UINT32 bytes = 0;
+	for (UINT32 i = 0; i < Count; i++)
+		bytes += LbStaticLength(rules.pairs[i].match) + LbStaticLength(rules.pairs[i].replace);
+	return bytes;
+}
+
+template <UINT32 Count>
+constexpr UINT32 LbStaticMaxMatchLength(const LB_STATIC_RULES<Count>& rules)
+{
+	UINT32 longest = 0;
+	for (UINT32 p = 0; p < LbStaticPatternCount(rules); p++)
+	{
+		if (LbStaticLength(LbStaticPattern(rules, p)) > longest)
+			longest = LbStaticLength(LbStaticPattern(rules, p));
+	}
+	return longest;
+}
+
+template <UINT32 Count>
+constexpr bool LbStaticEqualLength(const LB_STATIC_RULES<Count>& rules)
+{
+	for (UINT32 i = 0; i < Count; i++)
+	{
+		if (LbStaticLength(rules.pairs[i].match) != LbStaticLength(rules.pairs[i].replace))
+			return false;
+	}
+
+	return true;
+}
+
+// True when no pattern occurs inside of another one, duplicates included. Then the first match to end
+// is also the first one to start, so testing every pattern where a candidate starts finds exactly
+// what the automaton would have.
+template <UINT32 Count>
+constexpr bool LbStaticSubstringFree(const LB_STATIC_RULES<Count>& rules)
+{
+	for (UINT32 a = 0; a < LbStaticPatternCount(rules); a++)
+	{
+		for (UINT32 b = 0; b < LbStaticPatternCount(rules); b++)
+		{
+			if (a != b && LbStaticContains(LbStaticPattern(rules, a), LbStaticPattern(rules, b)))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+////////////
+// TABLES //
+////////////
+
+// An LB_MATCHER block as one type. Every member after the header is an array of 4 byte or smaller
+// elements, so none of them is padded and the offsets in the header are plain sums of their sizes.
+template <UINT32 States, UINT32 Patterns, UINT32 Strings>
+struct LB_STATIC_BLOCK
+{
+	LB_MATCHER header;
+	UINT32 transitions[States * 256];
+	UINT32 outputs[States];
+	UINT32 depths[States];
+	LB_MATCHER_PATTERN patterns[Patterns];
+	UINT8 strings[Strings];
+	UINT8 classes[256];				// Every byte is its own class
+};
+
+// The automaton again, in the narrowest state type that holds every state
+template <typename STATE, UINT32 States>
+struct LB_STATIC_AUTOMATON
+{
+	STATE transitions[States * 256];
+	STATE outputs[States];
+};
+
+template <bool Byte, bool Word>
+struct LB_STATIC_STATE_TYPE
+{
+	typedef UINT32 Type;
+};
+
+template <bool Word>
+struct LB_STATIC_STATE_TYPE<true, Word>
+{
+	typedef UINT8 Type;
+};
+
+template <>
+struct LB_STATIC_STATE_TYPE<false, true>
+{
+	typedef UINT16 Type;
+};
+
+// Same construction as LbMatcherCompile, step for step, without the byte classes and the breadth first
+// numbering it adds at the end. Those only save memory, which a few pairs in the image do not need.
+template <typename RULES, UINT32 States, UINT32 Patterns, UINT32 Strings>
+constexpr LB_STATIC_BLOCK<States, Patterns, Strings> LbStaticBuild()
+{
+	const auto rules = RULES::Get();
+	const UINT32 pairCount = LbStaticPairCount(rules);
+	LB_STATIC_BLOCK<States, Patterns, Strings> block{};
+	LB_MATCHER& header = block.header;
+	UINT32 fail[States] = {};
+	UINT32 queue[States] = {};
+	UINT8 alphabet[256] = {};	// Bytes some pattern contains, any other byte leads back to the root from every state
+	bool used[256] = {};
+	UINT32 alphabetSize = 0;
+	UINT32 stateCount = 1;
+	bool equalLength = true;
+
+	for (UINT32 i = 0; i < pairCount; i++)
+	{
+		UINT32 matchLength = LbStaticLength(rules.pairs[i].match);
+		UINT32 replaceLength = LbStaticLength(rules.pairs[i].replace);
+		UINT32 shortest = matchLength;
+		UINT32 longest = replaceLength;
+
+		if (matchLength != replaceLength)
+			equalLength = false;
+		if (rules.reversal && replaceLength < matchLength)
+			shortest = replaceLength;
+		if (rules.reversal && matchLength > replaceLength)
+			longest = matchLength;
+		if (header.minMatchLength == 0 || shortest < header.minMatchLength)
+			header.minMatchLength = shortest;
+		if (longest > header.maxReplaceLength)
+			header.maxReplaceLength = longest;
+	}
+
+	// Insert every pattern into the trie
+	for (UINT32 p = 0; p < Patterns; p++)
+	{
+		const char* pattern = LbStaticPattern(rules, p);
+		UINT32 state = LB_MATCHER_ROOT_STATE;
+
+		for (UINT32 i = 0; pattern[i] != '\0'; i++)
+		{
+			UINT8 c = (UINT8)pattern[i];
+			UINT32 edge = state * 256 + c;
+
+			if (!used[c])
+			{
+				used[c] = true;
+				alphabet[alphabetSize++] = c;
+			}
+
+			if (block.transitions[edge] == 0)
+			{
+				block.depths[stateCount] = i + 1;
+				block.transitions[edge] = stateCount++;
+			}
+			state = block.transitions[edge];
+		}
+
+		if (block.outputs[state] == 0)
+			block.outputs[state] = p + 1;
+	}
+
+	// Resolve the failure links into full transitions. Columns outside of the alphabet are all 0 already,
+	// which is the root, so only the alphabet is walked.
+	{
+		UINT32 head = 0;
+		UINT32 tail = 0;
+
+		for (UINT32 a = 0; a < alphabetSize; a++)
+		{
+			UINT32 next = block.transitions[alphabet[a]];
+			if (next != 0)
+			{
+				fail[next] = LB_MATCHER_ROOT_STATE;
+				queue[tail++] = next;
+			}
+		}
+
+		while (head < tail)
+		{
+			UINT32 state = queue[head++];
+
+			if (block.outputs[state] == 0)
+				block.outputs[state] = block.outputs[fail[state]];
+
+			for (UINT32 a = 0; a < alphabetSize; a++)
+			{
+				UINT32 edge = state * 256 + alphabet[a];
+				UINT32 fallback = block.transitions[fail[state] * 256 + alphabet[a]];
+
+				if (block.transitions[edge] != 0)
+				{
+					fail[block.transitions[edge]] = fallback;
+					queue[tail++] = block.transitions[edge];
+				}
+				else
+				{
+					block.transitions[edge] = fallback;
+				}
+			}
+		}
+	}
+
+	header.size = (UINT32)sizeof(LB_STATIC_BLOCK<States, Patterns, Strings>);
+	header.engine = LB_MATCHER_ENGINE_AUTOMATON;
+	header.stateCount = stateCount;
+	header.patternCount = Patterns;
+	header.equalLength = equalLength;
+	header.transitionOffset = (UINT32)sizeof(LB_MATCHER);
+	header.outputOffset = header.transitionOffset + States * 256 * (UINT32)sizeof(UINT32);
+	header.depthOffset = header.outputOffset + States * (UINT32)sizeof(UINT32);
+	header.patternOffset = header.depthOffset + States * (UINT32)sizeof(UINT32);
+	header.stringOffset = header.patternOffset + Patterns * (UINT32)sizeof(LB_MATCHER_PATTERN);
+	header.classCount = 256;
+	header.stateWidth = (UINT32)sizeof(UINT32);
+	header.classOffset = header.stringOffset + Strings;
+
+	for (UINT32 c = 0; c < 256; c++)
+		block.classes[c] = (UINT8)c;
+
+	for (UINT32 c = 0; c < 256; c++)
+	{
+		if (block.transitions[c] == LB_MATCHER_ROOT_STATE)
+			continue;
+
+		if (header.firstByteCount < LB_PREFILTER_MAX_BYTES)
+			header.firstBytes[header.firstByteCount] = (UINT8)c;
+		header.firstByteCount++;
+		header.firstByteMap[c >> 3] |= (UINT8)(1 << (c & 7));
+	}
+
+	// Copy the strings, offsets are from the start of the block like in every other LB_MATCHER
+	UINT32 cursor = 0;
+	for (UINT32 i = 0; i < pairCount; i++)
+	{
+		const char* match = rules.pairs[i].match;
+		const char* replace = rules.pairs[i].replace;
+		UINT32 matchLength = LbStaticLength(match);
+		UINT32 replaceLength = LbStaticLength(replace);
+		UINT32 matchOffset = header.stringOffset + cursor;
+		UINT32 replaceOffset = matchOffset + matchLength;
+
+		for (UINT32 k = 0; k < matchLength; k++)
+			block.strings[cursor++] = (UINT8)match[k];
+		for (UINT32 k = 0; k < replaceLength; k++)
+			block.strings[cursor++] = (UINT8)replace[k];
+
+		LB_MATCHER_PATTERN& forward = block.patterns[rules.reversal ? i * 2 : i];
+		forward.matchOffset = matchOffset;
+		forward.matchLength = matchLength;
+		forward.replaceOffset = replaceOffset;
+		forward.replaceLength = replaceLength;
+
+		if (rules.reversal)
+		{
+			LB_MATCHER_PATTERN& backward = block.patterns[i * 2 + 1];
+			backward.matchOffset = replaceOffset;
+			backward.matchLength = replaceLength;
+			backward.replaceOffset = matchOffset;
+			backward.replaceLength = matchLength;
+		}
+	}
+
+	return block;
+}
+
+// Pattern p's bytes (or a mask of them) as the word loading them gives. Every target is little endian.
+template <UINT32 States, UINT32 Patterns, UINT32 Strings>
+constexpr UINT64 LbStaticPatternWord(const LB_STATIC_BLOCK<States, Patterns, Strings>& block, UINT32 p, bool mask)
+{
+	const LB_MATCHER_PATTERN& pattern = block.patterns[p];
+	UINT64 word = 0;
+
+	for (UINT32 k = 0; k < pattern.matchLength && k < sizeof(UINT64); k++)
+		word |= (UINT64)(mask ? 0xFF : block.strings[pattern.matchOffset - block.header.stringOffset + k]) << (8 * k);
+
+	return word;
+}
+
+template <typename STATE, UINT32 States, UINT32 Patterns, UINT32 Strings>
+constexpr LB_STATIC_AUTOMATON<STATE, States> LbStaticNarrow(const LB_STATIC_BLOCK<States, Patterns, Strings>& block)
+{
+	LB_STATIC_AUTOMATON<STATE, States> automaton{};
+
+	for (UINT32 i = 0; i < block.header.stateCount * 256; i++)
+		automaton.transitions[i] = (STATE)block.transitions[i];
+	for (UINT32 state = 0; state < block.header.stateCount; state++)
+		automaton.outputs[state] = (STATE)block.outputs[state];
+
+	return automaton;
+}
+
+/////////////
+// MATCHER //
+/////////////
+
+template <typename RULES>
+struct LB_STATIC_MATCHER
+{
+	static_assert(LbStaticValid(RULES::Get()), "every match and replace string needs at least one byte");
+
+	static constexpr UINT32 pairCount = LbStaticPairCount(RULES::Get());
+	static constexpr UINT32 patternCount = LbStaticPatternCount(RULES::Get());
+	static constexpr UINT32 maxStates = LbStaticMaxStates(RULES::Get());
+	static constexpr UINT32 stringBytes = LbStaticStringBytes(RULES::Get());
+	static constexpr UINT32 maxMatchLength = LbStaticMaxMatchLength(RULES::Get());
+
+	// Whether Replace compares patterns directly wherever all of them still fit in the buffer. A pair that
+	// changes the length leaves the automaton where it is instead of at the root, only it can follow that.
+	static constexpr bool unrolled = LbStaticEqualLength(RULES::Get()) && LbStaticSubstringFree(RULES::Get()) &&
+		maxMatchLength <= LB_STATIC_UNROLL_MAX;
+
+	typedef typename LB_STATIC_STATE_TYPE<maxStates <= 0x100, maxStates <= 0x10000>::Type STATE;
+	typedef LB_STATIC_BLOCK<maxStates, patternCount, stringBytes> BLOCK;
+
+	static_assert(sizeof(BLOCK) - (sizeof(LB_MATCHER) + maxStates * 258 * sizeof(UINT32) +
+		patternCount * sizeof(LB_MATCHER_PATTERN) + stringBytes + 256) < alignof(LB_MATCHER), "block tables must not be padded");
+
+	static constexpr BLOCK block = LbStaticBuild<RULES, maxStates, patternCount, stringBytes>();
+	static constexpr LB_STATIC_AUTOMATON<STATE, maxStates> automaton = LbStaticNarrow<STATE>(block);
+
+	// The list as a matcher the runtime engine scans, it is read-only and must never be freed
+	static const LB_MATCHER* Matcher()
+	{
+		return &block.header;
+	}
+
+	// The list as an LB_USERDATA for LbMatcherCompile, pairs must have room for pairCount entries
+	static void UserData(LB_MATCH_AND_REPLACE* pairs, LB_USERDATA* ud);
+
+	// Same as LbMatcherReplace on Matcher(), state included. Fits LbMatcherReplaceCallback.
+	static UINT32 Replace(UINT32* state, UINT8* data, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits);
+
+private:
+	static SIZE_T NextCandidate(const UINT8* data, SIZE_T start, SIZE_T length);
+};
+
+template <typename RULES>
+constexpr typename LB_STATIC_MATCHER<RULES>::BLOCK LB_STATIC_MATCHER<RULES>::block;
+
+template <typename RULES>
+constexpr LB_STATIC_AUTOMATON<typename LB_STATIC_MATCHER<RULES>::STATE, LB_STATIC_MATCHER<RULES>::maxStates> LB_STATIC_MATCHER<RULES>::automaton;
+
+//////////////////////////
+// UNROLLED COMPARISONS //
+//////////////////////////
+
+// Index + 1 of the pattern an 8 byte word of data starts with, trying pattern P onwards, 0 when none does.
+// Each pattern is one masked compare against a constant. No pattern starts with another one, so at most
+// one of them matches and the results are added up without a branch between them.
+template <typename MATCHER, UINT32 P, bool Done = (!MATCHER::unrolled || P == MATCHER::patternCount)>
+struct LB_STATIC_COMPARE
+{
+	static constexpr UINT64 value = LbStaticPatternWord(MATCHER::block, P, false);
+	static constexpr UINT64 mask = LbStaticPatternWord(MATCHER::block, P, true);
+
+	static inline UINT32 Find(UINT64 word)
+	{
+		return ((word & mask) == value ? P + 1 : 0) + LB_STATIC_COMPARE<MATCHER, P + 1>::Find(word);
+	}
+};
+
+template <typename MATCHER, UINT32 P>
+struct LB_STATIC_COMPARE<MATCHER, P, true>
+{
+	static inline UINT32 Find(UINT64)
+	{
+		return 0;
+	}
+};
+
+#if defined(LB_STATIC_SSE2)
+
+// Bytes of a chunk that equal first byte N or any after it. Each byte is a constant the compiler folds into
+// the compare, where a loop over them would load and broadcast every one of them again for each chunk.
+// Only the first LB_PREFILTER_MAX_BYTES are kept, a list with more never calls it.
+template <typename MATCHER, UINT32 N, bool Done = (N + 1 >= MATCHER::block.header.firstByteCount || N + 1 >= LB_PREFILTER_MAX_BYTES)>
+struct LB_STATIC_FIRST_BYTES
+{
+	static constexpr UINT8 value = MATCHER::block.header.firstBytes[N];
+
+	static inline __m128i Hits(__m128i chunk)
+	{
+		return _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8((char)value)), LB_STATIC_FIRST_BYTES<MATCHER, N + 1>::Hits(chunk));
+	}
+};
+
+template <typename MATCHER, UINT32 N>
+struct LB_STATIC_FIRST_BYTES<MATCHER, N, true>
+{
+	static constexpr UINT8 value = MATCHER::block.header.firstBytes[N];
+
+	static inline __m128i Hits(__m128i chunk)
+	{
+		return _mm_cmpeq_epi8(chunk, _mm_set1_epi8((char)value));
+	}
+};
+
+#endif
+
+/////////////////////
+// MATCH & REPLACE //
+/////////////////////
+
+template <typename RULES>
+void LB_STATIC_MATCHER<RULES>::UserData(LB_MATCH_AND_REPLACE* pairs, LB_USERDATA* ud)
+{
+	const auto rules = RULES::Get();
+
+	for (UINT32 i = 0; i < pairCount; i++)
+	{
+		pairs[i].match = (char*)rules.pairs[i].match;
+		pairs[i].replace = (char*)rules.pairs[i].replace;
+	}
+
+	ud->count = (int)pairCount;
+	ud->enableReversal = rules.reversal;
+	ud->regex = false;
+	ud->strArray = pairs;
+}
+
+// LbMatcherNextCandidate with the first bytes as constants
+template <typename RULES>
+SIZE_T LB_STATIC_MATCHER<RULES>::NextCandidate(const UINT8* data, SIZE_T start, SIZE_T length)
+{
+	const LB_MATCHER& header = block.header;
+	SIZE_T i = start;
+
+#if defined(LB_STATIC_SSE2)
+	if (header.firstByteCount <= LB_PREFILTER_MAX_BYTES)
+	{
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i chunk = _mm_loadu_si128((const __m128i*)&data[i]);
+			UINT32 mask = (UINT32)_mm_movemask_epi8(LB_STATIC_FIRST_BYTES<LB_STATIC_MATCHER, 0>::Hits(chunk));
+			if (mask != 0)
+			{
+#if defined(_MSC_VER)
+				unsigned long bit;
+				_BitScanForward(&bit, mask);
+				return i + bit;
+#else
+				return i + (SIZE_T)__builtin_ctz(mask);
+#endif
+			}
+		}
+	}
+#endif
+
+	for (; i < length; i++)
+	{
+		if (header.firstByteMap[data[i] >> 3] & (1 << (data[i] & 7)))
+			return i;
+	}
+
+	return length;
+}
+
+template <typename RULES>
+UINT32 LB_STATIC_MATCHER<RULES>::Replace(UINT32* state, UINT8* data, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits)
+{
+	const LB_MATCHER_PATTERN* patterns = block.patterns;
+	UINT32 current = *state;
+	UINT32 replacements = 0;
+	SIZE_T i = 0;
+
+	// Before limit a whole word can be loaded, and every pattern starting at a byte ends inside the buffer.
+	// From there on a match may carry over into the next one, which only the automaton can keep track of.
+	SIZE_T limit = (unrolled && length >= sizeof(UINT64)) ? length - sizeof(UINT64) + 1 : 0;
+
+	while (i < length)
+	{
+		if (current == LB_MATCHER_ROOT_STATE)
+		{
+			if (i < limit)
+			{
+				// Candidates come in runs in text that is full of them, the next byte is tested on its own first
+				if (!(block.header.firstByteMap[data[i] >> 3] & (1 << (data[i] & 7))))
+					i = NextCandidate(data, i, limit);
+				if (i >= limit)
+					continue;
+
+				UINT64 word;
+				memcpy(&word, &data[i], sizeof(word));
+
+				UINT32 out = LB_STATIC_COMPARE<LB_STATIC_MATCHER, 0>::Find(word);
+				if (out == 0)
+				{
+					i++;
+					continue;
+				}
+
+				const LB_MATCHER_PATTERN* pattern = &patterns[out - 1];
+				const UINT8* replace = (const UINT8*)&block + pattern->replaceOffset;
+
+				if (edits)
+					LbChecksumEdit(edits, i, &data[i], replace, pattern->replaceLength);
+				memcpy(&data[i], replace, pattern->replaceLength);
+				replacements++;
+
+				i += pattern->matchLength;
+				continue;
+			}
+
+			i = NextCandidate(data, i, length);
+			if (i == length)
+				break;
+		}
+
+		// The automaton, for a match carried in from the previous buffer and for the end of this one
+		current = automaton.transitions[(SIZE_T)current * 256 + data[i++]];
+
+		UINT32 out = automaton.outputs[current];
+		if (out == 0 || patterns[out - 1].matchLength != patterns[out - 1].replaceLength)
+			continue;
+
+		// A match that started in an earlier buffer is rewritten whole or not at all, as LbMatcherReplace does
+		const LB_MATCHER_PATTERN* pattern = &patterns[out - 1];
+		if (LbMatcherWriteReplacement(spans, data, i, (const UINT8*)&block + pattern->replaceOffset, pattern->matchLength, edits))
+			replacements++;
+
+		current = LB_MATCHER_ROOT_STATE;
+	}
+
+	*state = current;
+	return replacements;
+}
@@ -0,0 +1,102 @@
+/*/
+/*  ** Stats.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the per-processor counters and latency histograms.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Gil Tene, HdrHistogram, https://github.com/HdrHistogram/HdrHistogram
+/*			* Log-linear buckets keep a fixed relative error over a huge range in very little memory.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "Stats.h"
+
+/////////////
+// GLOBALS //
+/////////////
+
+LB_STATS_PROCESSOR* lbStatsProcessors = NULL;
+
+static UINT32 lbStatsProcessorCount = 0;
+
+// Both clocks read at initialization, the cycle counter frequency is measured against the timestamp
+static UINT64 lbStatsStartCycles = 0;
+static UINT64 lbStatsStartTimestamp = 0;
+
+//////////////////////////
+// CREATION AND CLEANUP //
+//////////////////////////
+
+NTSTATUS LbStatsInitialize()
+{
+	UINT32 processorCount = LbProcessorCount();
+
+	// LbAlloc returns zeroed, cache line aligned memory
+	lbStatsProcessors = (LB_STATS_PROCESSOR*)LbAlloc(sizeof(LB_STATS_PROCESSOR) * processorCount, 'LBS0');
+	if (!lbStatsProcessors)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	lbStatsProcessorCount = processorCount;
+	lbStatsStartCycles = LbCycles();
+	lbStatsStartTimestamp = LbTimestamp();
+
+	return STATUS_SUCCESS;
+}
+
+void LbStatsCleanup()
+{
+	if (lbStatsProcessors)
+	{
+		LbFree(lbStatsProcessors, 'LBS0');
+		lbStatsProcessors = NULL;
+	}
+
+	lbStatsProcessorCount = 0;
+}
+
+//////////////
+// SNAPSHOT //
+//////////////
+
+void LbStatsSnapshot(LB_STATS_SNAPSHOT* snapshot)
+{
+	memset(snapshot, 0, sizeof(LB_STATS_SNAPSHOT));
+	snapshot->sampleInterval = LB_STATS_SAMPLE_INTERVAL;
+
+	if (!lbStatsProcessors)
+		return;
+
+	// Values keep moving while they are added up, every one of them is still a valid 64 bit read
+	for (UINT32 i = 0; i < lbStatsProcessorCount; i++)
+	{
+		const LB_STATS_PROCESSOR* stats = &lbStatsProcessors[i];
+
+		for (int counter = 0; counter < LB_COUNTER_COUNT; counter++)
+			snapshot->counters[counter] += stats->counters[counter];
+
+		for (int stage = 0; stage < LB_STAGE_COUNT; stage++)
+		{
+			for (int bucket = 0; bucket < LB_HISTOGRAM_BUCKETS; bucket++)
+				snapshot->histograms[stage][bucket] += stats->histograms[stage][bucket];
+		}
+	}
+
+	snapshot->cyclesPerSecond = LbStatsCyclesPerSecond();
+}
+
+UINT64 LbStatsCyclesPerSecond()
+{
+	// Split up so cycles * frequency cannot overflow
+	UINT64 cycles = LbCycles() - lbStatsStartCycles;
+	UINT64 ticks = LbTimestamp() - lbStatsStartTimestamp;
+	UINT64 frequency = LbTimestampFrequency();
+	if (ticks == 0)
+		return 0;
+
+	return cycles / ticks * frequency + cycles % ticks * frequency / ticks;
+}
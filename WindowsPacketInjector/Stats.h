@@ -0,0 +1,104 @@
+/*/
+/*  ** Stats.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the per-processor counters and latency histograms of the classify path.
+/*	Each processor only ever writes its own cache lines with plain increments, the totals are only
+/*	added up when someone asks for them. Counters see every call, timing every call would cost more
+/*	than what it measures, so only one call in LB_STATS_SAMPLE_INTERVAL per processor is timed.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+
+#define LB_STATS_SAMPLE_INTERVAL 16
+
+struct DECLSPEC_ALIGN(64) LB_STATS_PROCESSOR
+{
+	UINT64 counters[LB_COUNTER_COUNT];
+	UINT32 sampleCountdown;
+	UINT64 histograms[LB_STAGE_COUNT][LB_HISTOGRAM_BUCKETS];
+};
+
+// One per processor, NULL until LbStatsInitialize
+extern LB_STATS_PROCESSOR* lbStatsProcessors;
+
+NTSTATUS LbStatsInitialize();
+
+// Frees the statistics, nothing may still be recording
+void LbStatsCleanup();
+
+// Sum every processor's counters and histograms
+void LbStatsSnapshot(LB_STATS_SNAPSHOT* snapshot);
+
+// Cycle counter frequency, measured since LbStatsInitialize
+UINT64 LbStatsCyclesPerSecond();
+
+// Convert a LbTimestamp() difference into cycles, for stages that start and end on different processors
+inline UINT64 LbStatsTicksToCycles(UINT64 ticks, UINT64 cyclesPerSecond)
+{
+	UINT64 frequency = LbTimestampFrequency();
+
+	// Split up so ticks * cyclesPerSecond cannot overflow
+	return ticks / frequency * cyclesPerSecond + ticks % frequency * cyclesPerSecond / frequency;
+}
+
+// Log-linear bucket of a value, see LB_HISTOGRAM_BUCKETS
+inline UINT32 LbHistogramBucket(UINT64 value)
+{
+	if (value < 4)
+		return (UINT32)value;
+	if (value >> 32)
+		return LB_HISTOGRAM_BUCKETS - 1;
+
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+	unsigned long msb;
+	_BitScanReverse(&msb, (unsigned long)value);
+#else
+	UINT32 msb = 31 - __builtin_clz((unsigned int)value);
+#endif
+
+	return (UINT32)(msb - 1) * 4 + (UINT32)((value >> (msb - 2)) & 3);
+}
+
+// Statistics of the processor the caller runs on. The caller must stay on that processor
+// (DISPATCH_LEVEL) while it records, otherwise an update can occasionally get lost.
+inline LB_STATS_PROCESSOR* LbStatsCurrent()
+{
+	return lbStatsProcessors ? &lbStatsProcessors[LbCurrentProcessor()] : NULL;
+}
+
+inline void LbStatsCount(LB_STATS_PROCESSOR* stats, LB_COUNTER counter, UINT64 value = 1)
+{
+	if (stats) stats->counters[counter] += value;
+}
+
+// TRUE when this call should be timed
+inline BOOLEAN LbStatsSample(LB_STATS_PROCESSOR* stats)
+{
+	if (!stats || stats->sampleCountdown-- != 0)
+		return FALSE;
+
+	stats->sampleCountdown = LB_STATS_SAMPLE_INTERVAL - 1;
+	return TRUE;
+}
+
+inline void LbStatsRecord(LB_STATS_PROCESSOR* stats, LB_STAGE stage, UINT64 cycles)
+{
+	stats->histograms[stage][LbHistogramBucket(cycles)]++;
+}
+
+// Records the cycles since mark for a stage and returns the new mark
+inline UINT64 LbStatsStage(LB_STATS_PROCESSOR* stats, LB_STAGE stage, UINT64 mark)
+{
+	UINT64 now = LbCycles();
+	LbStatsRecord(stats, stage, now - mark);
+	return now;
+}
@@ -0,0 +1,200 @@
+/*/
+/*  ** VerdictCache.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the lock-free flow verdict cache.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- Christoph Lameter, "Effective Synchronization on Linux/NUMA Systems", Gelato 2005
+/*			* Describes the sequence lock used to protect every bucket.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "VerdictCache.h"
+
+/////////////////////
+// CACHE STRUCTURE //
+/////////////////////
+
+struct LB_VERDICT_ENTRY
+{
+	UINT64 addresses;		// localAddress << 32 | remoteAddress
+	UINT32 ports;			// localPort << 16 | remotePort
+	UINT8 protocol;
+	UINT8 verdict;
+	UINT8 direction;		// The same flow seen in both directions has a verdict for each
+	UINT8 family;
+	UINT32 generation;		// Generation the verdict was computed in, 0 for an empty entry
+	UINT32 reserved2;
+};
+
+// One bucket fills exactly one cache line so processors never share a line between buckets
+struct DECLSPEC_ALIGN(64) LB_VERDICT_BUCKET
+{
+	volatile LONG sequence;	// Odd while a writer is updating the bucket
+	UINT32 reserved[3];
+	LB_VERDICT_ENTRY entries[2];	// Most recently inserted flow first
+};
+
+static_assert(sizeof(LB_VERDICT_BUCKET) == 64, "verdict bucket must fill one cache line");
+
+/////////////
+// GLOBALS //
+/////////////
+
+static LB_VERDICT_BUCKET* lbVerdictBuckets = NULL;
+
+// Bumping the generation makes every existing entry stale without touching the table
+static volatile LONG lbVerdictGeneration = 1;
+
+/////////////
+// HELPERS //
+/////////////
+
+static inline UINT32 LbFlowKeyHash(UINT64 addresses, UINT32 ports, const LB_FLOW_KEY* key)
+{
+	UINT64 hash = addresses ^ ((UINT64)ports << 8) ^ key->protocol ^ ((UINT64)(key->family << 1 | key->direction) << 56);
+
+	// 64-bit finalizer from MurmurHash3, spreads nearby addresses and ports over every bucket
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return (UINT32)hash & (LB_VERDICT_CACHE_BUCKETS - 1);
+}
+
+static inline BOOLEAN LbVerdictEntryMatches(const LB_VERDICT_ENTRY* entry, UINT64 addresses, UINT32 ports, const LB_FLOW_KEY* key)
+{
+	return entry->addresses == addresses && entry->ports == ports && entry->protocol == key->protocol &&
+		entry->direction == key->direction && entry->family == key->family;
+}
+
+// Spin until this processor owns the bucket, returns the even sequence value to release with
+static inline LONG LbVerdictBucketLock(LB_VERDICT_BUCKET* bucket)
+{
+	for (;;)
+	{
+		LONG sequence = LbReadAcquire(&bucket->sequence);
+		if ((sequence & 1) == 0 && LbInterlockedCompareExchange(&bucket->sequence, sequence + 1, sequence) == sequence)
+			return sequence;
+	}
+}
+
+static inline void LbVerdictBucketUnlock(LB_VERDICT_BUCKET* bucket, LONG sequence)
+{
+	LbWriteRelease(&bucket->sequence, sequence + 2);
+}
+
+////////////////////
+// INITIALIZATION //
+////////////////////
+
+NTSTATUS LbVerdictCacheInitialize()
+{
+	lbVerdictBuckets = (LB_VERDICT_BUCKET*)LbAlloc(sizeof(LB_VERDICT_BUCKET) * LB_VERDICT_CACHE_BUCKETS, 'LBV0');
+	if (!lbVerdictBuckets)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	return STATUS_SUCCESS;
+}
+
+void LbVerdictCacheCleanup()
+{
+	if (lbVerdictBuckets)
+	{
+		LbFree(lbVerdictBuckets, 'LBV0');
+		lbVerdictBuckets = NULL;
+	}
+}
+
+////////////////
+// OPERATIONS //
+////////////////
+
+LB_VERDICT LbVerdictCacheLookup(const LB_FLOW_KEY* key)
+{
+	UINT64 addresses = ((UINT64)key->localAddress << 32) | key->remoteAddress;
+	UINT32 ports = ((UINT32)key->localPort << 16) | key->remotePort;
+	UINT32 generation = (UINT32)LbReadAcquire(&lbVerdictGeneration);
+	LB_VERDICT_BUCKET* bucket = &lbVerdictBuckets[LbFlowKeyHash(addresses, ports, key)];
+	LB_VERDICT verdict = LB_VERDICT_NONE;
+
+	// Never wait on a writer, a miss only costs a normal rule evaluation
+	LONG sequence = LbReadAcquire(&bucket->sequence);
+	if (sequence & 1)
+		return LB_VERDICT_NONE;
+
+	for (int way = 0; way < 2; way++)
+	{
+		const volatile LB_VERDICT_ENTRY* entry = &bucket->entries[way];
+		if (entry->generation == generation && LbVerdictEntryMatches((const LB_VERDICT_ENTRY*)entry, addresses, ports, key))
+		{
+			verdict = (LB_VERDICT)entry->verdict;
+			break;
+		}
+	}
+
+	// The entry may have been torn by a writer that ran while it was read
+	LbReadBarrier();
+	if (LbReadAcquire(&bucket->sequence) != sequence)
+		return LB_VERDICT_NONE;
+
+	return verdict;
+}
+
+void LbVerdictCacheInsert(const LB_FLOW_KEY* key, LB_VERDICT verdict)
+{
+	UINT64 addresses = ((UINT64)key->localAddress << 32) | key->remoteAddress;
+	UINT32 ports = ((UINT32)key->localPort << 16) | key->remotePort;
+	UINT32 generation = (UINT32)LbReadAcquire(&lbVerdictGeneration);
+	LB_VERDICT_BUCKET* bucket = &lbVerdictBuckets[LbFlowKeyHash(addresses, ports, key)];
+
+	// Best effort, leave the bucket alone if another processor is writing it
+	LONG sequence = LbReadAcquire(&bucket->sequence);
+	if ((sequence & 1) || LbInterlockedCompareExchange(&bucket->sequence, sequence + 1, sequence) != sequence)
+		return;
+
+	// Keep the other flow of the bucket in the second way unless it is the same flow
+	if (!LbVerdictEntryMatches(&bucket->entries[0], addresses, ports, key))
+		bucket->entries[1] = bucket->entries[0];
+
+	bucket->entries[0].addresses = addresses;
+	bucket->entries[0].ports = ports;
+	bucket->entries[0].protocol = key->protocol;
+	bucket->entries[0].direction = key->direction;
+	bucket->entries[0].family = key->family;
+	bucket->entries[0].verdict = (UINT8)verdict;
+	bucket->entries[0].generation = generation;
+
+	LbVerdictBucketUnlock(bucket, sequence);
+}
+
+void LbVerdictCacheRemove(const LB_FLOW_KEY* key)
+{
+	UINT64 addresses = ((UINT64)key->localAddress << 32) | key->remoteAddress;
+	UINT32 ports = ((UINT32)key->localPort << 16) | key->remotePort;
+	LB_VERDICT_BUCKET* bucket = &lbVerdictBuckets[LbFlowKeyHash(addresses, ports, key)];
+
+	LONG sequence = LbVerdictBucketLock(bucket);
+
+	for (int way = 0; way < 2; way++)
+	{
+		if (LbVerdictEntryMatches(&bucket->entries[way], addresses, ports, key))
+			bucket->entries[way].generation = 0;
+	}
+
+	LbVerdictBucketUnlock(bucket, sequence);
+}
+
+void LbVerdictCacheInvalidateAll()
+{
+	// Generation 0 marks empty entries, skip it when the counter wraps
+	if (LbInterlockedIncrement(&lbVerdictGeneration) == 0)
+		LbInterlockedIncrement(&lbVerdictGeneration);
+}
@@ -0,0 +1,82 @@
+/*/
+/*  ** VerdictCache.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the flow verdict cache.
+/*	The cache remembers, per 5-tuple, whether a flow is permitted, blocked or needs payload inspection
+/*	so repeat packets of a flow skip rule evaluation. Lookups take no locks, every bucket is
+/*	protected by a sequence counter that readers only check and writers bump around an update.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+// Transport protocol numbers, the WFP headers that define IPPROTO_* are not available everywhere
+#define LB_IPPROTO_TCP 6
+#define LB_IPPROTO_UDP 17
+
+enum LB_ADDRESS_FAMILY : UINT8
+{
+	LB_FAMILY_IPV4 = 0,
+	LB_FAMILY_IPV6,
+	LB_FAMILY_COUNT
+};
+
+// Addresses and ports in host byte order, exactly as WFP hands them to the classify function.
+// IPv6 addresses are folded into 32 bits by LbFlowAddressFold, no rule matches them so they only tell flows apart.
+struct LB_FLOW_KEY
+{
+	UINT32 localAddress;
+	UINT32 remoteAddress;
+	UINT16 localPort;
+	UINT16 remotePort;
+	UINT8 protocol;
+	UINT8 direction;			// LB_DIRECTION of the layer the packet was seen at
+	UINT8 family;				// LB_ADDRESS_FAMILY
+};
+
+// Fold a 16 byte IPv6 address in network byte order into a flow key address
+inline UINT32 LbFlowAddressFold(const UINT8* address)
+{
+	UINT32 folded = 0;
+
+	for (int i = 0; i < 16; i += 4)
+		folded ^= ((UINT32)address[i] << 24) | ((UINT32)address[i + 1] << 16) | ((UINT32)address[i + 2] << 8) | address[i + 3];
+
+	return folded;
+}
+
+enum LB_VERDICT : UINT8
+{
+	LB_VERDICT_NONE = 0,		// Not cached
+	LB_VERDICT_PERMIT,			// Permit without looking at the payload
+	LB_VERDICT_BLOCK,
+	LB_VERDICT_INSPECT,			// Payload must go through the match engine
+};
+
+// Number of buckets, must be a power of two. Each bucket is one cache line holding two flows.
+#define LB_VERDICT_CACHE_BUCKETS 4096
+
+// Allocate the cache, call before the callout is registered
+NTSTATUS LbVerdictCacheInitialize();
+
+// Free the cache
+void LbVerdictCacheCleanup();
+
+// Returns the cached verdict of a flow or LB_VERDICT_NONE on a miss
+LB_VERDICT LbVerdictCacheLookup(const LB_FLOW_KEY* key);
+
+// Remember the verdict of a flow, best effort: skipped when another processor is updating the same bucket
+void LbVerdictCacheInsert(const LB_FLOW_KEY* key, LB_VERDICT verdict);
+
+// Forget a flow, called when the flow is deleted
+void LbVerdictCacheRemove(const LB_FLOW_KEY* key);
+
+// Forget every flow at once, called whenever the rules that produced the verdicts change
+void LbVerdictCacheInvalidateAll();
@@ -0,0 +1,156 @@
+/*/
+/*  ** WorkQueue.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the worker queues.
+/*
+/*  SOURCES AND CITATIONS (NAME, PROJECT, URL):
+/*		- R. Kent Treiber, "Systems Programming: Coping with Parallelism", IBM RJ 5118, 1986
+/*			* The lock-free stack producers push onto.
+/*		- Microsoft, Windows-Driver-Samples, https://github.com/microsoft/Windows-driver-samples/
+/*			* The WFP inspect sample queues absorbed packets for a worker thread and injects them from there.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "WorkQueue.h"
+
+/////////////////////
+// QUEUE STRUCTURE //
+/////////////////////
+
+// Producers only touch the first cache line, the worker keeps its private list on the second
+struct DECLSPEC_ALIGN(64) LB_WORK_LANE
+{
+	LB_WORK_ITEM* volatile pushed;	// Newest first
+	volatile LONG depth;			// Items pushed and not popped yet, including those in ready
+	UINT8 reserved[64 - sizeof(LB_WORK_ITEM*) - sizeof(LONG)];
+
+	LB_WORK_ITEM* ready;			// Oldest first, taken off pushed but not handed out yet
+};
+
+struct LB_WORK_QUEUE
+{
+	UINT32 laneCount;
+	UINT32 capacity;
+	UINT32 tag;
+	LB_WORK_LANE* lanes;			// Stored right after this struct
+};
+
+//////////////////////////
+// CREATION AND CLEANUP //
+//////////////////////////
+
+NTSTATUS LbWorkQueueCreate(UINT32 laneCount, UINT32 capacity, UINT32 tag, LB_WORK_QUEUE** queue)
+{
+	if (queue == NULL || laneCount == 0 || capacity == 0 || capacity > LB_WORK_QUEUE_MAX_CAPACITY)
+		return STATUS_INVALID_PARAMETER;
+
+	*queue = NULL;
+
+	SIZE_T headerSize = (sizeof(LB_WORK_QUEUE) + 63) & ~(SIZE_T)63;
+
+	// LbAlloc returns zeroed, cache line aligned memory, every lane starts empty on its own lines
+	LB_WORK_QUEUE* result = (LB_WORK_QUEUE*)LbAlloc(headerSize + sizeof(LB_WORK_LANE) * laneCount, tag);
+	if (!result)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	result->laneCount = laneCount;
+	result->capacity = capacity;
+	result->tag = tag;
+	result->lanes = (LB_WORK_LANE*)((UINT8*)result + headerSize);
+
+	*queue = result;
+	return STATUS_SUCCESS;
+}
+
+void LbWorkQueueDestroy(LB_WORK_QUEUE* queue)
+{
+	if (queue)
+		LbFree(queue, queue->tag);
+}
+
+////////////////
+// OPERATIONS //
+////////////////
+
+UINT32 LbWorkQueueLane(const LB_WORK_QUEUE* queue, UINT64 flow)
+{
+	// 64-bit finalizer from MurmurHash3, flows that differ in one port still spread over every lane
+	flow ^= flow >> 33;
+	flow *= 0xff51afd7ed558ccdULL;
+	flow ^= flow >> 33;
+	flow *= 0xc4ceb9fe1a85ec53ULL;
+	flow ^= flow >> 33;
+
+	return (UINT32)(flow % queue->laneCount);
+}
+
+BOOLEAN LbWorkQueuePush(LB_WORK_QUEUE* queue, UINT32 lane, LB_WORK_ITEM* item, BOOLEAN* wake)
+{
+	LB_WORK_LANE* target = &queue->lanes[lane];
+	LB_WORK_ITEM* head;
+
+	*wake = FALSE;
+
+	// Claim a slot first, a lane never holds more than its capacity
+	if ((UINT32)LbInterlockedIncrement(&target->depth) > queue->capacity)
+	{
+		LbInterlockedAdd(&target->depth, -1);
+		return FALSE;
+	}
+
+	item->queued = LbTimestamp();
+
+	// Items only ever leave pushed all at once, so the head cannot be taken and put back under a producer
+	do
+	{
+		head = target->pushed;
+		item->next = head;
+	} while (LbInterlockedCompareExchangePointer((void* volatile*)&target->pushed, item, head) != head);
+
+	*wake = head == NULL;
+	return TRUE;
+}
+
+UINT32 LbWorkQueuePop(LB_WORK_QUEUE* queue, UINT32 lane, LB_WORK_ITEM** items, UINT32 maxItems)
+{
+	LB_WORK_LANE* source = &queue->lanes[lane];
+	BOOLEAN taken = FALSE;
+	UINT32 count = 0;
+
+	while (count < maxItems)
+	{
+		if (!source->ready)
+		{
+			// Everything pushed so far is newer than what was handed out before, one exchange takes it all
+			if (taken)
+				break;
+			taken = TRUE;
+
+			LB_WORK_ITEM* pushed = (LB_WORK_ITEM*)LbInterlockedExchangePointer((void* volatile*)&source->pushed, NULL);
+			if (!pushed)
+				break;
+
+			// Newest first into oldest first
+			while (pushed)
+			{
+				LB_WORK_ITEM* next = pushed->next;
+				pushed->next = source->ready;
+				source->ready = pushed;
+				pushed = next;
+			}
+		}
+
+		items[count++] = source->ready;
+		source->ready = source->ready->next;
+	}
+
+	if (count > 0)
+		LbInterlockedAdd(&source->depth, -(LONG)count);
+
+	return count;
+}
@@ -0,0 +1,50 @@
+/*/
+/*  ** WorkQueue.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the queues that hand absorbed packets from the classify path to worker threads.
+/*	A queue has one lane per worker. Any number of producers push onto a lane without taking a lock,
+/*	and the one worker that owns it pops items off in batches, oldest first. Every item of a flow is
+/*	pushed onto the lane its flow id picks, so one worker sees all of them and in the order they came.
+/*	Lanes are bounded: once one holds its capacity, pushing fails instead of letting a burst eat the pool.
+/*
+/*	Waiting is left to the caller. A push reports when the lane was idle so the caller knows to wake
+/*	its worker, and a worker only has to sleep after a pop came back empty.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+
+// Largest capacity of one lane
+#define LB_WORK_QUEUE_MAX_CAPACITY 0x10000
+
+// Embedded in whatever the caller queues, CONTAINING_RECORD gets back to it
+struct LB_WORK_ITEM
+{
+	LB_WORK_ITEM* next;
+	UINT64 queued;				// LbTimestamp() when the item was pushed
+};
+
+struct LB_WORK_QUEUE;
+
+// Create a queue of laneCount lanes, each holding up to capacity items
+NTSTATUS LbWorkQueueCreate(UINT32 laneCount, UINT32 capacity, UINT32 tag, LB_WORK_QUEUE** queue);
+
+// Free a queue, every item must have been popped and no producer may still be pushing
+void LbWorkQueueDestroy(LB_WORK_QUEUE* queue);
+
+// Lane every item of a flow goes to, flow is anything that identifies the flow
+UINT32 LbWorkQueueLane(const LB_WORK_QUEUE* queue, UINT64 flow);
+
+// Add an item to the end of a lane, safe from any number of processors at once. Returns FALSE when the
+// lane is full. wake is set when the lane had nothing waiting, its worker may be asleep.
+BOOLEAN LbWorkQueuePush(LB_WORK_QUEUE* queue, UINT32 lane, LB_WORK_ITEM* item, BOOLEAN* wake);
+
+// Take up to maxItems items off the front of a lane, returns how many. Only the lane's worker may call this.
+UINT32 LbWorkQueuePop(LB_WORK_QUEUE* queue, UINT32 lane, LB_WORK_ITEM** items, UINT32 maxItems);
@@ -0,0 +1,211 @@
+/*/
+/*  ** CaptureBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures what packet capture adds to a classify call, in nanoseconds per packet: a packet none of three
+/*	capture rules cover, one a rule covers but samples out, and one that is recorded with 64, 256 or 1460
+/*	bytes of data. Records are drained to pcapng whenever half the ring is full, and the drain is timed per
+/*	record. The timestamp every record takes and PrintPayload's hex format of a full segment, written to
+/*	memory instead of DbgPrintEx, are timed for reference.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "Capture.h"
+
+static LB_CAPTURE_RULE LbBenchRule()
+{
+	LB_CAPTURE_RULE rule = {};
+	rule.directions = LB_RULE_DIRECTION_BOTH;
+	rule.actions = LB_CAPTURE_ACTION_ALL;
+	rule.lastPort = 65535;
+	rule.sampleRate = 1;
+	rule.snapLength = LB_CAPTURE_MAX_SNAP;
+	return rule;
+}
+
+static LB_CAPTURE_FILTER* LbBenchFilter(const std::vector<LB_CAPTURE_RULE>& rules)
+{
+	LB_CAPTURE_RULES_HEADER header = { LB_CAPTURE_RULES_VERSION, (UINT32)rules.size() };
+	std::vector<UINT8> buffer(sizeof(header) + sizeof(LB_CAPTURE_RULE) * rules.size());
+	LB_CAPTURE_FILTER* filter = NULL;
+
+	memcpy(buffer.data(), &header, sizeof(header));
+	memcpy(buffer.data() + sizeof(header), rules.data(), sizeof(LB_CAPTURE_RULE) * rules.size());
+	LbCaptureFilterParse(buffer.data(), buffer.size(), &filter);
+	return filter;
+}
+
+// Three rules a busy link might have: blocked HTTPS, one network and DNS answers
+static std::vector<LB_CAPTURE_RULE> LbBenchRules()
+{
+	std::vector<LB_CAPTURE_RULE> rules(3, LbBenchRule());
+
+	rules[0].protocol = LB_IPPROTO_TCP;
+	rules[0].directions = LB_RULE_DIRECTION_OUTBOUND;
+	rules[0].actions = LB_CAPTURE_ACTION_BLOCK;
+	rules[0].firstPort = rules[0].lastPort = 443;
+	rules[1].address = 0x0A000000;
+	rules[1].prefixLength = 8;
+	rules[2].protocol = LB_IPPROTO_UDP;
+	rules[2].directions = LB_RULE_DIRECTION_INBOUND;
+	rules[2].firstPort = rules[2].lastPort = 53;
+	return rules;
+}
+
+// What the classify path does with a packet
+static inline BOOLEAN LbBenchOffer(LB_CAPTURE* capture, const LB_CAPTURE_FILTER* filter, const LB_CAPTURE_PACKET* packet, const UINT8* data)
+{
+	LB_CAPTURE_SLOT slot;
+
+	if (!LbCaptureBegin(capture, filter, packet, &slot))
+		return FALSE;
+
+	memcpy(slot.data, data, slot.capacity);
+	LbCaptureEnd(capture, &slot, slot.capacity);
+	return TRUE;
+}
+
+// Median ns per packet of offering packets that are not captured
+static double LbBenchNotCaptured(LB_CAPTURE* capture, const LB_CAPTURE_FILTER* filter, const LB_CAPTURE_PACKET* packet,
+	const UINT8* data, UINT32 packets, int rounds)
+{
+	std::vector<UINT64> samples;
+
+	for (int round = 0; round < rounds; round++)
+	{
+		UINT64 captured = 0;
+		UINT64 start = LbBenchNow();
+		for (UINT32 i = 0; i < packets; i++)
+			captured += LbBenchOffer(capture, filter, packet, data);
+		samples.push_back((LbBenchNow() - start) * 1000 / packets);
+		LbBenchKeep(captured);
+	}
+
+	return LbBenchPercentile(samples, 0.5) / 1000.0;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	const UINT32 packets = options.quick ? 1 << 12 : 1 << 22;
+	const int rounds = options.quick ? 1 : 9;
+	std::mt19937 rng(1);
+
+	std::vector<UINT64> section(LbCaptureSectionSize(1, LB_CAPTURE_RING_SIZE) / sizeof(UINT64));
+	LB_CAPTURE* capture = NULL;
+	LB_CAPTURE_READER* reader = NULL;
+	if (!NT_SUCCESS(LbCaptureCreate(section.data(), section.size() * sizeof(UINT64), 1, LB_CAPTURE_RING_SIZE, &capture)) ||
+		!NT_SUCCESS(LbCaptureReaderOpen(section.data(), section.size() * sizeof(UINT64), &reader)))
+		return 1;
+
+	std::string payload = LbBenchPayload(rng, LB_BENCH_TEXT, 1460);
+	const UINT8* data = (const UINT8*)payload.data();
+	UINT8 local[16] = { 192, 168, 0, 2 };
+	UINT8 remote[16] = { 93, 184, 216, 34 };
+	LB_CAPTURE_PACKET packet = {};
+	packet.localAddress = local;
+	packet.remoteAddress = remote;
+	packet.localPort = 49152;
+	packet.remotePort = 80;
+	packet.family = LB_FAMILY_IPV4;
+	packet.protocol = LB_IPPROTO_TCP;
+	packet.direction = LB_RULE_DIRECTION_OUTBOUND;
+	packet.action = LB_RULE_ACTION_INSPECT;
+	packet.length = 1460;
+
+	printf("1 ring of %u KB, %u packets, median of %d rounds\n", LB_CAPTURE_RING_SIZE >> 10, packets, rounds);
+	printf("%-28s %10s %14s %12s\n", "", "ns/packet", "drain ns/rec", "pcapng MB/s");
+
+	// Covered by none of the rules: the cost every packet pays once capture is on
+	std::vector<LB_CAPTURE_RULE> rules = LbBenchRules();
+	LB_CAPTURE_FILTER* filter = LbBenchFilter(rules);
+	printf("%-28s %10.1f\n", "filter miss, 3 rules", LbBenchNotCaptured(capture, filter, &packet, data, packets, rounds));
+	LbCaptureFilterFree(filter);
+
+	// Covered, and only the first of them recorded
+	rules.push_back(LbBenchRule());
+	rules.back().sampleRate = 0xFFFFFFFF;
+	filter = LbBenchFilter(rules);
+	printf("%-28s %10.1f\n", "covered, sampled out", LbBenchNotCaptured(capture, filter, &packet, data, packets, rounds));
+	LbCaptureFilterFree(filter);
+
+	// Every packet recorded, half a ring at a time and then drained
+	std::vector<UINT8> output(4 << 20);
+	LB_PCAPNG_CLOCK clock = { LbTimestamp(), 1700000000ull * 1000000000ull };
+	int failed = 0;
+
+	for (UINT16 snap : { 64, 256, 1460 })
+	{
+		rules.back().sampleRate = 1;
+		rules.back().snapLength = snap;
+		filter = LbBenchFilter(rules);
+
+		const UINT32 batch = LB_CAPTURE_RING_SIZE / 2 / (UINT32)(sizeof(LB_CAPTURE_RECORD) + ((snap + 7) & ~7));
+		std::vector<UINT64> captureSamples;
+		std::vector<UINT64> drainSamples;
+		UINT64 bytes = 0;
+		UINT64 drainNs = 0;
+
+		for (int round = 0; round < rounds; round++)
+		{
+			UINT64 captureNs = 0;
+			UINT64 recorded = 0;
+
+			for (UINT32 done = 0; done < packets; done += batch)
+			{
+				UINT64 start = LbBenchNow();
+				for (UINT32 i = 0; i < batch; i++)
+					recorded += LbBenchOffer(capture, filter, &packet, data);
+				UINT64 middle = LbBenchNow();
+
+				UINT64 dropped = 0;
+				SIZE_T written;
+				while ((written = LbCaptureDrainPcapng(reader, &clock, output.data(), output.size(), &dropped)) != 0)
+				{
+					bytes += written;
+					failed |= dropped != 0;
+				}
+				UINT64 end = LbBenchNow();
+
+				captureNs += middle - start;
+				drainNs += end - middle;
+			}
+
+			failed |= recorded != (UINT64)(packets + batch - 1) / batch * batch;
+			captureSamples.push_back(captureNs * 1000 / recorded);
+			drainSamples.push_back(drainNs * 1000 / recorded);
+			drainNs = 0;
+		}
+
+		double drain = LbBenchPercentile(drainSamples, 0.5) / 1000.0;
+		printf("%-28s %10.1f %14.1f %12.0f\n", ("captured, " + std::to_string(snap) + " B").c_str(),
+			LbBenchPercentile(captureSamples, 0.5) / 1000.0, drain, bytes / (double)rounds / ((packets + batch - 1) / batch * batch) / drain * 1e3);
+		LbCaptureFilterFree(filter);
+	}
+
+	// For reference: the clock read in every record, and what PrintPayload formats for one segment
+	UINT64 start = LbBenchNow();
+	for (UINT32 i = 0; i < packets; i++)
+		LbBenchKeep(LbTimestamp());
+	printf("%-28s %10.1f\n", "of which LbTimestamp", (double)(LbBenchNow() - start) / packets);
+
+	char text[1460 * 5 + 1];
+	const UINT32 dumps = packets / 256;
+	start = LbBenchNow();
+	for (UINT32 i = 0; i < dumps; i++)
+	{
+		for (UINT32 b = 0; b < 1460; b++)
+			snprintf(&text[b * 5], 6, "0x%02X ", data[b]);
+		LbBenchKeep((UINT8)text[(i % 1460) * 5 + 2]);
+	}
+	printf("%-28s %10.1f\n", "hex dump of 1460 B", (double)(LbBenchNow() - start) / dumps);
+
+	LbCaptureReaderClose(reader);
+	LbCaptureDestroy(capture);
+	return failed;
+}
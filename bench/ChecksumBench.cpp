@@ -0,0 +1,198 @@
+/*/
+/*  ** ChecksumBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures both ways a rewritten segment gets its checksum back. A full sum with LbChecksumAdd is timed
+/*	against the RFC 1071 loop a word at a time, at 40 to 9000 bytes. Patching a 1460 byte segment for 1 to
+/*	64 edits of 4 and 16 bytes is timed against summing it again, next to what LbChecksumEditsExceeded
+/*	decides for it, so LB_CHECKSUM_EDIT_COST and LB_CHECKSUM_EDIT_BYTE_COST can be checked against the
+/*	machine. Every patched checksum is checked against the recomputed one.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "Checksum.h"
+#include "VerdictCache.h"
+
+#define LB_BENCH_SEGMENTS 256
+
+static const UINT32 LbBenchSource = 0xC0A80002;
+static const UINT32 LbBenchDestination = 0x5DB8D822;
+
+// RFC 1071 section 4.1, what LbChecksumAdd replaced
+static UINT16 LbBenchReferenceChecksum(const UINT8* data, SIZE_T length)
+{
+	UINT32 sum = 0;
+	SIZE_T i = 0;
+
+	for (; i + 1 < length; i += 2)
+		sum += (UINT32)data[i] << 8 | data[i + 1];
+	if (i < length)
+		sum += (UINT32)data[i] << 8;
+
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return (UINT16)~sum;
+}
+
+static std::vector<UINT8> LbBenchBytes(std::mt19937& rng, SIZE_T length)
+{
+	std::vector<UINT8> data(length);
+
+	for (UINT8& byte : data)
+		byte = (UINT8)rng();
+	return data;
+}
+
+// Full sums: ns per buffer of the reference and of LbChecksumAdd
+static void LbBenchFull(std::mt19937& rng, UINT32 iterations, int rounds)
+{
+	printf("%8s %14s %10s %14s %10s %9s\n", "bytes", "RFC 1071 ns", "GB/s", "LbChecksumAdd", "GB/s", "speedup");
+
+	for (SIZE_T length : { 40, 576, 1460, 9000 })
+	{
+		std::vector<std::vector<UINT8>> buffers;
+		for (int i = 0; i < LB_BENCH_SEGMENTS; i++)
+			buffers.push_back(LbBenchBytes(rng, length));
+
+		std::vector<UINT64> referenceSamples;
+		std::vector<UINT64> fastSamples;
+		UINT32 count = std::max<UINT32>(LB_BENCH_SEGMENTS, (UINT32)(iterations * 1460 / length));
+
+		for (int round = 0; round < rounds; round++)
+		{
+			UINT64 start = LbBenchNow();
+			for (UINT32 i = 0; i < count; i++)
+			{
+				const std::vector<UINT8>& buffer = buffers[i % LB_BENCH_SEGMENTS];
+				LbBenchKeep(LbBenchReferenceChecksum(buffer.data(), length));
+			}
+			UINT64 middle = LbBenchNow();
+			for (UINT32 i = 0; i < count; i++)
+			{
+				const std::vector<UINT8>& buffer = buffers[i % LB_BENCH_SEGMENTS];
+				LbBenchKeep(LbChecksumFinish(LbChecksumAdd(0, buffer.data(), length)));
+			}
+			UINT64 end = LbBenchNow();
+
+			referenceSamples.push_back((middle - start) * 1000 / count);
+			fastSamples.push_back((end - middle) * 1000 / count);
+		}
+
+		double reference = LbBenchPercentile(referenceSamples, 0.5) / 1000.0;
+		double fast = LbBenchPercentile(fastSamples, 0.5) / 1000.0;
+		printf("%8zu %14.1f %10.2f %14.1f %10.2f %8.1fx\n", length, reference, length / reference, fast, length / fast, reference / fast);
+	}
+}
+
+// Patching a segment for its edits against summing it again
+static int LbBenchPatch(std::mt19937& rng, UINT32 iterations, int rounds)
+{
+	const SIZE_T length = 20 + 1460;
+	std::vector<std::vector<UINT8>> segments;
+	std::vector<std::vector<UINT8>> replacements;
+	std::vector<UINT16> checksums;
+	int failed = 0;
+
+	for (int i = 0; i < LB_BENCH_SEGMENTS; i++)
+	{
+		segments.push_back(LbBenchBytes(rng, length));
+		replacements.push_back(LbBenchBytes(rng, length));
+		segments.back()[16] = 0;
+		segments.back()[17] = 0;
+		checksums.push_back(LbTransportChecksumV4(LbBenchSource, LbBenchDestination, LB_IPPROTO_TCP, segments.back().data(), length));
+	}
+
+	UINT64 start = LbBenchNow();
+	for (UINT32 i = 0; i < iterations; i++)
+	{
+		const std::vector<UINT8>& segment = segments[i % LB_BENCH_SEGMENTS];
+		LbBenchKeep(LbTransportChecksumV4(LbBenchSource, LbBenchDestination, LB_IPPROTO_TCP, segment.data(), length));
+	}
+	double recompute = (double)(LbBenchNow() - start) / iterations;
+
+	printf("\n1460 byte payload, summing it again takes %.1f ns\n", recompute);
+	printf("%8s %6s %10s %12s %12s %12s\n", "edit", "edits", "patch ns", "per edit", "faster", "model");
+
+	for (SIZE_T editLength : { 4, 16 })
+	{
+		for (UINT32 editCount : { 1, 2, 4, 8, 16, 32, 64 })
+		{
+			// Edits start anywhere in the payload, so half of them are on odd bytes
+			std::vector<UINT32> offsets(LB_BENCH_SEGMENTS * editCount);
+			for (UINT32& offset : offsets)
+				offset = 20 + rng() % (UINT32)(1460 - editLength);
+
+			std::vector<UINT64> samples;
+			BOOLEAN exceeded = FALSE;
+
+			for (int round = 0; round < rounds; round++)
+			{
+				UINT64 begin = LbBenchNow();
+				for (UINT32 i = 0; i < iterations; i++)
+				{
+					UINT32 index = i % LB_BENCH_SEGMENTS;
+					const UINT8* segment = segments[index].data();
+					const UINT8* replacement = replacements[index].data();
+					const UINT32* at = &offsets[(SIZE_T)index * editCount];
+					LB_CHECKSUM_EDITS edits;
+
+					LbChecksumEditsBegin(&edits, 0);
+					for (UINT32 e = 0; e < editCount; e++)
+						LbChecksumEdit(&edits, at[e], segment + at[e], replacement + at[e], editLength);
+					LbBenchKeep(LbChecksumApplyEdits(checksums[index], &edits));
+				}
+				samples.push_back((LbBenchNow() - begin) * 1000 / iterations);
+			}
+
+			// What the cost model decides, and that the patch is right: edited in place, the segment sums to -0
+			for (UINT32 index = 0; index < LB_BENCH_SEGMENTS; index++)
+			{
+				std::vector<UINT8> segment = segments[index];
+				const UINT32* at = &offsets[(SIZE_T)index * editCount];
+				LB_CHECKSUM_EDITS edits;
+
+				LbChecksumEditsBegin(&edits, length);
+				for (UINT32 e = 0; e < editCount; e++)
+				{
+					LbChecksumEdit(&edits, at[e], &segment[at[e]], &replacements[index][at[e]], editLength);
+					memcpy(&segment[at[e]], &replacements[index][at[e]], editLength);
+				}
+				exceeded = LbChecksumEditsExceeded(&edits);
+
+				LbChecksumEditsBegin(&edits, 0);
+				segment = segments[index];
+				for (UINT32 e = 0; e < editCount; e++)
+				{
+					LbChecksumEdit(&edits, at[e], &segment[at[e]], &replacements[index][at[e]], editLength);
+					memcpy(&segment[at[e]], &replacements[index][at[e]], editLength);
+				}
+				LbWriteBe16(&segment[16], LbChecksumApplyEdits(checksums[index], &edits));
+				failed |= LbTransportChecksumV4(LbBenchSource, LbBenchDestination, LB_IPPROTO_TCP, segment.data(), length) != 0;
+			}
+
+			double patch = LbBenchPercentile(samples, 0.5) / 1000.0;
+			printf("%6zu B %6u %10.1f %12.1f %12s %12s\n", editLength, editCount, patch, patch / editCount,
+				patch < recompute ? "patch" : "recompute", exceeded ? "recompute" : "patch");
+		}
+	}
+
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const UINT32 iterations = options.quick ? 1 << 10 : 1 << 20;
+	const int rounds = options.quick ? 1 : 9;
+
+	printf("median of %d rounds\n", rounds);
+	LbBenchFull(rng, iterations, rounds);
+	return LbBenchPatch(rng, iterations, rounds);
+}
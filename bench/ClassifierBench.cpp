@@ -0,0 +1,134 @@
+/*/
+/*  ** ClassifierBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures flow classifier lookups per second for rule sets of 10, 1k and 100k rules, on 1 to N threads,
+/*	against walking the rules one by one as the hardcoded port checks it replaced would have to. Probes hit
+/*	the rules' own networks half the time and land anywhere the other half. Table sizes are printed too,
+/*	they are what a lookup's memory reads are spread over.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "Classifier.h"
+
+#define LB_BENCH_PROBES 0x10000		// Power of two
+
+// Nine in ten rules are address rules, the rest port ranges; prefixes from /8 to /32, mostly /24 and longer
+static void LbBenchRules(std::mt19937& rng, UINT32 count, std::vector<LB_ADDRESS_RULE>& addresses, std::vector<LB_PORT_RULE>& ports)
+{
+	for (UINT32 i = 0; i < count; i++)
+	{
+		if (i % 10 == 9)
+		{
+			LB_PORT_RULE rule = {};
+			rule.firstPort = (UINT16)rng();
+			rule.lastPort = (UINT16)std::min<UINT32>(0xFFFF, rule.firstPort + rng() % 64);
+			rule.action = (UINT8)(rng() % 3);
+			rule.directions = LB_RULE_DIRECTION_BOTH;
+			ports.push_back(rule);
+			continue;
+		}
+
+		LB_ADDRESS_RULE rule = {};
+		rule.address = rng();
+		rule.prefixLength = (UINT8)(rng() % 4 == 0 ? 8 + rng() % 16 : 24 + rng() % 9);
+		rule.action = (UINT8)(rng() % 3);
+		rule.directions = LB_RULE_DIRECTION_BOTH;
+		addresses.push_back(rule);
+	}
+}
+
+// What classifying took before the tables: every rule checked in turn, the longest prefix kept
+static LB_VERDICT LbBenchWalk(const std::vector<LB_ADDRESS_RULE>& addresses, const std::vector<LB_PORT_RULE>& ports, UINT32 address, UINT16 port)
+{
+	int bestLength = -1;
+	UINT32 best = LB_VERDICT_NONE;
+
+	for (const LB_ADDRESS_RULE& rule : addresses)
+	{
+		UINT32 prefix = rule.prefixLength ? 0xFFFFFFFF << (32 - rule.prefixLength) : 0;
+		if (((address ^ rule.address) & prefix) == 0 && (int)rule.prefixLength > bestLength)
+		{
+			bestLength = rule.prefixLength;
+			best = rule.action + LB_VERDICT_PERMIT;
+		}
+	}
+	if (best != LB_VERDICT_NONE)
+		return (LB_VERDICT)best;
+
+	for (const LB_PORT_RULE& rule : ports)
+	{
+		if (port >= rule.firstPort && port <= rule.lastPort)
+			return (LB_VERDICT)(rule.action + LB_VERDICT_PERMIT);
+	}
+
+	return LB_VERDICT_NONE;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	const UINT32 ruleCounts[] = { 10, 1000, 100000 };
+	const UINT32 lookups = options.quick ? 1 << 14 : 1 << 24;
+
+	printf("%8s %8s %10s %12s %10s %14s %12s\n", "rules", "threads", "table KB", "Mlookups/s", "ns/lookup", "walk ns/lookup", "build ms");
+
+	for (UINT32 ruleCount : ruleCounts)
+	{
+		std::mt19937 rng(ruleCount);
+		std::vector<LB_ADDRESS_RULE> addresses;
+		std::vector<LB_PORT_RULE> ports;
+		LbBenchRules(rng, ruleCount, addresses, ports);
+
+		UINT64 start = LbBenchNow();
+		LB_CLASSIFIER* classifier = NULL;
+		if (!NT_SUCCESS(LbClassifierCompile(addresses.data(), (UINT32)addresses.size(), ports.data(), (UINT32)ports.size(), &classifier)))
+			return 1;
+		double buildMs = (LbBenchNow() - start) / 1e6;
+
+		LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT];
+		double tableKb = LbClassifierWriteImage(classifier, NULL, 0, tables) / 1024.0;
+
+		std::vector<UINT32> probeAddresses(LB_BENCH_PROBES);
+		std::vector<UINT16> probePorts(LB_BENCH_PROBES);
+		for (UINT32 i = 0; i < LB_BENCH_PROBES; i++)
+		{
+			const LB_ADDRESS_RULE& near = addresses[rng() % addresses.size()];
+			probeAddresses[i] = rng() % 2 ? near.address ^ (rng() & 0xFF) : (UINT32)rng();
+			probePorts[i] = (UINT16)rng();
+		}
+
+		// The walk is timed over fewer probes, at 100k rules it takes about a millisecond each
+		UINT32 walks = std::max<UINT32>(16, (options.quick ? 1 << 8 : 1 << 20) / ruleCount);
+		start = LbBenchNow();
+		for (UINT32 i = 0; i < walks; i++)
+			LbBenchKeep(LbBenchWalk(addresses, ports, probeAddresses[i & (LB_BENCH_PROBES - 1)], probePorts[i & (LB_BENCH_PROBES - 1)]));
+		double walkNs = (double)(LbBenchNow() - start) / walks;
+
+		for (UINT32 threads : LbBenchThreadCounts(options))
+		{
+			UINT64 elapsed = LbBenchRunThreads(threads, [&](UINT32 index) {
+				UINT32 verdicts = 0;
+				for (UINT32 i = 0; i < lookups; i++)
+				{
+					UINT32 probe = (i + index * 4099) & (LB_BENCH_PROBES - 1);
+					verdicts += LbClassifierLookup(classifier, LB_DIRECTION_OUTBOUND, probeAddresses[probe], probePorts[probe]);
+				}
+				LbBenchKeep(verdicts);
+			});
+
+			double total = (double)lookups * threads;
+			printf("%8u %8u %10.0f %12.1f %10.2f %14.1f %12.2f\n", ruleCount, threads, tableKb, total / (elapsed / 1e3),
+				(double)elapsed * threads / total, walkNs, buildMs);
+		}
+
+		LbClassifierFree(classifier);
+	}
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*/
+/*  ** DissectorBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Runs the in place scan of the classify path over HTTP and DNS flows cut into 1460 byte segments, once
+/*	over every byte and once limited to one field with the dissector in front of the match engine. Prints
+/*	MB/s of flow data and how many bytes reached the engine. Bodies of a known length are skipped by
+/*	counting, so a header only rule set should hand the engine the same bytes for a large upload as for a
+/*	small one.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State University�s CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "ClassifyCore.h"
+
+#define LB_BENCH_SEGMENT 1460
+
+struct LB_BENCH_FLOW
+{
+	const char* name;
+	UINT8 protocol;
+	std::vector<std::string> segments;	// TCP segments in order, or DNS datagrams
+	UINT32 fields;						// The field a limited scan keeps
+};
+
+static LB_BENCH_FLOW LbBenchStream(const char* name, const std::string& data, UINT32 fields)
+{
+	LB_BENCH_FLOW flow = { name, LB_IPPROTO_TCP, {}, fields };
+
+	for (size_t offset = 0; offset < data.size(); offset += LB_BENCH_SEGMENT)
+		flow.segments.push_back(data.substr(offset, LB_BENCH_SEGMENT));
+
+	return flow;
+}
+
+// A DNS response for name with a few address records, the first pointing back at the question
+static std::string LbBenchDnsResponse(std::mt19937& rng, const std::string& name, UINT32 answers)
+{
+	std::string message("\x12\x34\x81\x80\x00\x01\x00\x00\x00\x00\x00\x00", 12);
+	message[7] = (char)answers;
+
+	for (size_t start = 0; start < name.size(); )
+	{
+		size_t dot = name.find('.', start);
+		size_t end = dot == std::string::npos ? name.size() : dot;
+		message += (char)(end - start);
+		message += name.substr(start, end - start);
+		start = end + 1;
+	}
+	message += std::string("\x00\x00\x01\x00\x01", 5);
+
+	for (UINT32 a = 0; a < answers; a++)
+	{
+		message += std::string("\xC0\x0C\x00\x01\x00\x01\x00\x00\x0E\x10\x00\x04", 12);
+		for (int i = 0; i < 4; i++)
+			message += (char)rng();
+	}
+
+	return message;
+}
+
+// Nanoseconds to scan every segment of flow, with the rule set limited to fields
+static UINT64 LbBenchScan(const LB_MATCHER* matcher, const LB_BENCH_FLOW& flow, std::vector<std::string>& work, UINT32 fields, UINT64* scanned)
+{
+	LB_FLOW_KEY key = {};
+	key.protocol = flow.protocol;
+	key.remotePort = flow.protocol == LB_IPPROTO_TCP ? LB_HTTP_PORT : LB_DNS_PORT;
+	key.family = LB_FAMILY_IPV4;
+	key.direction = LB_DIRECTION_OUTBOUND;
+
+	LB_DISSECTOR stream;
+	LbDissectorBegin(&stream, LbDissectorForFlow(&key));
+
+	LB_SCAN_CONTEXT scan = {};
+	scan.matcher = matcher;
+	scan.key = &key;
+	scan.stream = &stream;
+	scan.fields = fields;
+	scan.state = LB_MATCHER_ROOT_STATE;
+
+	UINT32 sequence = 1;
+	UINT64 start = LbBenchNow();
+	for (std::string& segment : work)
+	{
+		LbScanSegment(&scan, sequence, segment.size());
+		LbScanBuffer(&scan, (UINT8*)&segment[0], segment.size());
+		sequence += (UINT32)segment.size();
+	}
+	UINT64 elapsed = LbBenchNow() - start;
+
+	LbBenchKeep(scan.replacements);
+	*scanned = scan.bytes;
+	return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const size_t uploadBytes = options.quick ? (1 << 20) : (64 << 20);
+	const size_t flowBytes = options.quick ? (256 << 10) : (16 << 20);
+	const int rounds = options.quick ? 1 : 5;
+
+	// A single upload with a known length
+	std::string upload = "POST /upload HTTP/1.1\r\nHost: www.example.com\r\nContent-Length: " + std::to_string(uploadBytes) + "\r\n\r\n";
+	upload += LbBenchPayload(rng, LB_BENCH_TEXT, uploadBytes);
+
+	// Pipelined requests, nearly all header
+	std::string requests;
+	while (requests.size() < flowBytes)
+		requests += LbBenchPayload(rng, LB_BENCH_HTTP, 0) + "GET /a/" + std::to_string(rng() % 1000) + " HTTP/1.1\r\nHost: www.example.com\r\nCookie: id=" + std::to_string(rng()) + "\r\n\r\n";
+	requests.erase(0, requests.find("GET /a/"));
+
+	// A chunked response in 4 KB chunks
+	std::string chunked = "HTTP/1.1 200 OK\r\nServer: nginx\r\nTransfer-Encoding: chunked\r\n\r\n";
+	while (chunked.size() < flowBytes)
+		chunked += "1000\r\n" + LbBenchPayload(rng, LB_BENCH_TEXT, 0x1000) + "\r\n";
+	chunked += "0\r\n\r\n";
+
+	std::vector<LB_BENCH_FLOW> flows = {
+		LbBenchStream("upload", upload, LB_FIELD_HTTP_HEADERS),
+		LbBenchStream("upload", upload, LB_FIELD_HTTP_BODY),
+		LbBenchStream("requests", requests, LB_FIELD_HTTP_HEADERS),
+		LbBenchStream("chunked", chunked, LB_FIELD_HTTP_HEADERS),
+		LbBenchStream("chunked", chunked, LB_FIELD_HTTP_BODY),
+	};
+
+	LB_BENCH_FLOW dns = { "dns", LB_IPPROTO_UDP, {}, LB_FIELD_DNS_NAMES };
+	for (size_t bytes = 0; bytes < flowBytes; bytes += dns.segments.back().size())
+		dns.segments.push_back(LbBenchDnsResponse(rng, "host" + std::to_string(rng() % 100) + ".example.com", 1 + rng() % 4));
+	flows.push_back(dns);
+	dns.fields = LB_FIELD_DNS_DATA;
+	flows.push_back(dns);
+
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Love", (char*)"Hate" }, { (char*)"example", (char*)"exempla" } };
+	LB_USERDATA ud;
+	ud.count = 2;
+	ud.strArray = pairs;
+	LB_MATCHER* matcher = NULL;
+	if (!NT_SUCCESS(LbMatcherCompile(&ud, &matcher)))
+		return 1;
+
+	printf("%d byte segments, %d rounds\n", LB_BENCH_SEGMENT, rounds);
+	printf("%-10s %10s %8s  %12s %14s  %12s %14s %9s\n", "flow", "MB", "field", "all MB/s", "all scanned", "field MB/s", "field scanned", "speedup");
+
+	for (const LB_BENCH_FLOW& flow : flows)
+	{
+		UINT64 bytes = 0;
+		for (const std::string& segment : flow.segments)
+			bytes += segment.size();
+
+		UINT64 all = 0;
+		UINT64 limited = 0;
+		UINT64 allScanned = 0;
+		UINT64 limitedScanned = 0;
+		std::vector<std::string> work;
+
+		for (int round = 0; round < rounds; round++)
+		{
+			work = flow.segments;
+			all += LbBenchScan(matcher, flow, work, 0, &allScanned);
+			work = flow.segments;
+			limited += LbBenchScan(matcher, flow, work, flow.fields, &limitedScanned);
+		}
+
+		const char* field = flow.fields == LB_FIELD_HTTP_HEADERS ? "headers" : flow.fields == LB_FIELD_HTTP_BODY ? "body" :
+			flow.fields == LB_FIELD_DNS_NAMES ? "names" : "data";
+		printf("%-10s %10.1f %8s  %12.0f %14llu  %12.0f %14llu %8.1fx\n", flow.name, bytes / 1e6, field,
+			bytes * rounds / 1e6 / (all / 1e9), (unsigned long long)allScanned,
+			bytes * rounds / 1e6 / (limited / 1e9), (unsigned long long)limitedScanned, (double)all / limited);
+	}
+
+	LbMatcherFree(matcher);
+	return 0;
+}
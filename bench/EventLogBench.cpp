@@ -0,0 +1,131 @@
+/*/
+/*  ** EventLogBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures the event log. On one thread a write, its share of a drain and the timestamp it takes are timed
+/*	apart. Then 1 to N writers fill their rings as fast as they can while a reader drains them in batches,
+/*	the way IOCTL_LB_READ_EVENTS would: events per second in total and per processor, and how many of them
+/*	were lost to full or busy rings.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "EventLog.h"
+
+#define LB_BENCH_DRAIN_BATCH 256		// Events per read, 16 KB like a small IOCTL buffer
+
+// One writer, draining whenever half a ring is full: ns per write, per drained event and per timestamp
+static void LbBenchSingle(const LB_BENCH_OPTIONS& options)
+{
+	const UINT32 events = options.quick ? 1 << 12 : 1 << 22;
+	std::vector<LB_EVENT> buffer(LB_BENCH_DRAIN_BATCH);
+	LB_EVENT_LOG* log = NULL;
+	UINT64 writeNs = 0;
+	UINT64 drainNs = 0;
+	UINT64 drained = 0;
+	UINT64 lost = 0;
+
+	if (!NT_SUCCESS(LbEventLogCreate(LB_EVENT_RING_CAPACITY, &log)))
+		return;
+
+	for (UINT32 done = 0; done < events; done += LB_EVENT_RING_CAPACITY / 2)
+	{
+		UINT64 start = LbBenchNow();
+		for (UINT64 i = 0; i < LB_EVENT_RING_CAPACITY / 2; i++)
+		{
+			UINT64 args[] = { 0x0A000001, 443, 6, i };
+			LbEventLogWrite(log, LB_LEVEL_TRACE, LB_EVENT_PACKET_INSPECTED, args, 4);
+		}
+		UINT64 middle = LbBenchNow();
+
+		UINT32 count = 0;
+		UINT64 dropped = 0;
+		while ((count = LbEventLogDrain(log, buffer.data(), LB_BENCH_DRAIN_BATCH, &dropped)) != 0)
+		{
+			drained += count;
+			lost += dropped;
+		}
+		writeNs += middle - start;
+		drainNs += LbBenchNow() - middle;
+	}
+
+	UINT64 start = LbBenchNow();
+	for (UINT32 i = 0; i < events; i++)
+		LbBenchKeep(LbTimestamp());
+	double timestampNs = (double)(LbBenchNow() - start) / events;
+
+	printf("one writer, drained every %u events\n", LB_EVENT_RING_CAPACITY / 2);
+	printf("  write %.1f ns (of it LbTimestamp %.1f ns), drain %.1f ns per event, %llu drained, %llu lost\n\n",
+		(double)writeNs / events, timestampNs, (double)drainNs / drained, (unsigned long long)drained, (unsigned long long)lost);
+
+	LbEventLogDestroy(log);
+}
+
+// Writers flat out with one reader draining alongside them
+static void LbBenchConcurrent(const LB_BENCH_OPTIONS& options)
+{
+	const UINT32 perWriter = options.quick ? 1 << 12 : 1 << 22;
+
+	printf("writers flat out, one reader draining %u at a time\n", LB_BENCH_DRAIN_BATCH);
+	printf("%8s %12s %16s %14s %12s %10s\n", "writers", "Mevents/s", "Mevents/s/cpu", "ns/write", "drained", "lost");
+
+	for (UINT32 threads : LbBenchThreadCounts(options))
+	{
+		LB_EVENT_LOG* log = NULL;
+		if (!NT_SUCCESS(LbEventLogCreate(LB_EVENT_RING_CAPACITY, &log)))
+			return;
+
+		std::atomic<bool> stop(false);
+		UINT64 drained = 0;
+		UINT64 lost = 0;
+
+		std::thread reader([&]() {
+			std::vector<LB_EVENT> buffer(LB_BENCH_DRAIN_BATCH);
+			for (BOOLEAN last = FALSE; !last; )
+			{
+				last = stop.load();
+
+				UINT64 dropped = 0;
+				UINT32 count = LbEventLogDrain(log, buffer.data(), LB_BENCH_DRAIN_BATCH, &dropped);
+				drained += count;
+				lost += dropped;
+
+				if (last && count == LB_BENCH_DRAIN_BATCH)
+					last = FALSE;
+				if (count == 0)
+					std::this_thread::yield();
+			}
+		});
+
+		UINT64 elapsed = LbBenchRunThreads(threads, [&](UINT32 index) {
+			for (UINT64 i = 0; i < perWriter; i++)
+			{
+				UINT64 args[] = { index, i };
+				LbEventLogWrite(log, LB_LEVEL_TRACE, LB_EVENT_PACKET_INSPECTED, args, 2);
+			}
+		});
+
+		stop = true;
+		reader.join();
+
+		double total = (double)perWriter * threads;
+		UINT32 cpus = std::min(threads, LbProcessorCount());
+		printf("%8u %12.1f %16.1f %14.1f %12llu %9.2f%%\n", threads, total / (elapsed / 1e3), total / (elapsed / 1e3) / cpus,
+			(double)elapsed * cpus / total, (unsigned long long)drained, 100.0 * lost / total);
+
+		LbEventLogDestroy(log);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+
+	LbBenchSingle(options);
+	LbBenchConcurrent(options);
+	return 0;
+}
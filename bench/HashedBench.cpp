@@ -0,0 +1,182 @@
+/*/
+/*  ** HashedBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares the automaton with the hashed engine on dictionaries of 100 to 500k literal pairs: the bytes each
+/*	matcher takes, how long it takes to build, and MB/s of the copying rewrite over lowercase text and random
+/*	bytes in 1460 byte packets, with about one planted match every 4 KB. LB_USERDATA::automaton builds the
+/*	automaton however large the dictionary, at 500k pairs it takes close to half a gigabyte. A second table
+/*	does the same for 4 to 8 byte patterns, the windows LB_HASHED_MIN_STATES_SHORT is for. Both engines have
+/*	to write the same bytes.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "HashedEngine.h"
+
+struct LB_BENCH_DICTIONARY
+{
+	std::vector<std::string> words;
+	std::vector<std::string> replacements;
+	std::vector<LB_MATCH_AND_REPLACE> pairs;
+};
+
+static LB_BENCH_DICTIONARY LbBenchDictionary(std::mt19937& rng, size_t count, size_t minLength, size_t maxLength)
+{
+	LB_BENCH_DICTIONARY dictionary;
+
+	dictionary.words = LbBenchWords(rng, count, minLength, maxLength);
+	for (const std::string& word : dictionary.words)
+		dictionary.replacements.push_back(std::string(word.size(), 'X'));
+
+	dictionary.pairs.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		dictionary.pairs[i].match = (char*)dictionary.words[i].c_str();
+		dictionary.pairs[i].replace = (char*)dictionary.replacements[i].c_str();
+	}
+
+	return dictionary;
+}
+
+// bytes of packets of one kind, with a dictionary word planted about every 4 KB
+static std::vector<std::string> LbBenchPackets(std::mt19937& rng, LB_BENCH_PAYLOAD kind, const LB_BENCH_DICTIONARY& dictionary, size_t bytes)
+{
+	std::vector<std::string> packets;
+
+	for (size_t total = 0; total < bytes; total += 1460)
+	{
+		std::string packet = LbBenchPayload(rng, kind, 1460);
+		if (rng() % 4096 < 1460)
+			LbBenchPlant(rng, packet, dictionary.words[rng() % dictionary.words.size()]);
+		packets.push_back(packet);
+	}
+
+	return packets;
+}
+
+// Median MB/s of rewriting every packet into output
+static double LbBenchScan(const LB_MATCHER* matcher, const std::vector<std::string>& packets, std::vector<UINT8>& output, int rounds)
+{
+	std::vector<UINT64> samples;
+
+	for (int round = 0; round < rounds; round++)
+	{
+		UINT64 replacements = 0;
+		UINT64 start = LbBenchNow();
+		for (const std::string& packet : packets)
+		{
+			UINT32 state = LB_MATCHER_ROOT_STATE;
+			SIZE_T written = 0;
+			replacements += LbMatcherRewrite(matcher, &state, (const UINT8*)packet.data(), packet.size(), output.data(), &written);
+		}
+		samples.push_back(LbBenchNow() - start);
+		LbBenchKeep(replacements);
+	}
+
+	return packets.size() * 1460.0 / (LbBenchPercentile(samples, 0.5) / 1e3);
+}
+
+// Whether both engines write the same bytes for every packet
+static BOOLEAN LbBenchSame(const LB_MATCHER* a, const LB_MATCHER* b, const std::vector<std::string>& packets)
+{
+	std::vector<UINT8> outputA(LbMatcherRewriteBound(a, 1460));
+	std::vector<UINT8> outputB(LbMatcherRewriteBound(b, 1460));
+
+	for (const std::string& packet : packets)
+	{
+		UINT32 stateA = LB_MATCHER_ROOT_STATE;
+		UINT32 stateB = LB_MATCHER_ROOT_STATE;
+		SIZE_T writtenA = 0;
+		SIZE_T writtenB = 0;
+
+		if (LbMatcherRewrite(a, &stateA, (const UINT8*)packet.data(), packet.size(), outputA.data(), &writtenA) !=
+			LbMatcherRewrite(b, &stateB, (const UINT8*)packet.data(), packet.size(), outputB.data(), &writtenB) ||
+			writtenA != writtenB || memcmp(outputA.data(), outputB.data(), writtenA) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int LbBenchTable(std::mt19937& rng, const std::vector<UINT32>& counts, size_t minLength, size_t maxLength, size_t bytes, int rounds)
+{
+	int failed = 0;
+
+	printf("\n%zu to %zu byte patterns, %zu MB of 1460 byte packets, median of %d rounds\n", minLength, maxLength, bytes >> 20, rounds);
+	printf("%8s  %-10s %10s %10s %10s %12s\n", "pairs", "engine", "MB", "build ms", "text MB/s", "random MB/s");
+
+	for (UINT32 count : counts)
+	{
+		LB_BENCH_DICTIONARY dictionary = LbBenchDictionary(rng, count, minLength, maxLength);
+		std::vector<std::string> text = LbBenchPackets(rng, LB_BENCH_TEXT, dictionary, bytes);
+		std::vector<std::string> random = LbBenchPackets(rng, LB_BENCH_RANDOM, dictionary, bytes);
+		LB_MATCHER* matchers[2] = {};
+		double buildMs[2] = {};
+
+		for (int engine = 0; engine < 2; engine++)
+		{
+			LB_USERDATA ud;
+			ud.count = (int)count;
+			ud.strArray = dictionary.pairs.data();
+			ud.automaton = engine == 0;
+
+			UINT64 start = LbBenchNow();
+			NTSTATUS status = LbMatcherCompile(&ud, &matchers[engine]);
+			buildMs[engine] = (LbBenchNow() - start) / 1e6;
+			if (!NT_SUCCESS(status))
+			{
+				fprintf(stderr, "%u pairs refused (0x%08X)\n", count, (UINT32)status);
+				return 1;
+			}
+		}
+
+		// Small dictionaries go to the automaton on their own, the hashed engine is asked for by name then
+		if (matchers[1]->engine != LB_MATCHER_ENGINE_HASHED)
+		{
+			LB_USERDATA ud;
+			ud.count = (int)count;
+			ud.strArray = dictionary.pairs.data();
+
+			LbMatcherFree(matchers[1]);
+			matchers[1] = NULL;
+			UINT64 start = LbBenchNow();
+			if (!NT_SUCCESS(LbHashedCompile(&ud, &matchers[1])))
+				return 1;
+			buildMs[1] = (LbBenchNow() - start) / 1e6;
+		}
+
+		failed |= !LbBenchSame(matchers[0], matchers[1], text) || !LbBenchSame(matchers[0], matchers[1], random);
+
+		std::vector<UINT8> output(LbMatcherRewriteBound(matchers[1], 1460));
+		for (int engine = 0; engine < 2; engine++)
+		{
+			printf("%8u  %-10s %10.2f %10.1f %10.0f %12.0f\n", count, engine == 0 ? "automaton" : "hashed", matchers[engine]->size / 1048576.0, buildMs[engine],
+				LbBenchScan(matchers[engine], text, output, rounds), LbBenchScan(matchers[engine], random, output, rounds));
+			LbMatcherFree(matchers[engine]);
+		}
+	}
+
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const int rounds = options.quick ? 1 : 5;
+	const size_t bytes = options.quick ? 1 << 20 : 16 << 20;
+	std::vector<UINT32> counts = { 100, 1000, 10000, 100000, 500000 };
+	std::vector<UINT32> shortCounts = { 1000, 10000 };
+
+	if (options.quick)
+		counts = shortCounts = { 100, 1000 };
+
+	int failed = LbBenchTable(rng, counts, 6, 16, bytes, rounds);
+	failed |= LbBenchTable(rng, shortCounts, 4, 8, bytes, rounds);
+	return failed;
+}
@@ -0,0 +1,277 @@
+/*/
+/*  ** LayoutBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares the automaton's compact layout, a column per byte class and 16 bit states while they fit, with
+/*	the dense one it replaced: a UINT32 row of 256 transitions per state. The dense copy is made from the
+/*	compiled block, so both have the same states and scan through the same engine. For dictionaries of 3 to
+/*	30k lowercase pairs it prints the bytes each table takes, MB/s of the copying rewrite over lowercase text
+/*	and random bytes in 1460 byte packets with about one planted match every 4 KB, and the L1 and L2 misses
+/*	per KB of payload the scan's table reads cause in a simulated 32 KB 8-way L1 and 1 MB 16-way L2 with LRU
+/*	replacement and 64 byte lines. The payload's own lines are left out of the simulation.
+/*	Both layouts have to write the same bytes.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "MatchEngine.h"
+
+// One level of a set associative cache with 64 byte lines and LRU replacement
+struct LB_BENCH_CACHE
+{
+	SIZE_T sets;
+	SIZE_T ways;
+	std::vector<UINT64> lines;		// Line address + 1 of each way, 0 when empty
+	std::vector<UINT64> used;		// When each way was last touched
+	UINT64 clock = 0;
+	UINT64 misses = 0;
+
+	LB_BENCH_CACHE(SIZE_T bytes, SIZE_T associativity) : sets(bytes / 64 / associativity), ways(associativity),
+		lines(sets * associativity), used(sets * associativity)
+	{
+	}
+
+	// Whether the line holding address was already here, it is afterwards
+	bool Touch(UINT64 address)
+	{
+		UINT64 line = address / 64 + 1;
+		SIZE_T base = (SIZE_T)(line % sets) * ways;
+		SIZE_T oldest = base;
+
+		clock++;
+		for (SIZE_T way = base; way < base + ways; way++)
+		{
+			if (lines[way] == line)
+			{
+				used[way] = clock;
+				return true;
+			}
+			if (used[way] < used[oldest])
+				oldest = way;
+		}
+
+		lines[oldest] = line;
+		used[oldest] = clock;
+		misses++;
+		return false;
+	}
+};
+
+// The same automaton with every byte its own class and 32 bit states, as LbMatcherCompile laid it out before
+// byte classes. The block is copied whole and the table and identity classes are put after it, every other
+// offset stays valid.
+static std::vector<UINT64> LbBenchDense(const LB_MATCHER* matcher)
+{
+	SIZE_T transitionOffset = (matcher->size + 63) & ~(SIZE_T)63;
+	SIZE_T classOffset = transitionOffset + (SIZE_T)matcher->stateCount * 256 * sizeof(UINT32);
+	std::vector<UINT64> storage((classOffset + 256 + sizeof(UINT64) - 1) / sizeof(UINT64));
+	LB_MATCHER* dense = (LB_MATCHER*)storage.data();
+	const UINT8* classes = (const UINT8*)matcher + matcher->classOffset;
+	const UINT8* transitions = (const UINT8*)matcher + matcher->transitionOffset;
+	UINT32* rows = (UINT32*)((UINT8*)dense + transitionOffset);
+
+	memcpy(dense, matcher, matcher->size);
+	for (SIZE_T state = 0; state < matcher->stateCount; state++)
+	{
+		for (int c = 0; c < 256; c++)
+		{
+			SIZE_T i = state * matcher->classCount + classes[c];
+			rows[state * 256 + c] = matcher->stateWidth == sizeof(UINT16) ? ((const UINT16*)transitions)[i] : ((const UINT32*)transitions)[i];
+		}
+	}
+	for (int c = 0; c < 256; c++)
+		((UINT8*)dense + classOffset)[c] = (UINT8)c;
+
+	dense->classCount = 256;
+	dense->stateWidth = sizeof(UINT32);
+	dense->transitionOffset = (UINT32)transitionOffset;
+	dense->classOffset = (UINT32)classOffset;
+	dense->size = (UINT32)(classOffset + 256);
+	return storage;
+}
+
+// Bytes of the classes, transitions, outputs and depths, the header and pattern strings left out
+static SIZE_T LbBenchTableBytes(const LB_MATCHER* matcher)
+{
+	return 256 + (SIZE_T)matcher->stateCount * (matcher->classCount * matcher->stateWidth + 2 * sizeof(UINT32));
+}
+
+// L1 and L2 misses per KB of the lines the scan of every packet reads: the class of each byte it does not
+// skip, the transition it takes and the output of the state it reaches
+static void LbBenchSimulate(const LB_MATCHER* matcher, const std::vector<std::string>& packets, double* l1, double* l2)
+{
+	LB_BENCH_CACHE first(32 * 1024, 8);
+	LB_BENCH_CACHE second(1024 * 1024, 16);
+	const UINT8* block = (const UINT8*)matcher;
+	const UINT8* classes = block + matcher->classOffset;
+	const UINT32* outputs = (const UINT32*)(block + matcher->outputOffset);
+	UINT64 bytes = 0;
+
+	auto touch = [&](const void* address) {
+		if (!first.Touch((UINT64)(size_t)address))
+			second.Touch((UINT64)(size_t)address);
+	};
+
+	for (const std::string& packet : packets)
+	{
+		const UINT8* data = (const UINT8*)packet.data();
+		UINT32 state = LB_MATCHER_ROOT_STATE;
+
+		for (SIZE_T i = 0; i < packet.size(); i++)
+		{
+			// The prefilter passes over bytes no pattern starts with without touching the tables
+			if (state == LB_MATCHER_ROOT_STATE && !(matcher->firstByteMap[data[i] >> 3] & (1 << (data[i] & 7))))
+				continue;
+
+			SIZE_T column = (SIZE_T)state * matcher->classCount + classes[data[i]];
+			const UINT8* transition = block + matcher->transitionOffset + column * matcher->stateWidth;
+
+			touch(&classes[data[i]]);
+			touch(transition);
+			state = matcher->stateWidth == sizeof(UINT16) ? *(const UINT16*)transition : *(const UINT32*)transition;
+			touch(&outputs[state]);
+			if (outputs[state] != 0)
+				state = LB_MATCHER_ROOT_STATE;
+		}
+		bytes += packet.size();
+	}
+
+	*l1 = first.misses * 1024.0 / bytes;
+	*l2 = second.misses * 1024.0 / bytes;
+}
+
+// bytes of packets of one kind, with a dictionary word planted about every 4 KB
+static std::vector<std::string> LbBenchPackets(std::mt19937& rng, LB_BENCH_PAYLOAD kind, const std::vector<std::string>& words, size_t bytes)
+{
+	std::vector<std::string> packets;
+
+	for (size_t total = 0; total < bytes; total += 1460)
+	{
+		std::string packet = LbBenchPayload(rng, kind, 1460);
+		if (rng() % 4096 < 1460)
+			LbBenchPlant(rng, packet, words[rng() % words.size()]);
+		packets.push_back(packet);
+	}
+
+	return packets;
+}
+
+// Median MB/s of rewriting every packet into output
+static double LbBenchScan(const LB_MATCHER* matcher, const std::vector<std::string>& packets, std::vector<UINT8>& output, int rounds)
+{
+	std::vector<UINT64> samples;
+
+	for (int round = 0; round < rounds; round++)
+	{
+		UINT64 replacements = 0;
+		UINT64 start = LbBenchNow();
+		for (const std::string& packet : packets)
+		{
+			UINT32 state = LB_MATCHER_ROOT_STATE;
+			SIZE_T written = 0;
+			replacements += LbMatcherRewrite(matcher, &state, (const UINT8*)packet.data(), packet.size(), output.data(), &written);
+		}
+		samples.push_back(LbBenchNow() - start);
+		LbBenchKeep(replacements);
+	}
+
+	return packets.size() * 1460.0 / (LbBenchPercentile(samples, 0.5) / 1e3);
+}
+
+// Whether both layouts write the same bytes and end in the same state for every packet
+static BOOLEAN LbBenchSame(const LB_MATCHER* a, const LB_MATCHER* b, const std::vector<std::string>& packets)
+{
+	std::vector<UINT8> outputA(LbMatcherRewriteBound(a, 1460));
+	std::vector<UINT8> outputB(LbMatcherRewriteBound(b, 1460));
+
+	for (const std::string& packet : packets)
+	{
+		UINT32 stateA = LB_MATCHER_ROOT_STATE;
+		UINT32 stateB = LB_MATCHER_ROOT_STATE;
+		SIZE_T writtenA = 0;
+		SIZE_T writtenB = 0;
+
+		if (LbMatcherRewrite(a, &stateA, (const UINT8*)packet.data(), packet.size(), outputA.data(), &writtenA) !=
+			LbMatcherRewrite(b, &stateB, (const UINT8*)packet.data(), packet.size(), outputB.data(), &writtenB) ||
+			stateA != stateB || writtenA != writtenB || memcmp(outputA.data(), outputB.data(), writtenA) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const int rounds = options.quick ? 1 : 5;
+	const size_t bytes = options.quick ? 1 << 20 : 16 << 20;
+	const size_t simulated = options.quick ? 256 << 10 : 4 << 20;
+	std::vector<UINT32> counts = { 3, 30, 300, 3000, 30000 };
+	int failed = 0;
+
+	if (options.quick)
+		counts = { 3, 300 };
+
+	printf("3 to 12 byte lowercase patterns, %zu MB of 1460 byte packets, median of %d rounds\n", bytes >> 20, rounds);
+	printf("misses per KB of payload from the first %zu KB, simulated 32 KB 8-way L1 and 1 MB 16-way L2\n", simulated >> 10);
+	printf("%8s %8s  %-8s %6s %10s %10s %12s %9s %9s %9s %9s\n", "pairs", "states", "layout", "width", "table KB", "text MB/s", "random MB/s",
+		"text L1", "text L2", "rand L1", "rand L2");
+
+	for (UINT32 count : counts)
+	{
+		std::vector<std::string> words = LbBenchWords(rng, count, 3, 12);
+		std::vector<std::string> replacements;
+		std::vector<LB_MATCH_AND_REPLACE> pairs(count);
+		LB_USERDATA ud;
+		LB_MATCHER* compact = NULL;
+
+		for (const std::string& word : words)
+			replacements.push_back(std::string(word.size(), 'X'));
+		for (UINT32 i = 0; i < count; i++)
+		{
+			pairs[i].match = (char*)words[i].c_str();
+			pairs[i].replace = (char*)replacements[i].c_str();
+		}
+
+		// Large dictionaries would go to the hashed engine, this compares layouts of the automaton
+		ud.count = (int)count;
+		ud.strArray = pairs.data();
+		ud.automaton = true;
+		if (!NT_SUCCESS(LbMatcherCompile(&ud, &compact)))
+		{
+			fprintf(stderr, "%u pairs refused\n", count);
+			return 1;
+		}
+
+		std::vector<UINT64> denseBlock = LbBenchDense(compact);
+		const LB_MATCHER* layouts[2] = { (const LB_MATCHER*)denseBlock.data(), compact };
+		std::vector<std::string> text = LbBenchPackets(rng, LB_BENCH_TEXT, words, bytes);
+		std::vector<std::string> random = LbBenchPackets(rng, LB_BENCH_RANDOM, words, bytes);
+		std::vector<std::string> textSample(text.begin(), text.begin() + simulated / 1460);
+		std::vector<std::string> randomSample(random.begin(), random.begin() + simulated / 1460);
+		std::vector<UINT8> output(LbMatcherRewriteBound(compact, 1460));
+
+		failed |= !LbBenchSame(layouts[0], layouts[1], text) || !LbBenchSame(layouts[0], layouts[1], random);
+
+		for (int layout = 0; layout < 2; layout++)
+		{
+			const LB_MATCHER* matcher = layouts[layout];
+			double misses[4] = {};
+
+			LbBenchSimulate(matcher, textSample, &misses[0], &misses[1]);
+			LbBenchSimulate(matcher, randomSample, &misses[2], &misses[3]);
+			printf("%8u %8u  %-8s %6u %10.1f %10.0f %12.0f %9.2f %9.2f %9.2f %9.2f\n", count, matcher->stateCount, layout == 0 ? "dense" : "compact",
+				matcher->stateWidth * 8, LbBenchTableBytes(matcher) / 1024.0, LbBenchScan(matcher, text, output, rounds),
+				LbBenchScan(matcher, random, output, rounds), misses[0], misses[1], misses[2], misses[3]);
+		}
+
+		LbMatcherFree(compact);
+	}
+
+	return failed;
+}
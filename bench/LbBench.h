@@ -0,0 +1,217 @@
+/*/
+/*  ** LbBench.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the helpers shared by the user mode benchmarks: timing, command line options and the
+/*	synthetic payloads they run over. Every benchmark takes --quick, which shrinks it to a smoke test
+/*	that finishes in well under a second; ctest runs them that way so they keep building and running.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Options every benchmark understands
+struct LB_BENCH_OPTIONS
+{
+	bool quick = false;			// --quick
+	UINT32 threads = 0;			// --threads N, 0 for the benchmark's own default
+	double threshold = 0;		// --threshold X, a benchmark that has a pass mark fails below it
+	const char* input = NULL;	// First argument that is not an option
+};
+
+inline LB_BENCH_OPTIONS LbBenchParse(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+			options.quick = true;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			options.threads = (UINT32)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			options.threshold = atof(argv[++i]);
+		else
+			options.input = argv[i];
+	}
+
+	return options;
+}
+
+// Nanoseconds since an arbitrary point
+inline UINT64 LbBenchNow()
+{
+	UINT64 ticks = LbTimestamp();
+	UINT64 frequency = LbTimestampFrequency();
+
+	return ticks / frequency * 1000000000ull + ticks % frequency * 1000000000ull / frequency;
+}
+
+// Value below which fraction of the samples fall, samples are sorted in place
+inline UINT64 LbBenchPercentile(std::vector<UINT64>& samples, double fraction)
+{
+	if (samples.empty())
+		return 0;
+
+	std::sort(samples.begin(), samples.end());
+	size_t index = (size_t)(fraction * (samples.size() - 1) + 0.5);
+	return samples[index < samples.size() ? index : samples.size() - 1];
+}
+
+// Keeps the compiler from dropping a result nobody reads
+inline void LbBenchKeep(UINT64 value)
+{
+	static volatile UINT64 sink;
+	sink += value;
+}
+
+/////////////
+// THREADS //
+/////////////
+
+// Thread counts a scaling run goes through: 1, 2, 4 and so on up to --threads, or to every processor
+inline std::vector<UINT32> LbBenchThreadCounts(const LB_BENCH_OPTIONS& options)
+{
+	UINT32 most = options.threads ? options.threads : LbProcessorCount();
+	std::vector<UINT32> counts;
+
+	for (UINT32 count = 1; count < most; count *= 2)
+		counts.push_back(count);
+	counts.push_back(most);
+
+	return counts;
+}
+
+// Run body(index) on count threads, each pinned to its own processor while there are enough of them.
+// All of them are released at once, returns the nanoseconds from then until the last one finished.
+inline UINT64 LbBenchRunThreads(UINT32 count, const std::function<void(UINT32)>& body)
+{
+	std::vector<std::thread> threads;
+	std::atomic<UINT32> ready(0);
+	std::atomic<bool> go(false);
+	UINT32 processors = LbProcessorCount();
+
+	for (UINT32 index = 0; index < count; index++)
+	{
+		threads.emplace_back([&, index]() {
+			ready++;
+			while (!go.load())
+				std::this_thread::yield();
+			body(index);
+		});
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(index % processors, &set);
+		pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set);
+	}
+
+	while (ready.load() < count)
+		std::this_thread::yield();
+
+	UINT64 start = LbBenchNow();
+	go = true;
+	for (std::thread& thread : threads)
+		thread.join();
+
+	return LbBenchNow() - start;
+}
+
+//////////////
+// PAYLOADS //
+//////////////
+
+enum LB_BENCH_PAYLOAD
+{
+	LB_BENCH_HTTP = 0,		// HTTP/1.1 requests and responses with headers and a text body
+	LB_BENCH_TEXT,			// Lowercase words and spaces
+	LB_BENCH_RANDOM,		// Uniformly random bytes
+};
+
+inline const char* LbBenchPayloadName(LB_BENCH_PAYLOAD kind)
+{
+	return kind == LB_BENCH_HTTP ? "http" : kind == LB_BENCH_TEXT ? "text" : "random";
+}
+
+// length bytes of one kind of payload
+inline std::string LbBenchPayload(std::mt19937& rng, LB_BENCH_PAYLOAD kind, size_t length)
+{
+	static const char* words[] = {
+		"the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on", "not",
+		"he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you",
+		"were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if", "more", "when", "will",
+		"would", "who", "so", "no", "packet", "filter", "driver", "window", "stream", "session", "server"
+	};
+	static const char* heads[] = {
+		"GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nUser-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64)\r\nAccept: text/html,application/xhtml+xml\r\nAccept-Language: en-US,en;q=0.5\r\nConnection: keep-alive\r\n\r\n",
+		"POST /api/v1/messages HTTP/1.1\r\nHost: chat.example.org\r\nContent-Type: application/json\r\nCookie: session=4f2a9c; theme=dark\r\nContent-Length: 512\r\n\r\n",
+		"HTTP/1.1 200 OK\r\nServer: nginx\r\nDate: Tue, 14 Oct 2025 10:00:00 GMT\r\nContent-Type: text/html; charset=utf-8\r\nCache-Control: no-cache\r\n\r\n",
+	};
+	std::string result;
+
+	if (kind == LB_BENCH_RANDOM)
+	{
+		result.resize(length);
+		for (size_t i = 0; i < length; i++)
+			result[i] = (char)(rng() & 0xFF);
+		return result;
+	}
+
+	if (kind == LB_BENCH_HTTP)
+		result = heads[rng() % 3];
+
+	while (result.size() < length)
+	{
+		result += words[rng() % (sizeof(words) / sizeof(words[0]))];
+		result += rng() % 12 == 0 ? ". " : " ";
+	}
+
+	result.resize(length);
+	return result;
+}
+
+// Write pattern over payload at a random place, for a planted match
+inline void LbBenchPlant(std::mt19937& rng, std::string& payload, const std::string& pattern)
+{
+	if (pattern.size() <= payload.size())
+		payload.replace(rng() % (payload.size() - pattern.size() + 1), pattern.size(), pattern);
+}
+
+// Random lowercase words of minLength to maxLength bytes, no two alike
+inline std::vector<std::string> LbBenchWords(std::mt19937& rng, size_t count, size_t minLength, size_t maxLength)
+{
+	std::vector<std::string> result;
+	std::unordered_set<std::string> seen;
+
+	while (result.size() < count)
+	{
+		size_t length = minLength + rng() % (maxLength - minLength + 1);
+		std::string word(length, 'a');
+
+		for (size_t i = 0; i < length; i++)
+			word[i] = (char)('a' + rng() % 26);
+
+		if (seen.insert(word).second)
+			result.push_back(word);
+	}
+
+	return result;
+}
@@ -0,0 +1,1470 @@
+/*/
+/*  ** LbReplay.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the user mode replay harness: packets read from a pcap or pcapng capture are laid out as
+/*	NET_BUFFER_LIST, NET_BUFFER and MDL chains and driven through the classify path the way the callout
+/*	drives it, so the portable code (verdict lookup, LbScanBuffer in place over every MDL, LbRewriteTransport
+/*	for size changes) can be measured against recorded traffic without loading the driver.
+/*
+/*	The stand-ins keep the WDK's field names and only the fields the classify path reads. LbReplayClassify
+/*	follows LbClassifyLayer step by step; what it leaves out is what only a running stack has: flow contexts
+/*	are created per flow when the corpus is built, a rewritten segment is built but counted instead of sent,
+/*	asynchronous rule sets are inspected inline, and acknowledgements are not translated.
+/*
+/*	LbReplayStreamPacket drives LbClassifyStreamLayer the same way, with the outgoing TCP data of a capture
+/*	as the writes of each flow's stream and the need more data loop of the stack played out around it.
+/*
+/*	Which side of a captured packet is local is not in the capture. A packet is taken as outbound when its
+/*	source port is above its destination port, as a client's ephemeral port is above the service it calls.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "ClassifyCore.h"
+#include "SpanIterator.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+////////////////////
+// NDIS STAND-INS //
+////////////////////
+
+// A mapped buffer, MmGetSystemAddressForMdlSafe always succeeds
+struct LB_REPLAY_MDL
+{
+	LB_REPLAY_MDL* Next;
+	UINT8* MappedSystemVa;
+	ULONG ByteCount;
+};
+
+struct LB_REPLAY_NET_BUFFER
+{
+	LB_REPLAY_NET_BUFFER* Next;
+	LB_REPLAY_MDL* CurrentMdl;
+	ULONG CurrentMdlOffset;
+	ULONG DataLength;
+};
+
+struct LB_REPLAY_NET_BUFFER_LIST
+{
+	LB_REPLAY_NET_BUFFER_LIST* Next;
+	LB_REPLAY_NET_BUFFER* FirstNetBuffer;
+};
+
+// What LB_SPAN_ITERATOR needs to walk an MDL chain
+inline LB_REPLAY_MDL* LbSpanNodeNext(LB_REPLAY_MDL* mdl)
+{
+	return mdl->Next;
+}
+
+inline SIZE_T LbSpanNodeSize(LB_REPLAY_MDL* mdl)
+{
+	return mdl->ByteCount;
+}
+
+inline UINT8* LbSpanNodeMap(LB_REPLAY_MDL* mdl)
+{
+	return mdl->MappedSystemVa;
+}
+
+// NdisGetDataBuffer: a pointer to length bytes at the start of a NET_BUFFER, copied into storage when the
+// MDLs split them. NULL when they are split and there is no storage, or when the chain is too short.
+inline UINT8* LbReplayGetDataBuffer(LB_REPLAY_NET_BUFFER* netBuffer, ULONG length, UINT8* storage)
+{
+	LB_SPAN_ITERATOR<LB_REPLAY_MDL> it;
+	LB_SPAN span;
+	SIZE_T copied = 0;
+
+	if (length > netBuffer->DataLength)
+		return NULL;
+
+	LbSpanBegin(&it, netBuffer->CurrentMdl, netBuffer->CurrentMdlOffset, length);
+	if (!LbSpanNext(&it, &span))
+		return NULL;
+	if (span.length == length)
+		return span.data;
+	if (!storage)
+		return NULL;
+
+	do
+	{
+		memcpy(storage + copied, span.data, span.length);
+		copied += span.length;
+	} while (LbSpanNext(&it, &span));
+
+	return copied == length ? storage : NULL;
+}
+
+///////////////////
+// WFP STAND-INS //
+///////////////////
+
+// The callout's layers, with the field order of their FWPS_FIELDS_*_TRANSPORT_* enumerations
+enum LB_REPLAY_LAYER_ID : UINT16
+{
+	LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V4 = 0,
+	LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V6,
+	LB_REPLAY_LAYER_INBOUND_TRANSPORT_V4,
+	LB_REPLAY_LAYER_INBOUND_TRANSPORT_V6,
+};
+
+enum LB_REPLAY_FIELD
+{
+	LB_REPLAY_FIELD_IP_PROTOCOL = 0,
+	LB_REPLAY_FIELD_IP_LOCAL_ADDRESS,
+	LB_REPLAY_FIELD_IP_LOCAL_ADDRESS_TYPE,
+	LB_REPLAY_FIELD_IP_REMOTE_ADDRESS,
+	LB_REPLAY_FIELD_IP_LOCAL_PORT,
+	LB_REPLAY_FIELD_IP_REMOTE_PORT,
+	LB_REPLAY_FIELD_COUNT
+};
+
+// FWP_BYTE_ARRAY16
+struct LB_REPLAY_BYTE_ARRAY16
+{
+	UINT8 byteArray16[16];
+};
+
+// FWP_VALUE0, IPv4 addresses in host byte order, IPv6 ones as 16 bytes in network byte order
+struct LB_REPLAY_VALUE
+{
+	union
+	{
+		UINT8 uint8;
+		UINT16 uint16;
+		UINT32 uint32;
+		const LB_REPLAY_BYTE_ARRAY16* byteArray16;
+	};
+};
+
+struct LB_REPLAY_INCOMING_VALUE
+{
+	LB_REPLAY_VALUE value;
+};
+
+// FWPS_INCOMING_VALUES0
+struct LB_REPLAY_INCOMING_VALUES
+{
+	UINT16 layerId;
+	UINT32 valueCount;
+	LB_REPLAY_INCOMING_VALUE incomingValue[LB_REPLAY_FIELD_COUNT];
+};
+
+// LB_WFP_LAYER of the callout, the field indices are the same for every transport layer here
+template <class Traits, UINT16 LayerId>
+struct LB_REPLAY_LAYER : Traits
+{
+	static const UINT16 layerId = LayerId;
+	static const UINT32 localAddress = LB_REPLAY_FIELD_IP_LOCAL_ADDRESS;
+	static const UINT32 remoteAddress = LB_REPLAY_FIELD_IP_REMOTE_ADDRESS;
+	static const UINT32 localPort = LB_REPLAY_FIELD_IP_LOCAL_PORT;
+	static const UINT32 remotePort = LB_REPLAY_FIELD_IP_REMOTE_PORT;
+	static const UINT32 protocol = LB_REPLAY_FIELD_IP_PROTOCOL;
+};
+
+// The part of LB_FLOW_CONTEXT the classify path uses, one per flow and direction of the corpus
+struct LB_REPLAY_FLOW
+{
+	volatile LONG lock;			// KSPIN_LOCK, held across the inspection of one call
+	UINT32 matchState;
+	UINT32 matchGeneration;
+	LB_SEQ_TRACKER seq;
+	LB_DISSECTOR dissector;
+	LB_FLOW_KEY key;			// What the context was created for, LbReplayReset starts its dissector again
+};
+
+inline void LbReplayFlowInitialize(LB_REPLAY_FLOW* flow, const LB_FLOW_KEY* key)
+{
+	flow->key = *key;
+	flow->lock = 0;
+	flow->matchState = LB_MATCHER_ROOT_STATE;
+	flow->matchGeneration = 0;
+	LbSeqTrackerInitialize(&flow->seq);
+	LbDissectorBegin(&flow->dissector, LbDissectorForFlow(key));
+}
+
+inline void LbReplayFlowAcquire(LB_REPLAY_FLOW* flow)
+{
+	while (LbInterlockedCompareExchange(&flow->lock, 1, 0) != 0)
+	{
+		while (LbReadAcquire(&flow->lock) != 0)
+			LbSpinPause();
+	}
+}
+
+inline void LbReplayFlowRelease(LB_REPLAY_FLOW* flow)
+{
+	LbWriteRelease(&flow->lock, 0);
+}
+
+/////////////////////
+// CAPTURED FRAMES //
+/////////////////////
+
+// One TCP or UDP packet of a capture, from its transport header on
+struct LB_REPLAY_PACKET
+{
+	UINT64 timestamp;			// Nanoseconds since the epoch
+	UINT8 family;				// LB_ADDRESS_FAMILY
+	UINT8 protocol;
+	UINT8 source[16];			// Network byte order, an IPv4 address in the first four bytes
+	UINT8 destination[16];
+	UINT16 sourcePort;
+	UINT16 destinationPort;
+	UINT32 headerLength;		// Transport header bytes at the start of segment
+	std::vector<UINT8> segment;
+};
+
+// What a read kept and what it had to leave out
+struct LB_REPLAY_READ_STATS
+{
+	UINT64 frames;
+	UINT64 packets;				// TCP and UDP packets kept
+	UINT64 truncated;			// Cut short by the snapshot length, their payload is incomplete
+	UINT64 fragments;
+	UINT64 other;				// Other protocols, link types and malformed headers
+};
+
+// Link layer types of the captures this reads
+#define LB_REPLAY_LINKTYPE_NULL			0
+#define LB_REPLAY_LINKTYPE_ETHERNET		1
+#define LB_REPLAY_LINKTYPE_RAW			101
+#define LB_REPLAY_LINKTYPE_LINUX_SLL	113
+#define LB_REPLAY_LINKTYPE_IPV4			228
+#define LB_REPLAY_LINKTYPE_IPV6			229
+#define LB_REPLAY_LINKTYPE_LINUX_SLL2	276
+
+// Parse the IP packet at the start of data, captured of the wireLength bytes it had
+inline void LbReplayParseIp(const UINT8* data, SIZE_T captured, SIZE_T wireLength, UINT64 timestamp, std::vector<LB_REPLAY_PACKET>* packets, LB_REPLAY_READ_STATS* stats)
+{
+	LB_REPLAY_PACKET packet = {};
+	SIZE_T headerLength = 0;
+	SIZE_T totalLength = 0;
+	UINT8 protocol = 0;
+
+	packet.timestamp = timestamp;
+
+	if (captured >= 20 && (data[0] >> 4) == 4)
+	{
+		headerLength = (SIZE_T)(data[0] & 0x0F) * 4;
+		totalLength = LbReadBe16(&data[2]);
+		protocol = data[9];
+
+		if (headerLength < 20 || totalLength < headerLength || captured < headerLength)
+		{
+			stats->other++;
+			return;
+		}
+		if ((LbReadBe16(&data[6]) & 0x3FFF) != 0)	// More fragments, or a fragment offset
+		{
+			stats->fragments++;
+			return;
+		}
+
+		packet.family = LB_FAMILY_IPV4;
+		memcpy(packet.source, &data[12], 4);
+		memcpy(packet.destination, &data[16], 4);
+	}
+	else if (captured >= 40 && (data[0] >> 4) == 6)
+	{
+		totalLength = 40 + (SIZE_T)LbReadBe16(&data[4]);
+		protocol = data[6];
+		headerLength = 40;
+
+		// Hop-by-hop, routing and destination options are skipped, fragments are left out
+		while (protocol == 0 || protocol == 43 || protocol == 60 || protocol == 44)
+		{
+			if (protocol == 44)
+			{
+				stats->fragments++;
+				return;
+			}
+			if (captured < headerLength + 8)
+			{
+				stats->other++;
+				return;
+			}
+
+			protocol = data[headerLength];
+			headerLength += ((SIZE_T)data[headerLength + 1] + 1) * 8;
+		}
+
+		if (totalLength < headerLength || captured < headerLength)
+		{
+			stats->other++;
+			return;
+		}
+
+		packet.family = LB_FAMILY_IPV6;
+		memcpy(packet.source, &data[8], 16);
+		memcpy(packet.destination, &data[24], 16);
+	}
+	else
+	{
+		stats->other++;
+		return;
+	}
+
+	if (protocol != LB_IPPROTO_TCP && protocol != LB_IPPROTO_UDP)
+	{
+		stats->other++;
+		return;
+	}
+
+	// The IP length is what the packet had, an Ethernet frame may carry padding after it
+	if (totalLength > captured || totalLength > wireLength)
+	{
+		stats->truncated++;
+		return;
+	}
+
+	const UINT8* transport = data + headerLength;
+	SIZE_T transportLength = totalLength - headerLength;
+
+	packet.protocol = protocol;
+	packet.headerLength = protocol == LB_IPPROTO_TCP ? (transportLength >= 20 ? (UINT32)(transport[12] >> 4) * 4 : 0) : 8;
+	if (transportLength < 8 || packet.headerLength < 8 || packet.headerLength > transportLength)
+	{
+		stats->other++;
+		return;
+	}
+
+	packet.sourcePort = LbReadBe16(&transport[0]);
+	packet.destinationPort = LbReadBe16(&transport[2]);
+	packet.segment.assign(transport, transport + transportLength);
+
+	packets->push_back(std::move(packet));
+	stats->packets++;
+}
+
+// Strip the link layer of one frame
+inline void LbReplayParseFrame(UINT32 linkType, const UINT8* data, SIZE_T captured, SIZE_T wireLength, UINT64 timestamp, std::vector<LB_REPLAY_PACKET>* packets, LB_REPLAY_READ_STATS* stats)
+{
+	SIZE_T header = 0;
+	UINT16 etherType = 0;
+
+	stats->frames++;
+
+	switch (linkType)
+	{
+	case LB_REPLAY_LINKTYPE_ETHERNET:
+		header = 14;
+		if (captured < header)
+			break;
+		etherType = LbReadBe16(&data[12]);
+
+		// 802.1Q and 802.1ad tags, stacked or not
+		while ((etherType == 0x8100 || etherType == 0x88A8) && captured >= header + 4)
+		{
+			etherType = LbReadBe16(&data[header + 2]);
+			header += 4;
+		}
+		break;
+
+	case LB_REPLAY_LINKTYPE_LINUX_SLL:
+		header = 16;
+		if (captured >= header)
+			etherType = LbReadBe16(&data[14]);
+		break;
+
+	case LB_REPLAY_LINKTYPE_LINUX_SLL2:
+		header = 20;
+		if (captured >= header)
+			etherType = LbReadBe16(&data[0]);
+		break;
+
+	case LB_REPLAY_LINKTYPE_NULL:
+		// The address family in the byte order of the machine that captured it
+		header = 4;
+		if (captured >= header)
+		{
+			UINT32 family = data[0] | (data[1] << 8) | ((UINT32)data[2] << 16) | ((UINT32)data[3] << 24);
+			if (family > 0xFFFF)
+				family = LbReadBe32(data);
+			etherType = family == 2 ? 0x0800 : (family == 24 || family == 28 || family == 30) ? 0x86DD : 0;
+		}
+		break;
+
+	case LB_REPLAY_LINKTYPE_RAW:
+	case LB_REPLAY_LINKTYPE_IPV4:
+	case LB_REPLAY_LINKTYPE_IPV6:
+		header = 0;
+		etherType = captured > 0 ? ((data[0] >> 4) == 6 ? 0x86DD : 0x0800) : 0;
+		break;
+
+	default:
+		break;
+	}
+
+	if ((etherType != 0x0800 && etherType != 0x86DD) || captured < header || wireLength < header)
+	{
+		stats->other++;
+		return;
+	}
+
+	LbReplayParseIp(data + header, captured - header, wireLength - header, timestamp, packets, stats);
+}
+
+// Read fields in the byte order of the capture
+struct LB_REPLAY_READER
+{
+	const UINT8* data;
+	SIZE_T size;
+	BOOLEAN swapped;
+
+	UINT16 Read16(SIZE_T offset) const
+	{
+		UINT16 value;
+		memcpy(&value, data + offset, 2);
+		return swapped ? (UINT16)((value >> 8) | (value << 8)) : value;
+	}
+
+	UINT32 Read32(SIZE_T offset) const
+	{
+		UINT32 value;
+		memcpy(&value, data + offset, 4);
+		return swapped ? __builtin_bswap32(value) : value;
+	}
+};
+
+inline NTSTATUS LbReplayParsePcap(const UINT8* data, SIZE_T size, std::vector<LB_REPLAY_PACKET>* packets, LB_REPLAY_READ_STATS* stats)
+{
+	LB_REPLAY_READER reader = { data, size, FALSE };
+	UINT32 magic = reader.Read32(0);
+	UINT64 fraction = 1000;		// Nanoseconds per unit of the second timestamp field
+
+	if (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1)
+	{
+		reader.swapped = TRUE;
+		magic = reader.Read32(0);
+	}
+	if (magic == 0xA1B23C4D)
+		fraction = 1;
+	else if (magic != 0xA1B2C3D4)
+		return STATUS_INVALID_PARAMETER;
+
+	// The link type shares its field with the FCS length in the upper bits
+	UINT32 linkType = reader.Read32(20) & 0x0FFFFFFF;
+
+	for (SIZE_T offset = 24; offset < size; )
+	{
+		if (size - offset < 16)
+			return STATUS_INVALID_PARAMETER;
+
+		UINT64 timestamp = (UINT64)reader.Read32(offset) * 1000000000ull + (UINT64)reader.Read32(offset + 4) * fraction;
+		UINT32 captured = reader.Read32(offset + 8);
+		UINT32 wireLength = reader.Read32(offset + 12);
+
+		offset += 16;
+		if (captured > size - offset)
+			return STATUS_INVALID_PARAMETER;
+
+		LbReplayParseFrame(linkType, data + offset, captured, wireLength, timestamp, packets, stats);
+		offset += captured;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+inline NTSTATUS LbReplayParsePcapng(const UINT8* data, SIZE_T size, std::vector<LB_REPLAY_PACKET>* packets, LB_REPLAY_READ_STATS* stats)
+{
+	LB_REPLAY_READER reader = { data, size, FALSE };
+
+	// Every section has interfaces of its own, each with a link type and a timestamp resolution
+	struct LB_REPLAY_INTERFACE
+	{
+		UINT32 linkType;
+		UINT64 unitsPerSecond;
+	};
+	std::vector<LB_REPLAY_INTERFACE> interfaces;
+
+	for (SIZE_T offset = 0; offset < size; )
+	{
+		if (size - offset < 12)
+			return STATUS_INVALID_PARAMETER;
+
+		// A section header sets the byte order of everything up to the next one
+		UINT32 type = reader.Read32(offset);
+		if (type == 0x0A0D0D0A)
+		{
+			UINT32 byteOrder;
+			memcpy(&byteOrder, data + offset + 8, 4);
+			if (byteOrder != 0x1A2B3C4D && byteOrder != 0x4D3C2B1A)
+				return STATUS_INVALID_PARAMETER;
+
+			reader.swapped = byteOrder == 0x4D3C2B1A;
+			interfaces.clear();
+		}
+
+		UINT32 length = reader.Read32(offset + 4);
+		if (length < 12 || (length & 3) != 0 || length > size - offset)
+			return STATUS_INVALID_PARAMETER;
+
+		const UINT8* body = data + offset + 8;
+		SIZE_T bodyLength = length - 12;
+
+		if (type == 1 && bodyLength >= 8)
+		{
+			// Interface description, if_tsresol (option 9) changes the default of microseconds
+			LB_REPLAY_INTERFACE entry = { reader.Read16(offset + 8), 1000000 };
+			for (SIZE_T option = 8; option + 4 <= bodyLength; )
+			{
+				UINT16 code = reader.Read16(offset + 8 + option);
+				UINT16 optionLength = reader.Read16(offset + 8 + option + 2);
+				if (code == 0 || option + 4 + optionLength > bodyLength)
+					break;
+
+				if (code == 9 && optionLength >= 1)
+				{
+					UINT8 resolution = body[option + 4];
+					UINT32 exponent = resolution & 0x7F;
+					if (exponent < 64)
+					{
+						entry.unitsPerSecond = 1;
+						for (UINT32 i = 0; i < exponent; i++)
+							entry.unitsPerSecond *= (resolution & 0x80) ? 2 : 10;
+					}
+				}
+				option += 4 + ((optionLength + 3) & ~3u);
+			}
+			interfaces.push_back(entry);
+		}
+		else if (type == 6 && bodyLength >= 20)
+		{
+			// Enhanced packet
+			UINT32 interfaceId = reader.Read32(offset + 8);
+			UINT64 units = ((UINT64)reader.Read32(offset + 12) << 32) | reader.Read32(offset + 16);
+			UINT32 captured = reader.Read32(offset + 20);
+			UINT32 wireLength = reader.Read32(offset + 24);
+
+			if (interfaceId >= interfaces.size() || captured > bodyLength - 20)
+				return STATUS_INVALID_PARAMETER;
+
+			UINT64 perSecond = interfaces[interfaceId].unitsPerSecond;
+			UINT64 timestamp = units / perSecond * 1000000000ull + units % perSecond * 1000000000ull / perSecond;
+			LbReplayParseFrame(interfaces[interfaceId].linkType, body + 20, captured, wireLength, timestamp, packets, stats);
+		}
+		else if (type == 3 && bodyLength >= 4)
+		{
+			// Simple packet, always from the first interface and without a timestamp
+			if (interfaces.empty())
+				return STATUS_INVALID_PARAMETER;
+
+			UINT32 wireLength = reader.Read32(offset + 8);
+			UINT32 captured = (UINT32)std::min<SIZE_T>(wireLength, bodyLength - 4);
+			LbReplayParseFrame(interfaces[0].linkType, body + 4, captured, wireLength, 0, packets, stats);
+		}
+
+		offset += length;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+// The TCP and UDP packets of a pcap or pcapng capture held in memory
+inline NTSTATUS LbReplayParseCapture(const UINT8* data, SIZE_T size, std::vector<LB_REPLAY_PACKET>* packets, LB_REPLAY_READ_STATS* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (size >= 12 && data[0] == 0x0A && data[1] == 0x0D && data[2] == 0x0D && data[3] == 0x0A)
+		return LbReplayParsePcapng(data, size, packets, stats);
+	if (size >= 24)
+		return LbReplayParsePcap(data, size, packets, stats);
+
+	return STATUS_INVALID_PARAMETER;
+}
+
+inline NTSTATUS LbReplayReadCapture(const char* path, std::vector<LB_REPLAY_PACKET>* packets, LB_REPLAY_READ_STATS* stats)
+{
+	std::vector<UINT8> data;
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return STATUS_UNSUCCESSFUL;
+
+	UINT8 chunk[65536];
+	SIZE_T read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) != 0)
+		data.insert(data.end(), chunk, chunk + read);
+	fclose(file);
+
+	return LbReplayParseCapture(data.data(), data.size(), packets, stats);
+}
+
+/////////////////////
+// CAPTURE WRITERS //
+/////////////////////
+
+// Running sum of the IPv6 pseudo header of a TCP or UDP segment
+inline UINT32 LbReplayPseudoHeaderSumV6(const UINT8* source, const UINT8* destination, UINT8 protocol, SIZE_T length)
+{
+	UINT8 tail[8] = { (UINT8)(length >> 24), (UINT8)(length >> 16), (UINT8)(length >> 8), (UINT8)length, 0, 0, 0, protocol };
+	UINT32 sum = LbChecksumAdd(0, source, 16);
+	sum = LbChecksumAdd(sum, destination, 16);
+	return LbChecksumAdd(sum, tail, sizeof(tail));
+}
+
+// Checksum a packet's segment should carry, the field inside it is taken as zero
+inline UINT16 LbReplayTransportChecksum(const LB_REPLAY_PACKET& packet, const UINT8* segment, SIZE_T length)
+{
+	SIZE_T field = packet.protocol == LB_IPPROTO_TCP ? 16 : 6;
+	UINT32 sum = packet.family == LB_FAMILY_IPV4 ?
+		LbPseudoHeaderSumV4(LbReadBe32(packet.source), LbReadBe32(packet.destination), packet.protocol, length) :
+		LbReplayPseudoHeaderSumV6(packet.source, packet.destination, packet.protocol, length);
+
+	sum = LbChecksumAdd(sum, segment, field);
+	sum = LbChecksumAddAt(sum, field + 2, segment + field + 2, length - field - 2);
+
+	UINT16 checksum = LbChecksumFinish(sum);
+	return checksum == 0 && packet.protocol == LB_IPPROTO_UDP ? 0xFFFF : checksum;
+}
+
+// A packet with ports, addresses and the given payload, its checksum filled in. sequence only matters for TCP.
+inline LB_REPLAY_PACKET LbReplayMakePacket(UINT8 family, UINT8 protocol, const UINT8* source, const UINT8* destination,
+	UINT16 sourcePort, UINT16 destinationPort, UINT32 sequence, const std::string& payload)
+{
+	LB_REPLAY_PACKET packet = {};
+	packet.family = family;
+	packet.protocol = protocol;
+	memcpy(packet.source, source, family == LB_FAMILY_IPV4 ? 4 : 16);
+	memcpy(packet.destination, destination, family == LB_FAMILY_IPV4 ? 4 : 16);
+	packet.sourcePort = sourcePort;
+	packet.destinationPort = destinationPort;
+	packet.headerLength = protocol == LB_IPPROTO_TCP ? 20 : 8;
+
+	std::vector<UINT8>& segment = packet.segment;
+	segment.assign(packet.headerLength, 0);
+	segment.insert(segment.end(), payload.begin(), payload.end());
+	LbWriteBe16(&segment[0], sourcePort);
+	LbWriteBe16(&segment[2], destinationPort);
+
+	if (protocol == LB_IPPROTO_TCP)
+	{
+		LbWriteBe32(&segment[4], sequence);
+		segment[12] = 0x50;
+		segment[13] = 0x18;		// PSH, ACK
+		LbWriteBe16(&segment[14], 0xFFFF);
+	}
+	else
+		LbWriteBe16(&segment[4], (UINT16)segment.size());
+
+	LbWriteBe16(&segment[protocol == LB_IPPROTO_TCP ? 16 : 6], LbReplayTransportChecksum(packet, segment.data(), segment.size()));
+	return packet;
+}
+
+// The packet as an Ethernet frame (or a bare IP packet for LB_REPLAY_LINKTYPE_RAW), with a valid IPv4 header checksum
+inline std::vector<UINT8> LbReplayFrame(const LB_REPLAY_PACKET& packet, UINT32 linkType)
+{
+	std::vector<UINT8> frame;
+	SIZE_T length = packet.segment.size();
+
+	if (linkType == LB_REPLAY_LINKTYPE_ETHERNET)
+	{
+		frame.assign(14, 0);
+		frame[0] = 0x02;
+		frame[6] = 0x02;
+		frame[11] = 0x01;
+		LbWriteBe16(&frame[12], packet.family == LB_FAMILY_IPV4 ? 0x0800 : 0x86DD);
+	}
+
+	SIZE_T ip = frame.size();
+	if (packet.family == LB_FAMILY_IPV4)
+	{
+		frame.resize(ip + 20);
+		frame[ip] = 0x45;
+		LbWriteBe16(&frame[ip + 2], (UINT16)(20 + length));
+		LbWriteBe16(&frame[ip + 6], 0x4000);	// Don't fragment
+		frame[ip + 8] = 64;
+		frame[ip + 9] = packet.protocol;
+		memcpy(&frame[ip + 12], packet.source, 4);
+		memcpy(&frame[ip + 16], packet.destination, 4);
+		LbWriteBe16(&frame[ip + 10], LbChecksumFinish(LbChecksumAdd(0, &frame[ip], 20)));
+	}
+	else
+	{
+		frame.resize(ip + 40);
+		frame[ip] = 0x60;
+		LbWriteBe16(&frame[ip + 4], (UINT16)length);
+		frame[ip + 6] = packet.protocol;
+		frame[ip + 7] = 64;
+		memcpy(&frame[ip + 8], packet.source, 16);
+		memcpy(&frame[ip + 24], packet.destination, 16);
+	}
+
+	frame.insert(frame.end(), packet.segment.begin(), packet.segment.end());
+	return frame;
+}
+
+inline void LbReplayAppend32(std::vector<UINT8>& out, UINT32 value)
+{
+	out.insert(out.end(), (const UINT8*)&value, (const UINT8*)&value + 4);
+}
+
+// A classic pcap file of the packets, timestamps in microseconds
+inline std::vector<UINT8> LbReplayWritePcap(const std::vector<LB_REPLAY_PACKET>& packets, UINT32 linkType)
+{
+	std::vector<UINT8> out;
+	LbReplayAppend32(out, 0xA1B2C3D4);
+	LbReplayAppend32(out, 0x00040002);		// Version 2.4
+	LbReplayAppend32(out, 0);
+	LbReplayAppend32(out, 0);
+	LbReplayAppend32(out, 0xFFFF);
+	LbReplayAppend32(out, linkType);
+
+	for (const LB_REPLAY_PACKET& packet : packets)
+	{
+		std::vector<UINT8> frame = LbReplayFrame(packet, linkType);
+		LbReplayAppend32(out, (UINT32)(packet.timestamp / 1000000000ull));
+		LbReplayAppend32(out, (UINT32)(packet.timestamp % 1000000000ull / 1000));
+		LbReplayAppend32(out, (UINT32)frame.size());
+		LbReplayAppend32(out, (UINT32)frame.size());
+		out.insert(out.end(), frame.begin(), frame.end());
+	}
+
+	return out;
+}
+
+// A pcapng file of the packets, one interface with nanosecond timestamps
+inline std::vector<UINT8> LbReplayWritePcapng(const std::vector<LB_REPLAY_PACKET>& packets, UINT32 linkType)
+{
+	std::vector<UINT8> out;
+
+	// Section header, no options, section length unknown
+	LbReplayAppend32(out, 0x0A0D0D0A);
+	LbReplayAppend32(out, 28);
+	LbReplayAppend32(out, 0x1A2B3C4D);
+	LbReplayAppend32(out, 0x00000001);		// Version 1.0
+	LbReplayAppend32(out, 0xFFFFFFFF);
+	LbReplayAppend32(out, 0xFFFFFFFF);
+	LbReplayAppend32(out, 28);
+
+	// Interface description with if_tsresol 9
+	LbReplayAppend32(out, 1);
+	LbReplayAppend32(out, 32);
+	LbReplayAppend32(out, linkType);
+	LbReplayAppend32(out, 0);
+	LbReplayAppend32(out, 0x00010009);
+	LbReplayAppend32(out, 9);
+	LbReplayAppend32(out, 0);
+	LbReplayAppend32(out, 32);
+
+	for (const LB_REPLAY_PACKET& packet : packets)
+	{
+		std::vector<UINT8> frame = LbReplayFrame(packet, linkType);
+		UINT32 padded = (UINT32)((frame.size() + 3) & ~(SIZE_T)3);
+
+		LbReplayAppend32(out, 6);
+		LbReplayAppend32(out, 32 + padded);
+		LbReplayAppend32(out, 0);
+		LbReplayAppend32(out, (UINT32)(packet.timestamp >> 32));
+		LbReplayAppend32(out, (UINT32)packet.timestamp);
+		LbReplayAppend32(out, (UINT32)frame.size());
+		LbReplayAppend32(out, (UINT32)frame.size());
+		out.insert(out.end(), frame.begin(), frame.end());
+		out.resize(out.size() + padded - frame.size(), 0);
+		LbReplayAppend32(out, 32 + padded);
+	}
+
+	return out;
+}
+
+////////////
+// CORPUS //
+////////////
+
+// One classify call: the incoming values and the chain a layer would hand over
+struct LB_REPLAY_CALL
+{
+	LB_REPLAY_INCOMING_VALUES values;
+	LB_REPLAY_NET_BUFFER_LIST* netBufferList;
+	LB_REPLAY_FLOW* flow;		// The flow context, NULL for inbound layers which do not keep one
+	UINT32 packets;
+	UINT32 bytes;				// Data bytes of every NET_BUFFER, as the layer hands them over
+};
+
+// How a corpus lays packets out
+struct LB_REPLAY_LAYOUT
+{
+	UINT32 maxNetBuffers = 4;	// Consecutive packets of one flow and direction batched into one NET_BUFFER_LIST
+	UINT32 maxMdls = 4;			// A NET_BUFFER's bytes spread over up to this many MDLs
+	UINT32 splitPercent = 40;	// How many NET_BUFFERs are split at all, the rest sit in one MDL
+	UINT32 seed = 1;
+};
+
+// Packets laid out as classify calls. Every buffer, chain and flow lives in here, so one corpus is one set
+// of calls that can be replayed again after LbReplayReset puts back the bytes a replay rewrote.
+struct LB_REPLAY_CORPUS
+{
+	std::vector<UINT8> arena;
+	std::vector<UINT8> pristine;
+	std::deque<LB_REPLAY_MDL> mdls;
+	std::deque<LB_REPLAY_NET_BUFFER> netBuffers;
+	std::deque<LB_REPLAY_NET_BUFFER_LIST> netBufferLists;
+	std::deque<LB_REPLAY_BYTE_ARRAY16> addresses;
+	std::deque<LB_REPLAY_FLOW> flows;
+	std::vector<LB_REPLAY_CALL> calls;
+	UINT64 packets;
+	UINT64 bytes;
+};
+
+// Bytes kept in front of a NET_BUFFER's data in its first MDL, where the stack has the IP header
+#define LB_REPLAY_HEADROOM 40
+
+inline void LbReplayReset(LB_REPLAY_CORPUS* corpus)
+{
+	memcpy(corpus->arena.data(), corpus->pristine.data(), corpus->arena.size());
+
+	for (LB_REPLAY_FLOW& flow : corpus->flows)
+	{
+		LbSeqTrackerInitialize(&flow.seq);
+		flow.matchState = LB_MATCHER_ROOT_STATE;
+		flow.matchGeneration = 0;
+		LbDissectorBegin(&flow.dissector, LbDissectorForFlow(&flow.key));
+	}
+}
+
+// Flow key of a captured packet, as the layer it would be classified at sees it
+inline LB_FLOW_KEY LbReplayKey(const LB_REPLAY_PACKET& packet)
+{
+	BOOLEAN outbound = packet.sourcePort > packet.destinationPort;
+	const UINT8* local = outbound ? packet.source : packet.destination;
+	const UINT8* remote = outbound ? packet.destination : packet.source;
+
+	LB_FLOW_KEY key = {};
+	key.localAddress = packet.family == LB_FAMILY_IPV4 ? LbReadBe32(local) : LbFlowAddressFold(local);
+	key.remoteAddress = packet.family == LB_FAMILY_IPV4 ? LbReadBe32(remote) : LbFlowAddressFold(remote);
+	key.localPort = outbound ? packet.sourcePort : packet.destinationPort;
+	key.remotePort = outbound ? packet.destinationPort : packet.sourcePort;
+	key.protocol = packet.protocol;
+	key.direction = (UINT8)(outbound ? LB_DIRECTION_OUTBOUND : LB_DIRECTION_INBOUND);
+	key.family = packet.family;
+	return key;
+}
+
+// Only the fields, copies of a key need not carry the padding after them
+inline bool operator<(const LB_FLOW_KEY& a, const LB_FLOW_KEY& b)
+{
+	return memcmp(&a, &b, offsetof(LB_FLOW_KEY, family) + sizeof(a.family)) < 0;
+}
+
+inline void LbReplayBuild(const std::vector<LB_REPLAY_PACKET>& packets, const LB_REPLAY_LAYOUT& layout, LB_REPLAY_CORPUS* corpus)
+{
+	std::mt19937 rng(layout.seed);
+	std::map<LB_FLOW_KEY, LB_REPLAY_FLOW*> flows;
+	SIZE_T arenaSize = 0;
+
+	// Outbound layers hand over the transport header and payload, inbound ones the payload alone
+	for (const LB_REPLAY_PACKET& packet : packets)
+		arenaSize += LB_REPLAY_HEADROOM + packet.segment.size();
+
+	corpus->arena.assign(arenaSize, 0);
+	corpus->packets = packets.size();
+	corpus->bytes = 0;
+
+	SIZE_T used = 0;
+	LB_REPLAY_CALL* call = NULL;
+	LB_FLOW_KEY callKey = {};
+	LB_REPLAY_NET_BUFFER* lastNetBuffer = NULL;
+
+	for (const LB_REPLAY_PACKET& packet : packets)
+	{
+		LB_FLOW_KEY key = LbReplayKey(packet);
+		BOOLEAN outbound = key.direction == LB_DIRECTION_OUTBOUND;
+		SIZE_T skip = outbound ? 0 : packet.headerLength;
+		ULONG dataLength = (ULONG)(packet.segment.size() - skip);
+
+		// The IP header stands in front of the data, the layer's offset points past it
+		UINT8* base = corpus->arena.data() + used;
+		memset(base, 0x45, LB_REPLAY_HEADROOM);
+		memcpy(base + LB_REPLAY_HEADROOM, packet.segment.data() + skip, dataLength);
+		used += LB_REPLAY_HEADROOM + dataLength;
+
+		// Up to maxMdls buffers, cut anywhere, the first one holding the headroom as well
+		std::vector<ULONG> cuts = { 0 };
+		if (layout.maxMdls > 1 && rng() % 100 < layout.splitPercent && dataLength > 1)
+		{
+			UINT32 count = 1 + rng() % (layout.maxMdls - 1);
+			for (UINT32 i = 0; i < count; i++)
+				cuts.push_back(1 + rng() % (dataLength - 1));
+			std::sort(cuts.begin(), cuts.end());
+			cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+		}
+		cuts.push_back(dataLength);
+
+		LB_REPLAY_MDL* first = NULL;
+		LB_REPLAY_MDL* previous = NULL;
+		for (size_t i = 0; i + 1 < cuts.size(); i++)
+		{
+			ULONG start = i == 0 ? 0 : LB_REPLAY_HEADROOM + cuts[i];
+			ULONG end = LB_REPLAY_HEADROOM + cuts[i + 1];
+			corpus->mdls.push_back({ NULL, base + start, end - start });
+			LB_REPLAY_MDL* mdl = &corpus->mdls.back();
+			if (previous) previous->Next = mdl; else first = mdl;
+			previous = mdl;
+		}
+
+		corpus->netBuffers.push_back({ NULL, first, LB_REPLAY_HEADROOM, dataLength });
+		LB_REPLAY_NET_BUFFER* netBuffer = &corpus->netBuffers.back();
+		corpus->bytes += dataLength;
+
+		// Batched behind the previous packet when it belongs to the same flow and direction
+		if (call && memcmp(&callKey, &key, sizeof(key)) == 0 && call->packets < layout.maxNetBuffers)
+		{
+			lastNetBuffer->Next = netBuffer;
+			lastNetBuffer = netBuffer;
+			call->packets++;
+			call->bytes += dataLength;
+			continue;
+		}
+
+		corpus->netBufferLists.push_back({ NULL, netBuffer });
+		corpus->calls.push_back({});
+		call = &corpus->calls.back();
+		callKey = key;
+		lastNetBuffer = netBuffer;
+
+		call->netBufferList = &corpus->netBufferLists.back();
+		call->packets = 1;
+		call->bytes = dataLength;
+		call->values.layerId = (UINT16)(outbound ?
+			(packet.family == LB_FAMILY_IPV4 ? LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V4 : LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V6) :
+			(packet.family == LB_FAMILY_IPV4 ? LB_REPLAY_LAYER_INBOUND_TRANSPORT_V4 : LB_REPLAY_LAYER_INBOUND_TRANSPORT_V6));
+		call->values.valueCount = LB_REPLAY_FIELD_COUNT;
+
+		LB_REPLAY_VALUE* fields[2] = { &call->values.incomingValue[LB_REPLAY_FIELD_IP_LOCAL_ADDRESS].value, &call->values.incomingValue[LB_REPLAY_FIELD_IP_REMOTE_ADDRESS].value };
+		const UINT8* sides[2] = { outbound ? packet.source : packet.destination, outbound ? packet.destination : packet.source };
+		for (int side = 0; side < 2; side++)
+		{
+			if (packet.family == LB_FAMILY_IPV4)
+				fields[side]->uint32 = LbReadBe32(sides[side]);
+			else
+			{
+				corpus->addresses.push_back({});
+				memcpy(corpus->addresses.back().byteArray16, sides[side], 16);
+				fields[side]->byteArray16 = &corpus->addresses.back();
+			}
+		}
+		call->values.incomingValue[LB_REPLAY_FIELD_IP_LOCAL_PORT].value.uint16 = key.localPort;
+		call->values.incomingValue[LB_REPLAY_FIELD_IP_REMOTE_PORT].value.uint16 = key.remotePort;
+		call->values.incomingValue[LB_REPLAY_FIELD_IP_PROTOCOL].value.uint8 = key.protocol;
+
+		// The outgoing stream of a flow keeps its match state in a context, as LbFlowContextGet gives it
+		if (outbound)
+		{
+			LB_REPLAY_FLOW*& flow = flows[key];
+			if (!flow)
+			{
+				corpus->flows.push_back({});
+				flow = &corpus->flows.back();
+				LbReplayFlowInitialize(flow, &key);
+			}
+			call->flow = flow;
+		}
+	}
+
+	corpus->pristine = corpus->arena;
+}
+
+//////////////
+// CLASSIFY //
+//////////////
+
+// LB_REPLAY_MAX_SEGMENT, PacketInjector.h is kernel only
+#define LB_REPLAY_MAX_SEGMENT (0xFFFF - 60)
+
+// What one replay thread did, and the buffers it rewrites into
+struct LB_REPLAY_OUTPUT
+{
+	UINT64 calls;
+	UINT64 verdicts[LB_VERDICT_INSPECT + 1];
+	UINT64 bytesScanned;
+	UINT64 replacements;
+	UINT64 injected;			// Rewritten copies built to be sent instead of the original
+	UINT64 injectedBytes;
+	UINT64 checksumsRecomputed;
+	UINT64 streamWaits;			// Stream layer calls answered with FWPS_STREAM_ACTION_NEED_MORE_DATA
+	std::vector<UINT8> scratch;	// LbInjectorAllocatePacket
+	std::vector<UINT8> packet;
+
+	LB_REPLAY_OUTPUT() : calls(0), verdicts(), bytesScanned(0), replacements(0), injected(0), injectedBytes(0),
+		checksumsRecomputed(0), streamWaits(0), scratch(LB_REPLAY_MAX_SEGMENT), packet(LB_REPLAY_MAX_SEGMENT)
+	{
+	}
+};
+
+// LbChecksumField: the two bytes of a checksum field, wherever the MDLs split them
+inline BOOLEAN LbReplayChecksumField(LB_REPLAY_NET_BUFFER* netBuffer, ULONG offset, UINT8* field[2])
+{
+	LB_SPAN_ITERATOR<LB_REPLAY_MDL> it;
+	LB_SPAN span;
+	UINT32 found = 0;
+
+	LbSpanBegin(&it, netBuffer->CurrentMdl, (SIZE_T)netBuffer->CurrentMdlOffset + offset, 2);
+	while (LbSpanNext(&it, &span))
+	{
+		for (SIZE_T i = 0; i < span.length; i++)
+			field[found++] = &span.data[i];
+	}
+
+	return found == 2;
+}
+
+// LbChecksumRecompute, only ever reached for IPv4
+inline BOOLEAN LbReplayChecksumRecompute(LB_REPLAY_NET_BUFFER* netBuffer, const LB_FLOW_KEY* key, UINT16* checksum)
+{
+	LB_SPAN_ITERATOR<LB_REPLAY_MDL> it;
+	LB_SPAN span;
+	SIZE_T offset = 0;
+	UINT32 sum = LbPseudoHeaderSumV4(key->localAddress, key->remoteAddress, key->protocol, netBuffer->DataLength);
+
+	LbSpanBegin(&it, netBuffer->CurrentMdl, netBuffer->CurrentMdlOffset, netBuffer->DataLength);
+	while (LbSpanNext(&it, &span))
+	{
+		sum = LbChecksumAddAt(sum, offset, span.data, span.length);
+		offset += span.length;
+	}
+
+	if (it.remaining != 0)
+		return FALSE;
+
+	*checksum = LbChecksumFinish(sum + (UINT16)~*checksum);
+	if (*checksum == 0 && key->protocol == LB_IPPROTO_UDP)
+		*checksum = 0xFFFF;
+
+	return TRUE;
+}
+
+// LbChecksumCallback, the harness never leaves a checksum to the adapter
+inline void LbReplayChecksum(LB_REPLAY_NET_BUFFER* netBuffer, LB_SCAN_CONTEXT* scan, LB_REPLAY_OUTPUT* output)
+{
+	ULONG offset = scan->key->protocol == LB_IPPROTO_TCP ? 16 : 6;
+	UINT8* field[2];
+
+	if (scan->edits.count == 0 || !LbReplayChecksumField(netBuffer, offset, field))
+		return;
+
+	UINT16 checksum = (UINT16)((*field[0] << 8) | *field[1]);
+	LB_SCAN_CHECKSUM result = LbScanChecksum(scan, &checksum);
+	if (result == LB_SCAN_CHECKSUM_UNCHANGED)
+		return;
+	if (result == LB_SCAN_CHECKSUM_RECOMPUTE)
+	{
+		if (!LbReplayChecksumRecompute(netBuffer, scan->key, &checksum))
+			return;
+		output->checksumsRecomputed++;
+	}
+
+	*field[0] = (UINT8)(checksum >> 8);
+	*field[1] = (UINT8)checksum;
+}
+
+// ParsePacket with LbSegmentCallback, LbReplaceCallback and LbChecksumCallback
+inline void LbReplayParsePacket(LB_REPLAY_NET_BUFFER_LIST* netBufferList, UINT8 protocol, BOOLEAN headerInData, LB_SCAN_CONTEXT* scan, LB_REPLAY_OUTPUT* output)
+{
+	for (LB_REPLAY_NET_BUFFER_LIST* currentNBL = netBufferList; currentNBL != NULL; currentNBL = currentNBL->Next)
+	{
+		for (LB_REPLAY_NET_BUFFER* currentNB = currentNBL->FirstNetBuffer; currentNB != NULL; currentNB = currentNB->Next)
+		{
+			LB_SPAN_ITERATOR<LB_REPLAY_MDL> it;
+			LB_SPAN span;
+			ULONG headerLength = 0;
+			UINT32 sequence = 0;
+
+			// LbTransportHeader
+			if (headerInData)
+			{
+				UINT8 storage[13];
+				UINT8* header = NULL;
+
+				if (protocol == LB_IPPROTO_UDP)
+					headerLength = 8;
+				else if (protocol == LB_IPPROTO_TCP && (header = LbReplayGetDataBuffer(currentNB, sizeof(storage), storage)) != NULL)
+				{
+					headerLength = (header[12] >> 4) * 4;
+					sequence = LbReadBe32(&header[4]);
+				}
+
+				if (headerLength < 8 || headerLength > currentNB->DataLength)
+					continue;
+			}
+
+			LbScanSegment(scan, sequence, currentNB->DataLength - headerLength);
+
+			LbSpanBegin(&it, currentNB->CurrentMdl, (SIZE_T)currentNB->CurrentMdlOffset + headerLength, currentNB->DataLength - headerLength);
+			while (LbSpanNext(&it, &span))
+				LbScanBuffer(scan, span.data, span.length);
+
+			if (headerInData)
+				LbReplayChecksum(currentNB, scan, output);
+		}
+	}
+}
+
+// LbRewriteSegment: a rewritten copy of a lone segment, gathered from its MDLs first if they split it
+inline BOOLEAN LbReplayRewriteSegment(LB_REPLAY_NET_BUFFER_LIST* netBufferList, const LB_FLOW_KEY* key, LB_SEQ_TRACKER* seq, LB_SCAN_CONTEXT* scan, LB_REPLAY_OUTPUT* output)
+{
+	LB_REPLAY_NET_BUFFER* netBuffer = netBufferList->FirstNetBuffer;
+	ULONG length = netBuffer->DataLength;
+	ULONG written = 0;
+
+	if (netBufferList->Next != NULL || netBuffer->Next != NULL || length > LB_REPLAY_MAX_SEGMENT)
+		return FALSE;
+
+	UINT8* segment = LbReplayGetDataBuffer(netBuffer, length, output->scratch.data());
+	if (!segment)
+		return FALSE;
+
+	if (!LbRewriteTransport(key, seq, scan, segment, length, output->packet.data(), LB_REPLAY_MAX_SEGMENT, &written))
+		return FALSE;
+
+	output->injected++;
+	output->injectedBytes += written;
+	return TRUE;
+}
+
+// LbClassifyLayer without the stack: returns the verdict, and counts in output what was done about it
+template <class Layer>
+inline LB_VERDICT LbReplayClassifyLayer(const LB_RULESET* rules, const LB_REPLAY_CALL* call, LB_REPLAY_OUTPUT* output)
+{
+	const LB_REPLAY_INCOMING_VALUES* inFixedValues = &call->values;
+	LB_STATS_PROCESSOR* stats = LbStatsCurrent();
+	LB_VERDICT verdict = LB_VERDICT_NONE;
+
+	LB_FLOW_KEY key;
+	key.localAddress = Layer::family == LB_FAMILY_IPV4 ?
+		inFixedValues->incomingValue[Layer::localAddress].value.uint32 :
+		LbFlowAddressFold(inFixedValues->incomingValue[Layer::localAddress].value.byteArray16->byteArray16);
+	key.remoteAddress = Layer::family == LB_FAMILY_IPV4 ?
+		inFixedValues->incomingValue[Layer::remoteAddress].value.uint32 :
+		LbFlowAddressFold(inFixedValues->incomingValue[Layer::remoteAddress].value.byteArray16->byteArray16);
+	key.localPort = inFixedValues->incomingValue[Layer::localPort].value.uint16;
+	key.remotePort = inFixedValues->incomingValue[Layer::remotePort].value.uint16;
+	key.protocol = inFixedValues->incomingValue[Layer::protocol].value.uint8;
+	LbClassifyKeyLayer<Layer>(&key);
+
+	output->calls++;
+	verdict = LbClassifyLookup<Layer>(rules, &key, stats);
+	output->verdicts[verdict]++;
+
+	if (verdict != LB_VERDICT_INSPECT || call->netBufferList == NULL)
+		return verdict;
+
+	LB_REPLAY_FLOW* flow = Layer::flowState ? call->flow : NULL;
+	LB_SCAN_CONTEXT scan = { rules->matcher, rules->replace, LB_MATCHER_ROOT_STATE, 0, 0, FALSE, 0 };
+
+	if (flow)
+		LbReplayFlowAcquire(flow);
+
+	// LbInspectPayload
+	if (flow && flow->matchGeneration == rules->generation)
+		scan.state = flow->matchState;
+
+	scan.fields = rules->fields;
+	scan.key = &key;
+	scan.stream = flow ? &flow->dissector : NULL;
+
+	BOOLEAN shifted = flow && LbSeqTrackerIsActive(&flow->seq);
+	BOOLEAN canCopy = Layer::resizes && (key.protocol == LB_IPPROTO_UDP || (key.protocol == LB_IPPROTO_TCP && flow));
+
+	if ((rules->matcher->equalLength && !shifted) || !canCopy)
+		LbReplayParsePacket(call->netBufferList, key.protocol, Layer::headerInData, &scan, output);
+	else
+		LbReplayRewriteSegment(call->netBufferList, &key, flow ? &flow->seq : NULL, &scan, output);
+
+	if (flow)
+	{
+		flow->matchState = scan.state;
+		flow->matchGeneration = rules->generation;
+		LbReplayFlowRelease(flow);
+	}
+
+	output->bytesScanned += scan.bytes;
+	output->replacements += scan.replacements;
+	LbStatsCount(stats, LB_COUNTER_BYTES_SCANNED, scan.bytes);
+	LbStatsCount(stats, LB_COUNTER_BYTES_SKIPPED, scan.skipped);
+	LbStatsCount(stats, LB_COUNTER_REPLACEMENTS, scan.replacements);
+
+	return verdict;
+}
+
+// The classify function of the call's layer
+inline LB_VERDICT LbReplayClassify(const LB_RULESET* rules, const LB_REPLAY_CALL* call, LB_REPLAY_OUTPUT* output)
+{
+	switch (call->values.layerId)
+	{
+	case LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V4:
+		return LbReplayClassifyLayer<LB_REPLAY_LAYER<LB_LAYER_OUTBOUND_V4, LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V4>>(rules, call, output);
+	case LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V6:
+		return LbReplayClassifyLayer<LB_REPLAY_LAYER<LB_LAYER_OUTBOUND_V6, LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V6>>(rules, call, output);
+	case LB_REPLAY_LAYER_INBOUND_TRANSPORT_V4:
+		return LbReplayClassifyLayer<LB_REPLAY_LAYER<LB_LAYER_INBOUND_V4, LB_REPLAY_LAYER_INBOUND_TRANSPORT_V4>>(rules, call, output);
+	default:
+		return LbReplayClassifyLayer<LB_REPLAY_LAYER<LB_LAYER_INBOUND_V6, LB_REPLAY_LAYER_INBOUND_TRANSPORT_V6>>(rules, call, output);
+	}
+}
+
+//////////////////
+// STREAM LAYER //
+//////////////////
+
+// The outgoing data of one TCP flow at the stream layer. The stack indicates what a call did not enforce
+// again at once, together with whatever was written behind it. After FWPS_STREAM_ACTION_NEED_MORE_DATA it
+// holds writes back until countBytesRequired bytes are pending, or until one of them has to go out now.
+struct LB_REPLAY_STREAM
+{
+	LB_REPLAY_FLOW flow;
+	UINT32 nextSequence;		// Of the next byte in order, packets that do not start there are left out
+	BOOLEAN sequenced;
+	std::vector<UINT8> pending;	// Indicated and not enforced yet
+	SIZE_T required;			// countBytesRequired of the last NEED_MORE_DATA, 0 indicates every write
+	UINT32 flags;				// LB_STREAM_* of the latest write
+	std::vector<UINT8> sent;	// What left: the enforced bytes, or the rewritten copy injected instead of them
+	UINT64 writes;
+	UINT64 calls;
+};
+
+inline void LbReplayStreamInitialize(LB_REPLAY_STREAM* stream, const LB_FLOW_KEY* key)
+{
+	LbReplayFlowInitialize(&stream->flow, key);
+	stream->nextSequence = 0;
+	stream->sequenced = FALSE;
+	stream->pending.clear();
+	stream->required = 0;
+	stream->flags = 0;
+	stream->sent.clear();
+	stream->writes = 0;
+	stream->calls = 0;
+}
+
+// LbClassifyStreamLayer over the pending data of an inspected flow. Returns FALSE when it enforced nothing.
+inline BOOLEAN LbReplayClassifyStream(const LB_RULESET* rules, LB_REPLAY_STREAM* stream, LB_REPLAY_OUTPUT* output)
+{
+	LB_STATS_PROCESSOR* stats = LbStatsCurrent();
+	LB_REPLAY_FLOW* flow = &stream->flow;
+	LB_STREAM_POLICY policy = { rules->streamChunk, rules->streamLookahead };
+	LB_SCAN_CONTEXT scan = { rules->matcher, rules->replace, LB_MATCHER_ROOT_STATE, 0, 0, FALSE, 0 };
+	SIZE_T dataLength = stream->pending.size();
+	SIZE_T length = dataLength;
+	UINT32 flags = stream->flags;
+	SIZE_T consumed = 0;
+	SIZE_T written = 0;
+
+	output->calls++;
+	stream->calls++;
+	LbStatsCount(stats, LB_COUNTER_STREAM_CALLS);
+
+	// Whatever is not inspected passes as it is
+	LB_VERDICT verdict = flow->key.family == LB_FAMILY_IPV4 ?
+		LbClassifyLookup<LB_LAYER_OUTBOUND_V4>(rules, &flow->key, stats) :
+		LbClassifyLookup<LB_LAYER_OUTBOUND_V6>(rules, &flow->key, stats);
+	output->verdicts[verdict]++;
+	if (verdict != LB_VERDICT_INSPECT)
+	{
+		stream->sent.insert(stream->sent.end(), stream->pending.begin(), stream->pending.end());
+		stream->pending.clear();
+		return FALSE;
+	}
+
+	// Too little to be worth a scan
+	UINT32 wait = LbStreamWait(&policy, length, flags);
+	if (wait > 0)
+	{
+		stream->required = wait;
+		output->streamWaits++;
+		LbStatsCount(stats, LB_COUNTER_STREAM_WAITS);
+		return FALSE;
+	}
+
+	if (length > LB_REPLAY_MAX_SEGMENT)
+	{
+		length = LB_REPLAY_MAX_SEGMENT;
+		flags = 0;
+	}
+
+	// FwpsCopyStreamDataToBuffer
+	memcpy(output->scratch.data(), stream->pending.data(), length);
+
+	if (flow->matchGeneration == rules->generation)
+		scan.state = flow->matchState;
+	scan.fields = rules->fields;
+	scan.key = &flow->key;
+	scan.stream = &flow->dissector;
+
+	LbRewriteStream(&policy, &scan, output->scratch.data(), length, flags, output->packet.data(), LB_REPLAY_MAX_SEGMENT, &consumed, &written);
+
+	flow->matchState = scan.state;
+	flow->matchGeneration = rules->generation;
+	output->bytesScanned += scan.bytes;
+	output->replacements += scan.replacements;
+	LbStatsCount(stats, LB_COUNTER_BYTES_SCANNED, scan.bytes);
+	LbStatsCount(stats, LB_COUNTER_BYTES_SKIPPED, scan.skipped);
+	LbStatsCount(stats, LB_COUNTER_REPLACEMENTS, scan.replacements);
+
+	// Everything may be the start of a match: wait for one more byte, or let it all go at the end
+	if (consumed == 0)
+	{
+		if (flags & LB_STREAM_END)
+		{
+			stream->sent.insert(stream->sent.end(), stream->pending.begin(), stream->pending.end());
+			stream->pending.clear();
+			return FALSE;
+		}
+
+		stream->required = dataLength + 1;
+		output->streamWaits++;
+		LbStatsCount(stats, LB_COUNTER_STREAM_WAITS);
+		LbStatsCount(stats, LB_COUNTER_STREAM_HELD, dataLength);
+		return FALSE;
+	}
+
+	if (consumed < dataLength)
+		LbStatsCount(stats, LB_COUNTER_STREAM_HELD, dataLength - consumed);
+
+	// The rewritten copy is injected in place of the consumed bytes, which are blocked
+	if (scan.replacements > 0)
+	{
+		stream->sent.insert(stream->sent.end(), output->packet.begin(), output->packet.begin() + written);
+		output->injected++;
+		output->injectedBytes += written;
+	}
+	else
+		stream->sent.insert(stream->sent.end(), stream->pending.begin(), stream->pending.begin() + consumed);
+
+	stream->pending.erase(stream->pending.begin(), stream->pending.begin() + consumed);
+	return TRUE;
+}
+
+// One write of length bytes with LB_STREAM_* flags, and the classify calls the stack makes for it
+inline void LbReplayStreamWrite(const LB_RULESET* rules, LB_REPLAY_STREAM* stream, const UINT8* data, SIZE_T length, UINT32 flags, LB_REPLAY_OUTPUT* output)
+{
+	stream->pending.insert(stream->pending.end(), data, data + length);
+	stream->flags = flags;
+	stream->writes++;
+
+	if (stream->pending.size() < stream->required && !(flags & (LB_STREAM_FLUSH | LB_STREAM_END)))
+		return;
+
+	stream->required = 0;
+	while (!stream->pending.empty() && LbReplayClassifyStream(rules, stream, output))
+		;
+}
+
+// The payload of a captured outbound TCP packet as the next write of its flow's stream, a FIN or RST ends it.
+// The stack only indicates data in order, so a packet that does not start at the next byte is left out.
+inline void LbReplayStreamPacket(const LB_RULESET* rules, std::map<LB_FLOW_KEY, LB_REPLAY_STREAM>* streams, const LB_REPLAY_PACKET& packet, LB_REPLAY_OUTPUT* output)
+{
+	LB_FLOW_KEY key = LbReplayKey(packet);
+	if (packet.protocol != LB_IPPROTO_TCP || key.direction != LB_DIRECTION_OUTBOUND)
+		return;
+
+	auto found = streams->find(key);
+	if (found == streams->end())
+	{
+		found = streams->insert(std::make_pair(key, LB_REPLAY_STREAM())).first;
+		LbReplayStreamInitialize(&found->second, &key);
+	}
+
+	LB_REPLAY_STREAM* stream = &found->second;
+	UINT32 sequence = LbReadBe32(&packet.segment[4]);
+	SIZE_T length = packet.segment.size() - packet.headerLength;
+	UINT32 flags = (packet.segment[13] & 0x05) ? LB_STREAM_END : 0;
+
+	if (stream->sequenced && sequence != stream->nextSequence)
+		return;
+
+	stream->sequenced = TRUE;
+	stream->nextSequence = sequence + (UINT32)length;
+	LbReplayStreamWrite(rules, stream, &packet.segment[packet.headerLength], length, flags, output);
+}
+
+// The end of the capture closes every stream, what is still held back goes out
+inline void LbReplayStreamClose(const LB_RULESET* rules, std::map<LB_FLOW_KEY, LB_REPLAY_STREAM>* streams, LB_REPLAY_OUTPUT* output)
+{
+	for (auto& entry : *streams)
+	{
+		if (!entry.second.pending.empty())
+			LbReplayStreamWrite(rules, &entry.second, NULL, 0, LB_STREAM_END, output);
+	}
+}
+
+///////////////////////
+// SYNTHETIC TRAFFIC //
+///////////////////////
+
+// Client requests and server responses of flowCount TCP flows (a quarter of them IPv6) and some UDP queries,
+// interleaved as a busy link would carry them, in bursts of up to four packets of one flow and direction.
+// Every payload continues the stream of its direction.
+// Payloads are built by the caller, payloadFn(rng, index, request) returns one.
+template <typename PAYLOAD_FN>
+inline std::vector<LB_REPLAY_PACKET> LbReplaySynthesize(UINT32 flowCount, UINT32 packetCount, UINT32 seed, PAYLOAD_FN payloadFn)
+{
+	std::mt19937 rng(seed);
+	std::vector<LB_REPLAY_PACKET> packets;
+	std::vector<UINT32> clientSequence(flowCount);
+	std::vector<UINT32> serverSequence(flowCount);
+	UINT64 timestamp = 1700000000ull * 1000000000ull;
+
+	for (UINT32 flow = 0; flow < flowCount; flow++)
+	{
+		clientSequence[flow] = (UINT32)rng();
+		serverSequence[flow] = (UINT32)rng();
+	}
+
+	UINT32 flow = 0;
+	UINT32 burst = 0;
+	BOOLEAN request = FALSE;
+
+	for (UINT32 n = 0; n < packetCount; n++)
+	{
+		// One burst in four is a request, the rest are responses
+		if (burst == 0)
+		{
+			flow = rng() % flowCount;
+			burst = 1 + rng() % 4;
+			request = rng() % 4 == 0;
+		}
+		burst--;
+
+		UINT8 family = flow % 4 == 3 ? LB_FAMILY_IPV6 : LB_FAMILY_IPV4;
+		UINT8 protocol = flow % 8 == 5 ? LB_IPPROTO_UDP : LB_IPPROTO_TCP;
+		UINT8 client[16] = { 0x20, 0x01, 0x0D, 0xB8 };
+		UINT8 server[16] = { 0x20, 0x01, 0x0D, 0xB8, 0, 0, 0, 1 };
+		UINT16 clientPort = (UINT16)(49152 + flow);
+		UINT16 serverPort = protocol == LB_IPPROTO_UDP ? 53 : 80;
+
+		if (family == LB_FAMILY_IPV4)
+		{
+			LbWriteBe32(client, 0x0A000000 | (flow & 0xFFFF));
+			LbWriteBe32(server, 0xC0A80001 + flow % 16);
+		}
+		else
+		{
+			LbWriteBe32(&client[12], flow);
+			LbWriteBe32(&server[12], flow % 16);
+		}
+
+		std::string payload = payloadFn(rng, n, request);
+		LB_REPLAY_PACKET packet = request ?
+			LbReplayMakePacket(family, protocol, client, server, clientPort, serverPort, clientSequence[flow], payload) :
+			LbReplayMakePacket(family, protocol, server, client, serverPort, clientPort, serverSequence[flow], payload);
+
+		(request ? clientSequence[flow] : serverSequence[flow]) += (UINT32)payload.size();
+		timestamp += 1000 + rng() % 20000;
+		packet.timestamp = timestamp;
+		packets.push_back(std::move(packet));
+	}
+
+	return packets;
+}
@@ -0,0 +1,154 @@
+/*/
+/*  ** MatchBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares the compiled Aho-Corasick engine with the strstr loop LbReplaceCallback ran before it, on the
+/*	same payloads. The old loop only ever saw the first 255 bytes of a buffer as a C string, so both get
+/*	255 byte payloads; the engine is also timed on full 1460 byte segments for reference.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "MatchEngine.h"
+
+//////////////
+// BASELINE //
+//////////////
+
+// The rewrite loop of the original callout, allocation and debug printing aside
+static void LbBaselineReplace(char* packetStr, LB_USERDATA* ud)
+{
+	char result[255] = { 0 };
+	char* resOrigin = result;
+	char* cursor = result;
+
+	for (int i = 0, offset = 0; i < (int)strnlen(packetStr, 255); i++, offset++)
+	{
+		cursor[offset] = packetStr[i];
+
+		for (int k = 0; k < ud->count; k++)
+		{
+			char* match = ud->strArray[k].match;
+			char* replace = ud->strArray[k].replace;
+			char* loc = strstr(cursor, match);
+
+			if (loc)
+			{
+				strcpy(loc, replace);
+				cursor += offset;
+				offset = 0;
+				break;
+			}
+
+			loc = strstr(cursor, replace);
+			if (loc)
+			{
+				strcpy(loc, match);
+				cursor += offset;
+				offset = 0;
+				break;
+			}
+		}
+	}
+
+	strcpy(packetStr, resOrigin);
+}
+
+///////////
+// BENCH //
+///////////
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const size_t pairCounts[] = { 3, 10, 50 };
+	const size_t payloadCount = options.quick ? 64 : 4096;
+	const int rounds = options.quick ? 1 : 20;
+
+	printf("%-6s %5s  %14s %14s %9s  %16s\n", "data", "pairs", "strstr ns/pkt", "engine ns/pkt", "speedup", "engine MB/s 1460");
+
+	for (LB_BENCH_PAYLOAD kind : { LB_BENCH_HTTP, LB_BENCH_TEXT })
+	{
+		for (size_t pairCount : pairCounts)
+		{
+			// Equal length pairs, the old loop wrote replacements over the match in place
+			std::vector<std::string> words = LbBenchWords(rng, pairCount * 2, 4, 8);
+			std::vector<LB_MATCH_AND_REPLACE> pairs(pairCount);
+			for (size_t i = 0; i < pairCount; i++)
+			{
+				words[pairCount + i].resize(words[i].size(), 'x');
+				pairs[i].match = (char*)words[i].c_str();
+				pairs[i].replace = (char*)words[pairCount + i].c_str();
+			}
+
+			LB_USERDATA ud;
+			ud.count = (int)pairCount;
+			ud.enableReversal = true;
+			ud.strArray = pairs.data();
+
+			LB_MATCHER* matcher = NULL;
+			if (!NT_SUCCESS(LbMatcherCompile(&ud, &matcher)))
+				return 1;
+
+			// Recorded traffic rarely matches: one payload in four carries one of the words
+			std::vector<std::string> shortPayloads;
+			std::vector<std::string> fullPayloads;
+			for (size_t n = 0; n < payloadCount; n++)
+			{
+				std::string payload = LbBenchPayload(rng, kind, 1460);
+				if (n % 4 == 0)
+					LbBenchPlant(rng, payload, words[rng() % pairCount]);
+				fullPayloads.push_back(payload);
+				shortPayloads.push_back(payload.substr(0, 254));
+				if (n % 4 == 0)
+					LbBenchPlant(rng, shortPayloads.back(), words[rng() % pairCount]);
+			}
+
+			std::vector<std::string> work;
+			UINT64 baseline = 0;
+			UINT64 engine = 0;
+			UINT64 full = 0;
+
+			for (int round = 0; round < rounds; round++)
+			{
+				work = shortPayloads;
+				UINT64 start = LbBenchNow();
+				for (std::string& payload : work)
+					LbBaselineReplace(&payload[0], &ud);
+				baseline += LbBenchNow() - start;
+
+				work = shortPayloads;
+				start = LbBenchNow();
+				for (std::string& payload : work)
+				{
+					UINT32 state = LB_MATCHER_ROOT_STATE;
+					LbBenchKeep(LbMatcherReplace(matcher, &state, (UINT8*)&payload[0], payload.size(), NULL, NULL));
+				}
+				engine += LbBenchNow() - start;
+
+				work = fullPayloads;
+				start = LbBenchNow();
+				for (std::string& payload : work)
+				{
+					UINT32 state = LB_MATCHER_ROOT_STATE;
+					LbBenchKeep(LbMatcherReplace(matcher, &state, (UINT8*)&payload[0], payload.size(), NULL, NULL));
+				}
+				full += LbBenchNow() - start;
+			}
+
+			double packets = (double)payloadCount * rounds;
+			printf("%-6s %5zu  %14.0f %14.0f %8.1fx  %16.0f\n", LbBenchPayloadName(kind), pairCount,
+				baseline / packets, engine / packets, (double)baseline / (engine ? engine : 1),
+				packets * 1460 / 1e6 / (full / 1e9));
+
+			LbMatcherFree(matcher);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*/
+/*  ** PrefilterBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures bytes per cycle of LbMatcherReplace with the SSE2 first byte prefilter, with the scalar bitmap
+/*	it falls back to (reached by editing the compiled matcher), and of the loop it had before the prefilter,
+/*	one transition per byte, copied here over the same tables.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "MatchEngine.h"
+
+enum LB_PREFILTER_MODE
+{
+	LB_PREFILTER_SSE2 = 0,
+	LB_PREFILTER_BITMAP,
+	LB_PREFILTER_NONE,
+};
+
+// LbMatcherReplace before the prefilter, narrow states only
+static UINT32 LbBenchAutomatonLoop(const LB_MATCHER* matcher, UINT8* data, SIZE_T length)
+{
+	const UINT16* transitions = (const UINT16*)((const UINT8*)matcher + matcher->transitionOffset);
+	const UINT8* classes = (const UINT8*)matcher + matcher->classOffset;
+	const UINT32* outputs = (const UINT32*)((const UINT8*)matcher + matcher->outputOffset);
+	const LB_MATCHER_PATTERN* patterns = (const LB_MATCHER_PATTERN*)((const UINT8*)matcher + matcher->patternOffset);
+	UINT32 current = LB_MATCHER_ROOT_STATE;
+	UINT32 replacements = 0;
+
+	for (SIZE_T i = 0; i < length; i++)
+	{
+		current = transitions[(SIZE_T)current * matcher->classCount + classes[data[i]]];
+
+		UINT32 out = outputs[current];
+		if (out == 0)
+			continue;
+
+		const LB_MATCHER_PATTERN* pattern = &patterns[out - 1];
+		memcpy(&data[i + 1 - pattern->matchLength], (const UINT8*)matcher + pattern->replaceOffset, pattern->matchLength);
+		replacements++;
+		current = LB_MATCHER_ROOT_STATE;
+	}
+
+	return replacements;
+}
+
+// Bytes per cycle of one mode over every payload
+static double LbBenchScan(LB_MATCHER* matcher, LB_PREFILTER_MODE mode, const std::vector<std::string>& payloads, int rounds)
+{
+	UINT32 firstByteCount = matcher->firstByteCount;
+	std::vector<std::string> work = payloads;
+	UINT64 cycles = 0;
+	UINT64 bytes = 0;
+
+	if (mode != LB_PREFILTER_SSE2)
+		matcher->firstByteCount = LB_PREFILTER_MAX_BYTES + 1;
+
+	for (int round = 0; round < rounds; round++)
+	{
+		UINT64 start = LbCycles();
+		for (std::string& payload : work)
+		{
+			UINT32 state = LB_MATCHER_ROOT_STATE;
+			if (mode == LB_PREFILTER_NONE)
+				LbBenchKeep(LbBenchAutomatonLoop(matcher, (UINT8*)&payload[0], payload.size()));
+			else
+				LbBenchKeep(LbMatcherReplace(matcher, &state, (UINT8*)&payload[0], payload.size(), NULL, NULL));
+			bytes += payload.size();
+		}
+		cycles += LbCycles() - start;
+	}
+
+	matcher->firstByteCount = firstByteCount;
+	return (double)bytes / (cycles ? cycles : 1);
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const size_t payloadCount = options.quick ? 32 : 2048;
+	const int rounds = options.quick ? 1 : 50;
+
+	struct LB_BENCH_CASE
+	{
+		const char* name;
+		std::vector<std::string> patterns;
+		LB_BENCH_PAYLOAD kind;
+		size_t planted;		// Patterns written into every payload
+	};
+
+	// Patterns starting with bytes lowercase text never has, the same starting with common letters,
+	// and dense matches of the common ones
+	std::vector<LB_BENCH_CASE> cases = {
+		{ "no match, 3 first bytes", { "Alice", "Bob", "Carol" }, LB_BENCH_TEXT, 0 },
+		{ "no match, 8 first bytes", { "Alice", "Bob", "Carol", "Dave", "Eve", "Frank", "Grace", "Heidi" }, LB_BENCH_TEXT, 0 },
+		{ "no match, 12 first bytes", { "Alice", "Bob", "Carol", "Dave", "Eve", "Frank", "Grace", "Heidi", "Ivan", "Judy", "Mallory", "Oscar" }, LB_BENCH_TEXT, 0 },
+		{ "no match, random bytes", { "Alice", "Bob", "Carol" }, LB_BENCH_RANDOM, 0 },
+		{ "common first bytes", { "tqx", "aqx", "wqx" }, LB_BENCH_TEXT, 0 },
+		{ "dense match", { "love", "hate", "rose" }, LB_BENCH_TEXT, 40 },
+	};
+
+	printf("%-26s %8s %8s %8s %9s\n", "bytes/cycle, 1460 B", "sse2", "bitmap", "before", "speedup");
+
+	for (LB_BENCH_CASE& test : cases)
+	{
+		std::vector<LB_MATCH_AND_REPLACE> pairs;
+		std::vector<std::string> replacements;
+
+		for (const std::string& pattern : test.patterns)
+			replacements.push_back(std::string(pattern.size(), 'X'));
+		for (size_t i = 0; i < test.patterns.size(); i++)
+			pairs.push_back({ (char*)test.patterns[i].c_str(), (char*)replacements[i].c_str() });
+
+		LB_USERDATA ud;
+		ud.count = (int)pairs.size();
+		ud.strArray = pairs.data();
+
+		LB_MATCHER* matcher = NULL;
+		if (!NT_SUCCESS(LbMatcherCompile(&ud, &matcher)) || matcher->stateWidth != sizeof(UINT16))
+			return 1;
+
+		std::vector<std::string> payloads;
+		for (size_t n = 0; n < payloadCount; n++)
+		{
+			payloads.push_back(LbBenchPayload(rng, test.kind, 1460));
+			for (size_t k = 0; k < test.planted; k++)
+				LbBenchPlant(rng, payloads.back(), test.patterns[rng() % test.patterns.size()]);
+		}
+
+		double sse2 = LbBenchScan(matcher, LB_PREFILTER_SSE2, payloads, rounds);
+		double bitmap = LbBenchScan(matcher, LB_PREFILTER_BITMAP, payloads, rounds);
+		double none = LbBenchScan(matcher, LB_PREFILTER_NONE, payloads, rounds);
+
+		printf("%-26s %8.2f %8.2f %8.2f %8.1fx\n", test.name, sse2, bitmap, none, sse2 / none);
+		LbMatcherFree(matcher);
+	}
+
+	return 0;
+}
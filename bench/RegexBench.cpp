@@ -0,0 +1,124 @@
+/*/
+/*  ** RegexBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares the regex engine with the literal engine on the same 1460 byte HTTP payloads. The same words
+/*	are compiled both ways first, so the rows show what the lazy DFA costs over the Aho-Corasick tables
+/*	for patterns either engine takes, then a few patterns only the regex engine takes.
+/*
+/*	The first pass over the payloads is timed on its own: the state cache starts empty and every new state
+/*	is built on the way. The last row needs thousands of states, more than the cache holds, and shows the
+/*	NFA simulation the scan falls back on once it is full.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State University�s CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "RegexEngine.h"
+
+struct LB_BENCH_CASE
+{
+	std::string name;
+	std::vector<std::string> patterns;
+	std::vector<std::string> plants;	// Planted in one payload in four
+	BOOLEAN regex;
+	LB_BENCH_PAYLOAD kind;
+	std::string alphabet;				// Payloads drawn from these bytes instead, when set
+};
+
+// Nanoseconds of one pass rewriting the payloads into output. Copied, so a match of any length is replaced.
+static UINT64 LbBenchPass(const LB_MATCHER* matcher, const std::vector<std::string>& payloads, std::vector<UINT8>& output, UINT64* replacements)
+{
+	UINT64 start = LbBenchNow();
+	for (const std::string& payload : payloads)
+	{
+		UINT32 state = LB_MATCHER_ROOT_STATE;
+		SIZE_T written = 0;
+		*replacements += LbMatcherRewrite(matcher, &state, (const UINT8*)payload.data(), payload.size(), output.data(), &written);
+	}
+	return LbBenchNow() - start;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const size_t payloadCount = options.quick ? 64 : 4096;
+	const int rounds = options.quick ? 1 : 20;
+
+	std::vector<std::string> words4 = LbBenchWords(rng, 4, 5, 8);
+	std::vector<std::string> words16 = LbBenchWords(rng, 16, 5, 8);
+	std::vector<LB_BENCH_CASE> cases = {
+		{ "4 words", words4, words4, FALSE, LB_BENCH_HTTP, "" },
+		{ "4 words", words4, words4, TRUE, LB_BENCH_HTTP, "" },
+		{ "16 words", words16, words16, FALSE, LB_BENCH_HTTP, "" },
+		{ "16 words", words16, words16, TRUE, LB_BENCH_HTTP, "" },
+		{ "host", { "Host: [a-z]+\\.example\\.(com|org)" }, { "Host: mail.example.com" }, TRUE, LB_BENCH_HTTP, "" },
+		{ "query", { "[?&]cmd=[a-z]{3,8}", "session=[0-9a-f]+" }, { "?cmd=reboot" }, TRUE, LB_BENCH_HTTP, "" },
+		{ "header line", { "^Cookie: [^\\r\\n]*" }, {}, TRUE, LB_BENCH_HTTP, "" },
+		{ "a[ab]{12}b", { "a[ab]{12}b" }, {}, TRUE, LB_BENCH_HTTP, "ab" },
+	};
+
+	printf("%u byte payloads, %zu per pass, %d rounds\n", 1460, payloadCount, rounds);
+	printf("%-12s %8s %12s %12s %10s %16s\n", "patterns", "engine", "first MB/s", "MB/s", "ns/pkt", "replacements/pkt");
+
+	for (const LB_BENCH_CASE& bench : cases)
+	{
+		std::vector<LB_MATCH_AND_REPLACE> pairs(bench.patterns.size());
+		std::vector<std::string> replacements(bench.patterns.size(), "x");
+		for (size_t i = 0; i < pairs.size(); i++)
+		{
+			pairs[i].match = (char*)bench.patterns[i].c_str();
+			pairs[i].replace = (char*)replacements[i].c_str();
+		}
+
+		LB_USERDATA ud;
+		ud.count = (int)pairs.size();
+		ud.strArray = pairs.data();
+		ud.regex = bench.regex;
+
+		LB_MATCHER* matcher = NULL;
+		if (!NT_SUCCESS(LbMatcherCompile(&ud, &matcher)))
+		{
+			fprintf(stderr, "%s did not compile\n", bench.name.c_str());
+			return 1;
+		}
+
+		std::vector<std::string> payloads;
+		for (size_t n = 0; n < payloadCount; n++)
+		{
+			std::string payload;
+			if (bench.alphabet.empty())
+				payload = LbBenchPayload(rng, bench.kind, 1460);
+			else
+				for (size_t i = 0; i < 1460; i++)
+					payload += bench.alphabet[rng() % bench.alphabet.size()];
+
+			if (n % 4 == 0 && !bench.plants.empty())
+				LbBenchPlant(rng, payload, bench.plants[rng() % bench.plants.size()]);
+			payloads.push_back(payload);
+		}
+
+		// The first pass builds the cache, the rest run on what it built
+		std::vector<UINT8> output(LbMatcherRewriteBound(matcher, 1460));
+		UINT64 replaced = 0;
+		UINT64 first = LbBenchPass(matcher, payloads, output, &replaced);
+		UINT64 warm = 0;
+		replaced = 0;
+
+		for (int round = 0; round < rounds; round++)
+			warm += LbBenchPass(matcher, payloads, output, &replaced);
+
+		double bytes = (double)payloadCount * 1460;
+		double packets = (double)payloadCount * rounds;
+		printf("%-12s %8s %12.0f %12.0f %10.0f %16.2f\n", bench.name.c_str(), bench.regex ? "regex" : "literal",
+			bytes / 1e6 / (first / 1e9), bytes * rounds / 1e6 / (warm / 1e9), warm / packets, replaced / packets);
+
+		LbMatcherFree(matcher);
+	}
+
+	return 0;
+}
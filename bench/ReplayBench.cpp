@@ -0,0 +1,183 @@
+/*/
+/*  ** ReplayBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Replays a capture through the classify path with LbReplay.h: every TCP and UDP packet of it is laid out
+/*	as the NET_BUFFER_LIST, NET_BUFFER and MDL chain a transport layer would hand over and classified, with
+/*	payloads rewritten in place or copied for size changes. The corpus is split by the layer each call is
+/*	classified at, and every layer gets its own row of packets and bytes per second and p50, p99 and p99.9
+/*	latency of a classify call, once with equal length pairs and once with pairs that change the length.
+/*
+/*	--input takes a pcap or pcapng file. Without one a capture of HTTP flows (a quarter of them IPv6, an
+/*	eighth UDP) is synthesized, written as pcapng and read back, so the reader is part of every run.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "LbReplay.h"
+
+struct LB_BENCH_RULES
+{
+	const char* name;
+	LB_MATCH_AND_REPLACE* pairs;
+	int count;
+};
+
+// The calls of the corpus classified at one layer. Flows never cross layers, so each replays on its own.
+struct LB_BENCH_LAYER
+{
+	const char* name;
+	UINT16 layerId;
+	std::vector<const LB_REPLAY_CALL*> calls;
+	UINT64 packets;
+	UINT64 bytes;
+};
+
+// Timed calls of one replay of a layer
+struct LB_BENCH_RESULT
+{
+	UINT64 elapsed;
+	std::vector<UINT64> latencies;
+};
+
+static LB_BENCH_RESULT LbBenchReplay(const LB_RULESET* rules, LB_REPLAY_CORPUS* corpus, const LB_BENCH_LAYER& layer, LB_REPLAY_OUTPUT* output, BOOLEAN timed)
+{
+	LB_BENCH_RESULT result = {};
+	LbReplayReset(corpus);
+
+	if (timed)
+		result.latencies.reserve(layer.calls.size());
+
+	UINT64 start = LbBenchNow();
+	for (const LB_REPLAY_CALL* call : layer.calls)
+	{
+		if (timed)
+		{
+			UINT64 before = LbBenchNow();
+			LbReplayClassify(rules, call, output);
+			result.latencies.push_back(LbBenchNow() - before);
+		}
+		else
+			LbReplayClassify(rules, call, output);
+	}
+	result.elapsed = LbBenchNow() - start;
+
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	const int rounds = options.quick ? 1 : 20;
+	std::vector<LB_REPLAY_PACKET> packets;
+	LB_REPLAY_READ_STATS read = {};
+	NTSTATUS status;
+
+	if (options.input)
+		status = LbReplayReadCapture(options.input, &packets, &read);
+	else
+	{
+		// Responses carry most of the bytes, some of them a word a pair rewrites
+		auto payloadFn = [](std::mt19937& rng, UINT32, BOOLEAN request) {
+			std::string payload = LbBenchPayload(rng, LB_BENCH_HTTP, request ? 200 + rng() % 300 : 100 + rng() % 1360);
+			if (rng() % 8 == 0)
+				LbBenchPlant(rng, payload, rng() % 2 ? "Alice" : "Love");
+			return payload;
+		};
+		std::vector<LB_REPLAY_PACKET> synthetic = LbReplaySynthesize(options.quick ? 32 : 1024, options.quick ? 512 : 100000, 1, payloadFn);
+		std::vector<UINT8> capture = LbReplayWritePcapng(synthetic, LB_REPLAY_LINKTYPE_ETHERNET);
+		status = LbReplayParseCapture(capture.data(), capture.size(), &packets, &read);
+	}
+
+	if (!NT_SUCCESS(status) || packets.empty())
+	{
+		fprintf(stderr, "no TCP or UDP packets to replay (0x%08X)\n", (UINT32)status);
+		return 1;
+	}
+
+	LB_REPLAY_CORPUS corpus;
+	LbReplayBuild(packets, LB_REPLAY_LAYOUT(), &corpus);
+
+	printf("%s: %llu frames, %llu TCP/UDP packets kept, %llu truncated, %llu fragments, %llu other\n",
+		options.input ? options.input : "synthetic pcapng", (unsigned long long)read.frames, (unsigned long long)read.packets,
+		(unsigned long long)read.truncated, (unsigned long long)read.fragments, (unsigned long long)read.other);
+	printf("%zu classify calls, %zu NET_BUFFERs in %zu MDLs, %zu outbound flows, %.1f MB of layer data\n\n",
+		corpus.calls.size(), corpus.netBuffers.size(), corpus.mdls.size(), corpus.flows.size(), corpus.bytes / 1e6);
+
+	LB_BENCH_LAYER layers[] = {
+		{ "OUTBOUND_V4", LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V4 },
+		{ "OUTBOUND_V6", LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V6 },
+		{ "INBOUND_V4", LB_REPLAY_LAYER_INBOUND_TRANSPORT_V4 },
+		{ "INBOUND_V6", LB_REPLAY_LAYER_INBOUND_TRANSPORT_V6 },
+	};
+	for (const LB_REPLAY_CALL& call : corpus.calls)
+	{
+		LB_BENCH_LAYER& layer = layers[call.values.layerId];
+		layer.calls.push_back(&call);
+		layer.packets += call.packets;
+		layer.bytes += call.bytes;
+	}
+
+	LB_MATCH_AND_REPLACE equalPairs[] = { { (char*)"Love", (char*)"Hate" }, { (char*)"Alice", (char*)"Trudy" } };
+	LB_MATCH_AND_REPLACE unequalPairs[] = { { (char*)"Love", (char*)"Loathing" }, { (char*)"Alice", (char*)"Eve" } };
+	LB_BENCH_RULES ruleSets[] = { { "equal pairs", equalPairs, 2 }, { "resizing pairs", unequalPairs, 2 } };
+	LB_PORT_RULE portRules[] = { { 0, 65535, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+
+	if (!NT_SUCCESS(LbVerdictCacheInitialize()) || !NT_SUCCESS(LbStatsInitialize()))
+		return 1;
+
+	printf("every port inspected, %d rounds, latency per classify call (up to %u NET_BUFFERs)\n", rounds, LB_REPLAY_LAYOUT().maxNetBuffers);
+	printf("%16s %12s %10s %12s %10s %10s %10s %10s %14s %10s\n", "rules", "layer", "calls", "Mpackets/s", "MB/s", "p50 ns", "p99 ns", "p99.9 ns", "replacements", "injected");
+
+	for (const LB_BENCH_RULES& ruleSet : ruleSets)
+	{
+		LB_USERDATA ud;
+		ud.count = ruleSet.count;
+		ud.strArray = ruleSet.pairs;
+
+		LB_RULESET* rules = NULL;
+		if (!NT_SUCCESS(LbRuleSetCompile(NULL, 0, portRules, 1, &ud, 0, &rules)))
+			return 1;
+		LbVerdictCacheInvalidateAll();
+
+		for (const LB_BENCH_LAYER& layer : layers)
+		{
+			if (layer.calls.empty())
+			{
+				printf("%16s %12s %10s\n", ruleSet.name, layer.name, "0");
+				continue;
+			}
+
+			// Throughput untimed per call, then each call timed on its own for the latencies
+			UINT64 elapsed = 0;
+			std::vector<UINT64> latencies;
+			LB_REPLAY_OUTPUT output;
+			for (int round = 0; round < rounds; round++)
+				elapsed += LbBenchReplay(rules, &corpus, layer, &output, FALSE).elapsed;
+
+			LB_REPLAY_OUTPUT timedOutput;
+			for (int round = 0; round < rounds; round++)
+			{
+				std::vector<UINT64> samples = LbBenchReplay(rules, &corpus, layer, &timedOutput, TRUE).latencies;
+				latencies.insert(latencies.end(), samples.begin(), samples.end());
+			}
+
+			double seconds = elapsed / 1e9;
+			printf("%16s %12s %10zu %12.2f %10.0f %10llu %10llu %10llu %14llu %10llu\n", ruleSet.name, layer.name, layer.calls.size(),
+				layer.packets * rounds / seconds / 1e6, layer.bytes * rounds / seconds / 1e6,
+				(unsigned long long)LbBenchPercentile(latencies, 0.5), (unsigned long long)LbBenchPercentile(latencies, 0.99),
+				(unsigned long long)LbBenchPercentile(latencies, 0.999),
+				(unsigned long long)(output.replacements / rounds), (unsigned long long)(output.injected / rounds));
+		}
+
+		LbRuleSetFree(rules);
+	}
+
+	LbStatsCleanup();
+	LbVerdictCacheCleanup();
+	return 0;
+}
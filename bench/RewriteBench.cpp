@@ -0,0 +1,141 @@
+/*/
+/*  ** RewriteBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares the two ways a segment is rewritten: in place over its buffers with the checksum patched, as for
+/*	equal length pairs, and copied into a new segment with its checksum and sequence number computed again,
+/*	as for pairs that change the length. The copy is timed with equal and with unequal pairs, so the cost of
+/*	the copy itself can be told from the cost of growing the stream.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "ClassifyCore.h"
+
+#define LB_BENCH_HEADER 20
+
+static const UINT32 LbBenchSource = 0x0A000001;
+static const UINT32 LbBenchDestination = 0x0A000002;
+
+static std::string LbBenchSegment(const std::string& payload, UINT32 sequence)
+{
+	std::string segment(LB_BENCH_HEADER, '\0');
+	segment[12] = 0x50;
+	segment += payload;
+	LbWriteBe32((UINT8*)&segment[4], sequence);
+	LbWriteBe16((UINT8*)&segment[16], LbTransportChecksumV4(LbBenchSource, LbBenchDestination, LB_IPPROTO_TCP, (const UINT8*)segment.data(), segment.size()));
+	return segment;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const size_t segmentCount = options.quick ? 32 : 4096;
+	const int rounds = options.quick ? 1 : 20;
+	const size_t plantedCounts[] = { 0, 1, 8 };
+
+	LB_FLOW_KEY key = {};
+	key.localAddress = LbBenchSource;
+	key.remoteAddress = LbBenchDestination;
+	key.protocol = LB_IPPROTO_TCP;
+	key.direction = LB_DIRECTION_OUTBOUND;
+	key.family = LB_FAMILY_IPV4;
+
+	LB_MATCH_AND_REPLACE equalPairs[] = { { (char*)"Love", (char*)"Hate" }, { (char*)"Alice", (char*)"Trudy" }, { (char*)"Rob", (char*)"Bob" } };
+	LB_MATCH_AND_REPLACE unequalPairs[] = { { (char*)"Love", (char*)"Loathing" }, { (char*)"Alice", (char*)"Eve" }, { (char*)"Rob", (char*)"Robert" } };
+	LB_MATCHER* equal = NULL;
+	LB_MATCHER* unequal = NULL;
+	LB_USERDATA ud;
+	ud.count = 3;
+	ud.enableReversal = FALSE;
+
+	ud.strArray = equalPairs;
+	if (!NT_SUCCESS(LbMatcherCompile(&ud, &equal)))
+		return 1;
+	ud.strArray = unequalPairs;
+	if (!NT_SUCCESS(LbMatcherCompile(&ud, &unequal)))
+		return 1;
+
+	printf("1460 byte segments, ns/segment (MB/s)\n");
+	printf("%8s %22s %22s %22s\n", "matches", "in place, 3 buffers", "copy, equal pairs", "copy, unequal pairs");
+
+	for (size_t planted : plantedCounts)
+	{
+		std::vector<std::string> segments;
+		for (size_t n = 0; n < segmentCount; n++)
+		{
+			std::string payload = LbBenchPayload(rng, LB_BENCH_HTTP, 1460);
+			for (size_t k = 0; k < planted; k++)
+				LbBenchPlant(rng, payload, equalPairs[rng() % 3].match);
+			segments.push_back(LbBenchSegment(payload, (UINT32)(n * 1460)));
+		}
+
+		std::vector<UINT8> output(LB_BENCH_HEADER + LbMatcherRewriteBound(unequal, 1460));
+		UINT64 inPlace = 0;
+		UINT64 copyEqual = 0;
+		UINT64 copyUnequal = 0;
+
+		for (int round = 0; round < rounds; round++)
+		{
+			// In place, the payload split over three buffers like a segment that spans MDLs
+			std::vector<std::string> work = segments;
+			LB_SCAN_CONTEXT scan = {};
+			scan.matcher = equal;
+			scan.key = &key;
+
+			UINT64 start = LbBenchNow();
+			for (std::string& segment : work)
+			{
+				UINT8* payload = (UINT8*)&segment[LB_BENCH_HEADER];
+				UINT16 checksum = LbReadBe16((const UINT8*)&segment[16]);
+
+				LbScanSegment(&scan, 0, 1460);
+				LbScanBuffer(&scan, payload, 500);
+				LbScanBuffer(&scan, payload + 500, 500);
+				LbScanBuffer(&scan, payload + 1000, 460);
+				if (LbScanChecksum(&scan, &checksum) == LB_SCAN_CHECKSUM_RECOMPUTE)
+				{
+					LbWriteBe16((UINT8*)&segment[16], 0);
+					checksum = LbTransportChecksumV4(LbBenchSource, LbBenchDestination, LB_IPPROTO_TCP, (const UINT8*)segment.data(), segment.size());
+				}
+				LbWriteBe16((UINT8*)&segment[16], checksum);
+			}
+			inPlace += LbBenchNow() - start;
+
+			// Copies, each with the sequence tracking a flow has
+			for (LB_MATCHER* matcher : { equal, unequal })
+			{
+				LB_SEQ_TRACKER tracker;
+				LbSeqTrackerInitialize(&tracker);
+				scan = {};
+				scan.matcher = matcher;
+				scan.key = &key;
+
+				start = LbBenchNow();
+				for (const std::string& segment : segments)
+				{
+					ULONG written = 0;
+					LbBenchKeep(LbRewriteTransport(&key, &tracker, &scan, (const UINT8*)segment.data(), (ULONG)segment.size(), output.data(), (ULONG)output.size(), &written));
+				}
+				(matcher == equal ? copyEqual : copyUnequal) += LbBenchNow() - start;
+			}
+		}
+
+		double total = (double)segmentCount * rounds;
+		auto column = [&](UINT64 ns) {
+			static char text[64];
+			snprintf(text, sizeof(text), "%.0f (%.0f)", ns / total, total * 1460 / 1e6 / (ns / 1e9));
+			return std::string(text);
+		};
+		printf("%8zu %22s %22s %22s\n", planted, column(inPlace).c_str(), column(copyEqual).c_str(), column(copyUnequal).c_str());
+	}
+
+	LbMatcherFree(equal);
+	LbMatcherFree(unequal);
+	return 0;
+}
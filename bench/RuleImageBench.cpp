@@ -0,0 +1,143 @@
+/*/
+/*  ** RuleImageBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares the two ways a rule set reaches the driver at 1k, 10k and 100k rules: an IOCTL_LB_SET_RULES
+/*	buffer, which the driver parses and builds every table of (LbRuleSetParse), and a rule image, which it
+/*	copies once and checks in place (LbRuleSetLoadImage). Prints the median milliseconds of each over the
+/*	rounds, with the time RuleCompiler takes to read the rule file and lay out the image for reference, and
+/*	the CRC-32C over the image on its own, the part of a load that grows with the image rather than the rules.
+/*
+/*	A fifth of the rules are /16 to /24 networks, seven tenths port ranges and a tenth literal pairs, the
+/*	mix the 100k set needs to fit the rule set budget.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "LbRuleText.h"
+#include "RuleImage.h"
+
+static const char* LbBenchActions[] = { "permit", "block", "inspect" };
+static const char* LbBenchDirections[] = { "", " outbound", " inbound" };
+
+static std::string LbBenchRuleFile(std::mt19937& rng, UINT32 ruleCount)
+{
+	std::string text;
+
+	for (UINT32 i = 0; i < ruleCount / 5; i++)
+	{
+		UINT32 address = rng();
+		text += "address " + std::to_string(address >> 24) + "." + std::to_string(address >> 16 & 0xFF) + "." +
+			std::to_string(address >> 8 & 0xFF) + ".0/" + std::to_string(16 + rng() % 9) + " " + LbBenchActions[rng() % 3] +
+			LbBenchDirections[rng() % 3] + "\n";
+	}
+
+	for (UINT32 i = 0; i < ruleCount / 10 * 7; i++)
+	{
+		UINT32 first = rng() % 65000;
+		text += "port " + std::to_string(first) + "-" + std::to_string(first + rng() % 64) + " " + LbBenchActions[rng() % 3] +
+			LbBenchDirections[rng() % 3] + "\n";
+	}
+
+	std::vector<std::string> words = LbBenchWords(rng, ruleCount / 10, 6, 12);
+	for (const std::string& word : words)
+		text += "pair \"" + word + "\" \"" + std::string(word.size(), 'x') + "\"\n";
+
+	return text;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const int rounds = options.quick ? 1 : 9;
+	std::vector<UINT32> ruleCounts = { 1000, 10000, 100000 };
+	if (options.quick)
+		ruleCounts = { 1000 };
+
+	printf("median of %d rounds, ms\n", rounds);
+	printf("%8s %10s %10s  %10s %10s  %10s %10s %10s %9s\n", "rules", "image KB", "set KB", "read text", "build image",
+		"parse", "load image", "checksum", "speedup");
+
+	for (UINT32 ruleCount : ruleCounts)
+	{
+		std::string text = LbBenchRuleFile(rng, ruleCount);
+		std::vector<UINT64> readTimes;
+		std::vector<UINT64> buildTimes;
+		std::vector<UINT64> parseTimes;
+		std::vector<UINT64> loadTimes;
+		std::vector<UINT64> checksumTimes;
+		std::vector<UINT8> buffer;
+		void* image = NULL;
+		UINT32 size = 0;
+		SIZE_T setBytes = 0;
+
+		for (int round = 0; round < rounds; round++)
+		{
+			LB_RULE_TEXT rules;
+			UINT32 line;
+			LB_RULESET* parsed = NULL;
+			LB_RULESET* loaded = NULL;
+
+			// What RuleCompiler does once, ahead of time
+			UINT64 start = LbBenchNow();
+			if (!NT_SUCCESS(LbRuleTextParse(text.data(), text.size(), &rules, &line)))
+			{
+				fprintf(stderr, "rule file line %u\n", line);
+				return 1;
+			}
+			buffer = LbRuleTextBuffer(rules);
+			readTimes.push_back(LbBenchNow() - start);
+
+			// What the driver does with a rules buffer
+			start = LbBenchNow();
+			NTSTATUS status = LbRuleSetParse(buffer.data(), buffer.size(), &parsed);
+			parseTimes.push_back(LbBenchNow() - start);
+			if (!NT_SUCCESS(status))
+			{
+				fprintf(stderr, "%u rules refused (0x%08X)\n", ruleCount, (UINT32)status);
+				return 1;
+			}
+
+			LbRuleImageFree(image);
+			start = LbBenchNow();
+			status = LbRuleImageBuild(parsed, &image, &size);
+			buildTimes.push_back(LbBenchNow() - start);
+			LbRuleSetFree(parsed);
+			if (!NT_SUCCESS(status))
+				return 1;
+
+			// What it does with an image
+			start = LbBenchNow();
+			status = LbRuleSetLoadImage(image, size, &loaded);
+			loadTimes.push_back(LbBenchNow() - start);
+			if (!NT_SUCCESS(status))
+			{
+				fprintf(stderr, "%u rule image refused (0x%08X)\n", ruleCount, (UINT32)status);
+				return 1;
+			}
+
+			setBytes = loaded->bytes;
+			LbRuleSetFree(loaded);
+
+			start = LbBenchNow();
+			LbBenchKeep(LbRuleImageChecksum(image, size));
+			checksumTimes.push_back(LbBenchNow() - start);
+		}
+
+		double parse = LbBenchPercentile(parseTimes, 0.5) / 1e6;
+		double load = LbBenchPercentile(loadTimes, 0.5) / 1e6;
+		printf("%8u %10u %10zu  %10.2f %10.2f  %10.2f %10.2f %10.2f %8.1fx\n", ruleCount, size / 1024, setBytes / 1024,
+			LbBenchPercentile(readTimes, 0.5) / 1e6, LbBenchPercentile(buildTimes, 0.5) / 1e6, parse, load,
+			LbBenchPercentile(checksumTimes, 0.5) / 1e6, parse / load);
+
+		LbRuleImageFree(image);
+		image = NULL;
+	}
+
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*/
+/*  ** ScalingBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Replays one shared corpus (see ReplayBench.cpp) through the classify path on 1 to N threads. Calls are
+/*	spread over the threads by flow, as receive side scaling spreads flows over processors, so every thread
+/*	shares the rule set, the verdict cache and the statistics with the others but owns its flows.
+/*
+/*	The classify path records into the real LB_STATS_PROCESSOR of whichever processor a thread runs on, the
+/*	same in every run. On top of that every call counts its packets and bytes in a synthetic reference the
+/*	bench keeps itself, laid out three ways: padded to a cache line per thread, packed next to each other,
+/*	and one set shared by every thread. The ref columns only show what false sharing of such counters would
+/*	cost on this machine, they do not measure the driver's own statistics, whose per processor blocks span
+/*	many cache lines and so only ever meet their neighbours at the edges.
+/*
+/*	Parallel efficiency is throughput over the single thread's throughput times the processors in use.
+/*	The run fails when it falls below --threshold (0.5 unless given, not checked with --quick unless given,
+/*	ctest runs it once more with one) for any thread count that has a processor of its own. Thread counts past the processor count only
+/*	share the same processors, on a single processor machine nothing is checked.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "LbReplay.h"
+
+#define LB_BENCH_THRESHOLD 0.5
+
+enum LB_BENCH_LAYOUT
+{
+	LB_BENCH_PADDED = 0,
+	LB_BENCH_PACKED,
+	LB_BENCH_SHARED,
+	LB_BENCH_LAYOUTS
+};
+
+struct LB_BENCH_COUNTERS
+{
+	UINT64 packets;
+	UINT64 bytes;
+};
+
+struct DECLSPEC_ALIGN(64) LB_BENCH_PADDED_COUNTERS
+{
+	UINT64 packets;
+	UINT64 bytes;
+};
+
+struct LB_BENCH_SHARED_COUNTERS
+{
+	volatile LONG packets;
+	volatile LONG bytes;
+};
+
+// What one thread replays with. The padding keeps the counters LbReplayClassify writes in one thread's
+// output off the cache lines of the next one, so only the layout under test can share lines.
+struct LB_BENCH_THREAD
+{
+	LB_REPLAY_OUTPUT output;
+	std::vector<UINT32> calls;
+	UINT8 padding[64];
+};
+
+// Spread calls by flow, both directions of a flow on the same thread
+static UINT32 LbBenchCallHash(const LB_REPLAY_CALL* call)
+{
+	const LB_REPLAY_INCOMING_VALUE* values = call->values.incomingValue;
+	BOOLEAN v6 = call->values.layerId == LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V6 || call->values.layerId == LB_REPLAY_LAYER_INBOUND_TRANSPORT_V6;
+	UINT32 local = v6 ? LbFlowAddressFold(values[LB_REPLAY_FIELD_IP_LOCAL_ADDRESS].value.byteArray16->byteArray16) : values[LB_REPLAY_FIELD_IP_LOCAL_ADDRESS].value.uint32;
+	UINT32 remote = v6 ? LbFlowAddressFold(values[LB_REPLAY_FIELD_IP_REMOTE_ADDRESS].value.byteArray16->byteArray16) : values[LB_REPLAY_FIELD_IP_REMOTE_ADDRESS].value.uint32;
+	UINT32 hash = local ^ remote ^ ((UINT32)values[LB_REPLAY_FIELD_IP_LOCAL_PORT].value.uint16 << 16 | values[LB_REPLAY_FIELD_IP_REMOTE_PORT].value.uint16);
+
+	hash ^= hash >> 16;
+	hash *= 0x45D9F3B;
+	return hash ^ (hash >> 16);
+}
+
+// Nanoseconds the threads took over rounds replays of the corpus, each thread counting into its reference counters
+template <LB_BENCH_LAYOUT Layout>
+static UINT64 LbBenchReplay(const LB_RULESET* rules, LB_REPLAY_CORPUS* corpus, std::vector<LB_BENCH_THREAD>& threads, int rounds)
+{
+	UINT32 count = (UINT32)threads.size();
+	std::vector<LB_BENCH_PADDED_COUNTERS> padded(count);
+	std::vector<LB_BENCH_COUNTERS> packed(count);
+	LB_BENCH_SHARED_COUNTERS shared = {};
+	UINT64 elapsed = 0;
+
+	for (int round = 0; round < rounds; round++)
+	{
+		LbReplayReset(corpus);
+
+		elapsed += LbBenchRunThreads(count, [&](UINT32 index) {
+			LB_BENCH_THREAD& thread = threads[index];
+
+			for (UINT32 call : thread.calls)
+			{
+				const LB_REPLAY_CALL* current = &corpus->calls[call];
+				LbReplayClassify(rules, current, &thread.output);
+
+				if (Layout == LB_BENCH_PADDED)
+				{
+					padded[index].packets += current->packets;
+					padded[index].bytes += current->bytes;
+				}
+				else if (Layout == LB_BENCH_PACKED)
+				{
+					packed[index].packets += current->packets;
+					packed[index].bytes += current->bytes;
+				}
+				else
+				{
+					LbInterlockedAdd(&shared.packets, (LONG)current->packets);
+					LbInterlockedAdd(&shared.bytes, (LONG)current->bytes);
+				}
+			}
+		});
+	}
+
+	// Every layout has to count the whole corpus, or the compiler was free to drop the counting
+	UINT64 packets = (UINT64)(ULONG)shared.packets;
+	for (UINT32 i = 0; i < count; i++)
+		packets += padded[i].packets + packed[i].packets;
+	LbBenchKeep(packets);
+
+	return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	const int rounds = options.quick ? 2 : 10;
+	const double threshold = options.threshold > 0 ? options.threshold : options.quick ? 0 : LB_BENCH_THRESHOLD;
+	const UINT32 processors = LbProcessorCount();
+	std::vector<LB_REPLAY_PACKET> packets;
+	LB_REPLAY_READ_STATS read = {};
+	NTSTATUS status;
+
+	if (options.input)
+		status = LbReplayReadCapture(options.input, &packets, &read);
+	else
+	{
+		auto payloadFn = [](std::mt19937& rng, UINT32, BOOLEAN request) {
+			std::string payload = LbBenchPayload(rng, LB_BENCH_HTTP, request ? 200 + rng() % 300 : 100 + rng() % 1360);
+			if (rng() % 8 == 0)
+				LbBenchPlant(rng, payload, rng() % 2 ? "Alice" : "Love");
+			return payload;
+		};
+		packets = LbReplaySynthesize(options.quick ? 64 : 1024, options.quick ? 2048 : 100000, 1, payloadFn);
+		status = STATUS_SUCCESS;
+	}
+
+	if (!NT_SUCCESS(status) || packets.empty())
+	{
+		fprintf(stderr, "no TCP or UDP packets to replay (0x%08X)\n", (UINT32)status);
+		return 1;
+	}
+
+	LB_REPLAY_CORPUS corpus;
+	LbReplayBuild(packets, LB_REPLAY_LAYOUT(), &corpus);
+
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Love", (char*)"Hate" }, { (char*)"Alice", (char*)"Trudy" } };
+	LB_PORT_RULE portRules[] = { { 0, 65535, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_USERDATA ud;
+	ud.count = 2;
+	ud.strArray = pairs;
+	LB_RULESET* rules = NULL;
+
+	if (!NT_SUCCESS(LbRuleSetCompile(NULL, 0, portRules, 1, &ud, 0, &rules)) || !NT_SUCCESS(LbVerdictCacheInitialize()) || !NT_SUCCESS(LbStatsInitialize()))
+		return 1;
+
+	printf("%zu classify calls, %llu packets, %.1f MB, %d rounds, %u processors, equal pairs on every port\n",
+		corpus.calls.size(), (unsigned long long)corpus.packets, corpus.bytes / 1e6, rounds, processors);
+	printf("%8s %12s %12s %12s %14s %12s %14s\n", "threads", "Mpackets/s", "efficiency", "ref packed", "packed/padded", "ref shared", "shared/padded");
+
+	double single = 0;
+	BOOLEAN failed = FALSE;
+	BOOLEAN checked = FALSE;
+
+	for (UINT32 count : LbBenchThreadCounts(options))
+	{
+		std::vector<LB_BENCH_THREAD> threads(count);
+		for (UINT32 call = 0; call < corpus.calls.size(); call++)
+			threads[LbBenchCallHash(&corpus.calls[call]) % count].calls.push_back(call);
+
+		double rate[LB_BENCH_LAYOUTS];
+		UINT64 elapsed[LB_BENCH_LAYOUTS] = {
+			LbBenchReplay<LB_BENCH_PADDED>(rules, &corpus, threads, rounds),
+			LbBenchReplay<LB_BENCH_PACKED>(rules, &corpus, threads, rounds),
+			LbBenchReplay<LB_BENCH_SHARED>(rules, &corpus, threads, rounds),
+		};
+		for (int layout = 0; layout < LB_BENCH_LAYOUTS; layout++)
+			rate[layout] = (double)corpus.packets * rounds / (elapsed[layout] / 1e3);
+
+		if (count == 1)
+			single = rate[LB_BENCH_PADDED];
+
+		UINT32 used = std::min(count, processors);
+		double efficiency = rate[LB_BENCH_PADDED] / (single * used);
+		BOOLEAN check = count > 1 && count <= processors && threshold > 0;
+		BOOLEAN below = check && efficiency < threshold;
+
+		printf("%8u %12.2f %11.2f%s %12.2f %14.2f %12.2f %14.2f\n", count, rate[LB_BENCH_PADDED], efficiency, below ? "!" : " ",
+			rate[LB_BENCH_PACKED], rate[LB_BENCH_PACKED] / rate[LB_BENCH_PADDED], rate[LB_BENCH_SHARED], rate[LB_BENCH_SHARED] / rate[LB_BENCH_PADDED]);
+
+		checked |= check;
+		failed |= below;
+	}
+
+	if (failed)
+		printf("FAILED: parallel efficiency below %.2f\n", threshold);
+	else if (checked)
+		printf("parallel efficiency at or above %.2f\n", threshold);
+	else
+		printf("parallel efficiency not checked: %s\n", threshold > 0 ? "no thread count has processors of its own beyond the first" : "no threshold");
+
+	LbStatsCleanup();
+	LbVerdictCacheCleanup();
+	LbRuleSetFree(rules);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+/*/
+/*  ** SlabBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures taking and returning objects from a slab against LbAlloc/LbFree (zeroed and cache line aligned,
+/*	as pool allocations are) and plain malloc/free, on 1 to N threads at once. Objects are the size of a flow
+/*	context and of an injected segment buffer; each thread either frees every object right away, like the
+/*	classify path does, or holds a batch of them first.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "Slab.h"
+
+enum LB_BENCH_ALLOCATOR
+{
+	LB_BENCH_SLAB = 0,
+	LB_BENCH_LBALLOC,
+	LB_BENCH_MALLOC,
+};
+
+static inline void* LbBenchAlloc(LB_BENCH_ALLOCATOR allocator, LB_SLAB* slab, SIZE_T size)
+{
+	switch (allocator)
+	{
+	case LB_BENCH_SLAB: return LbSlabAlloc(slab);
+	case LB_BENCH_LBALLOC: return LbAlloc(size, 'LBB0');
+	default: return malloc(size);
+	}
+}
+
+static inline void LbBenchFree(LB_BENCH_ALLOCATOR allocator, LB_SLAB* slab, void* object)
+{
+	switch (allocator)
+	{
+	case LB_BENCH_SLAB: LbSlabFree(slab, object); break;
+	case LB_BENCH_LBALLOC: LbFree(object, 'LBB0'); break;
+	default: free(object); break;
+	}
+}
+
+// ns per allocation and free pair, every thread doing operations of them
+static double LbBenchRun(LB_BENCH_ALLOCATOR allocator, SIZE_T size, UINT32 batch, UINT32 threads, UINT32 operations)
+{
+	LB_SLAB* slab = NULL;
+	if (!NT_SUCCESS(LbSlabCreate(size, 16, 'LBB0', &slab)))
+		return 0;
+
+	UINT64 elapsed = LbBenchRunThreads(threads, [&](UINT32) {
+		std::vector<void*> held(batch);
+
+		for (UINT32 n = 0; n < operations; n += batch)
+		{
+			for (UINT32 i = 0; i < batch; i++)
+			{
+				held[i] = LbBenchAlloc(allocator, slab, size);
+				*(volatile UINT8*)held[i] = 1;
+			}
+			for (UINT32 i = 0; i < batch; i++)
+				LbBenchFree(allocator, slab, held[i]);
+		}
+	});
+
+	LbSlabDestroy(slab);
+	return (double)elapsed / operations;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	const UINT32 operations = options.quick ? 1 << 12 : 1 << 22;
+	const SIZE_T sizes[] = { 256, 2048 };
+	const UINT32 batches[] = { 1, 16 };
+
+	printf("wall ns per allocation and free, per thread\n");
+	printf("%6s %6s %8s %8s %8s %8s %12s\n", "size", "batch", "threads", "slab", "LbAlloc", "malloc", "vs LbAlloc");
+
+	for (SIZE_T size : sizes)
+	{
+		for (UINT32 batch : batches)
+		{
+			for (UINT32 threads : LbBenchThreadCounts(options))
+			{
+				double slab = LbBenchRun(LB_BENCH_SLAB, size, batch, threads, operations);
+				double pool = LbBenchRun(LB_BENCH_LBALLOC, size, batch, threads, operations);
+				double heap = LbBenchRun(LB_BENCH_MALLOC, size, batch, threads, operations);
+
+				printf("%6zu %6u %8u %8.1f %8.1f %8.1f %11.1fx\n", size, batch, threads, slab, pool, heap, pool / slab);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*/
+/*  ** StaticMatcherBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares the three ways the built-in Love/Hate, Alice/Trudy, Rob/Bob pairs can be scanned in place, in
+/*	nanoseconds per 1460 byte payload: the runtime engine on the automaton LbMatcherCompile builds at load,
+/*	the runtime engine on the block the compiler built (LB_STATIC_MATCHER::Matcher) and the scan specialized
+/*	for the pairs (LB_STATIC_MATCHER::Replace). Payloads are lowercase text with no candidate at all, HTTP
+/*	with a few planted matches, random bytes, and text whose every word starts with one of the first bytes.
+/*	All three have to leave the same bytes behind.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "StaticMatcher.h"
+
+#define LB_BENCH_PAYLOADS 256
+
+// Same as LB_BUILTIN_PAIRS in InjectionCallout.cpp
+struct LB_BENCH_BUILTIN
+{
+	static constexpr LB_STATIC_RULES<3> Get()
+	{
+		return { true, { { "Love", "Hate" }, { "Alice", "Trudy" }, { "Rob", "Bob" } } };
+	}
+};
+
+typedef LB_STATIC_MATCHER<LB_BENCH_BUILTIN> LB_BENCH_MATCHER;
+
+static const char* LbBenchPatterns[] = { "Love", "Hate", "Alice", "Trudy", "Rob", "Bob" };
+
+// payloads of one kind, "dense" is text with every word starting on a first byte
+static std::vector<std::string> LbBenchPayloads(std::mt19937& rng, const char* kind)
+{
+	std::vector<std::string> payloads;
+
+	for (int i = 0; i < LB_BENCH_PAYLOADS; i++)
+	{
+		std::string kindName = kind;
+		std::string payload = LbBenchPayload(rng, kindName == "http" ? LB_BENCH_HTTP : kindName == "random" ? LB_BENCH_RANDOM : LB_BENCH_TEXT, 1460);
+
+		if (kindName == "http")
+		{
+			for (int n = 0; n < 4; n++)
+				LbBenchPlant(rng, payload, LbBenchPatterns[rng() % 6]);
+		}
+		else if (kindName == "dense")
+		{
+			for (size_t b = 0; b < payload.size(); b++)
+			{
+				if (b == 0 || payload[b - 1] == ' ')
+					payload[b] = "LHATRB"[rng() % 6];
+			}
+		}
+
+		payloads.push_back(payload);
+	}
+
+	return payloads;
+}
+
+// Median ns per payload of scanning every payload in place, over and over. Every pair reverses, so the
+// matches of one pass are undone by the next and each pass does the same work.
+template <typename SCAN>
+static double LbBenchScan(std::vector<std::string> payloads, UINT32 iterations, int rounds, SCAN scan)
+{
+	std::vector<UINT64> samples;
+
+	for (int round = 0; round < rounds; round++)
+	{
+		UINT64 replacements = 0;
+		UINT64 start = LbBenchNow();
+		for (UINT32 i = 0; i < iterations; i++)
+		{
+			std::string& payload = payloads[i % LB_BENCH_PAYLOADS];
+			UINT32 state = LB_MATCHER_ROOT_STATE;
+			replacements += scan(&state, (UINT8*)&payload[0], payload.size(), NULL, NULL);
+		}
+		samples.push_back((LbBenchNow() - start) * 1000 / iterations);
+		LbBenchKeep(replacements);
+	}
+
+	return LbBenchPercentile(samples, 0.5) / 1000.0;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	const UINT32 iterations = options.quick ? 1 << 10 : 1 << 18;
+	const int rounds = options.quick ? 1 : 9;
+	std::mt19937 rng(1);
+
+	LB_MATCH_AND_REPLACE pairs[LB_BENCH_MATCHER::pairCount];
+	LB_USERDATA ud;
+	LB_MATCHER* runtime = NULL;
+	const LB_MATCHER* fixed = LB_BENCH_MATCHER::Matcher();
+
+	LB_BENCH_MATCHER::UserData(pairs, &ud);
+	if (!NT_SUCCESS(LbMatcherCompile(&ud, &runtime)))
+		return 1;
+
+	auto compiled = [&](UINT32* state, UINT8* data, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits) {
+		return LbMatcherReplace(runtime, state, data, length, spans, edits);
+	};
+	auto block = [&](UINT32* state, UINT8* data, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits) {
+		return LbMatcherReplace(fixed, state, data, length, spans, edits);
+	};
+
+	printf("built-in pairs, 1460 byte payloads, median of %d rounds, ns per payload\n", rounds);
+	printf("tables: compiled at load %u B, built by the compiler %u B, narrowed for Replace %zu B\n",
+		runtime->size, fixed->size, sizeof(LB_BENCH_MATCHER::automaton));
+	printf("%-8s %10s %10s %10s %10s %9s\n", "payload", "matches", "compiled", "block", "static", "speedup");
+
+	int failed = 0;
+
+	for (const char* kind : { "text", "http", "random", "dense" })
+	{
+		std::vector<std::string> payloads = LbBenchPayloads(rng, kind);
+
+		// One pass of each on its own copy, all three have to agree
+		UINT64 matches = 0;
+		for (const std::string& payload : payloads)
+		{
+			std::string a = payload;
+			std::string b = payload;
+			std::string c = payload;
+			UINT32 state[3] = { LB_MATCHER_ROOT_STATE, LB_MATCHER_ROOT_STATE, LB_MATCHER_ROOT_STATE };
+			UINT32 found = compiled(&state[0], (UINT8*)&a[0], a.size(), NULL, NULL);
+
+			failed |= block(&state[1], (UINT8*)&b[0], b.size(), NULL, NULL) != found;
+			failed |= LB_BENCH_MATCHER::Replace(&state[2], (UINT8*)&c[0], c.size(), NULL, NULL) != found;
+			failed |= a != b || a != c || state[1] != state[2];
+			matches += found;
+		}
+
+		double compiledNs = LbBenchScan(payloads, iterations, rounds, compiled);
+		double blockNs = LbBenchScan(payloads, iterations, rounds, block);
+		double staticNs = LbBenchScan(payloads, iterations, rounds, LB_BENCH_MATCHER::Replace);
+
+		printf("%-8s %10.1f %10.1f %10.1f %10.1f %8.2fx\n", kind, (double)matches / LB_BENCH_PAYLOADS, compiledNs, blockNs,
+			staticNs, compiledNs / staticNs);
+	}
+
+	LbMatcherFree(runtime);
+	return failed;
+}
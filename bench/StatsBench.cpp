@@ -0,0 +1,120 @@
+/*/
+/*  ** StatsBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures what the statistics add to a classify call. The same stand-in call (a flow key read from an
+/*	array, a classifier lookup and a verdict) runs bare, with the counters only, and with the counters plus
+/*	the sampled stage timing LbClassifyInject does, on 1 to N threads. The cost of the pieces the overhead
+/*	is made of (LbCurrentProcessor, LbCycles) is printed alongside, they vary a lot between machines.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "Stats.h"
+#include "Classifier.h"
+
+#define LB_BENCH_FLOWS 4096		// Power of two
+
+enum LB_BENCH_MODE
+{
+	LB_BENCH_BARE = 0,
+	LB_BENCH_COUNTERS,
+	LB_BENCH_TIMED,
+};
+
+struct LB_BENCH_FLOW
+{
+	UINT32 remoteAddress;
+	UINT16 remotePort;
+};
+
+// One stand-in classify call, the statistics calls placed where LbClassifyInject has them
+template <LB_BENCH_MODE Mode>
+static inline LB_VERDICT LbBenchClassify(const LB_CLASSIFIER* classifier, const LB_BENCH_FLOW* flow)
+{
+	LB_STATS_PROCESSOR* stats = Mode != LB_BENCH_BARE ? LbStatsCurrent() : NULL;
+	BOOLEAN timed = Mode == LB_BENCH_TIMED && LbStatsSample(stats);
+	UINT64 start = timed ? LbCycles() : 0;
+	UINT64 mark = start;
+
+	UINT32 remoteAddress = flow->remoteAddress;
+	UINT16 remotePort = flow->remotePort;
+	if (timed) mark = LbStatsStage(stats, LB_STAGE_FIELDS, mark);
+
+	LB_VERDICT verdict = LbClassifierLookup(classifier, LB_DIRECTION_OUTBOUND, remoteAddress, remotePort);
+	if (timed) mark = LbStatsStage(stats, LB_STAGE_LOOKUP, mark);
+
+	if (Mode != LB_BENCH_BARE)
+	{
+		LbStatsCount(stats, LB_COUNTER_PACKETS);
+		if (verdict == LB_VERDICT_PERMIT) LbStatsCount(stats, LB_COUNTER_PERMITTED);
+		if (verdict == LB_VERDICT_BLOCK) LbStatsCount(stats, LB_COUNTER_BLOCKED);
+		if (verdict == LB_VERDICT_INSPECT) LbStatsCount(stats, LB_COUNTER_INSPECTED);
+	}
+	if (timed) LbStatsRecord(stats, LB_STAGE_CLASSIFY, LbCycles() - start);
+
+	return verdict;
+}
+
+template <LB_BENCH_MODE Mode>
+static double LbBenchRun(UINT32 threads, UINT32 calls, const LB_CLASSIFIER* classifier, const std::vector<LB_BENCH_FLOW>& flows)
+{
+	UINT64 elapsed = LbBenchRunThreads(threads, [&](UINT32 index) {
+		UINT32 verdicts = 0;
+		for (UINT32 i = 0; i < calls; i++)
+			verdicts += LbBenchClassify<Mode>(classifier, &flows[(i + index * 977) & (LB_BENCH_FLOWS - 1)]);
+		LbBenchKeep(verdicts);
+	});
+
+	return (double)elapsed * std::min(threads, LbProcessorCount()) / ((double)calls * threads);
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	const UINT32 calls = options.quick ? 1 << 12 : 1 << 24;
+	std::mt19937 rng(1);
+
+	LB_ADDRESS_RULE addressRules[] = { { 0xC0A80000, 16, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_PORT_RULE portRules[] = { { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_CLASSIFIER* classifier = NULL;
+	if (!NT_SUCCESS(LbClassifierCompile(addressRules, 1, portRules, 1, &classifier)) || !NT_SUCCESS(LbStatsInitialize()))
+		return 1;
+
+	std::vector<LB_BENCH_FLOW> flows(LB_BENCH_FLOWS);
+	for (LB_BENCH_FLOW& flow : flows)
+	{
+		flow.remoteAddress = rng() % 4 ? 0xC0A80000 | (rng() & 0xFFFF) : (UINT32)rng();
+		flow.remotePort = rng() % 2 ? 80 : (UINT16)rng();
+	}
+
+	UINT64 start = LbBenchNow();
+	for (UINT32 i = 0; i < calls; i++)
+		LbBenchKeep(LbCurrentProcessor());
+	double processorNs = (double)(LbBenchNow() - start) / calls;
+
+	start = LbBenchNow();
+	for (UINT32 i = 0; i < calls; i++)
+		LbBenchKeep(LbCycles());
+	double cyclesNs = (double)(LbBenchNow() - start) / calls;
+
+	printf("LbCurrentProcessor %.1f ns, LbCycles %.1f ns, one call in %u timed\n", processorNs, cyclesNs, LB_STATS_SAMPLE_INTERVAL);
+	printf("%8s %10s %10s %10s %14s %14s\n", "threads", "bare ns", "counted", "timed", "counters +ns", "all stats +ns");
+
+	for (UINT32 threads : LbBenchThreadCounts(options))
+	{
+		double bare = LbBenchRun<LB_BENCH_BARE>(threads, calls, classifier, flows);
+		double counted = LbBenchRun<LB_BENCH_COUNTERS>(threads, calls, classifier, flows);
+		double timed = LbBenchRun<LB_BENCH_TIMED>(threads, calls, classifier, flows);
+
+		printf("%8u %10.2f %10.2f %10.2f %14.2f %14.2f\n", threads, bare, counted, timed, counted - bare, timed - bare);
+	}
+
+	LbStatsCleanup();
+	LbClassifierFree(classifier);
+	return 0;
+}
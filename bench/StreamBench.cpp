@@ -0,0 +1,215 @@
+/*/
+/*  ** StreamBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Replays segmented TCP streams through the per-segment transport path and through the stream layer with
+/*	LbReplay.h, and compares the classify calls each one takes, the replacements it makes and MB/s of
+/*	stream data. The outgoing data of every flow is also rewritten as one buffer; the stream layer output
+/*	has to equal it, the per-segment path misses what a segment boundary cuts.
+/*
+/*	The synthetic runs cut eight outgoing streams into writes of 1 byte up to 1 to 1400 bytes, interleave
+/*	them, and write them as pcapng and read them back. Each stream is 1 MB, except with one byte writes,
+/*	where they are 128 KB so the capture stays in memory. --input takes a pcap or pcapng file instead.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "LbReplay.h"
+
+#define LB_BENCH_FLOWS 8
+
+// The in order outgoing TCP data of every flow of a capture, as the stream layer sees it
+static std::map<LB_FLOW_KEY, std::string> LbBenchStreams(const std::vector<LB_REPLAY_PACKET>& packets)
+{
+	std::map<LB_FLOW_KEY, std::string> streams;
+	std::map<LB_FLOW_KEY, UINT32> next;
+
+	for (const LB_REPLAY_PACKET& packet : packets)
+	{
+		LB_FLOW_KEY key = LbReplayKey(packet);
+		if (packet.protocol != LB_IPPROTO_TCP || key.direction != LB_DIRECTION_OUTBOUND)
+			continue;
+
+		UINT32 sequence = LbReadBe32(&packet.segment[4]);
+		SIZE_T length = packet.segment.size() - packet.headerLength;
+		auto found = next.find(key);
+		if (found != next.end() && found->second != sequence)
+			continue;
+
+		next[key] = sequence + (UINT32)length;
+		streams[key].append((const char*)&packet.segment[packet.headerLength], length);
+	}
+
+	return streams;
+}
+
+// Outgoing streams of LB_BENCH_FLOWS flows, cut into writes of 1 to maxWrite bytes sent in a random order
+static std::vector<LB_REPLAY_PACKET> LbBenchWrites(std::mt19937& rng, UINT32 maxWrite, size_t streamBytes)
+{
+	std::vector<std::string> data(LB_BENCH_FLOWS);
+	std::vector<size_t> offset(LB_BENCH_FLOWS);
+	std::vector<UINT32> live;
+	std::vector<LB_REPLAY_PACKET> packets;
+	UINT8 server[16] = { 192, 168, 0, 1 };
+
+	for (UINT32 flow = 0; flow < LB_BENCH_FLOWS; flow++)
+	{
+		while (data[flow].size() < streamBytes)
+		{
+			std::string text = LbBenchPayload(rng, LB_BENCH_TEXT, 64);
+			LbBenchPlant(rng, text, rng() % 2 ? "Alice" : "Love");
+			data[flow] += text;
+		}
+		live.push_back(flow);
+	}
+
+	while (!live.empty())
+	{
+		size_t pick = rng() % live.size();
+		UINT32 flow = live[pick];
+		size_t length = std::min<size_t>(1 + rng() % maxWrite, data[flow].size() - offset[flow]);
+		UINT8 client[16] = { 10, 0, 0, (UINT8)(1 + flow) };
+
+		packets.push_back(LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, client, server, (UINT16)(49152 + flow), 80,
+			1000 + (UINT32)offset[flow], data[flow].substr(offset[flow], length)));
+		packets.back().timestamp = 1700000000ull * 1000000000ull + packets.size() * 1000;
+
+		offset[flow] += length;
+		if (offset[flow] == data[flow].size())
+		{
+			live[pick] = live.back();
+			live.pop_back();
+		}
+	}
+
+	return packets;
+}
+
+static int LbBenchRun(const char* name, const std::vector<LB_REPLAY_PACKET>& packets, LB_RULESET* rules, int rounds)
+{
+	std::map<LB_FLOW_KEY, std::string> data = LbBenchStreams(packets);
+	std::map<LB_FLOW_KEY, std::vector<UINT8>> reference;
+	UINT64 bytes = 0;
+	UINT64 expected = 0;
+
+	for (const auto& entry : data)
+	{
+		std::vector<UINT8>& out = reference[entry.first];
+		out.resize(LbMatcherRewriteBound(rules->matcher, entry.second.size()));
+		UINT32 state = LB_MATCHER_ROOT_STATE;
+		SIZE_T written = 0;
+		expected += LbMatcherRewrite(rules->matcher, &state, (const UINT8*)entry.second.data(), entry.second.size(), out.data(), &written);
+		out.resize(written);
+		bytes += entry.second.size();
+	}
+
+	// Per segment: every packet is a transport layer call
+	LB_REPLAY_CORPUS corpus;
+	LbReplayBuild(packets, LB_REPLAY_LAYOUT(), &corpus);
+	rules->stream = FALSE;
+	LbVerdictCacheInvalidateAll();
+
+	LB_REPLAY_OUTPUT segmentOutput;
+	UINT64 segmentElapsed = 0;
+	for (int round = 0; round < rounds; round++)
+	{
+		LbReplayReset(&corpus);
+		segmentOutput = LB_REPLAY_OUTPUT();
+		UINT64 start = LbBenchNow();
+		for (const LB_REPLAY_CALL& call : corpus.calls)
+			LbReplayClassify(rules, &call, &segmentOutput);
+		segmentElapsed += LbBenchNow() - start;
+	}
+
+	// Stream layer: writes are collected into chunks, a match that may go on is held back for the next one
+	rules->stream = TRUE;
+	LbVerdictCacheInvalidateAll();
+
+	LB_REPLAY_OUTPUT streamOutput;
+	UINT64 streamElapsed = 0;
+	BOOLEAN same = TRUE;
+	for (int round = 0; round < rounds; round++)
+	{
+		std::map<LB_FLOW_KEY, LB_REPLAY_STREAM> streams;
+		streamOutput = LB_REPLAY_OUTPUT();
+		UINT64 start = LbBenchNow();
+		for (const LB_REPLAY_PACKET& packet : packets)
+			LbReplayStreamPacket(rules, &streams, packet, &streamOutput);
+		LbReplayStreamClose(rules, &streams, &streamOutput);
+		streamElapsed += LbBenchNow() - start;
+
+		for (const auto& entry : streams)
+			same = same && entry.second.sent == reference[entry.first];
+	}
+
+	printf("%-9s %6.1f %9zu %9llu  %9llu %8.0f %9llu  %9llu %9llu %9llu %8.0f  %4s\n", name, bytes / 1e6, packets.size(),
+		(unsigned long long)expected, (unsigned long long)segmentOutput.calls, bytes * rounds / 1e6 / (segmentElapsed / 1e9),
+		(unsigned long long)segmentOutput.replacements, (unsigned long long)streamOutput.calls, (unsigned long long)streamOutput.streamWaits,
+		(unsigned long long)streamOutput.replacements, bytes * rounds / 1e6 / (streamElapsed / 1e9), same ? "yes" : "NO");
+
+	return same ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const int rounds = options.quick ? 1 : 5;
+	int failed = 0;
+
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Love", (char*)"Loathing" }, { (char*)"Alice", (char*)"Eve" } };
+	LB_PORT_RULE portRules[] = { { 0, 65535, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_USERDATA ud;
+	ud.count = 2;
+	ud.strArray = pairs;
+
+	LB_RULESET* rules = NULL;
+	if (!NT_SUCCESS(LbVerdictCacheInitialize()) || !NT_SUCCESS(LbStatsInitialize()) ||
+		!NT_SUCCESS(LbRuleSetCompile(NULL, 0, portRules, 1, &ud, 0, &rules)))
+		return 1;
+
+	// What a rule set asks for in LB_RULES_HEADER: a full segment per scan, the longest match less one held back
+	rules->streamChunk = 1460;
+	rules->streamLookahead = 4;
+
+	printf("%u byte chunks, %u byte lookahead, %d rounds\n", rules->streamChunk, rules->streamLookahead, rounds);
+	printf("%-9s %6s %9s %9s  %29s  %39s\n", "", "", "", "", "per segment", "stream layer");
+	printf("%-9s %6s %9s %9s  %9s %8s %9s  %9s %9s %9s %8s  %4s\n", "max write", "MB", "packets", "matches",
+		"calls", "MB/s", "replaced", "calls", "waits", "replaced", "MB/s", "same");
+
+	if (options.input)
+	{
+		std::vector<LB_REPLAY_PACKET> packets;
+		LB_REPLAY_READ_STATS read = {};
+		if (!NT_SUCCESS(LbReplayReadCapture(options.input, &packets, &read)) || packets.empty())
+		{
+			fprintf(stderr, "no TCP or UDP packets to replay\n");
+			return 1;
+		}
+		failed |= LbBenchRun("capture", packets, rules, rounds);
+	}
+	else
+	{
+		for (UINT32 maxWrite : { 1u, 40u, 200u, 1400u })
+		{
+			size_t streamBytes = options.quick ? (16 << 10) : maxWrite == 1 ? (128 << 10) : (1 << 20);
+			std::vector<LB_REPLAY_PACKET> synthetic = LbBenchWrites(rng, maxWrite, streamBytes);
+			std::vector<UINT8> capture = LbReplayWritePcapng(synthetic, LB_REPLAY_LINKTYPE_ETHERNET);
+			std::vector<LB_REPLAY_PACKET> packets;
+			LB_REPLAY_READ_STATS read = {};
+			if (!NT_SUCCESS(LbReplayParseCapture(capture.data(), capture.size(), &packets, &read)))
+				return 1;
+
+			failed |= LbBenchRun((std::to_string(maxWrite) + " B").c_str(), packets, rules, rounds);
+		}
+	}
+
+	LbRuleSetFree(rules);
+	LbStatsCleanup();
+	LbVerdictCacheCleanup();
+	return failed;
+}
@@ -0,0 +1,158 @@
+/*/
+/*  ** VerdictCacheBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Measures verdict cache hits on 1 to N threads over one shared set of flows, as processors classifying
+/*	packets of the same connections would: lookups per second, ns per lookup and the latency percentiles
+/*	of batches of lookups. A second run adds a thread that keeps inserting, so readers race writers.
+/*	The rule evaluation a hit saves is timed alongside for comparison.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "VerdictCache.h"
+#include "RuleSet.h"
+
+#define LB_BENCH_FLOWS	2048		// Live flows, half the buckets
+#define LB_BENCH_BATCH	32			// Lookups timed together, a single lookup is shorter than the clock read
+
+static LB_FLOW_KEY LbBenchFlow(UINT32 index)
+{
+	LB_FLOW_KEY key = {};
+	key.localAddress = 0x0A000000 | (index >> 8);
+	key.remoteAddress = 0xC0A80001 + (index & 0x0F);
+	key.localPort = (UINT16)(1024 + (index & 0xFF));
+	key.remotePort = 443;
+	key.protocol = LB_IPPROTO_TCP;
+	key.direction = LB_DIRECTION_OUTBOUND;
+	key.family = LB_FAMILY_IPV4;
+	return key;
+}
+
+static void LbBenchLookups(const LB_BENCH_OPTIONS& options, BOOLEAN writer)
+{
+	const UINT32 lookups = options.quick ? 1 << 14 : 1 << 23;
+	std::vector<LB_FLOW_KEY> flows;
+
+	for (UINT32 i = 0; i < LB_BENCH_FLOWS; i++)
+		flows.push_back(LbBenchFlow(i));
+
+	printf("%s\n", writer ? "with one thread inserting" : "lookups only");
+	printf("%8s %12s %12s %9s %9s %9s %8s\n", "threads", "Mlookups/s", "ns/lookup", "p50 ns", "p99 ns", "p99.9 ns", "hits");
+
+	for (UINT32 threads : LbBenchThreadCounts(options))
+	{
+		std::vector<std::vector<UINT64>> samples(threads);
+		std::vector<UINT64> hits(threads * 8);		// A cache line apart
+		std::atomic<bool> stop(false);
+		std::thread inserter;
+
+		for (const LB_FLOW_KEY& key : flows)
+			LbVerdictCacheInsert(&key, LB_VERDICT_PERMIT);
+
+		if (writer)
+		{
+			inserter = std::thread([&]() {
+				for (UINT32 i = 0; !stop.load(); i++)
+					LbVerdictCacheInsert(&flows[(i * 7919) % LB_BENCH_FLOWS], LB_VERDICT_PERMIT);
+			});
+		}
+
+		UINT64 elapsed = LbBenchRunThreads(threads, [&](UINT32 index) {
+			std::vector<UINT64>& times = samples[index];
+			UINT32 next = index * 977;
+			UINT64 found = 0;
+
+			times.reserve(lookups / LB_BENCH_BATCH);
+			for (UINT32 batch = 0; batch < lookups / LB_BENCH_BATCH; batch++)
+			{
+				UINT64 start = LbBenchNow();
+				for (UINT32 n = 0; n < LB_BENCH_BATCH; n++)
+				{
+					next = (next + 613) & (LB_BENCH_FLOWS - 1);
+					found += LbVerdictCacheLookup(&flows[next]) != LB_VERDICT_NONE;
+				}
+				times.push_back(LbBenchNow() - start);
+			}
+
+			hits[index * 8] = found;
+		});
+
+		stop = true;
+		if (inserter.joinable())
+			inserter.join();
+
+		std::vector<UINT64> all;
+		UINT64 found = 0;
+		for (UINT32 t = 0; t < threads; t++)
+		{
+			all.insert(all.end(), samples[t].begin(), samples[t].end());
+			found += hits[t * 8];
+		}
+
+		double total = (double)lookups * threads;
+		printf("%8u %12.1f %12.1f %9.1f %9.1f %9.1f %7.1f%%\n", threads, total / (elapsed / 1e3),
+			(double)elapsed * threads / total,
+			LbBenchPercentile(all, 0.5) / (double)LB_BENCH_BATCH,
+			LbBenchPercentile(all, 0.99) / (double)LB_BENCH_BATCH,
+			LbBenchPercentile(all, 0.999) / (double)LB_BENCH_BATCH,
+			100.0 * found / total);
+	}
+
+	printf("\n");
+}
+
+// What a miss costs instead: evaluating a rule set of ruleCount address rules
+static void LbBenchEvaluate(const LB_BENCH_OPTIONS& options, UINT32 ruleCount)
+{
+	std::vector<LB_ADDRESS_RULE> rules(ruleCount);
+	std::mt19937 rng(1);
+
+	for (LB_ADDRESS_RULE& rule : rules)
+	{
+		rule.address = rng();
+		rule.prefixLength = 16 + rng() % 17;
+		rule.action = LB_RULE_ACTION_BLOCK;
+		rule.directions = LB_RULE_DIRECTION_BOTH;
+	}
+
+	LB_MATCH_AND_REPLACE pair = { (char*)"Love", (char*)"Hate" };
+	LB_USERDATA ud;
+	ud.count = 1;
+	ud.strArray = &pair;
+
+	LB_RULESET* ruleSet = NULL;
+	if (!NT_SUCCESS(LbRuleSetCompile(rules.data(), ruleCount, NULL, 0, &ud, 0, &ruleSet)))
+		return;
+
+	const UINT32 lookups = options.quick ? 1 << 12 : 1 << 22;
+	UINT64 start = LbBenchNow();
+	for (UINT32 i = 0; i < lookups; i++)
+	{
+		LB_FLOW_KEY key = LbBenchFlow(i & (LB_BENCH_FLOWS - 1));
+		LbBenchKeep(LbRuleSetEvaluate(ruleSet, &key, LB_DIRECTION_OUTBOUND));
+	}
+
+	printf("rule evaluation, %u address rules: %.1f ns\n", ruleCount, (double)(LbBenchNow() - start) / lookups);
+	LbRuleSetFree(ruleSet);
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+
+	if (!NT_SUCCESS(LbVerdictCacheInitialize()))
+		return 1;
+
+	LbBenchLookups(options, FALSE);
+	LbBenchLookups(options, TRUE);
+	LbBenchEvaluate(options, 10);
+	LbBenchEvaluate(options, 1000);
+
+	LbVerdictCacheCleanup();
+	return 0;
+}
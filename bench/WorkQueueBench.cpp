@@ -0,0 +1,227 @@
+/*/
+/*  ** WorkQueueBench.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compares inspecting segments inline on the classify path with handing them to worker threads through
+/*	the work queues, under bursty load. Producers stand in for the classify path: each owns a share of the
+/*	flows and releases their 1460 byte segments in bursts on a fixed schedule, at a fraction of what one
+/*	processor can inspect. Inline, the producer runs the match engine itself; queued, it pushes the segment
+/*	onto its flow's lane and a worker per lane inspects batches of up to 32, as the driver's workers do.
+/*
+/*	Prints segments per second, how long the classify path was held per segment and the latency from a
+/*	segment's scheduled arrival to the end of its inspection. A push onto a full lane is inspected inline
+/*	and counted. Every run uses as many producers as workers, --threads of each (every processor unless
+/*	given); on a single processor they all share it and the queued latencies include the switches.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State University�s CS 492 course.
+/*/
+
+#include "LbBench.h"
+#include "MatchEngine.h"
+#include "WorkQueue.h"
+
+#define LB_BENCH_SEGMENT 1460
+#define LB_BENCH_BATCH 32
+
+// A segment on its way, the work item comes first so an item pointer is a segment pointer
+struct LB_BENCH_SEGMENT_ITEM
+{
+	LB_WORK_ITEM work;
+	UINT32 flow;
+	UINT32 payload;
+	UINT64 scheduled;			// LbBenchNow() the segment arrives at
+	UINT64 done;				// LbBenchNow() its inspection finished at
+};
+
+// Latency samples of one thread, padded apart from the next thread's
+struct LB_BENCH_THREAD
+{
+	std::vector<UINT64> held;
+	std::vector<UINT8> output;
+	UINT64 fallbacks;			// Segments inspected inline because their lane was full
+	UINT8 padding[64];
+};
+
+struct LB_BENCH_RUN
+{
+	const LB_MATCHER* matcher;
+	const std::vector<std::string>* payloads;
+	std::vector<LB_BENCH_SEGMENT_ITEM>* segments;
+	std::vector<std::vector<UINT32>> owned;	// Segments of each producer in the order they arrive
+};
+
+static void LbBenchInspect(const LB_BENCH_RUN* run, LB_BENCH_SEGMENT_ITEM* segment, LB_BENCH_THREAD* thread)
+{
+	const std::string& payload = (*run->payloads)[segment->payload];
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	SIZE_T written = 0;
+
+	LbBenchKeep(LbMatcherRewrite(run->matcher, &state, (const UINT8*)payload.data(), payload.size(), thread->output.data(), &written));
+	segment->done = LbBenchNow();
+}
+
+// Release a producer's segments on schedule, inspecting each inline or queueing it
+static void LbBenchProduce(LB_BENCH_RUN* run, LB_WORK_QUEUE* queue, UINT32 producer, LB_BENCH_THREAD* thread)
+{
+	for (UINT32 index : run->owned[producer])
+	{
+		LB_BENCH_SEGMENT_ITEM* segment = &(*run->segments)[index];
+
+		// Yield the wait, as the classify path leaves the processor to others between packets
+		while (LbBenchNow() < segment->scheduled)
+			std::this_thread::yield();
+
+		UINT64 start = LbBenchNow();
+		BOOLEAN wake;
+
+		if (!queue)
+			LbBenchInspect(run, segment, thread);
+		else if (!LbWorkQueuePush(queue, LbWorkQueueLane(queue, segment->flow), &segment->work, &wake))
+		{
+			LbBenchInspect(run, segment, thread);
+			thread->fallbacks++;
+		}
+
+		thread->held.push_back(LbBenchNow() - start);
+	}
+}
+
+static void LbBenchWork(LB_BENCH_RUN* run, LB_WORK_QUEUE* queue, UINT32 lane, std::atomic<UINT32>* producing, LB_BENCH_THREAD* thread)
+{
+	LB_WORK_ITEM* items[LB_BENCH_BATCH];
+
+	for (;;)
+	{
+		BOOLEAN done = producing->load() == 0;
+		UINT32 count = LbWorkQueuePop(queue, lane, items, LB_BENCH_BATCH);
+
+		for (UINT32 i = 0; i < count; i++)
+			LbBenchInspect(run, (LB_BENCH_SEGMENT_ITEM*)items[i], thread);
+
+		if (count == 0)
+		{
+			if (done)
+				break;
+			std::this_thread::yield();
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	LB_BENCH_OPTIONS options = LbBenchParse(argc, argv);
+	std::mt19937 rng(1);
+	const UINT32 threads = options.threads ? options.threads : LbProcessorCount();
+	const UINT32 segmentCount = options.quick ? 4096 : 200000;
+	const UINT32 flowCount = 1024;
+
+	std::vector<std::string> words = LbBenchWords(rng, 4, 5, 8);
+	std::vector<LB_MATCH_AND_REPLACE> pairs(words.size());
+	for (size_t i = 0; i < words.size(); i++)
+		pairs[i] = { (char*)words[i].c_str(), (char*)words[(i + 1) % words.size()].c_str() };
+
+	LB_USERDATA ud;
+	ud.count = (int)pairs.size();
+	ud.strArray = pairs.data();
+	LB_MATCHER* matcher = NULL;
+	if (!NT_SUCCESS(LbMatcherCompile(&ud, &matcher)))
+		return 1;
+
+	std::vector<std::string> payloads;
+	for (UINT32 n = 0; n < 1024; n++)
+	{
+		payloads.push_back(LbBenchPayload(rng, LB_BENCH_HTTP, LB_BENCH_SEGMENT));
+		if (n % 4 == 0)
+			LbBenchPlant(rng, payloads.back(), words[rng() % words.size()]);
+	}
+
+	std::vector<LB_BENCH_SEGMENT_ITEM> segments(segmentCount);
+	for (UINT32 i = 0; i < segmentCount; i++)
+	{
+		segments[i].flow = rng() % flowCount;
+		segments[i].payload = rng() % (UINT32)payloads.size();
+	}
+
+	// What one processor inspects per segment, the schedule is a fraction of it
+	LB_BENCH_RUN run = { matcher, &payloads, &segments, {} };
+	LB_BENCH_THREAD calibration = {};
+	calibration.output.resize(LbMatcherRewriteBound(matcher, LB_BENCH_SEGMENT));
+	UINT64 start = LbBenchNow();
+	for (UINT32 i = 0; i < segmentCount; i++)
+		LbBenchInspect(&run, &segments[i], &calibration);
+	const double inspectNs = (double)(LbBenchNow() - start) / segmentCount;
+
+	run.owned.resize(threads);
+	for (UINT32 i = 0; i < segmentCount; i++)
+		run.owned[segments[i].flow % threads].push_back(i);
+
+	printf("%u segments of %u bytes over %u flows, %u producers and %u workers on %u processors, %.0f ns to inspect one\n",
+		segmentCount, LB_BENCH_SEGMENT, flowCount, threads, threads, LbProcessorCount(), inspectNs);
+	printf("%-7s %5s %5s  %11s  %10s %10s  %10s %10s %10s  %8s\n", "mode", "load", "burst", "Msegments/s",
+		"held p50", "held p99", "lat p50 us", "lat p99 us", "lat p99.9", "inline");
+
+	for (double load : { 0.5, 0.9 })
+	{
+		for (UINT32 burst : { 1u, 64u })
+		{
+			for (BOOLEAN queued : { FALSE, TRUE })
+			{
+				// Bursts of a producer start burst segments' worth of inspection apart, divided by the load
+				UINT64 begin = LbBenchNow() + 5000000;
+				for (const std::vector<UINT32>& owned : run.owned)
+				{
+					for (size_t n = 0; n < owned.size(); n++)
+						segments[owned[n]].scheduled = begin + (UINT64)((n / burst) * burst * inspectNs / load);
+				}
+
+				LB_WORK_QUEUE* queue = NULL;
+				if (queued && !NT_SUCCESS(LbWorkQueueCreate(threads, 4096, 'LBB0', &queue)))
+					return 1;
+
+				std::vector<LB_BENCH_THREAD> state(threads * 2);
+				for (LB_BENCH_THREAD& thread : state)
+					thread.output.resize(LbMatcherRewriteBound(matcher, LB_BENCH_SEGMENT));
+
+				std::atomic<UINT32> producing(threads);
+				LbBenchRunThreads(queued ? threads * 2 : threads, [&](UINT32 index) {
+					if (index < threads)
+					{
+						LbBenchProduce(&run, queue, index, &state[index]);
+						producing--;
+					}
+					else
+						LbBenchWork(&run, queue, index - threads, &producing, &state[index]);
+				});
+
+				std::vector<UINT64> held;
+				std::vector<UINT64> latency;
+				UINT64 last = begin;
+				UINT64 inlined = 0;
+				for (const LB_BENCH_THREAD& thread : state)
+				{
+					held.insert(held.end(), thread.held.begin(), thread.held.end());
+					inlined += thread.fallbacks;
+				}
+				for (const LB_BENCH_SEGMENT_ITEM& segment : segments)
+				{
+					latency.push_back(segment.done - segment.scheduled);
+					last = std::max(last, segment.done);
+				}
+
+				printf("%-7s %5.1f %5u  %11.3f  %10llu %10llu  %10.1f %10.1f %10.1f  %8llu\n", queued ? "queued" : "inline", load, burst,
+					segmentCount / ((last - begin) / 1e3),
+					(unsigned long long)LbBenchPercentile(held, 0.5), (unsigned long long)LbBenchPercentile(held, 0.99),
+					LbBenchPercentile(latency, 0.5) / 1e3, LbBenchPercentile(latency, 0.99) / 1e3, LbBenchPercentile(latency, 0.999) / 1e3,
+					(unsigned long long)inlined);
+
+				LbWorkQueueDestroy(queue);
+			}
+		}
+	}
+
+	LbMatcherFree(matcher);
+	return 0;
+}
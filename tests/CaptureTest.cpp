@@ -0,0 +1,797 @@
+/*/
+/*  ** CaptureTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of packet capture: capture rules and sections refused when they are malformed, the
+/*	first covering rule deciding, one in N packets sampled, records read back as pcapng that LbReplay.h
+/*	parses into the packets that were offered, full rings counting their drops and wrapping, sections a
+/*	reader scribbled over, and writers racing a reader with every record accounted for.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "Capture.h"
+#include "Checksum.h"
+#include "LbReplay.h"
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+// Zeroed memory for a section, 8 byte aligned like the pages the driver maps
+struct LB_TEST_SECTION
+{
+	std::vector<UINT64> memory;
+	SIZE_T size;
+	LB_CAPTURE* capture;
+
+	UINT8* Data() { return (UINT8*)memory.data(); }
+	LB_CAPTURE_SECTION* Header() { return (LB_CAPTURE_SECTION*)memory.data(); }
+	LB_CAPTURE_RING* Ring(UINT32 index) { return (LB_CAPTURE_RING*)(Data() + Header()->ringOffset + (SIZE_T)index * Header()->ringStride); }
+};
+
+static BOOLEAN LbTestSectionCreate(LB_TEST_SECTION* section, UINT32 ringCount, UINT32 ringSize)
+{
+	section->size = LbCaptureSectionSize(ringCount, ringSize);
+	section->memory.assign(section->size / sizeof(UINT64), 0);
+	section->capture = NULL;
+	return NT_SUCCESS(LbCaptureCreate(section->Data(), section->size, ringCount, ringSize, &section->capture));
+}
+
+// A rule that covers every packet and captures all of it
+static LB_CAPTURE_RULE LbTestRule()
+{
+	LB_CAPTURE_RULE rule = {};
+	rule.directions = LB_RULE_DIRECTION_BOTH;
+	rule.actions = LB_CAPTURE_ACTION_ALL;
+	rule.lastPort = 65535;
+	rule.sampleRate = 1;
+	rule.snapLength = LB_CAPTURE_MAX_SNAP;
+	return rule;
+}
+
+static std::vector<UINT8> LbTestRulesBuffer(const std::vector<LB_CAPTURE_RULE>& rules)
+{
+	LB_CAPTURE_RULES_HEADER header = { LB_CAPTURE_RULES_VERSION, (UINT32)rules.size() };
+	std::vector<UINT8> buffer(sizeof(header) + sizeof(LB_CAPTURE_RULE) * rules.size());
+
+	memcpy(buffer.data(), &header, sizeof(header));
+	if (!rules.empty())
+		memcpy(buffer.data() + sizeof(header), rules.data(), sizeof(LB_CAPTURE_RULE) * rules.size());
+	return buffer;
+}
+
+static LB_CAPTURE_FILTER* LbTestFilter(const std::vector<LB_CAPTURE_RULE>& rules)
+{
+	std::vector<UINT8> buffer = LbTestRulesBuffer(rules);
+	LB_CAPTURE_FILTER* filter = NULL;
+
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbCaptureFilterParse(buffer.data(), buffer.size(), &filter));
+	return filter;
+}
+
+// A packet as the classify path offers it, with the addresses and data it points to
+struct LB_TEST_PACKET
+{
+	UINT8 local[16];
+	UINT8 remote[16];
+	std::vector<UINT8> data;
+	LB_CAPTURE_PACKET packet;
+};
+
+static void LbTestPacketInitialize(LB_TEST_PACKET* test, UINT8 family, UINT8 protocol, UINT8 direction, UINT8 action,
+	UINT32 remoteAddress, UINT16 remotePort, std::vector<UINT8> data)
+{
+	memset(test->local, 0, sizeof(test->local));
+	memset(test->remote, 0, sizeof(test->remote));
+	if (family == LB_FAMILY_IPV4)
+	{
+		LbWriteBe32(test->local, 0xC0A80002);
+		LbWriteBe32(test->remote, remoteAddress);
+	}
+	else
+	{
+		test->local[0] = 0xFD;
+		test->local[15] = 2;
+		test->remote[0] = 0x20;
+		test->remote[1] = 0x01;
+		LbWriteBe32(&test->remote[12], remoteAddress);
+	}
+
+	test->data = std::move(data);
+	test->packet = LB_CAPTURE_PACKET();
+	test->packet.localAddress = test->local;
+	test->packet.remoteAddress = test->remote;
+	test->packet.localPort = 49152;
+	test->packet.remotePort = remotePort;
+	test->packet.family = family;
+	test->packet.protocol = protocol;
+	test->packet.direction = direction;
+	test->packet.action = action;
+	test->packet.length = (UINT32)test->data.size();
+}
+
+// What the classify path does with a packet, returns whether it was captured
+static BOOLEAN LbTestOffer(LB_CAPTURE* capture, const LB_CAPTURE_FILTER* filter, const LB_TEST_PACKET& test, UINT32* rule = NULL)
+{
+	LB_CAPTURE_SLOT slot;
+
+	if (!LbCaptureBegin(capture, filter, &test.packet, &slot))
+		return FALSE;
+
+	UINT32 length = std::min<UINT32>(slot.capacity, (UINT32)test.data.size());
+	memcpy(slot.data, test.data.data(), length);
+	if (rule)
+		*rule = slot.record->rule;
+	LbCaptureEnd(capture, &slot, length);
+	return TRUE;
+}
+
+// Every record in the section as a pcapng file, drained into output buffers of capacity bytes
+static std::vector<UINT8> LbTestDrain(LB_CAPTURE_READER* reader, const LB_PCAPNG_CLOCK& clock, SIZE_T capacity, UINT64* dropped)
+{
+	std::vector<UINT8> file(64);
+	std::vector<UINT8> output(capacity);
+	SIZE_T written;
+
+	file.resize(LbPcapngWriteHeader(file.data(), file.size()));
+	*dropped = 0;
+
+	do
+	{
+		UINT64 lost = 0;
+		written = LbCaptureDrainPcapng(reader, &clock, output.data(), output.size(), &lost);
+		file.insert(file.end(), output.begin(), output.begin() + written);
+		*dropped += lost;
+	} while (written != 0);
+
+	return file;
+}
+
+// What an enhanced packet block holds
+struct LB_TEST_BLOCK
+{
+	UINT64 time;
+	UINT32 flags;
+	std::string comment;
+	std::vector<UINT8> data;	// Starting with the IP header
+	UINT32 originalLength;
+};
+
+// Walk a pcapng file the way a strict reader would. Returns FALSE on the first block that is malformed.
+static BOOLEAN LbTestBlocks(const std::vector<UINT8>& file, std::vector<LB_TEST_BLOCK>* blocks)
+{
+	for (SIZE_T offset = 0; offset < file.size(); )
+	{
+		UINT32 type;
+		UINT32 length;
+		UINT32 trailer;
+
+		if (file.size() - offset < 12)
+			return FALSE;
+		memcpy(&type, &file[offset], 4);
+		memcpy(&length, &file[offset + 4], 4);
+		if (length < 12 || length % 4 != 0 || length > file.size() - offset)
+			return FALSE;
+		memcpy(&trailer, &file[offset + length - 4], 4);
+		if (trailer != length)
+			return FALSE;
+
+		if (type == 6)
+		{
+			const UINT8* body = &file[offset + 8];
+			UINT32 high, low, captured, original;
+			LB_TEST_BLOCK block = {};
+
+			memcpy(&high, body + 4, 4);
+			memcpy(&low, body + 8, 4);
+			memcpy(&captured, body + 12, 4);
+			memcpy(&original, body + 16, 4);
+			if (28 + ((captured + 3) & ~3u) > length - 4)
+				return FALSE;
+
+			block.time = (UINT64)high << 32 | low;
+			block.data.assign(body + 20, body + 20 + captured);
+			block.originalLength = original;
+
+			// Options up to the end of the block, the last one has to be opt_endofopt
+			SIZE_T option = offset + 28 + ((captured + 3) & ~3u);
+			SIZE_T end = offset + length - 4;
+			BOOLEAN ended = FALSE;
+			while (option + 4 <= end && !ended)
+			{
+				UINT16 code, optionLength;
+				memcpy(&code, &file[option], 2);
+				memcpy(&optionLength, &file[option + 2], 2);
+				if (option + 4 + optionLength > end)
+					return FALSE;
+
+				if (code == 1)
+					block.comment.assign((const char*)&file[option + 4], optionLength);
+				else if (code == 2 && optionLength == 4)
+					memcpy(&block.flags, &file[option + 4], 4);
+				ended = code == 0;
+				option += 4 + ((optionLength + 3) & ~3u);
+			}
+			if (!ended || option != end)
+				return FALSE;
+
+			blocks->push_back(block);
+		}
+
+		offset += length;
+	}
+
+	return TRUE;
+}
+
+static std::vector<UINT8> LbTestBytes(std::mt19937& rng, SIZE_T length)
+{
+	std::vector<UINT8> data(length);
+
+	for (UINT8& byte : data)
+		byte = (UINT8)rng();
+	return data;
+}
+
+// Pinned, so every record and countdown is on the same processor
+struct LB_TEST_PIN
+{
+	cpu_set_t previous;
+
+	LB_TEST_PIN()
+	{
+		cpu_set_t set;
+		pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous);
+		CPU_ZERO(&set);
+		CPU_SET(0, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	~LB_TEST_PIN()
+	{
+		pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+	}
+};
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(SectionsAndRulesRejectBadInput)
+{
+	std::vector<UINT64> memory(LbCaptureSectionSize(2, 8192) / sizeof(UINT64));
+	LB_CAPTURE* capture = NULL;
+
+	LB_CHECK_EQUAL(0, LbCaptureSectionSize(2, 8192) % 4096);
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureCreate(memory.data(), memory.size() * 8, 2, 8192 + 4096, &capture));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureCreate(memory.data(), memory.size() * 8, 2, 2048, &capture));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureCreate(memory.data(), memory.size() * 8, 0, 8192, &capture));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureCreate(memory.data(), memory.size() * 8 - 4096, 2, 8192, &capture));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureCreate(NULL, memory.size() * 8, 2, 8192, &capture));
+	LB_CHECK(capture == NULL);
+
+	// Each field out of range on its own
+	std::vector<LB_CAPTURE_RULE> bad(10, LbTestRule());
+	bad[0].prefixLength = 33;
+	bad[1].firstPort = 81;
+	bad[1].lastPort = 80;
+	bad[2].directions = 0;
+	bad[3].directions = 4;
+	bad[4].actions = 0;
+	bad[5].actions = 8;
+	bad[6].snapLength = LB_CAPTURE_MAX_SNAP + 1;
+	bad[7].flags = 2;
+	bad[8].directions = LB_RULE_DIRECTION_INBOUND;
+	bad[9].prefixLength = 32;
+
+	UINT32 accepted = 0;
+	for (SIZE_T i = 0; i < bad.size(); i++)
+	{
+		std::vector<LB_CAPTURE_RULE> rules = { LbTestRule(), bad[i] };
+		std::vector<UINT8> buffer = LbTestRulesBuffer(rules);
+		LB_CAPTURE_FILTER* filter = NULL;
+
+		NTSTATUS status = LbCaptureFilterParse(buffer.data(), buffer.size(), &filter);
+		accepted += NT_SUCCESS(status);
+		LbCaptureFilterFree(filter);
+	}
+	LB_CHECK_EQUAL(2, accepted);
+
+	std::vector<UINT8> buffer = LbTestRulesBuffer(std::vector<LB_CAPTURE_RULE>(3, LbTestRule()));
+	LB_CAPTURE_FILTER* filter = NULL;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureFilterParse(buffer.data(), buffer.size() - 1, &filter));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureFilterParse(buffer.data(), 4, &filter));
+	((LB_CAPTURE_RULES_HEADER*)buffer.data())->version = 2;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureFilterParse(buffer.data(), buffer.size(), &filter));
+
+	buffer = LbTestRulesBuffer(std::vector<LB_CAPTURE_RULE>(LB_CAPTURE_MAX_RULES + 1, LbTestRule()));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureFilterParse(buffer.data(), buffer.size(), &filter));
+
+	// No rules turns capture off
+	buffer = LbTestRulesBuffer(std::vector<LB_CAPTURE_RULE>());
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbCaptureFilterParse(buffer.data(), buffer.size(), &filter));
+	LB_CHECK(filter == NULL);
+}
+
+LB_TEST(FirstCoveringRuleDecides)
+{
+	LB_TEST_SECTION section;
+	if (!LB_CHECK(LbTestSectionCreate(&section, 1, 1 << 16)))
+		return;
+
+	std::vector<LB_CAPTURE_RULE> rules(5, LbTestRule());
+	rules[0].protocol = LB_IPPROTO_TCP;
+	rules[0].directions = LB_RULE_DIRECTION_OUTBOUND;
+	rules[0].actions = LB_CAPTURE_ACTION_BLOCK;
+	rules[0].firstPort = rules[0].lastPort = 443;
+	rules[1].address = 0x0A0B0C0D;		// Cut down to 10.0.0.0/8
+	rules[1].prefixLength = 8;
+	rules[2].flags = LB_CAPTURE_RULE_REWRITTEN_ONLY;
+	rules[3].sampleRate = 0;			// Covers UDP, captures none of it
+	rules[3].protocol = LB_IPPROTO_UDP;
+	rules[4].actions = LB_CAPTURE_ACTION_INSPECT;
+
+	LB_CAPTURE_FILTER* filter = LbTestFilter(rules);
+	if (!filter)
+		return;
+
+	struct
+	{
+		UINT8 family;
+		UINT8 protocol;
+		UINT8 direction;
+		UINT8 action;
+		UINT8 flags;
+		UINT32 address;
+		UINT16 port;
+		INT32 rule;						// -1 when not captured
+	}
+	cases[] =
+	{
+		{ LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_BLOCK, 0, 0x08080808, 443, 0 },
+		{ LB_FAMILY_IPV6, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_BLOCK, 0, 0x08080808, 443, 0 },
+		{ LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_BLOCK, 0, 0x0AFFFFFF, 443, 1 },
+		{ LB_FAMILY_IPV4, LB_IPPROTO_UDP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_BLOCK, 0, 0x0A000001, 443, 1 },
+		{ LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT, 0, 0x0B000001, 443, -1 },
+		{ LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT, LB_CAPTURE_FLAG_REWRITTEN, 0x0B000001, 80, 2 },
+		{ LB_FAMILY_IPV6, LB_IPPROTO_TCP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_PERMIT, LB_CAPTURE_FLAG_REWRITTEN, 0x0A000001, 80, 2 },
+		{ LB_FAMILY_IPV4, LB_IPPROTO_UDP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_INSPECT, 0, 0x0B000001, 53, -1 },
+		{ LB_FAMILY_IPV6, LB_IPPROTO_TCP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_INSPECT, 0, 0x0A000001, 53, 4 },
+		{ LB_FAMILY_IPV6, LB_IPPROTO_TCP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_PERMIT, 0, 0x0A000001, 53, -1 },
+	};
+
+	UINT32 wrong = 0;
+	for (const auto& c : cases)
+	{
+		LB_TEST_PACKET test;
+		UINT32 rule = 99;
+
+		LbTestPacketInitialize(&test, c.family, c.protocol, c.direction, c.action, c.address, c.port, std::vector<UINT8>(10, 'x'));
+		test.packet.flags = c.flags;
+		BOOLEAN captured = LbTestOffer(section.capture, filter, test, &rule);
+		wrong += captured != (c.rule >= 0) || (captured && rule != (UINT32)c.rule);
+	}
+	LB_CHECK_EQUAL(0, wrong);
+
+	LbCaptureFilterFree(filter);
+	LbCaptureDestroy(section.capture);
+}
+
+LB_TEST(OneInNCoveredPacketsIsCaptured)
+{
+	LB_TEST_PIN pin;
+	LB_TEST_SECTION section;
+	if (!LB_CHECK(LbTestSectionCreate(&section, 1, 1 << 20)))
+		return;
+
+	std::vector<LB_CAPTURE_RULE> rules(2, LbTestRule());
+	rules[0].firstPort = rules[0].lastPort = 80;
+	rules[0].sampleRate = 7;
+	rules[1].sampleRate = 100;
+
+	LB_CAPTURE_FILTER* filter = LbTestFilter(rules);
+	if (!filter)
+		return;
+
+	LB_TEST_PACKET web;
+	LB_TEST_PACKET other;
+	LbTestPacketInitialize(&web, LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT, 0x08080808, 80, { 1 });
+	LbTestPacketInitialize(&other, LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT, 0x08080808, 81, { 2 });
+
+	// Counts per rule are kept apart, the first packet of each is captured
+	UINT32 captured[2] = {};
+	std::vector<UINT32> capturedAt;
+	for (UINT32 i = 0; i < 1000; i++)
+	{
+		UINT32 rule = 99;
+		if (LbTestOffer(section.capture, filter, i % 2 ? other : web, &rule))
+		{
+			captured[rule]++;
+			if (rule == 0)
+				capturedAt.push_back(i / 2);
+		}
+	}
+
+	LB_CHECK_EQUAL(72, captured[0]);
+	LB_CHECK_EQUAL(5, captured[1]);
+	UINT32 wrong = 0;
+	for (SIZE_T i = 0; i < capturedAt.size(); i++)
+		wrong += capturedAt[i] != i * 7;
+	LB_CHECK_EQUAL(0, wrong);
+
+	LbCaptureFilterFree(filter);
+	LbCaptureDestroy(section.capture);
+}
+
+LB_TEST(RecordsReadBackAsPcapng)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_TEST_SECTION section;
+	LB_CAPTURE_READER* reader = NULL;
+	if (!LB_CHECK(LbTestSectionCreate(&section, 1, 1 << 20)) ||
+		!LB_CHECK_EQUAL(STATUS_SUCCESS, LbCaptureReaderOpen(section.Data(), section.size, &reader)))
+		return;
+
+	std::vector<LB_CAPTURE_RULE> rules(2, LbTestRule());
+	rules[0].firstPort = rules[0].lastPort = 8080;
+	rules[0].snapLength = 100;
+	LB_CAPTURE_FILTER* filter = LbTestFilter(rules);
+	if (!filter)
+		return;
+
+	std::vector<LB_TEST_PACKET> tests(5);
+	LbTestPacketInitialize(&tests[0], LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_INSPECT, 0x5DB8D822, 80, LbTestBytes(rng, 1460));
+	LbTestPacketInitialize(&tests[1], LB_FAMILY_IPV4, LB_IPPROTO_UDP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_PERMIT, 0x08080808, 53, LbTestBytes(rng, 61));
+	LbTestPacketInitialize(&tests[2], LB_FAMILY_IPV6, LB_IPPROTO_TCP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_BLOCK, 0x00000001, 443, LbTestBytes(rng, 0));
+	LbTestPacketInitialize(&tests[3], LB_FAMILY_IPV6, LB_IPPROTO_UDP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT, 0x00000035, 5353, LbTestBytes(rng, 300));
+	LbTestPacketInitialize(&tests[4], LB_FAMILY_IPV4, LB_IPPROTO_TCP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT, 0x0A000001, 8080, LbTestBytes(rng, 1000));
+	tests[0].packet.flags = LB_CAPTURE_FLAG_REWRITTEN | LB_CAPTURE_FLAG_QUEUED;
+	tests[3].packet.flags = LB_CAPTURE_FLAG_STREAM;
+
+	// A record whose data already starts with its TCP header gets no second one
+	std::vector<UINT8> segment(20, 0);
+	LbWriteBe16(&segment[0], 443);
+	LbWriteBe16(&segment[2], 49152);
+	LbWriteBe32(&segment[4], 123456);
+	segment[12] = 5 << 4;
+	segment[13] = 0x10;
+	tests[2].data = segment;
+	tests[2].packet.length = 20;
+	tests[2].packet.flags = LB_CAPTURE_FLAG_HEADER;
+
+	LB_PCAPNG_CLOCK clock = { LbTimestamp(), 1700000000ull * 1000000000ull };
+	for (const LB_TEST_PACKET& test : tests)
+		LB_CHECK(LbTestOffer(section.capture, filter, test));
+	UINT64 elapsed = (LbTimestamp() - clock.timestamp) * 1000000000ull / LbTimestampFrequency() + 1;
+
+	UINT64 dropped = 99;
+	std::vector<UINT8> file = LbTestDrain(reader, clock, LB_PCAPNG_BLOCK_MAX, &dropped);
+	std::vector<LB_TEST_BLOCK> blocks;
+	LB_CHECK_EQUAL(0, dropped);
+	if (!LB_CHECK(LbTestBlocks(file, &blocks)) || !LB_CHECK_EQUAL(tests.size(), blocks.size()))
+		return;
+
+	const char* comments[] = { "rule 1, inspect, rewritten, queued", "rule 1, permit", "rule 1, block", "rule 1, permit, stream", "rule 0, permit" };
+	UINT32 wrong = 0;
+	for (SIZE_T i = 0; i < blocks.size(); i++)
+	{
+		const LB_TEST_BLOCK& block = blocks[i];
+		wrong += block.comment != comments[i];
+		wrong += block.flags != (tests[i].packet.direction == LB_RULE_DIRECTION_OUTBOUND ? 2u : 1u);
+		wrong += block.time < clock.epochNanoseconds || block.time > clock.epochNanoseconds + elapsed;
+		wrong += i > 0 && block.time < blocks[i - 1].time;
+		if (tests[i].packet.family == LB_FAMILY_IPV4)
+			wrong += block.data.size() < 20 || LbChecksumFinish(LbChecksumAdd(0, block.data.data(), 20)) != 0;
+	}
+	LB_CHECK_EQUAL(0, wrong);
+
+	// The snapped record only keeps its first 100 bytes
+	LB_CHECK_EQUAL(20 + 20 + 100, blocks[4].data.size());
+	LB_CHECK_EQUAL(20 + 20 + 1000, blocks[4].originalLength);
+	LB_CHECK(memcmp(&blocks[4].data[40], tests[4].data.data(), 100) == 0);
+
+	// Everything else reads back as the packet it was, the snapped one as truncated
+	std::vector<LB_REPLAY_PACKET> packets;
+	LB_REPLAY_READ_STATS stats = {};
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbReplayParseCapture(file.data(), file.size(), &packets, &stats));
+	LB_CHECK_EQUAL(1, stats.truncated);
+	if (!LB_CHECK_EQUAL(4, packets.size()))
+		return;
+
+	wrong = 0;
+	for (SIZE_T i = 0; i < packets.size(); i++)
+	{
+		const LB_REPLAY_PACKET& packet = packets[i];
+		const LB_TEST_PACKET& test = tests[i];
+		BOOLEAN outbound = test.packet.direction == LB_RULE_DIRECTION_OUTBOUND;
+		SIZE_T addressBytes = test.packet.family == LB_FAMILY_IPV4 ? 4 : 16;
+		std::vector<UINT8> payload(packet.segment.begin() + packet.headerLength, packet.segment.end());
+
+		wrong += packet.family != test.packet.family || packet.protocol != test.packet.protocol;
+		wrong += memcmp(packet.source, outbound ? test.local : test.remote, addressBytes) != 0;
+		wrong += memcmp(packet.destination, outbound ? test.remote : test.local, addressBytes) != 0;
+		wrong += packet.sourcePort != (outbound ? 49152 : test.packet.remotePort);
+		wrong += packet.destinationPort != (outbound ? test.packet.remotePort : 49152);
+		wrong += test.packet.flags & LB_CAPTURE_FLAG_HEADER ? packet.segment != test.data : payload != test.data;
+		wrong += packet.timestamp != blocks[i].time;
+	}
+	LB_CHECK_EQUAL(0, wrong);
+
+	LbCaptureReaderClose(reader);
+	LbCaptureFilterFree(filter);
+	LbCaptureDestroy(section.capture);
+}
+
+LB_TEST(FullRingsDropAndWrapAround)
+{
+	LB_TEST_PIN pin;
+	std::mt19937 rng(LbTestSeed());
+	LB_TEST_SECTION section;
+	LB_CAPTURE_READER* reader = NULL;
+	if (!LB_CHECK(LbTestSectionCreate(&section, 1, 4096)) ||
+		!LB_CHECK_EQUAL(STATUS_SUCCESS, LbCaptureReaderOpen(section.Data(), section.size, &reader)))
+		return;
+
+	LB_CAPTURE_FILTER* filter = LbTestFilter({ LbTestRule() });
+	if (!filter)
+		return;
+
+	// 264 byte records, 15 of them fill the 4096 bytes
+	LB_TEST_PACKET test;
+	LB_PCAPNG_CLOCK clock = { LbTimestamp(), 0 };
+	LbTestPacketInitialize(&test, LB_FAMILY_IPV4, LB_IPPROTO_UDP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT, 0x08080808, 53, std::vector<UINT8>(200, 7));
+
+	UINT32 captured = 0;
+	for (UINT32 i = 0; i < 20; i++)
+		captured += LbTestOffer(section.capture, filter, test);
+	LB_CHECK_EQUAL(15, captured);
+	LB_CHECK_EQUAL(5, section.Ring(0)->dropped);
+
+	UINT64 dropped = 0;
+	std::vector<LB_TEST_BLOCK> blocks;
+	LB_CHECK(LbTestBlocks(LbTestDrain(reader, clock, 4096, &dropped), &blocks));
+	LB_CHECK_EQUAL(15, blocks.size());
+	LB_CHECK_EQUAL(5, dropped);
+
+	// Records of every size go round the ring many times, each one only after the previous ones were read
+	UINT32 offered = 0;
+	UINT32 read = 0;
+	UINT32 wrong = 0;
+	while (offered < 3000 && wrong == 0)
+	{
+		std::vector<UINT8> data = LbTestBytes(rng, rng() % 1500);
+		if (data.size() >= 4)
+			LbWriteBe32(data.data(), offered);
+		test.data = data;
+		test.packet.length = (UINT32)data.size();
+
+		if (!LbTestOffer(section.capture, filter, test))
+		{
+			blocks.clear();
+			wrong += !LbTestBlocks(LbTestDrain(reader, clock, LB_PCAPNG_BLOCK_MAX / 8 + rng() % 8192, &dropped), &blocks) || blocks.empty();
+			wrong += dropped != 1;
+			for (const LB_TEST_BLOCK& block : blocks)
+			{
+				wrong += block.data.size() >= 32 && LbReadBe32(&block.data[28]) != read;
+				read++;
+			}
+			continue;
+		}
+		offered++;
+	}
+
+	blocks.clear();
+	LB_CHECK(LbTestBlocks(LbTestDrain(reader, clock, LB_PCAPNG_BLOCK_MAX, &dropped), &blocks));
+	for (const LB_TEST_BLOCK& block : blocks)
+	{
+		wrong += block.data.size() >= 32 && LbReadBe32(&block.data[28]) != read;
+		read++;
+	}
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK_EQUAL(offered, read);
+	LB_CHECK((UINT32)section.Ring(0)->head > 100 * 4096);
+
+	LbCaptureReaderClose(reader);
+	LbCaptureFilterFree(filter);
+	LbCaptureDestroy(section.capture);
+}
+
+LB_TEST(ScribbledSectionsAreSurvived)
+{
+	LB_TEST_PIN pin;
+	std::mt19937 rng(LbTestSeed());
+	LB_TEST_SECTION section;
+	LB_CAPTURE_READER* reader = NULL;
+	if (!LB_CHECK(LbTestSectionCreate(&section, 2, 8192)))
+		return;
+
+	// Headers a reader refuses to open
+	LB_CAPTURE_SECTION original = *section.Header();
+	UINT32 opened = 0;
+	for (UINT32 field = 0; field < 7; field++)
+	{
+		LB_CAPTURE_SECTION* header = section.Header();
+		*header = original;
+		switch (field)
+		{
+		case 0: header->magic++; break;
+		case 1: header->version++; break;
+		case 2: header->ringSize = 6000; break;
+		case 3: header->ringStride = 8192; break;
+		case 4: header->ringCount = 3; break;
+		case 5: header->ringOffset = 8; break;
+		case 6: header->frequency = 0; break;
+		}
+		opened += NT_SUCCESS(LbCaptureReaderOpen(section.Data(), section.size, &reader));
+		LbCaptureReaderClose(reader);
+	}
+	*section.Header() = original;
+	LB_CHECK_EQUAL(0, opened);
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbCaptureReaderOpen(section.Data(), sizeof(LB_CAPTURE_SECTION) - 1, &reader));
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbCaptureReaderOpen(section.Data(), section.size, &reader)))
+		return;
+
+	LB_CAPTURE_FILTER* filter = LbTestFilter({ LbTestRule() });
+	if (!filter)
+		return;
+
+	LB_TEST_PACKET test;
+	LB_PCAPNG_CLOCK clock = { LbTimestamp(), 0 };
+	LbTestPacketInitialize(&test, LB_FAMILY_IPV6, LB_IPPROTO_TCP, LB_RULE_DIRECTION_INBOUND, LB_RULE_ACTION_PERMIT, 1, 443, std::vector<UINT8>(100, 1));
+
+	// A tail past head, or more than a ring behind it, makes the writer drop instead of overwriting
+	UINT32 ring = LbCurrentProcessor() % 2;
+	LB_CHECK(LbTestOffer(section.capture, filter, test));
+	LONG head = section.Ring(ring)->head;
+	LbWriteRelease(&section.Ring(ring)->tail, head + 64);
+	LB_CHECK(!LbTestOffer(section.capture, filter, test));
+	LbWriteRelease(&section.Ring(ring)->tail, head - 8192 - 8);
+	LB_CHECK(!LbTestOffer(section.capture, filter, test));
+	LB_CHECK_EQUAL(2, section.Ring(ring)->dropped);
+	LbWriteRelease(&section.Ring(ring)->tail, 0);
+
+	// Garbage in the records, read into buffers with guard bytes after them
+	UINT32 overruns = 0;
+	UINT32 malformed = 0;
+	UINT32 recovered = 0;
+	for (UINT32 round = 0; round < 300; round++)
+	{
+		for (UINT32 i = 0, count = rng() % 8; i < count; i++)
+			LbTestOffer(section.capture, filter, test);
+
+		UINT8* records = (UINT8*)(section.Ring(ring) + 1);
+		for (UINT32 i = 0, count = 1 + rng() % 16; i < count; i++)
+		{
+			UINT32 offset = rng() % 8192;
+			if (rng() % 2)
+				records[offset & ~7u] = (UINT8)rng();			// A record's length
+			else
+				records[offset] = (UINT8)rng();
+		}
+		if (rng() % 8 == 0)
+			LbWriteRelease(&section.Ring(ring)->tail, (LONG)rng());
+
+		SIZE_T capacity = 1 + rng() % (2 * LB_PCAPNG_BLOCK_MAX);
+		std::vector<UINT8> output(capacity + 64, 0xA5);
+		UINT64 dropped;
+		SIZE_T written = LbCaptureDrainPcapng(reader, &clock, output.data(), capacity, &dropped);
+		overruns += written > capacity;
+		for (SIZE_T i = capacity; i < output.size(); i++)
+			overruns += output[i] != 0xA5;
+
+		std::vector<LB_TEST_BLOCK> blocks;
+		output.resize(written);
+		malformed += !LbTestBlocks(output, &blocks);
+
+		// Once drained, the ring takes records again and they come back whole
+		output.assign(LB_PCAPNG_BLOCK_MAX, 0);
+		while (LbCaptureDrainPcapng(reader, &clock, output.data(), output.size(), &dropped) != 0);
+		LbWriteRelease(&section.Ring(ring)->tail, section.Ring(ring)->head);
+		if (LbTestOffer(section.capture, filter, test))
+		{
+			blocks.clear();
+			LbTestBlocks(LbTestDrain(reader, clock, LB_PCAPNG_BLOCK_MAX, &dropped), &blocks);
+			recovered += blocks.size() == 1 && blocks[0].data.size() == 40 + 20 + 100;
+		}
+	}
+	LB_CHECK_EQUAL(0, overruns);
+	LB_CHECK_EQUAL(0, malformed);
+	LB_CHECK_EQUAL(300, recovered);
+
+	LbCaptureReaderClose(reader);
+	LbCaptureFilterFree(filter);
+	LbCaptureDestroy(section.capture);
+}
+
+LB_TEST(WritersRacingAReaderLoseNothingUncounted)
+{
+	const UINT32 writerCount = 4;
+	const UINT32 perWriter = 50000;
+	LB_TEST_SECTION section;
+	LB_CAPTURE_READER* reader = NULL;
+	if (!LB_CHECK(LbTestSectionCreate(&section, LbProcessorCount(), 1 << 16)) ||
+		!LB_CHECK_EQUAL(STATUS_SUCCESS, LbCaptureReaderOpen(section.Data(), section.size, &reader)))
+		return;
+
+	LB_CAPTURE_FILTER* filter = LbTestFilter({ LbTestRule() });
+	if (!filter)
+		return;
+
+	std::atomic<UINT32> running(writerCount);
+	std::vector<std::thread> writers;
+
+	for (UINT32 w = 0; w < writerCount; w++)
+	{
+		writers.emplace_back([&, w]() {
+			LB_TEST_PACKET test;
+			LbTestPacketInitialize(&test, LB_FAMILY_IPV4, LB_IPPROTO_UDP, LB_RULE_DIRECTION_OUTBOUND, LB_RULE_ACTION_PERMIT,
+				0x0A000000 + w, 53, std::vector<UINT8>(8 + w * 40));
+
+			for (UINT32 i = 0; i < perWriter; i++)
+			{
+				LbWriteBe32(&test.data[0], w);
+				LbWriteBe32(&test.data[4], i);
+				LbTestOffer(section.capture, filter, test);
+			}
+			running--;
+		});
+	}
+
+	// Each writer's record i may be read at most once, and what was not read must have been counted dropped
+	std::vector<std::vector<bool>> seen(writerCount, std::vector<bool>(perWriter));
+	std::vector<UINT8> output(1 << 16);
+	LB_PCAPNG_CLOCK clock = { LbTimestamp(), 0 };
+	UINT64 read = 0;
+	UINT64 lost = 0;
+	UINT32 wrong = 0;
+
+	for (BOOLEAN done = FALSE; !done; )
+	{
+		done = running.load() == 0;
+
+		UINT64 dropped = 0;
+		SIZE_T written = LbCaptureDrainPcapng(reader, &clock, output.data(), output.size(), &dropped);
+		std::vector<LB_TEST_BLOCK> blocks;
+		wrong += !LbTestBlocks(std::vector<UINT8>(output.begin(), output.begin() + written), &blocks);
+		lost += dropped;
+		read += blocks.size();
+
+		for (const LB_TEST_BLOCK& block : blocks)
+		{
+			UINT32 writer = block.data.size() >= 36 ? LbReadBe32(&block.data[28]) : writerCount;
+			UINT32 index = block.data.size() >= 36 ? LbReadBe32(&block.data[32]) : perWriter;
+			if (writer >= writerCount || index >= perWriter || seen[writer][index] || block.data.size() != 28 + 8 + writer * 40)
+			{
+				wrong++;
+				continue;
+			}
+			seen[writer][index] = true;
+		}
+
+		// A drain that wrote anything only ends the loop once one after it comes back empty
+		if (done && written != 0)
+			done = FALSE;
+		if (written == 0)
+			std::this_thread::yield();
+	}
+
+	for (std::thread& writer : writers)
+		writer.join();
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK_EQUAL((UINT64)writerCount * perWriter, read + lost);
+	LB_CHECK(read > 0);
+
+	LbCaptureReaderClose(reader);
+	LbCaptureFilterFree(filter);
+	LbCaptureDestroy(section.capture);
+}
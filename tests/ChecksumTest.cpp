@@ -0,0 +1,265 @@
+/*/
+/*  ** ChecksumTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the Internet checksum helpers against the RFC 1071 reference in LbReference.h: whole
+/*	buffers of every length, buffers summed in pieces that start on odd bytes, transport checksums with their
+/*	pseudo header, and both incremental paths, a 32-bit field update and the edits of an in-place rewrite,
+/*	which have to leave the same valid checksum a full recompute would.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "Checksum.h"
+#include "LbReference.h"
+#include "VerdictCache.h"
+#include <random>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+static const UINT32 LbTestSource = 0xC0A80002;
+static const UINT32 LbTestDestination = 0x5DB8D822;
+
+// Random bytes, every so often runs of 0xFF and 0x00 so the sums carry as much and as little as they can
+static std::vector<UINT8> LbTestData(std::mt19937& rng, size_t length)
+{
+	std::vector<UINT8> data(length);
+	UINT32 kind = rng() % 4;
+
+	for (UINT8& byte : data)
+		byte = kind == 0 ? 0xFF : kind == 1 && rng() % 8 != 0 ? 0 : (UINT8)rng();
+	return data;
+}
+
+// The pseudo header as the bytes RFC 793 lists, for the reference to sum
+static UINT64 LbTestPseudoHeaderSum(UINT8 protocol, size_t length)
+{
+	UINT8 header[12];
+
+	LbWriteBe32(&header[0], LbTestSource);
+	LbWriteBe32(&header[4], LbTestDestination);
+	header[8] = 0;
+	header[9] = protocol;
+	LbWriteBe16(&header[10], (UINT16)length);
+	return (UINT16)~LbReferenceChecksum(0, header, sizeof(header));
+}
+
+// A TCP segment of length bytes (at least the 20 byte header) with a valid checksum at 16
+static std::vector<UINT8> LbTestSegment(std::mt19937& rng, size_t length)
+{
+	std::vector<UINT8> segment = LbTestData(rng, length);
+
+	segment[16] = 0;
+	segment[17] = 0;
+	LbWriteBe16(&segment[16], LbReferenceChecksum(LbTestPseudoHeaderSum(LB_IPPROTO_TCP, length), segment.data(), length));
+	return segment;
+}
+
+static BOOLEAN LbTestValid(const std::vector<UINT8>& segment)
+{
+	return LbReferenceChecksum(LbTestPseudoHeaderSum(LB_IPPROTO_TCP, segment.size()), segment.data(), segment.size()) == 0;
+}
+
+// Two checksums that only differ as +0 and -0 are the same sum (RFC 1624 section 3)
+static BOOLEAN LbTestSameChecksum(UINT16 a, UINT16 b)
+{
+	return a == b || ((a == 0 || a == 0xFFFF) && (b == 0 || b == 0xFFFF));
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(SumsMatchTheReference)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	for (size_t length = 0; length < 9000; length += length < 600 ? 1 : 1 + rng() % 97)
+	{
+		for (UINT32 round = 0; round < 4; round++)
+		{
+			std::vector<UINT8> data = LbTestData(rng, length);
+			UINT32 sum = round == 0 ? 0 : round == 1 ? 0xFFFFFFFF : rng();
+
+			// Summed from 1 byte into the buffer as well, so the wide loads are unaligned too
+			wrong += LbChecksumFinish(LbChecksumAdd(sum, data.data(), length)) != LbReferenceChecksum(sum, data.data(), length);
+			if (length > 0)
+				wrong += LbChecksumFinish(LbChecksumAdd(sum, data.data() + 1, length - 1)) != LbReferenceChecksum(sum, data.data() + 1, length - 1);
+		}
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+
+	// Carries: a megabyte of 0xFF sums to -0
+	std::vector<UINT8> ones(1 << 20, 0xFF);
+	LB_CHECK_EQUAL(0, LbChecksumFinish(LbChecksumAdd(0, ones.data(), ones.size())));
+	LB_CHECK_EQUAL(0xFFFF, LbChecksumFinish(LbChecksumAdd(0, ones.data(), 0)));
+}
+
+LB_TEST(SumsInPiecesMatchOneSum)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	for (UINT32 round = 0; round < 2000; round++)
+	{
+		std::vector<UINT8> data = LbTestData(rng, rng() % 3000);
+		UINT32 sum = 0;
+
+		// Pieces as MDL spans cut them, of any length and starting anywhere
+		for (size_t offset = 0; offset < data.size(); )
+		{
+			size_t length = std::min<size_t>(data.size() - offset, rng() % 4 == 0 ? 1 : rng() % 700);
+			sum = LbChecksumAddAt(sum, offset, data.data() + offset, length);
+			offset += length;
+		}
+
+		wrong += LbChecksumFinish(sum) != LbReferenceChecksum(0, data.data(), data.size());
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+}
+
+LB_TEST(TransportChecksumsCoverThePseudoHeader)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	for (UINT32 round = 0; round < 1000; round++)
+	{
+		UINT8 protocol = round % 2 ? LB_IPPROTO_TCP : LB_IPPROTO_UDP;
+		size_t length = 8 + rng() % 1500;
+		std::vector<UINT8> segment = LbTestData(rng, length);
+		size_t field = protocol == LB_IPPROTO_TCP && length >= 20 ? 16 : 6;
+
+		segment[field] = 0;
+		segment[field + 1] = 0;
+		UINT16 checksum = LbTransportChecksumV4(LbTestSource, LbTestDestination, protocol, segment.data(), length);
+		wrong += checksum != LbReferenceChecksum(LbTestPseudoHeaderSum(protocol, length), segment.data(), length);
+
+		// With the field filled in the whole segment sums to -0
+		LbWriteBe16(&segment[field], checksum);
+		wrong += LbTransportChecksumV4(LbTestSource, LbTestDestination, protocol, segment.data(), length) != 0;
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+}
+
+LB_TEST(FieldUpdatesMatchARecompute)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	for (UINT32 round = 0; round < 10000; round++)
+	{
+		std::vector<UINT8> segment = LbTestSegment(rng, 20 + rng() % 100);
+		UINT32 oldValue = LbReadBe32(&segment[4]);
+		UINT32 newValue = round % 3 == 0 ? oldValue + 1 + rng() % 1500 : rng();
+
+		// The sequence number, as the copying rewrite moves it
+		LbWriteBe32(&segment[4], newValue);
+		UINT16 patched = LbChecksumUpdate32(LbReadBe16(&segment[16]), oldValue, newValue);
+		segment[16] = 0;
+		segment[17] = 0;
+		UINT16 recomputed = LbReferenceChecksum(LbTestPseudoHeaderSum(LB_IPPROTO_TCP, segment.size()), segment.data(), segment.size());
+
+		LbWriteBe16(&segment[16], patched);
+		wrong += !LbTestSameChecksum(patched, recomputed) || !LbTestValid(segment);
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+}
+
+LB_TEST(EditsPatchLikeARecompute)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+	UINT32 wide = 0;
+
+	for (UINT32 round = 0; round < 20000; round++)
+	{
+		std::vector<UINT8> segment = LbTestSegment(rng, 20 + rng() % 1480);
+		UINT16 checksum = LbReadBe16(&segment[16]);
+		LB_CHECKSUM_EDITS edits;
+
+		// The buffer being edited is one span of the payload, which may start on an odd byte
+		size_t start = 20 + rng() % (segment.size() - 19);
+		UINT8* buffer = segment.data() + start;
+		size_t bufferLength = segment.size() - start;
+
+		LbChecksumEditsBegin(&edits, 0);
+		edits.base = start;
+
+		for (UINT32 i = 0, count = rng() % 24; i < count && bufferLength > 0; i++)
+		{
+			size_t offset = rng() % bufferLength;
+			size_t length = 1 + rng() % std::min<size_t>(bufferLength - offset, rng() % 4 == 0 ? 96 : 12);
+			std::vector<UINT8> after = LbTestData(rng, length);
+
+			// Recorded first, while the old bytes are still there. The same bytes may be edited again.
+			LbChecksumEdit(&edits, offset, buffer + offset, after.data(), length);
+			memcpy(buffer + offset, after.data(), length);
+			wide += length >= 32;
+		}
+
+		UINT16 patched = LbChecksumApplyEdits(checksum, &edits);
+		segment[16] = 0;
+		segment[17] = 0;
+		UINT16 recomputed = LbReferenceChecksum(LbTestPseudoHeaderSum(LB_IPPROTO_TCP, segment.size()), segment.data(), segment.size());
+
+		LbWriteBe16(&segment[16], patched);
+		wrong += !LbTestSameChecksum(patched, recomputed) || !LbTestValid(segment);
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK(wide > 1000);
+}
+
+LB_TEST(EditsGiveUpPastTheirLimit)
+{
+	UINT8 before[64] = {};
+	UINT8 after[64];
+	LB_CHECKSUM_EDITS edits;
+	memset(after, 0x5A, sizeof(after));
+
+	// A 1460 byte segment is patched for as many 4 byte edits as cost less than summing it
+	const SIZE_T editCost = LB_CHECKSUM_EDIT_COST + LB_CHECKSUM_EDIT_BYTE_COST * 4;
+	UINT32 patchable = 0;
+	LbChecksumEditsBegin(&edits, 1460);
+	while (!LbChecksumEditsExceeded(&edits))
+	{
+		LbChecksumEdit(&edits, patchable * 8, before, after, 4);
+		patchable += !LbChecksumEditsExceeded(&edits);
+	}
+	LB_CHECK_EQUAL(1460 / editCost, patchable);
+	LB_CHECK_EQUAL(patchable + 1, edits.count);
+
+	// Edits past the limit are still counted
+	LbChecksumEdit(&edits, 0, before, after, 64);
+	LB_CHECK_EQUAL(patchable + 2, edits.count);
+	LB_CHECK(LbChecksumEditsExceeded(&edits));
+
+	// A limit of 0 never gives up, and a large edit costs more than a small one
+	LbChecksumEditsBegin(&edits, 0);
+	for (UINT32 i = 0; i < 10000; i++)
+		LbChecksumEdit(&edits, i % 64, before, after, 1);
+	LB_CHECK(!LbChecksumEditsExceeded(&edits));
+
+	LbChecksumEditsBegin(&edits, 1000);
+	LbChecksumEdit(&edits, 0, before, after, 64);
+	LbChecksumEdit(&edits, 0, before, after, 64);
+	LB_CHECK(LbChecksumEditsExceeded(&edits));
+
+	// Nothing changed, nothing to patch
+	LbChecksumEditsBegin(&edits, 0);
+	LbChecksumEdit(&edits, 3, after, after, 40);
+	LB_CHECK_EQUAL(0x1234, LbChecksumApplyEdits(0x1234, &edits));
+}
@@ -0,0 +1,279 @@
+/*/
+/*  ** ClassifierTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the flow classifier: random address and port rules looked up through the tables
+/*	against a plain walk of the rules, the range walks, and tables copied into a rule image and bound again.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "Classifier.h"
+#include <random>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+struct LB_TEST_RULES
+{
+	std::vector<LB_ADDRESS_RULE> addresses;
+	std::vector<LB_PORT_RULE> ports;
+};
+
+// Rules clustered around a few networks so prefixes of every length overlap and nest
+static LB_TEST_RULES LbTestRandomRules(std::mt19937& rng, UINT32 addressCount, UINT32 portCount)
+{
+	const UINT32 networks[] = { 0x0A000000, 0xC0A80000, 0xAC100000, 0x08080800 };
+	LB_TEST_RULES rules;
+
+	for (UINT32 i = 0; i < addressCount; i++)
+	{
+		LB_ADDRESS_RULE rule = {};
+		rule.address = networks[rng() % 4] ^ (rng() & (0xFFFFFFFF >> (rng() % 33)));
+		rule.prefixLength = (UINT8)(rng() % 4 == 0 ? rng() % 33 : 16 + rng() % 17);
+		rule.action = (UINT8)(rng() % 3);
+		rule.directions = (UINT8)(1 + rng() % 3);
+		rules.addresses.push_back(rule);
+	}
+
+	for (UINT32 i = 0; i < portCount; i++)
+	{
+		LB_PORT_RULE rule = {};
+		rule.firstPort = (UINT16)(rng() % 2 ? rng() % 1024 : rng());
+		rule.lastPort = (UINT16)std::min<UINT32>(0xFFFF, rule.firstPort + (rng() % 4 ? rng() % 16 : rng() % 4096));
+		rule.action = (UINT8)(rng() % 3);
+		rule.directions = (UINT8)(1 + rng() % 3);
+		rules.ports.push_back(rule);
+	}
+
+	return rules;
+}
+
+static UINT8 LbTestDirectionMask(LB_DIRECTION direction)
+{
+	return direction == LB_DIRECTION_OUTBOUND ? LB_RULE_DIRECTION_OUTBOUND : LB_RULE_DIRECTION_INBOUND;
+}
+
+// The longest prefix covering the address decides, the rule listed first among equal ones; then the first port rule
+static LB_VERDICT LbTestReferenceLookup(const LB_TEST_RULES& rules, LB_DIRECTION direction, UINT32 address, UINT16 port)
+{
+	UINT8 mask = LbTestDirectionMask(direction);
+	int bestLength = -1;
+	LB_VERDICT best = LB_VERDICT_NONE;
+
+	for (const LB_ADDRESS_RULE& rule : rules.addresses)
+	{
+		UINT32 prefix = rule.prefixLength ? 0xFFFFFFFF << (32 - rule.prefixLength) : 0;
+		if ((rule.directions & mask) && ((address ^ rule.address) & prefix) == 0 && (int)rule.prefixLength > bestLength)
+		{
+			bestLength = rule.prefixLength;
+			best = (LB_VERDICT)(rule.action + LB_VERDICT_PERMIT);
+		}
+	}
+	if (best != LB_VERDICT_NONE)
+		return best;
+
+	for (const LB_PORT_RULE& rule : rules.ports)
+	{
+		if ((rule.directions & mask) && port >= rule.firstPort && port <= rule.lastPort)
+			return (LB_VERDICT)(rule.action + LB_VERDICT_PERMIT);
+	}
+
+	return LB_VERDICT_NONE;
+}
+
+// Addresses on and just past the edges of every rule, and some anywhere
+static std::vector<UINT32> LbTestProbeAddresses(std::mt19937& rng, const LB_TEST_RULES& rules)
+{
+	std::vector<UINT32> probes;
+
+	for (const LB_ADDRESS_RULE& rule : rules.addresses)
+	{
+		UINT32 prefix = rule.prefixLength ? 0xFFFFFFFF << (32 - rule.prefixLength) : 0;
+		UINT32 first = rule.address & prefix;
+		UINT32 last = first | ~prefix;
+
+		probes.insert(probes.end(), { first, last, first - 1, last + 1, first | (UINT32)(rng() & ~prefix) });
+	}
+	for (int i = 0; i < 256; i++)
+		probes.push_back(rng());
+
+	return probes;
+}
+
+static NTSTATUS LbTestCollectRange(UINT32 first, UINT32 last, LB_VERDICT verdict, void* value)
+{
+	std::vector<UINT32>* ranges = (std::vector<UINT32>*)value;
+	ranges->insert(ranges->end(), { first, last, (UINT32)verdict });
+	return STATUS_SUCCESS;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(RejectsBadRules)
+{
+	LB_ADDRESS_RULE address = { 0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 };
+	LB_PORT_RULE port = { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 };
+	LB_CLASSIFIER* classifier = NULL;
+
+	LB_ADDRESS_RULE bad = address;
+	bad.prefixLength = 33;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierCompile(&bad, 1, &port, 1, &classifier));
+	bad = address;
+	bad.action = LB_RULE_ACTION_INSPECT + 1;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierCompile(&bad, 1, &port, 1, &classifier));
+	bad = address;
+	bad.directions = 0;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierCompile(&bad, 1, &port, 1, &classifier));
+
+	LB_PORT_RULE backwards = { 90, 80, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 };
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierCompile(&address, 1, &backwards, 1, &classifier));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierCompile(NULL, 1, &port, 1, &classifier));
+	LB_CHECK(classifier == NULL);
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierCompile(&address, 1, &port, 1, &classifier)))
+		return;
+
+	LB_CHECK_EQUAL(LB_VERDICT_BLOCK, LbClassifierLookup(classifier, LB_DIRECTION_INBOUND, 0x0A010203, 80));
+	LB_CHECK_EQUAL(LB_VERDICT_INSPECT, LbClassifierLookup(classifier, LB_DIRECTION_INBOUND, 0x0B010203, 80));
+	LB_CHECK_EQUAL(LB_VERDICT_NONE, LbClassifierLookup(classifier, LB_DIRECTION_INBOUND, 0x0B010203, 81));
+	LB_CHECK_EQUAL(LB_VERDICT_INSPECT, LbClassifierLookupPort(classifier, LB_DIRECTION_OUTBOUND, 80));
+	LbClassifierFree(classifier);
+}
+
+LB_TEST(RandomRulesMatchAWalkOfTheRules)
+{
+	std::mt19937 rng(LbTestSeed());
+
+	for (int round = 0; round < 40; round++)
+	{
+		LB_TEST_RULES rules = LbTestRandomRules(rng, 1 + rng() % 200, rng() % 60);
+		LB_CLASSIFIER* classifier = NULL;
+
+		if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierCompile(rules.addresses.data(), (UINT32)rules.addresses.size(), rules.ports.data(), (UINT32)rules.ports.size(), &classifier)))
+			return;
+
+		std::vector<UINT32> probes = LbTestProbeAddresses(rng, rules);
+		UINT32 wrong = 0;
+
+		for (UINT32 address : probes)
+		{
+			UINT16 port = (UINT16)(rng() % 2 ? rng() % 1100 : rng());
+
+			for (LB_DIRECTION direction : { LB_DIRECTION_OUTBOUND, LB_DIRECTION_INBOUND })
+			{
+				LB_TEST_RULES portsOnly = { {}, rules.ports };
+				wrong += LbClassifierLookup(classifier, direction, address, port) != LbTestReferenceLookup(rules, direction, address, port);
+				wrong += LbClassifierLookupPort(classifier, direction, port) != LbTestReferenceLookup(portsOnly, direction, address, port);
+			}
+		}
+
+		LB_CHECK_EQUAL(0, wrong);
+		LbClassifierFree(classifier);
+	}
+}
+
+LB_TEST(RangeWalksCoverEveryValueOnce)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_TEST_RULES rules = LbTestRandomRules(rng, 300, 80);
+	LB_CLASSIFIER* classifier = NULL;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierCompile(rules.addresses.data(), (UINT32)rules.addresses.size(), rules.ports.data(), (UINT32)rules.ports.size(), &classifier)))
+		return;
+
+	for (LB_DIRECTION direction : { LB_DIRECTION_OUTBOUND, LB_DIRECTION_INBOUND })
+	{
+		LB_TEST_RULES addressesOnly = { rules.addresses, {} };
+		LB_TEST_RULES portsOnly = { {}, rules.ports };
+
+		for (int kind = 0; kind < 2; kind++)
+		{
+			std::vector<UINT32> ranges;
+			UINT32 end = kind == 0 ? 0xFFFFFFFF : 0xFFFF;
+
+			if (kind == 0)
+				LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierEnumerateAddresses(classifier, direction, LbTestCollectRange, &ranges));
+			else
+				LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierEnumeratePorts(classifier, direction, LbTestCollectRange, &ranges));
+
+			// Back to back from 0 to the last value, neighbours always differ, both ends agree with the rules
+			UINT32 wrong = 0;
+			UINT64 next = 0;
+
+			for (size_t i = 0; i < ranges.size(); i += 3)
+			{
+				UINT32 first = ranges[i];
+				UINT32 last = ranges[i + 1];
+				LB_VERDICT verdict = (LB_VERDICT)ranges[i + 2];
+
+				wrong += first != next || last < first;
+				wrong += i > 0 && ranges[i - 1] == ranges[i + 2];
+				for (UINT32 value : { first, last })
+				{
+					wrong += kind == 0 ?
+						LbTestReferenceLookup(addressesOnly, direction, value, 0) != verdict :
+						LbTestReferenceLookup(portsOnly, direction, 0, (UINT16)value) != verdict;
+				}
+				next = (UINT64)last + 1;
+			}
+
+			LB_CHECK_EQUAL(0, wrong);
+			LB_CHECK_EQUAL((UINT64)end + 1, next);
+		}
+	}
+
+	LbClassifierFree(classifier);
+}
+
+LB_TEST(ImageTablesLookUpTheSame)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_TEST_RULES rules = LbTestRandomRules(rng, 500, 50);
+	LB_CLASSIFIER* classifier = NULL;
+	LB_CLASSIFIER* bound = NULL;
+	LB_CLASSIFIER_IMAGE tables[LB_DIRECTION_COUNT] = {};
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierCompile(rules.addresses.data(), (UINT32)rules.addresses.size(), rules.ports.data(), (UINT32)rules.ports.size(), &classifier)))
+		return;
+
+	// Tables start past offset 0, which marks a missing one
+	SIZE_T size = LbClassifierWriteImage(classifier, NULL, 64, tables);
+	UINT8* image = (UINT8*)LbAlloc(size, 'LBT0');
+	LB_CHECK_EQUAL(size, LbClassifierWriteImage(classifier, image, 64, tables));
+
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierBindImage(image, size, tables, &bound)))
+	{
+		UINT32 wrong = 0;
+		for (UINT32 address : LbTestProbeAddresses(rng, rules))
+		{
+			UINT16 port = (UINT16)rng();
+			for (LB_DIRECTION direction : { LB_DIRECTION_OUTBOUND, LB_DIRECTION_INBOUND })
+				wrong += LbClassifierLookup(bound, direction, address, port) != LbClassifierLookup(classifier, direction, address, port);
+		}
+
+		LB_CHECK_EQUAL(0, wrong);
+		LbClassifierFree(bound);
+	}
+
+	// A cut image, a misaligned table and an entry pointing past the subtables are all refused
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierBindImage(image, size - 1, tables, &bound));
+
+	LB_CLASSIFIER_IMAGE moved[LB_DIRECTION_COUNT] = { tables[0], tables[1] };
+	moved[0].addressOffset += 4;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierBindImage(image, size, moved, &bound));
+
+	((UINT32*)(image + tables[0].addressOffset))[0x0A00] = 0x80000000 | tables[0].subtableCount;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbClassifierBindImage(image, size, tables, &bound));
+
+	LbFree(image, 'LBT0');
+	LbClassifierFree(classifier);
+}
@@ -0,0 +1,332 @@
+/*/
+/*  ** ClassifyCoreTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the in place scan the callout runs over the buffers of each segment:
+/*	matches split between buffers and between segments, and the checksum patched for what was rewritten.
+/*	Also the copying rewrite of whole segments, whose size changes move the sequence numbers after them, and
+/*	what the traits of each of the four transport layers let the classify path do there.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbReference.h"
+#include "ClassifyCore.h"
+#include <algorithm>
+
+/////////////
+// HELPERS //
+/////////////
+
+#define LB_TEST_TCP_HEADER 20
+
+static const UINT32 LbTestSource = 0x0A000001;
+static const UINT32 LbTestDestination = 0x0A000002;
+
+static LB_FLOW_KEY LbTestKey()
+{
+	LB_FLOW_KEY key = {};
+	key.localAddress = LbTestSource;
+	key.remoteAddress = LbTestDestination;
+	key.localPort = 49152;
+	key.remotePort = 80;
+	key.protocol = LB_IPPROTO_TCP;
+	key.direction = LB_DIRECTION_OUTBOUND;
+	key.family = LB_FAMILY_IPV4;
+	return key;
+}
+
+// A TCP segment carrying payload, with its checksum filled in
+static std::string LbTestSegment(const std::string& payload)
+{
+	std::string segment(LB_TEST_TCP_HEADER, '\0');
+	segment[12] = 0x50;
+	segment += payload;
+
+	UINT16 checksum = LbTransportChecksumV4(LbTestSource, LbTestDestination, LB_IPPROTO_TCP, (const UINT8*)segment.data(), segment.size());
+	LbWriteBe16((UINT8*)&segment[16], checksum);
+	return segment;
+}
+
+// Scan the payload of segment in place, split into buffers at cuts (offsets into the payload), and patch
+// its checksum as the callout does. Returns FALSE when the checksum had to be computed again.
+static BOOLEAN LbTestScanSegment(LB_SCAN_CONTEXT* scan, std::string& segment, const std::vector<size_t>& cuts)
+{
+	size_t payloadLength = segment.size() - LB_TEST_TCP_HEADER;
+	size_t start = 0;
+
+	LbScanSegment(scan, 0, payloadLength);
+	for (size_t n = 0; n <= cuts.size(); n++)
+	{
+		size_t end = n < cuts.size() ? cuts[n] : payloadLength;
+		LbScanBuffer(scan, (UINT8*)&segment[LB_TEST_TCP_HEADER + start], end - start);
+		start = end;
+	}
+
+	UINT16 checksum = LbReadBe16((const UINT8*)&segment[16]);
+	LB_SCAN_CHECKSUM result = LbScanChecksum(scan, &checksum);
+
+	if (result == LB_SCAN_CHECKSUM_RECOMPUTE)
+	{
+		LbWriteBe16((UINT8*)&segment[16], 0);
+		checksum = LbTransportChecksumV4(LbTestSource, LbTestDestination, LB_IPPROTO_TCP, (const UINT8*)segment.data(), segment.size());
+	}
+
+	LbWriteBe16((UINT8*)&segment[16], checksum);
+	return result != LB_SCAN_CHECKSUM_RECOMPUTE;
+}
+
+// Whether the checksum of segment is right
+static BOOLEAN LbTestChecksumValid(const std::string& segment)
+{
+	return LbTransportChecksumV4(LbTestSource, LbTestDestination, LB_IPPROTO_TCP, (const UINT8*)segment.data(), segment.size()) == 0;
+}
+
+static std::vector<size_t> LbTestCuts(std::mt19937& rng, size_t length, size_t count)
+{
+	std::vector<size_t> cuts;
+
+	for (size_t n = 0; n < count && length > 1; n++)
+		cuts.push_back(1 + rng() % (length - 1));
+	std::sort(cuts.begin(), cuts.end());
+	cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+	return cuts;
+}
+
+///////////
+// TESTS //
+///////////
+
+// Checked at compile time, a wrong trait fails the build of this test rather than a run of it
+LB_TEST(LayerTraitsOfTheFourLayers)
+{
+	static_assert(LB_LAYER_OUTBOUND_V4::addressBytes == 4 && LB_LAYER_INBOUND_V4::addressBytes == 4, "IPv4 layers carry 4 byte addresses");
+	static_assert(LB_LAYER_OUTBOUND_V6::addressBytes == 16 && LB_LAYER_INBOUND_V6::addressBytes == 16, "IPv6 layers carry 16 byte addresses");
+
+	static_assert(LB_LAYER_OUTBOUND_V4::headerInData && LB_LAYER_OUTBOUND_V6::headerInData, "outbound data starts at the transport header");
+	static_assert(!LB_LAYER_INBOUND_V4::headerInData && !LB_LAYER_INBOUND_V6::headerInData, "inbound data starts at the payload");
+
+	static_assert(LB_LAYER_OUTBOUND_V4::flowState && LB_LAYER_OUTBOUND_V6::flowState, "outgoing streams keep their match state");
+	static_assert(!LB_LAYER_INBOUND_V4::flowState && !LB_LAYER_INBOUND_V6::flowState, "incoming segments are matched on their own");
+
+	static_assert(LB_LAYER_OUTBOUND_V4::resizes, "outbound IPv4 injects resized segments");
+	static_assert(!LB_LAYER_OUTBOUND_V6::resizes && !LB_LAYER_INBOUND_V4::resizes && !LB_LAYER_INBOUND_V6::resizes, "only outbound IPv4 resizes");
+
+	static_assert(LB_LAYER_INBOUND_V4::translatesAcks, "inbound IPv4 translates acknowledgements");
+	static_assert(!LB_LAYER_OUTBOUND_V4::translatesAcks && !LB_LAYER_OUTBOUND_V6::translatesAcks && !LB_LAYER_INBOUND_V6::translatesAcks,
+		"only inbound IPv4 translates acknowledgements");
+
+	LB_CHECK(TRUE);
+}
+
+LB_TEST(MatchSplitBetweenBuffersIsRewrittenWhole)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("Love", "Hate");
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+		return;
+
+	LB_FLOW_KEY key = LbTestKey();
+	LB_SCAN_CONTEXT scan = {};
+	scan.matcher = matcher;
+	scan.key = &key;
+
+	// Every way of cutting "Love" over two and three buffers, at odd and even offsets
+	for (size_t lead = 0; lead < 2; lead++)
+	{
+		for (size_t first = 1; first < 4; first++)
+		{
+			for (size_t second = first; second < 4; second++)
+			{
+				std::string before = std::string(lead + 3, 'x') + "Love" + "xxx";
+				std::string segment = LbTestSegment(before);
+				std::vector<size_t> cuts = { lead + 3 + first };
+				if (second != first)
+					cuts.push_back(lead + 3 + second);
+
+				scan.state = LB_MATCHER_ROOT_STATE;
+				scan.replacements = 0;
+				LbTestScanSegment(&scan, segment, cuts);
+
+				LB_CHECK(segment.substr(LB_TEST_TCP_HEADER) == std::string(lead + 3, 'x') + "Hate" + "xxx");
+				LB_CHECK_EQUAL(1, scan.replacements);
+				LB_CHECK(LbTestChecksumValid(segment));
+			}
+		}
+	}
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(MatchSplitBetweenSegmentsIsLeftAlone)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("Love", "Hate");
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+		return;
+
+	LB_FLOW_KEY key = LbTestKey();
+	LB_SCAN_CONTEXT scan = {};
+	scan.matcher = matcher;
+	scan.key = &key;
+	scan.state = LB_MATCHER_ROOT_STATE;
+
+	// The first half is already on its way, writing "te" alone would leave "Late" on the wire
+	std::string first = LbTestSegment("xxLo");
+	std::string second = LbTestSegment("ve and Love");
+
+	LbTestScanSegment(&scan, first, {});
+	LbTestScanSegment(&scan, second, { 3 });
+
+	LB_CHECK(first.substr(LB_TEST_TCP_HEADER) == "xxLo");
+	LB_CHECK(second.substr(LB_TEST_TCP_HEADER) == "ve and Hate");
+	LB_CHECK_EQUAL(1, scan.replacements);
+	LB_CHECK(LbTestChecksumValid(first));
+	LB_CHECK(LbTestChecksumValid(second));
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(RandomSegmentsMatchTheReference)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 patched = 0;
+
+	for (int round = 0; round < 200; round++)
+	{
+		LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcd", 1 + rng() % 20, 1, 10, round % 4 != 0);
+		pairs.reversal = rng() % 2 == 0;
+		LB_USERDATA ud = pairs.UserData();
+		LB_MATCHER* matcher = NULL;
+		if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+			return;
+
+		LB_FLOW_KEY key = LbTestKey();
+		LB_SCAN_CONTEXT scan = {};
+		scan.matcher = matcher;
+		scan.key = &key;
+		scan.state = LB_MATCHER_ROOT_STATE;
+
+		// One stream cut into segments, each segment into no more buffers than a scan can reach back into
+		std::string data = LbReferenceString(rng, "abcd", rng() % 3000);
+		std::vector<size_t> segmentCuts = LbTestCuts(rng, data.size(), rng() % 10);
+		std::string result;
+		UINT32 expected = 0;
+		size_t start = 0;
+
+		for (size_t n = 0; n <= segmentCuts.size(); n++)
+		{
+			size_t end = n < segmentCuts.size() ? segmentCuts[n] : data.size();
+			std::string segment = LbTestSegment(data.substr(start, end - start));
+
+			patched += LbTestScanSegment(&scan, segment, LbTestCuts(rng, end - start, rng() % LB_MATCHER_MAX_SPANS));
+			LB_CHECK(LbTestChecksumValid(segment));
+			result += segment.substr(LB_TEST_TCP_HEADER);
+			start = end;
+		}
+
+		LB_CHECK(result == LbReferenceRewrite(pairs, data, segmentCuts, false, true, &expected));
+		LB_CHECK_EQUAL(expected, scan.replacements);
+		LB_CHECK_EQUAL(data.size(), scan.bytes);
+
+		LbMatcherFree(matcher);
+	}
+
+	// Not every segment was summed again
+	LB_CHECK(patched > 0);
+}
+
+LB_TEST(LengthChangingRewriteKeepsTheStreamInOrder)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 resized = 0;
+
+	for (int round = 0; round < 200; round++)
+	{
+		LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcd", 1 + rng() % 10, 1, 6, false);
+		pairs.reversal = rng() % 2 == 0;
+		LB_USERDATA ud = pairs.UserData();
+		LB_MATCHER* matcher = NULL;
+		if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+			return;
+
+		LB_FLOW_KEY key = LbTestKey();
+		LB_SEQ_TRACKER tracker;
+		LB_SCAN_CONTEXT scan = {};
+		scan.matcher = matcher;
+		scan.key = &key;
+		scan.state = LB_MATCHER_ROOT_STATE;
+		LbSeqTrackerInitialize(&tracker);
+
+		std::string data = LbReferenceString(rng, "abcd", rng() % 4000);
+		std::vector<size_t> cuts = LbTestCuts(rng, data.size(), rng() % 12);
+		std::string result;
+		std::string reference;
+		UINT32 expected = 0;
+		UINT32 sequence = rng();
+		UINT32 sent = sequence;		// Where the rewritten stream stands
+		size_t start = 0;
+
+		for (size_t n = 0; n <= cuts.size(); n++)
+		{
+			size_t end = n < cuts.size() ? cuts[n] : data.size();
+			std::string segment = LbTestSegment(data.substr(start, end - start));
+			std::vector<UINT8> output(LB_TEST_TCP_HEADER + LbMatcherRewriteBound(matcher, end - start));
+			ULONG outputLength = 0;
+
+			LbWriteBe32((UINT8*)&segment[4], sequence);
+			LbWriteBe16((UINT8*)&segment[16], 0);
+			LbWriteBe16((UINT8*)&segment[16], LbTransportChecksumV4(LbTestSource, LbTestDestination, LB_IPPROTO_TCP, (const UINT8*)segment.data(), segment.size()));
+
+			std::string out = segment;
+			if (LbRewriteTransport(&key, &tracker, &scan, (const UINT8*)segment.data(), (ULONG)segment.size(), output.data(), (ULONG)output.size(), &outputLength))
+				out.assign((const char*)output.data(), outputLength);
+
+			// Every segment starts where the rewritten stream left off and carries a valid checksum
+			LB_CHECK_EQUAL(sent, LbReadBe32((const UINT8*)&out[4]));
+			LB_CHECK(LbTestChecksumValid(out));
+			resized += out.size() != segment.size();
+
+			// The receiver acknowledging all of it is mapped back to the end of the original
+			sent += (UINT32)(out.size() - LB_TEST_TCP_HEADER);
+			sequence += (UINT32)(end - start);
+			LB_CHECK_EQUAL(sequence, LbSeqTrackerMapAck(&tracker, sent));
+
+			// A resend comes out exactly as the first send and leaves the stream where it was
+			if (rng() % 4 == 0)
+			{
+				UINT32 replacements = scan.replacements;
+				std::string again = segment;
+				if (LbRewriteTransport(&key, &tracker, &scan, (const UINT8*)segment.data(), (ULONG)segment.size(), output.data(), (ULONG)output.size(), &outputLength))
+					again.assign((const char*)output.data(), outputLength);
+
+				LB_CHECK(again == out);
+				scan.replacements = replacements;
+			}
+
+			// Each segment is rewritten on its own
+			UINT32 replacements = 0;
+			reference += LbReferenceRewrite(pairs, data.substr(start, end - start), {}, false, false, &replacements);
+			expected += replacements;
+
+			result += out.substr(LB_TEST_TCP_HEADER);
+			start = end;
+		}
+
+		LB_CHECK(result == reference);
+		LB_CHECK_EQUAL(expected, scan.replacements);
+
+		LbMatcherFree(matcher);
+	}
+
+	LB_CHECK(resized > 0);
+}
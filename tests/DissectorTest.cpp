@@ -0,0 +1,462 @@
+/*/
+/*  ** DissectorTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the HTTP and DNS dissectors: the field of every byte of messages built with a known
+/*	layout, the same fields however a stream is split, mutated streams that must never be read out of bounds,
+/*	the placing of segments in a stream, and the in place scan limited to the fields of a rule set.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbReference.h"
+#include "ClassifyCore.h"
+#include <algorithm>
+
+/////////////
+// HELPERS //
+/////////////
+
+// A stream and the field each of its bytes belongs to, 0 for framing that belongs to none
+struct LB_TEST_STREAM
+{
+	std::string data;
+	std::vector<UINT32> fields;
+
+	void Add(const std::string& part, UINT32 field)
+	{
+		data += part;
+		fields.insert(fields.end(), part.size(), field);
+	}
+};
+
+// What the dissector reported for a stream: the field of every byte, and where each field started anew
+struct LB_TEST_RESULT
+{
+	std::vector<UINT32> fields;
+	std::vector<std::pair<size_t, UINT32>> firsts;
+	UINT32 errors;				// Runs out of bounds, out of order or reported twice
+
+	bool operator==(const LB_TEST_RESULT& other) const
+	{
+		return fields == other.fields && firsts == other.firsts && errors == other.errors;
+	}
+};
+
+struct LB_TEST_FEED
+{
+	LB_TEST_RESULT* result;
+	UINT32 field;
+	size_t base;				// Offset of the current feed in the stream
+	size_t length;				// Bytes of the current feed
+	size_t end;					// End of the previous run
+};
+
+static void LbTestRun(SIZE_T offset, SIZE_T length, BOOLEAN first, void* value)
+{
+	LB_TEST_FEED* feed = (LB_TEST_FEED*)value;
+	size_t start = feed->base + offset;
+
+	if (length == 0 || offset > feed->length || length > feed->length - offset || start < feed->end)
+	{
+		feed->result->errors++;
+		return;
+	}
+
+	for (size_t i = start; i < start + length; i++)
+	{
+		if (feed->result->fields[i] != 0)
+			feed->result->errors++;
+		feed->result->fields[i] = feed->field;
+	}
+
+	if (first)
+		feed->result->firsts.push_back(std::make_pair(start, feed->field));
+	feed->end = start + length;
+}
+
+// Dissect data fed in pieces ending at cuts, once for every field on its own
+static LB_TEST_RESULT LbTestDissect(UINT8 protocol, const std::string& data, const std::vector<size_t>& cuts)
+{
+	LB_TEST_RESULT result = {};
+	result.fields.resize(data.size());
+
+	for (UINT32 field = 1; field & LB_FIELD_ALL; field <<= 1)
+	{
+		LB_DISSECTOR dissector;
+		LB_TEST_FEED feed = { &result, field, 0, 0, 0 };
+		LbDissectorBegin(&dissector, protocol);
+
+		for (size_t n = 0; n <= cuts.size(); n++)
+		{
+			size_t end = n < cuts.size() ? cuts[n] : data.size();
+			feed.length = end - feed.base;
+			LbDissectorFeed(&dissector, field, (const UINT8*)&data[feed.base], feed.length, LbTestRun, &feed);
+			feed.base = end;
+		}
+	}
+
+	std::sort(result.firsts.begin(), result.firsts.end());
+	return result;
+}
+
+static std::vector<size_t> LbTestCuts(std::mt19937& rng, size_t length, size_t count)
+{
+	std::vector<size_t> cuts;
+
+	for (size_t n = 0; n < count && length > 1; n++)
+		cuts.push_back(1 + rng() % (length - 1));
+	std::sort(cuts.begin(), cuts.end());
+	cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+	return cuts;
+}
+
+static std::vector<size_t> LbTestEveryByte(size_t length)
+{
+	std::vector<size_t> cuts;
+
+	for (size_t i = 1; i < length; i++)
+		cuts.push_back(i);
+
+	return cuts;
+}
+
+// One HTTP message of a random kind, with the field of every byte. Only the last one may end with the connection.
+static void LbTestHttpMessage(std::mt19937& rng, LB_TEST_STREAM* stream, BOOLEAN last)
+{
+	std::string body = LbReferenceString(rng, "abcLove \r\n", rng() % 64);
+	UINT32 kind = rng() % (last ? 5 : 4);
+
+	if (kind == 4)
+	{
+		// A response without a length lasts until the connection closes
+		stream->Add("HTTP/1.0 200 OK\r\n", LB_FIELD_HTTP_START_LINE);
+		stream->Add("Server: x\r\n\r\n", LB_FIELD_HTTP_HEADERS);
+		stream->Add(body, LB_FIELD_HTTP_BODY);
+		return;
+	}
+
+	if (kind == 3)
+	{
+		// A response no body can follow, whatever its length says
+		stream->Add(rng() % 2 ? "HTTP/1.1 204 No Content\r\n" : "HTTP/1.1 100 Continue\r\n", LB_FIELD_HTTP_START_LINE);
+		stream->Add("Content-Length: 10\r\n", LB_FIELD_HTTP_HEADERS);
+		stream->Add("\r\n", LB_FIELD_HTTP_HEADERS);
+		return;
+	}
+
+	stream->Add(kind == 0 ? "GET /index.html HTTP/1.1\r\n" : kind == 1 ? "POST /upload HTTP/1.1\n" : "HTTP/1.1 200 OK\r\n", LB_FIELD_HTTP_START_LINE);
+	stream->Add("Host: www.example.com\r\n", LB_FIELD_HTTP_HEADERS);
+	if (rng() % 2)
+		stream->Add("X-Love: Love\r\n", LB_FIELD_HTTP_HEADERS);
+
+	if (kind == 0)
+		stream->Add("\r\n", LB_FIELD_HTTP_HEADERS);
+	else if (kind == 1)
+	{
+		stream->Add("content-length:  " + std::to_string(body.size()) + "\n", LB_FIELD_HTTP_HEADERS);
+		stream->Add("\n", LB_FIELD_HTTP_HEADERS);
+		stream->Add(body, LB_FIELD_HTTP_BODY);
+	}
+	else
+	{
+		// Chunk framing belongs to no field
+		stream->Add("Transfer-Encoding: gzip, chunked\r\n", LB_FIELD_HTTP_HEADERS);
+		stream->Add("\r\n", LB_FIELD_HTTP_HEADERS);
+		for (UINT32 chunks = rng() % 3; chunks > 0; chunks--)
+		{
+			std::string chunk = LbReferenceString(rng, "abcLove", 1 + rng() % 24);
+			char size[16];
+			snprintf(size, sizeof(size), "%zX;ext=1\r\n", chunk.size());
+			stream->Add(size, 0);
+			stream->Add(chunk, LB_FIELD_HTTP_BODY);
+			stream->Add("\r\n", 0);
+		}
+		stream->Add("0\r\n", 0);
+		if (rng() % 2)
+			stream->Add("Trailer: x\r\n", 0);
+		stream->Add("\r\n", 0);
+	}
+}
+
+static LB_TEST_STREAM LbTestHttpStream(std::mt19937& rng)
+{
+	LB_TEST_STREAM stream;
+	UINT32 messages = 1 + rng() % 4;
+
+	for (UINT32 m = 0; m < messages; m++)
+		LbTestHttpMessage(rng, &stream, m + 1 == messages);
+
+	return stream;
+}
+
+static void LbTestBe16(LB_TEST_STREAM* stream, UINT16 value, UINT32 field)
+{
+	std::string bytes(2, '\0');
+	LbWriteBe16((UINT8*)&bytes[0], value);
+	stream->Add(bytes, field);
+}
+
+// A DNS response with every kind of name: labels, a pointer, labels ending in a pointer and the root
+static LB_TEST_STREAM LbTestDnsMessage(std::mt19937& rng)
+{
+	LB_TEST_STREAM stream;
+	std::string address = LbReferenceString(rng, "\x01\x02\xC0\x00", 4);
+
+	LbTestBe16(&stream, 0x1234, 0);
+	LbTestBe16(&stream, 0x8180, 0);
+	LbTestBe16(&stream, 1, 0);
+	LbTestBe16(&stream, 2, 0);
+	LbTestBe16(&stream, 0, 0);
+	LbTestBe16(&stream, 1, 0);
+
+	stream.Add(std::string("\x03www\x07" "example\x03" "com\x00", 17), LB_FIELD_DNS_NAMES);
+	stream.Add(std::string("\x00\x01\x00\x01", 4), 0);
+
+	stream.Add("\xC0\x0C", LB_FIELD_DNS_NAMES);
+	stream.Add(std::string("\x00\x01\x00\x01\x00\x00\x0E\x10\x00\x04", 10), 0);
+	stream.Add(address, LB_FIELD_DNS_DATA);
+
+	stream.Add("\x04" "mail\xC0\x10", LB_FIELD_DNS_NAMES);
+	stream.Add(std::string("\x00\x10\x00\x01\x00\x00\x0E\x10\x00\x00", 10), 0);
+
+	stream.Add(std::string("\x00", 1), LB_FIELD_DNS_NAMES);
+	stream.Add(std::string("\x00\x29\x10\x00\x00\x00\x00\x00\x00\x06", 10), 0);
+	stream.Add("v=Love", LB_FIELD_DNS_DATA);
+
+	// Whatever follows the last record is not part of the message
+	stream.Add("xyz", 0);
+	return stream;
+}
+
+// Damage a stream the way a broken or hostile peer would
+static std::string LbTestMutate(std::mt19937& rng, std::string data)
+{
+	for (UINT32 mutations = 1 + rng() % 4; mutations > 0 && !data.empty(); mutations--)
+	{
+		size_t at = rng() % data.size();
+
+		switch (rng() % 6)
+		{
+		case 0: data[at] = (char)rng(); break;
+		case 1: data.insert(at, 1, "\r\n:0123456789abcdefABCDEF\xC0\x3F"[rng() % 27]); break;
+		case 2: data.erase(at, 1 + rng() % 8); break;
+		case 3: data.resize(at); break;
+		case 4: data.insert(at, rng() % 2 ? "Content-Length: 99999999999999999999\r\n" : "Transfer-Encoding: chunked\r\n\r\nFFFFFFFFFFFFFFFF\r\n"); break;
+		default: data.insert(at, data.substr(rng() % data.size(), 1 + rng() % 32)); break;
+		}
+	}
+
+	return data;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(HttpFieldsOfEveryByte)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	for (UINT32 round = 0; round < 200; round++)
+	{
+		LB_TEST_STREAM stream = LbTestHttpStream(rng);
+		LB_TEST_RESULT result = LbTestDissect(LB_DISSECTOR_HTTP, stream.data, {});
+
+		if (result.fields != stream.fields || result.errors != 0)
+		{
+			printf("  %s\n", stream.data.c_str());
+			wrong++;
+		}
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+
+	// Pipelined requests start their fields anew, chunk framing does not split a body in two
+	LB_TEST_STREAM stream;
+	stream.Add("GET / HTTP/1.1\r\n", LB_FIELD_HTTP_START_LINE);
+	stream.Add("\r\n", LB_FIELD_HTTP_HEADERS);
+	stream.Add("HTTP/1.1 200 OK\r\n", LB_FIELD_HTTP_START_LINE);
+	stream.Add("Transfer-Encoding: chunked\r\n\r\n", LB_FIELD_HTTP_HEADERS);
+	stream.Add("2\r\n", 0);
+	stream.Add("Lo", LB_FIELD_HTTP_BODY);
+	stream.Add("\r\n2\r\n", 0);
+	stream.Add("ve", LB_FIELD_HTTP_BODY);
+	stream.Add("\r\n0\r\n\r\n", 0);
+
+	LB_TEST_RESULT result = LbTestDissect(LB_DISSECTOR_HTTP, stream.data, {});
+	LB_CHECK(result.fields == stream.fields);
+	LB_CHECK_EQUAL(5, result.firsts.size());
+	LB_CHECK_EQUAL(LB_FIELD_HTTP_BODY, result.firsts.back().second);
+
+	// What is not HTTP is left to LB_FIELD_OTHER from where it stops making sense
+	result = LbTestDissect(LB_DISSECTOR_HTTP, "GET / HTTP/1.1\r\n\r\n\x16\x03\x01 hello", {});
+	LB_CHECK_EQUAL(LB_FIELD_HTTP_HEADERS, result.fields[17]);
+	LB_CHECK_EQUAL(LB_FIELD_OTHER, result.fields[18]);
+	LB_CHECK_EQUAL(LB_FIELD_OTHER, result.fields.back());
+}
+
+LB_TEST(DnsFieldsOfEveryByte)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_TEST_STREAM stream = LbTestDnsMessage(rng);
+	LB_TEST_RESULT result = LbTestDissect(LB_DISSECTOR_DNS, stream.data, {});
+
+	LB_CHECK(result.fields == stream.fields);
+	LB_CHECK_EQUAL(0, result.errors);
+
+	// A label past the 255 byte limit of a name loses the message
+	std::string longName(12, '\0');
+	longName[5] = 1;
+	for (int label = 0; label < 5; label++)
+		longName += std::string(1, (char)63) + std::string(63, 'a');
+	longName += std::string("\x00\x00\x01\x00\x01", 5);
+
+	result = LbTestDissect(LB_DISSECTOR_DNS, longName, {});
+	LB_CHECK_EQUAL(LB_FIELD_DNS_NAMES, result.fields[12]);
+	LB_CHECK_EQUAL(LB_FIELD_OTHER, result.fields.back());
+	LB_CHECK_EQUAL(0, result.errors);
+}
+
+LB_TEST(EverySplitGivesTheSameFields)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	for (UINT32 round = 0; round < 200; round++)
+	{
+		BOOLEAN dns = round % 4 == 0;
+		LB_TEST_STREAM stream = dns ? LbTestDnsMessage(rng) : LbTestHttpStream(rng);
+		UINT8 protocol = dns ? LB_DISSECTOR_DNS : LB_DISSECTOR_HTTP;
+		LB_TEST_RESULT whole = LbTestDissect(protocol, stream.data, {});
+
+		wrong += !(LbTestDissect(protocol, stream.data, LbTestEveryByte(stream.data.size())) == whole);
+		wrong += !(LbTestDissect(protocol, stream.data, LbTestCuts(rng, stream.data.size(), 1 + rng() % 8)) == whole);
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+}
+
+LB_TEST(MutatedStreamsStayInBounds)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	// Every run inside what was fed, in order, once, and the same however the stream is split. Built with
+	// LB_SANITIZE this also catches any read past the end of a piece.
+	for (UINT32 round = 0; round < 3000; round++)
+	{
+		BOOLEAN dns = round % 3 == 0;
+		std::string data = LbTestMutate(rng, dns ? LbTestDnsMessage(rng).data : LbTestHttpStream(rng).data);
+		UINT8 protocol = dns ? LB_DISSECTOR_DNS : LB_DISSECTOR_HTTP;
+		LB_TEST_RESULT whole = LbTestDissect(protocol, data, {});
+		LB_TEST_RESULT split = LbTestDissect(protocol, data, LbTestCuts(rng, data.size(), 1 + rng() % 16));
+
+		wrong += whole.errors != 0 || !(split == whole);
+	}
+
+	for (UINT32 round = 0; round < 500; round++)
+	{
+		std::string data = LbReferenceString(rng, std::string("\x00\x01\x03\xC0\r\nHTTP/1.1 GET: 0a", 22), rng() % 256);
+		for (UINT8 protocol : { LB_DISSECTOR_HTTP, LB_DISSECTOR_DNS })
+			wrong += !(LbTestDissect(protocol, data, {}) == LbTestDissect(protocol, data, LbTestEveryByte(data.size())));
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+}
+
+LB_TEST(SegmentsArePlacedInTheStream)
+{
+	const std::string request = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+	LB_DISSECTOR dissector;
+
+	// Sequence numbers wrap in the middle of the stream
+	LbDissectorBegin(&dissector, LB_DISSECTOR_HTTP);
+	LB_CHECK(LbDissectorInSequence(&dissector, 0xFFFFFFF0, 20));
+	LB_CHECK(LbDissectorInSequence(&dissector, 4, 7));
+	LB_CHECK_EQUAL(LB_DISSECTOR_HTTP, dissector.protocol);
+
+	// A resend is not fed again, neither is a part of one
+	LB_CHECK(!LbDissectorInSequence(&dissector, 4, 7));
+	LB_CHECK(!LbDissectorInSequence(&dissector, 0xFFFFFFF0, 30));
+	LB_CHECK(LbDissectorInSequence(&dissector, 11, 0));
+	LB_CHECK_EQUAL(LB_DISSECTOR_HTTP, dissector.protocol);
+
+	// After a gap there is no telling where in a message the stream is
+	LB_CHECK(LbDissectorInSequence(&dissector, 12, 5));
+	LB_CHECK_EQUAL(LB_DISSECTOR_NONE, dissector.protocol);
+
+	LB_TEST_RESULT result = {};
+	result.fields.resize(request.size());
+	LB_TEST_FEED feed = { &result, LB_FIELD_OTHER, 0, request.size(), 0 };
+	LbDissectorFeed(&dissector, LB_FIELD_OTHER, (const UINT8*)request.data(), request.size(), LbTestRun, &feed);
+	LB_CHECK(std::count(result.fields.begin(), result.fields.end(), LB_FIELD_OTHER) == (long)request.size());
+
+	// Flows are only dissected on the well known ports
+	LB_FLOW_KEY key = {};
+	key.protocol = LB_IPPROTO_TCP;
+	key.localPort = LB_HTTP_PORT;
+	LB_CHECK_EQUAL(LB_DISSECTOR_HTTP, LbDissectorForFlow(&key));
+	key.protocol = LB_IPPROTO_UDP;
+	LB_CHECK_EQUAL(LB_DISSECTOR_NONE, LbDissectorForFlow(&key));
+	key.remotePort = LB_DNS_PORT;
+	LB_CHECK_EQUAL(LB_DISSECTOR_DNS, LbDissectorForFlow(&key));
+}
+
+LB_TEST(ScanOnlyTouchesTheRuleSetFields)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("Love", "Hate");
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+		return;
+
+	LB_FLOW_KEY key = {};
+	key.protocol = LB_IPPROTO_TCP;
+	key.remotePort = LB_HTTP_PORT;
+	key.family = LB_FAMILY_IPV4;
+
+	LB_DISSECTOR stream;
+	LbDissectorBegin(&stream, LbDissectorForFlow(&key));
+
+	LB_SCAN_CONTEXT scan = {};
+	scan.matcher = matcher;
+	scan.key = &key;
+	scan.stream = &stream;
+	scan.fields = LB_FIELD_HTTP_HEADERS;
+	scan.state = LB_MATCHER_ROOT_STATE;
+
+	// The headers are split over two segments, the body over the second and third
+	std::string first = "POST /Love HTTP/1.1\r\nX-Note: Love\r\nContent-Le";
+	std::string second = "ngth: 12\r\n\r\nLove";
+	std::string third = "LoveLove";
+	UINT32 sequence = 1000;
+
+	for (std::string* segment : { &first, &second, &third })
+	{
+		LbScanSegment(&scan, sequence, segment->size());
+		LbScanBuffer(&scan, (UINT8*)&(*segment)[0], segment->size());
+		sequence += (UINT32)segment->size();
+	}
+
+	LB_CHECK(first == "POST /Love HTTP/1.1\r\nX-Note: Hate\r\nContent-Le");
+	LB_CHECK(second == "ngth: 12\r\n\r\nLove");
+	LB_CHECK(third == "LoveLove");
+	LB_CHECK_EQUAL(1, scan.replacements);
+	LB_CHECK_EQUAL(21 + 12, scan.skipped);
+
+	// A resent segment is scanned whole, it has no place in the stream any more
+	std::string resent = "LoveLove";
+	LbScanSegment(&scan, sequence - 8, resent.size());
+	LbScanBuffer(&scan, (UINT8*)&resent[0], resent.size());
+	LB_CHECK(resent == "HateHate");
+
+	LbMatcherFree(matcher);
+}
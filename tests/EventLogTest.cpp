@@ -0,0 +1,243 @@
+/*/
+/*  ** EventLogTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the event log: records coming back as written, full rings counting their losses,
+/*	drains into small buffers, levels compiled out, and writers racing a reader with every event accounted for.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "EventLog.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+// Events of one processor carry consecutive sequence numbers, lost ones never took a number
+static UINT32 LbTestSequenceGaps(const std::vector<LB_EVENT>& events, std::vector<INT64>& last)
+{
+	UINT32 gaps = 0;
+
+	for (const LB_EVENT& event : events)
+	{
+		if (event.processor >= last.size())
+		{
+			gaps++;
+			continue;
+		}
+
+		gaps += last[event.processor] >= 0 && event.sequence != (UINT32)(last[event.processor] + 1);
+		last[event.processor] = event.sequence;
+	}
+
+	return gaps;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(CreateRejectsBadCapacities)
+{
+	LB_EVENT_LOG* log = NULL;
+
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbEventLogCreate(0, &log));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbEventLogCreate(100, &log));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbEventLogCreate(64, NULL));
+	LB_CHECK(log == NULL);
+}
+
+LB_TEST(DrainReturnsWhatWasWritten)
+{
+	LB_EVENT_LOG* log = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbEventLogCreate(64, &log)))
+		return;
+
+	for (UINT64 i = 0; i < 10; i++)
+	{
+		UINT64 args[] = { i, i * 2, i * 3 };
+		LbEventLogWrite(log, LB_LEVEL_INFO, LB_EVENT_PACKET_INSPECTED, args, (UINT32)(i % 4));
+	}
+
+	std::vector<LB_EVENT> events(64);
+	UINT64 lost = 99;
+	UINT32 count = LbEventLogDrain(log, events.data(), 64, &lost);
+
+	LB_CHECK_EQUAL(10, count);
+	LB_CHECK_EQUAL(0, lost);
+
+	UINT32 wrong = 0;
+	for (UINT32 i = 0; i < count; i++)
+	{
+		const LB_EVENT& event = events[i];
+		wrong += event.id != LB_EVENT_PACKET_INSPECTED || event.level != LB_LEVEL_INFO || event.argCount != i % 4;
+		wrong += event.sequence != i || (i > 0 && event.timestamp < events[i - 1].timestamp);
+		for (UINT32 a = 0; a < LB_EVENT_ARGS; a++)
+			wrong += event.args[a] != (a < event.argCount ? i * (a + 1) : 0);
+	}
+	LB_CHECK_EQUAL(0, wrong);
+
+	LB_CHECK_EQUAL(0, LbEventLogDrain(log, events.data(), 64, &lost));
+	LbEventLogDestroy(log);
+}
+
+LB_TEST(FullRingCountsWhatItDrops)
+{
+	const UINT32 capacity = 16;
+	LB_EVENT_LOG* log = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbEventLogCreate(capacity, &log)))
+		return;
+
+	// Pinned, so every write goes to the same ring
+	cpu_set_t previous;
+	cpu_set_t set;
+	pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous);
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	for (UINT64 i = 0; i < capacity + 5; i++)
+		LbEventLogWrite(log, LB_LEVEL_TRACE, LB_EVENT_SEGMENT_INJECTED, &i, 1);
+
+	std::vector<LB_EVENT> events(capacity * 2);
+	UINT64 lost = 0;
+
+	LB_CHECK_EQUAL(capacity, LbEventLogDrain(log, events.data(), capacity * 2, &lost));
+	LB_CHECK_EQUAL(5, lost);
+	LB_CHECK_EQUAL(capacity - 1, events[capacity - 1].args[0]);
+
+	// Losses are reported once, and the ring takes events again once drained
+	UINT64 next = 1000;
+	LbEventLogWrite(log, LB_LEVEL_TRACE, LB_EVENT_SEGMENT_INJECTED, &next, 1);
+	LB_CHECK_EQUAL(1, LbEventLogDrain(log, events.data(), capacity * 2, &lost));
+	LB_CHECK_EQUAL(0, lost);
+	LB_CHECK_EQUAL(1000, events[0].args[0]);
+	LB_CHECK_EQUAL(capacity, events[0].sequence);
+
+	pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+	LbEventLogDestroy(log);
+}
+
+LB_TEST(SmallBuffersDrainInPieces)
+{
+	LB_EVENT_LOG* log = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbEventLogCreate(128, &log)))
+		return;
+
+	for (UINT64 i = 0; i < 100; i++)
+		LbEventLogWrite(log, LB_LEVEL_INFO, LB_EVENT_FIRST_BLOCK, &i, 1);
+
+	std::vector<LB_EVENT> all;
+	std::vector<LB_EVENT> events(7);
+	UINT32 count = 0;
+	UINT64 lost = 0;
+
+	while ((count = LbEventLogDrain(log, events.data(), 7, &lost)) != 0)
+	{
+		LB_CHECK(count <= 7);
+		all.insert(all.end(), events.begin(), events.begin() + count);
+	}
+
+	std::vector<INT64> last(LbProcessorCount(), -1);
+	LB_CHECK_EQUAL(100, all.size());
+	LB_CHECK_EQUAL(0, LbTestSequenceGaps(all, last));
+	LbEventLogDestroy(log);
+}
+
+LB_TEST(LevelsAboveTheMaximumAreCompiledOut)
+{
+	LB_EVENT_LOG* log = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbEventLogCreate(64, &log)))
+		return;
+
+	lbEventLog = log;
+	LBEVENT(LB_LEVEL_ERROR, LB_EVENT_INJECT_FAILED, (UINT32)STATUS_INVALID_PARAMETER);
+	LBEVENT(LB_EVENT_LEVEL_MAX + 1, LB_EVENT_INJECT_FAILED, 1, 2);
+	lbEventLog = NULL;
+
+	LB_EVENT events[4];
+	UINT64 lost = 0;
+	LB_CHECK_EQUAL(1, LbEventLogDrain(log, events, 4, &lost));
+	LB_CHECK_EQUAL(LB_LEVEL_ERROR, events[0].level);
+	LB_CHECK_EQUAL((UINT64)(UINT32)STATUS_INVALID_PARAMETER, events[0].args[0]);
+	LbEventLogDestroy(log);
+}
+
+LB_TEST(WritersRacingAReaderLoseNothingUncounted)
+{
+	const UINT32 writerCount = 4;
+	const UINT32 perWriter = 200000;
+	LB_EVENT_LOG* log = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbEventLogCreate(256, &log)))
+		return;
+
+	std::atomic<UINT32> running(writerCount);
+	std::vector<std::thread> writers;
+
+	for (UINT32 w = 0; w < writerCount; w++)
+	{
+		writers.emplace_back([&, w]() {
+			for (UINT64 i = 0; i < perWriter; i++)
+			{
+				UINT64 args[] = { w, i };
+				LbEventLogWrite(log, LB_LEVEL_TRACE, LB_EVENT_PACKET_INSPECTED, args, 2);
+			}
+			running--;
+		});
+	}
+
+	// Each writer's event i may be read at most once, and what was not read must have been counted lost
+	std::vector<std::vector<bool>> seen(writerCount, std::vector<bool>(perWriter));
+	std::vector<INT64> last(LbProcessorCount(), -1);
+	std::vector<LB_EVENT> events(64);
+	UINT64 read = 0;
+	UINT64 lost = 0;
+	UINT32 wrong = 0;
+
+	for (BOOLEAN done = FALSE; !done; )
+	{
+		done = running.load() == 0;
+
+		UINT64 dropped = 0;
+		UINT32 count = LbEventLogDrain(log, events.data(), (UINT32)events.size(), &dropped);
+		lost += dropped;
+		read += count;
+
+		for (UINT32 i = 0; i < count; i++)
+		{
+			UINT64 writer = events[i].args[0];
+			UINT64 index = events[i].args[1];
+			if (writer >= writerCount || index >= perWriter || seen[writer][index])
+			{
+				wrong++;
+				continue;
+			}
+			seen[writer][index] = true;
+		}
+
+		std::vector<LB_EVENT> batch(events.begin(), events.begin() + count);
+		wrong += LbTestSequenceGaps(batch, last);
+
+		// A drain that came up short only ends the loop once the writers had finished before it started
+		if (done && count == events.size())
+			done = FALSE;
+		if (count == 0)
+			std::this_thread::yield();
+	}
+
+	for (std::thread& writer : writers)
+		writer.join();
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK_EQUAL((UINT64)writerCount * perWriter, read + lost);
+	LB_CHECK(read > 0);
+	LbEventLogDestroy(log);
+}
@@ -0,0 +1,599 @@
+/*/
+/*  ** FilterCompilerTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the filter compiler, against an LB_FILTER_ENGINE that only records what is added
+/*	and deleted. The filters it is left with are evaluated the way the filter engine would: the heaviest
+/*	filter matching a packet decides, and nothing matching permits it. Every flow has to end up where the
+/*	classifier sends it: dropped, permitted, or handed to the callout that inspects it or translates its
+/*	acknowledgements.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "FilterCompiler.h"
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+// Filter engine that keeps the filters added to it, add number failAt fails
+struct LB_TEST_ENGINE
+{
+	std::map<UINT64, LB_FILTER_SPEC> filters;
+	std::vector<UINT64> added;
+	std::vector<UINT64> deleted;
+	UINT64 nextId = 1000;
+	UINT32 failAt = 0xFFFFFFFF;
+	UINT32 unknownDeletes = 0;
+};
+
+static NTSTATUS LbTestAddFilter(void* context, const LB_FILTER_SPEC* filter, UINT64* filterId)
+{
+	LB_TEST_ENGINE* engine = (LB_TEST_ENGINE*)context;
+
+	if (engine->added.size() == engine->failAt)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	*filterId = engine->nextId++;
+	engine->filters[*filterId] = *filter;
+	engine->added.push_back(*filterId);
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS LbTestDeleteFilter(void* context, UINT64 filterId)
+{
+	LB_TEST_ENGINE* engine = (LB_TEST_ENGINE*)context;
+
+	engine->deleted.push_back(filterId);
+	if (engine->filters.erase(filterId) == 0)
+	{
+		engine->unknownDeletes++;
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+struct LB_TEST_RULES
+{
+	std::vector<LB_ADDRESS_RULE> addresses;
+	std::vector<LB_PORT_RULE> ports;
+};
+
+// Compiles rules and installs their plan, with the ACK filter the driver adds once at load
+struct LB_TEST_INSTALL
+{
+	LB_CLASSIFIER* classifier = NULL;
+	LB_FILTER_PLAN plan = {};
+	std::vector<UINT64> ids;
+	LB_TEST_ENGINE mock;
+	LB_FILTER_ENGINE engine = { &mock, LbTestAddFilter, LbTestDeleteFilter };
+
+	BOOLEAN Install(const LB_TEST_RULES& rules, BOOLEAN stream)
+	{
+		LB_FILTER_SPEC ack;
+		UINT64 ackId = 0;
+
+		if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierCompile(rules.addresses.data(), (UINT32)rules.addresses.size(),
+			rules.ports.data(), (UINT32)rules.ports.size(), &classifier)))
+			return FALSE;
+		if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbFilterPlanCompile(classifier, stream, &plan)))
+			return FALSE;
+
+		LbFilterAckSpec(&ack);
+		LbTestAddFilter(&mock, &ack, &ackId);
+
+		ids.resize(plan.count + 1);
+		return LB_CHECK_EQUAL(STATUS_SUCCESS, LbFilterPlanInstall(&plan, &engine, ids.data()));
+	}
+
+	// Filters of the plan on one layer
+	std::vector<LB_FILTER_SPEC> Filters(UINT8 direction, UINT8 family, UINT8 layer) const
+	{
+		std::vector<LB_FILTER_SPEC> result;
+
+		for (UINT32 i = 0; i < plan.count; i++)
+		{
+			const LB_FILTER_SPEC& filter = plan.filters[i];
+			if (filter.direction == direction && filter.family == family && filter.layer == layer)
+				result.push_back(filter);
+		}
+
+		return result;
+	}
+
+	~LB_TEST_INSTALL()
+	{
+		LbFilterPlanFree(&plan);
+		LbClassifierFree(classifier);
+	}
+};
+
+// A packet as the filter engine sees it at one layer
+struct LB_TEST_PACKET
+{
+	UINT8 direction;
+	UINT8 family;
+	UINT8 layer;
+	BOOLEAN tcp;
+	UINT32 address;
+	UINT16 port;
+};
+
+static BOOLEAN LbTestMatches(const LB_FILTER_SPEC& filter, const LB_TEST_PACKET& packet)
+{
+	if (filter.direction != packet.direction || filter.family != packet.family || filter.layer != packet.layer)
+		return FALSE;
+	if (filter.matchAddress && (packet.address < filter.firstAddress || packet.address > filter.lastAddress))
+		return FALSE;
+	if (filter.matchPort && (packet.port < filter.firstPort || packet.port > filter.lastPort))
+		return FALSE;
+	if (filter.protocol != LB_FILTER_PROTOCOL_ANY && (filter.protocol == LB_FILTER_PROTOCOL_TCP) != packet.tcp)
+		return FALSE;
+
+	return TRUE;
+}
+
+// What the filter engine does with a packet: the heaviest matching filter decides. Two matching filters of the
+// same weight would leave it to the order they were added in, which counts as a failure.
+static LB_FILTER_ACTION LbTestEvaluate(const LB_TEST_ENGINE& engine, const LB_TEST_PACKET& packet)
+{
+	const LB_FILTER_SPEC* decides = NULL;
+	BOOLEAN tied = FALSE;
+
+	for (const auto& entry : engine.filters)
+	{
+		if (!LbTestMatches(entry.second, packet))
+			continue;
+
+		if (decides == NULL || LbFilterWeight(&entry.second) > LbFilterWeight(decides))
+		{
+			decides = &entry.second;
+			tied = FALSE;
+		}
+		else if (LbFilterWeight(&entry.second) == LbFilterWeight(decides))
+			tied = TRUE;
+	}
+
+	LB_CHECK(!tied);
+	return decides ? LbFilterAction(decides) : LB_FILTER_ACTION_PERMIT;
+}
+
+// Whether the filters of one tier and layer overlap anywhere
+static BOOLEAN LbTestDisjoint(const LB_FILTER_PLAN& plan)
+{
+	for (UINT32 i = 0; i < plan.count; i++)
+	{
+		for (UINT32 j = i + 1; j < plan.count; j++)
+		{
+			const LB_FILTER_SPEC& a = plan.filters[i];
+			const LB_FILTER_SPEC& b = plan.filters[j];
+
+			if (a.direction != b.direction || a.family != b.family || a.layer != b.layer || a.tier != b.tier)
+				continue;
+			if (a.protocol != LB_FILTER_PROTOCOL_ANY && b.protocol != LB_FILTER_PROTOCOL_ANY && a.protocol != b.protocol)
+				continue;
+
+			UINT32 firstA = a.tier == LB_FILTER_TIER_ADDRESS ? (a.matchAddress ? a.firstAddress : 0) : (a.matchPort ? a.firstPort : 0);
+			UINT32 lastA = a.tier == LB_FILTER_TIER_ADDRESS ? (a.matchAddress ? a.lastAddress : 0xFFFFFFFF) : (a.matchPort ? a.lastPort : 0xFFFF);
+			UINT32 firstB = b.tier == LB_FILTER_TIER_ADDRESS ? (b.matchAddress ? b.firstAddress : 0) : (b.matchPort ? b.firstPort : 0);
+			UINT32 lastB = b.tier == LB_FILTER_TIER_ADDRESS ? (b.matchAddress ? b.lastAddress : 0xFFFFFFFF) : (b.matchPort ? b.lastPort : 0xFFFF);
+
+			if (firstA <= lastB && firstB <= lastA)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static LB_ADDRESS_RULE LbTestAddress(UINT32 address, UINT8 prefixLength, UINT8 action, UINT8 directions)
+{
+	LB_ADDRESS_RULE rule = {};
+	rule.address = address;
+	rule.prefixLength = prefixLength;
+	rule.action = action;
+	rule.directions = directions;
+	return rule;
+}
+
+static LB_PORT_RULE LbTestPort(UINT16 firstPort, UINT16 lastPort, UINT8 action, UINT8 directions)
+{
+	LB_PORT_RULE rule = {};
+	rule.firstPort = firstPort;
+	rule.lastPort = lastPort;
+	rule.action = action;
+	rule.directions = directions;
+	return rule;
+}
+
+static LB_TEST_PACKET LbTestPacketOf(UINT8 direction, UINT8 family, UINT8 layer, BOOLEAN tcp, UINT32 address, UINT16 port)
+{
+	LB_TEST_PACKET packet = { direction, family, layer, tcp, address, port };
+	return packet;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(AddressTierOverridesPortTier)
+{
+	LB_TEST_RULES rules;
+	rules.ports.push_back(LbTestPort(80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0x0A010000, 16, LB_RULE_ACTION_PERMIT, LB_RULE_DIRECTION_OUTBOUND));
+
+	LB_TEST_INSTALL install;
+	if (!install.Install(rules, FALSE))
+		return;
+
+	LB_CHECK(LB_FILTER_WEIGHT_ADDRESS > LB_FILTER_WEIGHT_PORT && LB_FILTER_WEIGHT_PORT > LB_FILTER_WEIGHT_ACK);
+	for (UINT32 i = 0; i < install.plan.count; i++)
+	{
+		const LB_FILTER_SPEC& filter = install.plan.filters[i];
+		LB_CHECK_EQUAL(filter.matchAddress ? LB_FILTER_WEIGHT_ADDRESS : LB_FILTER_WEIGHT_PORT, LbFilterWeight(&filter));
+		LB_CHECK(filter.matchAddress ? filter.tier == LB_FILTER_TIER_ADDRESS : filter.matchPort && filter.tier == LB_FILTER_TIER_PORT);
+	}
+
+	// The blocked network drops port 80 too, the permitted one inside it gets port 80 back to the permit
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_BLOCK, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x0A020304, 80)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x0A010203, 80)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x08080808, 80)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x08080808, 443)));
+	LB_CHECK(LbTestDisjoint(install.plan));
+}
+
+LB_TEST(RangesWithinATierAreDisjoint)
+{
+	LB_TEST_RULES rules;
+
+	// Nested and overlapping rules, the flattened ranges they leave must not overlap
+	rules.ports.push_back(LbTestPort(1, 1023, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_INBOUND));
+	rules.ports.push_back(LbTestPort(80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.ports.push_back(LbTestPort(500, 2000, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0xC0A80000, 16, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0xC0A80100, 24, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0xC0A80101, 32, LB_RULE_ACTION_PERMIT, LB_RULE_DIRECTION_BOTH));
+
+	for (BOOLEAN stream : { FALSE, TRUE })
+	{
+		LB_TEST_INSTALL install;
+		if (!install.Install(rules, stream))
+			return;
+
+		LB_CHECK(LbTestDisjoint(install.plan));
+
+		// 192.168.1.0/24 is cut around the /32 into two ranges
+		std::vector<LB_FILTER_SPEC> filters = install.Filters(LB_DIRECTION_INBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT);
+		UINT32 inspected = 0;
+		for (const LB_FILTER_SPEC& filter : filters)
+		{
+			if (filter.tier == LB_FILTER_TIER_ADDRESS && filter.verdict == LB_VERDICT_INSPECT)
+			{
+				LB_CHECK(filter.lastAddress < 0xC0A80101 || filter.firstAddress > 0xC0A80101);
+				inspected++;
+			}
+		}
+		LB_CHECK_EQUAL(2, inspected);
+	}
+}
+
+LB_TEST(BlockOnlyRulesNeedNoCallout)
+{
+	LB_TEST_RULES rules;
+	rules.ports.push_back(LbTestPort(23, 23, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH));
+	rules.ports.push_back(LbTestPort(135, 139, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_INBOUND));
+	rules.addresses.push_back(LbTestAddress(0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_OUTBOUND));
+
+	LB_TEST_INSTALL install;
+	if (!install.Install(rules, TRUE))
+		return;
+
+	// Telnet both ways on both families, NetBIOS inbound on both, and the network outbound on IPv4 alone
+	LB_CHECK_EQUAL(4 + 2 + 1, install.plan.count);
+	for (UINT32 i = 0; i < install.plan.count; i++)
+	{
+		LB_CHECK_EQUAL(LB_FILTER_ACTION_BLOCK, LbFilterAction(&install.plan.filters[i]));
+		LB_CHECK_EQUAL(LB_FILTER_LAYER_TRANSPORT, install.plan.filters[i].layer);
+		LB_CHECK_EQUAL(LB_FILTER_PROTOCOL_ANY, install.plan.filters[i].protocol);
+	}
+
+	// Nothing but the ACK filter ever reaches a callout, and outbound traffic never does
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x08080808, 80)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_STREAM, TRUE, 0x08080808, 80)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_BLOCK, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, FALSE, 0x0A000001, 53)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_BLOCK, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_INBOUND, LB_FAMILY_IPV6, LB_FILTER_LAYER_TRANSPORT, TRUE, 0, 137)));
+}
+
+LB_TEST(InspectRulesGoToTheCallout)
+{
+	LB_TEST_RULES rules;
+	rules.ports.push_back(LbTestPort(80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_OUTBOUND));
+	rules.addresses.push_back(LbTestAddress(0xC0A80000, 16, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_INBOUND));
+
+	LB_TEST_INSTALL install;
+	if (!install.Install(rules, FALSE))
+		return;
+
+	for (UINT32 i = 0; i < install.plan.count; i++)
+	{
+		LB_CHECK_EQUAL(LB_VERDICT_INSPECT, install.plan.filters[i].verdict);
+		LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbFilterAction(&install.plan.filters[i]));
+	}
+
+	LB_CHECK_EQUAL(3, install.plan.count);
+	LB_CHECK_EQUAL(1, install.Filters(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT).size());
+	LB_CHECK_EQUAL(1, install.Filters(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV6, LB_FILTER_LAYER_TRANSPORT).size());
+	LB_CHECK_EQUAL(1, install.Filters(LB_DIRECTION_INBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT).size());
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV6, LB_FILTER_LAYER_TRANSPORT, FALSE, 0, 80)));
+}
+
+LB_TEST(InboundPermitKeepsTheAckCallout)
+{
+	LB_FILTER_SPEC ack;
+	LbFilterAckSpec(&ack);
+
+	// The ACK filter catches inbound IPv4 TCP under every rule and sends it to the inbound callout
+	LB_CHECK_EQUAL(LB_DIRECTION_INBOUND, ack.direction);
+	LB_CHECK_EQUAL(LB_FAMILY_IPV4, ack.family);
+	LB_CHECK_EQUAL(LB_FILTER_LAYER_TRANSPORT, ack.layer);
+	LB_CHECK_EQUAL(LB_FILTER_PROTOCOL_TCP, ack.protocol);
+	LB_CHECK(!ack.matchAddress && !ack.matchPort);
+	LB_CHECK_EQUAL(LB_FILTER_WEIGHT_ACK, LbFilterWeight(&ack));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbFilterAction(&ack));
+
+	// A permitted network inside inspected ports has to be a filter of its own. Inbound on IPv4 it still goes
+	// to the callout, everywhere else it is a plain permit.
+	LB_TEST_RULES rules;
+	rules.ports.push_back(LbTestPort(1, 0xFFFF, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0x0A000000, 8, LB_RULE_ACTION_PERMIT, LB_RULE_DIRECTION_BOTH));
+
+	LB_TEST_INSTALL install;
+	if (!install.Install(rules, FALSE))
+		return;
+
+	UINT32 permits = 0;
+	for (UINT32 i = 0; i < install.plan.count; i++)
+	{
+		const LB_FILTER_SPEC& filter = install.plan.filters[i];
+		if (filter.verdict != LB_VERDICT_PERMIT)
+			continue;
+
+		LB_CHECK_EQUAL(filter.direction == LB_DIRECTION_INBOUND ? LB_FILTER_ACTION_CALLOUT : LB_FILTER_ACTION_PERMIT, LbFilterAction(&filter));
+		permits++;
+	}
+	LB_CHECK_EQUAL(2, permits);
+
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_INBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x0A000001, 80)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x0A000001, 80)));
+
+	// Port 0 is covered by no rule, only the ACK filter sees it and only for TCP
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_INBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x08080808, 0)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_INBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, FALSE, 0x08080808, 0)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_INBOUND, LB_FAMILY_IPV6, LB_FILTER_LAYER_TRANSPORT, TRUE, 0, 0)));
+}
+
+LB_TEST(StreamSplitsOutboundTcp)
+{
+	LB_TEST_RULES rules;
+	rules.ports.push_back(LbTestPort(80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH));
+
+	LB_TEST_INSTALL install;
+	if (!install.Install(rules, TRUE))
+		return;
+
+	for (UINT8 family : { LB_FAMILY_IPV4, LB_FAMILY_IPV6 })
+	{
+		// Outbound port 80: everything but TCP is inspected per segment, TCP goes to the stream layer instead
+		std::vector<LB_FILTER_SPEC> transport = install.Filters(LB_DIRECTION_OUTBOUND, family, LB_FILTER_LAYER_TRANSPORT);
+		std::vector<LB_FILTER_SPEC> stream = install.Filters(LB_DIRECTION_OUTBOUND, family, LB_FILTER_LAYER_STREAM);
+		UINT32 split = 0;
+
+		for (const LB_FILTER_SPEC& filter : transport)
+		{
+			if (filter.tier != LB_FILTER_TIER_PORT)
+				continue;
+			LB_CHECK_EQUAL(filter.protocol == LB_FILTER_PROTOCOL_TCP ? LB_VERDICT_PERMIT : LB_VERDICT_INSPECT, filter.verdict);
+			LB_CHECK(filter.protocol != LB_FILTER_PROTOCOL_ANY);
+			split++;
+		}
+		LB_CHECK_EQUAL(2, split);
+
+		for (const LB_FILTER_SPEC& filter : stream)
+		{
+			LB_CHECK_EQUAL(LB_FILTER_PROTOCOL_ANY, filter.protocol);
+			LB_CHECK(filter.verdict != LB_VERDICT_BLOCK);
+		}
+
+		LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, family, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x08080808, 80)));
+		LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, family, LB_FILTER_LAYER_TRANSPORT, FALSE, 0x08080808, 80)));
+		LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, family, LB_FILTER_LAYER_STREAM, TRUE, 0x08080808, 80)));
+
+		// Inbound is never split, there is no inbound stream callout
+		LB_CHECK_EQUAL(0, install.Filters(LB_DIRECTION_INBOUND, family, LB_FILTER_LAYER_STREAM).size());
+		for (const LB_FILTER_SPEC& filter : install.Filters(LB_DIRECTION_INBOUND, family, LB_FILTER_LAYER_TRANSPORT))
+			LB_CHECK_EQUAL(LB_FILTER_PROTOCOL_ANY, filter.protocol);
+	}
+
+	// The blocked network overrides the stream layer's inspected port as it does at the transport layer,
+	// with a permit there, the transport layer drops it
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_STREAM, TRUE, 0x0A000001, 80)));
+	LB_CHECK_EQUAL(LB_FILTER_ACTION_BLOCK, LbTestEvaluate(install.mock, LbTestPacketOf(LB_DIRECTION_OUTBOUND, LB_FAMILY_IPV4, LB_FILTER_LAYER_TRANSPORT, TRUE, 0x0A000001, 80)));
+
+	// Without the stream layer TCP stays at the transport layer
+	LB_TEST_INSTALL plain;
+	if (!plain.Install(rules, FALSE))
+		return;
+
+	for (UINT32 i = 0; i < plain.plan.count; i++)
+	{
+		LB_CHECK_EQUAL(LB_FILTER_LAYER_TRANSPORT, plain.plan.filters[i].layer);
+		LB_CHECK_EQUAL(LB_FILTER_PROTOCOL_ANY, plain.plan.filters[i].protocol);
+	}
+}
+
+LB_TEST(Ipv6GetsPortFiltersOnly)
+{
+	LB_TEST_RULES rules;
+	rules.addresses.push_back(LbTestAddress(0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0xC0A80000, 16, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+
+	// Address rules alone give IPv6 nothing
+	{
+		LB_TEST_INSTALL install;
+		if (!install.Install(rules, TRUE))
+			return;
+
+		for (UINT32 i = 0; i < install.plan.count; i++)
+			LB_CHECK_EQUAL(LB_FAMILY_IPV4, install.plan.filters[i].family);
+	}
+
+	rules.ports.push_back(LbTestPort(443, 443, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+
+	LB_TEST_INSTALL install;
+	if (!install.Install(rules, FALSE))
+		return;
+
+	UINT32 v6 = 0;
+	for (UINT32 i = 0; i < install.plan.count; i++)
+	{
+		const LB_FILTER_SPEC& filter = install.plan.filters[i];
+		if (filter.family != LB_FAMILY_IPV6)
+			continue;
+
+		LB_CHECK(!filter.matchAddress && filter.matchPort);
+		LB_CHECK_EQUAL(LB_FILTER_TIER_PORT, filter.tier);
+		v6++;
+	}
+	LB_CHECK_EQUAL(2, v6);
+}
+
+LB_TEST(FailedInstallDeletesWhatWasAdded)
+{
+	LB_TEST_RULES rules;
+	rules.ports.push_back(LbTestPort(80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.ports.push_back(LbTestPort(23, 23, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH));
+
+	LB_CLASSIFIER* classifier = NULL;
+	LB_FILTER_PLAN plan = {};
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbClassifierCompile(rules.addresses.data(), (UINT32)rules.addresses.size(), rules.ports.data(), (UINT32)rules.ports.size(), &classifier)))
+		return;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbFilterPlanCompile(classifier, TRUE, &plan)))
+		return;
+	LB_CHECK(plan.count > 4);
+
+	// Fail each add in turn, the engine must be left exactly as it was
+	for (UINT32 failAt = 1; failAt <= plan.count; failAt++)
+	{
+		LB_TEST_ENGINE mock;
+		LB_FILTER_ENGINE engine = { &mock, LbTestAddFilter, LbTestDeleteFilter };
+		LB_FILTER_SPEC ack;
+		UINT64 ackId = 0;
+		std::vector<UINT64> ids(plan.count);
+
+		LbFilterAckSpec(&ack);
+		LbTestAddFilter(&mock, &ack, &ackId);
+		mock.failAt = failAt;
+
+		LB_CHECK_EQUAL(STATUS_INSUFFICIENT_RESOURCES, LbFilterPlanInstall(&plan, &engine, ids.data()));
+		LB_CHECK_EQUAL(1, mock.filters.size());
+		LB_CHECK(mock.filters.count(ackId) == 1);
+		LB_CHECK(std::vector<UINT64>(mock.added.begin() + 1, mock.added.end()) == mock.deleted);
+		LB_CHECK_EQUAL(0, mock.unknownDeletes);
+	}
+
+	LbFilterPlanFree(&plan);
+	LbClassifierFree(classifier);
+}
+
+LB_TEST(RemoveDeletesExactlyWhatWasInstalled)
+{
+	LB_TEST_RULES rules;
+	rules.ports.push_back(LbTestPort(80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH));
+	rules.addresses.push_back(LbTestAddress(0xC0A80000, 16, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_INBOUND));
+
+	LB_TEST_INSTALL install;
+	if (!install.Install(rules, TRUE))
+		return;
+
+	LB_CHECK_EQUAL(install.plan.count + 1, install.mock.filters.size());
+	for (UINT32 i = 0; i < install.plan.count; i++)
+		LB_CHECK(memcmp(&install.mock.filters[install.ids[i]], &install.plan.filters[i], sizeof(LB_FILTER_SPEC)) == 0);
+
+	LbFilterPlanRemove(&install.engine, install.ids.data(), install.plan.count);
+
+	// Only the ACK filter, which no rule set owns, is left
+	LB_CHECK_EQUAL(1, install.mock.filters.size());
+	LB_CHECK_EQUAL(install.plan.count, install.mock.deleted.size());
+	LB_CHECK(std::vector<UINT64>(install.ids.begin(), install.ids.begin() + install.plan.count) == install.mock.deleted);
+	LB_CHECK_EQUAL(0, install.mock.unknownDeletes);
+}
+
+LB_TEST(RandomRulesMatchTheClassifier)
+{
+	std::mt19937 rng(LbTestSeed());
+	const UINT32 networks[] = { 0x0A000000, 0xC0A80000, 0xAC100000, 0x08080800 };
+
+	for (int round = 0; round < 40; round++)
+	{
+		LB_TEST_RULES rules;
+		BOOLEAN stream = round % 2 == 0;
+
+		for (UINT32 i = rng() % 12; i > 0; i--)
+			rules.addresses.push_back(LbTestAddress(networks[rng() % 4] ^ (rng() & 0xFFFFF), (UINT8)(8 + rng() % 25), (UINT8)(rng() % 3), (UINT8)(1 + rng() % 3)));
+		for (UINT32 i = rng() % 12; i > 0; i--)
+		{
+			UINT16 first = (UINT16)(rng() % 2000);
+			rules.ports.push_back(LbTestPort(first, (UINT16)(first + rng() % 100), (UINT8)(rng() % 3), (UINT8)(1 + rng() % 3)));
+		}
+
+		LB_TEST_INSTALL install;
+		if (!install.Install(rules, stream))
+			return;
+		if (!LB_CHECK(LbTestDisjoint(install.plan)))
+			return;
+
+		for (int sample = 0; sample < 400; sample++)
+		{
+			UINT8 direction = (UINT8)(rng() % LB_DIRECTION_COUNT);
+			UINT8 family = (UINT8)(rng() % LB_FAMILY_COUNT);
+			BOOLEAN tcp = rng() % 2 == 0;
+			UINT32 address = networks[rng() % 4] ^ (rng() & 0xFFFFF);
+			UINT16 port = (UINT16)(rng() % 2200);
+			LB_VERDICT verdict = family == LB_FAMILY_IPV4 ? LbClassifierLookup(install.classifier, (LB_DIRECTION)direction, address, port) :
+				LbClassifierLookupPort(install.classifier, (LB_DIRECTION)direction, port);
+			LB_FILTER_ACTION transport = LbTestEvaluate(install.mock, LbTestPacketOf(direction, family, LB_FILTER_LAYER_TRANSPORT, tcp, address, port));
+			BOOLEAN streamed = stream && direction == LB_DIRECTION_OUTBOUND && tcp;
+
+			if (verdict == LB_VERDICT_BLOCK)
+				LB_CHECK_EQUAL(LB_FILTER_ACTION_BLOCK, transport);
+			else if (verdict == LB_VERDICT_INSPECT)
+				LB_CHECK_EQUAL(streamed ? LB_FILTER_ACTION_PERMIT : LB_FILTER_ACTION_CALLOUT, transport);
+			else if (direction == LB_DIRECTION_INBOUND && family == LB_FAMILY_IPV4 && tcp)
+				LB_CHECK_EQUAL(LB_FILTER_ACTION_CALLOUT, transport);
+			else if (direction == LB_DIRECTION_INBOUND && family == LB_FAMILY_IPV4)
+				LB_CHECK(transport != LB_FILTER_ACTION_BLOCK);		// The inbound callout permits what no rule blocks
+			else
+				LB_CHECK_EQUAL(LB_FILTER_ACTION_PERMIT, transport);
+
+			// Only outgoing data of inspected flows reaches the stream callout, the stream layer carries nothing but TCP
+			if (tcp)
+			{
+				LB_FILTER_ACTION atStream = LbTestEvaluate(install.mock, LbTestPacketOf(direction, family, LB_FILTER_LAYER_STREAM, tcp, address, port));
+				LB_CHECK_EQUAL(streamed && verdict == LB_VERDICT_INSPECT ? LB_FILTER_ACTION_CALLOUT : LB_FILTER_ACTION_PERMIT, atStream);
+			}
+		}
+	}
+}
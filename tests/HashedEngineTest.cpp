@@ -0,0 +1,365 @@
+/*/
+/*  ** HashedEngineTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the hashed literal engine: which dictionaries LbMatcherCompile gives it, that it
+/*	finds and rewrites the same matches the automaton and the reference do on both rewrite paths, that the
+/*	bytes it holds back are enough to find a match split between two stream writes, rule images, and a
+/*	dictionary of a hundred thousand pairs.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbReference.h"
+#include "HashedEngine.h"
+#include <unordered_map>
+#include <unordered_set>
+
+/////////////
+// HELPERS //
+/////////////
+
+static LB_MATCHER* LbTestCompile(LB_REFERENCE_PAIRS& pairs, bool automaton)
+{
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+
+	ud.automaton = automaton;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, automaton ? LbMatcherCompile(&ud, &matcher) : LbHashedCompile(&ud, &matcher)))
+		return NULL;
+
+	return matcher;
+}
+
+static std::string LbTestReplace(const LB_MATCHER* matcher, const std::string& data, UINT32* replacements, UINT32* state)
+{
+	std::string result = data;
+
+	*state = LB_MATCHER_ROOT_STATE;
+	*replacements = LbMatcherReplace(matcher, state, (UINT8*)&result[0], result.size(), NULL, NULL);
+	return result;
+}
+
+static std::string LbTestRewrite(const LB_MATCHER* matcher, const std::string& data, UINT32* replacements)
+{
+	std::vector<UINT8> output(LbMatcherRewriteBound(matcher, data.size()) + 1);
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	SIZE_T written = 0;
+
+	*replacements = LbMatcherRewrite(matcher, &state, (const UINT8*)data.data(), data.size(), output.data(), &written);
+	return std::string((const char*)output.data(), written);
+}
+
+// Random data with whole patterns planted in it and the first bytes of others at the end of it
+static std::string LbTestData(std::mt19937& rng, const LB_REFERENCE_PAIRS& pairs, const std::string& alphabet, size_t length)
+{
+	std::string data = LbReferenceString(rng, alphabet, length);
+
+	for (size_t k = 0, planted = rng() % 12; k < planted; k++)
+	{
+		size_t i = rng() % pairs.match.size();
+		const std::string& pattern = pairs.reversal && rng() % 2 ? pairs.replace[i] : pairs.match[i];
+
+		if (pattern.size() <= data.size())
+			data.replace(rng() % (data.size() - pattern.size() + 1), pattern.size(), pattern);
+	}
+
+	if (rng() % 2 && !data.empty())
+	{
+		const std::string& pattern = pairs.match[rng() % pairs.match.size()];
+		size_t prefix = std::min(data.size(), 1 + rng() % pattern.size());
+		data.replace(data.size() - prefix, prefix, pattern, 0, prefix);
+	}
+
+	return data;
+}
+
+// LbReferenceRandomPairs for dictionaries too large to compare every new pattern with all the others
+static LB_REFERENCE_PAIRS LbTestDictionary(std::mt19937& rng, size_t count, size_t minLength, size_t maxLength)
+{
+	std::unordered_set<std::string> seen;
+	LB_REFERENCE_PAIRS pairs;
+
+	while (pairs.match.size() < count)
+	{
+		std::string match = LbReferenceString(rng, "abcdefghijklmnopqrstuvwxyz", minLength + rng() % (maxLength - minLength + 1));
+		if (seen.insert(match).second)
+			pairs.Add(match, LbReferenceString(rng, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", match.size()));
+	}
+
+	return pairs;
+}
+
+// LbReferenceRewrite of one buffer for dictionaries too large to try every pattern at every byte
+static std::string LbTestDictionaryRewrite(const LB_REFERENCE_PAIRS& pairs, const std::string& data, size_t shortest, size_t longest, UINT32* replacements)
+{
+	std::unordered_map<std::string, size_t> index;
+	std::string result;
+	size_t reset = 0;
+
+	for (size_t i = pairs.match.size(); i-- > 0; )
+		index[pairs.match[i]] = i;
+
+	*replacements = 0;
+	for (size_t end = 1; end <= data.size(); end++)
+	{
+		for (size_t length = std::min(longest, end - reset); length >= shortest; length--)
+		{
+			auto found = index.find(data.substr(end - length, length));
+			if (found == index.end())
+				continue;
+
+			result.append(data, reset, end - length - reset);
+			result += pairs.replace[found->second];
+			reset = end;
+			(*replacements)++;
+			break;
+		}
+	}
+
+	result.append(data, reset, std::string::npos);
+	return result;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(ChoosesTheEngineBySizeAndShortestPattern)
+{
+	LB_CHECK(!LbHashedPreferred(0, 100000, 8));
+	LB_CHECK(!LbHashedPreferred(1000, 100000, LB_HASHED_MIN_WINDOW - 1));
+	LB_CHECK(!LbHashedPreferred(100, LB_HASHED_MIN_STATES, LB_HASHED_FAST_WINDOW));
+	LB_CHECK(LbHashedPreferred(100, LB_HASHED_MIN_STATES + 1, LB_HASHED_FAST_WINDOW));
+	LB_CHECK(!LbHashedPreferred(1000, LB_HASHED_MIN_STATES_SHORT, LB_HASHED_FAST_WINDOW - 1));
+	LB_CHECK(LbHashedPreferred(1000, LB_HASHED_MIN_STATES_SHORT + 1, LB_HASHED_MIN_WINDOW));
+
+	std::mt19937 rng(LbTestSeed());
+	LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcdefghijklmnopqrstuvwxyz", 200, 8, 8, true);
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+
+	// 1600 states of 8 byte patterns
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+	{
+		LB_CHECK_EQUAL(LB_MATCHER_ENGINE_HASHED, matcher->engine);
+		LbMatcherFree(matcher);
+	}
+
+	ud.automaton = true;
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+	{
+		LB_CHECK_EQUAL(LB_MATCHER_ENGINE_AUTOMATON, matcher->engine);
+		LbMatcherFree(matcher);
+	}
+
+	// One short pattern keeps the whole dictionary on the automaton, the hashed engine refuses it outright
+	pairs.Add("abc", "ABC");
+	ud = pairs.UserData();
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+	{
+		LB_CHECK_EQUAL(LB_MATCHER_ENGINE_AUTOMATON, matcher->engine);
+		LbMatcherFree(matcher);
+	}
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbHashedCompile(&ud, &matcher));
+
+	ud.regex = true;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbHashedCompile(&ud, &matcher));
+}
+
+LB_TEST(RandomDictionariesMatchTheAutomaton)
+{
+	std::mt19937 rng(LbTestSeed());
+	const char* alphabets[] = { "abcd", "abcdefghijklmnopqrstuvwxyz" };
+	UINT32 wrong = 0;
+	UINT32 replaced = 0;
+
+	for (int round = 0; round < 300; round++)
+	{
+		std::string alphabet = alphabets[round % 2];
+		size_t shortest = LB_HASHED_MIN_WINDOW + rng() % 6;
+		size_t count = rng() % 4 == 0 ? 1 + rng() % 600 : 1 + rng() % 60;
+		LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, alphabet, count, shortest, shortest + rng() % 14, round % 3 != 0);
+		pairs.reversal = rng() % 2 == 0;
+
+		// Reversed, the replacements are patterns too and have to be as long as the window
+		if (pairs.reversal)
+		{
+			for (size_t i = 0; i < pairs.replace.size(); i++)
+			{
+				if (pairs.replace[i].size() < shortest)
+					pairs.replace[i].resize(shortest, 'Z');
+			}
+		}
+
+		LB_MATCHER* hashed = LbTestCompile(pairs, false);
+		LB_MATCHER* automaton = LbTestCompile(pairs, true);
+
+		for (int sample = 0; hashed && automaton && sample < 10; sample++)
+		{
+			std::string data = LbTestData(rng, pairs, alphabet, rng() % 1200);
+			UINT32 expected = 0;
+			UINT32 actual = 0;
+			UINT32 state = 0;
+
+			// Copying path
+			std::string reference = LbReferenceRewrite(pairs, data, {}, false, false, &expected);
+			wrong += LbTestRewrite(hashed, data, &actual) != reference || actual != expected;
+			wrong += LbTestRewrite(automaton, data, &actual) != reference || actual != expected;
+			replaced += expected;
+
+			// In place, and what is left pending is never more than the data
+			reference = LbReferenceRewrite(pairs, data, {}, false, true, &expected);
+			wrong += LbTestReplace(hashed, data, &actual, &state) != reference || actual != expected;
+			wrong += LbMatcherPendingLength(hashed, state) > data.size();
+			wrong += LbTestReplace(automaton, data, &actual, &state) != reference || actual != expected;
+		}
+
+		LbMatcherFree(hashed);
+		LbMatcherFree(automaton);
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK(replaced > 1000);
+}
+
+LB_TEST(HeldBackBytesCompleteSplitMatches)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+	UINT32 heldBack = 0;
+
+	for (int round = 0; round < 200; round++)
+	{
+		LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcdef", 1 + rng() % 200, 4 + rng() % 4, 12, true);
+		LB_MATCHER* matcher = LbTestCompile(pairs, false);
+		if (!matcher) return;
+
+		std::string data = LbTestData(rng, pairs, "abcdef", 4000);
+		UINT32 expected = 0;
+		UINT32 state = 0;
+		std::string whole = LbTestReplace(matcher, data, &expected, &state);
+
+		// As the stream layer does: the bytes that could still begin a match go in front of the next write
+		std::string result;
+		std::string carried;
+		UINT32 replacements = 0;
+
+		for (size_t start = 0; start < data.size(); )
+		{
+			size_t length = std::min(data.size() - start, (size_t)(1 + rng() % 300));
+			std::string buffer = carried + data.substr(start, length);
+			UINT32 found = 0;
+
+			start += length;
+			buffer = LbTestReplace(matcher, buffer, &found, &state);
+			replacements += found;
+
+			size_t pending = start < data.size() ? LbMatcherPendingLength(matcher, state) : 0;
+			heldBack += pending != 0;
+			result += buffer.substr(0, buffer.size() - pending);
+			carried = buffer.substr(buffer.size() - pending);
+		}
+
+		wrong += result != whole || replacements != expected;
+		LbMatcherFree(matcher);
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK(heldBack > 1000);
+}
+
+LB_TEST(ImageRoundTripAndRejectsDamage)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcdefghijklmnopqrstuvwxyz", 3000, 6, 14, true);
+	LB_MATCHER* matcher = LbTestCompile(pairs, false);
+	if (!matcher) return;
+
+	UINT32 offset = 0;
+	SIZE_T end = LbMatcherWriteImage(matcher, NULL, 64, &offset);
+	std::vector<UINT8> image(end);
+
+	LbMatcherWriteImage(matcher, image.data(), 64, &offset);
+	LB_CHECK_EQUAL(0, offset % 64);
+
+	LB_MATCHER* bound = (LB_MATCHER*)&image[offset];
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherBindImage(bound, end - offset)))
+	{
+		std::string data = LbTestData(rng, pairs, "abcdefghijklmnopqrstuvwxyz", 3000);
+		UINT32 expected = 0;
+		UINT32 actual = 0;
+		UINT32 state = 0;
+
+		LB_CHECK(LbTestReplace(bound, data, &actual, &state) == LbTestReplace(matcher, data, &expected, &state));
+		LB_CHECK_EQUAL(expected, actual);
+		LbMatcherUnbindImage(bound);
+	}
+
+	// A bucket entry past the last pattern
+	std::vector<UINT8> damaged(image);
+	LB_MATCHER* header = (LB_MATCHER*)&damaged[offset];
+	((UINT32*)((UINT8*)header + header->hashEntryOffset))[7] = header->patternCount;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, end - offset));
+
+	// A window longer than the shortest pattern
+	damaged = image;
+	header = (LB_MATCHER*)&damaged[offset];
+	header->hashWindowLength = (UINT32)header->minMatchLength + 1;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, end - offset));
+
+	// A block that claims more than there is
+	damaged = image;
+	header = (LB_MATCHER*)&damaged[offset];
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, header->size - 1));
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(HundredThousandPairs)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_REFERENCE_PAIRS pairs = LbTestDictionary(rng, 100000, 6, 16);
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+		return;
+
+	// An automaton could need a state per pattern byte, a kilobyte each
+	LB_CHECK_EQUAL(LB_MATCHER_ENGINE_HASHED, matcher->engine);
+	LB_CHECK_EQUAL(100000, matcher->patternCount);
+	LB_CHECK(matcher->size < 8 * 1024 * 1024);
+
+	UINT32 wrong = 0;
+	UINT32 replaced = 0;
+
+	for (int sample = 0; sample < 20; sample++)
+	{
+		std::string data = LbReferenceString(rng, "abcdefghijklmnopqrstuvwxyz", 1460);
+
+		for (int k = 0; k < 40; k++)
+		{
+			const std::string& pattern = pairs.match[rng() % pairs.match.size()];
+			data.replace(rng() % (data.size() - pattern.size()), pattern.size(), pattern);
+		}
+
+		UINT32 expected = 0;
+		UINT32 actual = 0;
+		UINT32 state = 0;
+		std::string reference = LbTestDictionaryRewrite(pairs, data, 6, 16, &expected);
+
+		wrong += LbTestReplace(matcher, data, &actual, &state) != reference || actual != expected;
+		wrong += LbTestRewrite(matcher, data, &actual) != reference || actual != expected;
+		replaced += expected;
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK(replaced > 20 * 20);
+
+	LbMatcherFree(matcher);
+}
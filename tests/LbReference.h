@@ -0,0 +1,238 @@
+/*/
+/*  ** LbReference.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the plain, slow implementations the tests hold the engines against, and the random inputs they
+/*	are run over. Nothing here is meant to be fast, only obviously right.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "MatchEngine.h"
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+// A match/replace list and the LB_USERDATA that points into it
+struct LB_REFERENCE_PAIRS
+{
+	std::vector<std::string> match;
+	std::vector<std::string> replace;
+	std::vector<LB_MATCH_AND_REPLACE> pairs;
+	bool reversal = false;
+
+	void Add(const std::string& m, const std::string& r)
+	{
+		match.push_back(m);
+		replace.push_back(r);
+	}
+
+	LB_USERDATA UserData()
+	{
+		LB_USERDATA ud;
+
+		pairs.resize(match.size());
+		for (size_t i = 0; i < match.size(); i++)
+		{
+			pairs[i].match = (char*)match[i].c_str();
+			pairs[i].replace = (char*)replace[i].c_str();
+		}
+
+		ud.count = (int)match.size();
+		ud.enableReversal = reversal;
+		ud.strArray = pairs.data();
+		return ud;
+	}
+};
+
+// Random string of length bytes drawn from alphabet
+inline std::string LbReferenceString(std::mt19937& rng, const std::string& alphabet, size_t length)
+{
+	std::string result(length, '\0');
+	for (size_t i = 0; i < length; i++)
+		result[i] = alphabet[rng() % alphabet.size()];
+
+	return result;
+}
+
+// Random pairs with match strings between minLength and maxLength bytes, no two alike. With equalLength every
+// replacement is as long as its match, otherwise it is 1 to maxLength + 2 bytes.
+inline LB_REFERENCE_PAIRS LbReferenceRandomPairs(std::mt19937& rng, const std::string& alphabet, size_t count, size_t minLength, size_t maxLength, bool equalLength)
+{
+	LB_REFERENCE_PAIRS result;
+	size_t attempts = 0;
+
+	while (result.match.size() < count && attempts++ < count * 100)
+	{
+		std::string match = LbReferenceString(rng, alphabet, minLength + rng() % (maxLength - minLength + 1));
+		std::string replace = LbReferenceString(rng, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", equalLength ? match.size() : 1 + rng() % (maxLength + 2));
+		bool seen = false;
+
+		for (const std::string& other : result.match)
+			seen = seen || other == match;
+		if (!seen)
+			result.Add(match, replace);
+	}
+
+	return result;
+}
+
+// What the automaton does to data cut into buffers at cuts (ascending offsets): at every byte the longest pattern
+// ending there since the last match is replaced, the first pair to claim a string wins. A match that began before
+// the buffer it ends in resets the scan without being replaced, unless keepSplit is set.
+// In place scans pass equalLength: only equal length pairs are replaced, the others are not even noticed.
+inline std::string LbReferenceRewrite(const LB_REFERENCE_PAIRS& pairs, const std::string& data, const std::vector<size_t>& cuts, bool keepSplit, bool equalLength, UINT32* replacements)
+{
+	std::vector<const std::string*> from;
+	std::vector<const std::string*> to;
+	std::string result;
+	size_t reset = 0;		// Where the automaton last went back to the root
+	size_t copied = 0;
+	size_t cut = 0;
+
+	for (size_t i = 0; i < pairs.match.size(); i++)
+	{
+		from.push_back(&pairs.match[i]);
+		to.push_back(&pairs.replace[i]);
+		if (pairs.reversal)
+		{
+			from.push_back(&pairs.replace[i]);
+			to.push_back(&pairs.match[i]);
+		}
+	}
+
+	*replacements = 0;
+	for (size_t end = 1; end <= data.size(); end++)
+	{
+		size_t best = from.size();
+
+		while (cut < cuts.size() && cuts[cut] < end)
+			cut++;
+
+		for (size_t p = 0; p < from.size(); p++)
+		{
+			size_t length = from[p]->size();
+			if (length > end - reset || data.compare(end - length, length, *from[p]) != 0)
+				continue;
+			if (best == from.size() || length > from[best]->size())
+				best = p;
+		}
+
+		if (best == from.size() || (equalLength && from[best]->size() != to[best]->size()))
+			continue;
+
+		size_t start = end - from[best]->size();
+		size_t bufferStart = cut > 0 ? cuts[cut - 1] : 0;
+
+		if (keepSplit || start >= bufferStart)
+		{
+			result.append(data, copied, start - copied);
+			result += *to[best];
+			copied = end;
+			(*replacements)++;
+		}
+		reset = end;
+	}
+
+	result.append(data, copied, std::string::npos);
+	return result;
+}
+
+// What the regex engine does to one buffer: of the matches ending earliest the first pair's wins, started as far
+// left as it can be and then extended as far as it goes, and the next one is looked for after it. A pattern
+// starting with ^ only starts at the start of the data or after a line feed. In place scans pass equalLength:
+// matches as long as their replacement are replaced, the others are found but left as they are.
+inline std::string LbReferenceRegexRewrite(const LB_REFERENCE_PAIRS& pairs, const std::string& data, bool equalLength, UINT32* replacements)
+{
+	std::vector<std::regex> expressions;
+	std::vector<bool> lineStart;
+	std::string result;
+	size_t low = 0;
+	size_t copied = 0;
+
+	for (const std::string& match : pairs.match)
+	{
+		lineStart.push_back(match[0] == '^');
+		expressions.emplace_back(match[0] == '^' ? match.substr(1) : match, std::regex::ECMAScript);
+	}
+
+	auto matches = [&](size_t p, size_t start, size_t end) {
+		if (lineStart[p] && start > 0 && data[start - 1] != '\n')
+			return false;
+		return std::regex_match(data.begin() + start, data.begin() + end, expressions[p]);
+	};
+
+	*replacements = 0;
+	for (;;)
+	{
+		size_t pattern = expressions.size();
+		size_t start = 0;
+		size_t end = low;
+
+		while (pattern == expressions.size() && ++end <= data.size())
+		{
+			for (size_t p = 0; p < expressions.size() && pattern == expressions.size(); p++)
+			{
+				for (start = low; start < end; start++)
+				{
+					if (matches(p, start, end))
+					{
+						pattern = p;
+						break;
+					}
+				}
+			}
+		}
+
+		if (pattern == expressions.size())
+			break;
+
+		for (size_t longer = data.size(); longer > end; longer--)
+		{
+			if (matches(pattern, start, longer))
+			{
+				end = longer;
+				break;
+			}
+		}
+
+		const std::string& replace = pairs.replace[pattern];
+		result.append(data, copied, start - copied);
+		if (!equalLength || replace.size() == end - start)
+		{
+			result += replace;
+			(*replacements)++;
+		}
+		else
+			result.append(data, start, end - start);
+
+		copied = end;
+		low = end;
+	}
+
+	result.append(data, copied, std::string::npos);
+	return result;
+}
+
+// The Internet checksum as RFC 1071 section 4.1 computes it: 16-bit big endian words added one at a time, an odd
+// last byte padded with a zero, the carries folded back in at the end. sum is added first, as a pseudo header.
+inline UINT16 LbReferenceChecksum(UINT64 sum, const UINT8* data, size_t length)
+{
+	size_t i = 0;
+
+	for (; i + 1 < length; i += 2)
+		sum += (UINT32)data[i] << 8 | data[i + 1];
+	if (i < length)
+		sum += (UINT32)data[i] << 8;
+
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return (UINT16)~sum;
+}
@@ -0,0 +1,93 @@
+/*/
+/*  ** LbTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains function definitions for the user mode test harness, and the main function of every test program.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include <string.h>
+
+/////////////
+// GLOBALS //
+/////////////
+
+static LB_TEST_CASE* lbTestFirst = NULL;
+static LB_TEST_CASE* lbTestLast = NULL;
+static UINT32 lbTestFailures = 0;
+static UINT32 lbTestChecks = 0;
+
+/////////////
+// HARNESS //
+/////////////
+
+LB_TEST_CASE::LB_TEST_CASE(const char* name, LbTestFunction* function) : name(name), function(function), next(NULL)
+{
+	// Static objects of one file are constructed in order, so tests run the way they read
+	if (lbTestLast)
+		lbTestLast->next = this;
+	else
+		lbTestFirst = this;
+	lbTestLast = this;
+}
+
+BOOLEAN LbTestCheck(BOOLEAN passed, const char* expression, const char* file, int line)
+{
+	lbTestChecks++;
+	if (!passed)
+	{
+		lbTestFailures++;
+		printf("%s:%d: check failed: %s\n", file, line, expression);
+	}
+
+	return passed;
+}
+
+BOOLEAN LbTestCheckEqual(UINT64 expected, UINT64 actual, const char* expression, const char* file, int line)
+{
+	lbTestChecks++;
+	if (expected != actual)
+	{
+		lbTestFailures++;
+		printf("%s:%d: check failed: %s is %llu, expected %llu\n", file, line, expression, (unsigned long long)actual, (unsigned long long)expected);
+	}
+
+	return expected == actual;
+}
+
+UINT32 LbTestSeed()
+{
+	const char* seed = getenv("LB_TEST_SEED");
+	return seed ? (UINT32)strtoul(seed, NULL, 0) : 1;
+}
+
+int main(int argc, char** argv)
+{
+	UINT32 run = 0;
+	UINT32 failed = 0;
+
+	for (LB_TEST_CASE* test = lbTestFirst; test; test = test->next)
+	{
+		if (argc > 1 && !strstr(test->name, argv[1]))
+			continue;
+
+		UINT32 failures = lbTestFailures;
+		UINT64 start = LbTimestamp();
+
+		test->function();
+		run++;
+
+		UINT64 elapsed = (LbTimestamp() - start) * 1000 / LbTimestampFrequency();
+		if (lbTestFailures != failures)
+			failed++;
+		printf("%-6s %s (%llu ms)\n", lbTestFailures != failures ? "FAIL" : "ok", test->name, (unsigned long long)elapsed);
+	}
+
+	printf("%u of %u tests passed, %u checks\n", run - failed, run, lbTestChecks);
+	return failed ? 1 : 0;
+}
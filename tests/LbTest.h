@@ -0,0 +1,47 @@
+/*/
+/*  ** LbTest.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains declerations for the small test harness the user mode tests are written against.
+/*	Every LB_TEST in a test program runs in the order it was defined, a failed check is reported
+/*	with its file and line and the test goes on. The program exits with 1 if any check failed.
+/*	A test program takes one optional argument, only the tests whose names contain it are run.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include <stdio.h>
+
+typedef void(LbTestFunction)();
+
+struct LB_TEST_CASE
+{
+	const char* name;
+	LbTestFunction* function;
+	LB_TEST_CASE* next;
+
+	LB_TEST_CASE(const char* name, LbTestFunction* function);
+};
+
+// Records a check, returns whether it passed
+BOOLEAN LbTestCheck(BOOLEAN passed, const char* expression, const char* file, int line);
+
+// Same for two integers that must be equal, both are printed when they are not
+BOOLEAN LbTestCheckEqual(UINT64 expected, UINT64 actual, const char* expression, const char* file, int line);
+
+// Seed for the random inputs of the current test, LB_TEST_SEED in the environment overrides it
+UINT32 LbTestSeed();
+
+#define LB_TEST(name) \
+	static void name(); \
+	static LB_TEST_CASE name##Case(#name, name); \
+	static void name()
+
+#define LB_CHECK(expression) LbTestCheck((expression) ? TRUE : FALSE, #expression, __FILE__, __LINE__)
+#define LB_CHECK_EQUAL(expected, actual) LbTestCheckEqual((UINT64)(expected), (UINT64)(actual), #actual, __FILE__, __LINE__)
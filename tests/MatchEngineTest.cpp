@@ -0,0 +1,474 @@
+/*/
+/*  ** MatchEngineTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the Aho-Corasick match and replace engine: both rewrite paths, scans continued
+/*	across buffers, the prefilter, the layout of the tables, rule images and the memory budget.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbReference.h"
+#include "MatchEngine.h"
+#include <algorithm>
+
+/////////////
+// HELPERS //
+/////////////
+
+static LB_MATCHER* LbTestCompile(LB_REFERENCE_PAIRS& pairs)
+{
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+		return NULL;
+
+	return matcher;
+}
+
+// In place scan of data cut at cuts, as the buffers of one segment
+static std::string LbTestReplace(const LB_MATCHER* matcher, const std::string& data, const std::vector<size_t>& cuts, BOOLEAN withSpans, UINT32* replacements)
+{
+	std::string result = data;
+	LB_MATCHER_SPANS spans;
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	size_t start = 0;
+
+	LbMatcherSpansBegin(&spans);
+	*replacements = 0;
+
+	for (size_t n = 0; n <= cuts.size(); n++)
+	{
+		size_t end = n < cuts.size() ? cuts[n] : result.size();
+		UINT8* buffer = (UINT8*)&result[start];
+
+		*replacements += LbMatcherReplace(matcher, &state, buffer, end - start, withSpans ? &spans : NULL, NULL);
+		LbMatcherSpansAdd(&spans, buffer, end - start, start);
+		start = end;
+	}
+
+	return result;
+}
+
+// Copying scan of data cut at cuts
+static std::string LbTestRewrite(const LB_MATCHER* matcher, const std::string& data, const std::vector<size_t>& cuts, UINT32* replacements)
+{
+	std::string result;
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	size_t start = 0;
+
+	*replacements = 0;
+
+	for (size_t n = 0; n <= cuts.size(); n++)
+	{
+		size_t end = n < cuts.size() ? cuts[n] : data.size();
+		std::vector<UINT8> output(LbMatcherRewriteBound(matcher, end - start) + 1);
+		SIZE_T written = 0;
+
+		*replacements += LbMatcherRewrite(matcher, &state, (const UINT8*)data.data() + start, end - start, output.data(), &written);
+		LB_CHECK(written <= LbMatcherRewriteBound(matcher, end - start));
+		result.append((const char*)output.data(), written);
+		start = end;
+	}
+
+	return result;
+}
+
+static std::vector<size_t> LbTestCuts(std::mt19937& rng, size_t length, size_t count)
+{
+	std::vector<size_t> cuts;
+
+	for (size_t n = 0; n < count && length > 1; n++)
+		cuts.push_back(1 + rng() % (length - 1));
+	std::sort(cuts.begin(), cuts.end());
+	cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+	return cuts;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(ReplacesEveryPairInPlace)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("Love", "Hate");
+	pairs.Add("Alice", "Trudy");
+	pairs.Add("Rob", "Bob");
+	pairs.reversal = true;
+
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!matcher) return;
+
+	UINT32 replacements = 0;
+	std::string result = LbTestReplace(matcher, "I Love Alice but Hate Bob and Rob. Trudy", {}, TRUE, &replacements);
+
+	LB_CHECK(result == "I Hate Trudy but Love Rob and Bob. Alice");
+	LB_CHECK_EQUAL(6, replacements);
+	LB_CHECK(matcher->equalLength != 0);
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(LongestMatchAndFirstPairWin)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("he", "HE");
+	pairs.Add("she", "SHE");
+	pairs.Add("hers", "HERS");
+	pairs.Add("she", "XXX");
+
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!matcher) return;
+
+	UINT32 replacements = 0;
+	LB_CHECK(LbTestReplace(matcher, "ushers", {}, TRUE, &replacements) == "uSHErs");
+	LB_CHECK(LbTestReplace(matcher, "hershe", {}, TRUE, &replacements) == "HErSHE");
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(UnequalPairsOnlyChangeOnTheCopyingPath)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("cat", "lion");
+	pairs.Add("dog", "cow");
+
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!matcher) return;
+
+	UINT32 replacements = 0;
+	LB_CHECK(LbTestReplace(matcher, "a cat and a dog", {}, TRUE, &replacements) == "a cat and a cow");
+	LB_CHECK_EQUAL(1, replacements);
+	LB_CHECK(LbTestRewrite(matcher, "a cat and a dog", {}, &replacements) == "a lion and a cow");
+	LB_CHECK_EQUAL(2, replacements);
+	LB_CHECK_EQUAL(4, matcher->maxReplaceLength);
+	LB_CHECK_EQUAL(3, matcher->minMatchLength);
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(SplitMatchIsRewrittenWholeOrNotAtAll)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("Love", "Hate");
+
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!matcher) return;
+
+	UINT32 replacements = 0;
+
+	// Both halves in one segment
+	LB_CHECK(LbTestReplace(matcher, "xxLovexx", { 4 }, TRUE, &replacements) == "xxHatexx");
+	LB_CHECK_EQUAL(1, replacements);
+
+	// The first half went out with an earlier segment
+	LB_CHECK(LbTestReplace(matcher, "xxLovexx", { 4 }, FALSE, &replacements) == "xxLovexx");
+	LB_CHECK_EQUAL(0, replacements);
+
+	// One byte per buffer, more buffers than the spans keep
+	LB_REFERENCE_PAIRS longer;
+	longer.Add("abcdefghijkl", "ABCDEFGHIJKL");
+	LB_MATCHER* deep = LbTestCompile(longer);
+	if (deep)
+	{
+		std::vector<size_t> cuts;
+		for (size_t i = 1; i < 12; i++)
+			cuts.push_back(i);
+
+		LB_CHECK(LbTestReplace(deep, "abcdefghijkl", cuts, TRUE, &replacements) == "abcdefghijkl");
+		LB_CHECK_EQUAL(0, replacements);
+		LbMatcherFree(deep);
+	}
+
+	// The copying path never reaches back into bytes it already wrote
+	LB_CHECK(LbTestRewrite(matcher, "xxLovexxLove", { 4 }, &replacements) == "xxLovexxHate");
+	LB_CHECK_EQUAL(1, replacements);
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(RandomDictionariesMatchTheReference)
+{
+	std::mt19937 rng(LbTestSeed());
+	const char* alphabets[] = { "ab", "abcd", "abcdefghijklmnopqrstuvwxyz ./" };
+
+	for (int round = 0; round < 300; round++)
+	{
+		std::string alphabet = alphabets[round % 3];
+		bool equalLength = round % 2 == 0;
+		LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, alphabet, 1 + rng() % 40, 1, 8, equalLength);
+		pairs.reversal = rng() % 2 == 0;
+
+		LB_MATCHER* matcher = LbTestCompile(pairs);
+		if (!matcher) return;
+
+		for (int sample = 0; sample < 10; sample++)
+		{
+			std::string data = LbReferenceString(rng, alphabet, rng() % 600);
+			std::vector<size_t> cuts = LbTestCuts(rng, data.size(), rng() % 8);
+			UINT32 expected = 0;
+			UINT32 actual = 0;
+
+			// Copying path, buffer by buffer
+			std::string reference = LbReferenceRewrite(pairs, data, cuts, false, false, &expected);
+			LB_CHECK(LbTestRewrite(matcher, data, cuts, &actual) == reference);
+			LB_CHECK_EQUAL(expected, actual);
+
+			// In place, every earlier buffer of the segment still at hand
+			reference = LbReferenceRewrite(pairs, data, cuts, true, true, &expected);
+			LB_CHECK(LbTestReplace(matcher, data, cuts, TRUE, &actual) == reference);
+			LB_CHECK_EQUAL(expected, actual);
+		}
+
+		LbMatcherFree(matcher);
+	}
+}
+
+LB_TEST(WideStatesPastSixtyFiveThousand)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcdefghijklmnopqrstuvwxyz", 6000, 12, 16, true);
+
+	// A short pattern keeps the dictionary on the automaton, see LbHashedPreferred
+	pairs.Add("ab", "AB");
+
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!matcher) return;
+
+	LB_CHECK_EQUAL(LB_MATCHER_ENGINE_AUTOMATON, matcher->engine);
+	LB_CHECK(matcher->stateCount > 0x10000);
+	LB_CHECK_EQUAL(sizeof(UINT32), matcher->stateWidth);
+	LB_CHECK_EQUAL(27, matcher->classCount);
+
+	for (int sample = 0; sample < 20; sample++)
+	{
+		std::string data = LbReferenceString(rng, "abcdefghijklmnopqrstuvwxyz", 2000);
+		UINT32 expected = 0;
+		UINT32 actual = 0;
+
+		// Plant whole patterns so the deep states are reached
+		for (int k = 0; k < 10; k++)
+		{
+			const std::string& pattern = pairs.match[rng() % pairs.match.size()];
+			data.replace(rng() % (data.size() - pattern.size()), pattern.size(), pattern);
+		}
+
+		std::string reference = LbReferenceRewrite(pairs, data, {}, true, true, &expected);
+		LB_CHECK(LbTestReplace(matcher, data, {}, TRUE, &actual) == reference);
+		LB_CHECK_EQUAL(expected, actual);
+	}
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(ByteClassesAndBreadthFirstStates)
+{
+	std::mt19937 rng(LbTestSeed());
+	const char* alphabets[] = { "ab", "abcdefghijklmnopqrstuvwxyz", "0123456789abcdefABCDEF:/.-_ " };
+
+	for (int round = 0; round < 60; round++)
+	{
+		LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, alphabets[round % 3], 1 + rng() % 300, 1, 12, round % 2 == 0);
+		pairs.reversal = rng() % 2 == 0;
+
+		LB_MATCHER* matcher = LbTestCompile(pairs);
+		if (!matcher) return;
+
+		// Every byte a pattern contains has a column of its own, in byte order, every other byte shares column 0
+		bool used[256] = {};
+		for (size_t n = 0; n < pairs.match.size(); n++)
+		{
+			for (UINT8 c : pairs.match[n])
+				used[c] = true;
+			for (UINT8 c : pairs.reversal ? pairs.replace[n] : std::string())
+				used[c] = true;
+		}
+
+		const UINT8* classes = (const UINT8*)matcher + matcher->classOffset;
+		UINT32 classCount = 1;
+		for (int c = 0; c < 256; c++)
+			LB_CHECK_EQUAL(used[c] ? classCount++ : 0, classes[c]);
+		LB_CHECK_EQUAL(classCount, matcher->classCount);
+
+		// No dictionary this small needs more than 16 bit states
+		LB_CHECK(matcher->stateCount <= 0x10000);
+		LB_CHECK_EQUAL(sizeof(UINT16), matcher->stateWidth);
+		LB_CHECK(matcher->size >= matcher->transitionOffset + (SIZE_T)matcher->stateCount * matcher->classCount * sizeof(UINT16));
+
+		// States are numbered as they are reached, never deeper than the one after them
+		const UINT32* depths = (const UINT32*)((const UINT8*)matcher + matcher->depthOffset);
+		LB_CHECK_EQUAL(0, depths[LB_MATCHER_ROOT_STATE]);
+		for (UINT32 state = 1; state < matcher->stateCount; state++)
+		{
+			if (!LB_CHECK(depths[state - 1] <= depths[state] && depths[state] >= 1))
+				break;
+		}
+
+		LbMatcherFree(matcher);
+	}
+}
+
+LB_TEST(PrefilterFindsEveryCandidate)
+{
+	std::mt19937 rng(LbTestSeed());
+
+	for (int round = 0; round < 200; round++)
+	{
+		LB_REFERENCE_PAIRS pairs;
+		size_t firstBytes = 1 + round % 12;
+
+		for (size_t n = 0; n < firstBytes; n++)
+			pairs.Add(std::string(1, (char)('a' + n)) + "zz", std::string(1, (char)('A' + n)) + "ZZ");
+
+		LB_MATCHER* matcher = LbTestCompile(pairs);
+		if (!matcher) return;
+
+		LB_CHECK_EQUAL(firstBytes, matcher->firstByteCount);
+
+		std::string data = LbReferenceString(rng, "abcdefghijklmnopqrstuvwxyz0123456789", 1 + rng() % 200);
+		for (SIZE_T start = 0; start <= data.size(); start++)
+		{
+			SIZE_T expected = start;
+			while (expected < data.size() && (UINT8)(data[expected] - 'a') >= firstBytes)
+				expected++;
+
+			if (!LB_CHECK_EQUAL(expected, LbMatcherNextCandidate(matcher, (const UINT8*)data.data(), start, data.size())))
+				break;
+		}
+
+		LbMatcherFree(matcher);
+	}
+}
+
+LB_TEST(PrefilterLeavesResultsAlone)
+{
+	std::mt19937 rng(LbTestSeed());
+
+	for (int round = 0; round < 100; round++)
+	{
+		LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcdefghijklmnop", 1 + rng() % 12, 1, 6, true);
+		LB_MATCHER* matcher = LbTestCompile(pairs);
+		if (!matcher) return;
+
+		std::string data = LbReferenceString(rng, "abcdefghijklmnopqrstuvwxyz", rng() % 1500);
+		UINT32 expected = 0;
+		UINT32 actual = 0;
+		std::string reference = LbTestReplace(matcher, data, {}, TRUE, &expected);
+
+		// The scalar bitmap, as for more first bytes than the SSE2 loop takes
+		UINT32 firstByteCount = matcher->firstByteCount;
+		matcher->firstByteCount = LB_PREFILTER_MAX_BYTES + 1;
+		LB_CHECK(LbTestReplace(matcher, data, {}, TRUE, &actual) == reference);
+		LB_CHECK_EQUAL(expected, actual);
+
+		// Every byte a candidate, the automaton steps over all of them
+		memset(matcher->firstByteMap, 0xFF, sizeof(matcher->firstByteMap));
+		LB_CHECK(LbTestReplace(matcher, data, {}, TRUE, &actual) == reference);
+		LB_CHECK_EQUAL(expected, actual);
+
+		matcher->firstByteCount = firstByteCount;
+		LbMatcherFree(matcher);
+	}
+}
+
+LB_TEST(ImageRoundTripAndRejectsDamage)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcdef", 50, 2, 6, true);
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!matcher) return;
+
+	UINT32 offset = 0;
+	SIZE_T end = LbMatcherWriteImage(matcher, NULL, 64, &offset);
+	std::vector<UINT8> image(end);
+
+	LbMatcherWriteImage(matcher, image.data(), 64, &offset);
+	LB_CHECK_EQUAL(0, offset % 64);
+
+	LB_MATCHER* bound = (LB_MATCHER*)&image[offset];
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherBindImage(bound, end - offset)))
+	{
+		std::string data = LbReferenceString(rng, "abcdef", 1000);
+		UINT32 expected = 0;
+		UINT32 actual = 0;
+
+		LB_CHECK(LbTestReplace(bound, data, {}, TRUE, &actual) == LbTestReplace(matcher, data, {}, TRUE, &expected));
+		LB_CHECK_EQUAL(expected, actual);
+		LbMatcherUnbindImage(bound);
+	}
+
+	// A transition past the last state
+	std::vector<UINT8> damaged(image);
+	LB_MATCHER* header = (LB_MATCHER*)&damaged[offset];
+	UINT8* transition = (UINT8*)header + header->transitionOffset + header->stateWidth * 5;
+	memset(transition, 0xFF, header->stateWidth);
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, end - offset));
+
+	// A byte whose class has no column
+	damaged = image;
+	header = (LB_MATCHER*)&damaged[offset];
+	((UINT8*)header + header->classOffset)['a'] = (UINT8)header->classCount;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, end - offset));
+
+	// No classes at all, or more than there are bytes
+	for (UINT32 classCount : { 0u, 257u })
+	{
+		damaged = image;
+		header = (LB_MATCHER*)&damaged[offset];
+		header->classCount = classCount;
+		LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, end - offset));
+	}
+
+	// States neither 16 nor 32 bits wide
+	damaged = image;
+	header = (LB_MATCHER*)&damaged[offset];
+	header->stateWidth = 3;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, end - offset));
+
+	// A block that claims more than there is
+	damaged = image;
+	header = (LB_MATCHER*)&damaged[offset];
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherBindImage(header, header->size - 1));
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(BudgetIsCheckedBeforeAllocating)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_REFERENCE_PAIRS pairs = LbReferenceRandomPairs(rng, "abcdefghijklmnopqrstuvwxyz", 2000, 3, 10, true);
+	pairs.Add("a", "b");
+
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+
+	ud.budget = 64 * 1024;
+	LB_CHECK_EQUAL(STATUS_QUOTA_EXCEEDED, LbMatcherCompile(&ud, &matcher));
+	LB_CHECK(matcher == NULL);
+
+	ud.budget = 64 * 1024 * 1024;
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher)))
+	{
+		LB_CHECK(matcher->size < ud.budget);
+		LbMatcherFree(matcher);
+	}
+}
+
+LB_TEST(RejectsEmptyStrings)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("abc", "");
+
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherCompile(&ud, &matcher));
+	LB_CHECK(matcher == NULL);
+}
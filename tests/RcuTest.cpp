@@ -0,0 +1,150 @@
+/*/
+/*  ** RcuTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the read-copy-update pointer the rule sets are published through: the first value
+/*	published without a grace period, every later one retiring the one before it only after the barrier, and
+/*	LbRcuWaitReaders holding a publish back exactly as long as a reader stays in the section it was in.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "Rcu.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+// What the callbacks saw, in the order they saw it
+struct LB_TEST_LOG
+{
+	std::vector<int> events;
+	std::atomic<int> retired;
+};
+
+static void LbTestBarrier(void* context)
+{
+	((LB_TEST_LOG*)context)->events.push_back(0);
+}
+
+static void LbTestRetire(void* value, void* context)
+{
+	LB_TEST_LOG* log = (LB_TEST_LOG*)context;
+
+	log->events.push_back(*(int*)value);
+	log->retired = *(int*)value;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(FirstPublishHasNoGracePeriod)
+{
+	LB_TEST_LOG log;
+	LB_RCU rcu;
+	int one = 1;
+
+	log.retired = 0;
+	LbRcuInitialize(&rcu, NULL, LbTestBarrier, &log);
+	LB_CHECK(LbRcuRead(&rcu) == NULL);
+
+	LbRcuPublish(&rcu, &one, LbTestRetire, &log);
+	LB_CHECK(LbRcuRead(&rcu) == &one);
+	LB_CHECK(log.events.empty());
+	LB_CHECK_EQUAL(0, rcu.gracePeriods);
+}
+
+LB_TEST(RetiresPreviousAfterTheBarrier)
+{
+	LB_TEST_LOG log;
+	LB_RCU rcu;
+	int values[] = { 1, 2, 3 };
+
+	log.retired = 0;
+	LbRcuInitialize(&rcu, &values[0], LbTestBarrier, &log);
+
+	LbRcuPublish(&rcu, &values[1], LbTestRetire, &log);
+	LbRcuPublish(&rcu, &values[2], LbTestRetire, &log);
+
+	// Barrier, then the value it covered, once per publish
+	LB_CHECK(log.events == std::vector<int>({ 0, 1, 0, 2 }));
+	LB_CHECK(LbRcuRead(&rcu) == &values[2]);
+	LB_CHECK_EQUAL(2, rcu.gracePeriods);
+}
+
+LB_TEST(WaitsForReaderInsideASection)
+{
+	std::vector<LB_RCU_READER> readers(2);
+	LB_RCU_READERS waited = { readers.data(), 2 };
+	LB_TEST_LOG log;
+	LB_RCU rcu;
+	int values[] = { 1, 2 };
+	std::atomic<bool> leave(false);
+	std::atomic<bool> inside(false);
+
+	readers[0].section = 0;
+	readers[1].section = 0;
+	log.retired = 0;
+	LbRcuInitialize(&rcu, &values[0], LbRcuWaitReaders, &waited);
+
+	std::thread reader([&]() {
+		LbRcuReadBegin(&readers[0]);
+		LB_CHECK(LbRcuRead(&rcu) == &values[0]);
+		inside = true;
+		while (!leave.load())
+			std::this_thread::yield();
+		LbRcuReadEnd(&readers[0]);
+	});
+
+	while (!inside.load())
+		std::this_thread::yield();
+
+	std::thread writer([&]() {
+		LbRcuPublish(&rcu, &values[1], LbTestRetire, &log);
+	});
+
+	// The publish is visible at once, the retire waits on the reader
+	while (LbRcuRead(&rcu) != &values[1])
+		std::this_thread::yield();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	LB_CHECK_EQUAL(0, log.retired.load());
+
+	leave = true;
+	reader.join();
+	writer.join();
+
+	LB_CHECK_EQUAL(1, log.retired.load());
+	LB_CHECK_EQUAL(1, rcu.gracePeriods);
+}
+
+LB_TEST(LaterSectionsDoNotHoldUpAPublish)
+{
+	std::vector<LB_RCU_READER> readers(1);
+	LB_RCU_READERS waited = { readers.data(), 1 };
+	LB_TEST_LOG log;
+	LB_RCU rcu;
+	int values[] = { 1, 2, 3 };
+
+	log.retired = 0;
+	LbRcuInitialize(&rcu, &values[0], LbRcuWaitReaders, &waited);
+
+	// Outside of any section, and a section entered and left, are never waited on
+	readers[0].section = 0;
+	LbRcuPublish(&rcu, &values[1], LbTestRetire, &log);
+	LB_CHECK_EQUAL(1, log.retired.load());
+
+	LbRcuReadBegin(&readers[0]);
+	LbRcuReadEnd(&readers[0]);
+	LbRcuPublish(&rcu, &values[2], LbTestRetire, &log);
+	LB_CHECK_EQUAL(2, log.retired.load());
+	LB_CHECK_EQUAL(2, rcu.gracePeriods);
+}
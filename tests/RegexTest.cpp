@@ -0,0 +1,243 @@
+/*/
+/*  ** RegexTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the lazy DFA regex engine: the syntax it rejects, random patterns held against
+/*	std::regex for both rewrites, positions carried between buffers, and a pattern with far more DFA states
+/*	than the state cache holds, which has to keep matching on the NFA once the cache is full.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbReference.h"
+#include "RegexEngine.h"
+
+/////////////
+// HELPERS //
+/////////////
+
+static LB_MATCHER* LbTestCompile(LB_REFERENCE_PAIRS& pairs)
+{
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+
+	ud.regex = true;
+	if (!NT_SUCCESS(LbMatcherCompile(&ud, &matcher)))
+		return NULL;
+
+	return matcher;
+}
+
+static std::string LbTestRewrite(const LB_MATCHER* matcher, const std::string& data, UINT32* replacements)
+{
+	std::vector<UINT8> output(LbMatcherRewriteBound(matcher, data.size()));
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	SIZE_T written = 0;
+
+	*replacements = LbMatcherRewrite(matcher, &state, (const UINT8*)data.data(), data.size(), output.data(), &written);
+	return std::string(output.begin(), output.begin() + written);
+}
+
+static std::string LbTestReplace(const LB_MATCHER* matcher, std::string data, UINT32* replacements)
+{
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+
+	*replacements = LbMatcherReplace(matcher, &state, (UINT8*)&data[0], data.size(), NULL, NULL);
+	return data;
+}
+
+// A random piece of a pattern that never matches the empty string
+static std::string LbTestAtom(std::mt19937& rng)
+{
+	static const char* atoms[] = { "a", "b", "c", "[ab]", "[^a]", ".", "\\n", "(a|bc)", "(b|ca|\\n)", "[a-b]c" };
+	return atoms[rng() % (sizeof(atoms) / sizeof(atoms[0]))];
+}
+
+static std::string LbTestPattern(std::mt19937& rng)
+{
+	static const char* required[] = { "", "", "+", "{1,2}", "{2}" };
+	static const char* any[] = { "", "", "*", "+", "?", "{0,2}", "{1,3}" };
+	std::string pattern = rng() % 4 == 0 ? "^" : "";
+
+	pattern += LbTestAtom(rng) + required[rng() % 5];
+	for (UINT32 pieces = rng() % 3; pieces > 0; pieces--)
+		pattern += LbTestAtom(rng) + any[rng() % 7];
+
+	return pattern;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(RejectsWhatItDoesNotSupport)
+{
+	const char* rejected[] = { "a$", "(a", "a)", "[ab", "a{3,1}", "a{256}", "*a", "a^b", "\\1", "\\q", "a*", "b?", "(a|b)*", "^" };
+	UINT32 wrong = 0;
+
+	for (const char* pattern : rejected)
+	{
+		LB_REFERENCE_PAIRS pairs;
+		pairs.Add(pattern, "x");
+		LB_MATCHER* matcher = LbTestCompile(pairs);
+		if (matcher)
+		{
+			printf("  accepted %s\n", pattern);
+			LbMatcherFree(matcher);
+			wrong++;
+		}
+	}
+	LB_CHECK_EQUAL(0, wrong);
+
+	// Reversal needs literals, and the state cache alone is more than a small budget
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("a[bc]", "x");
+	LB_USERDATA ud = pairs.UserData();
+	LB_MATCHER* matcher = NULL;
+	ud.regex = true;
+	ud.enableReversal = true;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbMatcherCompile(&ud, &matcher));
+
+	ud.enableReversal = false;
+	ud.budget = LB_REGEX_CACHE_BYTES / 2;
+	LB_CHECK_EQUAL(STATUS_QUOTA_EXCEEDED, LbMatcherCompile(&ud, &matcher));
+	LB_CHECK(matcher == NULL);
+
+	ud.budget = 0;
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &matcher));
+	LB_CHECK_EQUAL(LB_MATCHER_ENGINE_REGEX, matcher->engine);
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(RandomPatternsMatchStdRegex)
+{
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+	UINT32 replaced = 0;
+
+	for (UINT32 round = 0; round < 150; round++)
+	{
+		LB_REFERENCE_PAIRS pairs;
+		for (UINT32 p = 1 + rng() % 3; p > 0; p--)
+			pairs.Add(LbTestPattern(rng), std::string(1 + rng() % 3, (char)('X' + p)));
+
+		LB_MATCHER* matcher = LbTestCompile(pairs);
+		if (!matcher)
+		{
+			printf("  did not compile %s\n", pairs.match[0].c_str());
+			wrong++;
+			continue;
+		}
+
+		for (UINT32 text = 0; text < 4; text++)
+		{
+			std::string data = LbReferenceString(rng, "aabbcc\n", 1 + rng() % 32);
+			UINT32 expectedCount;
+			UINT32 count;
+
+			// Copied with every match replaced, then in place with only the equal length ones
+			std::string expected = LbReferenceRegexRewrite(pairs, data, false, &expectedCount);
+			std::string actual = LbTestRewrite(matcher, data, &count);
+			BOOLEAN same = expected == actual && expectedCount == count;
+			replaced += count;
+
+			expected = LbReferenceRegexRewrite(pairs, data, true, &expectedCount);
+			actual = LbTestReplace(matcher, data, &count);
+			same = same && expected == actual && expectedCount == count;
+
+			if (!same)
+			{
+				printf("  %s on \"%s\"\n", pairs.match[0].c_str(), data.c_str());
+				wrong++;
+			}
+		}
+
+		LbMatcherFree(matcher);
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK(replaced > 100);
+}
+
+LB_TEST(PositionsCarryBetweenBuffers)
+{
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("Host: [a-z]+\\.com", "Host: x.com");
+	pairs.Add("^GET", "PUT");
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!LB_CHECK(matcher != NULL))
+		return;
+
+	// Still inside a match at the end of the first buffer, the second one cannot rewrite what was sent
+	std::string first = "GET / HTTP/1.1\r\nHost: exam";
+	std::string second = "ple.com\r\n\r\nHost: b.com";
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	UINT32 count = LbMatcherReplace(matcher, &state, (UINT8*)&first[0], first.size(), NULL, NULL);
+
+	LB_CHECK_EQUAL(1, count);
+	LB_CHECK(first.compare(0, 3, "PUT") == 0);
+	LB_CHECK_EQUAL((SIZE_T)-1, LbMatcherPendingLength(matcher, state));
+
+	std::vector<UINT8> output(LbMatcherRewriteBound(matcher, second.size()));
+	SIZE_T written = 0;
+	count = LbMatcherRewrite(matcher, &state, (const UINT8*)second.data(), second.size(), output.data(), &written);
+	LB_CHECK_EQUAL(1, count);
+	LB_CHECK(std::string(output.begin(), output.begin() + written) == "ple.com\r\n\r\nHost: x.com");
+	LB_CHECK_EQUAL(0, LbMatcherPendingLength(matcher, state));
+
+	// ^ holds after a line feed carried over from the previous buffer, and not in the middle of a line
+	std::string line = "x\n";
+	std::string next = "GETGET";
+	state = LB_MATCHER_ROOT_STATE;
+	LbMatcherReplace(matcher, &state, (UINT8*)&line[0], line.size(), NULL, NULL);
+	LB_CHECK_EQUAL(1, LbMatcherReplace(matcher, &state, (UINT8*)&next[0], next.size(), NULL, NULL));
+	LB_CHECK(next == "PUTGET");
+
+	LbMatcherFree(matcher);
+}
+
+LB_TEST(FullCacheFallsBackToTheNfa)
+{
+	// An a thirteen bytes before a b: the DFA needs a state for every mix of a and b in the last thirteen
+	// bytes, thousands more than the cache holds, so random text soon runs on the NFA
+	const size_t length = 14;
+	LB_REFERENCE_PAIRS pairs;
+	pairs.Add("a[ab]{12}b", std::string(length, 'X'));
+	LB_MATCHER* matcher = LbTestCompile(pairs);
+	if (!LB_CHECK(matcher != NULL))
+		return;
+
+	std::mt19937 rng(LbTestSeed());
+	UINT32 wrong = 0;
+
+	for (UINT32 round = 0; round < 4; round++)
+	{
+		std::string data = LbReferenceString(rng, "ab", 1 << 16);
+
+		// Every match is fourteen bytes long, the earliest ending one is the leftmost one
+		std::string expected = data;
+		UINT32 expectedCount = 0;
+		for (size_t start = 0; start + length <= data.size(); )
+		{
+			if (data[start] == 'a' && data[start + length - 1] == 'b')
+			{
+				expected.replace(start, length, length, 'X');
+				expectedCount++;
+				start += length;
+			}
+			else
+				start++;
+		}
+
+		UINT32 count;
+		wrong += LbTestReplace(matcher, data, &count) != expected || count != expectedCount;
+		wrong += LbTestRewrite(matcher, data, &count) != expected || count != expectedCount;
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LbMatcherFree(matcher);
+}
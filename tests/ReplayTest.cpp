@@ -0,0 +1,548 @@
+/*/
+/*  ** ReplayTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the replay harness in bench/LbReplay.h: captures read back the same from every file
+/*	format and link layer it knows, packets it cannot replay counted instead of kept, NET_BUFFER chains holding
+/*	exactly the data a layer hands over, and the classify path run over them: matches split between MDLs
+/*	rewritten with a valid checksum, blocked flows left alone and size changes sent as copies. At the stream
+/*	layer, writes of any size come out as one rewrite of the whole stream would, and only in order data is sent.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbReplay.h"
+
+/////////////
+// HELPERS //
+/////////////
+
+static const UINT8 LbTestClient[16] = { 10, 0, 0, 1 };
+static const UINT8 LbTestServer[16] = { 192, 168, 0, 1 };
+static const UINT8 LbTestClientV6[16] = { 0x20, 0x01, 0x0D, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+static const UINT8 LbTestServerV6[16] = { 0x20, 0x01, 0x0D, 0xB8, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1 };
+
+static std::vector<LB_REPLAY_PACKET> LbTestTraffic(UINT32 flows, UINT32 packets)
+{
+	return LbReplaySynthesize(flows, packets, LbTestSeed(), [](std::mt19937& rng, UINT32, BOOLEAN) {
+		std::string payload(1 + rng() % 600, ' ');
+		for (char& c : payload)
+			c = (char)('a' + rng() % 26);
+		return payload;
+	});
+}
+
+static BOOLEAN LbTestSamePackets(const std::vector<LB_REPLAY_PACKET>& expected, const std::vector<LB_REPLAY_PACKET>& actual, UINT64 timestampUnit)
+{
+	if (expected.size() != actual.size())
+		return FALSE;
+
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		const LB_REPLAY_PACKET& a = expected[i];
+		const LB_REPLAY_PACKET& b = actual[i];
+
+		if (a.family != b.family || a.protocol != b.protocol || a.sourcePort != b.sourcePort || a.destinationPort != b.destinationPort)
+			return FALSE;
+		if (memcmp(a.source, b.source, 16) != 0 || memcmp(a.destination, b.destination, 16) != 0)
+			return FALSE;
+		if (a.headerLength != b.headerLength || a.segment != b.segment || a.timestamp / timestampUnit * timestampUnit != b.timestamp)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+// A classic pcap file of hand made frames
+static std::vector<UINT8> LbTestPcap(UINT32 linkType, const std::vector<std::vector<UINT8>>& frames, const std::vector<UINT32>& wireLengths = {})
+{
+	std::vector<UINT8> out = LbReplayWritePcap({}, linkType);
+
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		LbReplayAppend32(out, 1);
+		LbReplayAppend32(out, 0);
+		LbReplayAppend32(out, (UINT32)frames[i].size());
+		LbReplayAppend32(out, i < wireLengths.size() ? wireLengths[i] : (UINT32)frames[i].size());
+		out.insert(out.end(), frames[i].begin(), frames[i].end());
+	}
+
+	return out;
+}
+
+// The same pcap file written by a machine of the other byte order
+static std::vector<UINT8> LbTestSwapPcap(std::vector<UINT8> pcap)
+{
+	auto swap = [&](size_t offset) {
+		std::reverse(pcap.begin() + offset, pcap.begin() + offset + 4);
+	};
+
+	for (size_t offset = 0; offset < 24; offset += 4)
+		swap(offset);
+	std::swap(pcap[4], pcap[6]);	// Version is two 16 bit fields, not one 32 bit one
+	std::swap(pcap[5], pcap[7]);
+
+	for (size_t offset = 24; offset < pcap.size(); )
+	{
+		UINT32 captured;
+		memcpy(&captured, &pcap[offset + 8], 4);
+		for (size_t field = 0; field < 16; field += 4)
+			swap(offset + field);
+		offset += 16 + captured;
+	}
+
+	return pcap;
+}
+
+// Every byte a NET_BUFFER's MDLs hold for it
+static std::vector<UINT8> LbTestGather(LB_REPLAY_NET_BUFFER* netBuffer)
+{
+	LB_SPAN_ITERATOR<LB_REPLAY_MDL> it;
+	LB_SPAN span;
+	std::vector<UINT8> data;
+
+	LbSpanBegin(&it, netBuffer->CurrentMdl, netBuffer->CurrentMdlOffset, netBuffer->DataLength);
+	while (LbSpanNext(&it, &span))
+		data.insert(data.end(), span.data, span.data + span.length);
+
+	return data;
+}
+
+static BOOLEAN LbTestContains(const std::vector<UINT8>& data, const char* text)
+{
+	return std::search(data.begin(), data.end(), text, text + strlen(text)) != data.end();
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(ReadsEveryCaptureFormat)
+{
+	std::vector<LB_REPLAY_PACKET> expected = LbTestTraffic(8, 64);
+	LB_REPLAY_READ_STATS stats;
+
+	struct
+	{
+		const char* name;
+		std::vector<UINT8> capture;
+		UINT64 timestampUnit;
+	} variants[] = {
+		{ "pcap, Ethernet", LbReplayWritePcap(expected, LB_REPLAY_LINKTYPE_ETHERNET), 1000 },
+		{ "pcap, raw IP", LbReplayWritePcap(expected, LB_REPLAY_LINKTYPE_RAW), 1000 },
+		{ "pcap, swapped", LbTestSwapPcap(LbReplayWritePcap(expected, LB_REPLAY_LINKTYPE_ETHERNET)), 1000 },
+		{ "pcapng, Ethernet", LbReplayWritePcapng(expected, LB_REPLAY_LINKTYPE_ETHERNET), 1 },
+		{ "pcapng, raw IP", LbReplayWritePcapng(expected, LB_REPLAY_LINKTYPE_RAW), 1 },
+	};
+
+	for (auto& variant : variants)
+	{
+		std::vector<LB_REPLAY_PACKET> packets;
+		if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbReplayParseCapture(variant.capture.data(), variant.capture.size(), &packets, &stats)))
+			continue;
+
+		LB_CHECK_EQUAL(expected.size(), stats.packets);
+		if (!LB_CHECK(LbTestSamePackets(expected, packets, variant.timestampUnit)))
+			printf("  in %s\n", variant.name);
+	}
+
+	// Nanosecond pcap timestamps
+	std::vector<UINT8> nanoseconds = LbReplayWritePcap(expected, LB_REPLAY_LINKTYPE_ETHERNET);
+	LbWriteBe32(&nanoseconds[0], 0x4D3CB2A1);
+	for (size_t offset = 24, i = 0; offset < nanoseconds.size(); i++)
+	{
+		UINT32 fraction = (UINT32)(expected[i].timestamp % 1000000000ull);
+		UINT32 captured;
+		memcpy(&nanoseconds[offset + 4], &fraction, 4);
+		memcpy(&captured, &nanoseconds[offset + 8], 4);
+		offset += 16 + captured;
+	}
+
+	std::vector<LB_REPLAY_PACKET> packets;
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbReplayParseCapture(nanoseconds.data(), nanoseconds.size(), &packets, &stats));
+	LB_CHECK(LbTestSamePackets(expected, packets, 1));
+
+	// Not a capture, or one cut off in the middle of a record
+	std::vector<UINT8> cut = LbReplayWritePcapng(expected, LB_REPLAY_LINKTYPE_ETHERNET);
+	cut.resize(cut.size() - 10);
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbReplayParseCapture(cut.data(), cut.size(), &packets, &stats));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbReplayParseCapture(expected[0].segment.data(), expected[0].segment.size(), &packets, &stats));
+}
+
+LB_TEST(StripsEveryLinkLayer)
+{
+	LB_REPLAY_PACKET packet = LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1000, "GET / HTTP/1.1\r\n\r\n");
+	LB_REPLAY_PACKET packetV6 = LbReplayMakePacket(LB_FAMILY_IPV6, LB_IPPROTO_UDP, LbTestClientV6, LbTestServerV6, 50000, 53, 0, "query");
+	std::vector<UINT8> ip = LbReplayFrame(packet, LB_REPLAY_LINKTYPE_RAW);
+	std::vector<UINT8> ipV6 = LbReplayFrame(packetV6, LB_REPLAY_LINKTYPE_RAW);
+
+	// Two stacked VLAN tags
+	std::vector<UINT8> vlan = LbReplayFrame(packet, LB_REPLAY_LINKTYPE_ETHERNET);
+	UINT8 tags[] = { 0x88, 0xA8, 0x00, 0x05, 0x81, 0x00, 0x00, 0x06 };
+	vlan.insert(vlan.begin() + 12, tags, tags + sizeof(tags));
+
+	std::vector<UINT8> sll(16, 0);
+	LbWriteBe16(&sll[14], 0x86DD);
+	sll.insert(sll.end(), ipV6.begin(), ipV6.end());
+
+	std::vector<UINT8> sll2(20, 0);
+	LbWriteBe16(&sll2[0], 0x0800);
+	sll2.insert(sll2.end(), ip.begin(), ip.end());
+
+	std::vector<UINT8> loopback = { 2, 0, 0, 0 };
+	loopback.insert(loopback.end(), ip.begin(), ip.end());
+	std::vector<UINT8> loopbackV6 = { 0, 0, 0, 30 };
+	loopbackV6.insert(loopbackV6.end(), ipV6.begin(), ipV6.end());
+
+	struct
+	{
+		UINT32 linkType;
+		std::vector<UINT8> frame;
+		const LB_REPLAY_PACKET* expected;
+	} variants[] = {
+		{ LB_REPLAY_LINKTYPE_ETHERNET, vlan, &packet },
+		{ LB_REPLAY_LINKTYPE_LINUX_SLL, sll, &packetV6 },
+		{ LB_REPLAY_LINKTYPE_LINUX_SLL2, sll2, &packet },
+		{ LB_REPLAY_LINKTYPE_NULL, loopback, &packet },
+		{ LB_REPLAY_LINKTYPE_NULL, loopbackV6, &packetV6 },
+		{ LB_REPLAY_LINKTYPE_IPV4, ip, &packet },
+		{ LB_REPLAY_LINKTYPE_IPV6, ipV6, &packetV6 },
+	};
+
+	for (auto& variant : variants)
+	{
+		std::vector<UINT8> capture = LbTestPcap(variant.linkType, { variant.frame });
+		std::vector<LB_REPLAY_PACKET> packets;
+		LB_REPLAY_READ_STATS stats;
+
+		LB_CHECK_EQUAL(STATUS_SUCCESS, LbReplayParseCapture(capture.data(), capture.size(), &packets, &stats));
+		if (!LB_CHECK_EQUAL(1, packets.size()))
+			continue;
+
+		LB_REPLAY_PACKET expected = *variant.expected;
+		expected.timestamp = 1000000000ull;
+		LB_CHECK(LbTestSamePackets({ expected }, packets, 1));
+	}
+}
+
+LB_TEST(SkipsWhatItCannotReplay)
+{
+	LB_REPLAY_PACKET packet = LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1000, std::string(100, 'x'));
+	LB_REPLAY_PACKET packetV6 = LbReplayMakePacket(LB_FAMILY_IPV6, LB_IPPROTO_TCP, LbTestClientV6, LbTestServerV6, 50000, 80, 1000, std::string(100, 'x'));
+	std::vector<UINT8> good = LbReplayFrame(packet, LB_REPLAY_LINKTYPE_ETHERNET);
+
+	std::vector<UINT8> fragment = good;
+	LbWriteBe16(&fragment[14 + 6], 0x2000);		// More fragments
+
+	std::vector<UINT8> fragmentV6 = LbReplayFrame(packetV6, LB_REPLAY_LINKTYPE_ETHERNET);
+	UINT8 fragmentHeader[8] = { LB_IPPROTO_TCP, 0, 0, 0, 0, 0, 0, 1 };
+	fragmentV6[14 + 6] = 44;
+	LbWriteBe16(&fragmentV6[14 + 4], (UINT16)(LbReadBe16(&fragmentV6[14 + 4]) + 8));
+	fragmentV6.insert(fragmentV6.begin() + 14 + 40, fragmentHeader, fragmentHeader + 8);
+
+	std::vector<UINT8> icmp = good;
+	icmp[14 + 9] = 1;
+
+	std::vector<UINT8> arp = good;
+	LbWriteBe16(&arp[12], 0x0806);
+
+	std::vector<UINT8> truncated(good.begin(), good.begin() + 80);
+
+	std::vector<UINT8> capture = LbTestPcap(LB_REPLAY_LINKTYPE_ETHERNET, { fragment, fragmentV6, icmp, arp, truncated, good },
+		{ (UINT32)fragment.size(), (UINT32)fragmentV6.size(), (UINT32)icmp.size(), (UINT32)arp.size(), (UINT32)good.size(), (UINT32)good.size() });
+	std::vector<LB_REPLAY_PACKET> packets;
+	LB_REPLAY_READ_STATS stats;
+
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbReplayParseCapture(capture.data(), capture.size(), &packets, &stats));
+	LB_CHECK_EQUAL(6, stats.frames);
+	LB_CHECK_EQUAL(1, stats.packets);
+	LB_CHECK_EQUAL(2, stats.fragments);
+	LB_CHECK_EQUAL(2, stats.other);
+	LB_CHECK_EQUAL(1, stats.truncated);
+	LB_CHECK_EQUAL(1, packets.size());
+}
+
+LB_TEST(ChainsHoldWhatTheLayerHandsOver)
+{
+	std::vector<LB_REPLAY_PACKET> packets = LbTestTraffic(16, 400);
+	LB_REPLAY_LAYOUT layout;
+	layout.splitPercent = 100;
+	layout.seed = LbTestSeed();
+
+	LB_REPLAY_CORPUS corpus;
+	LbReplayBuild(packets, layout, &corpus);
+
+	// NET_BUFFERs come in packet order, outbound ones from the transport header on and inbound ones from the payload
+	UINT32 wrong = 0;
+	UINT32 batched = 0;
+	size_t next = 0;
+	for (const LB_REPLAY_CALL& call : corpus.calls)
+	{
+		UINT32 count = 0;
+		for (LB_REPLAY_NET_BUFFER* netBuffer = call.netBufferList->FirstNetBuffer; netBuffer != NULL; netBuffer = netBuffer->Next, next++, count++)
+		{
+			const LB_REPLAY_PACKET& packet = packets[next];
+			BOOLEAN outbound = packet.sourcePort > packet.destinationPort;
+			std::vector<UINT8> expected(packet.segment.begin() + (outbound ? 0 : packet.headerLength), packet.segment.end());
+
+			wrong += LbTestGather(netBuffer) != expected;
+			wrong += netBuffer->CurrentMdlOffset != LB_REPLAY_HEADROOM;
+			wrong += (call.flow != NULL) != outbound;
+			wrong += call.values.layerId != (outbound ? LB_REPLAY_LAYER_OUTBOUND_TRANSPORT_V4 : LB_REPLAY_LAYER_INBOUND_TRANSPORT_V4) + (packet.family == LB_FAMILY_IPV6);
+		}
+
+		wrong += count != call.packets || count > layout.maxNetBuffers;
+		batched += count > 1;
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK_EQUAL(packets.size(), next);
+	LB_CHECK(batched > 0);
+	LB_CHECK(corpus.mdls.size() > corpus.netBuffers.size());
+}
+
+LB_TEST(MatchesSplitBetweenMdlsAreRewrittenInPlace)
+{
+	std::mt19937 rng(LbTestSeed());
+	std::vector<LB_REPLAY_PACKET> packets;
+
+	// Outgoing TCP and UDP, IPv4 and IPv6, one or several matches anywhere in short payloads
+	for (UINT32 n = 0; n < 400; n++)
+	{
+		UINT8 family = n % 2 ? LB_FAMILY_IPV6 : LB_FAMILY_IPV4;
+		UINT8 protocol = n % 3 ? LB_IPPROTO_TCP : LB_IPPROTO_UDP;
+		std::string payload(rng() % 20, '.');
+		for (UINT32 k = n % 4 == 0 ? 4 : 1; k > 0; k--)
+			payload += "Alice" + std::string(rng() % 20, '.');
+
+		packets.push_back(LbReplayMakePacket(family, protocol, family == LB_FAMILY_IPV4 ? LbTestClient : LbTestClientV6,
+			family == LB_FAMILY_IPV4 ? LbTestServer : LbTestServerV6, (UINT16)(50000 + n), 80, (UINT32)rng(), payload));
+	}
+
+	LB_REPLAY_LAYOUT layout;
+	layout.splitPercent = 100;
+	layout.seed = LbTestSeed();
+	LB_REPLAY_CORPUS corpus;
+	LbReplayBuild(packets, layout, &corpus);
+
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Alice", (char*)"Trudy" } };
+	LB_PORT_RULE portRules[] = { { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_USERDATA ud;
+	ud.count = 1;
+	ud.strArray = pairs;
+	LB_RULESET* rules = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetCompile(NULL, 0, portRules, 1, &ud, 0, &rules)) || !LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	LB_REPLAY_OUTPUT output;
+	UINT32 wrong = 0;
+	for (const LB_REPLAY_CALL& call : corpus.calls)
+		wrong += LbReplayClassify(rules, &call, &output) != LB_VERDICT_INSPECT;
+
+	// Every match rewritten wherever the cuts fell, and every checksum still valid
+	UINT32 split = 0;
+	size_t next = 0;
+	for (const LB_REPLAY_CALL& call : corpus.calls)
+	{
+		for (LB_REPLAY_NET_BUFFER* netBuffer = call.netBufferList->FirstNetBuffer; netBuffer != NULL; netBuffer = netBuffer->Next)
+		{
+			const LB_REPLAY_PACKET& packet = packets[next++];
+			std::vector<UINT8> segment = LbTestGather(netBuffer);
+			SIZE_T field = packet.protocol == LB_IPPROTO_TCP ? 16 : 6;
+
+			wrong += LbTestContains(segment, "Alice") || !LbTestContains(segment, "Trudy");
+			wrong += LbReadBe16(&segment[field]) != LbReplayTransportChecksum(packet, segment.data(), segment.size());
+			split += netBuffer->CurrentMdl->Next != NULL;
+		}
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK_EQUAL(packets.size() + 300, output.replacements);
+	LB_CHECK_EQUAL(0, output.injected);
+	LB_CHECK(output.checksumsRecomputed > 0);
+	LB_CHECK(split > packets.size() / 2);
+
+	LbVerdictCacheCleanup();
+	LbRuleSetFree(rules);
+}
+
+LB_TEST(BlockedFlowsAreLeftAlone)
+{
+	std::vector<LB_REPLAY_PACKET> packets = { LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1, "Alice") };
+	LB_REPLAY_CORPUS corpus;
+	LbReplayBuild(packets, LB_REPLAY_LAYOUT(), &corpus);
+
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Alice", (char*)"Trudy" } };
+	LB_ADDRESS_RULE addressRules[] = { { 0xC0A80000, 16, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_PORT_RULE portRules[] = { { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_USERDATA ud;
+	ud.count = 1;
+	ud.strArray = pairs;
+	LB_RULESET* rules = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetCompile(addressRules, 1, portRules, 1, &ud, 0, &rules)) || !LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	LB_REPLAY_OUTPUT output;
+	LB_CHECK_EQUAL(LB_VERDICT_BLOCK, LbReplayClassify(rules, &corpus.calls[0], &output));
+	LB_CHECK_EQUAL(0, output.bytesScanned);
+	LB_CHECK(corpus.arena == corpus.pristine);
+
+	LbVerdictCacheCleanup();
+	LbRuleSetFree(rules);
+}
+
+LB_TEST(SizeChangesAreSentAsCopies)
+{
+	// One flow, the second segment has nothing to replace but follows a resized one
+	std::vector<LB_REPLAY_PACKET> packets = {
+		LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1000, "to Alice and Alice"),
+		LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1018, "nobody"),
+		LbReplayMakePacket(LB_FAMILY_IPV6, LB_IPPROTO_TCP, LbTestClientV6, LbTestServerV6, 50000, 80, 1000, "to Alice"),
+	};
+	LB_REPLAY_LAYOUT layout;
+	layout.maxNetBuffers = 1;
+	layout.splitPercent = 100;
+	LB_REPLAY_CORPUS corpus;
+	LbReplayBuild(packets, layout, &corpus);
+
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Alice", (char*)"Eve" } };
+	LB_PORT_RULE portRules[] = { { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_USERDATA ud;
+	ud.count = 1;
+	ud.strArray = pairs;
+	LB_RULESET* rules = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetCompile(NULL, 0, portRules, 1, &ud, 0, &rules)) || !LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	// The IPv4 segments go out as copies, the IPv6 layer cannot resize and keeps its segment as it was
+	LB_REPLAY_OUTPUT output;
+	for (const LB_REPLAY_CALL& call : corpus.calls)
+		LbReplayClassify(rules, &call, &output);
+
+	LB_CHECK_EQUAL(3, corpus.calls.size());
+	LB_CHECK_EQUAL(2, output.injected);
+	LB_CHECK_EQUAL(2, output.replacements);
+	LB_CHECK_EQUAL(20 + 14 + 20 + 6, output.injectedBytes);
+	LB_CHECK(corpus.arena == corpus.pristine);
+	LB_CHECK(LbSeqTrackerIsActive(&corpus.calls[0].flow->seq));
+
+	LbVerdictCacheCleanup();
+	LbRuleSetFree(rules);
+}
+
+LB_TEST(StreamWritesRewriteLikeOneBuffer)
+{
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Alice", (char*)"Eve" }, { (char*)"Bob", (char*)"Robert" }, { (char*)"Carol", (char*)"Trent" } };
+	LB_PORT_RULE portRules[] = { { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_USERDATA ud;
+	ud.count = 3;
+	ud.strArray = pairs;
+	LB_RULESET* rules = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetCompile(NULL, 0, portRules, 1, &ud, 0, &rules)) || !LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	// Names planted in letters that never start one, at any place a write may cut them
+	std::mt19937 rng(LbTestSeed());
+	std::string data;
+	while (data.size() < 64 * 1024)
+	{
+		data += std::string(rng() % 40, 'x');
+		data += pairs[rng() % 3].match;
+	}
+
+	std::vector<UINT8> expected(LbMatcherRewriteBound(rules->matcher, data.size()));
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	SIZE_T written = 0;
+	UINT32 replaced = LbMatcherRewrite(rules->matcher, &state, (const UINT8*)data.data(), data.size(), expected.data(), &written);
+	expected.resize(written);
+
+	// Tiny writes up to full segments, scanned as they come or collected into chunks first
+	for (UINT32 maxWrite : { 1u, 7u, 200u, 1400u })
+	{
+		for (UINT32 chunk : { 0u, 64u, 1460u })
+		{
+			std::vector<LB_REPLAY_PACKET> packets;
+			for (size_t offset = 0; offset < data.size(); )
+			{
+				size_t length = std::min<size_t>(1 + rng() % maxWrite, data.size() - offset);
+				packets.push_back(LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1000 + (UINT32)offset, data.substr(offset, length)));
+				offset += length;
+			}
+
+			rules->stream = TRUE;
+			rules->streamChunk = chunk;
+			rules->streamLookahead = 4;
+
+			std::map<LB_FLOW_KEY, LB_REPLAY_STREAM> streams;
+			LB_REPLAY_OUTPUT output;
+			for (const LB_REPLAY_PACKET& packet : packets)
+				LbReplayStreamPacket(rules, &streams, packet, &output);
+			LbReplayStreamClose(rules, &streams, &output);
+
+			if (!LB_CHECK_EQUAL(1, streams.size()))
+				continue;
+
+			const LB_REPLAY_STREAM& stream = streams.begin()->second;
+			LB_CHECK(stream.sent == expected);
+			LB_CHECK_EQUAL(replaced, output.replacements);
+			LB_CHECK(stream.pending.empty());
+			LB_CHECK(stream.writes == packets.size() || stream.writes == packets.size() + 1);
+
+			// Collecting writes into chunks calls the engine far less often than there are writes
+			if (chunk >= 64 && maxWrite <= 7)
+				LB_CHECK(output.calls - output.streamWaits < packets.size() / 8);
+		}
+	}
+
+	LbVerdictCacheCleanup();
+	LbRuleSetFree(rules);
+}
+
+LB_TEST(StreamSkipsRepeatsAndEndsAtFin)
+{
+	LB_MATCH_AND_REPLACE pairs[] = { { (char*)"Alice", (char*)"Trudy" } };
+	LB_PORT_RULE portRules[] = { { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 } };
+	LB_USERDATA ud;
+	ud.count = 1;
+	ud.strArray = pairs;
+	LB_RULESET* rules = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetCompile(NULL, 0, portRules, 1, &ud, 0, &rules)) || !LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	rules->stream = TRUE;
+	rules->streamChunk = 1460;
+	rules->streamLookahead = 4;
+
+	// A retransmission and a segment past a gap are left out, the FIN sends what is held back at once
+	std::vector<LB_REPLAY_PACKET> packets = {
+		LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1000, "to Al"),
+		LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1000, "to Al"),
+		LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1009, "lost"),
+		LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestClient, LbTestServer, 50000, 80, 1005, "ice, Ali"),
+		LbReplayMakePacket(LB_FAMILY_IPV4, LB_IPPROTO_TCP, LbTestServer, LbTestClient, 80, 50000, 1, "Alice"),
+	};
+	packets[3].segment[13] |= 0x01;
+
+	std::map<LB_FLOW_KEY, LB_REPLAY_STREAM> streams;
+	LB_REPLAY_OUTPUT output;
+	for (const LB_REPLAY_PACKET& packet : packets)
+		LbReplayStreamPacket(rules, &streams, packet, &output);
+
+	if (LB_CHECK_EQUAL(1, streams.size()))
+	{
+		const LB_REPLAY_STREAM& stream = streams.begin()->second;
+		const char* sent = "to Trudy, Ali";
+		LB_CHECK_EQUAL(2, stream.writes);
+		LB_CHECK(stream.sent == std::vector<UINT8>(sent, sent + strlen(sent)));
+		LB_CHECK(stream.pending.empty());
+		LB_CHECK_EQUAL(1, output.replacements);
+		LB_CHECK_EQUAL(1, output.streamWaits);
+	}
+
+	LbVerdictCacheCleanup();
+	LbRuleSetFree(rules);
+}
@@ -0,0 +1,423 @@
+/*/
+/*  ** RuleImageTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of rule files and rule images: a rule file read into the same IOCTL_LB_SET_RULES
+/*	buffer as one built by hand, lines that are not rules refused with their number, and images built from
+/*	compiled rule sets loaded back into sets that decide every flow and rewrite every payload the same way,
+/*	up to 100k rules. A damaged image, however it was damaged, is refused.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbRuleText.h"
+#include "RuleImage.h"
+#include <random>
+
+/////////////
+// HELPERS //
+/////////////
+
+static const char* LbTestActions[] = { "permit", "block", "inspect" };
+static const char* LbTestDirections[] = { "", " outbound", " inbound", " both" };
+
+// A rule file of random address and port rules and literal pairs, with whatever is in options first.
+// Networks are /16 to /24, each one past /16 may take a 1 KB subtable of the rule set budget.
+static std::string LbTestRuleFile(std::mt19937& rng, UINT32 addressCount, UINT32 portCount, UINT32 pairCount, const std::string& options)
+{
+	std::string text = options;
+
+	for (UINT32 i = 0; i < addressCount; i++)
+	{
+		UINT32 address = rng();
+		text += "address " + std::to_string(address >> 24) + "." + std::to_string(address >> 16 & 0xFF) + "." +
+			std::to_string(address >> 8 & 0xFF) + "." + std::to_string(address & 0xFF) + "/" + std::to_string(16 + rng() % 9) +
+			" " + LbTestActions[rng() % 3] + LbTestDirections[rng() % 4] + "\n";
+	}
+
+	for (UINT32 i = 0; i < portCount; i++)
+	{
+		UINT32 first = rng() % 65536;
+		UINT32 last = std::min<UINT32>(65535, first + rng() % 64);
+		text += "port " + std::to_string(first) + (last != first ? "-" + std::to_string(last) : "") + " " +
+			LbTestActions[rng() % 3] + LbTestDirections[rng() % 4] + "\n";
+	}
+
+	// Distinct words replaced by themselves in capitals, so reversed pairs are distinct as well
+	for (UINT32 i = 0; i < pairCount; i++)
+	{
+		std::string word = "w" + std::to_string(i);
+		while (word.size() < 6)
+			word += (char)('a' + rng() % 26);
+
+		std::string capitals = word;
+		for (char& c : capitals)
+			c = (char)toupper(c);
+		text += "pair \"" + word + "\" \"" + capitals + "\"\n";
+	}
+
+	return text;
+}
+
+// Compile a rule file as the driver would compile its buffer
+static LB_RULESET* LbTestCompile(const std::string& text)
+{
+	LB_RULE_TEXT rules;
+	UINT32 line;
+	LB_RULESET* ruleSet = NULL;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleTextParse(text.data(), text.size(), &rules, &line)))
+		return NULL;
+
+	std::vector<UINT8> buffer = LbRuleTextBuffer(rules);
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetParse(buffer.data(), buffer.size(), &ruleSet)))
+		return NULL;
+
+	return ruleSet;
+}
+
+// The image of a rule set, loaded from a copy that starts at an odd address and is gone once it is loaded
+static LB_RULESET* LbTestReload(const LB_RULESET* ruleSet, std::vector<UINT8>* kept)
+{
+	void* image = NULL;
+	UINT32 size = 0;
+	LB_RULESET* loaded = NULL;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleImageBuild(ruleSet, &image, &size)))
+		return NULL;
+
+	std::vector<UINT8> copy(size + 1);
+	memcpy(&copy[1], image, size);
+	if (kept)
+		kept->assign((UINT8*)image, (UINT8*)image + size);
+	LbRuleImageFree(image);
+
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetLoadImage(&copy[1], size, &loaded));
+	memset(copy.data(), 0xCC, copy.size());
+	return loaded;
+}
+
+// Flows the two sets decide differently, over random flows and flows into every address rule's network
+static UINT32 LbTestVerdictsDiffer(std::mt19937& rng, const LB_RULESET* a, const LB_RULESET* b, const LB_RULE_TEXT* rules, UINT32 probes)
+{
+	std::vector<UINT32> addresses;
+	UINT32 wrong = 0;
+
+	for (UINT32 i = 0; i < probes; i++)
+		addresses.push_back(rng());
+	for (const LB_ADDRESS_RULE& rule : rules->addressRules)
+		addresses.push_back(rule.address | (rng() & (rule.prefixLength ? 0xFFFFFFFF >> rule.prefixLength : 0xFFFFFFFF)));
+
+	for (UINT32 address : addresses)
+	{
+		LB_FLOW_KEY key = {};
+		key.localAddress = 0x0A000001;
+		key.remoteAddress = address;
+		key.localPort = 50000;
+		key.remotePort = (UINT16)rng();
+		key.protocol = LB_IPPROTO_TCP;
+		key.family = LB_FAMILY_IPV4;
+
+		for (LB_DIRECTION direction : { LB_DIRECTION_OUTBOUND, LB_DIRECTION_INBOUND })
+		{
+			key.direction = (UINT8)direction;
+			wrong += LbRuleSetEvaluate(a, &key, direction) != LbRuleSetEvaluate(b, &key, direction);
+			wrong += LbRuleSetEvaluatePorts(a, &key, direction) != LbRuleSetEvaluatePorts(b, &key, direction);
+		}
+	}
+
+	return wrong;
+}
+
+// Payloads the two sets rewrite differently, each one with some of the patterns planted in it
+static UINT32 LbTestRewritesDiffer(std::mt19937& rng, const LB_RULESET* a, const LB_RULESET* b, const std::vector<std::string>& strings, UINT32 payloads)
+{
+	UINT32 wrong = 0;
+
+	for (UINT32 n = 0; n < payloads; n++)
+	{
+		std::string payload;
+		while (payload.size() < 1460)
+		{
+			payload += std::string(rng() % 16, (char)('a' + rng() % 26));
+			if (!strings.empty())
+				payload += strings[rng() % (strings.size() / 2) * 2];
+		}
+
+		std::vector<UINT8> outA(LbMatcherRewriteBound(a->matcher, payload.size()));
+		std::vector<UINT8> outB(LbMatcherRewriteBound(b->matcher, payload.size()));
+		UINT32 stateA = LB_MATCHER_ROOT_STATE;
+		UINT32 stateB = LB_MATCHER_ROOT_STATE;
+		SIZE_T writtenA = 0;
+		SIZE_T writtenB = 0;
+
+		UINT32 countA = LbMatcherRewrite(a->matcher, &stateA, (const UINT8*)payload.data(), payload.size(), outA.data(), &writtenA);
+		UINT32 countB = LbMatcherRewrite(b->matcher, &stateB, (const UINT8*)payload.data(), payload.size(), outB.data(), &writtenB);
+		outA.resize(writtenA);
+		outB.resize(writtenB);
+		wrong += countA != countB || outA != outB || stateA != stateB;
+	}
+
+	return wrong;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(TextReadsIntoTheSameBuffer)
+{
+	const char* text =
+		"# Everything the format has\n"
+		"flags reversal stream\n"
+		"fields http-headers dns-names\n"
+		"stream-chunk 512   # a comment after a directive\n"
+		"stream-lookahead\t7\n"
+		"budget 16777216\n"
+		"\n"
+		"address 192.168.0.0/16 block\n"
+		"address 192.168.1.0/24 inspect outbound\n"
+		"address 10.1.2.3 permit inbound\n"
+		"port 80 inspect both\n"
+		"port 1-1023 block inbound\r\n"
+		"pair \"Love\" \"Hate\"\n"
+		"pair \"a \\\"quote\\\" # not a comment\" \"\\x41\\r\\n\\t\\\\\\d\"\n";
+
+	LB_RULE_TEXT rules;
+	UINT32 line = 99;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleTextParse(text, strlen(text), &rules, &line)))
+		return;
+	LB_CHECK_EQUAL(0, line);
+
+	LB_RULES_HEADER header = {};
+	header.version = LB_RULES_VERSION;
+	header.flags = LB_RULES_FLAG_REVERSAL | LB_RULES_FLAG_STREAM;
+	header.fields = LB_FIELD_HTTP_HEADERS | LB_FIELD_DNS_NAMES;
+	header.streamChunk = 512;
+	header.streamLookahead = 7;
+	header.memoryBudget = 16777216;
+	header.addressRuleCount = 3;
+	header.portRuleCount = 2;
+	header.pairCount = 2;
+
+	LB_ADDRESS_RULE addressRules[] = {
+		{ 0xC0A80000, 16, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 },
+		{ 0xC0A80100, 24, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_OUTBOUND, 0 },
+		{ 0x0A010203, 32, LB_RULE_ACTION_PERMIT, LB_RULE_DIRECTION_INBOUND, 0 },
+	};
+	LB_PORT_RULE portRules[] = {
+		{ 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 },
+		{ 1, 1023, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_INBOUND, 0 },
+	};
+	const char strings[] = "Love\0Hate\0a \"quote\" # not a comment\0A\r\n\t\\\\d";
+
+	std::vector<UINT8> expected((const UINT8*)&header, (const UINT8*)(&header + 1));
+	expected.insert(expected.end(), (const UINT8*)addressRules, (const UINT8*)(addressRules + 3));
+	expected.insert(expected.end(), (const UINT8*)portRules, (const UINT8*)(portRules + 2));
+	expected.insert(expected.end(), strings, strings + sizeof(strings));
+
+	LB_CHECK(LbRuleTextBuffer(rules) == expected);
+}
+
+LB_TEST(TextRefusesWhatIsNotARule)
+{
+	struct
+	{
+		const char* text;
+		UINT32 line;
+	} broken[] = {
+		{ "frobnicate\n", 1 },
+		{ "# fine\nport 80\n", 2 },
+		{ "port 80 inspect sideways\n", 1 },
+		{ "port 80 inspect outbound extra\n", 1 },
+		{ "port 65536 block\n", 1 },
+		{ "port 90-80 block\n", 1 },
+		{ "port -80 block\n", 1 },
+		{ "address 10.0.0/8 block\n", 1 },
+		{ "address 10.0.0.256 block\n", 1 },
+		{ "address 10.0.0.0/33 block\n", 1 },
+		{ "address 10.0.0.0.1 block\n", 1 },
+		{ "\n\npair \"open\n", 3 },
+		{ "pair \"a\" \"b\" \"c\"\n", 1 },
+		{ "pair \"\" \"b\"\n", 1 },
+		{ "pair a b\n", 1 },
+		{ "pair \"a\\x00\" \"b\"\n", 1 },
+		{ "pair \"a\\xG0\" \"b\"\n", 1 },
+		{ "flags reversal sideways\n", 1 },
+		{ "flags\n", 1 },
+		{ "fields body\n", 1 },
+		{ "stream-chunk 40000\n", 1 },
+		{ "stream-lookahead -1\n", 1 },
+		{ "budget 4294967296\n", 1 },
+		{ "\"port\" 80 block\n", 1 },
+		{ "port \"80\" block\n", 1 },
+	};
+
+	for (const auto& file : broken)
+	{
+		LB_RULE_TEXT rules;
+		UINT32 line = 0;
+		if (!LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleTextParse(file.text, strlen(file.text), &rules, &line)))
+			printf("  accepted: %s", file.text);
+		LB_CHECK_EQUAL(file.line, line);
+	}
+}
+
+LB_TEST(ImagesLoadAsTheSetTheyWereBuiltFrom)
+{
+	std::mt19937 rng(LbTestSeed());
+
+	// The automaton with and without reversal, the regex engine, and the options a set carries
+	std::vector<std::string> files = {
+		LbTestRuleFile(rng, 300, 100, 40, ""),
+		LbTestRuleFile(rng, 50, 20, 40, "flags reversal\nfields http-body other\n"),
+		LbTestRuleFile(rng, 50, 20, 0, "flags regex stream async\nstream-chunk 1460\nstream-lookahead 16\n"
+			"pair \"Host: [a-z]+\\.example\\.(com|org)\" \"Host: x\"\npair \"[?&]cmd=\\w{3,8}\" \"?cmd=x\"\n"),
+		LbTestRuleFile(rng, 0, 0, 0, ""),
+	};
+
+	for (const std::string& text : files)
+	{
+		LB_RULE_TEXT rules;
+		UINT32 line;
+		LbRuleTextParse(text.data(), text.size(), &rules, &line);
+
+		LB_RULESET* compiled = LbTestCompile(text);
+		if (!compiled)
+			continue;
+
+		LB_RULESET* loaded = LbTestReload(compiled, NULL);
+		if (loaded)
+		{
+			std::vector<std::string> planted = rules.strings;
+			if (rules.header.flags & LB_RULES_FLAG_REGEX)
+				planted = { "Host: www.example.com", "", "&cmd=reboot", "" };
+
+			LB_CHECK_EQUAL(0, LbTestVerdictsDiffer(rng, compiled, loaded, &rules, 2000));
+			LB_CHECK_EQUAL(0, LbTestRewritesDiffer(rng, compiled, loaded, planted, 200));
+			LB_CHECK_EQUAL(compiled->matcher->engine, loaded->matcher->engine);
+			LB_CHECK_EQUAL(compiled->fields, loaded->fields);
+			LB_CHECK_EQUAL(compiled->stream, loaded->stream);
+			LB_CHECK_EQUAL(compiled->async, loaded->async);
+			LB_CHECK_EQUAL(compiled->streamChunk, loaded->streamChunk);
+			LB_CHECK_EQUAL(compiled->streamLookahead, loaded->streamLookahead);
+			LB_CHECK(loaded->generation != compiled->generation);
+			LB_CHECK(loaded->bytes <= loaded->memoryBudget);
+			LbRuleSetFree(loaded);
+		}
+
+		LbRuleSetFree(compiled);
+	}
+}
+
+LB_TEST(DamagedImagesAreRefused)
+{
+	std::mt19937 rng(LbTestSeed());
+	std::vector<UINT8> image;
+
+	// The CRC-32C check value
+	LB_CHECK_EQUAL(0xE3069283, LbRuleImageChecksum("123456789", 9));
+
+	LB_RULESET* compiled = LbTestCompile(LbTestRuleFile(rng, 100, 50, 20, ""));
+	if (!compiled)
+		return;
+
+	LB_RULESET* loaded = LbTestReload(compiled, &image);
+	LbRuleSetFree(loaded);
+	LbRuleSetFree(compiled);
+	if (!loaded)
+		return;
+
+	LB_RULESET* ruleSet = NULL;
+	UINT32 accepted = 0;
+
+	// Any one byte changed anywhere is caught by the checksum
+	for (int n = 0; n < 500; n++)
+	{
+		std::vector<UINT8> damaged = image;
+		damaged[rng() % damaged.size()] ^= (UINT8)(1 + rng() % 255);
+		accepted += NT_SUCCESS(LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet));
+	}
+	LB_CHECK_EQUAL(0, accepted);
+	LB_CHECK(ruleSet == NULL);
+
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetLoadImage(image.data(), image.size() - 1, &ruleSet));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetLoadImage(image.data(), sizeof(LB_RULE_IMAGE_HEADER) - 1, &ruleSet));
+	image.push_back(0);
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetLoadImage(image.data(), image.size(), &ruleSet));
+	image.pop_back();
+
+	// Headers that pass the checksum because it was taken again after the damage
+	auto resum = [](std::vector<UINT8> damaged) {
+		SIZE_T start = FIELD_OFFSET(LB_RULE_IMAGE_HEADER, checksum) + sizeof(UINT32);
+		((LB_RULE_IMAGE_HEADER*)damaged.data())->checksum = LbRuleImageChecksum(damaged.data() + start, damaged.size() - start);
+		return damaged;
+	};
+
+	std::vector<UINT8> damaged = resum(image);
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet));
+	LbRuleSetFree(ruleSet);
+
+	LB_RULE_IMAGE_HEADER* header = (LB_RULE_IMAGE_HEADER*)image.data();
+	LB_RULE_IMAGE_HEADER saved = *header;
+
+	header->version++;
+	damaged = resum(image);
+	LB_CHECK(!NT_SUCCESS(LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet)));
+	*header = saved;
+
+	header->matcherOffset = (UINT32)image.size() - 8;
+	damaged = resum(image);
+	LB_CHECK(!NT_SUCCESS(LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet)));
+	*header = saved;
+
+	header->matcherSize += 64;
+	damaged = resum(image);
+	LB_CHECK(!NT_SUCCESS(LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet)));
+	*header = saved;
+
+	header->tables[0].addressOffset += 4;
+	damaged = resum(image);
+	LB_CHECK(!NT_SUCCESS(LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet)));
+	*header = saved;
+
+	header->streamChunk = LB_STREAM_MAX_CHUNK + 1;
+	damaged = resum(image);
+	LB_CHECK(!NT_SUCCESS(LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet)));
+	*header = saved;
+
+	// A budget smaller than the set takes
+	header->memoryBudget = 4096;
+	damaged = resum(image);
+	LB_CHECK_EQUAL(STATUS_QUOTA_EXCEEDED, LbRuleSetLoadImage(damaged.data(), damaged.size(), &ruleSet));
+	*header = saved;
+}
+
+LB_TEST(HundredThousandRulesLoad)
+{
+	std::mt19937 rng(LbTestSeed());
+	std::string text = LbTestRuleFile(rng, 20000, 70000, 10000, "");
+	LB_RULE_TEXT rules;
+	UINT32 line;
+
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleTextParse(text.data(), text.size(), &rules, &line));
+	LB_CHECK_EQUAL(100000, rules.addressRules.size() + rules.portRules.size() + rules.strings.size() / 2);
+
+	LB_RULESET* compiled = LbTestCompile(text);
+	if (!compiled)
+		return;
+
+	LB_RULESET* loaded = LbTestReload(compiled, NULL);
+	if (loaded)
+	{
+		LB_CHECK_EQUAL(0, LbTestVerdictsDiffer(rng, compiled, loaded, &rules, 10000));
+		LB_CHECK_EQUAL(0, LbTestRewritesDiffer(rng, compiled, loaded, rules.strings, 200));
+		LbRuleSetFree(loaded);
+	}
+
+	LbRuleSetFree(compiled);
+}
@@ -0,0 +1,283 @@
+/*/
+/*  ** RuleSetTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of compiled rule sets: parsing IOCTL_LB_SET_RULES buffers, rejecting broken ones and
+/*	ones over their memory budget, and replacing the published set while other threads classify with it. The
+/*	swap test publishes through the same LB_RCU as the driver with threads in place of processors: a reader
+/*	holds the set only inside a read section, as a classify holds it at DISPATCH_LEVEL, and LbRcuWaitReaders
+/*	stands in for the DPC LbRulesPublish runs everywhere before the old set is freed.
+/*	Configure with -DLB_SANITIZE=ON to have a reader that touches a freed set reported.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "RuleSet.h"
+#include "Rcu.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+// An IOCTL_LB_SET_RULES input buffer
+static std::string LbTestRulesBuffer(LB_RULES_HEADER header, const std::vector<LB_ADDRESS_RULE>& addressRules, const std::vector<LB_PORT_RULE>& portRules, const std::vector<std::string>& strings)
+{
+	std::string buffer;
+
+	header.version = LB_RULES_VERSION;
+	header.addressRuleCount = (UINT32)addressRules.size();
+	header.portRuleCount = (UINT32)portRules.size();
+	header.pairCount = (UINT32)strings.size() / 2;
+
+	buffer.append((const char*)&header, sizeof(header));
+	buffer.append((const char*)addressRules.data(), addressRules.size() * sizeof(LB_ADDRESS_RULE));
+	buffer.append((const char*)portRules.data(), portRules.size() * sizeof(LB_PORT_RULE));
+	for (const std::string& str : strings)
+		buffer.append(str.c_str(), str.size() + 1);
+
+	return buffer;
+}
+
+static LB_FLOW_KEY LbTestFlow(UINT32 remoteAddress, UINT16 remotePort)
+{
+	LB_FLOW_KEY key = {};
+	key.localAddress = 0x0A000001;
+	key.remoteAddress = remoteAddress;
+	key.localPort = 50000;
+	key.remotePort = remotePort;
+	key.protocol = LB_IPPROTO_TCP;
+	key.direction = LB_DIRECTION_OUTBOUND;
+	key.family = LB_FAMILY_IPV4;
+	return key;
+}
+
+static std::string LbTestRewrite(const LB_RULESET* ruleSet, std::string data)
+{
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	LbMatcherReplace(ruleSet->matcher, &state, (UINT8*)&data[0], data.size(), NULL, NULL);
+	return data;
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(ParseBuildsWhatTheBufferSays)
+{
+	LB_RULES_HEADER header = {};
+	header.flags = LB_RULES_FLAG_REVERSAL;
+	header.streamChunk = 512;
+
+	std::string buffer = LbTestRulesBuffer(header,
+		{ { 0xC0A80000, 16, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 }, { 0xC0A80100, 24, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_OUTBOUND, 0 } },
+		{ { 80, 80, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_BOTH, 0 }, { 1, 1023, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_INBOUND, 0 } },
+		{ "Love", "Hate", "Alice", "Trudy" });
+
+	LB_RULESET* ruleSet = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetParse(buffer.data(), buffer.size(), &ruleSet)))
+		return;
+
+	LB_FLOW_KEY blocked = LbTestFlow(0xC0A8FF01, 443);
+	LB_FLOW_KEY longer = LbTestFlow(0xC0A80107, 443);
+	LB_FLOW_KEY web = LbTestFlow(0x08080808, 80);
+	LB_FLOW_KEY other = LbTestFlow(0x08080808, 443);
+	LB_FLOW_KEY low = LbTestFlow(0x08080808, 22);
+
+	LB_CHECK_EQUAL(LB_VERDICT_BLOCK, LbRuleSetEvaluate(ruleSet, &blocked, LB_DIRECTION_OUTBOUND));
+	LB_CHECK_EQUAL(LB_VERDICT_INSPECT, LbRuleSetEvaluate(ruleSet, &longer, LB_DIRECTION_OUTBOUND));
+	LB_CHECK_EQUAL(LB_VERDICT_BLOCK, LbRuleSetEvaluate(ruleSet, &longer, LB_DIRECTION_INBOUND));
+	LB_CHECK_EQUAL(LB_VERDICT_INSPECT, LbRuleSetEvaluate(ruleSet, &web, LB_DIRECTION_OUTBOUND));
+	LB_CHECK_EQUAL(LB_VERDICT_PERMIT, LbRuleSetEvaluate(ruleSet, &other, LB_DIRECTION_OUTBOUND));
+	LB_CHECK_EQUAL(LB_VERDICT_PERMIT, LbRuleSetEvaluate(ruleSet, &low, LB_DIRECTION_OUTBOUND));
+	LB_CHECK_EQUAL(LB_VERDICT_BLOCK, LbRuleSetEvaluate(ruleSet, &low, LB_DIRECTION_INBOUND));
+
+	LB_CHECK(LbTestRewrite(ruleSet, "Love Alice, Hate Trudy") == "Hate Trudy, Love Alice");
+	LB_CHECK_EQUAL(512, ruleSet->streamChunk);
+	LB_CHECK(ruleSet->bytes > 0 && ruleSet->bytes <= ruleSet->memoryBudget);
+
+	LbRuleSetFree(ruleSet);
+}
+
+LB_TEST(ParseRejectsBrokenBuffers)
+{
+	LB_RULES_HEADER header = {};
+	std::string good = LbTestRulesBuffer(header, { { 0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 } }, {}, { "Love", "Hate" });
+	LB_RULESET* ruleSet = NULL;
+
+	// Cut anywhere, the buffer is refused rather than read past
+	for (size_t size = 0; size < good.size(); size++)
+	{
+		std::string cut = good.substr(0, size);
+		if (!LB_CHECK(!NT_SUCCESS(LbRuleSetParse(cut.data(), cut.size(), &ruleSet))))
+			LbRuleSetFree(ruleSet);
+	}
+
+	std::string bad = good;
+	((LB_RULES_HEADER*)&bad[0])->version = LB_RULES_VERSION + 1;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetParse(bad.data(), bad.size(), &ruleSet));
+
+	bad = good;
+	((LB_RULES_HEADER*)&bad[0])->addressRuleCount = 0xFFFFFFFF;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetParse(bad.data(), bad.size(), &ruleSet));
+
+	bad = good;
+	((LB_RULES_HEADER*)&bad[0])->pairCount = 2;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetParse(bad.data(), bad.size(), &ruleSet));
+
+	bad = good;
+	((LB_RULES_HEADER*)&bad[0])->streamChunk = LB_STREAM_MAX_CHUNK + 1;
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetParse(bad.data(), bad.size(), &ruleSet));
+
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetParse(good.data(), good.size(), &ruleSet));
+	LbRuleSetFree(ruleSet);
+}
+
+LB_TEST(ParseKeepsRulesWithinTheirBudget)
+{
+	LB_RULES_HEADER header = {};
+	std::vector<std::string> strings;
+
+	// 2000 distinct 8 byte words need an automaton of well over 64 KB, though the buffer is only 36 KB
+	for (int n = 0; n < 2000; n++)
+	{
+		char word[9];
+		snprintf(word, sizeof(word), "w%07d", n * 7919 % 10000000);
+		strings.push_back(word);
+		strings.push_back(std::string(8, 'X'));
+	}
+	strings.push_back("a");
+	strings.push_back("b");
+
+	LB_RULESET* ruleSet = NULL;
+	header.memoryBudget = 64 * 1024;
+	std::string buffer = LbTestRulesBuffer(header, { { 0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 } }, {}, strings);
+	LB_CHECK_EQUAL(STATUS_QUOTA_EXCEEDED, LbRuleSetParse(buffer.data(), buffer.size(), &ruleSet));
+	LB_CHECK(ruleSet == NULL);
+
+	// Rules whose classifier alone goes over it never reach the match engine
+	header.memoryBudget = 1024;
+	buffer = LbTestRulesBuffer(header, { { 0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 } }, {}, { "Love", "Hate" });
+	LB_CHECK_EQUAL(STATUS_QUOTA_EXCEEDED, LbRuleSetParse(buffer.data(), buffer.size(), &ruleSet));
+
+	header.memoryBudget = 4 * 1024 * 1024;
+	buffer = LbTestRulesBuffer(header, { { 0x0A000000, 8, LB_RULE_ACTION_BLOCK, LB_RULE_DIRECTION_BOTH, 0 } }, {}, strings);
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetParse(buffer.data(), buffer.size(), &ruleSet)))
+	{
+		LB_CHECK_EQUAL(header.memoryBudget, ruleSet->memoryBudget);
+		LB_CHECK(ruleSet->bytes > 64 * 1024 && ruleSet->bytes <= ruleSet->memoryBudget);
+		LB_CHECK(ruleSet->bytes >= sizeof(LB_RULESET) + ruleSet->matcher->size);
+		LbRuleSetFree(ruleSet);
+	}
+
+	// 0 keeps the driver's limit, and no buffer can ask for more than it
+	for (UINT32 budget : { 0u, 0xFFFFFFFFu })
+	{
+		header.memoryBudget = budget;
+		buffer = LbTestRulesBuffer(header, {}, {}, { "Love", "Hate" });
+		if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetParse(buffer.data(), buffer.size(), &ruleSet)))
+		{
+			LB_CHECK_EQUAL(LB_RULES_MAX_BYTES, ruleSet->memoryBudget);
+			LbRuleSetFree(ruleSet);
+		}
+	}
+}
+
+LB_TEST(SwapWhileReadersClassify)
+{
+	const UINT32 readerCount = 4;
+	const UINT32 swaps = 300;
+	const UINT64 seconds = 120;		// Only there so a reader that never leaves its section cannot hang the test
+	std::vector<LB_RCU_READER> readers(readerCount);
+	LB_RCU_READERS waited = { readers.data(), readerCount };
+	LB_RCU rules;
+	std::atomic<bool> stop(false);
+	std::atomic<UINT64> wrong(0);
+	std::atomic<UINT64> sections(0);
+	std::vector<std::thread> threads;
+
+	// Rule set k blocks the probe address when k is odd and inspects it otherwise, and rewrites "Love" to
+	// the k-th letter four times. streamChunk carries k so a reader can tell what it should see.
+	auto build = [](UINT32 k) {
+		LB_RULES_HEADER header = {};
+		header.streamChunk = k;
+		std::string replace(4, (char)('a' + k % 26));
+		std::string buffer = LbTestRulesBuffer(header,
+			{ { 0xC0A80001, 32, (UINT8)(k % 2 ? LB_RULE_ACTION_BLOCK : LB_RULE_ACTION_INSPECT), LB_RULE_DIRECTION_BOTH, 0 } },
+			{ { 1, 65535, LB_RULE_ACTION_PERMIT, LB_RULE_DIRECTION_BOTH, 0 } },
+			{ "Love", replace });
+		LB_RULESET* ruleSet = NULL;
+		return NT_SUCCESS(LbRuleSetParse(buffer.data(), buffer.size(), &ruleSet)) ? ruleSet : NULL;
+	};
+
+	// A reader still holding a retired set would see k == 0
+	auto retire = [](void* value, void*) {
+		((LB_RULESET*)value)->streamChunk = 0;
+		LbRuleSetFree((LB_RULESET*)value);
+	};
+
+	LbRcuInitialize(&rules, build(1), LbRcuWaitReaders, &waited);
+	if (!LB_CHECK(rules.value != NULL))
+		return;
+
+	for (UINT32 r = 0; r < readerCount; r++)
+	{
+		readers[r].section = 0;
+		threads.emplace_back([&, r]() {
+			LB_FLOW_KEY probe = LbTestFlow(0xC0A80001, 80);
+			UINT32 last = 0;
+
+			while (!stop.load())
+			{
+				LbRcuReadBegin(&readers[r]);
+				const LB_RULESET* ruleSet = (const LB_RULESET*)LbRcuRead(&rules);
+				UINT32 k = ruleSet->streamChunk;
+
+				// Sets only ever get newer, and everything in one belongs to the same k
+				if (k == 0 || k < last)
+					wrong++;
+				if (LbRuleSetEvaluate(ruleSet, &probe, LB_DIRECTION_OUTBOUND) != (k % 2 ? LB_VERDICT_BLOCK : LB_VERDICT_INSPECT))
+					wrong++;
+				if (LbTestRewrite(ruleSet, "I Love it") != "I " + std::string(4, (char)('a' + k % 26)) + " it")
+					wrong++;
+				if (ruleSet->streamChunk != k)
+					wrong++;
+
+				last = k;
+				LbRcuReadEnd(&readers[r]);
+				sections++;
+			}
+		});
+	}
+
+	UINT64 deadline = LbTimestamp() + seconds * LbTimestampFrequency();
+	UINT32 swapped = 0;
+
+	for (UINT32 k = 2; k <= swaps + 1 && LbTimestamp() < deadline; k++)
+	{
+		LB_RULESET* next = build(k);
+		if (!LB_CHECK(next != NULL))
+			break;
+
+		LbRcuPublish(&rules, next, retire, NULL);
+		swapped++;
+	}
+
+	stop = true;
+	for (std::thread& thread : threads)
+		thread.join();
+
+	LB_CHECK_EQUAL(0, wrong.load());
+	LB_CHECK(sections.load() > 0);
+	LB_CHECK_EQUAL(swaps, swapped);
+	LB_CHECK_EQUAL(swaps, rules.gracePeriods);
+
+	LbRuleSetFree((LB_RULESET*)rules.value);
+}
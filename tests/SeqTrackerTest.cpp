@@ -0,0 +1,141 @@
+/*/
+/*  ** SeqTrackerTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the sequence tracker: sequence numbers moved by earlier size changes,
+/*	acknowledgements mapped back, retransmissions, wraparound and edits folded into the base.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "SeqTracker.h"
+#include <random>
+#include <vector>
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(UnchangedStreamMapsToItself)
+{
+	LB_SEQ_TRACKER tracker;
+	LbSeqTrackerInitialize(&tracker);
+
+	LbSeqTrackerRecord(&tracker, 1000, 100, 100);
+	LbSeqTrackerRecord(&tracker, 1100, 100, 100);
+
+	LB_CHECK(!LbSeqTrackerIsActive(&tracker));
+	LB_CHECK_EQUAL(1200, LbSeqTrackerMapSeq(&tracker, 1200));
+	LB_CHECK_EQUAL(1150, LbSeqTrackerMapAck(&tracker, 1150));
+}
+
+LB_TEST(GrowthAndShrinkMoveLaterSegments)
+{
+	LB_SEQ_TRACKER tracker;
+	LbSeqTrackerInitialize(&tracker);
+
+	// 1000..1100 went out as 110 bytes, 1100..1200 as 100, 1200..1300 as 95
+	LbSeqTrackerRecord(&tracker, 1000, 100, 110);
+	LB_CHECK(LbSeqTrackerIsActive(&tracker));
+	LB_CHECK_EQUAL(1110, LbSeqTrackerMapSeq(&tracker, 1100));
+	LbSeqTrackerRecord(&tracker, 1100, 100, 100);
+	LB_CHECK_EQUAL(1210, LbSeqTrackerMapSeq(&tracker, 1200));
+	LbSeqTrackerRecord(&tracker, 1200, 100, 95);
+	LB_CHECK_EQUAL(1305, LbSeqTrackerMapSeq(&tracker, 1300));
+
+	// Bytes before the first change never moved
+	LB_CHECK_EQUAL(1000, LbSeqTrackerMapSeq(&tracker, 1000));
+
+	// Acknowledgements of whole segments map back to their original ends
+	LB_CHECK_EQUAL(1100, LbSeqTrackerMapAck(&tracker, 1110));
+	LB_CHECK_EQUAL(1200, LbSeqTrackerMapAck(&tracker, 1210));
+	LB_CHECK_EQUAL(1300, LbSeqTrackerMapAck(&tracker, 1305));
+
+	// Part of a rewritten segment acknowledges none of it
+	LB_CHECK_EQUAL(1000, LbSeqTrackerMapAck(&tracker, 1050));
+	LB_CHECK_EQUAL(1200, LbSeqTrackerMapAck(&tracker, 1250));
+}
+
+LB_TEST(RetransmissionsAreNotRecordedTwice)
+{
+	LB_SEQ_TRACKER tracker;
+	LbSeqTrackerInitialize(&tracker);
+
+	LbSeqTrackerRecord(&tracker, 1000, 100, 120);
+	LbSeqTrackerRecord(&tracker, 1100, 100, 100);
+
+	LB_CHECK(LbSeqTrackerIsRetransmission(&tracker, 1000));
+	LB_CHECK(LbSeqTrackerIsRetransmission(&tracker, 1100));
+	LB_CHECK(!LbSeqTrackerIsRetransmission(&tracker, 1200));
+
+	LbSeqTrackerRecord(&tracker, 1000, 100, 120);
+	LB_CHECK_EQUAL(1, tracker.count);
+	LB_CHECK_EQUAL(1000, LbSeqTrackerMapSeq(&tracker, 1000));
+	LB_CHECK_EQUAL(1220, LbSeqTrackerMapSeq(&tracker, 1200));
+}
+
+LB_TEST(WrapsAroundSequenceSpace)
+{
+	LB_SEQ_TRACKER tracker;
+	LbSeqTrackerInitialize(&tracker);
+
+	UINT32 start = 0xFFFFFFC0;
+	LbSeqTrackerRecord(&tracker, start, 100, 90);
+
+	LB_CHECK_EQUAL((UINT32)(start + 90), LbSeqTrackerMapSeq(&tracker, start + 100));
+	LB_CHECK_EQUAL((UINT32)(start + 100), LbSeqTrackerMapAck(&tracker, start + 90));
+	LB_CHECK(LbSeqTrackerIsRetransmission(&tracker, start));
+	LB_CHECK(!LbSeqTrackerIsRetransmission(&tracker, start + 100));
+}
+
+LB_TEST(RandomStreamsMatchARunningTotal)
+{
+	std::mt19937 rng(LbTestSeed());
+
+	for (int round = 0; round < 200; round++)
+	{
+		LB_SEQ_TRACKER tracker;
+		LbSeqTrackerInitialize(&tracker);
+
+		// Original and rewritten start of every segment sent so far
+		std::vector<UINT32> original;
+		std::vector<UINT32> rewritten;
+		UINT32 seq = rng();
+		UINT32 mapped = seq;
+
+		// Far more changes than the tracker remembers, acknowledgements only ever cover recent data
+		for (int n = 0; n < 100; n++)
+		{
+			UINT32 length = 1 + rng() % 1460;
+			INT32 change = rng() % 3 == 0 ? (INT32)(rng() % 41) - 20 : 0;
+			UINT32 newLength = (INT32)length + change > 0 ? length + change : 1;
+
+			if (!LB_CHECK_EQUAL(mapped, LbSeqTrackerMapSeq(&tracker, seq)))
+				break;
+			LbSeqTrackerRecord(&tracker, seq, length, newLength);
+
+			original.push_back(seq);
+			rewritten.push_back(mapped);
+			seq += length;
+			mapped += newLength;
+
+			// A resent segment is recognized and moves nothing
+			if (rng() % 5 == 0)
+			{
+				size_t back = original.size() - 1 - rng() % std::min<size_t>(original.size(), 4);
+				LB_CHECK(LbSeqTrackerIsRetransmission(&tracker, original[back]));
+				LB_CHECK_EQUAL(rewritten[back], LbSeqTrackerMapSeq(&tracker, original[back]));
+				LbSeqTrackerRecord(&tracker, original[back], 10, 20);
+			}
+
+			// The receiver acknowledging everything so far, or the start of a recent segment
+			LB_CHECK_EQUAL(seq, LbSeqTrackerMapAck(&tracker, mapped));
+			size_t recent = original.size() - 1 - rng() % std::min<size_t>(original.size(), LB_SEQ_TRACKER_EDITS / 2);
+			LB_CHECK_EQUAL(original[recent], LbSeqTrackerMapAck(&tracker, rewritten[recent]));
+		}
+	}
+}
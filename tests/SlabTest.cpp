@@ -0,0 +1,142 @@
+/*/
+/*  ** SlabTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the per-processor object caches: reuse, the depth bound, alignment, and
+/*	threads taking and returning objects at once without ever sharing one.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "Slab.h"
+#include <atomic>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(RejectsBadParameters)
+{
+	LB_SLAB* slab = NULL;
+
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbSlabCreate(0, 8, 'LBT0', &slab));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbSlabCreate(64, LB_SLAB_MAX_DEPTH + 1, 'LBT0', &slab));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbSlabCreate(64, 8, 'LBT0', NULL));
+}
+
+LB_TEST(ReusesTheLastObjectReturned)
+{
+	LB_SLAB* slab = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbSlabCreate(200, 8, 'LBT0', &slab)))
+		return;
+
+	void* first = LbSlabAlloc(slab);
+	void* second = LbSlabAlloc(slab);
+	LB_CHECK(first != NULL && second != NULL && first != second);
+	LB_CHECK_EQUAL(0, (UINT64)first % 64);
+
+	LbSlabFree(slab, first);
+	LbSlabFree(slab, second);
+	LB_CHECK(LbSlabAlloc(slab) == second);
+	LB_CHECK(LbSlabAlloc(slab) == first);
+
+	LbSlabFree(slab, first);
+	LbSlabFree(slab, second);
+	LbSlabFree(slab, NULL);
+	LbSlabDestroy(slab);
+}
+
+LB_TEST(KeepsNoMoreThanItsDepth)
+{
+	const UINT32 depth = 4;
+	LB_SLAB* slab = NULL;
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbSlabCreate(64, depth, 'LBT0', &slab)))
+		return;
+
+	std::vector<void*> objects;
+	for (UINT32 i = 0; i < depth * 3; i++)
+		objects.push_back(LbSlabAlloc(slab));
+	for (void* object : objects)
+		LbSlabFree(slab, object);
+
+	// The first depth objects returned are cached, the rest went back to the pool
+	std::set<void*> cached(objects.begin(), objects.begin() + depth);
+	UINT32 reused = 0;
+	std::vector<void*> again;
+
+	for (UINT32 i = 0; i < depth * 3; i++)
+	{
+		again.push_back(LbSlabAlloc(slab));
+		reused += i < depth && cached.count(again.back()) != 0;
+	}
+	LB_CHECK_EQUAL(depth, reused);
+
+	for (void* object : again)
+		LbSlabFree(slab, object);
+	LbSlabDestroy(slab);
+}
+
+LB_TEST(ThreadsNeverShareAnObject)
+{
+	const UINT32 threadCount = 6;
+	const UINT32 rounds = 200000;
+	const SIZE_T objectSize = 128;
+	std::atomic<UINT64> wrong(0);
+	std::vector<std::thread> threads;
+	LB_SLAB* slab = NULL;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbSlabCreate(objectSize, 16, 'LBT0', &slab)))
+		return;
+
+	// Each thread stamps what it holds with its own id, a stamp changed by anyone else is a shared object
+	for (UINT32 t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([&, t]() {
+			std::mt19937 rng(LbTestSeed() + t);
+			std::vector<UINT64*> held;
+
+			for (UINT32 round = 0; round < rounds; round++)
+			{
+				if (held.empty() || (held.size() < 40 && rng() % 2 == 0))
+				{
+					UINT64* object = (UINT64*)LbSlabAlloc(slab);
+					if (!object)
+						continue;
+					for (SIZE_T i = 0; i < objectSize / sizeof(UINT64); i++)
+						object[i] = ((UINT64)t << 32) | round;
+					held.push_back(object);
+				}
+				else
+				{
+					size_t index = rng() % held.size();
+					UINT64* object = held[index];
+					UINT64 stamp = object[0];
+
+					for (SIZE_T i = 0; i < objectSize / sizeof(UINT64); i++)
+						wrong += object[i] != stamp || (stamp >> 32) != t;
+
+					held[index] = held.back();
+					held.pop_back();
+					LbSlabFree(slab, object);
+				}
+			}
+
+			for (UINT64* object : held)
+				LbSlabFree(slab, object);
+		});
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	LB_CHECK_EQUAL(0, wrong.load());
+	LbSlabDestroy(slab);
+}
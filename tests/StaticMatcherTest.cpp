@@ -0,0 +1,348 @@
+/*/
+/*  ** StaticMatcherTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the matchers built at compile time. Each list below is compiled both ways: the
+/*	LB_MATCHER block the compiler lays out has to hold what LbMatcherCompile builds from UserData(), and
+/*	over random data cut into buffers Replace() has to leave the same bytes, replacement counts, automaton
+/*	state and checksum edits as LbMatcherReplace on that block, which in turn has to match the reference.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "LbReference.h"
+#include "StaticMatcher.h"
+#include "RuleSet.h"
+#include "ClassifyCore.h"
+#include <algorithm>
+
+////////////////
+// RULE LISTS //
+////////////////
+
+// The pairs every driver build starts with, see LbInjectionInitialize
+struct LB_TEST_BUILTIN
+{
+	static constexpr LB_STATIC_RULES<3> Get()
+	{
+		return { true, { { "Love", "Hate" }, { "Alice", "Trudy" }, { "Rob", "Bob" } } };
+	}
+};
+
+// Patterns inside of other patterns and a pair claimed twice, only the automaton can scan them
+struct LB_TEST_OVERLAPPING
+{
+	static constexpr LB_STATIC_RULES<4> Get()
+	{
+		return { false, { { "he", "HE" }, { "she", "SHE" }, { "hers", "HERS" }, { "she", "XXX" } } };
+	}
+};
+
+// Pairs that change the length, which a scan in place notices but leaves alone
+struct LB_TEST_UNEQUAL
+{
+	static constexpr LB_STATIC_RULES<3> Get()
+	{
+		return { true, { { "cat", "lion" }, { "dog", "cow" }, { "ox", "yak" } } };
+	}
+};
+
+// Patterns as long as a whole word
+struct LB_TEST_EIGHT
+{
+	static constexpr LB_STATIC_RULES<3> Get()
+	{
+		return { true, { { "abcdefgh", "ABCDEFGH" }, { "hgfedcba", "HGFEDCBA" }, { "bbbbbbbb", "aaaaaaaa" } } };
+	}
+};
+
+// More states than a byte holds
+struct LB_TEST_WIDE
+{
+	static constexpr LB_STATIC_RULES<30> Get()
+	{
+		return { true, {
+			{ "abandon", "ABANDON" }, { "balance", "BALANCE" }, { "cabinet", "CABINET" }, { "dancing", "DANCING" },
+			{ "eastern", "EASTERN" }, { "fabrics", "FABRICS" }, { "gallery", "GALLERY" }, { "habitat", "HABITAT" },
+			{ "iceberg", "ICEBERG" }, { "jackets", "JACKETS" }, { "kingdom", "KINGDOM" }, { "lantern", "LANTERN" },
+			{ "machine", "MACHINE" }, { "natural", "NATURAL" }, { "oatmeal", "OATMEAL" }, { "package", "PACKAGE" },
+			{ "quality", "QUALITY" }, { "raccoon", "RACCOON" }, { "sailing", "SAILING" }, { "tactics", "TACTICS" },
+			{ "unicorn", "UNICORN" }, { "vaccine", "VACCINE" }, { "walnuts", "WALNUTS" }, { "xylitol", "XYLITOL" },
+			{ "yellows", "YELLOWS" }, { "zealous", "ZEALOUS" }, { "harbour", "HARBOUR" }, { "mission", "MISSION" },
+			{ "orchard", "ORCHARD" }, { "pattern", "PATTERN" },
+		} };
+	}
+};
+
+typedef LB_STATIC_MATCHER<LB_TEST_BUILTIN> LB_TEST_BUILTIN_MATCHER;
+typedef LB_STATIC_MATCHER<LB_TEST_OVERLAPPING> LB_TEST_OVERLAPPING_MATCHER;
+typedef LB_STATIC_MATCHER<LB_TEST_UNEQUAL> LB_TEST_UNEQUAL_MATCHER;
+typedef LB_STATIC_MATCHER<LB_TEST_EIGHT> LB_TEST_EIGHT_MATCHER;
+typedef LB_STATIC_MATCHER<LB_TEST_WIDE> LB_TEST_WIDE_MATCHER;
+
+// Built by the compiler, these fail the build rather than the test
+static_assert(LB_TEST_BUILTIN_MATCHER::block.header.patternCount == 6, "builtin pairs reverse into 6 patterns");
+static_assert(LB_TEST_BUILTIN_MATCHER::block.header.minMatchLength == 3, "Rob is the shortest match");
+static_assert(LB_TEST_BUILTIN_MATCHER::block.transitions['L'] != LB_MATCHER_ROOT_STATE, "L starts a pattern");
+
+/////////////
+// HELPERS //
+/////////////
+
+// The list as reference pairs, through UserData() as the runtime engine gets it
+template <typename MATCHER>
+static LB_REFERENCE_PAIRS LbTestPairs()
+{
+	LB_MATCH_AND_REPLACE list[MATCHER::pairCount];
+	LB_USERDATA ud;
+	LB_REFERENCE_PAIRS pairs;
+
+	MATCHER::UserData(list, &ud);
+	for (int i = 0; i < ud.count; i++)
+		pairs.Add(ud.strArray[i].match, ud.strArray[i].replace);
+	pairs.reversal = ud.enableReversal;
+
+	return pairs;
+}
+
+// Data full of the list's patterns, whole and cut short, between bytes the patterns use and a few they do not
+static std::string LbTestData(std::mt19937& rng, const LB_REFERENCE_PAIRS& pairs, size_t length)
+{
+	std::string alphabet = " .x";
+	std::string data;
+
+	for (size_t i = 0; i < pairs.match.size(); i++)
+		alphabet += pairs.match[i] + pairs.replace[i];
+
+	while (data.size() < length)
+	{
+		UINT32 kind = rng() % 4;
+		size_t i = rng() % pairs.match.size();
+		const std::string& pattern = rng() % 2 ? pairs.match[i] : pairs.replace[i];
+
+		if (kind == 0)
+			data += pattern;
+		else if (kind == 1)
+			data += pattern.substr(0, 1 + rng() % pattern.size());
+		else
+			data += LbReferenceString(rng, alphabet, 1 + rng() % 12);
+	}
+
+	data.resize(length);
+	return data;
+}
+
+static std::vector<size_t> LbTestCuts(std::mt19937& rng, size_t length, size_t count)
+{
+	std::vector<size_t> cuts;
+
+	for (size_t n = 0; n < count && length > 1; n++)
+		cuts.push_back(1 + rng() % (length - 1));
+	std::sort(cuts.begin(), cuts.end());
+	cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+	return cuts;
+}
+
+// One in place scan of data cut at cuts, with every earlier buffer at hand
+struct LB_TEST_SCAN
+{
+	std::string data;
+	UINT32 replacements = 0;
+	std::vector<UINT32> states;		// After each buffer
+	UINT16 checksum = 0;			// 0x1234 patched for the edits
+};
+
+template <typename SCAN>
+static LB_TEST_SCAN LbTestScan(const std::string& data, const std::vector<size_t>& cuts, SCAN scan)
+{
+	LB_TEST_SCAN result;
+	LB_MATCHER_SPANS spans;
+	LB_CHECKSUM_EDITS edits;
+	UINT32 state = LB_MATCHER_ROOT_STATE;
+	size_t start = 0;
+
+	result.data = data;
+	LbMatcherSpansBegin(&spans);
+	LbChecksumEditsBegin(&edits, 0);
+
+	for (size_t n = 0; n <= cuts.size(); n++)
+	{
+		size_t end = n < cuts.size() ? cuts[n] : data.size();
+		UINT8* buffer = (UINT8*)&result.data[start];
+
+		edits.base = start;
+		result.replacements += scan(&state, buffer, end - start, &spans, &edits);
+		LbMatcherSpansAdd(&spans, buffer, end - start, start);
+		result.states.push_back(state);
+		start = end;
+	}
+
+	result.checksum = LbChecksumApplyEdits(0x1234, &edits);
+	return result;
+}
+
+// Everything the compiler built against what LbMatcherCompile builds from the same list, then all three
+// scans against each other and the reference over rounds of random data
+template <typename MATCHER>
+static void LbTestAgainstRuntime(UINT32 rounds)
+{
+	std::mt19937 rng(LbTestSeed());
+	LB_REFERENCE_PAIRS pairs = LbTestPairs<MATCHER>();
+	LB_USERDATA ud = pairs.UserData();
+	const LB_MATCHER* fixed = MATCHER::Matcher();
+	LB_MATCHER* runtime = NULL;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbMatcherCompile(&ud, &runtime)))
+		return;
+
+	LB_CHECK_EQUAL(LB_MATCHER_ENGINE_AUTOMATON, fixed->engine);
+	LB_CHECK_EQUAL(sizeof(typename MATCHER::BLOCK), fixed->size);
+	LB_CHECK_EQUAL(runtime->patternCount, fixed->patternCount);
+	LB_CHECK_EQUAL(runtime->minMatchLength, fixed->minMatchLength);
+	LB_CHECK_EQUAL(runtime->maxReplaceLength, fixed->maxReplaceLength);
+	LB_CHECK_EQUAL(runtime->equalLength != 0, fixed->equalLength != 0);
+	LB_CHECK_EQUAL(runtime->firstByteCount, fixed->firstByteCount);
+	LB_CHECK(memcmp(runtime->firstByteMap, fixed->firstByteMap, sizeof(fixed->firstByteMap)) == 0);
+	LB_CHECK(fixed->stateCount <= MATCHER::maxStates);
+	LB_CHECK(sizeof(typename MATCHER::STATE) == 4 || fixed->stateCount <= (1u << (8 * sizeof(typename MATCHER::STATE))));
+
+	// Both number the patterns alike and point at the same bytes
+	const LB_MATCHER_PATTERN* fixedPatterns = (const LB_MATCHER_PATTERN*)((const UINT8*)fixed + fixed->patternOffset);
+	const LB_MATCHER_PATTERN* runtimePatterns = (const LB_MATCHER_PATTERN*)((const UINT8*)runtime + runtime->patternOffset);
+	for (UINT32 p = 0; p < fixed->patternCount && p < runtime->patternCount; p++)
+	{
+		const LB_MATCHER_PATTERN& a = fixedPatterns[p];
+		const LB_MATCHER_PATTERN& b = runtimePatterns[p];
+
+		LB_CHECK_EQUAL(b.matchLength, a.matchLength);
+		LB_CHECK_EQUAL(b.replaceLength, a.replaceLength);
+		LB_CHECK(memcmp((const UINT8*)fixed + a.matchOffset, (const UINT8*)runtime + b.matchOffset, a.matchLength) == 0);
+		LB_CHECK(memcmp((const UINT8*)fixed + a.replaceOffset, (const UINT8*)runtime + b.replaceOffset, a.replaceLength) == 0);
+	}
+
+	UINT32 wrong = 0;
+	UINT32 replaced = 0;
+
+	for (UINT32 round = 0; round < rounds; round++)
+	{
+		std::string data = LbTestData(rng, pairs, rng() % 4 == 0 ? rng() % 24 : rng() % 1500);
+		std::vector<size_t> cuts = LbTestCuts(rng, data.size(), rng() % 2 ? 0 : rng() % 12);
+		UINT32 expected = 0;
+		std::string reference = LbReferenceRewrite(pairs, data, cuts, true, true, &expected);
+
+		LB_TEST_SCAN compiled = LbTestScan(data, cuts, [&](UINT32* state, UINT8* buffer, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits) {
+			return LbMatcherReplace(runtime, state, buffer, length, spans, edits);
+		});
+		LB_TEST_SCAN block = LbTestScan(data, cuts, [&](UINT32* state, UINT8* buffer, SIZE_T length, const LB_MATCHER_SPANS* spans, LB_CHECKSUM_EDITS* edits) {
+			return LbMatcherReplace(fixed, state, buffer, length, spans, edits);
+		});
+		LB_TEST_SCAN specialized = LbTestScan(data, cuts, MATCHER::Replace);
+
+		// The runtime engine numbers its states another way, only whether it is at the root compares
+		wrong += compiled.data != reference || compiled.replacements != expected;
+		wrong += block.data != reference || block.replacements != expected || block.checksum != compiled.checksum;
+		wrong += specialized.data != reference || specialized.replacements != expected || specialized.checksum != compiled.checksum;
+		wrong += specialized.states != block.states;
+		for (size_t n = 0; n < compiled.states.size(); n++)
+			wrong += (compiled.states[n] == LB_MATCHER_ROOT_STATE) != (block.states[n] == LB_MATCHER_ROOT_STATE);
+
+		replaced += expected;
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK(replaced > rounds);
+
+	LbMatcherFree(runtime);
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(BuiltinPairsMatchTheRuntimeEngine)
+{
+	LB_CHECK(LB_TEST_BUILTIN_MATCHER::unrolled);
+	LB_CHECK_EQUAL(1, sizeof(LB_TEST_BUILTIN_MATCHER::STATE));
+	LbTestAgainstRuntime<LB_TEST_BUILTIN_MATCHER>(20000);
+}
+
+LB_TEST(OverlappingPatternsMatchTheRuntimeEngine)
+{
+	LB_CHECK(!LB_TEST_OVERLAPPING_MATCHER::unrolled);
+	LbTestAgainstRuntime<LB_TEST_OVERLAPPING_MATCHER>(20000);
+}
+
+LB_TEST(UnequalPairsMatchTheRuntimeEngine)
+{
+	LB_CHECK(!LB_TEST_UNEQUAL_MATCHER::unrolled);
+	LB_CHECK_EQUAL(0, LB_TEST_UNEQUAL_MATCHER::Matcher()->equalLength);
+	LbTestAgainstRuntime<LB_TEST_UNEQUAL_MATCHER>(20000);
+}
+
+LB_TEST(WordLongPatternsMatchTheRuntimeEngine)
+{
+	LB_CHECK(LB_TEST_EIGHT_MATCHER::unrolled);
+	LbTestAgainstRuntime<LB_TEST_EIGHT_MATCHER>(20000);
+}
+
+LB_TEST(WideStatesMatchTheRuntimeEngine)
+{
+	LB_CHECK(LB_TEST_WIDE_MATCHER::unrolled);
+	LB_CHECK_EQUAL(2, sizeof(LB_TEST_WIDE_MATCHER::STATE));
+	LB_CHECK(LB_TEST_WIDE_MATCHER::Matcher()->stateCount > 256);
+	LbTestAgainstRuntime<LB_TEST_WIDE_MATCHER>(5000);
+}
+
+LB_TEST(RuleSetScansWithTheSpecializedMatcher)
+{
+	LB_PORT_RULE ports[] = { { 27015, 27015, LB_RULE_ACTION_INSPECT, LB_RULE_DIRECTION_OUTBOUND, 0 } };
+	LB_RULESET* ruleSet = NULL;
+
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetCompileStatic(NULL, 0, ports, 1, NULL, LB_TEST_BUILTIN_MATCHER::Replace, &ruleSet));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbRuleSetCompileStatic(NULL, 0, ports, 1, LB_TEST_BUILTIN_MATCHER::Matcher(), NULL, &ruleSet));
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetCompileStatic(NULL, 0, ports, 1,
+		LB_TEST_BUILTIN_MATCHER::Matcher(), LB_TEST_BUILTIN_MATCHER::Replace, &ruleSet)))
+		return;
+
+	// The tables stay in read-only data, the same pairs compiled at runtime take the automaton's bytes more
+	LB_CHECK(ruleSet->matcher == LB_TEST_BUILTIN_MATCHER::Matcher());
+	LB_CHECK(ruleSet->replace == LB_TEST_BUILTIN_MATCHER::Replace);
+
+	LB_REFERENCE_PAIRS pairs = LbTestPairs<LB_TEST_BUILTIN_MATCHER>();
+	LB_USERDATA ud = pairs.UserData();
+	LB_RULESET* compiled = NULL;
+	if (LB_CHECK_EQUAL(STATUS_SUCCESS, LbRuleSetCompile(NULL, 0, ports, 1, &ud, 0, &compiled)))
+	{
+		LB_CHECK(compiled->replace == NULL);
+		LB_CHECK(compiled->bytes >= ruleSet->bytes + compiled->matcher->size);
+		LbRuleSetFree(compiled);
+	}
+
+	// The callout's scan goes through replace, "Love" split over two buffers included
+	std::string payload = "I Love Alice but Hate Bob and Rob. Trudy";
+	LB_FLOW_KEY key = {};
+	key.protocol = LB_IPPROTO_TCP;
+	key.direction = LB_DIRECTION_OUTBOUND;
+	key.family = LB_FAMILY_IPV4;
+
+	LB_SCAN_CONTEXT scan = {};
+	scan.key = &key;
+	scan.matcher = ruleSet->matcher;
+	scan.replace = ruleSet->replace;
+	scan.state = LB_MATCHER_ROOT_STATE;
+
+	LbScanSegment(&scan, 0, payload.size());
+	LbScanBuffer(&scan, (UINT8*)&payload[0], 4);
+	LbScanBuffer(&scan, (UINT8*)&payload[4], payload.size() - 4);
+
+	LB_CHECK(payload == "I Hate Trudy but Love Rob and Bob. Alice");
+	LB_CHECK_EQUAL(6, scan.replacements);
+
+	LbRuleSetFree(ruleSet);
+}
@@ -0,0 +1,125 @@
+/*/
+/*  ** StatsTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the classify path statistics: histogram buckets against the layout IOCTL readers
+/*	rely on, the sampling interval, tick conversion without overflow, and snapshots adding up every processor.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "Stats.h"
+#include <initializer_list>
+#include <thread>
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(HistogramBucketsFollowTheDocumentedLayout)
+{
+	UINT32 wrong = 0;
+
+	// Bucket i below 4 holds i, every other bucket starts at (4 + i % 4) << (i / 4 - 1)
+	for (UINT32 bucket = 0; bucket < LB_HISTOGRAM_BUCKETS - 1; bucket++)
+	{
+		UINT64 first = bucket < 4 ? bucket : (UINT64)(4 + bucket % 4) << (bucket / 4 - 1);
+		if (first >> 32)
+			break;
+
+		wrong += LbHistogramBucket(first) != bucket;
+		wrong += first > 0 && LbHistogramBucket(first - 1) != bucket - 1;
+	}
+	LB_CHECK_EQUAL(0, wrong);
+
+	// Never decreasing, and everything too large lands in the last bucket
+	UINT32 previous = 0;
+	for (UINT64 value = 1; value < ((UINT64)1 << 40); value += value / 7 + 1)
+	{
+		UINT32 bucket = LbHistogramBucket(value);
+		wrong += bucket < previous || bucket >= LB_HISTOGRAM_BUCKETS;
+		previous = bucket;
+	}
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK_EQUAL(LB_HISTOGRAM_BUCKETS - 1, LbHistogramBucket(~(UINT64)0));
+}
+
+LB_TEST(SamplesOneCallInTheInterval)
+{
+	LB_STATS_PROCESSOR stats = {};
+	UINT32 sampled = 0;
+
+	for (UINT32 i = 0; i < LB_STATS_SAMPLE_INTERVAL * 100; i++)
+		sampled += LbStatsSample(&stats);
+
+	LB_CHECK_EQUAL(100, sampled);
+	LB_CHECK(!LbStatsSample(NULL));
+
+	// Counting without statistics is allowed and does nothing
+	LbStatsCount(NULL, LB_COUNTER_PACKETS);
+}
+
+LB_TEST(TicksConvertWithoutOverflow)
+{
+	UINT64 frequency = LbTimestampFrequency();
+	UINT64 cyclesPerSecond = 3000000000ull;
+	UINT32 wrong = 0;
+
+	for (UINT64 ticks : { (UINT64)0, (UINT64)1, frequency - 1, frequency, frequency * 3600 + 12345, (UINT64)1 << 62 })
+	{
+		unsigned __int128 expected = (unsigned __int128)ticks * cyclesPerSecond / frequency;
+		wrong += LbStatsTicksToCycles(ticks, cyclesPerSecond) != (UINT64)expected;
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+}
+
+LB_TEST(SnapshotAddsUpEveryProcessor)
+{
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbStatsInitialize()))
+		return;
+
+	UINT32 processors = LbProcessorCount();
+	for (UINT32 i = 0; i < processors; i++)
+	{
+		LB_STATS_PROCESSOR* stats = &lbStatsProcessors[i];
+		LbStatsCount(stats, LB_COUNTER_PACKETS, 10 + i);
+		LbStatsCount(stats, LB_COUNTER_BYTES_SCANNED, 1460);
+		LbStatsRecord(stats, LB_STAGE_LOOKUP, 100);
+		LbStatsRecord(stats, LB_STAGE_CLASSIFY, 1000 + i);
+	}
+
+	// The current processor's own statistics, as the classify path records them
+	LB_STATS_PROCESSOR* current = LbStatsCurrent();
+	LB_CHECK(current != NULL);
+	LbStatsCount(current, LB_COUNTER_BLOCKED);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+	LB_STATS_SNAPSHOT snapshot;
+	LbStatsSnapshot(&snapshot);
+
+	LB_CHECK_EQUAL((UINT64)processors * 10 + (UINT64)processors * (processors - 1) / 2, snapshot.counters[LB_COUNTER_PACKETS]);
+	LB_CHECK_EQUAL((UINT64)processors * 1460, snapshot.counters[LB_COUNTER_BYTES_SCANNED]);
+	LB_CHECK_EQUAL(1, snapshot.counters[LB_COUNTER_BLOCKED]);
+	LB_CHECK_EQUAL(processors, snapshot.histograms[LB_STAGE_LOOKUP][LbHistogramBucket(100)]);
+	LB_CHECK_EQUAL(LB_STATS_SAMPLE_INTERVAL, snapshot.sampleInterval);
+
+	UINT64 total = 0;
+	for (UINT32 bucket = 0; bucket < LB_HISTOGRAM_BUCKETS; bucket++)
+		total += snapshot.histograms[LB_STAGE_CLASSIFY][bucket];
+	LB_CHECK_EQUAL(processors, total);
+
+	// Measured over the sleep, any processor of the last decades runs between 100 MHz and 10 GHz
+	LB_CHECK(snapshot.cyclesPerSecond > 100000000ull && snapshot.cyclesPerSecond < 10000000000ull);
+
+	LbStatsCleanup();
+	LB_CHECK(LbStatsCurrent() == NULL);
+
+	LbStatsSnapshot(&snapshot);
+	LB_CHECK_EQUAL(0, snapshot.counters[LB_COUNTER_PACKETS]);
+}
@@ -0,0 +1,197 @@
+/*/
+/*  ** VerdictCacheTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the per-flow verdict cache: what is kept, what is forgotten, and that readers
+/*	racing writers on other threads only ever see a verdict that was really inserted for their flow.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "VerdictCache.h"
+#include "Classifier.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+static LB_FLOW_KEY LbTestFlow(UINT32 index)
+{
+	LB_FLOW_KEY key = {};
+	key.localAddress = 0x0A000000 | (index >> 8);
+	key.remoteAddress = 0xC0A80001;
+	key.localPort = (UINT16)(1024 + (index & 0xFF));
+	key.remotePort = 443;
+	key.protocol = LB_IPPROTO_TCP;
+	key.direction = LB_DIRECTION_OUTBOUND;
+	key.family = LB_FAMILY_IPV4;
+	return key;
+}
+
+// The only verdict the concurrency test ever inserts for a flow
+static LB_VERDICT LbTestVerdictOf(UINT32 index)
+{
+	return (LB_VERDICT)(LB_VERDICT_PERMIT + index % 3);
+}
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(InsertLookupRemove)
+{
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	LB_FLOW_KEY flow = LbTestFlow(7);
+	LB_FLOW_KEY reply = flow;
+	reply.direction = LB_DIRECTION_INBOUND;
+
+	LB_CHECK_EQUAL(LB_VERDICT_NONE, LbVerdictCacheLookup(&flow));
+
+	LbVerdictCacheInsert(&flow, LB_VERDICT_INSPECT);
+	LB_CHECK_EQUAL(LB_VERDICT_INSPECT, LbVerdictCacheLookup(&flow));
+
+	// Each direction of a flow has its own verdict
+	LB_CHECK_EQUAL(LB_VERDICT_NONE, LbVerdictCacheLookup(&reply));
+	LbVerdictCacheInsert(&reply, LB_VERDICT_PERMIT);
+	LB_CHECK_EQUAL(LB_VERDICT_PERMIT, LbVerdictCacheLookup(&reply));
+	LB_CHECK_EQUAL(LB_VERDICT_INSPECT, LbVerdictCacheLookup(&flow));
+
+	// A new verdict replaces the old one
+	LbVerdictCacheInsert(&flow, LB_VERDICT_BLOCK);
+	LB_CHECK_EQUAL(LB_VERDICT_BLOCK, LbVerdictCacheLookup(&flow));
+
+	LbVerdictCacheRemove(&flow);
+	LB_CHECK_EQUAL(LB_VERDICT_NONE, LbVerdictCacheLookup(&flow));
+	LB_CHECK_EQUAL(LB_VERDICT_PERMIT, LbVerdictCacheLookup(&reply));
+
+	LbVerdictCacheCleanup();
+}
+
+LB_TEST(InvalidateAllForgetsEveryFlow)
+{
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	for (UINT32 i = 0; i < 1000; i++)
+	{
+		LB_FLOW_KEY key = LbTestFlow(i);
+		LbVerdictCacheInsert(&key, LB_VERDICT_PERMIT);
+	}
+
+	LbVerdictCacheInvalidateAll();
+
+	UINT32 hits = 0;
+	for (UINT32 i = 0; i < 1000; i++)
+	{
+		LB_FLOW_KEY key = LbTestFlow(i);
+		hits += LbVerdictCacheLookup(&key) != LB_VERDICT_NONE;
+	}
+	LB_CHECK_EQUAL(0, hits);
+
+	// Verdicts of the new generation are kept again
+	LB_FLOW_KEY key = LbTestFlow(3);
+	LbVerdictCacheInsert(&key, LB_VERDICT_BLOCK);
+	LB_CHECK_EQUAL(LB_VERDICT_BLOCK, LbVerdictCacheLookup(&key));
+
+	LbVerdictCacheCleanup();
+}
+
+LB_TEST(KeepsMostFlowsUpToItsSize)
+{
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	// At one flow for every two buckets, about 1.6% of them land in a bucket two newer flows already filled
+	const UINT32 flows = LB_VERDICT_CACHE_BUCKETS / 2;
+	UINT32 hits = 0;
+
+	for (UINT32 i = 0; i < flows; i++)
+	{
+		LB_FLOW_KEY key = LbTestFlow(i);
+		LbVerdictCacheInsert(&key, LB_VERDICT_PERMIT);
+	}
+	for (UINT32 i = 0; i < flows; i++)
+	{
+		LB_FLOW_KEY key = LbTestFlow(i);
+		hits += LbVerdictCacheLookup(&key) == LB_VERDICT_PERMIT;
+	}
+
+	LB_CHECK(hits > flows * 96 / 100);
+
+	// The flow inserted last is always there
+	LB_FLOW_KEY last = LbTestFlow(flows - 1);
+	LB_CHECK_EQUAL(LB_VERDICT_PERMIT, LbVerdictCacheLookup(&last));
+
+	LbVerdictCacheCleanup();
+}
+
+LB_TEST(ReadersRacingWritersSeeNoWrongVerdict)
+{
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbVerdictCacheInitialize()))
+		return;
+
+	// Far more flows than entries, so writers keep evicting each other in the same buckets
+	const UINT32 flows = LB_VERDICT_CACHE_BUCKETS * 4;
+	const UINT32 readers = 3;
+	const UINT32 writers = 2;
+	std::atomic<bool> stop(false);
+	std::atomic<UINT64> wrong(0);
+	std::atomic<UINT64> hits(0);
+	std::vector<std::thread> threads;
+
+	for (UINT32 w = 0; w < writers; w++)
+	{
+		threads.emplace_back([&, w]() {
+			UINT32 index = w;
+			while (!stop.load())
+			{
+				index = (index * 2654435761u + 1) % flows;
+				LB_FLOW_KEY key = LbTestFlow(index);
+				if (index % 7 == 0)
+					LbVerdictCacheRemove(&key);
+				else
+					LbVerdictCacheInsert(&key, LbTestVerdictOf(index));
+				if (index % 4099 == 0)
+					LbVerdictCacheInvalidateAll();
+			}
+		});
+	}
+
+	for (UINT32 r = 0; r < readers; r++)
+	{
+		threads.emplace_back([&, r]() {
+			for (UINT32 round = 0; round < 2000000; round++)
+			{
+				UINT32 index = (round * 40503u + r) % flows;
+				LB_FLOW_KEY key = LbTestFlow(index);
+				LB_VERDICT verdict = LbVerdictCacheLookup(&key);
+				if (verdict != LB_VERDICT_NONE)
+				{
+					hits++;
+					if (verdict != LbTestVerdictOf(index))
+						wrong++;
+				}
+			}
+		});
+	}
+
+	for (UINT32 r = 0; r < readers; r++)
+		threads[writers + r].join();
+	stop = true;
+	for (UINT32 w = 0; w < writers; w++)
+		threads[w].join();
+
+	LB_CHECK_EQUAL(0, wrong.load());
+	LB_CHECK(hits.load() > 0);
+
+	LbVerdictCacheCleanup();
+}
@@ -0,0 +1,205 @@
+/*/
+/*  ** WorkQueueTest.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the tests of the work queues between the classify path and the worker threads: the bounds of a
+/*	lane, the order items come off it, the wake up hint, the spread of flows over lanes, and every item of
+/*	every flow arriving once and in order with several producers and a worker per lane.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbTest.h"
+#include "WorkQueue.h"
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+/////////////
+// HELPERS //
+/////////////
+
+// A queued segment, the work item comes first so an item pointer is a segment pointer
+struct LB_TEST_SEGMENT
+{
+	LB_WORK_ITEM work;
+	UINT32 flow;
+	UINT32 sequence;			// Position of the segment in its flow
+};
+
+///////////
+// TESTS //
+///////////
+
+LB_TEST(CreateRejectsBadArguments)
+{
+	LB_WORK_QUEUE* queue = NULL;
+
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbWorkQueueCreate(0, 16, 'LBT0', &queue));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbWorkQueueCreate(4, 0, 'LBT0', &queue));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbWorkQueueCreate(4, LB_WORK_QUEUE_MAX_CAPACITY + 1, 'LBT0', &queue));
+	LB_CHECK_EQUAL(STATUS_INVALID_PARAMETER, LbWorkQueueCreate(4, 16, 'LBT0', NULL));
+	LB_CHECK(queue == NULL);
+
+	LB_CHECK_EQUAL(STATUS_SUCCESS, LbWorkQueueCreate(4, LB_WORK_QUEUE_MAX_CAPACITY, 'LBT0', &queue));
+	LbWorkQueueDestroy(queue);
+}
+
+LB_TEST(LaneIsBoundedAndOldestFirst)
+{
+	const UINT32 capacity = 64;
+	std::vector<LB_TEST_SEGMENT> segments(capacity + 1);
+	LB_WORK_ITEM* items[capacity];
+	LB_WORK_QUEUE* queue = NULL;
+	BOOLEAN wake;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbWorkQueueCreate(2, capacity, 'LBT0', &queue)))
+		return;
+
+	// Only the push onto an idle lane asks for the worker to be woken
+	for (UINT32 i = 0; i < capacity; i++)
+	{
+		segments[i].sequence = i;
+		LB_CHECK(LbWorkQueuePush(queue, 1, &segments[i].work, &wake));
+		LB_CHECK_EQUAL(i == 0, wake);
+	}
+
+	LB_CHECK(!LbWorkQueuePush(queue, 1, &segments[capacity].work, &wake));
+	LB_CHECK_EQUAL(0, LbWorkQueuePop(queue, 0, items, capacity));
+
+	// Batches come off oldest first, a popped item frees its slot
+	UINT32 next = 0;
+	UINT32 wrong = 0;
+	UINT32 count = LbWorkQueuePop(queue, 1, items, 10);
+	LB_CHECK_EQUAL(10, count);
+	for (UINT32 i = 0; i < count; i++)
+		wrong += ((LB_TEST_SEGMENT*)items[i])->sequence != next++;
+
+	segments[capacity].sequence = capacity;
+	LB_CHECK(LbWorkQueuePush(queue, 1, &segments[capacity].work, &wake));
+
+	// What was taken off the stack before still comes ahead of what was pushed since
+	while ((count = LbWorkQueuePop(queue, 1, items, 7)) > 0)
+	{
+		for (UINT32 i = 0; i < count; i++)
+			wrong += ((LB_TEST_SEGMENT*)items[i])->sequence != next++;
+	}
+
+	LB_CHECK_EQUAL(0, wrong);
+	LB_CHECK_EQUAL(capacity + 1, next);
+	LB_CHECK(LbWorkQueuePush(queue, 1, &segments[0].work, &wake));
+	LB_CHECK(wake);
+	LB_CHECK_EQUAL(1, LbWorkQueuePop(queue, 1, items, capacity));
+
+	LbWorkQueueDestroy(queue);
+}
+
+LB_TEST(FlowsKeepTheirLaneAndSpread)
+{
+	const UINT32 laneCount = 8;
+	const UINT32 flowCount = 1024;
+	std::vector<UINT32> perLane(laneCount);
+	LB_WORK_QUEUE* queue = NULL;
+	UINT32 moved = 0;
+
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbWorkQueueCreate(laneCount, 16, 'LBT0', &queue)))
+		return;
+
+	// Flows that only differ in a port spread over every lane, within half of an even share
+	for (UINT64 flow = 0; flow < flowCount; flow++)
+	{
+		UINT64 id = 0x0A0000010A000002ULL ^ (flow << 48 | 80);
+		UINT32 lane = LbWorkQueueLane(queue, id);
+		moved += lane != LbWorkQueueLane(queue, id);
+		perLane[lane]++;
+	}
+
+	LB_CHECK_EQUAL(0, moved);
+	for (UINT32 lane = 0; lane < laneCount; lane++)
+		LB_CHECK(perLane[lane] > flowCount / laneCount / 2 && perLane[lane] < flowCount / laneCount * 3 / 2);
+
+	LbWorkQueueDestroy(queue);
+}
+
+LB_TEST(EveryFlowArrivesOnceAndInOrder)
+{
+	const UINT32 producerCount = 4;
+	const UINT32 laneCount = 4;
+	const UINT32 flowCount = 1024;
+	const UINT32 segmentCount = 800000;
+	std::vector<LB_TEST_SEGMENT> segments(segmentCount);
+	std::vector<UINT32> expected(flowCount);
+	std::vector<std::thread> threads;
+	std::atomic<UINT32> producing(producerCount);
+	std::atomic<UINT64> wrong(0);
+	LB_WORK_QUEUE* queue = NULL;
+
+	// Small lanes, so producers keep running into full ones
+	if (!LB_CHECK_EQUAL(STATUS_SUCCESS, LbWorkQueueCreate(laneCount, 256, 'LBT0', &queue)))
+		return;
+
+	// Each producer owns the flows congruent to it, as a flow is classified on one processor at a time
+	std::mt19937 rng(LbTestSeed());
+	std::vector<UINT32> sent(flowCount);
+	for (LB_TEST_SEGMENT& segment : segments)
+	{
+		segment.flow = rng() % flowCount;
+		segment.sequence = sent[segment.flow]++;
+	}
+
+	for (UINT32 p = 0; p < producerCount; p++)
+	{
+		threads.emplace_back([&, p]() {
+			for (LB_TEST_SEGMENT& segment : segments)
+			{
+				if (segment.flow % producerCount != p)
+					continue;
+
+				UINT32 lane = LbWorkQueueLane(queue, segment.flow);
+				BOOLEAN wake;
+				while (!LbWorkQueuePush(queue, lane, &segment.work, &wake))
+					std::this_thread::yield();
+			}
+			producing--;
+		});
+	}
+
+	// One worker per lane checks that each flow's next segment is the one it expects
+	for (UINT32 lane = 0; lane < laneCount; lane++)
+	{
+		threads.emplace_back([&, lane]() {
+			LB_WORK_ITEM* items[32];
+
+			for (;;)
+			{
+				BOOLEAN done = producing.load() == 0;
+				UINT32 count = LbWorkQueuePop(queue, lane, items, 32);
+
+				for (UINT32 i = 0; i < count; i++)
+				{
+					LB_TEST_SEGMENT* segment = (LB_TEST_SEGMENT*)items[i];
+					if (LbWorkQueueLane(queue, segment->flow) != lane || segment->sequence != expected[segment->flow]++)
+						wrong++;
+				}
+
+				if (count == 0)
+				{
+					if (done)
+						break;
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	LB_CHECK_EQUAL(0, wrong.load());
+	LB_CHECK(expected == sent);
+	LbWorkQueueDestroy(queue);
+}
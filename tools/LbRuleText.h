@@ -0,0 +1,387 @@
+/*/
+/*  ** LbRuleText.h **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Contains the reader for rule files, the text form of an IOCTL_LB_SET_RULES buffer. RuleCompiler turns
+/*	one into a rule image; the tests and benchmarks read them the same way. One directive per line, words
+/*	separated by blanks, and everything from a # outside of quotes to the end of the line is a comment:
+/*
+/*		flags reversal regex async stream		LB_RULES_FLAG_*, any of them
+/*		fields http-headers dns-names			LB_FIELD_*, or all; without it every byte is scanned
+/*		stream-chunk 1460						LB_RULES_HEADER::streamChunk
+/*		stream-lookahead 4						LB_RULES_HEADER::streamLookahead
+/*		budget 16777216							LB_RULES_HEADER::memoryBudget, in bytes
+/*		address 192.168.0.0/16 block inbound	An LB_ADDRESS_RULE, without a prefix length it is one host
+/*		port 1-1023 inspect						An LB_PORT_RULE, a range or a single port
+/*		pair "Love" "Hate"						A match/replace pair
+/*
+/*	Actions are permit, block and inspect. A rule applies to both directions unless it names inbound or
+/*	outbound after its action. Pairs are quoted; \" \\ \r \n \t and \xHH stand for one byte each, any
+/*	other backslash is kept with the character after it, so regular expressions keep their \d and \.
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Ioctl.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+// What a rule file says, in the order it says it
+struct LB_RULE_TEXT
+{
+	LB_RULES_HEADER header;
+	std::vector<LB_ADDRESS_RULE> addressRules;
+	std::vector<LB_PORT_RULE> portRules;
+	std::vector<std::string> strings;	// Match and replace of every pair, one after the other
+};
+
+/////////////
+// HELPERS //
+/////////////
+
+// Value of a hex digit, -1 for any other character
+inline int LbRuleTextHex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// The next word of a line, a quoted one with its escapes taken out. FALSE at the end of the line or
+// at a quote that is never closed, which *broken tells apart.
+inline BOOLEAN LbRuleTextWord(const char** cursor, const char* end, std::string* word, BOOLEAN* quoted, BOOLEAN* broken)
+{
+	const char* c = *cursor;
+
+	while (c < end && (*c == ' ' || *c == '\t' || *c == '\r'))
+		c++;
+	*cursor = c;
+	*broken = FALSE;
+	*quoted = FALSE;
+	word->clear();
+
+	if (c == end || *c == '#')
+		return FALSE;
+
+	if (*c != '"')
+	{
+		while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '#')
+			word->push_back(*c++);
+		*cursor = c;
+		return TRUE;
+	}
+
+	for (c++; c < end && *c != '"'; c++)
+	{
+		if (*c != '\\' || c + 1 == end)
+		{
+			word->push_back(*c);
+			continue;
+		}
+
+		char next = *++c;
+		int high;
+		int low;
+
+		switch (next)
+		{
+		case '"':
+		case '\\':
+			word->push_back(next);
+			break;
+		case 'r':
+			word->push_back('\r');
+			break;
+		case 'n':
+			word->push_back('\n');
+			break;
+		case 't':
+			word->push_back('\t');
+			break;
+		case 'x':
+			high = c + 1 < end ? LbRuleTextHex(c[1]) : -1;
+			low = c + 2 < end ? LbRuleTextHex(c[2]) : -1;
+			if (high < 0 || low < 0)
+			{
+				*broken = TRUE;
+				return FALSE;
+			}
+			word->push_back((char)(high << 4 | low));
+			c += 2;
+			break;
+		default:
+			word->push_back('\\');
+			word->push_back(next);
+			break;
+		}
+	}
+
+	if (c == end)
+	{
+		*broken = TRUE;
+		return FALSE;
+	}
+
+	*cursor = c + 1;
+	*quoted = TRUE;
+	return TRUE;
+}
+
+// A decimal number no larger than limit, all of word
+inline BOOLEAN LbRuleTextNumber(const std::string& word, UINT32 limit, UINT32* value)
+{
+	UINT64 result = 0;
+
+	if (word.empty() || word.size() > 10)
+		return FALSE;
+
+	for (char c : word)
+	{
+		if (c < '0' || c > '9')
+			return FALSE;
+		result = result * 10 + (c - '0');
+	}
+
+	if (result > limit)
+		return FALSE;
+
+	*value = (UINT32)result;
+	return TRUE;
+}
+
+// An IPv4 address with an optional /prefix, in host byte order
+inline BOOLEAN LbRuleTextAddress(const std::string& word, UINT32* address, UINT8* prefixLength)
+{
+	size_t slash = word.find('/');
+	std::string dotted = word.substr(0, slash);
+	UINT32 prefix = 32;
+	UINT32 result = 0;
+	size_t start = 0;
+
+	if (slash != std::string::npos && !LbRuleTextNumber(word.substr(slash + 1), 32, &prefix))
+		return FALSE;
+
+	for (int part = 0; part < 4; part++)
+	{
+		size_t dot = part < 3 ? dotted.find('.', start) : dotted.size();
+		UINT32 octet;
+
+		if (dot == std::string::npos || !LbRuleTextNumber(dotted.substr(start, dot - start), 255, &octet))
+			return FALSE;
+
+		result = result << 8 | octet;
+		start = dot + 1;
+	}
+
+	*address = result;
+	*prefixLength = (UINT8)prefix;
+	return TRUE;
+}
+
+// The action and optional direction after a rule's match
+inline BOOLEAN LbRuleTextAction(const std::vector<std::string>& words, size_t first, UINT8* action, UINT8* directions)
+{
+	if (words.size() < first + 1 || words.size() > first + 2)
+		return FALSE;
+
+	if (words[first] == "permit")
+		*action = LB_RULE_ACTION_PERMIT;
+	else if (words[first] == "block")
+		*action = LB_RULE_ACTION_BLOCK;
+	else if (words[first] == "inspect")
+		*action = LB_RULE_ACTION_INSPECT;
+	else
+		return FALSE;
+
+	*directions = LB_RULE_DIRECTION_BOTH;
+	if (words.size() == first + 1)
+		return TRUE;
+
+	if (words[first + 1] == "outbound")
+		*directions = LB_RULE_DIRECTION_OUTBOUND;
+	else if (words[first + 1] == "inbound")
+		*directions = LB_RULE_DIRECTION_INBOUND;
+	else if (words[first + 1] != "both")
+		return FALSE;
+
+	return TRUE;
+}
+
+// A word of a flags or fields directive and the bit it stands for
+struct LB_RULE_TEXT_NAME
+{
+	const char* name;
+	UINT32 value;
+};
+
+// One directive, already split into words
+inline BOOLEAN LbRuleTextDirective(const std::vector<std::string>& words, const std::vector<BOOLEAN>& quoted, LB_RULE_TEXT* rules)
+{
+	static const LB_RULE_TEXT_NAME flagNames[] = {
+		{ "reversal", LB_RULES_FLAG_REVERSAL }, { "regex", LB_RULES_FLAG_REGEX }, { "async", LB_RULES_FLAG_ASYNC }, { "stream", LB_RULES_FLAG_STREAM },
+	};
+	static const LB_RULE_TEXT_NAME fieldNames[] = {
+		{ "http-start-line", LB_FIELD_HTTP_START_LINE }, { "http-headers", LB_FIELD_HTTP_HEADERS }, { "http-body", LB_FIELD_HTTP_BODY },
+		{ "dns-names", LB_FIELD_DNS_NAMES }, { "dns-data", LB_FIELD_DNS_DATA }, { "other", LB_FIELD_OTHER }, { "all", LB_FIELD_ALL },
+	};
+	const std::string& name = words[0];
+
+	// Only pairs take quoted words
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		if (quoted[i] && name != "pair")
+			return FALSE;
+	}
+
+	if (name == "flags" || name == "fields")
+	{
+		BOOLEAN flags = name == "flags";
+		UINT32* target = flags ? &rules->header.flags : &rules->header.fields;
+		const LB_RULE_TEXT_NAME* names = flags ? flagNames : fieldNames;
+		size_t count = flags ? sizeof(flagNames) / sizeof(flagNames[0]) : sizeof(fieldNames) / sizeof(fieldNames[0]);
+
+		for (size_t i = 1; i < words.size(); i++)
+		{
+			UINT32 value = 0;
+			for (size_t n = 0; n < count; n++)
+				value = words[i] == names[n].name ? names[n].value : value;
+
+			if (value == 0)
+				return FALSE;
+			*target |= value;
+		}
+		return words.size() > 1;
+	}
+
+	if (name == "stream-chunk" || name == "stream-lookahead" || name == "budget")
+	{
+		UINT32* target = name == "budget" ? &rules->header.memoryBudget :
+			name == "stream-chunk" ? &rules->header.streamChunk : &rules->header.streamLookahead;
+		return words.size() == 2 && LbRuleTextNumber(words[1], name == "budget" ? 0xFFFFFFFF : LB_STREAM_MAX_CHUNK, target);
+	}
+
+	if (name == "address")
+	{
+		LB_ADDRESS_RULE rule = {};
+		if (words.size() < 2 || !LbRuleTextAddress(words[1], &rule.address, &rule.prefixLength) ||
+			!LbRuleTextAction(words, 2, &rule.action, &rule.directions))
+			return FALSE;
+
+		rules->addressRules.push_back(rule);
+		return TRUE;
+	}
+
+	if (name == "port")
+	{
+		LB_PORT_RULE rule = {};
+		UINT32 first;
+		UINT32 last;
+
+		if (words.size() < 2)
+			return FALSE;
+
+		size_t dash = words[1].find('-');
+		if (!LbRuleTextNumber(words[1].substr(0, dash), 65535, &first))
+			return FALSE;
+		last = first;
+		if (dash != std::string::npos && (!LbRuleTextNumber(words[1].substr(dash + 1), 65535, &last) || last < first))
+			return FALSE;
+		if (!LbRuleTextAction(words, 2, &rule.action, &rule.directions))
+			return FALSE;
+
+		rule.firstPort = (UINT16)first;
+		rule.lastPort = (UINT16)last;
+		rules->portRules.push_back(rule);
+		return TRUE;
+	}
+
+	// Strings go into the buffer NUL terminated, they cannot hold one
+	if (name == "pair")
+	{
+		if (words.size() != 3 || !quoted[1] || !quoted[2] || words[1].empty())
+			return FALSE;
+		if (words[1].find('\0') != std::string::npos || words[2].find('\0') != std::string::npos)
+			return FALSE;
+
+		rules->strings.push_back(words[1]);
+		rules->strings.push_back(words[2]);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+///////////////
+// RULE TEXT //
+///////////////
+
+// Read a rule file of length bytes. A line that is not a directive fails the whole file with
+// STATUS_INVALID_PARAMETER and its number (from 1) in *errorLine.
+inline NTSTATUS LbRuleTextParse(const char* text, SIZE_T length, LB_RULE_TEXT* rules, UINT32* errorLine)
+{
+	const char* end = text + length;
+	UINT32 line = 0;
+
+	memset(&rules->header, 0, sizeof(rules->header));
+	rules->header.version = LB_RULES_VERSION;
+	rules->addressRules.clear();
+	rules->portRules.clear();
+	rules->strings.clear();
+	*errorLine = 0;
+
+	for (const char* start = text; start < end; )
+	{
+		const char* newline = (const char*)memchr(start, '\n', end - start);
+		const char* stop = newline ? newline : end;
+		const char* cursor = start;
+		std::vector<std::string> words;
+		std::vector<BOOLEAN> quoted;
+		std::string word;
+		BOOLEAN isQuoted;
+		BOOLEAN broken;
+
+		line++;
+		while (LbRuleTextWord(&cursor, stop, &word, &isQuoted, &broken))
+		{
+			words.push_back(word);
+			quoted.push_back(isQuoted);
+		}
+
+		if (broken || (!words.empty() && (quoted[0] || !LbRuleTextDirective(words, quoted, rules))))
+		{
+			*errorLine = line;
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		start = stop + 1;
+	}
+
+	rules->header.addressRuleCount = (UINT32)rules->addressRules.size();
+	rules->header.portRuleCount = (UINT32)rules->portRules.size();
+	rules->header.pairCount = (UINT32)rules->strings.size() / 2;
+	return STATUS_SUCCESS;
+}
+
+// The IOCTL_LB_SET_RULES buffer of what a rule file says, for LbRuleSetParse
+inline std::vector<UINT8> LbRuleTextBuffer(const LB_RULE_TEXT& rules)
+{
+	std::vector<UINT8> buffer((const UINT8*)&rules.header, (const UINT8*)(&rules.header + 1));
+
+	buffer.insert(buffer.end(), (const UINT8*)rules.addressRules.data(), (const UINT8*)(rules.addressRules.data() + rules.addressRules.size()));
+	buffer.insert(buffer.end(), (const UINT8*)rules.portRules.data(), (const UINT8*)(rules.portRules.data() + rules.portRules.size()));
+	for (const std::string& str : rules.strings)
+		buffer.insert(buffer.end(), (const UINT8*)str.c_str(), (const UINT8*)str.c_str() + str.size() + 1);
+
+	return buffer;
+}
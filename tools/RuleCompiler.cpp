@@ -0,0 +1,151 @@
+/*/
+/*  ** RuleCompiler.cpp **
+/*	AUTHOR: Nicholas Tranquilli
+/*
+/*	DESCRIPTION:
+/*	Compiles a rule file (see LbRuleText.h) into a rule image for IOCTL_LB_SET_RULE_IMAGE. The rules are
+/*	checked and built exactly as the driver would build an IOCTL_LB_SET_RULES buffer, with LbRuleSetParse,
+/*	then laid out with LbRuleImageBuild. The image is loaded back before it is written, so a file this
+/*	writes is one the driver accepts.
+/*
+/*		RuleCompiler rules.txt rules.lbri			Write the image
+/*		RuleCompiler --buffer rules.txt rules.bin	Write the IOCTL_LB_SET_RULES buffer instead
+/*		RuleCompiler --check rules.lbri				Load an image and say what is in it
+/*
+/*	ADDITIONAL NOTES:
+/*	This driver and source code is for educational purposes only and was created
+/*	as a final project for Central Connecticut State Universitys CS 492 course.
+/*/
+
+#include "LbRuleText.h"
+#include "RuleImage.h"
+#include <stdio.h>
+
+static BOOLEAN LbReadFile(const char* path, std::vector<UINT8>* data)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return FALSE;
+
+	UINT8 chunk[65536];
+	size_t count;
+	while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		data->insert(data->end(), chunk, chunk + count);
+
+	BOOLEAN ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+static BOOLEAN LbWriteFile(const char* path, const void* data, SIZE_T size)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return FALSE;
+
+	BOOLEAN ok = fwrite(data, 1, size, file) == size;
+	return fclose(file) == 0 && ok;
+}
+
+static void LbDescribe(const LB_RULESET* ruleSet, SIZE_T size)
+{
+	static const char* engines[] = { "automaton", "regex", "hashed" };
+
+	printf("%zu byte image, %zu bytes loaded, %s engine with %u patterns\n", size, ruleSet->bytes,
+		ruleSet->matcher->engine < 3 ? engines[ruleSet->matcher->engine] : "unknown", ruleSet->matcher->patternCount);
+	printf("fields 0x%02X, %s%s, stream chunk %u, lookahead %u\n", ruleSet->fields,
+		ruleSet->stream ? "stream" : "per segment", ruleSet->async ? ", async" : "", ruleSet->streamChunk, ruleSet->streamLookahead);
+}
+
+int main(int argc, char** argv)
+{
+	BOOLEAN buffer = argc == 4 && strcmp(argv[1], "--buffer") == 0;
+	BOOLEAN check = argc == 3 && strcmp(argv[1], "--check") == 0;
+	std::vector<UINT8> input;
+	LB_RULESET* ruleSet = NULL;
+	NTSTATUS status;
+
+	if (argc != 3 + buffer && !check)
+	{
+		fprintf(stderr, "usage: %s [--buffer] rules.txt output\n       %s --check image\n", argv[0], argv[0]);
+		return 2;
+	}
+
+	const char* inputPath = argv[1 + (buffer || check)];
+	if (!LbReadFile(inputPath, &input))
+	{
+		fprintf(stderr, "%s: cannot read\n", inputPath);
+		return 1;
+	}
+
+	if (check)
+	{
+		status = LbRuleSetLoadImage(input.data(), input.size(), &ruleSet);
+		if (!NT_SUCCESS(status))
+		{
+			fprintf(stderr, "%s: not a valid rule image (0x%08X)\n", inputPath, (UINT32)status);
+			return 1;
+		}
+
+		LbDescribe(ruleSet, input.size());
+		LbRuleSetFree(ruleSet);
+		return 0;
+	}
+
+	LB_RULE_TEXT rules;
+	UINT32 line;
+	status = LbRuleTextParse((const char*)input.data(), input.size(), &rules, &line);
+	if (!NT_SUCCESS(status))
+	{
+		fprintf(stderr, "%s:%u: not a rule\n", inputPath, line);
+		return 1;
+	}
+
+	std::vector<UINT8> rulesBuffer = LbRuleTextBuffer(rules);
+	status = LbRuleSetParse(rulesBuffer.data(), rulesBuffer.size(), &ruleSet);
+	if (!NT_SUCCESS(status))
+	{
+		fprintf(stderr, "%s: the driver would refuse these rules (0x%08X)\n", inputPath, (UINT32)status);
+		return 1;
+	}
+
+	const char* outputPath = argv[argc - 1];
+	if (buffer)
+	{
+		LbRuleSetFree(ruleSet);
+		if (!LbWriteFile(outputPath, rulesBuffer.data(), rulesBuffer.size()))
+		{
+			fprintf(stderr, "%s: cannot write\n", outputPath);
+			return 1;
+		}
+		return 0;
+	}
+
+	void* image = NULL;
+	UINT32 size = 0;
+	LB_RULESET* loaded = NULL;
+
+	status = LbRuleImageBuild(ruleSet, &image, &size);
+	LbRuleSetFree(ruleSet);
+	if (NT_SUCCESS(status))
+		status = LbRuleSetLoadImage(image, size, &loaded);
+	if (!NT_SUCCESS(status))
+	{
+		fprintf(stderr, "%s: no image could be built (0x%08X)\n", inputPath, (UINT32)status);
+		LbRuleImageFree(image);
+		return 1;
+	}
+
+	LbDescribe(loaded, size);
+	LbRuleSetFree(loaded);
+
+	BOOLEAN written = LbWriteFile(outputPath, image, size);
+	LbRuleImageFree(image);
+	if (!written)
+	{
+		fprintf(stderr, "%s: cannot write\n", outputPath);
+		return 1;
+	}
+
+	return 0;
+}